@@ -18,6 +18,15 @@
  *    DES3 encrypt and decrypt (with modes ECB and CBC)
  *    AES encrypt and decrypt (with modes ECB and CBC, with keylength 128, 192,
  *    256), SHA1, SHA256, SHA512
+ *    C_FindObjects (with 100, 1000, 10000, 50000 session objects)
+ *    C_FindObjects with C_GetAttributeValue per object compared to
+ *    C_IBM_FindObjectsGetAttributes (with 50000 session objects)
+ *    C_GetAttributeValue (CK_ULONG, CK_BBOOL and multiple attributes of a key)
+ *    C_EncryptUpdate/C_DecryptUpdate (AES-CBC, AES-OFB, DES3-CBC in 64KB chunks)
+ *    AES-XTS encrypt and decrypt (data units of 512 bytes to 1MB, and
+ *    C_EncryptUpdate/C_DecryptUpdate in 64KB chunks)
+ *    AES-ECB encrypt from 1, 8 and 64 threads with a session per thread
+ *    C_WrapKey/C_UnwrapKey of RSA, EC, Dilithium and Kyber private keys
  */
 
 
@@ -25,6 +34,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <memory.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/time.h>
 
@@ -63,6 +73,65 @@ static inline unsigned long delta_time_us(struct timeval *t1,
     return (d ? d : 1);         // return 1us if delta is 0
 }
 
+/*
+ * Timing statistics of a speed_measure() run. The fastest and the slowest
+ * run are not included in tot_time and avg_time.
+ */
+struct speed_stats {
+    CK_ULONG iterations;
+    CK_ULONG tot_time;
+    CK_ULONG min_time;
+    CK_ULONG max_time;
+    CK_ULONG avg_time;
+};
+
+/*
+ * Calls op iterations + 2 times and measures the time of each call. If
+ * prepare is not NULL, it is called before each call of op, outside of the
+ * measured time. Returns the return code of the first failing call.
+ */
+static CK_RV speed_measure(CK_RV (*prepare)(void *arg),
+                           CK_RV (*op)(void *arg), void *arg,
+                           CK_ULONG iterations, struct speed_stats *stats)
+{
+    SYSTEMTIME t1, t2;
+    CK_ULONG i, diff;
+    CK_RV rc;
+
+    stats->iterations = iterations;
+    stats->tot_time = 0;
+    stats->max_time = 0;
+    stats->min_time = 0xFFFFFFFF;
+
+    for (i = 0; i < iterations + 2; i++) {
+        if (prepare != NULL) {
+            rc = prepare(arg);
+            if (rc != CKR_OK)
+                return rc;
+        }
+
+        GetSystemTime(&t1);
+        rc = op(arg);
+        GetSystemTime(&t2);
+        if (rc != CKR_OK)
+            return rc;
+
+        diff = delta_time_us(&t1, &t2);
+        stats->tot_time += diff;
+        if (diff < stats->min_time)
+            stats->min_time = diff;
+
+        if (diff > stats->max_time)
+            stats->max_time = diff;
+    }
+
+    stats->tot_time -= stats->min_time;
+    stats->tot_time -= stats->max_time;
+    stats->avg_time = stats->tot_time / iterations;
+
+    return CKR_OK;
+}
+
 // keylength: 512, 1024, 2048, 4096
 int do_RSA_PKCS_EncryptDecrypt(int keylength)
 {
@@ -1009,145 +1078,1464 @@ testcase_cleanup:
     return TRUE;
 }
 
-void speed_usage(char *fct)
+struct hmac_data {
+    CK_SESSION_HANDLE session;
+    CK_MECHANISM *mech;
+    CK_OBJECT_HANDLE h_key;
+    CK_BYTE *msg;
+    CK_ULONG msg_len;
+    CK_ULONG calls;
+};
+
+static CK_RV hmac_op(void *arg)
 {
-    printf("usage:  %s -slot <num>", fct);
-    printf(" [-rsa_keygen] [-rsa_signverify]");
-    printf(" [-rsa_endecrypt] [-des3] [-aes] [-sha]");
-    printf(" [-h] \n\n");
+    struct hmac_data *data = arg;
+    CK_BYTE mac[MAX_HASH_LEN];
+    CK_ULONG j, mac_len;
+    CK_RV rc;
 
-    return;
+    for (j = 0; j < data->calls; j++) {
+        rc = funcs->C_SignInit(data->session, data->mech, data->h_key);
+        if (rc != CKR_OK) {
+            testcase_error("C_SignInit rc=%s", p11_get_ckr(rc));
+            return rc;
+        }
+
+        mac_len = sizeof(mac);
+        rc = funcs->C_Sign(data->session, data->msg, data->msg_len,
+                           mac, &mac_len);
+        if (rc != CKR_OK) {
+            testcase_error("C_Sign rc=%s", p11_get_ckr(rc));
+            return rc;
+        }
+    }
+
+    return CKR_OK;
 }
 
-int main(int argc, char **argv)
+// data_len: length of the messages signed with the same HMAC key
+int do_HMAC(CK_MECHANISM_TYPE mech_type, const char *name, CK_ULONG data_len)
 {
-    CK_C_INITIALIZE_ARGS cinit_args;
-    int rc, i;
-    int do_rsa_keygen = 0;
-    int do_rsa_signverify = 0;
-    int do_rsa_endecrypt = 0;
-    int do_des3_endecrypt = 0;
-    int do_aes_endecrypt = 0;
-    int do_sha = 0;
+    CK_SESSION_HANDLE session;
+    CK_FLAGS flags;
+    CK_RV rc;
 
-    SLOT_ID = 1000;
+    CK_MECHANISM key_mech = { CKM_GENERIC_SECRET_KEY_GEN, NULL, 0 };
+    CK_MECHANISM mech = { mech_type, NULL, 0 };
+    CK_ULONG key_len = 32;
+    CK_BBOOL true = TRUE;
+    CK_ATTRIBUTE key_tmpl[] = {
+        {CKA_SIGN, &true, sizeof(true)},
+        {CKA_VALUE_LEN, &key_len, sizeof(key_len)}
+    };
+    CK_OBJECT_HANDLE h_key;
+    CK_BYTE data[BIG_REQUEST];
+    struct hmac_data op_data;
+    struct speed_stats stats;
+    CK_ULONG i;
 
-    for (i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "-slot") == 0) {
-            if (i + 1 >= argc) {
-                printf("Slot number missing\n");
-                return -1;
+    testcase_begin("%s Sign with datalen=%lu", name, data_len);
+
+    if (!mech_supported(SLOT_ID, CKM_GENERIC_SECRET_KEY_GEN) ||
+        !mech_supported(SLOT_ID, mech_type)) {
+        testcase_skip("Slot %lu doesn't support %s", SLOT_ID, name);
+        return TRUE;
+    }
+
+    testcase_new_assertion();
+
+    testcase_rw_session();
+
+    rc = funcs->C_GenerateKey(session, &key_mech, key_tmpl,
+                              sizeof(key_tmpl) / sizeof(CK_ATTRIBUTE), &h_key);
+    if (rc != CKR_OK) {
+        testcase_error("C_GenerateKey rc=%s", p11_get_ckr(rc));
+        goto testcase_cleanup;
+    }
+
+    if (data_len > sizeof(data))
+        data_len = sizeof(data);
+    for (i = 0; i < data_len; i++)
+        data[i] = i % 255;
+
+    op_data.session = session;
+    op_data.mech = &mech;
+    op_data.h_key = h_key;
+    op_data.msg = data;
+    op_data.msg_len = data_len;
+    op_data.calls = 20000;
+
+    rc = speed_measure(NULL, hmac_op, &op_data, 10, &stats);
+    if (rc != CKR_OK)
+        goto testcase_cleanup;
+
+    printf("%lu iterations of %lu calls: total=%luus min=%luus max=%luus "
+           "avg=%luus %.0f ops/s\n", stats.iterations, op_data.calls,
+           stats.tot_time, stats.min_time, stats.max_time, stats.avg_time,
+           (double) op_data.calls * 1000000.0 / (double) stats.avg_time);
+
+    testcase_pass("%s Sign with datalen=%lu", name, data_len);
+
+testcase_cleanup:
+    testcase_closeall_session();
+    if (rc != CKR_OK)
+        return FALSE;
+
+    return TRUE;
+}
+
+enum find_mode {
+    FIND_OBJECTS,               /* C_FindObjects only */
+    FIND_OBJECTS_GET_ATTRS,     /* plus C_GetAttributeValue per object */
+    FIND_OBJECTS_IBM_BULK,      /* C_IBM_FindObjectsGetAttributes */
+};
+
+struct find_data {
+    CK_SESSION_HANDLE session;
+    CK_ATTRIBUTE *tmpl;
+    CK_ULONG tmpl_len;
+    CK_ULONG num_objs;
+    enum find_mode mode;
+    CK_IBM_FUNCTION_LIST_1_1 *ibm_funcs;
+};
+
+/*
+ * Lists all objects matching the template, and optionally their CKA_LABEL
+ * and CKA_VALUE, and checks that num_objs objects were found.
+ */
+static CK_RV find_op(void *arg)
+{
+    struct find_data *data = arg;
+    CK_ATTRIBUTE_TYPE types[] = { CKA_LABEL, CKA_VALUE };
+    CK_BYTE label_buf[64], value_buf[64];
+    CK_ATTRIBUTE attrs[2];
+    CK_OBJECT_HANDLE h_found[100];
+    CK_BYTE bulk_buf[65536];
+    CK_ULONG found, num_found = 0, bulk_len, j;
+    CK_RV rc;
+
+    rc = funcs->C_FindObjectsInit(data->session, data->tmpl, data->tmpl_len);
+    if (rc != CKR_OK) {
+        testcase_error("C_FindObjectsInit rc=%s", p11_get_ckr(rc));
+        return rc;
+    }
+
+    do {
+        if (data->mode == FIND_OBJECTS_IBM_BULK) {
+            bulk_len = sizeof(bulk_buf);
+            rc = data->ibm_funcs->C_IBM_FindObjectsGetAttributes(
+                                        data->session, types, 2, bulk_buf,
+                                        &bulk_len, &found);
+            if (rc != CKR_OK) {
+                funcs->C_FindObjectsFinal(data->session);
+                if (rc != CKR_FUNCTION_NOT_SUPPORTED)
+                    testcase_error("C_IBM_FindObjectsGetAttributes rc=%s",
+                                   p11_get_ckr(rc));
+                return rc;
             }
-            SLOT_ID = atoi(argv[i + 1]);
-            i++;
+            num_found += found;
             continue;
         }
-        if (strcmp(argv[i], "-rsa_keygen") == 0) {
-            do_rsa_keygen = 1;
-        } else if (strcmp(argv[i], "-rsa_signverify") == 0) {
-            do_rsa_signverify = 1;
-        } else if (strcmp(argv[i], "-rsa_endecrypt") == 0) {
-            do_rsa_endecrypt = 1;
-        } else if (strcmp(argv[i], "-des3") == 0) {
-            do_des3_endecrypt = 1;
-        } else if (strcmp(argv[i], "-aes") == 0) {
-            do_aes_endecrypt = 1;
-        } else if (strcmp(argv[i], "-sha") == 0) {
-            do_sha = 1;
-        } else if (strcmp(argv[i], "-h") == 0) {
-            speed_usage(argv[0]);
-            return 0;
-        } else {
-            printf("unknown option '%s'\n", argv[i]);
-            speed_usage(argv[0]);
-            return 1;
+
+        rc = funcs->C_FindObjects(data->session, h_found,
+                                  sizeof(h_found) / sizeof(h_found[0]),
+                                  &found);
+        if (rc != CKR_OK) {
+            testcase_error("C_FindObjects rc=%s", p11_get_ckr(rc));
+            return rc;
         }
-    }
 
-    // error if slot has not been identified.
-    if (SLOT_ID == 1000) {
-        printf("Please specify the slot to be tested.\n");
-        speed_usage(argv[0]);
-        return 1;
+        for (j = 0; data->mode == FIND_OBJECTS_GET_ATTRS && j < found; j++) {
+            attrs[0].type = types[0];
+            attrs[0].pValue = label_buf;
+            attrs[0].ulValueLen = sizeof(label_buf);
+            attrs[1].type = types[1];
+            attrs[1].pValue = value_buf;
+            attrs[1].ulValueLen = sizeof(value_buf);
+
+            rc = funcs->C_GetAttributeValue(data->session, h_found[j],
+                                            attrs, 2);
+            if (rc != CKR_OK) {
+                testcase_error("C_GetAttributeValue rc=%s", p11_get_ckr(rc));
+                return rc;
+            }
+        }
+        num_found += found;
+    } while (found > 0);
+
+    rc = funcs->C_FindObjectsFinal(data->session);
+    if (rc != CKR_OK) {
+        testcase_error("C_FindObjectsFinal rc=%s", p11_get_ckr(rc));
+        return rc;
     }
 
-    if (do_rsa_keygen + do_rsa_signverify + do_rsa_endecrypt
-        + do_des3_endecrypt + do_aes_endecrypt + do_sha == 0) {
-        do_rsa_keygen = 1;
-        do_rsa_signverify = 1;
-        do_rsa_endecrypt = 1;
-        do_des3_endecrypt = 1;
-        do_aes_endecrypt = 1;
-        do_sha = 1;
+    if (num_found != data->num_objs) {
+        testcase_error("found %lu objects, but expected %lu",
+                       num_found, data->num_objs);
+        return CKR_FUNCTION_FAILED;
     }
 
-    printf("Using slot #%lu...\n\n", SLOT_ID);
+    return CKR_OK;
+}
 
-    rc = do_GetFunctionList();
-    if (!rc)
-        return rc;
+// num_objs: number of matching session objects to search through
+int do_FindObjects(CK_ULONG num_objs)
+{
+    CK_SESSION_HANDLE session;
+    CK_FLAGS flags;
+    CK_RV rc;
 
-    memset(&cinit_args, 0x0, sizeof(cinit_args));
-    cinit_args.flags = CKF_OS_LOCKING_OK;
+    CK_OBJECT_CLASS class = CKO_DATA;
+    CK_BBOOL false = FALSE;
+    CK_BYTE label[] = "speed-findobjects";
+    CK_BYTE value[16] = { 0 };
+    CK_ATTRIBUTE obj_tmpl[] = {
+        {CKA_CLASS, &class, sizeof(class)},
+        {CKA_TOKEN, &false, sizeof(false)},
+        {CKA_LABEL, label, sizeof(label) - 1},
+        {CKA_VALUE, value, sizeof(value)}
+    };
+    CK_ATTRIBUTE find_tmpl[] = {
+        {CKA_CLASS, &class, sizeof(class)},
+        {CKA_LABEL, label, sizeof(label) - 1}
+    };
+    CK_OBJECT_HANDLE h_obj;
+    struct find_data op_data;
+    struct speed_stats stats;
+    CK_ULONG i;
 
-    funcs->C_Initialize(&cinit_args);
+    testcase_begin("C_FindObjects with %lu session objects", num_objs);
+    testcase_new_assertion();
 
-    testcase_setup();
+    testcase_rw_session();
 
-    if (do_rsa_keygen) {
-        testsuite_begin("RSA Keygen.");
-        rc = do_RSA_KeyGen(1024);
-        if (!rc)
-            goto out;
-        rc = do_RSA_KeyGen(2048);
-        if (!rc)
-            goto out;
-        rc = do_RSA_KeyGen(4096);
-        if (!rc)
-            goto out;
+    for (i = 0; i < num_objs; i++) {
+        memcpy(value, &i, sizeof(i));
+        rc = funcs->C_CreateObject(session, obj_tmpl,
+                                   sizeof(obj_tmpl) / sizeof(CK_ATTRIBUTE),
+                                   &h_obj);
+        if (rc != CKR_OK) {
+            testcase_error("C_CreateObject rc=%s", p11_get_ckr(rc));
+            goto testcase_cleanup;
+        }
     }
 
-    if (do_rsa_signverify) {
-        testsuite_begin("RSA Sign/Verify.");
-        rc = do_RSA_PKCS_SignVerify(1024);
-        if (!rc)
-            goto out;
-        rc = do_RSA_PKCS_SignVerify(2048);
-        if (!rc)
-            goto out;
-        rc = do_RSA_PKCS_SignVerify(4096);
-        if (!rc)
-            goto out;
+    op_data.session = session;
+    op_data.tmpl = find_tmpl;
+    op_data.tmpl_len = sizeof(find_tmpl) / sizeof(CK_ATTRIBUTE);
+    op_data.num_objs = num_objs;
+    op_data.mode = FIND_OBJECTS;
+    op_data.ibm_funcs = NULL;
+
+    rc = speed_measure(NULL, find_op, &op_data, 10, &stats);
+    if (rc != CKR_OK)
+        goto testcase_cleanup;
+
+    printf("%lu iterations: total=%luus min=%luus max=%luus avg=%luus "
+           "per object=%.3fus\n", stats.iterations, stats.tot_time,
+           stats.min_time, stats.max_time, stats.avg_time,
+           (double) stats.avg_time / (double) num_objs);
+
+    testcase_pass("C_FindObjects with %lu session objects", num_objs);
+
+testcase_cleanup:
+    testcase_closeall_session();
+    if (rc != CKR_OK)
+        return FALSE;
+
+    return TRUE;
+}
+
+/*
+ * List the CKA_LABEL and CKA_VALUE of num_objs session objects, once with
+ * C_FindObjects and a C_GetAttributeValue call per object, and once in bulk
+ * with C_IBM_FindObjectsGetAttributes.
+ */
+int do_FindObjectsGetAttributes(CK_ULONG num_objs)
+{
+    CK_SESSION_HANDLE session;
+    CK_FLAGS flags;
+    CK_RV rc;
+
+    CK_OBJECT_CLASS class = CKO_DATA;
+    CK_BBOOL false = FALSE;
+    CK_BYTE label[] = "speed-findobjects-getattrs";
+    CK_BYTE value[16] = { 0 };
+    CK_ATTRIBUTE obj_tmpl[] = {
+        {CKA_CLASS, &class, sizeof(class)},
+        {CKA_TOKEN, &false, sizeof(false)},
+        {CKA_LABEL, label, sizeof(label) - 1},
+        {CKA_VALUE, value, sizeof(value)}
+    };
+    CK_ATTRIBUTE find_tmpl[] = {
+        {CKA_CLASS, &class, sizeof(class)},
+        {CKA_LABEL, label, sizeof(label) - 1}
+    };
+    CK_OBJECT_HANDLE h_obj;
+
+    CK_VERSION ibm_version = { 1, 1 };
+    CK_INTERFACE *ibm_interface = NULL;
+
+    struct find_data op_data;
+    struct speed_stats loop_stats, bulk_stats;
+    CK_ULONG i;
+
+    testcase_begin("C_IBM_FindObjectsGetAttributes with %lu session objects",
+                   num_objs);
+    testcase_new_assertion();
+
+    rc = funcs3->C_GetInterface((CK_UTF8CHAR *)"Vendor IBM", &ibm_version,
+                                &ibm_interface, 0);
+    if (rc != CKR_OK) {
+        testcase_skip("Vendor IBM interface version 1.1 not available");
+        return TRUE;
     }
 
-    if (do_rsa_endecrypt) {
-        testsuite_begin("RSA Encrypt/Decrypt.");
-        rc = do_RSA_PKCS_EncryptDecrypt(1024);
-        if (!rc)
-            goto out;
-        rc = do_RSA_PKCS_EncryptDecrypt(2048);
-        if (!rc)
-            goto out;
-        rc = do_RSA_PKCS_EncryptDecrypt(4096);
-        if (!rc)
-            goto out;
+    testcase_rw_session();
+
+    for (i = 0; i < num_objs; i++) {
+        memcpy(value, &i, sizeof(i));
+        rc = funcs->C_CreateObject(session, obj_tmpl,
+                                   sizeof(obj_tmpl) / sizeof(CK_ATTRIBUTE),
+                                   &h_obj);
+        if (rc != CKR_OK) {
+            testcase_error("C_CreateObject rc=%s", p11_get_ckr(rc));
+            goto testcase_cleanup;
+        }
     }
 
-    if (do_des3_endecrypt) {
-        testsuite_begin("DES3 Encrypt/Decrypt.");
-        rc = do_DES3_EncrDecr("ECB");
-        if (!rc)
-            goto out;
-        rc = do_DES3_EncrDecr("CBC");
-        if (!rc)
-            goto out;
+    op_data.session = session;
+    op_data.tmpl = find_tmpl;
+    op_data.tmpl_len = sizeof(find_tmpl) / sizeof(CK_ATTRIBUTE);
+    op_data.num_objs = num_objs;
+    op_data.ibm_funcs = ibm_interface->pFunctionList;
+
+    op_data.mode = FIND_OBJECTS_GET_ATTRS;
+    rc = speed_measure(NULL, find_op, &op_data, 10, &loop_stats);
+    if (rc != CKR_OK)
+        goto testcase_cleanup;
+
+    printf("C_FindObjects + C_GetAttributeValue: %lu iterations: "
+           "total=%luus min=%luus max=%luus avg=%luus per object=%.3fus\n",
+           loop_stats.iterations, loop_stats.tot_time, loop_stats.min_time,
+           loop_stats.max_time, loop_stats.avg_time,
+           (double) loop_stats.avg_time / (double) num_objs);
+
+    op_data.mode = FIND_OBJECTS_IBM_BULK;
+    rc = speed_measure(NULL, find_op, &op_data, 10, &bulk_stats);
+    if (rc == CKR_FUNCTION_NOT_SUPPORTED) {
+        testcase_skip("C_IBM_FindObjectsGetAttributes not supported");
+        rc = CKR_OK;
+        goto testcase_cleanup;
     }
+    if (rc != CKR_OK)
+        goto testcase_cleanup;
 
-    if (do_aes_endecrypt) {
-        testsuite_begin("AES Encrypt/Decrypt.");
-        rc = do_AES_EncrDecr(128, "ECB");
-        if (!rc)
-            goto out;
+    printf("C_IBM_FindObjectsGetAttributes: %lu iterations: "
+           "total=%luus min=%luus max=%luus avg=%luus per object=%.3fus\n",
+           bulk_stats.iterations, bulk_stats.tot_time, bulk_stats.min_time,
+           bulk_stats.max_time, bulk_stats.avg_time,
+           (double) bulk_stats.avg_time / (double) num_objs);
+    printf("C_IBM_FindObjectsGetAttributes speedup: %.2fx\n",
+           (double) loop_stats.avg_time / (double) bulk_stats.avg_time);
+
+    testcase_pass("C_IBM_FindObjectsGetAttributes with %lu session objects",
+                  num_objs);
+
+testcase_cleanup:
+    testcase_closeall_session();
+    if (rc != CKR_OK)
+        return FALSE;
+
+    return TRUE;
+}
+
+struct get_attr_data {
+    CK_SESSION_HANDLE session;
+    CK_OBJECT_HANDLE h_key;
+    CK_ATTRIBUTE_TYPE *types;
+    CK_ULONG num_types;
+    CK_ULONG calls;
+};
+
+static CK_RV get_attr_op(void *arg)
+{
+    struct get_attr_data *data = arg;
+    CK_BYTE values[16][32];
+    CK_ATTRIBUTE attrs[16];
+    CK_ULONG j, k;
+    CK_RV rc;
+
+    for (j = 0; j < data->calls; j++) {
+        for (k = 0; k < data->num_types; k++) {
+            attrs[k].type = data->types[k];
+            attrs[k].pValue = values[k];
+            attrs[k].ulValueLen = sizeof(values[k]);
+        }
+
+        rc = funcs->C_GetAttributeValue(data->session, data->h_key, attrs,
+                                        data->num_types);
+        if (rc != CKR_OK) {
+            testcase_error("C_GetAttributeValue rc=%s", p11_get_ckr(rc));
+            return rc;
+        }
+    }
+
+    return CKR_OK;
+}
+
+/*
+ * Get the specified attributes of an AES key. The attribute values must fit
+ * into 32 bytes each, at most 16 attributes are supported.
+ */
+int do_GetAttributeValue(const char *name, CK_ATTRIBUTE_TYPE *types,
+                         CK_ULONG num_types)
+{
+    CK_SESSION_HANDLE session;
+    CK_FLAGS flags;
+    CK_RV rc;
+
+    CK_MECHANISM mech = { CKM_AES_KEY_GEN, NULL, 0 };
+    CK_ULONG key_len = 32;
+    CK_BBOOL true = TRUE;
+    CK_ATTRIBUTE key_tmpl[] = {
+        {CKA_VALUE_LEN, &key_len, sizeof(key_len)},
+        {CKA_ENCRYPT, &true, sizeof(true)},
+        {CKA_DECRYPT, &true, sizeof(true)}
+    };
+    CK_OBJECT_HANDLE h_key;
+    struct get_attr_data op_data;
+    struct speed_stats stats;
+
+    testcase_begin("C_GetAttributeValue of %s", name);
+    testcase_new_assertion();
+
+    testcase_rw_session();
+
+    rc = funcs->C_GenerateKey(session, &mech, key_tmpl,
+                              sizeof(key_tmpl) / sizeof(CK_ATTRIBUTE), &h_key);
+    if (rc != CKR_OK) {
+        testcase_error("C_GenerateKey rc=%s", p11_get_ckr(rc));
+        goto testcase_cleanup;
+    }
+
+    op_data.session = session;
+    op_data.h_key = h_key;
+    op_data.types = types;
+    op_data.num_types = num_types;
+    op_data.calls = 10000;
+
+    rc = speed_measure(NULL, get_attr_op, &op_data, 10, &stats);
+    if (rc != CKR_OK)
+        goto testcase_cleanup;
+
+    printf("%lu iterations of %lu calls: total=%luus min=%luus max=%luus "
+           "avg=%luus per call=%.3fus\n", stats.iterations, op_data.calls,
+           stats.tot_time, stats.min_time, stats.max_time, stats.avg_time,
+           (double) stats.avg_time / (double) op_data.calls);
+
+    testcase_pass("C_GetAttributeValue of %s", name);
+
+testcase_cleanup:
+    testcase_closeall_session();
+    if (rc != CKR_OK)
+        return FALSE;
+
+    return TRUE;
+}
+
+struct crypt_data {
+    CK_SESSION_HANDLE session;
+    CK_MECHANISM *mech;
+    CK_OBJECT_HANDLE h_key;
+    CK_BYTE *in;
+    CK_BYTE *out;
+    CK_ULONG data_len;          /* chunk or data unit length */
+    CK_ULONG total_len;
+    CK_BBOOL encrypt;
+};
+
+/*
+ * Measures op with data->encrypt set to TRUE and then to FALSE, and prints
+ * the throughput of both.
+ */
+static CK_RV speed_encr_decr(CK_RV (*op)(void *arg), struct crypt_data *data)
+{
+    struct speed_stats stats;
+    CK_RV rc;
+
+    for (data->encrypt = TRUE; ; data->encrypt = FALSE) {
+        rc = speed_measure(NULL, op, data, 10, &stats);
+        if (rc != CKR_OK)
+            return rc;
+
+        printf("%s: %lu iterations of %luMB: total=%luus min=%luus "
+               "max=%luus avg=%luus %.3fMB/s\n",
+               data->encrypt ? "encrypt" : "decrypt", stats.iterations,
+               data->total_len / (1024 * 1024), stats.tot_time,
+               stats.min_time, stats.max_time, stats.avg_time,
+               (double) data->total_len / (double) stats.avg_time);
+
+        if (!data->encrypt)
+            break;
+    }
+
+    return CKR_OK;
+}
+
+static CK_RV crypt_update_op(void *arg)
+{
+    struct crypt_data *data = arg;
+    CK_ULONG j, len, out_len;
+    CK_RV rc;
+
+    if (data->encrypt)
+        rc = funcs->C_EncryptInit(data->session, data->mech, data->h_key);
+    else
+        rc = funcs->C_DecryptInit(data->session, data->mech, data->h_key);
+    if (rc != CKR_OK) {
+        testcase_error("C_%sInit rc=%s", data->encrypt ? "Encrypt" : "Decrypt",
+                       p11_get_ckr(rc));
+        return rc;
+    }
+
+    for (j = 0; j < data->total_len; j += len) {
+        len = data->total_len - j < data->data_len ?
+                                data->total_len - j : data->data_len;
+        out_len = data->data_len + 32;
+        if (data->encrypt)
+            rc = funcs->C_EncryptUpdate(data->session, data->in, len,
+                                        data->out, &out_len);
+        else
+            rc = funcs->C_DecryptUpdate(data->session, data->in, len,
+                                        data->out, &out_len);
+        if (rc != CKR_OK) {
+            testcase_error("C_%sUpdate rc=%s",
+                           data->encrypt ? "Encrypt" : "Decrypt",
+                           p11_get_ckr(rc));
+            return rc;
+        }
+    }
+
+    out_len = data->data_len + 32;
+    if (data->encrypt)
+        rc = funcs->C_EncryptFinal(data->session, data->out, &out_len);
+    else
+        rc = funcs->C_DecryptFinal(data->session, data->out, &out_len);
+    if (rc != CKR_OK) {
+        testcase_error("C_%sFinal rc=%s", data->encrypt ? "Encrypt" : "Decrypt",
+                       p11_get_ckr(rc));
+        return rc;
+    }
+
+    return CKR_OK;
+}
+
+/*
+ * Streams the data through C_EncryptUpdate and C_DecryptUpdate in chunks of
+ * chunk_len bytes, as e.g. done when encrypting a large file.
+ */
+int do_EncrDecrUpdate(const char *name, CK_MECHANISM_TYPE key_gen_mech,
+                      CK_ULONG key_len, CK_MECHANISM *mech, CK_ULONG chunk_len)
+{
+    CK_SESSION_HANDLE session;
+    CK_FLAGS flags;
+    CK_RV rc;
+
+    CK_MECHANISM key_mech = { key_gen_mech, NULL, 0 };
+    CK_BBOOL true = TRUE;
+    CK_ATTRIBUTE key_tmpl[] = {
+        {CKA_ENCRYPT, &true, sizeof(true)},
+        {CKA_DECRYPT, &true, sizeof(true)},
+        {CKA_VALUE_LEN, &key_len, sizeof(key_len)}
+    };
+    CK_ULONG num_attrs = sizeof(key_tmpl) / sizeof(CK_ATTRIBUTE);
+    CK_OBJECT_HANDLE h_key;
+    CK_BYTE *in = NULL, *out = NULL;
+    struct crypt_data op_data;
+
+    testcase_begin("C_EncryptUpdate/C_DecryptUpdate with %s chunklen=%lu",
+                   name, chunk_len);
+
+    if (!mech_supported(SLOT_ID, key_gen_mech) ||
+        !mech_supported(SLOT_ID, mech->mechanism)) {
+        testcase_skip("Slot %lu doesn't support %s", SLOT_ID, name);
+        return TRUE;
+    }
+
+    testcase_new_assertion();
+
+    testcase_rw_session();
+
+    /* DES3 keys have a fixed length */
+    if (key_gen_mech == CKM_DES3_KEY_GEN)
+        num_attrs--;
+
+    rc = funcs->C_GenerateKey(session, &key_mech, key_tmpl, num_attrs, &h_key);
+    if (rc != CKR_OK) {
+        testcase_error("C_GenerateKey rc=%s", p11_get_ckr(rc));
+        goto testcase_cleanup;
+    }
+
+    in = calloc(1, chunk_len + 32);
+    out = calloc(1, chunk_len + 32);
+    if (in == NULL || out == NULL) {
+        testcase_error("calloc failed");
+        rc = CKR_HOST_MEMORY;
+        goto testcase_cleanup;
+    }
+
+    op_data.session = session;
+    op_data.mech = mech;
+    op_data.h_key = h_key;
+    op_data.in = in;
+    op_data.out = out;
+    op_data.data_len = chunk_len;
+    op_data.total_len = 16 * 1024 * 1024;
+
+    rc = speed_encr_decr(crypt_update_op, &op_data);
+    if (rc != CKR_OK)
+        goto testcase_cleanup;
+
+    testcase_pass("C_EncryptUpdate/C_DecryptUpdate with %s chunklen=%lu",
+                  name, chunk_len);
+
+testcase_cleanup:
+    free(in);
+    free(out);
+    testcase_closeall_session();
+    if (rc != CKR_OK)
+        return FALSE;
+
+    return TRUE;
+}
+
+/* The mechanism parameter is the tweak, it is set to the data unit number */
+static CK_RV xts_op(void *arg)
+{
+    struct crypt_data *data = arg;
+    CK_ULONG j, unit, out_len;
+    CK_RV rc;
+
+    for (j = 0, unit = 0; j < data->total_len; j += data->data_len, unit++) {
+        memcpy(data->mech->pParameter, &unit, sizeof(unit));
+
+        if (data->encrypt)
+            rc = funcs->C_EncryptInit(data->session, data->mech, data->h_key);
+        else
+            rc = funcs->C_DecryptInit(data->session, data->mech, data->h_key);
+        if (rc != CKR_OK) {
+            testcase_error("C_%sInit rc=%s",
+                           data->encrypt ? "Encrypt" : "Decrypt",
+                           p11_get_ckr(rc));
+            return rc;
+        }
+
+        out_len = data->data_len;
+        if (data->encrypt)
+            rc = funcs->C_Encrypt(data->session, data->in, data->data_len,
+                                  data->out, &out_len);
+        else
+            rc = funcs->C_Decrypt(data->session, data->in, data->data_len,
+                                  data->out, &out_len);
+        if (rc != CKR_OK) {
+            testcase_error("C_%s rc=%s", data->encrypt ? "Encrypt" : "Decrypt",
+                           p11_get_ckr(rc));
+            return rc;
+        }
+    }
+
+    return CKR_OK;
+}
+
+/*
+ * Encrypts and decrypts 16MB of data with AES-XTS in data units of
+ * data_len bytes, each with its own tweak, as e.g. done for disk sectors.
+ */
+int do_AES_XTS(CK_ULONG data_len)
+{
+    CK_SESSION_HANDLE session;
+    CK_FLAGS flags;
+    CK_RV rc;
+
+    CK_MECHANISM key_mech = { CKM_AES_XTS_KEY_GEN, NULL, 0 };
+    CK_BYTE tweak[16] = { 0 };
+    CK_MECHANISM mech = { CKM_AES_XTS, tweak, sizeof(tweak) };
+    CK_ULONG key_len = 64;
+    CK_BBOOL true = TRUE;
+    CK_ATTRIBUTE key_tmpl[] = {
+        {CKA_ENCRYPT, &true, sizeof(true)},
+        {CKA_DECRYPT, &true, sizeof(true)},
+        {CKA_VALUE_LEN, &key_len, sizeof(key_len)}
+    };
+    CK_OBJECT_HANDLE h_key;
+    CK_BYTE *in = NULL, *out = NULL;
+    struct crypt_data op_data;
+
+    testcase_begin("AES-XTS Encrypt/Decrypt with datalen=%lu", data_len);
+
+    if (!mech_supported(SLOT_ID, CKM_AES_XTS_KEY_GEN) ||
+        !mech_supported(SLOT_ID, CKM_AES_XTS)) {
+        testcase_skip("Slot %lu doesn't support AES-XTS", SLOT_ID);
+        return TRUE;
+    }
+
+    testcase_new_assertion();
+
+    testcase_rw_session();
+
+    rc = funcs->C_GenerateKey(session, &key_mech, key_tmpl,
+                              sizeof(key_tmpl) / sizeof(CK_ATTRIBUTE), &h_key);
+    if (rc != CKR_OK) {
+        testcase_error("C_GenerateKey rc=%s", p11_get_ckr(rc));
+        goto testcase_cleanup;
+    }
+
+    in = calloc(1, data_len);
+    out = calloc(1, data_len);
+    if (in == NULL || out == NULL) {
+        testcase_error("calloc failed");
+        rc = CKR_HOST_MEMORY;
+        goto testcase_cleanup;
+    }
+
+    op_data.session = session;
+    op_data.mech = &mech;
+    op_data.h_key = h_key;
+    op_data.in = in;
+    op_data.out = out;
+    op_data.data_len = data_len;
+    op_data.total_len = 16 * 1024 * 1024;
+
+    rc = speed_encr_decr(xts_op, &op_data);
+    if (rc != CKR_OK)
+        goto testcase_cleanup;
+
+    testcase_pass("AES-XTS Encrypt/Decrypt with datalen=%lu", data_len);
+
+testcase_cleanup:
+    free(in);
+    free(out);
+    testcase_closeall_session();
+    if (rc != CKR_OK)
+        return FALSE;
+
+    return TRUE;
+}
+
+struct thread_encr_data {
+    CK_OBJECT_HANDLE h_key;
+    CK_ULONG calls;
+    CK_RV rc;
+};
+
+static void *thread_encr_func(void *arg)
+{
+    struct thread_encr_data *data = arg;
+    CK_SESSION_HANDLE session;
+    CK_MECHANISM mech = { CKM_AES_ECB, NULL, 0 };
+    CK_BYTE clear[16] = { 0 }, cipher[16];
+    CK_ULONG i, cipher_len;
+    CK_RV rc;
+
+    rc = funcs->C_OpenSession(SLOT_ID, CKF_SERIAL_SESSION, NULL, NULL,
+                              &session);
+    if (rc != CKR_OK)
+        goto out;
+
+    for (i = 0; i < data->calls; i++) {
+        rc = funcs->C_EncryptInit(session, &mech, data->h_key);
+        if (rc != CKR_OK)
+            break;
+
+        cipher_len = sizeof(cipher);
+        rc = funcs->C_Encrypt(session, clear, sizeof(clear), cipher,
+                              &cipher_len);
+        if (rc != CKR_OK)
+            break;
+    }
+
+    funcs->C_CloseSession(session);
+out:
+    data->rc = rc;
+    return NULL;
+}
+
+/*
+ * Encrypts single AES blocks from num_threads threads in parallel, each
+ * thread using its own session, to measure the contention in the session
+ * and object lookups.
+ */
+int do_MultiThreadEncrypt(CK_ULONG num_threads)
+{
+    CK_SESSION_HANDLE session;
+    CK_FLAGS flags;
+    CK_RV rc;
+
+    CK_MECHANISM mech = { CKM_AES_KEY_GEN, NULL, 0 };
+    CK_ULONG key_len = 32;
+    CK_BBOOL true = TRUE;
+    CK_ATTRIBUTE key_tmpl[] = {
+        {CKA_VALUE_LEN, &key_len, sizeof(key_len)},
+        {CKA_ENCRYPT, &true, sizeof(true)}
+    };
+    CK_OBJECT_HANDLE h_key;
+    pthread_t *threads = NULL;
+    struct thread_encr_data *data = NULL;
+    CK_ULONG i, calls = 640000 / num_threads;
+
+    SYSTEMTIME t1, t2;
+    CK_ULONG diff;
+
+    testcase_begin("AES-ECB Encrypt with %lu threads", num_threads);
+
+    if (!mech_supported(SLOT_ID, CKM_AES_KEY_GEN) ||
+        !mech_supported(SLOT_ID, CKM_AES_ECB)) {
+        testcase_skip("Slot %lu doesn't support AES-ECB", SLOT_ID);
+        return TRUE;
+    }
+
+    testcase_new_assertion();
+
+    testcase_rw_session();
+
+    rc = funcs->C_GenerateKey(session, &mech, key_tmpl,
+                              sizeof(key_tmpl) / sizeof(CK_ATTRIBUTE), &h_key);
+    if (rc != CKR_OK) {
+        testcase_error("C_GenerateKey rc=%s", p11_get_ckr(rc));
+        goto testcase_cleanup;
+    }
+
+    threads = calloc(num_threads, sizeof(pthread_t));
+    data = calloc(num_threads, sizeof(struct thread_encr_data));
+    if (threads == NULL || data == NULL) {
+        testcase_error("calloc failed");
+        rc = CKR_HOST_MEMORY;
+        goto testcase_cleanup;
+    }
+
+    GetSystemTime(&t1);
+
+    for (i = 0; i < num_threads; i++) {
+        data[i].h_key = h_key;
+        data[i].calls = calls;
+        if (pthread_create(&threads[i], NULL, thread_encr_func,
+                           &data[i]) != 0) {
+            testcase_error("pthread_create failed");
+            num_threads = i;
+            rc = CKR_FUNCTION_FAILED;
+            break;
+        }
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+        if (data[i].rc != CKR_OK && rc == CKR_OK) {
+            testcase_error("Thread %lu failed: rc=%s", i,
+                           p11_get_ckr(data[i].rc));
+            rc = data[i].rc;
+        }
+    }
+
+    GetSystemTime(&t2);
+
+    if (rc != CKR_OK)
+        goto testcase_cleanup;
+
+    diff = delta_time_us(&t1, &t2);
+
+    printf("%lu threads with %lu calls: total=%luus %.0f calls/s\n",
+           num_threads, calls, diff,
+           (double) (num_threads * calls) * 1000000.0 / (double) diff);
+
+    testcase_pass("AES-ECB Encrypt with %lu threads", num_threads);
+
+testcase_cleanup:
+    free(threads);
+    free(data);
+    testcase_closeall_session();
+    if (rc != CKR_OK)
+        return FALSE;
+
+    return TRUE;
+}
+
+struct rng_data {
+    CK_SESSION_HANDLE session;
+    CK_BYTE *buf;
+    CK_ULONG data_len;
+    CK_ULONG calls;
+};
+
+static CK_RV rng_op(void *arg)
+{
+    struct rng_data *data = arg;
+    CK_ULONG j;
+    CK_RV rc;
+
+    for (j = 0; j < data->calls; j++) {
+        rc = funcs->C_GenerateRandom(data->session, data->buf, data->data_len);
+        if (rc != CKR_OK) {
+            testcase_error("C_GenerateRandom rc=%s", p11_get_ckr(rc));
+            return rc;
+        }
+    }
+
+    return CKR_OK;
+}
+
+int do_GenerateRandom(CK_ULONG data_len)
+{
+    CK_SESSION_HANDLE session;
+    CK_FLAGS flags;
+    CK_RV rc;
+
+    CK_BYTE *buf = NULL;
+    CK_ULONG total_len = 16 * 1024 * 1024;
+    struct rng_data op_data;
+    struct speed_stats stats;
+
+    testcase_begin("C_GenerateRandom with datalen=%lu", data_len);
+    testcase_new_assertion();
+
+    testcase_rw_session();
+
+    buf = malloc(data_len);
+    if (buf == NULL) {
+        testcase_error("malloc failed");
+        rc = CKR_HOST_MEMORY;
+        goto testcase_cleanup;
+    }
+
+    op_data.session = session;
+    op_data.buf = buf;
+    op_data.data_len = data_len;
+    op_data.calls = total_len / data_len;
+    if (op_data.calls > 100000)
+        op_data.calls = 100000;
+
+    rc = speed_measure(NULL, rng_op, &op_data, 10, &stats);
+    if (rc != CKR_OK)
+        goto testcase_cleanup;
+
+    printf("%lu iterations of %lu calls: total=%luus min=%luus max=%luus "
+           "avg=%luus %.0f calls/s %.3fMB/s\n", stats.iterations,
+           op_data.calls, stats.tot_time, stats.min_time, stats.max_time,
+           stats.avg_time,
+           (double) op_data.calls * 1000000.0 / (double) stats.avg_time,
+           (double) (op_data.calls * data_len) / (double) stats.avg_time);
+
+    testcase_pass("C_GenerateRandom with datalen=%lu", data_len);
+
+testcase_cleanup:
+    free(buf);
+    testcase_closeall_session();
+    if (rc != CKR_OK)
+        return FALSE;
+
+    return TRUE;
+}
+
+struct login_data {
+    CK_SESSION_HANDLE session;
+    CK_BYTE *user_pin;
+    CK_ULONG user_pin_len;
+};
+
+static CK_RV logout_op(void *arg)
+{
+    struct login_data *data = arg;
+    CK_RV rc;
+
+    rc = funcs->C_Logout(data->session);
+    if (rc != CKR_OK)
+        testcase_error("C_Logout rc=%s", p11_get_ckr(rc));
+
+    return rc;
+}
+
+static CK_RV login_op(void *arg)
+{
+    struct login_data *data = arg;
+    CK_RV rc;
+
+    rc = funcs->C_Login(data->session, CKU_USER, data->user_pin,
+                        data->user_pin_len);
+    if (rc != CKR_OK)
+        testcase_error("C_Login rc=%s", p11_get_ckr(rc));
+
+    return rc;
+}
+
+// num_objs: number of private token objects loaded at login
+int do_Login(CK_ULONG num_objs)
+{
+    CK_SESSION_HANDLE session;
+    CK_FLAGS flags;
+    CK_BYTE user_pin[PKCS11_MAX_PIN_LEN];
+    CK_ULONG user_pin_len;
+    CK_RV rc;
+
+    CK_OBJECT_CLASS class = CKO_DATA;
+    CK_BBOOL true = TRUE;
+    CK_BYTE label[] = "speed-login";
+    CK_BYTE value[64] = { 0 };
+    CK_ATTRIBUTE obj_tmpl[] = {
+        {CKA_CLASS, &class, sizeof(class)},
+        {CKA_TOKEN, &true, sizeof(true)},
+        {CKA_PRIVATE, &true, sizeof(true)},
+        {CKA_LABEL, label, sizeof(label) - 1},
+        {CKA_VALUE, value, sizeof(value)}
+    };
+    CK_ATTRIBUTE find_tmpl[] = {
+        {CKA_CLASS, &class, sizeof(class)},
+        {CKA_LABEL, label, sizeof(label) - 1}
+    };
+    CK_OBJECT_HANDLE h_obj, *h_objs = NULL;
+    CK_ULONG num_found = 0;
+    struct login_data op_data;
+    struct speed_stats stats;
+    CK_ULONG i;
+
+    testcase_begin("C_Login with %lu private token objects", num_objs);
+    testcase_new_assertion();
+
+    testcase_rw_session();
+    testcase_user_login();
+
+    for (i = 0; i < num_objs; i++) {
+        memcpy(value, &i, sizeof(i));
+        rc = funcs->C_CreateObject(session, obj_tmpl,
+                                   sizeof(obj_tmpl) / sizeof(CK_ATTRIBUTE),
+                                   &h_obj);
+        if (rc != CKR_OK) {
+            testcase_error("C_CreateObject rc=%s", p11_get_ckr(rc));
+            goto testcase_cleanup;
+        }
+    }
+
+    op_data.session = session;
+    op_data.user_pin = user_pin;
+    op_data.user_pin_len = user_pin_len;
+
+    /* Only C_Login is measured, C_Logout runs before each call */
+    rc = speed_measure(logout_op, login_op, &op_data, 10, &stats);
+    if (rc != CKR_OK)
+        goto testcase_cleanup;
+
+    printf("%lu iterations: total=%luus min=%luus max=%luus avg=%luus "
+           "per object=%.3fus\n", stats.iterations, stats.tot_time,
+           stats.min_time, stats.max_time, stats.avg_time,
+           num_objs > 0 ? (double) stats.avg_time / num_objs : 0.0);
+
+    testcase_pass("C_Login with %lu private token objects", num_objs);
+
+testcase_cleanup:
+    if (num_objs > 0)
+        h_objs = calloc(num_objs, sizeof(CK_OBJECT_HANDLE));
+    if (h_objs != NULL &&
+        funcs->C_FindObjectsInit(session, find_tmpl,
+                                 sizeof(find_tmpl) /
+                                            sizeof(CK_ATTRIBUTE)) == CKR_OK) {
+        funcs->C_FindObjects(session, h_objs, num_objs, &num_found);
+        funcs->C_FindObjectsFinal(session);
+        for (i = 0; i < num_found; i++)
+            funcs->C_DestroyObject(session, h_objs[i]);
+    }
+    free(h_objs);
+    testcase_user_logout();
+    testcase_closeall_session();
+    if (rc != CKR_OK)
+        return FALSE;
+
+    return TRUE;
+}
+
+struct wrap_data {
+    CK_SESSION_HANDLE session;
+    CK_MECHANISM *mech;
+    CK_OBJECT_HANDLE h_wrapping_key;
+    CK_OBJECT_HANDLE h_key;
+    CK_ATTRIBUTE *unwrap_tmpl;
+    CK_ULONG unwrap_tmpl_len;
+    CK_OBJECT_HANDLE h_unwrapped;
+    CK_BYTE wrapped[16384];
+    CK_ULONG wrapped_len;
+};
+
+static CK_RV wrap_op(void *arg)
+{
+    struct wrap_data *data = arg;
+    CK_RV rc;
+
+    data->wrapped_len = sizeof(data->wrapped);
+    rc = funcs->C_WrapKey(data->session, data->mech, data->h_wrapping_key,
+                          data->h_key, data->wrapped, &data->wrapped_len);
+    if (rc != CKR_OK)
+        testcase_error("C_WrapKey rc=%s", p11_get_ckr(rc));
+
+    return rc;
+}
+
+/* Destroys the key unwrapped by the previous call of unwrap_op() */
+static CK_RV unwrap_cleanup_op(void *arg)
+{
+    struct wrap_data *data = arg;
+    CK_RV rc = CKR_OK;
+
+    if (data->h_unwrapped != CK_INVALID_HANDLE) {
+        rc = funcs->C_DestroyObject(data->session, data->h_unwrapped);
+        if (rc != CKR_OK)
+            testcase_error("C_DestroyObject rc=%s", p11_get_ckr(rc));
+        data->h_unwrapped = CK_INVALID_HANDLE;
+    }
+
+    return rc;
+}
+
+static CK_RV unwrap_op(void *arg)
+{
+    struct wrap_data *data = arg;
+    CK_RV rc;
+
+    rc = funcs->C_UnwrapKey(data->session, data->mech, data->h_wrapping_key,
+                            data->wrapped, data->wrapped_len,
+                            data->unwrap_tmpl, data->unwrap_tmpl_len,
+                            &data->h_unwrapped);
+    if (rc != CKR_OK)
+        testcase_error("C_UnwrapKey rc=%s", p11_get_ckr(rc));
+
+    return rc;
+}
+
+/*
+ * Wraps and unwraps a private key with AES-CBC-PAD. This mainly exercises
+ * the DER encoding and decoding of the private key (PKCS#8).
+ */
+int do_WrapUnwrapKey(const char *name, CK_MECHANISM *keygen_mech,
+                     CK_ATTRIBUTE *publ_tmpl, CK_ULONG publ_tmpl_len,
+                     CK_KEY_TYPE key_type)
+{
+    CK_SESSION_HANDLE session;
+    CK_FLAGS flags;
+    CK_BYTE user_pin[PKCS11_MAX_PIN_LEN];
+    CK_ULONG user_pin_len;
+    CK_RV rc;
+
+    CK_MECHANISM aes_keygen_mech = { CKM_AES_KEY_GEN, NULL, 0 };
+    CK_BYTE iv[16] = { 0 };
+    CK_MECHANISM wrap_mech = { CKM_AES_CBC_PAD, iv, sizeof(iv) };
+    CK_ULONG key_len = 32;
+    CK_BBOOL true = TRUE;
+    CK_BBOOL false = FALSE;
+    CK_OBJECT_CLASS class = CKO_PRIVATE_KEY;
+    CK_ATTRIBUTE aes_tmpl[] = {
+        {CKA_VALUE_LEN, &key_len, sizeof(key_len)},
+        {CKA_WRAP, &true, sizeof(true)},
+        {CKA_UNWRAP, &true, sizeof(true)}
+    };
+    CK_ATTRIBUTE priv_tmpl[] = {
+        {CKA_EXTRACTABLE, &true, sizeof(true)},
+        {CKA_SENSITIVE, &false, sizeof(false)}
+    };
+    CK_ATTRIBUTE unwrap_tmpl[] = {
+        {CKA_CLASS, &class, sizeof(class)},
+        {CKA_KEY_TYPE, &key_type, sizeof(key_type)},
+        {CKA_TOKEN, &false, sizeof(false)}
+    };
+    CK_OBJECT_HANDLE h_aes, h_publ, h_priv;
+    struct wrap_data op_data;
+    struct speed_stats stats;
+
+    testcase_begin("C_WrapKey/C_UnwrapKey of %s", name);
+
+    if (!mech_supported(SLOT_ID, keygen_mech->mechanism) ||
+        !mech_supported(SLOT_ID, CKM_AES_CBC_PAD)) {
+        testcase_skip("Slot %lu doesn't support mechanism 0x%lx or "
+                      "CKM_AES_CBC_PAD", SLOT_ID, keygen_mech->mechanism);
+        return TRUE;
+    }
+
+    testcase_new_assertion();
+
+    op_data.h_unwrapped = CK_INVALID_HANDLE;
+
+    testcase_rw_session();
+    testcase_user_login();
+
+    rc = funcs->C_GenerateKey(session, &aes_keygen_mech, aes_tmpl,
+                              sizeof(aes_tmpl) / sizeof(CK_ATTRIBUTE), &h_aes);
+    if (rc != CKR_OK) {
+        testcase_error("C_GenerateKey rc=%s", p11_get_ckr(rc));
+        goto testcase_cleanup;
+    }
+
+    rc = funcs->C_GenerateKeyPair(session, keygen_mech,
+                                  publ_tmpl, publ_tmpl_len,
+                                  priv_tmpl,
+                                  sizeof(priv_tmpl) / sizeof(CK_ATTRIBUTE),
+                                  &h_publ, &h_priv);
+    if (rc != CKR_OK) {
+        testcase_error("C_GenerateKeyPair rc=%s", p11_get_ckr(rc));
+        goto testcase_cleanup;
+    }
+
+    op_data.session = session;
+    op_data.mech = &wrap_mech;
+    op_data.h_wrapping_key = h_aes;
+    op_data.h_key = h_priv;
+    op_data.unwrap_tmpl = unwrap_tmpl;
+    op_data.unwrap_tmpl_len = sizeof(unwrap_tmpl) / sizeof(CK_ATTRIBUTE);
+
+    rc = speed_measure(NULL, wrap_op, &op_data, 100, &stats);
+    if (rc != CKR_OK)
+        goto testcase_cleanup;
+
+    printf("wrap: %lu iterations (%lu bytes wrapped): total=%luus min=%luus "
+           "max=%luus avg=%luus\n", stats.iterations, op_data.wrapped_len,
+           stats.tot_time, stats.min_time, stats.max_time, stats.avg_time);
+
+    /* The key unwrapped by the previous call is destroyed before each call */
+    rc = speed_measure(unwrap_cleanup_op, unwrap_op, &op_data, 100, &stats);
+    if (rc != CKR_OK)
+        goto testcase_cleanup;
+
+    printf("unwrap: %lu iterations (%lu bytes wrapped): total=%luus "
+           "min=%luus max=%luus avg=%luus\n", stats.iterations,
+           op_data.wrapped_len, stats.tot_time, stats.min_time,
+           stats.max_time, stats.avg_time);
+
+    testcase_pass("C_WrapKey/C_UnwrapKey of %s", name);
+
+testcase_cleanup:
+    if (op_data.h_unwrapped != CK_INVALID_HANDLE)
+        funcs->C_DestroyObject(session, op_data.h_unwrapped);
+    testcase_closeall_session();
+    if (rc != CKR_OK)
+        return FALSE;
+
+    return TRUE;
+}
+
+void speed_usage(char *fct)
+{
+    printf("usage:  %s -slot <num>", fct);
+    printf(" [-rsa_keygen] [-rsa_signverify]");
+    printf(" [-rsa_endecrypt] [-des3] [-aes] [-sha] [-hmac] [-findobjects]");
+    printf(" [-getattr] [-update] [-xts] [-threads] [-rng] [-login]");
+    printf(" [-wrap]");
+    printf(" [-h] \n\n");
+
+    return;
+}
+
+int main(int argc, char **argv)
+{
+    CK_C_INITIALIZE_ARGS cinit_args;
+    int rc, i;
+    int do_rsa_keygen = 0;
+    int do_rsa_signverify = 0;
+    int do_rsa_endecrypt = 0;
+    int do_des3_endecrypt = 0;
+    int do_aes_endecrypt = 0;
+    int do_sha = 0;
+    int do_hmac = 0;
+    int do_findobjects = 0;
+    int do_getattr = 0;
+    int do_update = 0;
+    int do_xts = 0;
+    int do_threads = 0;
+    int do_rng = 0;
+    int do_login = 0;
+    int do_wrap = 0;
+    CK_BYTE iv[16] = { 0 };
+    CK_MECHANISM aes_cbc = { CKM_AES_CBC, iv, 16 };
+    CK_MECHANISM aes_ofb = { CKM_AES_OFB, iv, 16 };
+    CK_MECHANISM des3_cbc = { CKM_DES3_CBC, iv, 8 };
+    CK_MECHANISM aes_xts = { CKM_AES_XTS, iv, 16 };
+    CK_ATTRIBUTE_TYPE ulong_attr[] = { CKA_KEY_TYPE };
+    CK_ATTRIBUTE_TYPE bool_attr[] = { CKA_ENCRYPT };
+    CK_MECHANISM rsa_keygen = { CKM_RSA_PKCS_KEY_PAIR_GEN, NULL, 0 };
+    CK_MECHANISM ec_keygen = { CKM_EC_KEY_PAIR_GEN, NULL, 0 };
+    CK_MECHANISM dilithium_keygen = { CKM_IBM_DILITHIUM, NULL, 0 };
+    CK_MECHANISM kyber_keygen = { CKM_IBM_KYBER, NULL, 0 };
+    CK_ULONG rsa_bits = 4096;
+    CK_BYTE rsa_pub_exp[] = { 0x01, 0x00, 0x01 };
+    CK_BYTE prime256v1[] = { 0x06, 0x08, 0x2A, 0x86, 0x48, 0xCE, 0x3D, 0x03,
+                             0x01, 0x07 };
+    CK_BYTE secp521r1[] = { 0x06, 0x05, 0x2B, 0x81, 0x04, 0x00, 0x23 };
+    CK_ULONG dilithium_keyform = CK_IBM_DILITHIUM_KEYFORM_ROUND2_65;
+    CK_ULONG kyber_keyform = CK_IBM_KYBER_KEYFORM_ROUND2_1024;
+    CK_ATTRIBUTE rsa_tmpl[] = {
+        {CKA_MODULUS_BITS, &rsa_bits, sizeof(rsa_bits)},
+        {CKA_PUBLIC_EXPONENT, rsa_pub_exp, sizeof(rsa_pub_exp)}
+    };
+    CK_ATTRIBUTE p256_tmpl[] = {
+        {CKA_EC_PARAMS, prime256v1, sizeof(prime256v1)}
+    };
+    CK_ATTRIBUTE p521_tmpl[] = {
+        {CKA_EC_PARAMS, secp521r1, sizeof(secp521r1)}
+    };
+    CK_ATTRIBUTE dilithium_tmpl[] = {
+        {CKA_IBM_DILITHIUM_KEYFORM, &dilithium_keyform,
+         sizeof(dilithium_keyform)}
+    };
+    CK_ATTRIBUTE kyber_tmpl[] = {
+        {CKA_IBM_KYBER_KEYFORM, &kyber_keyform, sizeof(kyber_keyform)}
+    };
+    CK_ATTRIBUTE_TYPE multi_attr[] = {
+        CKA_CLASS, CKA_KEY_TYPE, CKA_TOKEN, CKA_PRIVATE, CKA_ENCRYPT,
+        CKA_DECRYPT, CKA_SIGN, CKA_VERIFY, CKA_WRAP, CKA_UNWRAP,
+        CKA_VALUE_LEN, CKA_LABEL
+    };
+
+    SLOT_ID = 1000;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-slot") == 0) {
+            if (i + 1 >= argc) {
+                printf("Slot number missing\n");
+                return -1;
+            }
+            SLOT_ID = atoi(argv[i + 1]);
+            i++;
+            continue;
+        }
+        if (strcmp(argv[i], "-rsa_keygen") == 0) {
+            do_rsa_keygen = 1;
+        } else if (strcmp(argv[i], "-rsa_signverify") == 0) {
+            do_rsa_signverify = 1;
+        } else if (strcmp(argv[i], "-rsa_endecrypt") == 0) {
+            do_rsa_endecrypt = 1;
+        } else if (strcmp(argv[i], "-des3") == 0) {
+            do_des3_endecrypt = 1;
+        } else if (strcmp(argv[i], "-aes") == 0) {
+            do_aes_endecrypt = 1;
+        } else if (strcmp(argv[i], "-sha") == 0) {
+            do_sha = 1;
+        } else if (strcmp(argv[i], "-hmac") == 0) {
+            do_hmac = 1;
+        } else if (strcmp(argv[i], "-findobjects") == 0) {
+            do_findobjects = 1;
+        } else if (strcmp(argv[i], "-getattr") == 0) {
+            do_getattr = 1;
+        } else if (strcmp(argv[i], "-update") == 0) {
+            do_update = 1;
+        } else if (strcmp(argv[i], "-xts") == 0) {
+            do_xts = 1;
+        } else if (strcmp(argv[i], "-threads") == 0) {
+            do_threads = 1;
+        } else if (strcmp(argv[i], "-rng") == 0) {
+            do_rng = 1;
+        } else if (strcmp(argv[i], "-login") == 0) {
+            do_login = 1;
+        } else if (strcmp(argv[i], "-wrap") == 0) {
+            do_wrap = 1;
+        } else if (strcmp(argv[i], "-h") == 0) {
+            speed_usage(argv[0]);
+            return 0;
+        } else {
+            printf("unknown option '%s'\n", argv[i]);
+            speed_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // error if slot has not been identified.
+    if (SLOT_ID == 1000) {
+        printf("Please specify the slot to be tested.\n");
+        speed_usage(argv[0]);
+        return 1;
+    }
+
+    if (do_rsa_keygen + do_rsa_signverify + do_rsa_endecrypt
+        + do_des3_endecrypt + do_aes_endecrypt + do_sha + do_hmac
+        + do_findobjects + do_getattr + do_update + do_xts
+        + do_threads + do_rng + do_login + do_wrap == 0) {
+        do_rsa_keygen = 1;
+        do_rsa_signverify = 1;
+        do_rsa_endecrypt = 1;
+        do_des3_endecrypt = 1;
+        do_aes_endecrypt = 1;
+        do_sha = 1;
+        do_hmac = 1;
+        do_findobjects = 1;
+        do_getattr = 1;
+        do_update = 1;
+        do_xts = 1;
+        do_threads = 1;
+        do_rng = 1;
+        do_login = 1;
+        do_wrap = 1;
+    }
+
+    printf("Using slot #%lu...\n\n", SLOT_ID);
+
+    rc = do_GetFunctionList();
+    if (!rc)
+        return rc;
+
+    memset(&cinit_args, 0x0, sizeof(cinit_args));
+    cinit_args.flags = CKF_OS_LOCKING_OK;
+
+    funcs->C_Initialize(&cinit_args);
+
+    testcase_setup();
+
+    if (do_rsa_keygen) {
+        testsuite_begin("RSA Keygen.");
+        rc = do_RSA_KeyGen(1024);
+        if (!rc)
+            goto out;
+        rc = do_RSA_KeyGen(2048);
+        if (!rc)
+            goto out;
+        rc = do_RSA_KeyGen(4096);
+        if (!rc)
+            goto out;
+    }
+
+    if (do_rsa_signverify) {
+        testsuite_begin("RSA Sign/Verify.");
+        rc = do_RSA_PKCS_SignVerify(1024);
+        if (!rc)
+            goto out;
+        rc = do_RSA_PKCS_SignVerify(2048);
+        if (!rc)
+            goto out;
+        rc = do_RSA_PKCS_SignVerify(4096);
+        if (!rc)
+            goto out;
+    }
+
+    if (do_rsa_endecrypt) {
+        testsuite_begin("RSA Encrypt/Decrypt.");
+        rc = do_RSA_PKCS_EncryptDecrypt(1024);
+        if (!rc)
+            goto out;
+        rc = do_RSA_PKCS_EncryptDecrypt(2048);
+        if (!rc)
+            goto out;
+        rc = do_RSA_PKCS_EncryptDecrypt(4096);
+        if (!rc)
+            goto out;
+    }
+
+    if (do_des3_endecrypt) {
+        testsuite_begin("DES3 Encrypt/Decrypt.");
+        rc = do_DES3_EncrDecr("ECB");
+        if (!rc)
+            goto out;
+        rc = do_DES3_EncrDecr("CBC");
+        if (!rc)
+            goto out;
+    }
+
+    if (do_aes_endecrypt) {
+        testsuite_begin("AES Encrypt/Decrypt.");
+        rc = do_AES_EncrDecr(128, "ECB");
+        if (!rc)
+            goto out;
         rc = do_AES_EncrDecr(128, "CBC");
         if (!rc)
             goto out;
@@ -1178,6 +2566,163 @@ int main(int argc, char **argv)
             goto out;
     }
 
+    if (do_hmac) {
+        testsuite_begin("HMAC Sign.");
+        rc = do_HMAC(CKM_SHA256_HMAC, "SHA256-HMAC", 64);
+        if (!rc)
+            goto out;
+        rc = do_HMAC(CKM_SHA256_HMAC, "SHA256-HMAC", 1024);
+        if (!rc)
+            goto out;
+        rc = do_HMAC(CKM_SHA512_HMAC, "SHA512-HMAC", 64);
+        if (!rc)
+            goto out;
+    }
+
+    if (do_findobjects) {
+        testsuite_begin("Find Objects.");
+        rc = do_FindObjects(100);
+        if (!rc)
+            goto out;
+        rc = do_FindObjects(1000);
+        if (!rc)
+            goto out;
+        rc = do_FindObjects(10000);
+        if (!rc)
+            goto out;
+        rc = do_FindObjects(50000);
+        if (!rc)
+            goto out;
+        rc = do_FindObjectsGetAttributes(50000);
+        if (!rc)
+            goto out;
+    }
+
+    if (do_getattr) {
+        testsuite_begin("Get Attribute Value.");
+        rc = do_GetAttributeValue("CKA_KEY_TYPE", ulong_attr,
+                                  sizeof(ulong_attr) / sizeof(ulong_attr[0]));
+        if (!rc)
+            goto out;
+        rc = do_GetAttributeValue("CKA_ENCRYPT", bool_attr,
+                                  sizeof(bool_attr) / sizeof(bool_attr[0]));
+        if (!rc)
+            goto out;
+        rc = do_GetAttributeValue("12 attributes", multi_attr,
+                                  sizeof(multi_attr) / sizeof(multi_attr[0]));
+        if (!rc)
+            goto out;
+    }
+
+    if (do_update) {
+        testsuite_begin("Multi-part Encrypt/Decrypt.");
+        rc = do_EncrDecrUpdate("AES-CBC", CKM_AES_KEY_GEN, 32, &aes_cbc,
+                               65536);
+        if (!rc)
+            goto out;
+        rc = do_EncrDecrUpdate("AES-CBC", CKM_AES_KEY_GEN, 32, &aes_cbc,
+                               65535);
+        if (!rc)
+            goto out;
+        rc = do_EncrDecrUpdate("AES-OFB", CKM_AES_KEY_GEN, 32, &aes_ofb,
+                               65536);
+        if (!rc)
+            goto out;
+        rc = do_EncrDecrUpdate("DES3-CBC", CKM_DES3_KEY_GEN, 24, &des3_cbc,
+                               65536);
+        if (!rc)
+            goto out;
+    }
+
+    if (do_xts) {
+        testsuite_begin("AES-XTS Encrypt/Decrypt.");
+        rc = do_AES_XTS(512);
+        if (!rc)
+            goto out;
+        rc = do_AES_XTS(4096);
+        if (!rc)
+            goto out;
+        rc = do_AES_XTS(65536);
+        if (!rc)
+            goto out;
+        rc = do_AES_XTS(1024 * 1024);
+        if (!rc)
+            goto out;
+        rc = do_EncrDecrUpdate("AES-XTS", CKM_AES_XTS_KEY_GEN, 64, &aes_xts,
+                               65536);
+        if (!rc)
+            goto out;
+        rc = do_EncrDecrUpdate("AES-XTS", CKM_AES_XTS_KEY_GEN, 64, &aes_xts,
+                               65535);
+        if (!rc)
+            goto out;
+    }
+
+    if (do_threads) {
+        testsuite_begin("Multi-threaded Encrypt.");
+        rc = do_MultiThreadEncrypt(1);
+        if (!rc)
+            goto out;
+        rc = do_MultiThreadEncrypt(8);
+        if (!rc)
+            goto out;
+        rc = do_MultiThreadEncrypt(64);
+        if (!rc)
+            goto out;
+    }
+
+    if (do_rng) {
+        testsuite_begin("Generate Random.");
+        rc = do_GenerateRandom(16);
+        if (!rc)
+            goto out;
+        rc = do_GenerateRandom(256);
+        if (!rc)
+            goto out;
+        rc = do_GenerateRandom(65536);
+        if (!rc)
+            goto out;
+    }
+
+    if (do_login) {
+        testsuite_begin("Login.");
+        rc = do_Login(0);
+        if (!rc)
+            goto out;
+        rc = do_Login(1000);
+        if (!rc)
+            goto out;
+        rc = do_Login(5000);
+        if (!rc)
+            goto out;
+    }
+
+    if (do_wrap) {
+        testsuite_begin("Wrap/Unwrap Key.");
+        rc = do_WrapUnwrapKey("RSA-4096", &rsa_keygen, rsa_tmpl,
+                              sizeof(rsa_tmpl) / sizeof(CK_ATTRIBUTE), CKK_RSA);
+        if (!rc)
+            goto out;
+        rc = do_WrapUnwrapKey("EC prime256v1", &ec_keygen, p256_tmpl,
+                              sizeof(p256_tmpl) / sizeof(CK_ATTRIBUTE), CKK_EC);
+        if (!rc)
+            goto out;
+        rc = do_WrapUnwrapKey("EC secp521r1", &ec_keygen, p521_tmpl,
+                              sizeof(p521_tmpl) / sizeof(CK_ATTRIBUTE), CKK_EC);
+        if (!rc)
+            goto out;
+        rc = do_WrapUnwrapKey("Dilithium", &dilithium_keygen, dilithium_tmpl,
+                              sizeof(dilithium_tmpl) / sizeof(CK_ATTRIBUTE),
+                              CKK_IBM_PQC_DILITHIUM);
+        if (!rc)
+            goto out;
+        rc = do_WrapUnwrapKey("Kyber", &kyber_keygen, kyber_tmpl,
+                              sizeof(kyber_tmpl) / sizeof(CK_ATTRIBUTE),
+                              CKK_IBM_PQC_KYBER);
+        if (!rc)
+            goto out;
+    }
+
 out:
     testcase_print_result();
 
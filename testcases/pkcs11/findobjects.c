@@ -22,12 +22,14 @@
  * C_FindObjectsInit
  * C_FindObjects
  * C_CreateObject
+ * C_IBM_FindObjectsGetAttributes
  *
- * 3 TestCases
+ * 4 TestCases
  * Setup: Create 2 3des objects and 2 aes private objects
  * Testcase 1: Find only the 3des key objects.
  * Testcase 2: Find only the aes session objects that were created.
  * Testcase 3: Find all the objects.
+ * Testcase 4: Find the 3des key objects with their attributes in bulk.
  */
 CK_RV do_FindObjects(void)
 {
@@ -45,6 +47,16 @@ CK_RV do_FindObjects(void)
     CK_ULONG num_objs = 0;
     CK_ULONG i;
 
+    CK_VERSION ibm_version = { 1, 1 };
+    CK_INTERFACE *ibm_interface = NULL;
+    CK_IBM_FUNCTION_LIST_1_1 *ibm_funcs;
+    CK_ATTRIBUTE_TYPE bulk_types[] = { CKA_ID, CKA_MODULUS, CKA_KEY_TYPE };
+    CK_BYTE bulk_buf[1024];
+    CK_ULONG bulk_len;
+    CK_IBM_OBJECT_RECORD rec;
+    CK_IBM_ATTRIBUTE_VALUE val;
+    CK_BYTE *ptr;
+
     CK_OBJECT_CLASS key_class = CKO_SECRET_KEY;
     CK_KEY_TYPE aes_type = CKK_AES;
     CK_KEY_TYPE des3_type = CKK_DES3;
@@ -250,6 +262,112 @@ CK_RV do_FindObjects(void)
 
     testcase_pass("Found all the objects.");
 
+    /* Testcase 4: Find the 2 des3 key objects with attributes in bulk */
+    testcase_new_assertion();
+
+    rc = funcs3->C_GetInterface((CK_UTF8CHAR *)"Vendor IBM", &ibm_version,
+                                &ibm_interface, 0);
+    if (rc != CKR_OK) {
+        testcase_skip("Vendor IBM interface version 1.1 not available");
+        goto testcase_cleanup;
+    }
+    ibm_funcs = ibm_interface->pFunctionList;
+
+    not_found = 0;
+    find_count = 0;
+
+    rc = funcs->C_FindObjectsInit(session, search_des3_tmpl, 2);
+    if (rc != CKR_OK) {
+        testcase_fail("C_FindObjectsInit() rc = %s", p11_get_ckr(rc));
+        goto testcase_cleanup;
+    }
+
+    /* Too small for a single record: must report the needed size */
+    bulk_len = sizeof(rec);
+    rc = ibm_funcs->C_IBM_FindObjectsGetAttributes(session, bulk_types, 3,
+                                                   bulk_buf, &bulk_len,
+                                                   &find_count);
+    if (rc == CKR_FUNCTION_NOT_SUPPORTED) {
+        funcs->C_FindObjectsFinal(session);
+        testcase_skip("C_IBM_FindObjectsGetAttributes not supported");
+        goto testcase_cleanup;
+    }
+    if (rc != CKR_BUFFER_TOO_SMALL || bulk_len <= sizeof(rec)) {
+        funcs->C_FindObjectsFinal(session);
+        testcase_fail("C_IBM_FindObjectsGetAttributes() rc = %s, len = %lu",
+                      p11_get_ckr(rc), bulk_len);
+        goto testcase_cleanup;
+    }
+
+    bulk_len = sizeof(bulk_buf);
+    rc = ibm_funcs->C_IBM_FindObjectsGetAttributes(session, bulk_types, 3,
+                                                   bulk_buf, &bulk_len,
+                                                   &find_count);
+    if (rc != CKR_OK) {
+        funcs->C_FindObjectsFinal(session);
+        testcase_fail("C_IBM_FindObjectsGetAttributes() rc = %s",
+                      p11_get_ckr(rc));
+        goto testcase_cleanup;
+    }
+
+    if (find_count != 2) {
+        funcs->C_FindObjectsFinal(session);
+        testcase_fail("Should have found 2 des3 key objects, found %d",
+                      (int) find_count);
+        goto testcase_cleanup;
+    }
+
+    /* Examine the 2 records: CKA_ID, missing CKA_MODULUS, CKA_KEY_TYPE */
+    for (i = 0, ptr = bulk_buf; i < find_count; i++, ptr += rec.ulRecordLen) {
+        memcpy(&rec, ptr, sizeof(rec));
+        if ((rec.hObject != keyobj[0]) && (rec.hObject != keyobj[1]))
+            not_found++;
+
+        memcpy(&val, ptr + sizeof(rec), sizeof(val));
+        if (val.type != CKA_ID || val.ulValueLen != sizeof(test1_id) ||
+            memcmp(ptr + sizeof(rec) + sizeof(val), test1_id,
+                   sizeof(test1_id)) != 0)
+            not_found++;
+
+        memcpy(&val, ptr + rec.ulRecordLen - 2 * sizeof(val) -
+               sizeof(CK_KEY_TYPE), sizeof(val));
+        if (val.type != CKA_MODULUS ||
+            val.ulValueLen != CK_UNAVAILABLE_INFORMATION)
+            not_found++;
+
+        memcpy(&val, ptr + rec.ulRecordLen - sizeof(val) -
+               sizeof(CK_KEY_TYPE), sizeof(val));
+        if (val.type != CKA_KEY_TYPE || val.ulValueLen != sizeof(CK_KEY_TYPE) ||
+            memcmp(ptr + rec.ulRecordLen - sizeof(CK_KEY_TYPE), &des3_type,
+                   sizeof(des3_type)) != 0)
+            not_found++;
+    }
+
+    /* The find operation must be exhausted now */
+    bulk_len = sizeof(bulk_buf);
+    rc = ibm_funcs->C_IBM_FindObjectsGetAttributes(session, bulk_types, 3,
+                                                   bulk_buf, &bulk_len,
+                                                   &find_count);
+    if (rc != CKR_OK || find_count != 0 || bulk_len != 0) {
+        funcs->C_FindObjectsFinal(session);
+        testcase_fail("C_IBM_FindObjectsGetAttributes() rc = %s, "
+                      "found %lu more objects", p11_get_ckr(rc), find_count);
+        goto testcase_cleanup;
+    }
+
+    rc = funcs->C_FindObjectsFinal(session);
+    if (rc != CKR_OK) {
+        testcase_fail("C_FindObjectsFinal() rc = %s", p11_get_ckr(rc));
+        goto testcase_cleanup;
+    }
+
+    if (not_found) {
+        testcase_fail("Wrong objects or attributes found!");
+        goto testcase_cleanup;
+    }
+
+    testcase_pass("Found the 2 des3 key objects with their attributes.");
+
 testcase_cleanup:
 /*	for (i=0; i<num_objs; i++)
 		funcs->C_DestroyObject(session, keyobj[i]);
@@ -0,0 +1,214 @@
+/*
+ * COPYRIGHT (c) International Business Machines Corp. 2026
+ *
+ * This program is provided under the terms of the Common Public License,
+ * version 1.0 (CPL-1.0). Any use, reproduction or distribution for this
+ * software constitutes recipient's acceptance of CPL-1.0 terms which can be
+ * found in the file LICENSE file or at
+ * https://opensource.org/licenses/cpl1.0.php
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "pkcs11types.h"
+#include "local_types.h"
+#include "unittest.h"
+
+#define NUM_NODES       1000
+#define NUM_THREADS     16
+#define NUM_ITERATIONS  20000
+
+struct testvalue {
+    struct bt_ref_hdr hdr;
+    unsigned long id;
+};
+
+static unsigned long deleted;
+
+static void delete_value(void *value)
+{
+    __atomic_add_fetch(&deleted, 1, __ATOMIC_RELAXED);
+    free(value);
+}
+
+static struct testvalue *new_value(unsigned long id)
+{
+    struct testvalue *v = calloc(1, sizeof(*v));
+
+    if (v != NULL)
+        v->id = id;
+    return v;
+}
+
+static int testserial(void)
+{
+    struct btree t;
+    struct testvalue *v;
+    unsigned long i, h;
+    int res = -1;
+
+    deleted = 0;
+    if (bt_init(&t, delete_value) != CKR_OK) {
+        fprintf(stderr, "bt_init failed\n");
+        return -1;
+    }
+
+    for (i = 1; i <= NUM_NODES; i++) {
+        h = bt_node_add(&t, new_value(i));
+        if (h != i) {
+            fprintf(stderr, "Node %lu added with handle %lu\n", i, h);
+            goto out;
+        }
+    }
+
+    for (i = 1; i <= NUM_NODES; i++) {
+        v = bt_get_node_value(&t, i);
+        if (v == NULL || v->id != i) {
+            fprintf(stderr, "Wrong value for handle %lu\n", i);
+            goto out;
+        }
+        bt_put_node_value(&t, v);
+    }
+
+    if (bt_get_node_value(&t, 0) != NULL ||
+        bt_get_node_value(&t, NUM_NODES + 1) != NULL) {
+        fprintf(stderr, "Got a value for an invalid handle\n");
+        goto out;
+    }
+
+    for (i = 1; i <= NUM_NODES; i += 2)
+        bt_node_free(&t, i, 1);
+
+    if (bt_nodes_in_use(&t) != NUM_NODES / 2 || deleted != NUM_NODES / 2) {
+        fprintf(stderr, "Wrong number of nodes after free: %lu/%lu\n",
+                bt_nodes_in_use(&t), deleted);
+        goto out;
+    }
+
+    for (i = 1; i <= NUM_NODES; i++) {
+        v = bt_get_node_value(&t, i);
+        if ((i & 1) ? v != NULL : (v == NULL || v->id != i)) {
+            fprintf(stderr, "Wrong value for handle %lu after free\n", i);
+            goto out;
+        }
+        bt_put_node_value(&t, v);
+    }
+
+    /* Freed handles must be reused before the tree grows */
+    for (i = 1; i <= NUM_NODES; i += 2) {
+        h = bt_node_add(&t, new_value(0));
+        if (h == 0 || h > NUM_NODES || !(h & 1)) {
+            fprintf(stderr, "Freed handle not reused: %lu\n", h);
+            goto out;
+        }
+    }
+
+    if (bt_nodes_in_use(&t) != NUM_NODES) {
+        fprintf(stderr, "Wrong number of nodes after reuse\n");
+        goto out;
+    }
+
+    for (i = 1; i <= NUM_NODES; i++)
+        bt_node_free(&t, i, 1);
+
+    if (!bt_is_empty(&t) || deleted != NUM_NODES + NUM_NODES / 2) {
+        fprintf(stderr, "Tree not empty after freeing all nodes\n");
+        goto out;
+    }
+
+    res = 0;
+out:
+    bt_destroy(&t);
+    return res;
+}
+
+static struct btree ctree;
+static int cerrors;
+
+static void *concurrent_thread(void *arg)
+{
+    unsigned long id = (unsigned long)arg, i, h, r;
+    struct testvalue *v;
+
+    for (i = 0; i < NUM_ITERATIONS; i++) {
+        h = bt_node_add(&ctree, new_value(id));
+        if (h == 0) {
+            __atomic_add_fetch(&cerrors, 1, __ATOMIC_RELAXED);
+            break;
+        }
+
+        v = bt_get_node_value(&ctree, h);
+        if (v == NULL || v->id != id)
+            __atomic_add_fetch(&cerrors, 1, __ATOMIC_RELAXED);
+        bt_put_node_value(&ctree, v);
+
+        /* Look at a node that is concurrently added and freed */
+        r = (h * 2654435761UL + i) % (bt_nodes_in_use(&ctree) + 1) + 1;
+        v = bt_get_node_value(&ctree, r);
+        bt_put_node_value(&ctree, v);
+
+        if (bt_node_free(&ctree, h, 1) == NULL)
+            __atomic_add_fetch(&cerrors, 1, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+static int testconcurrent(void)
+{
+    pthread_t threads[NUM_THREADS];
+    unsigned long i;
+    int res = 0;
+
+    deleted = 0;
+    cerrors = 0;
+    if (bt_init(&ctree, delete_value) != CKR_OK) {
+        fprintf(stderr, "bt_init failed\n");
+        return -1;
+    }
+
+    for (i = 0; i < NUM_THREADS; i++) {
+        if (pthread_create(&threads[i], NULL, concurrent_thread,
+                           (void *)(i + 1)) != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            exit(TEST_FAIL);
+        }
+    }
+    for (i = 0; i < NUM_THREADS; i++)
+        pthread_join(threads[i], NULL);
+
+    if (cerrors != 0) {
+        fprintf(stderr, "%d errors in concurrent test\n", cerrors);
+        res = -1;
+    }
+    if (!bt_is_empty(&ctree) ||
+        deleted != (unsigned long)NUM_THREADS * NUM_ITERATIONS) {
+        fprintf(stderr, "Wrong state after concurrent test: %lu/%lu\n",
+                bt_nodes_in_use(&ctree), deleted);
+        res = -1;
+    }
+    /* A few extra nodes may be created while concurrent frees are pending */
+    if (ctree.size >= NUM_ITERATIONS) {
+        fprintf(stderr, "Freed nodes not reused: size %lu\n", ctree.size);
+        res = -1;
+    }
+
+    bt_destroy(&ctree);
+    return res;
+}
+
+int main(void)
+{
+    int res = TEST_PASS;
+
+    if (testserial()) {
+        fprintf(stderr, "testserial failed\n");
+        res = TEST_FAIL;
+    }
+    if (testconcurrent()) {
+        fprintf(stderr, "testconcurrent failed\n");
+        res = TEST_FAIL;
+    }
+    return res;
+}
@@ -0,0 +1,632 @@
+/*
+ * COPYRIGHT (c) International Business Machines Corp. 2026
+ *
+ * This program is provided under the terms of the Common Public License,
+ * version 1.0 (CPL-1.0). Any use, reproduction or distribution for this
+ * software constitutes recipient's acceptance of CPL-1.0 terms which can be
+ * found in the file LICENSE file or at
+ * https://opensource.org/licenses/cpl1.0.php
+ */
+
+/*
+ * Tests of the LDAP connection pool of the ICSF token against a mock LDAP
+ * server. The mock implements the few libldap functions used by icsf_call()
+ * and answers pipelined extended operations out of order.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "defs.h"
+#include "icsf.h"
+#include "attributes.h"
+#include "unittest.h"
+
+#define NUM_THREADS     4
+
+enum mock_failure {
+    MOCK_OK,
+    MOCK_FAIL_SEND,
+    MOCK_FAIL_RESULT,
+    MOCK_TIMEOUT,               /* ldap_result() fails with LDAP_TIMEOUT */
+};
+
+struct ldap {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    enum mock_failure failure;
+    int result_code;
+    int next_msgid;
+    /* Requests to collect before any response is delivered */
+    unsigned int pipeline;
+    unsigned int sent;
+    /* Highest message ID not yet answered, responses go out backwards */
+    int answer;
+};
+
+struct ldapmsg {
+    int msgid;
+};
+
+static __thread int last_msgid;
+static unsigned long connects, unbinds;
+
+/* While the bind gate is closed, mock_connect() blocks like a slow bind */
+static pthread_mutex_t bind_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bind_cond = PTHREAD_COND_INITIALIZER;
+static int bind_gate_closed;
+static unsigned int binds_waiting;
+
+static LDAP *mock_connect(void *private)
+{
+    LDAP *ld;
+
+    pthread_mutex_lock(&bind_mutex);
+    binds_waiting++;
+    pthread_cond_broadcast(&bind_cond);
+    while (bind_gate_closed)
+        pthread_cond_wait(&bind_cond, &bind_mutex);
+    binds_waiting--;
+    pthread_mutex_unlock(&bind_mutex);
+
+    ld = calloc(1, sizeof(*ld));
+    if (ld == NULL)
+        return NULL;
+    pthread_mutex_init(&ld->mutex, NULL);
+    pthread_cond_init(&ld->cond, NULL);
+    ld->next_msgid = 1;
+    ld->pipeline = *(unsigned int *)private;
+    __atomic_add_fetch(&connects, 1, __ATOMIC_RELAXED);
+
+    return ld;
+}
+
+static void mock_free(LDAP *ld)
+{
+    pthread_cond_destroy(&ld->cond);
+    pthread_mutex_destroy(&ld->mutex);
+    free(ld);
+    __atomic_add_fetch(&unbinds, 1, __ATOMIC_RELAXED);
+}
+
+int ldap_extended_operation(LDAP *ld, const char *reqoid,
+                            struct berval *reqdata, LDAPControl **sctrls,
+                            LDAPControl **cctrls, int *msgidp)
+{
+    UNUSED(reqoid);
+    UNUSED(reqdata);
+    UNUSED(sctrls);
+    UNUSED(cctrls);
+
+    pthread_mutex_lock(&ld->mutex);
+    if (ld->failure == MOCK_FAIL_SEND) {
+        pthread_mutex_unlock(&ld->mutex);
+        return LDAP_SERVER_DOWN;
+    }
+    *msgidp = ld->next_msgid++;
+    last_msgid = *msgidp;
+    ld->sent++;
+    ld->answer = *msgidp;
+    pthread_cond_broadcast(&ld->cond);
+    pthread_mutex_unlock(&ld->mutex);
+
+    return LDAP_SUCCESS;
+}
+
+int ldap_result(LDAP *ld, int msgid, int all, struct timeval *timeout,
+                LDAPMessage **result)
+{
+    int rc = -1;
+
+    UNUSED(all);
+    UNUSED(timeout);
+
+    pthread_mutex_lock(&ld->mutex);
+    if (ld->failure == MOCK_FAIL_RESULT) {
+        ld->result_code = LDAP_SERVER_DOWN;
+        goto done;
+    }
+    if (ld->failure == MOCK_TIMEOUT) {
+        ld->result_code = LDAP_TIMEOUT;
+        goto done;
+    }
+
+    /* Wait for the whole pipeline, then answer the newest request first */
+    while (ld->sent < ld->pipeline || ld->answer != msgid)
+        pthread_cond_wait(&ld->cond, &ld->mutex);
+
+    *result = malloc(sizeof(**result));
+    if (*result == NULL)
+        goto done;
+    (*result)->msgid = msgid;
+    ld->answer--;
+    pthread_cond_broadcast(&ld->cond);
+    rc = 0x78; /* LDAP_RES_EXTENDED */
+
+done:
+    pthread_mutex_unlock(&ld->mutex);
+    return rc;
+}
+
+/*
+ * The response carries the message ID as ICSF reason code, so each caller
+ * can check that it got the answer to its own request.
+ */
+int ldap_parse_extended_result(LDAP *ld, LDAPMessage *res, char **retoidp,
+                               struct berval **retdatap, int freeit)
+{
+    char handle[ICSF_HANDLE_LEN] = { 0 };
+    BerElement *ber;
+    int rc;
+
+    UNUSED(ld);
+    UNUSED(freeit);
+
+    *retoidp = NULL;
+    ber = ber_alloc_t(LBER_USE_DER);
+    if (ber == NULL)
+        return LDAP_OTHER;
+    rc = ber_printf(ber, "{iiiso}", 1, 0, res->msgid, "", handle,
+                    sizeof(handle));
+    if (rc >= 0)
+        rc = ber_flatten(ber, retdatap);
+    ber_free(ber, 1);
+
+    return rc < 0 ? LDAP_OTHER : LDAP_SUCCESS;
+}
+
+int ldap_parse_result(LDAP *ld, LDAPMessage *res, int *errcodep,
+                      char **matcheddnp, char **diagmsgp, char ***referralsp,
+                      LDAPControl ***serverctrls, int freeit)
+{
+    UNUSED(ld);
+    UNUSED(res);
+    UNUSED(matcheddnp);
+    UNUSED(referralsp);
+    UNUSED(serverctrls);
+    UNUSED(freeit);
+
+    *errcodep = LDAP_SUCCESS;
+    *diagmsgp = NULL;
+    return LDAP_SUCCESS;
+}
+
+int ldap_get_option(LDAP *ld, int option, void *outvalue)
+{
+    if (option != LDAP_OPT_RESULT_CODE)
+        return -1;
+    *(int *)outvalue = ld->result_code;
+    return LDAP_OPT_SUCCESS;
+}
+
+int ldap_unbind_ext(LDAP *ld, LDAPControl **sctrls, LDAPControl **cctrls)
+{
+    UNUSED(sctrls);
+    UNUSED(cctrls);
+
+    mock_free(ld);
+    return LDAP_SUCCESS;
+}
+
+int ldap_unbind_ext_s(LDAP *ld, LDAPControl **sctrls, LDAPControl **cctrls)
+{
+    UNUSED(sctrls);
+    UNUSED(cctrls);
+
+    mock_free(ld);
+    return LDAP_SUCCESS;
+}
+
+int ldap_msgfree(LDAPMessage *lm)
+{
+    free(lm);
+    return 0x78;
+}
+
+void ldap_memfree(void *p)
+{
+    free(p);
+}
+
+char *ldap_err2string(int err)
+{
+    UNUSED(err);
+
+    return "mock error";
+}
+
+/* Not used by the tests, only needed to link icsf.c */
+int ldap_initialize(LDAP **ldp, const char *url)
+{
+    UNUSED(ldp);
+    UNUSED(url);
+
+    return LDAP_OTHER;
+}
+
+int ldap_set_option(LDAP *ld, int option, const void *invalue)
+{
+    UNUSED(ld);
+    UNUSED(option);
+    UNUSED(invalue);
+
+    return -1;
+}
+
+int ldap_sasl_bind_s(LDAP *ld, const char *dn, const char *mechanism,
+                     struct berval *cred, LDAPControl **sctrls,
+                     LDAPControl **cctrls, struct berval **servercredp)
+{
+    UNUSED(ld);
+    UNUSED(dn);
+    UNUSED(mechanism);
+    UNUSED(cred);
+    UNUSED(sctrls);
+    UNUSED(cctrls);
+    UNUSED(servercredp);
+
+    return LDAP_OTHER;
+}
+
+int ldap_search_ext_s(LDAP *ld, const char *base, int scope,
+                      const char *filter, char **attrs, int attrsonly,
+                      LDAPControl **sctrls, LDAPControl **cctrls,
+                      struct timeval *timeout, int sizelimit,
+                      LDAPMessage **res)
+{
+    UNUSED(ld);
+    UNUSED(base);
+    UNUSED(scope);
+    UNUSED(filter);
+    UNUSED(attrs);
+    UNUSED(attrsonly);
+    UNUSED(sctrls);
+    UNUSED(cctrls);
+    UNUSED(timeout);
+    UNUSED(sizelimit);
+    UNUSED(res);
+
+    return LDAP_OTHER;
+}
+
+LDAPMessage *ldap_first_entry(LDAP *ld, LDAPMessage *chain)
+{
+    UNUSED(ld);
+    UNUSED(chain);
+
+    return NULL;
+}
+
+char *ldap_first_attribute(LDAP *ld, LDAPMessage *entry, BerElement **ber)
+{
+    UNUSED(ld);
+    UNUSED(entry);
+    UNUSED(ber);
+
+    return NULL;
+}
+
+char *ldap_next_attribute(LDAP *ld, LDAPMessage *entry, BerElement *ber)
+{
+    UNUSED(ld);
+    UNUSED(entry);
+    UNUSED(ber);
+
+    return NULL;
+}
+
+struct berval **ldap_get_values_len(LDAP *ld, LDAPMessage *entry,
+                                    const char *target)
+{
+    UNUSED(ld);
+    UNUSED(entry);
+    UNUSED(target);
+
+    return NULL;
+}
+
+void ldap_value_free_len(struct berval **vals)
+{
+    UNUSED(vals);
+}
+
+CK_RV add_to_attribute_array(CK_ATTRIBUTE_PTR *p_attrs,
+                             CK_ULONG_PTR p_attrs_len, CK_ATTRIBUTE_TYPE type,
+                             CK_BYTE_PTR value, CK_ULONG value_len)
+{
+    UNUSED(p_attrs);
+    UNUSED(p_attrs_len);
+    UNUSED(type);
+    UNUSED(value);
+    UNUSED(value_len);
+
+    return CKR_FUNCTION_FAILED;
+}
+
+void free_attribute_array(CK_ATTRIBUTE_PTR attrs, CK_ULONG attrs_len)
+{
+    UNUSED(attrs);
+    UNUSED(attrs_len);
+}
+
+static int destroy_object(LDAP *ld)
+{
+    struct icsf_object_record obj = { "TOKEN", 1, 'T' };
+    int reason = -1, rc;
+
+    rc = icsf_destroy_object(ld, &reason, &obj);
+    if (rc == 0 && reason != last_msgid) {
+        fprintf(stderr, "Got response %d for request %d\n", reason,
+                last_msgid);
+        return -1;
+    }
+
+    return rc;
+}
+
+struct thread_arg {
+    struct icsf_ldap_pool *pool;
+    int rc;
+};
+
+static void *pipeline_thread(void *arg)
+{
+    struct thread_arg *t = arg;
+    LDAP *ld;
+
+    ld = icsf_ldap_pool_get(t->pool);
+    if (ld == NULL) {
+        t->rc = -1;
+        return NULL;
+    }
+    t->rc = destroy_object(ld);
+    icsf_ldap_pool_put(t->pool, ld);
+
+    return NULL;
+}
+
+/*
+ * All threads share the single pooled connection. The mock only answers
+ * once every request was sent, so the test hangs unless the requests are
+ * really pipelined, and it answers them in reverse order.
+ */
+static int testpipeline(void)
+{
+    struct icsf_ldap_pool pool;
+    unsigned int pipeline = NUM_THREADS;
+    struct thread_arg args[NUM_THREADS];
+    pthread_t threads[NUM_THREADS];
+    int i, res = 0;
+
+    connects = unbinds = 0;
+    if (icsf_ldap_pool_init(&pool, 1, mock_connect, &pipeline) != 0) {
+        fprintf(stderr, "icsf_ldap_pool_init failed\n");
+        return -1;
+    }
+
+    for (i = 0; i < NUM_THREADS; i++) {
+        args[i].pool = &pool;
+        args[i].rc = -1;
+        if (pthread_create(&threads[i], NULL, pipeline_thread, &args[i])) {
+            fprintf(stderr, "pthread_create failed\n");
+            return -1;
+        }
+    }
+    for (i = 0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        if (args[i].rc != 0) {
+            fprintf(stderr, "Pipelined request of thread %d failed\n", i);
+            res = -1;
+        }
+    }
+
+    if (connects != 1) {
+        fprintf(stderr, "%lu connections bound instead of 1\n", connects);
+        res = -1;
+    }
+
+    icsf_ldap_pool_close(&pool, 0);
+    icsf_ldap_pool_destroy(&pool);
+    if (unbinds != connects) {
+        fprintf(stderr, "%lu of %lu connections unbound\n", unbinds,
+                connects);
+        res = -1;
+    }
+
+    return res;
+}
+
+/*
+ * A request failing because the connection was lost marks it broken. The
+ * next borrower gets a new connection, and the broken one is unbound once
+ * its last user gives it back.
+ */
+static int testreconnect(enum mock_failure failure)
+{
+    struct icsf_ldap_pool pool;
+    unsigned int pipeline = 1;
+    LDAP *ld1, *ld2, *ld3;
+    int res = -1;
+
+    connects = unbinds = 0;
+    if (icsf_ldap_pool_init(&pool, 1, mock_connect, &pipeline) != 0) {
+        fprintf(stderr, "icsf_ldap_pool_init failed\n");
+        return -1;
+    }
+
+    ld1 = icsf_ldap_pool_get(&pool);
+    if (ld1 == NULL || destroy_object(ld1) != 0) {
+        fprintf(stderr, "Request on healthy connection failed\n");
+        goto out;
+    }
+
+    ld1->failure = failure;
+    if (destroy_object(ld1) == 0) {
+        fprintf(stderr, "Request on lost connection succeeded\n");
+        goto out;
+    }
+    if (!icsf_ldap_is_broken(ld1)) {
+        fprintf(stderr, "Lost connection not marked broken\n");
+        goto out;
+    }
+
+    /* The broken connection is still in use, but must not be handed out */
+    ld2 = icsf_ldap_pool_get(&pool);
+    if (ld2 == NULL || ld2 == ld1 || connects != 2) {
+        fprintf(stderr, "No new connection for a broken one\n");
+        goto out;
+    }
+    if (destroy_object(ld2) != 0) {
+        fprintf(stderr, "Request on new connection failed\n");
+        goto out;
+    }
+
+    icsf_ldap_pool_put(&pool, ld1);
+    if (unbinds != 1) {
+        fprintf(stderr, "Broken connection not unbound when put\n");
+        goto out;
+    }
+
+    /* The healthy connection is shared again */
+    icsf_ldap_pool_put(&pool, ld2);
+    ld3 = icsf_ldap_pool_get(&pool);
+    if (ld3 != ld2 || connects != 2) {
+        fprintf(stderr, "Healthy connection not reused\n");
+        goto out;
+    }
+    icsf_ldap_pool_put(&pool, ld3);
+
+    res = 0;
+
+out:
+    icsf_ldap_pool_close(&pool, 0);
+    icsf_ldap_pool_destroy(&pool);
+    if (res == 0 && unbinds != connects) {
+        fprintf(stderr, "%lu of %lu connections unbound\n", unbinds,
+                connects);
+        res = -1;
+    }
+
+    return res;
+}
+
+struct get_arg {
+    struct icsf_ldap_pool *pool;
+    LDAP *ld;
+};
+
+static void *get_thread(void *arg)
+{
+    struct get_arg *t = arg;
+
+    t->ld = icsf_ldap_pool_get(t->pool);
+
+    return NULL;
+}
+
+/*
+ * While one session binds a new connection, another one shares the pooled
+ * connection. The test hangs if the bind is done with the pool lock held.
+ */
+static int testslowbind(void)
+{
+    struct icsf_ldap_pool pool;
+    unsigned int pipeline = 1;
+    struct get_arg arg;
+    pthread_t thread;
+    LDAP *ld1, *ld2;
+    int res = -1;
+
+    connects = unbinds = 0;
+    if (icsf_ldap_pool_init(&pool, 2, mock_connect, &pipeline) != 0) {
+        fprintf(stderr, "icsf_ldap_pool_init failed\n");
+        return -1;
+    }
+
+    ld1 = icsf_ldap_pool_get(&pool);
+    if (ld1 == NULL) {
+        fprintf(stderr, "No connection\n");
+        goto out;
+    }
+
+    /* ld1 is in use, so the next borrower binds a second connection */
+    pthread_mutex_lock(&bind_mutex);
+    bind_gate_closed = 1;
+    pthread_mutex_unlock(&bind_mutex);
+
+    arg.pool = &pool;
+    arg.ld = NULL;
+    if (pthread_create(&thread, NULL, get_thread, &arg)) {
+        fprintf(stderr, "pthread_create failed\n");
+        goto out;
+    }
+
+    pthread_mutex_lock(&bind_mutex);
+    while (binds_waiting == 0)
+        pthread_cond_wait(&bind_cond, &bind_mutex);
+    pthread_mutex_unlock(&bind_mutex);
+
+    /* The pool is full with the pending bind, ld1 must be shared */
+    ld2 = icsf_ldap_pool_get(&pool);
+
+    pthread_mutex_lock(&bind_mutex);
+    bind_gate_closed = 0;
+    pthread_cond_broadcast(&bind_cond);
+    pthread_mutex_unlock(&bind_mutex);
+    pthread_join(thread, NULL);
+
+    if (ld2 != ld1) {
+        fprintf(stderr, "Pooled connection not shared during a bind\n");
+        goto out;
+    }
+    if (arg.ld == NULL || arg.ld == ld1 || connects != 2) {
+        fprintf(stderr, "Slow bind did not add a connection\n");
+        goto out;
+    }
+
+    icsf_ldap_pool_put(&pool, arg.ld);
+    icsf_ldap_pool_put(&pool, ld2);
+    icsf_ldap_pool_put(&pool, ld1);
+
+    res = 0;
+
+out:
+    icsf_ldap_pool_close(&pool, 0);
+    icsf_ldap_pool_destroy(&pool);
+    if (res == 0 && unbinds != connects) {
+        fprintf(stderr, "%lu of %lu connections unbound\n", unbinds,
+                connects);
+        res = -1;
+    }
+
+    return res;
+}
+
+int main(void)
+{
+    int res = TEST_PASS;
+
+    if (testpipeline()) {
+        fprintf(stderr, "Pipelined requests test failed\n");
+        res = TEST_FAIL;
+    }
+    if (testreconnect(MOCK_FAIL_SEND)) {
+        fprintf(stderr, "Reconnect after send failure test failed\n");
+        res = TEST_FAIL;
+    }
+    if (testreconnect(MOCK_FAIL_RESULT)) {
+        fprintf(stderr, "Reconnect after receive failure test failed\n");
+        res = TEST_FAIL;
+    }
+    if (testreconnect(MOCK_TIMEOUT)) {
+        fprintf(stderr, "Reconnect after timeout test failed\n");
+        res = TEST_FAIL;
+    }
+    if (testslowbind()) {
+        fprintf(stderr, "Slow bind test failed\n");
+        res = TEST_FAIL;
+    }
+
+    return res;
+}
@@ -0,0 +1,315 @@
+/*
+ * COPYRIGHT (c) International Business Machines Corp. 2026
+ *
+ * This program is provided under the terms of the Common Public License,
+ * version 1.0 (CPL-1.0). Any use, reproduction or distribution for this
+ * software constitutes recipient's acceptance of CPL-1.0 terms which can be
+ * found in the file LICENSE file or at
+ * https://opensource.org/licenses/cpl1.0.php
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "pkcs11types.h"
+#include "logstore.h"
+#include "unittest.h"
+
+#define NUM_OBJS    1000
+
+static char path[64];
+
+static void make_name(unsigned long i, CK_BYTE *name)
+{
+    char tmp[LOGSTORE_NAME_LEN + 1];
+
+    snprintf(tmp, sizeof(tmp), "OB%06lu", i);
+    memcpy(name, tmp, LOGSTORE_NAME_LEN);
+}
+
+/* Object i has version v: i + v bytes of the value (i + v) & 0xff */
+static CK_RV put_obj(logstore_t *ls, unsigned long i, unsigned long v)
+{
+    CK_BYTE name[LOGSTORE_NAME_LEN], *data;
+    CK_RV rc;
+
+    data = malloc(i + v + 1);
+    if (data == NULL)
+        return CKR_HOST_MEMORY;
+    memset(data, (i + v) & 0xff, i + v);
+    make_name(i, name);
+    rc = logstore_put(ls, name, data, i + v);
+    free(data);
+    return rc;
+}
+
+static int check_obj(logstore_t *ls, unsigned long i, long v)
+{
+    CK_BYTE name[LOGSTORE_NAME_LEN], *data;
+    CK_ULONG len, k;
+    int res = 0;
+
+    make_name(i, name);
+    if (logstore_get(ls, name, &data, &len) != CKR_OK) {
+        fprintf(stderr, "logstore_get failed for object %lu\n", i);
+        return -1;
+    }
+
+    if (v < 0) {
+        if (data != NULL) {
+            fprintf(stderr, "Deleted object %lu found\n", i);
+            res = -1;
+        }
+        goto out;
+    }
+
+    if (data == NULL || len != i + v) {
+        fprintf(stderr, "Object %lu not found or wrong length\n", i);
+        res = -1;
+        goto out;
+    }
+    for (k = 0; k < len; k++) {
+        if (data[k] != ((i + v) & 0xff)) {
+            fprintf(stderr, "Object %lu has wrong contents\n", i);
+            res = -1;
+            break;
+        }
+    }
+out:
+    free(data);
+    return res;
+}
+
+static long expected_version(unsigned long i)
+{
+    if (i % 4 == 3)
+        return -1;              /* deleted */
+    return (i % 2) ? 7 : 0;     /* odd objects updated */
+}
+
+static int check_all(logstore_t *ls)
+{
+    unsigned long i;
+
+    for (i = 0; i < NUM_OBJS; i++) {
+        if (check_obj(ls, i, expected_version(i)))
+            return -1;
+    }
+    return 0;
+}
+
+static off_t file_size(void)
+{
+    struct stat sb;
+
+    return stat(path, &sb) == 0 ? sb.st_size : -1;
+}
+
+static int append_garbage(off_t off, const char *garbage, size_t len)
+{
+    int fd, res = 0;
+
+    fd = open(path, O_WRONLY);
+    if (fd < 0)
+        return -1;
+    if (pwrite(fd, garbage, len, off) != (ssize_t)len)
+        res = -1;
+    close(fd);
+    return res;
+}
+
+static int testbasic(void)
+{
+    logstore_t *ls = NULL, *ls2 = NULL;
+    CK_BYTE *names = NULL, name[LOGSTORE_NAME_LEN];
+    CK_ULONG num;
+    unsigned long i;
+    int res = -1;
+
+    if (logstore_open(path, NULL, &ls) != CKR_OK) {
+        fprintf(stderr, "logstore_open failed\n");
+        return -1;
+    }
+
+    for (i = 0; i < NUM_OBJS; i++) {
+        if (put_obj(ls, i, 0) != CKR_OK) {
+            fprintf(stderr, "logstore_put failed\n");
+            goto out;
+        }
+    }
+    for (i = 1; i < NUM_OBJS; i += 2) {
+        if (put_obj(ls, i, 7) != CKR_OK) {
+            fprintf(stderr, "logstore_put update failed\n");
+            goto out;
+        }
+    }
+    for (i = 3; i < NUM_OBJS; i += 4) {
+        make_name(i, name);
+        if (logstore_delete(ls, name) != CKR_OK) {
+            fprintf(stderr, "logstore_delete failed\n");
+            goto out;
+        }
+    }
+    if (check_all(ls))
+        goto out;
+
+    /* A second handle sees the same objects, like another process would */
+    if (logstore_open(path, NULL, &ls2) != CKR_OK || check_all(ls2))
+        goto out;
+
+    /* Changes through one handle are picked up by the other one */
+    if (put_obj(ls2, NUM_OBJS, 0) != CKR_OK || check_obj(ls, NUM_OBJS, 0))
+        goto out;
+    make_name(NUM_OBJS, name);
+    if (logstore_delete(ls, name) != CKR_OK || check_obj(ls2, NUM_OBJS, -1))
+        goto out;
+
+    if (logstore_names(ls, &names, &num) != CKR_OK ||
+        num != NUM_OBJS - NUM_OBJS / 4) {
+        fprintf(stderr, "logstore_names returned wrong number of names\n");
+        goto out;
+    }
+
+    if (logstore_new_name(ls, name) != CKR_OK ||
+        memcmp(name, "OB", 2) != 0) {
+        fprintf(stderr, "logstore_new_name failed\n");
+        goto out;
+    }
+    for (i = 0; i < num; i++) {
+        if (memcmp(names + i * LOGSTORE_NAME_LEN, name,
+                   LOGSTORE_NAME_LEN) == 0) {
+            fprintf(stderr, "logstore_new_name returned a used name\n");
+            goto out;
+        }
+    }
+
+    logstore_close(ls);
+    ls = NULL;
+
+    /* The index is rebuilt from the log */
+    if (logstore_open(path, NULL, &ls) != CKR_OK || check_all(ls))
+        goto out;
+
+    res = 0;
+out:
+    free(names);
+    logstore_close(ls);
+    logstore_close(ls2);
+    return res;
+}
+
+static int testcrash(void)
+{
+    logstore_t *ls = NULL;
+    off_t size;
+    int res = -1;
+
+    /* An incomplete record at the end is ignored */
+    size = file_size();
+    if (size < 0 || append_garbage(size, "OBJR\001garbage", 12))
+        goto out;
+
+    if (logstore_open(path, NULL, &ls) != CKR_OK || check_all(ls))
+        goto out;
+
+    /* ... and overwritten by the next record */
+    if (put_obj(ls, NUM_OBJS + 1, 0) != CKR_OK || file_size() <= size)
+        goto out;
+    logstore_close(ls);
+    ls = NULL;
+
+    if (logstore_open(path, NULL, &ls) != CKR_OK || check_all(ls) ||
+        check_obj(ls, NUM_OBJS + 1, 0))
+        goto out;
+    logstore_close(ls);
+    ls = NULL;
+
+    /* Everything behind a corrupted record is dropped */
+    if (append_garbage(size + 30, "X", 1))
+        goto out;
+    if (logstore_open(path, NULL, &ls) != CKR_OK || check_all(ls) ||
+        check_obj(ls, NUM_OBJS + 1, -1))
+        goto out;
+
+    res = 0;
+out:
+    logstore_close(ls);
+    return res;
+}
+
+static int testcompact(void)
+{
+    logstore_t *ls = NULL, *ls2 = NULL;
+    unsigned long i, k;
+    off_t size;
+    int res = -1;
+
+    if (logstore_open(path, NULL, &ls) != CKR_OK ||
+        logstore_open(path, NULL, &ls2) != CKR_OK)
+        goto out;
+
+    size = file_size();
+    if (logstore_compact(ls) != CKR_OK || file_size() >= size) {
+        fprintf(stderr, "Explicit compaction failed\n");
+        goto out;
+    }
+    if (check_all(ls) || check_all(ls2))
+        goto out;
+
+    /* Rewriting the same objects compacts the store automatically */
+    size = file_size();
+    for (k = 0; k < 20; k++) {
+        for (i = 1; i < NUM_OBJS; i += 2) {
+            if (expected_version(i) < 0)
+                continue;
+            if (put_obj(ls, i, 7) != CKR_OK)
+                goto out;
+        }
+    }
+    if (file_size() > 4 * size) {
+        fprintf(stderr, "Store not compacted: %ld bytes\n",
+                (long)file_size());
+        goto out;
+    }
+    if (check_all(ls) || check_all(ls2))
+        goto out;
+
+    res = 0;
+out:
+    logstore_close(ls);
+    logstore_close(ls2);
+    return res;
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/logstoretestXXXXXX";
+    int res = TEST_PASS;
+
+    if (mkdtemp(dir) == NULL) {
+        fprintf(stderr, "mkdtemp failed\n");
+        return TEST_FAIL;
+    }
+    snprintf(path, sizeof(path), "%s/OBJ.LOG", dir);
+
+    if (testbasic()) {
+        fprintf(stderr, "testbasic failed\n");
+        res = TEST_FAIL;
+    }
+    if (res == TEST_PASS && testcrash()) {
+        fprintf(stderr, "testcrash failed\n");
+        res = TEST_FAIL;
+    }
+    if (res == TEST_PASS && testcompact()) {
+        fprintf(stderr, "testcompact failed\n");
+        res = TEST_FAIL;
+    }
+
+    unlink(path);
+    rmdir(dir);
+    return res;
+}
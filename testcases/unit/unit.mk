@@ -1,12 +1,14 @@
 check_PROGRAMS = testcases/unit/policytest testcases/unit/hashmaptest	\
 	testcases/unit/mechtabletest testcases/unit/configdump		\
 	testcases/unit/buffertest testcases/unit/uritest		\
-	testcases/unit/pintest
+	testcases/unit/pintest testcases/unit/btreetest			\
+	testcases/unit/logstoretest
 
 TESTS = testcases/unit/policytest testcases/unit/hashmaptest		\
 	testcases/unit/mechtabletest testcases/unit/configdump		\
 	testcases/unit/buffertest testcases/unit/uritest		\
-	testcases/unit/pintest.sh
+	testcases/unit/pintest.sh testcases/unit/btreetest		\
+	testcases/unit/logstoretest
 
 EXTRA_DIST += testcases/unit/pintest.sh
 noinst_HEADERS += testcases/unit/unittest.h
@@ -70,3 +72,32 @@ testcases_unit_pintest_SOURCES=testcases/unit/pintest.c		\
 
 testcases_unit_pintest_CFLAGS=-I${top_srcdir}/usr/lib/common
 testcases_unit_pintest_LDFLAGS=-lcrypto
+
+testcases_unit_btreetest_SOURCES=testcases/unit/btreetest.c		\
+	usr/lib/common/btree.c usr/lib/common/trace.c
+
+testcases_unit_btreetest_CFLAGS=-I${top_srcdir}/usr/lib/common		\
+	-I${top_srcdir}/usr/include -I${top_builddir}/usr/lib/api	\
+	-I${top_srcdir}/usr/lib/api -DSTDLL_NAME=\"btreetest\"
+
+testcases_unit_logstoretest_SOURCES=testcases/unit/logstoretest.c	\
+	usr/lib/common/logstore.c usr/lib/common/trace.c
+
+testcases_unit_logstoretest_CFLAGS=-I${top_srcdir}/usr/lib/common	\
+	-I${top_srcdir}/usr/include -I${top_builddir}/usr/lib/api	\
+	-I${top_srcdir}/usr/lib/api -DSTDLL_NAME=\"logstoretest\"
+
+if ENABLE_ICSFTOK
+check_PROGRAMS += testcases/unit/icsfpooltest
+TESTS += testcases/unit/icsfpooltest
+
+testcases_unit_icsfpooltest_SOURCES=testcases/unit/icsfpooltest.c	\
+	usr/lib/icsf_stdll/icsf.c usr/lib/common/trace.c
+
+testcases_unit_icsfpooltest_CFLAGS=-I${top_srcdir}/usr/lib/icsf_stdll	\
+	-I${top_srcdir}/usr/lib/common -I${top_srcdir}/usr/include	\
+	-I${top_builddir}/usr/lib/api -I${top_srcdir}/usr/lib/api	\
+	-DSTDLL_NAME=\"icsfpooltest\"
+
+testcases_unit_icsfpooltest_LDFLAGS=-llber -lpthread
+endif
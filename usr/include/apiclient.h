@@ -285,6 +285,11 @@ extern "C" {
                                 CK_OBJECT_HANDLE, CK_MECHANISM_PTR,
                                 CK_OBJECT_HANDLE, CK_BYTE_PTR,
                                 CK_ULONG, CK_BYTE_PTR, CK_ULONG_PTR);
+
+    CK_RV C_IBM_FindObjectsGetAttributes(CK_SESSION_HANDLE,
+                                         CK_ATTRIBUTE_TYPE *, CK_ULONG,
+                                         CK_BYTE_PTR, CK_ULONG_PTR,
+                                         CK_ULONG_PTR);
 #ifdef __cplusplus
 }
 #endif
@@ -99,5 +99,7 @@ typedef struct {
 #define EVENT_MK_CHANGE_FLAGS_NONE            0x00000000
 #define EVENT_MK_CHANGE_FLAGS_TOK_OBJS        0x00000001
 #define EVENT_MK_CHANGE_FLAGS_TOK_OBJS_FINAL  0x00000002
+/* With TOK_OBJS: skip token objects already re-enciphered by a prior run */
+#define EVENT_MK_CHANGE_FLAGS_TOK_OBJS_RESUME 0x00000004
 
 #endif
@@ -41,13 +41,32 @@ struct btnode {
     void *value;
 };
 
-/* Binary tree root */
-struct btree {
+/*
+ * Number of lock stripes of a binary tree. Node n is protected by stripe
+ * (n % BT_LOCK_STRIPES), which also holds the free list for its nodes.
+ */
+#define BT_LOCK_STRIPES 32
+
+/* Lock stripe, padded to keep the stripes on separate cache lines */
+struct bt_stripe {
+    pthread_mutex_t mutex;
     struct btnode *free_list;
+    char pad[64 - (sizeof(pthread_mutex_t) + sizeof(void *)) % 64];
+};
+
+/*
+ * Binary tree root
+ * Nodes are never removed from the tree until it is destroyed, thus the tree
+ * can be traversed without a lock. The value and flags of a node are protected
+ * by the node's lock stripe, the mutex serializes the growth of the tree.
+ */
+struct btree {
     struct btnode *top;
     unsigned long size;
     unsigned long free_nodes;
+    unsigned long next_stripe;
     pthread_mutex_t mutex;
+    struct bt_stripe stripes[BT_LOCK_STRIPES];
     void (*delete_func)(void *);
 };
 
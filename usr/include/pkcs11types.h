@@ -1693,6 +1693,10 @@ typedef struct CK_IBM_FUNCTION_LIST_1_0 CK_IBM_FUNCTION_LIST_1_0;
 typedef struct CK_IBM_FUNCTION_LIST_1_0 CK_PTR CK_IBM_FUNCTION_LIST_1_0_PTR;
 typedef CK_IBM_FUNCTION_LIST_1_0_PTR CK_PTR CK_IBM_FUNCTION_LIST_1_0_PTR_PTR;
 
+typedef struct CK_IBM_FUNCTION_LIST_1_1 CK_IBM_FUNCTION_LIST_1_1;
+typedef struct CK_IBM_FUNCTION_LIST_1_1 CK_PTR CK_IBM_FUNCTION_LIST_1_1_PTR;
+typedef CK_IBM_FUNCTION_LIST_1_1_PTR CK_PTR CK_IBM_FUNCTION_LIST_1_1_PTR_PTR;
+
 typedef CK_RV (CK_PTR CK_C_Initialize) (CK_VOID_PTR pReserved);
 typedef CK_RV (CK_PTR CK_C_Finalize) (CK_VOID_PTR pReserved);
 typedef CK_RV (CK_PTR CK_C_Terminate) (void);
@@ -2057,6 +2061,40 @@ typedef CK_RV (CK_PTR CK_C_IBM_ReencryptSingle) (CK_SESSION_HANDLE hSession,
                                                  CK_BYTE_PTR pReencryptedData,
                                                  CK_ULONG_PTR pulReencryptedDataLen);
 
+/*
+ * C_IBM_FindObjectsGetAttributes continues a find operation started with
+ * C_FindObjectsInit and returns the next matching objects together with the
+ * values of the requested attribute types. The buffer receives one record
+ * per object: a CK_IBM_OBJECT_RECORD, followed by one CK_IBM_ATTRIBUTE_VALUE
+ * per requested type, each followed by its value padded to a multiple of
+ * sizeof(CK_ULONG). ulValueLen is CK_UNAVAILABLE_INFORMATION for attributes
+ * that the object does not have or that are sensitive; no value follows
+ * then. ulRecordLen is the total length of the record including its header.
+ * Records are not aligned if the buffer is not.
+ *
+ * As many records as fit into *pulBufferLen bytes are returned, and
+ * *pulBufferLen and *pulObjectCount are set to the bytes and records used.
+ * No records are returned once all matches have been returned. If not even
+ * the next record fits, CKR_BUFFER_TOO_SMALL is returned and *pulBufferLen
+ * is set to the length of that record.
+ */
+typedef struct CK_IBM_OBJECT_RECORD {
+    CK_OBJECT_HANDLE hObject;
+    CK_ULONG ulRecordLen;
+} CK_IBM_OBJECT_RECORD;
+
+typedef struct CK_IBM_ATTRIBUTE_VALUE {
+    CK_ATTRIBUTE_TYPE type;
+    CK_ULONG ulValueLen;
+} CK_IBM_ATTRIBUTE_VALUE;
+
+typedef CK_RV (CK_PTR CK_C_IBM_FindObjectsGetAttributes) (CK_SESSION_HANDLE hSession,
+                                                          CK_ATTRIBUTE_TYPE *pTypes,
+                                                          CK_ULONG ulTypeCount,
+                                                          CK_BYTE_PTR pBuffer,
+                                                          CK_ULONG_PTR pulBufferLen,
+                                                          CK_ULONG_PTR pulObjectCount);
+
 struct CK_FUNCTION_LIST {
     CK_VERSION version;
     CK_C_Initialize C_Initialize;
@@ -2231,6 +2269,12 @@ struct CK_IBM_FUNCTION_LIST_1_0 {
     CK_C_IBM_ReencryptSingle C_IBM_ReencryptSingle;
 };
 
+struct CK_IBM_FUNCTION_LIST_1_1 {
+    CK_VERSION version;
+    CK_C_IBM_ReencryptSingle C_IBM_ReencryptSingle;
+    CK_C_IBM_FindObjectsGetAttributes C_IBM_FindObjectsGetAttributes;
+};
+
 #ifdef __cplusplus
 }
 #endif
@@ -59,6 +59,10 @@
 #define NUMBER_PROCESSES_ALLOWED  1000
 #define NUMBER_ADMINS_ALLOWED     1000
 
+// Token object stores (slot configuration keyword 'objstore')
+#define OBJSTORE_FILES  0   // one file per token object, listed in OBJ.IDX
+#define OBJSTORE_LOG    1   // all token objects in one log file, OBJ.LOG
+
 //
 // Per Process Data structure
 // one entry in the table is grabbed by each process
@@ -114,6 +118,7 @@ typedef struct {
 #define FLAG_STATISTICS_ENABLED       0x02
 #define FLAG_STATISTICS_IMPLICIT      0x04
 #define FLAG_STATISTICS_INTERNAL      0x08
+#define FLAG_STATISTICS_LATENCY       0x10
 
 #ifdef PKCS64
 
@@ -204,6 +209,7 @@ typedef struct {
     char tokname[NAME_MAX + 1]; // token specific directory
     LW_SHM_TYPE *shm_addr;      // token specific shm address
     uint32_t version; // version: major<<16|minor
+    uint32_t objstore; // token object store, OBJSTORE_*
 } Slot_Info_t_64;
 
 typedef Slot_Info_t_64 SLOT_INFO;
@@ -353,6 +353,14 @@ typedef CK_RV (CK_PTR ST_C_IBM_ReencryptSingle)(STDLL_TokData_t *tokdata,
                                                 CK_ULONG ulEncryptedDataLen,
                                                 CK_BYTE_PTR pReencryptedData,
                                             CK_ULONG_PTR pulReencryptedDataLen);
+typedef CK_RV (CK_PTR ST_C_IBM_FindObjectsGetAttributes)(
+                                                STDLL_TokData_t *tokdata,
+                                                ST_SESSION_T *hSession,
+                                                CK_ATTRIBUTE_TYPE *pTypes,
+                                                CK_ULONG ulTypeCount,
+                                                CK_BYTE_PTR pBuffer,
+                                                CK_ULONG_PTR pulBufferLen,
+                                                CK_ULONG_PTR pulObjectCount);
 
 typedef CK_RV (CK_PTR ST_C_HandleEvent)(STDLL_TokData_t *tokdata,
                                         unsigned int event_type,
@@ -434,6 +442,7 @@ struct ST_FCN_LIST {
     ST_C_SessionCancel ST_SessionCancel;
 
     ST_C_IBM_ReencryptSingle ST_IBM_ReencryptSingle;
+    ST_C_IBM_FindObjectsGetAttributes ST_IBM_FindObjectsGetAttributes;
 
     /* The functions defined below are not part of the external API */
     ST_C_HandleEvent ST_HandleEvent;
@@ -50,8 +50,23 @@ static int openssl_err_cb(const char *str, size_t len, void *u)
     return 1;
 }
 
+/*
+ * OpenSSL errors raised by the token are only of interest when they are
+ * traced. Otherwise they are just discarded by ERR_pop_to_mark().
+ */
+#define OPENSSL_PRINT_ERRORS()                                              \
+        do {                                                                \
+            if (trace.level >= TRACE_LEVEL_DEVEL)                           \
+                ERR_print_errors_cb(openssl_err_cb, NULL);                  \
+        } while (0)
+
+/*
+ * Each API call switches to opencryptoki's library context and back, so both
+ * OSSL_LIB_CTX_set0_default() calls run on every call. Only the formatting of
+ * pending OpenSSL errors is skipped when it would not be traced.
+ */
 #if OPENSSL_VERSION_PREREQ(3, 0)
-#define BEGIN_OPENSSL_LIBCTX(ossl_ctx, rc)                                  \
+#define BEGIN_OPENSSL_LIBCTX(ossl_ctx, rc)                               \
         do {                                                                \
             ERR_set_mark();                                                 \
             OSSL_LIB_CTX  *prev_ctx = OSSL_LIB_CTX_set0_default((ossl_ctx));\
@@ -68,7 +83,7 @@ static int openssl_err_cb(const char *str, size_t len, void *u)
                     (rc) = CKR_FUNCTION_FAILED;                             \
                 TRACE_ERROR("OSSL_LIB_CTX_set0_default failed\n");          \
             }                                                               \
-            ERR_print_errors_cb(openssl_err_cb, NULL);                      \
+            OPENSSL_PRINT_ERRORS();                                         \
             ERR_pop_to_mark();                                              \
         } while (0);
 #else
@@ -77,7 +92,7 @@ static int openssl_err_cb(const char *str, size_t len, void *u)
             ERR_set_mark();
 
 #define END_OPENSSL_LIBCTX(rc)                                              \
-            ERR_print_errors_cb(openssl_err_cb, NULL);                      \
+            OPENSSL_PRINT_ERRORS();                                         \
             ERR_pop_to_mark();                                              \
         } while (0);
 #endif
@@ -110,6 +125,12 @@ static CK_IBM_FUNCTION_LIST_1_0 func_list_ibm_1_0 = {
     C_IBM_ReencryptSingle
 };
 
+static CK_IBM_FUNCTION_LIST_1_1 func_list_ibm_1_1 = {
+    {1, 1},
+    C_IBM_ReencryptSingle,
+    C_IBM_FindObjectsGetAttributes
+};
+
 static CK_FUNCTION_LIST func_list_pkcs11_2_40 = {
     {2, 40},
     C_Initialize,
@@ -300,6 +321,11 @@ static CK_INTERFACE interface_list[] = {
         &func_list_pkcs11_2_40,
         CKF_INTERFACE_FORK_SAFE /*XXX*/
     },
+    {
+        (CK_UTF8CHAR *)"Vendor IBM",
+        &func_list_ibm_1_1,
+        CKF_INTERFACE_FORK_SAFE /*XXX*/
+    },
     {
         (CK_UTF8CHAR *)"Vendor IBM",
         &func_list_ibm_1_0,
@@ -3202,6 +3228,8 @@ CK_RV C_Initialize(CK_VOID_PTR pVoid)
             stat_flags |= STATISTICS_FLAG_COUNT_IMPLICIT;
         if (Anchor->SocketDataP.flags & FLAG_STATISTICS_INTERNAL)
             stat_flags |= STATISTICS_FLAG_COUNT_INTERNAL;
+        if (Anchor->SocketDataP.flags & FLAG_STATISTICS_LATENCY)
+            stat_flags |= STATISTICS_FLAG_LATENCY;
 
         rc = statistics_init(&statistics, &Anchor->SocketDataP, stat_flags,
                              Anchor->ClientCred.real_uid);
@@ -5623,6 +5651,65 @@ CK_RV C_IBM_ReencryptSingle(CK_SESSION_HANDLE hSession,
     return rv;
 }
 
+CK_RV C_IBM_FindObjectsGetAttributes(CK_SESSION_HANDLE hSession,
+                                     CK_ATTRIBUTE_TYPE *pTypes,
+                                     CK_ULONG ulTypeCount,
+                                     CK_BYTE_PTR pBuffer,
+                                     CK_ULONG_PTR pulBufferLen,
+                                     CK_ULONG_PTR pulObjectCount)
+{
+    CK_RV rv;
+    API_Slot_t *sltp;
+    STDLL_FcnList_t *fcn;
+    ST_SESSION_T rSession;
+
+    TRACE_INFO("C_IBM_FindObjectsGetAttributes\n");
+    if (API_Initialized() == FALSE) {
+        TRACE_ERROR("%s\n", ock_err(ERR_CRYPTOKI_NOT_INITIALIZED));
+        return CKR_CRYPTOKI_NOT_INITIALIZED;
+    }
+
+    if ((!pTypes && ulTypeCount > 0) || !pBuffer || !pulBufferLen ||
+        !pulObjectCount) {
+        TRACE_ERROR("%s\n", ock_err(ERR_ARGUMENTS_BAD));
+        return CKR_ARGUMENTS_BAD;
+    }
+    if (!Valid_Session(hSession, &rSession)) {
+        TRACE_ERROR("%s\n", ock_err(ERR_SESSION_HANDLE_INVALID));
+        TRACE_ERROR("Session handle id: %lu\n", hSession);
+        return CKR_SESSION_HANDLE_INVALID;
+    }
+    TRACE_INFO("Valid Session handle id: %lu\n", rSession.sessionh);
+
+    sltp = &(Anchor->SltList[rSession.slotID]);
+    if (sltp->DLLoaded == FALSE) {
+        TRACE_ERROR("%s\n", ock_err(ERR_TOKEN_NOT_PRESENT));
+        return CKR_TOKEN_NOT_PRESENT;
+    }
+    if ((fcn = sltp->FcnList) == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_TOKEN_NOT_PRESENT));
+        return CKR_TOKEN_NOT_PRESENT;
+    }
+    if (fcn->ST_IBM_FindObjectsGetAttributes) {
+        BEGIN_OPENSSL_LIBCTX(Anchor->openssl_libctx, rv)
+        BEGIN_HSM_MK_CHANGE_LOCK(sltp, rv)
+        // Map the Session to the slot session
+        rv = fcn->ST_IBM_FindObjectsGetAttributes(sltp->TokData, &rSession,
+                                                  pTypes, ulTypeCount,
+                                                  pBuffer, pulBufferLen,
+                                                  pulObjectCount);
+        TRACE_DEVEL("fcn->ST_IBM_FindObjectsGetAttributes returned: 0x%lx\n",
+                    rv);
+        END_HSM_MK_CHANGE_LOCK(sltp, rv)
+        END_OPENSSL_LIBCTX(rv)
+    } else {
+        TRACE_ERROR("%s\n", ock_err(ERR_FUNCTION_NOT_SUPPORTED));
+        rv = CKR_FUNCTION_NOT_SUPPORTED;
+    }
+
+    return rv;
+}
+
 #ifdef __sun
 #pragma init(api_init)
 #else
@@ -8,11 +8,13 @@
  * https://opensource.org/licenses/cpl1.0.php
  */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sched.h>
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -22,39 +24,93 @@
 #include "h_extern.h"
 #include "ock_syslog.h"
 
-static CK_RV statistics_increment(struct statistics *statistics,
-                                  CK_SLOT_ID slot,
-                                  const CK_MECHANISM *mech,
-                                  CK_ULONG strength_idx)
+/*
+ * Returns the entry for the specified slot, mechanism and strength in the
+ * counter shard of the CPU the caller is currently running on.
+ */
+static CK_RV statistics_get_counter(struct statistics *statistics,
+                                    CK_SLOT_ID slot, const CK_MECHANISM *mech,
+                                    CK_ULONG strength_idx,
+                                    struct stat_counter **counter)
 {
     CK_ULONG ofs;
-    counter_t *counter;
-    int mech_idx;
-    CK_MECHANISM implicit_mech = { 0, NULL, 0 };
-    CK_RV rc;
+    int mech_idx, cpu;
 
     if (slot >= NUMBER_SLOTS_MANAGED || strength_idx > POLICY_STRENGTH_IDX_0 ||
         mech == NULL)
         return CKR_ARGUMENTS_BAD;
 
     ofs = statistics->slot_shm_offsets[slot];
-    if (ofs > statistics->shm_size)
+    if (ofs > statistics->shard_size)
         return CKR_SLOT_ID_INVALID;
 
     mech_idx = mechtable_idx_from_numeric(mech->mechanism);
     if (mech_idx < 0)
         return CKR_MECHANISM_INVALID;
 
-    ofs += mech_idx * (NUM_SUPPORTED_STRENGTHS + 1) * sizeof(counter_t);
+    ofs += mech_idx * STAT_MECH_SIZE;
 
     strength_idx = NUM_SUPPORTED_STRENGTHS - strength_idx;
-    ofs += strength_idx * sizeof(counter_t);
+    ofs += strength_idx * sizeof(struct stat_counter);
 
-    if (ofs > statistics->shm_size)
+    cpu = sched_getcpu();
+    if (cpu > 0)
+        ofs += (cpu % STAT_NUM_SHARDS) * statistics->shard_size;
+
+    if (ofs + sizeof(struct stat_counter) > statistics->shm_size)
         return CKR_FUNCTION_FAILED;
 
-    counter = (counter_t*)(statistics->shm_data + ofs);
-    __sync_add_and_fetch(counter, 1);
+    *counter = (struct stat_counter *)(statistics->shm_data + ofs);
+
+    return CKR_OK;
+}
+
+static CK_RV statistics_record(struct statistics *statistics,
+                               CK_SLOT_ID slot,
+                               const CK_MECHANISM *mech,
+                               CK_ULONG strength_idx,
+                               CK_ULONG bytes,
+                               CK_ULONG start_time)
+{
+    struct stat_counter *counter;
+    CK_ULONG latency, bucket;
+    CK_RV rc;
+
+    rc = statistics_get_counter(statistics, slot, mech, strength_idx,
+                                &counter);
+    if (rc != CKR_OK)
+        return rc;
+
+    if (bytes > 0)
+        __sync_add_and_fetch(&counter->bytes, bytes);
+
+    if (start_time == 0 || (statistics->flags & STATISTICS_FLAG_LATENCY) == 0)
+        return CKR_OK;
+
+    latency = statistics_time(statistics) - start_time;
+    for (bucket = 0; latency > 0 && bucket < STAT_LATENCY_BUCKETS - 1;
+         bucket++)
+        latency >>= 1;
+    __sync_add_and_fetch(&counter->latency[bucket], 1);
+
+    return CKR_OK;
+}
+
+static CK_RV statistics_increment(struct statistics *statistics,
+                                  CK_SLOT_ID slot,
+                                  const CK_MECHANISM *mech,
+                                  CK_ULONG strength_idx)
+{
+    struct stat_counter *counter;
+    CK_MECHANISM implicit_mech = { 0, NULL, 0 };
+    CK_RV rc;
+
+    rc = statistics_get_counter(statistics, slot, mech, strength_idx,
+                                &counter);
+    if (rc != CKR_OK)
+        return rc;
+
+    __sync_add_and_fetch(&counter->count, 1);
 
     if ((statistics->flags & STATISTICS_FLAG_COUNT_IMPLICIT) == 0)
         return CKR_OK;
@@ -190,7 +246,7 @@ static CK_RV statistics_increment(struct statistics *statistics,
 static CK_RV statistics_open_shm(struct statistics *statistics, int user,
                                  CK_BBOOL create)
 {
-    int i, err, clear = 0, fd;
+    int i, err, fd;
     struct stat stat_buf;
 
     snprintf(statistics->shm_name, sizeof(statistics->shm_name) - 1,
@@ -267,7 +323,12 @@ static CK_RV statistics_open_shm(struct statistics *statistics, int user,
 
     if ((CK_ULONG)stat_buf.st_size != statistics->shm_size) {
         if (create) {
-            if (ftruncate(fd, statistics->shm_size) < 0) {
+            /*
+             * Truncate to zero first, so that the segment is cleared without
+             * touching all of its (mostly unused) pages.
+             */
+            if (ftruncate(fd, 0) < 0 ||
+                ftruncate(fd, statistics->shm_size) < 0) {
                 err = errno;
                 TRACE_ERROR("Failed to set size of SHM '%s': %s\n",
                             statistics->shm_name,  strerror(err));
@@ -276,8 +337,6 @@ static CK_RV statistics_open_shm(struct statistics *statistics, int user,
                 close(fd);
                 return CKR_FUNCTION_FAILED;
             }
-
-            clear = 1;
         } else {
             TRACE_ERROR("SHM '%s' has wrong size\n", statistics->shm_name);
             OCK_SYSLOG(LOG_ERR, "SHM '%s' has wrong size\n",
@@ -301,9 +360,6 @@ static CK_RV statistics_open_shm(struct statistics *statistics, int user,
         return CKR_FUNCTION_FAILED;
     }
 
-    if (clear)
-        memset(statistics->shm_data, 0, sizeof(statistics->shm_size));
-
     return CKR_OK;
 }
 
@@ -353,7 +409,8 @@ CK_RV statistics_init(struct statistics *statistics,
             statistics->slot_shm_offsets[i] = (CK_ULONG)-1;
         }
     }
-    statistics->shm_size = statistics->num_slots * STAT_SLOT_SIZE;
+    statistics->shard_size = statistics->num_slots * STAT_SLOT_SIZE;
+    statistics->shm_size = STAT_NUM_SHARDS * statistics->shard_size;
 
     TRACE_INFO("%lu slots defined\n", statistics->num_slots);
     TRACE_INFO("Statistics SHM size: %lu\n", statistics->shm_size);
@@ -363,6 +420,7 @@ CK_RV statistics_init(struct statistics *statistics,
         goto error;
 
     statistics->increment_func = statistics_increment;
+    statistics->record_func = statistics_record;
 
     return CKR_OK;
 
@@ -10,6 +10,7 @@
 #ifndef OCK_STATISTICS_H
 #define OCK_STATISTICS_H
 
+#include <time.h>
 #include <pkcs11types.h>
 #include "slotmgr.h"
 #include "mechtable.h"
@@ -18,19 +19,42 @@
 /*
  * Statistics are collected in a shared memory segment per user.
  * The statistics shared memory segment has the following layout:
- * - For each configured slot:
- *    - For each supported mechanism:
- *       - one counter (counter_t) for non-key mechanisms (strength=0)
- *       - one counter for each supported strength (counter_t each)
+ * - For each counter shard (STAT_NUM_SHARDS):
+ *    - For each configured slot:
+ *       - For each supported mechanism:
+ *          - one entry (struct stat_counter) for non-key mechanisms
+ *            (strength=0)
+ *          - one entry for each supported strength
  *
  * The size of the shared segment therefore is:
- *   Num configured slots * num supp.mechanisms * (num supp. strength + 1) *
- *                                                  size of a counter
+ *   Num shards * num configured slots * num supp.mechanisms *
+ *                         (num supp. strength + 1) * size of an entry
+ *
+ * A process updates the shard selected by the CPU it is currently running
+ * on, so that concurrent processes and threads do not contend on the same
+ * cache lines. The shards must be summed up to get the actual statistics.
+ *
+ * Each entry contains the number of times the mechanism was used, the number
+ * of bytes of input data processed by crypto operations, and a latency
+ * histogram of the crypto operations (from Init to the completing call).
+ * Latency bucket 0 counts operations that took less than 1 microsecond,
+ * bucket i counts operations that took 2^(i-1) up to 2^i - 1 microseconds.
+ * The last bucket also counts all operations taking longer.
  */
 
 typedef CK_ULONG counter_t;
 
-#define STAT_MECH_SIZE  ((NUM_SUPPORTED_STRENGTHS + 1) * sizeof(counter_t))
+#define STAT_NUM_SHARDS         16
+#define STAT_LATENCY_BUCKETS    24
+
+struct stat_counter {
+    counter_t count;
+    counter_t bytes;
+    counter_t latency[STAT_LATENCY_BUCKETS];
+};
+
+#define STAT_MECH_SIZE  ((NUM_SUPPORTED_STRENGTHS + 1) * \
+                         sizeof(struct stat_counter))
 #define STAT_SLOT_SIZE  (MECHTABLE_NUM_ELEMS * STAT_MECH_SIZE)
 
 struct statistics;
@@ -40,20 +64,42 @@ typedef CK_RV (*statistics_increment_f)(struct statistics *statistics,
                                         CK_SLOT_ID slot,
                                         const CK_MECHANISM *mech,
                                         CK_ULONG strength);
+typedef CK_RV (*statistics_record_f)(struct statistics *statistics,
+                                     CK_SLOT_ID slot,
+                                     const CK_MECHANISM *mech,
+                                     CK_ULONG strength,
+                                     CK_ULONG bytes,
+                                     CK_ULONG start_time);
 
 #define STATISTICS_FLAG_COUNT_IMPLICIT      (1 << 0)
 #define STATISTICS_FLAG_COUNT_INTERNAL      (1 << 1)
+#define STATISTICS_FLAG_LATENCY             (1 << 2)
 
 struct statistics {
     CK_ULONG flags;
     CK_ULONG num_slots;
     CK_ULONG slot_shm_offsets[NUMBER_SLOTS_MANAGED];
+    CK_ULONG shard_size;
     CK_ULONG shm_size;
     char shm_name[PATH_MAX];
     CK_BYTE *shm_data;
     statistics_increment_f increment_func; /* NULL if statistics disabled */
+    statistics_record_f record_func; /* NULL if statistics disabled */
 };
 
+/* Monotonic time stamp in microseconds, 0 if latency is not collected */
+static inline CK_ULONG statistics_time(const struct statistics *statistics)
+{
+    struct timespec ts;
+
+    if (statistics->record_func == NULL ||
+        (statistics->flags & STATISTICS_FLAG_LATENCY) == 0 ||
+        clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        return 0;
+
+    return (CK_ULONG)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
 #define INC_COUNTER(tokdata, sess, mech, key, no_key_strength)              \
     do {                                                                    \
         if ((tokdata)->statistics->increment_func != NULL)                  \
@@ -62,6 +108,49 @@ struct statistics {
                   ((OBJECT *)(key))->strength.strength : (no_key_strength));\
     } while (0)
 
+/*
+ * State of a crypto operation for recording the bytes processed and its
+ * latency. It is armed when a counted operation is initialized, and consumed
+ * when the operation completes. It is kept separate from the rest of the
+ * operation context, because some mechanisms clean up the context themselves
+ * before the completing call returns.
+ */
+struct stat_op {
+    CK_MECHANISM_TYPE mechanism;
+    CK_ULONG strength;
+    CK_ULONG bytes;
+    CK_ULONG start_time;
+    CK_BBOOL active;
+};
+
+#define STAT_OP_START(tokdata, ctx, mech, key, no_key_strength)             \
+    do {                                                                    \
+        (ctx)->stat.mechanism = (mech)->mechanism;                          \
+        (ctx)->stat.strength = (key) != NULL ?                              \
+                  ((OBJECT *)(key))->strength.strength : (no_key_strength); \
+        (ctx)->stat.bytes = 0;                                              \
+        (ctx)->stat.start_time = statistics_time((tokdata)->statistics);    \
+        (ctx)->stat.active = TRUE;                                          \
+    } while (0)
+
+/*
+ * Record the input bytes processed and the latency of a completed crypto
+ * operation. The bytes of the completing call are passed in 'len', the ones
+ * of previous update calls are accumulated in the operation state.
+ */
+#define STAT_OP_DONE(tokdata, sess, ctx, len)                               \
+    do {                                                                    \
+        CK_MECHANISM stat_mech = { (ctx)->stat.mechanism, NULL, 0 };        \
+                                                                            \
+        if ((ctx)->stat.active == TRUE &&                                   \
+            (tokdata)->statistics->record_func != NULL)                     \
+            (tokdata)->statistics->record_func((tokdata)->statistics,       \
+                  (sess)->session_info.slotID, &stat_mech,                  \
+                  (ctx)->stat.strength, (ctx)->stat.bytes + (len),          \
+                  (ctx)->stat.start_time);                                  \
+        (ctx)->stat.active = FALSE;                                         \
+    } while (0)
+
 CK_RV statistics_init(struct statistics *statistics,
                       Slot_Mgr_Socket_t *slots_infos, CK_ULONG flags,
                       uid_t uid);
@@ -1636,6 +1636,22 @@ static CK_BBOOL cca_reencipher_cancel_filter_cb(STDLL_TokData_t *tokdata,
     return cca_reencipher_filter_cb(tokdata, obj, filter_data);
 }
 
+/*
+ * When resuming an interrupted re-encipher run, skip those objects that
+ * already have been re-enciphered.
+ */
+static CK_BBOOL cca_reencipher_resume_filter_cb(STDLL_TokData_t *tokdata,
+                                                OBJECT *obj, void *filter_data)
+{
+    CK_ATTRIBUTE *attr;
+
+    if (template_attribute_find(obj->template, CKA_IBM_OPAQUE_REENC,
+                                &attr) == TRUE)
+        return FALSE;
+
+    return cca_reencipher_filter_cb(tokdata, obj, filter_data);
+}
+
 static CK_RV cca_reencipher_cancel_objects_cb(STDLL_TokData_t *tokdata,
                                               OBJECT *obj, void *cb_data)
 {
@@ -1913,8 +1929,16 @@ static CK_RV cca_mk_change_reencipher(STDLL_TokData_t *tokdata,
     rd.tokdata = tokdata;
     rd.mk_change_op = mk_change_op;
 
+    /*
+     * If flag EVENT_MK_CHANGE_FLAGS_TOK_OBJS_RESUME is on, the tool resumes an
+     * interrupted run, skip the token objects re-enciphered by that run.
+     */
     rc = obj_mgr_iterate_key_objects(tokdata, !token_objs, token_objs,
-                                     cca_reencipher_filter_cb, mk_change_op,
+                                     token_objs && (op->flags &
+                                         EVENT_MK_CHANGE_FLAGS_TOK_OBJS_RESUME) ?
+                                         cca_reencipher_resume_filter_cb :
+                                         cca_reencipher_filter_cb,
+                                     mk_change_op,
                                      cca_reencipher_objects_cb, &rd,
                                      TRUE, "re-encipher");
     if (rc != CKR_OK) {
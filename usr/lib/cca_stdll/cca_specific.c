@@ -2083,13 +2083,12 @@ static CK_RV ccatok_pkey_add_attrs(STDLL_TokData_t * tokdata, TEMPLATE *template
                             CK_BYTE *rule_array, CK_ULONG rule_array_size,
                             CK_ULONG *rule_array_count)
 {
-    DL_NODE *node;
     CK_ATTRIBUTE_PTR attr;
+    CK_ULONG i;
     CK_RV ret;
 
-    node = template->attribute_list;
-    while (node != NULL) {
-        attr = node->data;
+    for (i = 0; i < template->num_attrs; i++) {
+        attr = template->attrs[i].attr;
 
         if (ccatok_pkey_attr_applicable(tokdata, attr, ktype,
                                         curve_type, curve_bitlen)) {
@@ -2098,8 +2097,6 @@ static CK_RV ccatok_pkey_add_attrs(STDLL_TokData_t * tokdata, TEMPLATE *template
             if (ret != CKR_OK)
                 return ret;
         }
-
-        node = node->next;
     }
 
     return CKR_OK;
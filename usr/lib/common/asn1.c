@@ -907,6 +907,183 @@ CK_RV ber_decode_CHOICE(CK_BYTE *choice,
     return CKR_FUNCTION_FAILED;
 }
 
+//
+// DER writer used by the key encoders below.
+//
+// The encoders first compute the length of the complete structure, allocate
+// one buffer of exactly that size and then fill it from its end towards its
+// start. Since the contents of an element are written before its header, the
+// length of every element is known when the header is written, and nested
+// elements need no temporary buffers that are copied into their parents.
+//
+struct der_writer {
+    CK_BYTE *buf;
+    CK_ULONG pos;               // start of the data written so far
+};
+
+// Length of an element with a content of content_len bytes, including the
+// tag and length octets.
+//
+static CK_RV der_element_len(CK_ULONG content_len, CK_ULONG *len)
+{
+    if (content_len < 128) {
+        *len = 1 + 1 + content_len;
+    } else if (content_len < 256) {
+        *len = 1 + (1 + 1) + content_len;
+    } else if (content_len < (1 << 16)) {
+        *len = 1 + (1 + 2) + content_len;
+    } else if (content_len < (1 << 24)) {
+        *len = 1 + (1 + 3) + content_len;
+    } else {
+        TRACE_ERROR("%s\n", ock_err(ERR_FUNCTION_FAILED));
+        return CKR_FUNCTION_FAILED;
+    }
+
+    return CKR_OK;
+}
+
+// Content length of an INTEGER, see ber_encode_INTEGER() for the padding.
+//
+static CK_ULONG der_integer_content_len(const CK_BYTE *data,
+                                        CK_ULONG data_len)
+{
+    if (data_len > 0 && (data == NULL || (data[0] & 0x80)))
+        return data_len + 1;
+
+    return data_len;
+}
+
+static CK_RV der_integer_len(const CK_BYTE *data, CK_ULONG data_len,
+                             CK_ULONG *len)
+{
+    return der_element_len(der_integer_content_len(data, data_len), len);
+}
+
+static void der_put_bytes(struct der_writer *w, const CK_BYTE *data,
+                          CK_ULONG data_len)
+{
+    w->pos -= data_len;
+    if (data_len == 0)
+        return;
+
+    if (data != NULL)
+        memcpy(w->buf + w->pos, data, data_len);
+    else
+        memset(w->buf + w->pos, 0, data_len);
+}
+
+static void der_put_header(struct der_writer *w, CK_BYTE tag,
+                           CK_ULONG content_len)
+{
+    CK_BYTE num = 0;
+
+    if (content_len < 128) {
+        w->buf[--w->pos] = content_len;
+    } else {
+        for (; content_len > 0; content_len >>= 8, num++)
+            w->buf[--w->pos] = content_len & 0xFF;
+        w->buf[--w->pos] = 0x80 | num;
+    }
+    w->buf[--w->pos] = tag;
+}
+
+static void der_put_INTEGER(struct der_writer *w, const CK_BYTE *data,
+                            CK_ULONG data_len)
+{
+    CK_ULONG content_len = der_integer_content_len(data, data_len);
+
+    der_put_bytes(w, data, data_len);
+    if (content_len > data_len)
+        w->buf[--w->pos] = 0x00;
+    der_put_header(w, 0x02, content_len);
+}
+
+static void der_put_OCTET_STRING(struct der_writer *w, const CK_BYTE *data,
+                                 CK_ULONG data_len)
+{
+    der_put_bytes(w, data, data_len);
+    der_put_header(w, 0x04, data_len);
+}
+
+static void der_put_BIT_STRING(struct der_writer *w, const CK_BYTE *data,
+                               CK_ULONG data_len)
+{
+    der_put_bytes(w, data, data_len);
+    w->buf[--w->pos] = 0x00;    // unused bits
+    der_put_header(w, 0x03, data_len + 1);
+}
+
+// AlgorithmIdentifier ::= SEQUENCE { algorithm OID, parameters NULL }
+//
+static CK_RV der_algid_len(CK_ULONG oid_len, CK_ULONG *len)
+{
+    return der_element_len(oid_len + ber_NULLLen, len);
+}
+
+static void der_put_algid(struct der_writer *w, const CK_BYTE *oid,
+                          CK_ULONG oid_len)
+{
+    der_put_bytes(w, ber_NULL, ber_NULLLen);
+    der_put_bytes(w, oid, oid_len);
+    der_put_header(w, 0x30, oid_len + ber_NULLLen);
+}
+
+// Length of a PrivateKeyInfo around an already encoded private key of
+// priv_key_len bytes, see ber_encode_PrivateKeyInfo().
+//
+static CK_RV der_PrivateKeyInfo_len(CK_ULONG algorithm_id_len,
+                                    CK_ULONG priv_key_len, CK_ULONG *len)
+{
+    CK_BYTE version[] = { 0 };
+    CK_ULONG total, content_len;
+    CK_RV rc;
+
+    rc = der_integer_len(version, sizeof(version), &total);
+    if (rc != CKR_OK)
+        return rc;
+    content_len = total + algorithm_id_len;
+
+    rc = der_element_len(priv_key_len, &total);
+    if (rc != CKR_OK)
+        return rc;
+    content_len += total;
+
+    return der_element_len(content_len, len);
+}
+
+// Writes the PrivateKeyInfo around the private key of priv_key_len bytes that
+// has just been written.
+//
+static void der_put_PrivateKeyInfo(struct der_writer *w,
+                                   const CK_BYTE *algorithm_id,
+                                   CK_ULONG algorithm_id_len,
+                                   CK_ULONG priv_key_len)
+{
+    CK_BYTE version[] = { 0 };
+    CK_ULONG end = w->pos + priv_key_len;
+
+    der_put_header(w, 0x04, priv_key_len);
+    der_put_bytes(w, algorithm_id, algorithm_id_len);
+    der_put_INTEGER(w, version, sizeof(version));
+    der_put_header(w, 0x30, end - w->pos);
+}
+
+// Same as der_put_PrivateKeyInfo(), but with an AlgorithmIdentifier of the
+// given OID and NULL parameters.
+//
+static void der_put_PrivateKeyInfo_algid(struct der_writer *w,
+                                         const CK_BYTE *oid, CK_ULONG oid_len,
+                                         CK_ULONG priv_key_len)
+{
+    CK_BYTE version[] = { 0 };
+    CK_ULONG end = w->pos + priv_key_len;
+
+    der_put_header(w, 0x04, priv_key_len);
+    der_put_algid(w, oid, oid_len);
+    der_put_INTEGER(w, version, sizeof(version));
+    der_put_header(w, 0x30, end - w->pos);
+}
+
 // PrivateKeyInfo ::= SEQUENCE {
 //    version  Version  -- always '0' for now
 //    privateKeyAlgorithm PrivateKeyAlgorithmIdentifier
@@ -921,86 +1098,37 @@ CK_RV ber_encode_PrivateKeyInfo(CK_BBOOL length_only,
                                 const CK_ULONG algorithm_id_len,
                                 CK_BYTE *priv_key, CK_ULONG priv_key_len)
 {
-    CK_BYTE *buf = NULL;
-    CK_BYTE *tmp = NULL;
-    CK_BYTE version[] = { 0 };
-    CK_ULONG len, total;
+    struct der_writer w;
+    CK_ULONG total;
     CK_RV rc;
 
-    len = 0;
-
-    rc = ber_encode_INTEGER(TRUE, NULL, &total, version, sizeof(version));
-    if (rc != CKR_OK) {
-        TRACE_DEVEL("ber_encode_INTEGER failed\n");
-        return rc;
-    } else {
-        len += total;
-    }
-
-    len += algorithm_id_len;
-
-    rc = ber_encode_OCTET_STRING(TRUE, NULL, &total, priv_key, priv_key_len);
+    // for this stuff, attributes can be suppressed.
+    //
+    rc = der_PrivateKeyInfo_len(algorithm_id_len, priv_key_len, &total);
     if (rc != CKR_OK) {
-        TRACE_DEVEL("ber_encode_OCTET_STRING failed\n");
+        TRACE_DEVEL("der_PrivateKeyInfo_len failed\n");
         return rc;
     }
 
-    len += total;
-
-    // for this stuff, attributes can be suppressed.
-    //
-
     if (length_only == TRUE) {
-        rc = ber_encode_SEQUENCE(TRUE, NULL, &total, NULL, len);
-
-        if (rc == CKR_OK)
-            *data_len = total;
-        if (rc != CKR_OK)
-            TRACE_DEVEL("ber_encode_SEQUENCE failed\n");
-        return rc;
+        *data_len = total;
+        return CKR_OK;
     }
 
-    buf = (CK_BYTE *) malloc(len);
-    if (!buf) {
+    w.buf = (CK_BYTE *) malloc(total);
+    if (!w.buf) {
         TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
         return CKR_HOST_MEMORY;
     }
-    len = 0;
-    rc = ber_encode_INTEGER(FALSE, &tmp, &total, version, sizeof(version));
-    if (rc != CKR_OK) {
-        TRACE_DEVEL("ber_encode_INTEGER failed\n");
-        goto error;
-    }
-    if (tmp != NULL) {
-        memcpy(buf + len, tmp, total);
-        len += total;
-        free(tmp);
-        tmp = NULL;
-    }
-
-    memcpy(buf + len, algorithm_id, algorithm_id_len);
-    len += algorithm_id_len;
-
-    rc = ber_encode_OCTET_STRING(FALSE, &tmp, &total, priv_key, priv_key_len);
-    if (rc != CKR_OK) {
-        TRACE_DEVEL("ber_encode_OCTET_STRING failed\n");
-        goto error;
-    }
-    memcpy(buf + len, tmp, total);
-    len += total;
-    free(tmp);
-    tmp = NULL;
+    w.pos = total;
 
-    rc = ber_encode_SEQUENCE(FALSE, data, data_len, buf, len);
-    if (rc != CKR_OK)
-        TRACE_DEVEL("ber_encode_SEQUENCE failed\n");
+    der_put_bytes(&w, priv_key, priv_key_len);
+    der_put_PrivateKeyInfo(&w, algorithm_id, algorithm_id_len, priv_key_len);
 
-error:
-    if (tmp != NULL)
-        free(tmp);
-    free(buf);
+    *data = w.buf;
+    *data_len = total;
 
-    return rc;
+    return CKR_OK;
 }
 
 
@@ -1140,206 +1268,59 @@ CK_RV ber_encode_RSAPrivateKey(CK_BBOOL length_only,
                                CK_ATTRIBUTE *exponent2,
                                CK_ATTRIBUTE *coeff)
 {
-    CK_BYTE *buf = NULL;
-    CK_BYTE *buf2 = NULL;
-    CK_ULONG len, offset;
+    CK_ATTRIBUTE *ints[] = { modulus, publ_exp, priv_exp, prime1, prime2,
+                             exponent1, exponent2, coeff };
+    CK_ULONG num_ints = sizeof(ints) / sizeof(ints[0]);
     CK_BYTE version[] = { 0 };
+    struct der_writer w;
+    CK_ULONG len, offset, key_len, total, i;
     CK_RV rc;
 
-
-    offset = 0;
-    rc = 0;
-
-    rc |= ber_encode_INTEGER(TRUE, NULL, &len, NULL, sizeof(version));
-    offset += len;
-    rc |= ber_encode_INTEGER(TRUE, NULL, &len, NULL, modulus->ulValueLen);
-    offset += len;
-    rc |= ber_encode_INTEGER(TRUE, NULL, &len, NULL, publ_exp->ulValueLen);
-    offset += len;
-    rc |= ber_encode_INTEGER(TRUE, NULL, &len, NULL, priv_exp->ulValueLen);
-    offset += len;
-    rc |= ber_encode_INTEGER(TRUE, NULL, &len, NULL, prime1->ulValueLen);
-    offset += len;
-    rc |= ber_encode_INTEGER(TRUE, NULL, &len, NULL, prime2->ulValueLen);
-    offset += len;
-    rc |= ber_encode_INTEGER(TRUE, NULL, &len, NULL, exponent1->ulValueLen);
-    offset += len;
-    rc |= ber_encode_INTEGER(TRUE, NULL, &len, NULL, exponent2->ulValueLen);
-    offset += len;
-    rc |= ber_encode_INTEGER(TRUE, NULL, &len, NULL, coeff->ulValueLen);
-    offset += len;
-
-    if (rc != CKR_OK) {
-        TRACE_DEVEL("ber_encode_INTEGER failed\n");
-        return CKR_FUNCTION_FAILED;
-    }
-    if (length_only == TRUE) {
-        rc = ber_encode_SEQUENCE(TRUE, NULL, &len, NULL, offset);
-        if (rc != CKR_OK) {
-            TRACE_DEVEL("ber_encode_SEQUENCE failed\n");
-            return rc;
-        }
-        rc = ber_encode_PrivateKeyInfo(TRUE,
-                                       NULL, data_len,
-                                       NULL, ber_AlgIdRSAEncryptionLen,
-                                       NULL, len);
-        if (rc != CKR_OK) {
-            TRACE_DEVEL("ber_encode_PrivateKeyInfo failed\n");
-            return rc;
-        }
-        return rc;
-    }
-
-    buf = (CK_BYTE *) malloc(offset);
-    if (!buf) {
-        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-        return CKR_HOST_MEMORY;
-    }
-    offset = 0;
-
-    rc = ber_encode_INTEGER(FALSE, &buf2, &len, version, sizeof(version));
-    if (rc != CKR_OK) {
-        TRACE_DEVEL("ber_encode_INTEGER failed\n");
-        goto error;
-    }
-    if (buf2 != NULL) {
-        memcpy(buf + offset, buf2, len);
+    rc = der_integer_len(version, sizeof(version), &offset);
+    for (i = 0; i < num_ints && rc == CKR_OK; i++) {
+        rc = der_integer_len(ints[i]->pValue, ints[i]->ulValueLen, &len);
         offset += len;
-        free(buf2);
-        buf2 = NULL;
     }
-
-    rc = ber_encode_INTEGER(FALSE, &buf2, &len,
-                            (CK_BYTE *) modulus + sizeof(CK_ATTRIBUTE),
-                            modulus->ulValueLen);
-    if (rc != CKR_OK) {
-        TRACE_DEVEL("ber_encode_INTEGER failed\n");
-        goto error;
-    }
-    if (buf2 != NULL) {
-        memcpy(buf + offset, buf2, len);
-        offset += len;
-        free(buf2);
-        buf2 = NULL;
-    }
-
-    rc = ber_encode_INTEGER(FALSE, &buf2, &len,
-                            (CK_BYTE *) publ_exp + sizeof(CK_ATTRIBUTE),
-                            publ_exp->ulValueLen);
     if (rc != CKR_OK) {
-        TRACE_DEVEL("ber_encode_INTEGER failed\n");
-        goto error;
-    }
-    if (buf2 != NULL) {
-        memcpy(buf + offset, buf2, len);
-        offset += len;
-        free(buf2);
-        buf2 = NULL;
+        TRACE_DEVEL("der_integer_len failed\n");
+        return CKR_FUNCTION_FAILED;
     }
 
-    rc = ber_encode_INTEGER(FALSE, &buf2, &len,
-                            (CK_BYTE *) priv_exp + sizeof(CK_ATTRIBUTE),
-                            priv_exp->ulValueLen);
+    rc = der_element_len(offset, &key_len);
     if (rc != CKR_OK) {
-        TRACE_DEVEL("ber_encode_INTEGER failed\n");
-        goto error;
-    }
-    if (buf2 != NULL) {
-        memcpy(buf + offset, buf2, len);
-        offset += len;
-        free(buf2);
-        buf2 = NULL;
+        TRACE_DEVEL("der_element_len failed\n");
+        return rc;
     }
-
-    rc = ber_encode_INTEGER(FALSE, &buf2, &len,
-                            (CK_BYTE *) prime1 + sizeof(CK_ATTRIBUTE),
-                            prime1->ulValueLen);
+    rc = der_PrivateKeyInfo_len(ber_AlgIdRSAEncryptionLen, key_len, &total);
     if (rc != CKR_OK) {
-        TRACE_DEVEL("ber_encode_INTEGER failed\n");
-        goto error;
-    }
-    if (buf2 != NULL) {
-        memcpy(buf + offset, buf2, len);
-        offset += len;
-        free(buf2);
-        buf2 = NULL;
+        TRACE_DEVEL("der_PrivateKeyInfo_len failed\n");
+        return rc;
     }
 
-    rc = ber_encode_INTEGER(FALSE, &buf2, &len,
-                            (CK_BYTE *) prime2 + sizeof(CK_ATTRIBUTE),
-                            prime2->ulValueLen);
-    if (rc != CKR_OK) {
-        TRACE_DEVEL("ber_encode_INTEGER failed\n");
-        goto error;
-    }
-    if (buf2 != NULL) {
-        memcpy(buf + offset, buf2, len);
-        offset += len;
-        free(buf2);
-        buf2 = NULL;
+    if (length_only == TRUE) {
+        *data_len = total;
+        return CKR_OK;
     }
 
-    rc = ber_encode_INTEGER(FALSE, &buf2, &len,
-                            (CK_BYTE *) exponent1 + sizeof(CK_ATTRIBUTE),
-                            exponent1->ulValueLen);
-    if (rc != CKR_OK) {
-        TRACE_DEVEL("ber_encode_INTEGER failed\n");
-        goto error;
-    }
-    if (buf2 != NULL) {
-        memcpy(buf + offset, buf2, len);
-        offset += len;
-        free(buf2);
-        buf2 = NULL;
+    w.buf = (CK_BYTE *) malloc(total);
+    if (!w.buf) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        return CKR_HOST_MEMORY;
     }
+    w.pos = total;
 
-    rc = ber_encode_INTEGER(FALSE, &buf2, &len,
-                            (CK_BYTE *) exponent2 + sizeof(CK_ATTRIBUTE),
-                            exponent2->ulValueLen);
-    if (rc != CKR_OK) {
-        TRACE_DEVEL("ber_encode_INTEGER failed\n");
-        goto error;
-    }
-    if (buf2 != NULL) {
-        memcpy(buf + offset, buf2, len);
-        offset += len;
-        free(buf2);
-        buf2 = NULL;
-    }
+    for (i = num_ints; i > 0; i--)
+        der_put_INTEGER(&w, ints[i - 1]->pValue, ints[i - 1]->ulValueLen);
+    der_put_INTEGER(&w, version, sizeof(version));
+    der_put_header(&w, 0x30, offset);
 
-    rc = ber_encode_INTEGER(FALSE, &buf2, &len,
-                            (CK_BYTE *) coeff + sizeof(CK_ATTRIBUTE),
-                            coeff->ulValueLen);
-    if (rc != CKR_OK) {
-        TRACE_DEVEL("ber_encode_INTEGER failed\n");
-        goto error;
-    }
-    if (buf2 != NULL) {
-        memcpy(buf + offset, buf2, len);
-        offset += len;
-        free(buf2);
-        buf2 = NULL;
-    }
+    der_put_PrivateKeyInfo(&w, ber_AlgIdRSAEncryption,
+                           ber_AlgIdRSAEncryptionLen, key_len);
 
-    rc = ber_encode_SEQUENCE(FALSE, &buf2, &len, buf, offset);
-    if (rc != CKR_OK) {
-        TRACE_DEVEL("ber_encode_SEQUENCE failed\n");
-        goto error;
-    }
-    rc = ber_encode_PrivateKeyInfo(FALSE,
-                                   data, data_len,
-                                   ber_AlgIdRSAEncryption,
-                                   ber_AlgIdRSAEncryptionLen, buf2, len);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("ber_encode_PrivateKeyInfo failed\n");
-    }
-error:
-    if (buf2)
-        free(buf2);
-    if (buf)
-        free(buf);
+    *data = w.buf;
+    *data_len = total;
 
-    return rc;
+    return CKR_OK;
 }
 
 
@@ -2516,35 +2497,35 @@ CK_RV der_encode_ECPrivateKey(CK_BBOOL length_only,
                               CK_ATTRIBUTE *point,
                               CK_ATTRIBUTE *pubkey)
 {
-    CK_BYTE *buf = NULL;
-    CK_BYTE *buf2 = NULL;
-    CK_ULONG len, offset = 0;
     CK_BYTE version[] = { 1 };  // ecPrivkeyVer1
     CK_BYTE der_AlgIdEC[der_AlgIdECBaseLen + params->ulValueLen];
     CK_ULONG der_AlgIdECLen = sizeof(der_AlgIdEC);
-    CK_BYTE *ecpoint;
-    CK_ULONG ecpoint_len, field_len;
-    BerElement *ber;
-    BerValue *val = NULL;
-    CK_RV rc = 0;
+    CK_BYTE *ecpoint = NULL;
+    CK_ULONG ecpoint_len = 0, field_len;
+    CK_ULONG len, offset, pub_len = 0, key_len, total;
+    struct der_writer w;
+    CK_RV rc;
 
-    /* Calculate BER encoding length
+    /* Calculate DER encoding length
      * Inner SEQUENCE of
      * Integer (version), OCTET STRING (private key)
      * and CHOICE [1] BIT STRING (public key)
      */
     // version
-    rc |= ber_encode_INTEGER(TRUE, NULL, &len, NULL, sizeof(version));
-    offset += len;
+    rc = der_integer_len(version, sizeof(version), &offset);
+    if (rc != CKR_OK) {
+        TRACE_DEVEL("der encoding failed\n");
+        return CKR_FUNCTION_FAILED;
+    }
 
     // private key octet
-    rc |= ber_encode_OCTET_STRING(TRUE, NULL, &len, NULL,
-                                  point->ulValueLen);
-    offset += len;
+    rc = der_element_len(point->ulValueLen, &len);
     if (rc != CKR_OK) {
         TRACE_DEVEL("der encoding failed\n");
         return CKR_FUNCTION_FAILED;
     }
+    offset += len;
+
     // public key bit string
     if (pubkey && pubkey->pValue) {
         rc = ber_decode_OCTET_STRING(pubkey->pValue, &ecpoint, &ecpoint_len,
@@ -2554,124 +2535,49 @@ CK_RV der_encode_ECPrivateKey(CK_BBOOL length_only,
             return CKR_ATTRIBUTE_VALUE_INVALID;
         }
 
-        ber = ber_alloc_t(LBER_USE_DER);
-        rc = (ber_put_bitstring(ber, (char *)ecpoint, ecpoint_len * 8, 0x03)
-                                                            <= 0 ? 1 : 0);
-        rc |= ber_flatten(ber, &val);
-        if (rc != 0) {
-            TRACE_DEVEL("ber_put_bitstring/ber_flatten failed\n");
-            ber_free(ber, 1);
-            ber_bvfree(val);
-            return CKR_FUNCTION_FAILED;
-       }
-
-        rc = ber_encode_CHOICE(TRUE, 1, &buf2, &len, (CK_BYTE *)val->bv_val,
-                               val->bv_len);
-        if (rc != 0) {
-            TRACE_DEVEL("ber_encode_CHOICE failed\n");
-            ber_free(ber, 1);
-            ber_bvfree(val);
+        rc = der_element_len(ecpoint_len + 1, &pub_len);
+        if (rc == CKR_OK)
+            rc = der_element_len(pub_len, &len);
+        if (rc != CKR_OK) {
+            TRACE_DEVEL("der encoding of public key failed\n");
             return CKR_FUNCTION_FAILED;
-       }
-
+        }
         offset += len;
-        ber_free(ber, 1);
-        ber_bvfree(val);
     }
 
-    if (length_only == TRUE) {
-        rc = ber_encode_SEQUENCE(TRUE, NULL, &len, NULL, offset);
-        if (rc != CKR_OK) {
-            TRACE_DEVEL("ber_encode_SEQUENCE failed\n");
-            return rc;
-        }
-        rc = ber_encode_PrivateKeyInfo(TRUE, NULL, data_len, NULL,
-                                       der_AlgIdECLen, NULL, len);
-        if (rc != CKR_OK) {
-            TRACE_DEVEL("ber_encode_PrivateKeyInfo failed\n");
-            return rc;
-        }
+    rc = der_element_len(offset, &key_len);
+    if (rc != CKR_OK) {
+        TRACE_DEVEL("der_element_len failed\n");
         return rc;
     }
-
-    /* Now starting with the real data */
-    buf = (CK_BYTE *) malloc(offset);
-    if (!buf) {
-        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-        return CKR_HOST_MEMORY;
-    }
-    offset = 0;
-
-    rc = ber_encode_INTEGER(FALSE, &buf2, &len, version, sizeof(version));
+    rc = der_PrivateKeyInfo_len(der_AlgIdECLen, key_len, &total);
     if (rc != CKR_OK) {
-        TRACE_DEVEL("ber_encode_INTEGER failed\n");
-        goto error;
-    }
-    if (buf2 != NULL) {
-        memcpy(buf + offset, buf2, len);
-        offset += len;
-        free(buf2);
-        buf2 = NULL;
+        TRACE_DEVEL("der_PrivateKeyInfo_len failed\n");
+        return rc;
     }
 
-    rc = ber_encode_OCTET_STRING(FALSE, &buf2, &len,
-                                 (CK_BYTE *) point +
-                                 sizeof(CK_ATTRIBUTE), point->ulValueLen);
-    if (rc != CKR_OK) {
-        TRACE_DEVEL("ber_encode_INTEGER failed\n");
-        goto error;
+    if (length_only == TRUE) {
+        *data_len = total;
+        return CKR_OK;
     }
-    if (buf2 != NULL) {
-        memcpy(buf + offset, buf2, len);
-        offset += len;
-        free(buf2);
-        buf2 = NULL;
+
+    /* Now starting with the real data */
+    w.buf = (CK_BYTE *) malloc(total);
+    if (!w.buf) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        return CKR_HOST_MEMORY;
     }
+    w.pos = total;
 
     /* generate optional bit-string of public key */
-    if (pubkey && pubkey->pValue) {
-        rc = ber_decode_OCTET_STRING(pubkey->pValue, &ecpoint, &ecpoint_len,
-                                     &field_len);
-        if (rc != CKR_OK || pubkey->ulValueLen != field_len) {
-            TRACE_DEVEL("ber decoding of public key failed\n");
-            rc = CKR_ATTRIBUTE_VALUE_INVALID;
-            goto error;
-        }
-
-        ber = ber_alloc_t(LBER_USE_DER);
-        rc = (ber_put_bitstring(ber, (char *)ecpoint, ecpoint_len * 8, 0x03)
-                                                                <= 0 ? 1 : 0);
-        rc |= ber_flatten(ber, &val);
-        if (rc != 0) {
-            TRACE_DEVEL("ber_put_bitstring/ber_flatten failed\n");
-            ber_free(ber, 1);
-            ber_bvfree(val);
-            rc = CKR_FUNCTION_FAILED;
-            goto error;
-       }
-
-        rc = ber_encode_CHOICE(FALSE, 1, &buf2, &len, (CK_BYTE *)val->bv_val,
-                               val->bv_len);
-        if (rc != CKR_OK) {
-            TRACE_DEVEL("ber_encode_CHOICE failed\n");
-            ber_free(ber, 1);
-            ber_bvfree(val);
-            goto error;
-        }
-
-        memcpy(buf + offset, buf2, len);
-        offset += len;
-        free(buf2);
-        buf2 = NULL;
-        ber_free(ber, 1);
-        ber_bvfree(val);
+    if (ecpoint != NULL) {
+        der_put_BIT_STRING(&w, ecpoint, ecpoint_len);
+        der_put_header(&w, 0xA1, pub_len);
     }
 
-    rc = ber_encode_SEQUENCE(FALSE, &buf2, &len, buf, offset);
-    if (rc != CKR_OK) {
-        TRACE_DEVEL("ber_encode_SEQUENCE failed\n");
-        goto error;
-    }
+    der_put_OCTET_STRING(&w, point->pValue, point->ulValueLen);
+    der_put_INTEGER(&w, version, sizeof(version));
+    der_put_header(&w, 0x30, offset);
 
     /* concatenate EC algorithm-id + specific curve id */
     memcpy(der_AlgIdEC, der_AlgIdECBase, der_AlgIdECBaseLen);
@@ -2680,19 +2586,12 @@ CK_RV der_encode_ECPrivateKey(CK_BBOOL length_only,
     /* adjust length field */
     der_AlgIdEC[1] = der_AlgIdEC[1] + params->ulValueLen;
 
-    rc = ber_encode_PrivateKeyInfo(FALSE, data, data_len, der_AlgIdEC,
-                                   der_AlgIdECLen, buf2, len);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("ber_encode_PrivateKeyInfo failed\n");
-    }
+    der_put_PrivateKeyInfo(&w, der_AlgIdEC, der_AlgIdECLen, key_len);
 
-error:
-    if (buf2)
-        free(buf2);
-    if (buf)
-        free(buf);
+    *data = w.buf;
+    *data_len = total;
 
-    return rc;
+    return CKR_OK;
 }
 
 //
@@ -3643,135 +3542,39 @@ CK_RV ber_encode_IBM_DilithiumPublicKey(CK_BBOOL length_only,
                                         const CK_BYTE *oid, CK_ULONG oid_len,
                                         CK_ATTRIBUTE *rho, CK_ATTRIBUTE *t1)
 {
-    CK_BYTE *buf = NULL, *buf2 = NULL, *buf3 = NULL, *buf4 = NULL;
-    CK_BYTE *buf5 = NULL, *algid = NULL;
-    CK_ULONG len = 0, len4, offset, total, total_len, algid_len;
+    CK_ULONG len, offset, seq_len, bitstr_len, algid_len, total;
+    struct der_writer w;
     CK_RV rc;
 
     UNUSED(length_only);
 
-    offset = 0;
-    rc = 0;
-    total_len = 0;
-    total = 0;
-
-    /* Calculate storage for AlgID sequence */
-    rc |= ber_encode_SEQUENCE(TRUE, NULL, &total_len, NULL,
-                              oid_len + ber_NULLLen);
-
     /* Calculate storage for inner sequence */
-    rc |= ber_encode_INTEGER(TRUE, NULL, &len, NULL, rho->ulValueLen);
-    offset += len;
-    rc |= ber_encode_INTEGER(TRUE, NULL, &len, NULL, t1->ulValueLen);
-    offset += len;
-
-    if (rc != CKR_OK) {
-        TRACE_ERROR("%s ber_encode_Int failed with rc=0x%lx\n", __func__, rc);
+    rc = der_element_len(rho->ulValueLen + 1, &offset);
+    if (rc == CKR_OK) {
+        rc = der_element_len(t1->ulValueLen + 1, &len);
+        offset += len;
+    }
+    /* Calculate storage for bit string, AlgID and outer sequence */
+    if (rc == CKR_OK)
+        rc = der_element_len(offset, &seq_len);
+    if (rc == CKR_OK)
+        rc = der_element_len(seq_len + 1, &bitstr_len);
+    if (rc == CKR_OK)
+        rc = der_algid_len(oid_len, &algid_len);
+    if (rc == CKR_OK)
+        rc = der_element_len(algid_len + bitstr_len, &total);
+    if (rc != CKR_OK) {
+        TRACE_ERROR("%s der length calculation failed with rc=0x%lx\n",
+                    __func__, rc);
         return rc;
     }
 
-    /* Allocate storage for inner sequence */
-    buf = (CK_BYTE *) malloc(offset);
-    if (!buf) {
+    w.buf = (CK_BYTE *) malloc(total);
+    if (!w.buf) {
         TRACE_ERROR("%s Memory allocation failed\n", __func__);
         return CKR_HOST_MEMORY;
     }
-
-    /**
-     *    SEQUENCE (2 elem)
-     *       BIT STRING -> rho
-     *       BIT STRING -> t
-     */
-    offset = 0;
-    rc = ber_encode_BIT_STRING(FALSE, &buf2, &len,
-                               rho->pValue, rho->ulValueLen, 0);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("%s ber_encode_Int failed with rc=0x%lx\n", __func__, rc);
-        goto error;
-    }
-    memcpy(buf + offset, buf2, len);
-    offset += len;
-    free(buf2);
-    buf2 = NULL;
-
-    rc = ber_encode_BIT_STRING(FALSE, &buf2, &len,
-                               t1->pValue, t1->ulValueLen, 0);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("%s ber_encode_Int failed with rc=0x%lx\n", __func__, rc);
-        goto error;
-    }
-    memcpy(buf + offset, buf2, len);
-    offset += len;
-    free(buf2);
-    buf2 = NULL;
-
-    rc = ber_encode_SEQUENCE(FALSE, &buf2, &len, buf, offset);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("%s ber_encode_Seq failed with rc=0x%lx\n", __func__, rc);
-        goto error;
-    }
-    free(buf);
-    buf = NULL;
-
-    /* Calculate length of outer sequence */
-    rc = ber_encode_BIT_STRING(TRUE, NULL, &total, buf2, len, 0);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("%s ber_encode_Oct_Str failed with rc=0x%lx\n", __func__, rc);
-        goto error;
-    } else {
-        total_len += total;
-    }
-
-    /* Allocate storage for outer sequence and bit string */
-    buf3 = (CK_BYTE *) malloc(total_len);
-    if (!buf3) {
-        TRACE_ERROR("%s Memory allocation failed\n", __func__);
-        rc = CKR_HOST_MEMORY;
-        goto error;
-    }
-
-    /*
-     * SEQUENCE (2 elem)
-     *      OBJECT IDENTIFIER 1.3.6.1.4.1.2.267.xxx
-     *      NULL  <- no parms for this oid
-     */
-    buf5 = (CK_BYTE *) malloc(oid_len + ber_NULLLen);
-    if (!buf5) {
-        TRACE_ERROR("%s Memory allocation failed\n", __func__);
-        rc = CKR_HOST_MEMORY;
-        goto error;
-    }
-    memcpy(buf5, oid, oid_len);
-    memcpy(buf5 + oid_len, ber_NULL, ber_NULLLen);
-
-    rc = ber_encode_SEQUENCE(FALSE, &algid, &algid_len, buf5,
-                             oid_len + ber_NULLLen);
-    free(buf5);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("%s ber_encode_SEQUENCE failed with rc=0x%lx\n", __func__, rc);
-        goto error;
-    }
-
-    total_len = algid_len;
-    memcpy(buf3, algid, algid_len);
-    free(algid);
-    algid = NULL;
-
-    /*
-     * BIT STRING (1 elem)
-     *       SEQUENCE (2 elem)
-     *          BIT STRING  -> rho
-     *          BIT STRING  -> t1
-     */
-    rc = ber_encode_BIT_STRING(FALSE, &buf4, &len4, buf2, len, 0);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("%s ber_encode_BIT_STRING failed with rc=0x%lx\n", __func__, rc);
-        goto error;
-    }
-    memcpy(buf3 + total_len, buf4, len4);
-    total_len += len4;
-    free(buf4);
-    buf4 = NULL;
+    w.pos = total;
 
     /**
      * SEQUENCE (2 elem)
@@ -3782,21 +3585,19 @@ CK_RV ber_encode_IBM_DilithiumPublicKey(CK_BBOOL length_only,
      *       SEQUENCE (2 elem)
      *          BIT STRING  -> rho
      *          BIT STRING  -> t1
-     */
-    rc = ber_encode_SEQUENCE(FALSE, data, data_len, buf3, total_len);
-    if (rc != CKR_OK)
-        TRACE_ERROR("%s ber_encode_Seq failed with rc=0x%lx\n", __func__, rc);
-
-error:
-
-    if (buf)
-        free(buf);
-    if (buf2)
-        free(buf2);
-    if (buf3)
-        free(buf3);
+     */
+    der_put_BIT_STRING(&w, t1->pValue, t1->ulValueLen);
+    der_put_BIT_STRING(&w, rho->pValue, rho->ulValueLen);
+    der_put_header(&w, 0x30, offset);
+    w.buf[--w.pos] = 0x00;      // unused bits
+    der_put_header(&w, 0x03, seq_len + 1);
+    der_put_algid(&w, oid, oid_len);
+    der_put_header(&w, 0x30, algid_len + bitstr_len);
 
-    return rc;
+    *data = w.buf;
+    *data_len = total;
+
+    return CKR_OK;
 }
 
 
@@ -3942,209 +3743,68 @@ CK_RV ber_encode_IBM_DilithiumPrivateKey(CK_BBOOL length_only,
                                          CK_ATTRIBUTE *t0,
                                          CK_ATTRIBUTE *t1)
 {
-    CK_BYTE *buf = NULL, *buf2 = NULL, *buf3 = NULL;
-    CK_BYTE *algid = NULL, *algid_buf = NULL;
-    CK_ULONG len, len2 = 0, offset, algid_len = 0;
+    CK_ATTRIBUTE *bitstrs[] = { rho, seed, tr, s1, s2, t0 };
+    CK_ULONG num_bitstrs = sizeof(bitstrs) / sizeof(bitstrs[0]);
     CK_BYTE version[] = { 0 };
+    struct der_writer w;
+    CK_ULONG len, t1_len = 0, offset, key_len, algid_len, total, i;
     CK_RV rc;
 
     /* Calculate storage for sequence */
-    offset = 0;
-    rc = 0;
-
-    rc |= ber_encode_SEQUENCE(TRUE, NULL, &algid_len, NULL,
-                              oid_len + ber_NULLLen);
-
-    rc |= ber_encode_INTEGER(TRUE, NULL, &len, NULL, sizeof(version));
-    offset += len;
-    rc |= ber_encode_BIT_STRING(TRUE, NULL, &len, NULL, rho->ulValueLen, 0);
-    offset += len;
-    rc |= ber_encode_BIT_STRING(TRUE, NULL, &len, NULL, seed->ulValueLen, 0);
-    offset += len;
-    rc |= ber_encode_BIT_STRING(TRUE, NULL, &len, NULL, tr->ulValueLen, 0);
-    offset += len;
-    rc |= ber_encode_BIT_STRING(TRUE, NULL, &len, NULL, s1->ulValueLen, 0);
-    offset += len;
-    rc |= ber_encode_BIT_STRING(TRUE, NULL, &len, NULL, s2->ulValueLen, 0);
-    offset += len;
-    rc |= ber_encode_BIT_STRING(TRUE, NULL, &len, NULL, t0->ulValueLen, 0);
-    offset += len;
-    if (t1) {
-        rc |= ber_encode_BIT_STRING(TRUE, NULL, &len2, NULL, t1->ulValueLen, 0);
-        rc |= ber_encode_CHOICE(TRUE, 0, NULL, &len, NULL, len2);
+    rc = der_integer_len(version, sizeof(version), &offset);
+    for (i = 0; i < num_bitstrs && rc == CKR_OK; i++) {
+        rc = der_element_len(bitstrs[i]->ulValueLen + 1, &len);
         offset += len;
     }
-
+    if (rc == CKR_OK && t1 && t1->pValue) {
+        rc = der_element_len(t1->ulValueLen + 1, &t1_len);
+        if (rc == CKR_OK)
+            rc = der_element_len(t1_len, &len);
+        offset += len;
+    }
+    if (rc == CKR_OK)
+        rc = der_element_len(offset, &key_len);
+    if (rc == CKR_OK)
+        rc = der_algid_len(oid_len, &algid_len);
+    if (rc == CKR_OK)
+        rc = der_PrivateKeyInfo_len(algid_len, key_len, &total);
     if (rc != CKR_OK) {
         TRACE_DEVEL("Calculate storage for sequence failed\n");
         return CKR_FUNCTION_FAILED;
     }
 
     if (length_only == TRUE) {
-        rc = ber_encode_SEQUENCE(TRUE, NULL, &len, NULL, offset);
-        if (rc != CKR_OK) {
-            TRACE_DEVEL("ber_encode_SEQUENCE failed\n");
-            return rc;
-        }
-        rc = ber_encode_PrivateKeyInfo(TRUE,
-                                       NULL, data_len,
-                                       NULL, algid_len,
-                                       NULL, len);
-        if (rc != CKR_OK) {
-            TRACE_DEVEL("ber_encode_PrivateKeyInfo failed\n");
-            return rc;
-        }
-        return rc;
+        *data_len = total;
+        return CKR_OK;
     }
 
-    /* Allocate storage for sequence */
-    buf = (CK_BYTE *) malloc(offset);
-    if (!buf) {
+    w.buf = (CK_BYTE *) malloc(total);
+    if (!w.buf) {
         TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
         return CKR_HOST_MEMORY;
     }
-    offset = 0;
-
-    /* Version */
-    rc = ber_encode_INTEGER(FALSE, &buf2, &len, version, sizeof(version));
-    if (rc != CKR_OK) {
-        TRACE_ERROR("ber_encode_INTEGER of version failed\n");
-        goto error;
-    }
-    memcpy(buf + offset, buf2, len);
-    offset += len;
-    free(buf2);
-    buf2 = NULL;
-
-    /* rho */
-    rc = ber_encode_BIT_STRING(FALSE, &buf2, &len,
-                            rho->pValue, rho->ulValueLen, 0);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("ber_encode_BIT_STRING of rho failed\n");
-        goto error;
-    }
-    memcpy(buf + offset, buf2, len);
-    offset += len;
-    free(buf2);
-    buf2 = NULL;
-
-    /* seed */
-    rc = ber_encode_BIT_STRING(FALSE, &buf2, &len,
-                            seed->pValue, seed->ulValueLen, 0);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("ber_encode_BIT_STRING of seed failed\n");
-        goto error;
-    }
-    memcpy(buf + offset, buf2, len);
-    offset += len;
-    free(buf2);
-    buf2 = NULL;
-
-    /* tr */
-    rc = ber_encode_BIT_STRING(FALSE, &buf2, &len,
-                               tr->pValue, tr->ulValueLen, 0);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("ber_encode_BIT_STRING of (tr) failed\n");
-        goto error;
-    }
-    memcpy(buf + offset, buf2, len);
-    offset += len;
-    free(buf2);
-    buf2 = NULL;
-
-    /* s1 */
-    rc = ber_encode_BIT_STRING(FALSE, &buf2, &len,
-                               s1->pValue, s1->ulValueLen, 0);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("ber_encode_BIT_STRING of (s1) failed\n");
-        goto error;
-    }
-    memcpy(buf + offset, buf2, len);
-    offset += len;
-    free(buf2);
-    buf2 = NULL;
-
-    /* s2 */
-    rc = ber_encode_BIT_STRING(FALSE, &buf2, &len,
-                               s2->pValue, s2->ulValueLen, 0);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("ber_encode_BIT_STRING of (s2) failed\n");
-        goto error;
-    }
-    memcpy(buf + offset, buf2, len);
-    offset += len;
-    free(buf2);
-    buf2 = NULL;
-
-    /* t0 */
-    rc = ber_encode_BIT_STRING(FALSE, &buf2, &len,
-                               t0->pValue, t0->ulValueLen, 0);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("ber_encode_BIT_STRING of (t0) failed\n");
-        goto error;
-    }
-    memcpy(buf + offset, buf2, len);
-    offset += len;
-    free(buf2);
-    buf2 = NULL;
+    w.pos = total;
 
     /* (t1) Optional bit-string of public key */
     if (t1 && t1->pValue) {
-        rc = ber_encode_BIT_STRING(FALSE, &buf3, &len2, t1->pValue, t1->ulValueLen, 0);
-        rc |= ber_encode_CHOICE(FALSE, 0, &buf2, &len, buf3, len2);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("encoding of t1 value failed\n");
-            goto error;
-        }
-        memcpy(buf + offset, buf2, len);
-        offset += len;
-        free(buf2);
-        buf2 = NULL;
-    }
-
-    /* Encode sequence */
-    rc = ber_encode_SEQUENCE(FALSE, &buf2, &len, buf, offset);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("ber_encode_SEQUENCE failed\n");
-        goto error;
+        der_put_BIT_STRING(&w, t1->pValue, t1->ulValueLen);
+        der_put_header(&w, 0xA0, t1_len);
     }
 
-    algid_buf = (CK_BYTE *) malloc(oid_len + ber_NULLLen);
-    if (!algid_buf) {
-        TRACE_ERROR("%s Memory allocation failed\n", __func__);
-        rc = CKR_HOST_MEMORY;
-        goto error;
-    }
-    memcpy(algid_buf, oid, oid_len);
-    memcpy(algid_buf + oid_len, ber_NULL, ber_NULLLen);
+    /* t0, s2, s1, tr, seed, rho */
+    for (i = num_bitstrs; i > 0; i--)
+        der_put_BIT_STRING(&w, bitstrs[i - 1]->pValue,
+                           bitstrs[i - 1]->ulValueLen);
 
-    rc = ber_encode_SEQUENCE(FALSE, &algid, &algid_len, algid_buf,
-                             oid_len + ber_NULLLen);
-    free(algid_buf);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("%s ber_encode_SEQUENCE failed with rc=0x%lx\n", __func__, rc);
-        goto error;
-    }
+    der_put_INTEGER(&w, version, sizeof(version));
+    der_put_header(&w, 0x30, offset);
 
-    rc = ber_encode_PrivateKeyInfo(FALSE,
-                                   data, data_len,
-                                   algid, algid_len,
-                                   buf2, len);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("ber_encode_PrivateKeyInfo failed\n");
-    }
+    der_put_PrivateKeyInfo_algid(&w, oid, oid_len, key_len);
 
-error:
-    if (buf3)
-        free(buf3);
-    if (buf2)
-        free(buf2);
-    if (buf)
-        free(buf);
-    if (algid)
-        free(algid);
+    *data = w.buf;
+    *data_len = total;
 
-    return rc;
+    return CKR_OK;
 }
 
 /**
@@ -4417,120 +4077,35 @@ CK_RV ber_encode_IBM_KyberPublicKey(CK_BBOOL length_only,
                                     const CK_BYTE *oid, CK_ULONG oid_len,
                                     CK_ATTRIBUTE *pk)
 {
-    CK_BYTE *buf = NULL, *buf2 = NULL, *buf3 = NULL, *buf4 = NULL;
-    CK_BYTE *buf5 = NULL, *algid = NULL;
-    CK_ULONG len, len4, offset, total, total_len, algid_len;
+    CK_ULONG offset, seq_len, bitstr_len, algid_len, total;
+    struct der_writer w;
     CK_RV rc;
 
     UNUSED(length_only);
 
-    offset = 0;
-    rc = 0;
-    total_len = 0;
-    total = 0;
-
-    /* Calculate storage for AlgID sequence */
-    rc |= ber_encode_SEQUENCE(TRUE, NULL, &total_len, NULL,
-                              oid_len + ber_NULLLen);
-
     /* Calculate storage for inner sequence */
-    rc |= ber_encode_INTEGER(TRUE, NULL, &len, NULL, pk->ulValueLen);
-    offset += len;
-
-    if (rc != CKR_OK) {
-        TRACE_ERROR("%s ber_encode_Int failed with rc=0x%lx\n", __func__, rc);
+    rc = der_element_len(pk->ulValueLen + 1, &offset);
+    /* Calculate storage for bit string, AlgID and outer sequence */
+    if (rc == CKR_OK)
+        rc = der_element_len(offset, &seq_len);
+    if (rc == CKR_OK)
+        rc = der_element_len(seq_len + 1, &bitstr_len);
+    if (rc == CKR_OK)
+        rc = der_algid_len(oid_len, &algid_len);
+    if (rc == CKR_OK)
+        rc = der_element_len(algid_len + bitstr_len, &total);
+    if (rc != CKR_OK) {
+        TRACE_ERROR("%s der length calculation failed with rc=0x%lx\n",
+                    __func__, rc);
         return rc;
     }
 
-    /* Allocate storage for inner sequence */
-    buf = (CK_BYTE *) malloc(offset);
-    if (!buf) {
+    w.buf = (CK_BYTE *) malloc(total);
+    if (!w.buf) {
         TRACE_ERROR("%s Memory allocation failed\n", __func__);
         return CKR_HOST_MEMORY;
     }
-
-    /**
-     *    SEQUENCE (1 elem)
-     *       BIT STRING -> pk
-     */
-    offset = 0;
-    rc = ber_encode_BIT_STRING(FALSE, &buf2, &len,
-                               pk->pValue, pk->ulValueLen, 0);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("%s ber_encode_Int failed with rc=0x%lx\n", __func__, rc);
-        goto error;
-    }
-    memcpy(buf + offset, buf2, len);
-    offset += len;
-    free(buf2);
-    buf2 = NULL;
-
-    rc = ber_encode_SEQUENCE(FALSE, &buf2, &len, buf, offset);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("%s ber_encode_Seq failed with rc=0x%lx\n", __func__, rc);
-        goto error;
-    }
-    free(buf);
-    buf = NULL;
-
-    /* Calculate length of outer sequence */
-    rc = ber_encode_BIT_STRING(TRUE, NULL, &total, buf2, len, 0);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("%s ber_encode_Oct_Str failed with rc=0x%lx\n", __func__, rc);
-        goto error;
-    } else {
-        total_len += total;
-    }
-
-    /* Allocate storage for outer sequence and bit string */
-    buf3 = (CK_BYTE *) malloc(total_len);
-    if (!buf3) {
-        TRACE_ERROR("%s Memory allocation failed\n", __func__);
-        rc = CKR_HOST_MEMORY;
-        goto error;
-    }
-
-    /*
-     * SEQUENCE (2 elem)
-     *      OBJECT IDENTIFIER 1.3.6.1.4.1.2.267.5.xxx
-     *      NULL  <- no parms for this oid
-     */
-    buf5 = (CK_BYTE *) malloc(oid_len + ber_NULLLen);
-    if (!buf5) {
-        TRACE_ERROR("%s Memory allocation failed\n", __func__);
-        rc = CKR_HOST_MEMORY;
-        goto error;
-    }
-    memcpy(buf5, oid, oid_len);
-    memcpy(buf5 + oid_len, ber_NULL, ber_NULLLen);
-
-    rc = ber_encode_SEQUENCE(FALSE, &algid, &algid_len, buf5,
-                             oid_len + ber_NULLLen);
-    free(buf5);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("%s ber_encode_SEQUENCE failed with rc=0x%lx\n", __func__, rc);
-        goto error;
-    }
-
-    total_len = algid_len;
-    memcpy(buf3, algid, algid_len);
-    free(algid);
-    algid = NULL;
-
-    /*
-     * BIT STRING (1 elem)
-     *       SEQUENCE (1 elem)
-     *          BIT STRING  -> pk
-     */
-    rc = ber_encode_BIT_STRING(FALSE, &buf4, &len4, buf2, len, 0);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("%s ber_encode_BIT_STRING failed with rc=0x%lx\n", __func__, rc);
-        goto error;
-    }
-    memcpy(buf3 + total_len, buf4, len4);
-    total_len += len4;
-    free(buf4);
-    buf4 = NULL;
+    w.pos = total;
 
     /**
      * SEQUENCE (2 elem)
@@ -4538,23 +4113,20 @@ CK_RV ber_encode_IBM_KyberPublicKey(CK_BBOOL length_only,
      *       OBJECT IDENTIFIER 1.3.6.1.4.1.2.267.5.xxx
      *       NULL -> no parms for this oid
      *    BIT STRING (1 elem)
-     *       SEQUENCE (2 elem)
+     *       SEQUENCE (1 elem)
      *          BIT STRING  -> pk
      */
-    rc = ber_encode_SEQUENCE(FALSE, data, data_len, buf3, total_len);
-    if (rc != CKR_OK)
-        TRACE_ERROR("%s ber_encode_Seq failed with rc=0x%lx\n", __func__, rc);
-
-error:
+    der_put_BIT_STRING(&w, pk->pValue, pk->ulValueLen);
+    der_put_header(&w, 0x30, offset);
+    w.buf[--w.pos] = 0x00;      // unused bits
+    der_put_header(&w, 0x03, seq_len + 1);
+    der_put_algid(&w, oid, oid_len);
+    der_put_header(&w, 0x30, algid_len + bitstr_len);
 
-    if (buf)
-        free(buf);
-    if (buf2)
-        free(buf2);
-    if (buf3)
-        free(buf3);
+    *data = w.buf;
+    *data_len = total;
 
-    return rc;
+    return CKR_OK;
 }
 
 CK_RV ber_decode_IBM_KyberPublicKey(CK_BYTE *data,
@@ -4664,154 +4236,68 @@ CK_RV ber_encode_IBM_KyberPrivateKey(CK_BBOOL length_only,
                                      CK_ATTRIBUTE *sk,
                                      CK_ATTRIBUTE *pk)
 {
-    CK_BYTE *buf = NULL, *buf2 = NULL, *buf3 = NULL;
-    CK_BYTE *algid = NULL, *algid_buf = NULL, *pk_rs = NULL;
-    CK_ULONG len, len2 = 0, offset, algid_len = 0;
     CK_BYTE version[] = { 0 };
+    struct der_writer w;
+    CK_ULONG len, pk_len = 0, offset, key_len, algid_len, total;
     CK_RV rc;
 
     /* Calculate storage for sequence */
-    offset = 0;
-    rc = 0;
-
-    rc |= ber_encode_SEQUENCE(TRUE, NULL, &algid_len, NULL,
-                              oid_len + ber_NULLLen);
-
-    rc |= ber_encode_INTEGER(TRUE, NULL, &len, NULL, sizeof(version));
-    offset += len;
-    rc |= ber_encode_BIT_STRING(TRUE, NULL, &len, NULL, sk->ulValueLen, 0);
-    offset += len;
-    if (pk) {
-        rc |= ber_encode_BIT_STRING(TRUE, NULL, &len2, NULL,
-                                    pk->ulValueLen + 64, 0);
-        rc |= ber_encode_CHOICE(TRUE, 0, NULL, &len, NULL, len2);
+    rc = der_integer_len(version, sizeof(version), &offset);
+    if (rc == CKR_OK) {
+        rc = der_element_len(sk->ulValueLen + 1, &len);
         offset += len;
     }
-
+    if (rc == CKR_OK && pk && pk->pValue) {
+        rc = der_element_len(pk->ulValueLen + 64 + 1, &pk_len);
+        if (rc == CKR_OK)
+            rc = der_element_len(pk_len, &len);
+        offset += len;
+    }
+    if (rc == CKR_OK)
+        rc = der_element_len(offset, &key_len);
+    if (rc == CKR_OK)
+        rc = der_algid_len(oid_len, &algid_len);
+    if (rc == CKR_OK)
+        rc = der_PrivateKeyInfo_len(algid_len, key_len, &total);
     if (rc != CKR_OK) {
         TRACE_DEVEL("Calculate storage for sequence failed\n");
         return CKR_FUNCTION_FAILED;
     }
 
     if (length_only == TRUE) {
-        rc = ber_encode_SEQUENCE(TRUE, NULL, &len, NULL, offset);
-        if (rc != CKR_OK) {
-            TRACE_DEVEL("ber_encode_SEQUENCE failed\n");
-            return rc;
-        }
-        rc = ber_encode_PrivateKeyInfo(TRUE,
-                                       NULL, data_len,
-                                       NULL, algid_len,
-                                       NULL, len);
-        if (rc != CKR_OK) {
-            TRACE_DEVEL("ber_encode_PrivateKeyInfo failed\n");
-            return rc;
-        }
-        return rc;
+        *data_len = total;
+        return CKR_OK;
     }
 
-    /* Allocate storage for sequence */
-    buf = (CK_BYTE *) malloc(offset);
-    if (!buf) {
+    w.buf = (CK_BYTE *) malloc(total);
+    if (!w.buf) {
         TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
         return CKR_HOST_MEMORY;
     }
-    offset = 0;
-
-    /* Version */
-    rc = ber_encode_INTEGER(FALSE, &buf2, &len, version, sizeof(version));
-    if (rc != CKR_OK) {
-        TRACE_ERROR("ber_encode_INTEGER of version failed\n");
-        goto error;
-    }
-    memcpy(buf + offset, buf2, len);
-    offset += len;
-    free(buf2);
-    buf2 = NULL;
-
-    /* sk */
-    rc = ber_encode_BIT_STRING(FALSE, &buf2, &len,
-                            sk->pValue, sk->ulValueLen, 0);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("ber_encode_BIT_STRING of sk failed\n");
-        goto error;
-    }
-    memcpy(buf + offset, buf2, len);
-    offset += len;
-    free(buf2);
-    buf2 = NULL;
+    w.pos = total;
 
-    /* (pk) Optional bit-string of public key */
+    /* (pk) Optional bit-string of public key with rs appended */
     if (pk && pk->pValue) {
-        /* append rs to public key */
-        pk_rs = (CK_BYTE *)malloc(pk->ulValueLen + 64);
-        if (!pk_rs) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            rc = CKR_HOST_MEMORY;
-            goto error;
-        }
-
-        memcpy(pk_rs, pk->pValue, pk->ulValueLen);
-        memset(pk_rs + pk->ulValueLen, 0x30, 64);
-
-        rc = ber_encode_BIT_STRING(FALSE, &buf3, &len2,
-                                   pk_rs, pk->ulValueLen + 64, 0);
-        rc |= ber_encode_CHOICE(FALSE, 0, &buf2, &len, buf3, len2);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("encoding of pk value failed\n");
-            goto error;
-        }
-        memcpy(buf + offset, buf2, len);
-        offset += len;
-        free(buf2);
-        buf2 = NULL;
-    }
-
-    /* Encode sequence */
-    rc = ber_encode_SEQUENCE(FALSE, &buf2, &len, buf, offset);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("ber_encode_SEQUENCE failed\n");
-        goto error;
+        w.pos -= 64;
+        memset(w.buf + w.pos, 0x30, 64);
+        der_put_bytes(&w, pk->pValue, pk->ulValueLen);
+        w.buf[--w.pos] = 0x00;  // unused bits
+        der_put_header(&w, 0x03, pk->ulValueLen + 64 + 1);
+        der_put_header(&w, 0xA0, pk_len);
     }
 
-    algid_buf = (CK_BYTE *) malloc(oid_len + ber_NULLLen);
-    if (!algid_buf) {
-        TRACE_ERROR("%s Memory allocation failed\n", __func__);
-        rc = CKR_HOST_MEMORY;
-        goto error;
-    }
-    memcpy(algid_buf, oid, oid_len);
-    memcpy(algid_buf + oid_len, ber_NULL, ber_NULLLen);
+    /* sk */
+    der_put_BIT_STRING(&w, sk->pValue, sk->ulValueLen);
 
-    rc = ber_encode_SEQUENCE(FALSE, &algid, &algid_len, algid_buf,
-                             oid_len + ber_NULLLen);
-    free(algid_buf);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("%s ber_encode_SEQUENCE failed with rc=0x%lx\n", __func__, rc);
-        goto error;
-    }
+    der_put_INTEGER(&w, version, sizeof(version));
+    der_put_header(&w, 0x30, offset);
 
-    rc = ber_encode_PrivateKeyInfo(FALSE,
-                                   data, data_len,
-                                   algid, algid_len,
-                                   buf2, len);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("ber_encode_PrivateKeyInfo failed\n");
-    }
+    der_put_PrivateKeyInfo_algid(&w, oid, oid_len, key_len);
 
-error:
-    if (buf3)
-        free(buf3);
-    if (buf2)
-        free(buf2);
-    if (buf)
-        free(buf);
-    if (algid)
-        free(algid);
-    if (pk_rs)
-        free(pk_rs);
+    *data = w.buf;
+    *data_len = total;
 
-    return rc;
+    return CKR_OK;
 }
 
 /**
@@ -28,23 +28,28 @@
 #define GET_NODE_HANDLE(n) get_node_handle(n, 1)
 #define TREE_DUMP(t)  tree_dump((t)->top, 0)
 
+static inline struct bt_stripe *bt_stripe(struct btree *t,
+                                          unsigned long node_num)
+{
+    return &t->stripes[node_num % BT_LOCK_STRIPES];
+}
+
 /*
- * __bt_get_node() - Low level function, needs proper locking before invocation.
+ * __bt_get_node() - Low level function, returns the node regardless of its
+ * free flag. The tree itself can be traversed without a lock, since nodes are
+ * only linked into the tree before the size is increased, and are never
+ * removed. The node's stripe lock is needed to access the node's value and
+ * flags.
  */
 static struct btnode *__bt_get_node(struct btree *t, unsigned long node_num)
 {
     struct btnode *temp;
     unsigned long i;
 
-    temp = t->top;
-
-    if (!node_num || node_num > t->size)
+    if (!node_num || node_num > __atomic_load_n(&t->size, __ATOMIC_ACQUIRE))
         return NULL;
 
-    if (node_num == 1) {
-        temp = t->top;
-        return (temp->flags & BT_FLAG_FREE) ? NULL : temp;
-    }
+    temp = t->top;
 
     i = node_num;
     while (i != 1) {
@@ -58,7 +63,7 @@ static struct btnode *__bt_get_node(struct btree *t, unsigned long node_num)
         i >>= 1;
     }
 
-    return (temp->flags & BT_FLAG_FREE) ? NULL : temp;
+    return temp;
 }
 
 /*
@@ -69,16 +74,19 @@ static struct btnode *__bt_get_node(struct btree *t, unsigned long node_num)
  */
 struct btnode *bt_get_node(struct btree *t, unsigned long node_num)
 {
+    struct bt_stripe *stripe = bt_stripe(t, node_num);
     struct btnode *temp;
 
-    if (pthread_mutex_lock(&t->mutex)) {
+    if (pthread_mutex_lock(&stripe->mutex)) {
         TRACE_ERROR("BTree Lock failed.\n");
         return NULL;
     }
 
     temp = __bt_get_node(t, node_num);
+    if (temp != NULL && (temp->flags & BT_FLAG_FREE))
+        temp = NULL;
 
-    pthread_mutex_unlock(&t->mutex);
+    pthread_mutex_unlock(&stripe->mutex);
 
     return temp;
 }
@@ -91,15 +99,16 @@ struct btnode *bt_get_node(struct btree *t, unsigned long node_num)
  */
 void *bt_get_node_value(struct btree *t, unsigned long node_num)
 {
+    struct bt_stripe *stripe = bt_stripe(t, node_num);
     struct btnode *n;
-    void *v;
+    void *v = NULL;
     unsigned long ref;
 
 #ifndef DEBUG
     UNUSED(ref);
 #endif
 
-    if (pthread_mutex_lock(&t->mutex)) {
+    if (pthread_mutex_lock(&stripe->mutex)) {
         TRACE_ERROR("BTree Lock failed.\n");
         return NULL;
     }
@@ -111,7 +120,8 @@ void *bt_get_node_value(struct btree *t, unsigned long node_num)
      * points to another node in the free list.
      */
     n = __bt_get_node(t, node_num);
-    v = ((n) ? n->value : NULL);
+    if (n != NULL && !(n->flags & BT_FLAG_FREE))
+        v = n->value;
 
     if (v != NULL) {
         ref = __sync_add_and_fetch(&((struct bt_ref_hdr *)v)->ref, 1);
@@ -120,7 +130,7 @@ void *bt_get_node_value(struct btree *t, unsigned long node_num)
                     (void *)t, v, ref);
     }
 
-    pthread_mutex_unlock(&t->mutex);
+    pthread_mutex_unlock(&stripe->mutex);
     return v;
 }
 
@@ -171,8 +181,9 @@ static struct btnode *node_create(struct btnode **child_ptr,
     node->left = node->right = NULL;
     node->flags = 0;
     node->value = value;
-    *child_ptr = node;
     node->parent = parent_ptr;
+    /* Lock-less readers must see the initialized node */
+    __atomic_store_n(child_ptr, node, __ATOMIC_RELEASE);
 
     return node;
 }
@@ -201,42 +212,62 @@ static unsigned long get_node_handle(struct btnode *node,
  */
 unsigned long bt_node_add(struct btree *t, void *value)
 {
+    struct bt_stripe *stripe;
     struct btnode *temp;
-    unsigned long new_node_index;
-
-    if (pthread_mutex_lock(&t->mutex)) {
-        TRACE_ERROR("BTree Lock failed.\n");
-        return 0;
-    }
+    unsigned long new_node_index, i, start;
 
     ((struct bt_ref_hdr *)value)->ref = 1;
 
     TRACE_DEBUG("bt_node_add: Btree: %p Value: %p Ref: %lu\n", (void *)t, value,
                 ((struct bt_ref_hdr *)value)->ref);
 
+    /*
+     * If there are nodes on the free lists, use one of them instead of
+     * mallocing new. Start at a different stripe each time to spread the
+     * concurrent adds over the stripes.
+     */
+    if (__atomic_load_n(&t->free_nodes, __ATOMIC_RELAXED) > 0) {
+        start = __atomic_fetch_add(&t->next_stripe, 1, __ATOMIC_RELAXED);
+
+        for (i = 0; i < BT_LOCK_STRIPES; i++) {
+            stripe = &t->stripes[(start + i) % BT_LOCK_STRIPES];
+
+            if (pthread_mutex_lock(&stripe->mutex)) {
+                TRACE_ERROR("BTree Lock failed.\n");
+                return 0;
+            }
+
+            temp = stripe->free_list;
+            if (temp != NULL) {
+                stripe->free_list = temp->value;
+                temp->value = value;
+                temp->flags &= (~BT_FLAG_FREE);
+                __atomic_sub_fetch(&t->free_nodes, 1, __ATOMIC_RELAXED);
+                pthread_mutex_unlock(&stripe->mutex);
+
+                return GET_NODE_HANDLE(temp);
+            }
+
+            pthread_mutex_unlock(&stripe->mutex);
+        }
+    }
+
+    if (pthread_mutex_lock(&t->mutex)) {
+        TRACE_ERROR("BTree Lock failed.\n");
+        return 0;
+    }
+
     temp = t->top;
 
     if (!temp) {                /* no root node yet exists, create it */
-        t->size = 1;
         if (!node_create(&t->top, NULL, value)) {
             pthread_mutex_unlock(&t->mutex);
             return 0;
         }
 
+        __atomic_store_n(&t->size, 1, __ATOMIC_RELEASE);
         pthread_mutex_unlock(&t->mutex);
         return 1;
-    } else if (t->free_list) {
-        /* there's a node on the free list,
-         * use it instead of mallocing new
-         */
-        temp = t->free_list;
-        t->free_list = temp->value;
-        temp->value = value;
-        temp->flags &= (~BT_FLAG_FREE);
-        t->free_nodes--;
-        new_node_index = GET_NODE_HANDLE(temp);
-        pthread_mutex_unlock(&t->mutex);
-        return new_node_index;
     }
 
     new_node_index = t->size + 1;
@@ -269,8 +300,9 @@ unsigned long bt_node_add(struct btree *t, void *value)
         new_node_index >>= 1;
     }
 
-    t->size++;
-    new_node_index = t->size;
+    /* Publish the new node to lock-less readers */
+    new_node_index = t->size + 1;
+    __atomic_store_n(&t->size, new_node_index, __ATOMIC_RELEASE);
 
     pthread_mutex_unlock(&t->mutex);
     return new_node_index;
@@ -312,17 +344,18 @@ void tree_dump(struct btnode *n, int depth)
 void *bt_node_free(struct btree *t, unsigned long node_num,
                    int put_value)
 {
+    struct bt_stripe *stripe = bt_stripe(t, node_num);
     struct btnode *node;
     void *value = NULL;
 
-    if (pthread_mutex_lock(&t->mutex)) {
+    if (pthread_mutex_lock(&stripe->mutex)) {
         TRACE_ERROR("BTree Lock failed.\n");
         return NULL;
     }
 
     node = __bt_get_node(t, node_num);
 
-    if (node) {
+    if (node && !(node->flags & BT_FLAG_FREE)) {
         /*
          * Need to get the node value within the locked block,
          * otherwise the node might be deleted concurrently before the
@@ -332,19 +365,19 @@ void *bt_node_free(struct btree *t, unsigned long node_num,
 
         node->flags |= BT_FLAG_FREE;
 
-        /* add node to the free list,
+        /* add node to the stripe's free list,
          * which is chained by using
          * the value pointer
          */
-        node->value = t->free_list;
-        t->free_list = node;
-        t->free_nodes++;
+        node->value = stripe->free_list;
+        stripe->free_list = node;
+        __atomic_add_fetch(&t->free_nodes, 1, __ATOMIC_RELAXED);
 
         TRACE_DEBUG("bt_node_free: Btree: %p Value: %p Ref: %lu\n", (void *)t,
                     value, ((struct bt_ref_hdr *)value)->ref);
     }
 
-    pthread_mutex_unlock(&t->mutex);
+    pthread_mutex_unlock(&stripe->mutex);
 
     if (value && put_value)
         bt_put_node_value(t, value);
@@ -358,16 +391,8 @@ void *bt_node_free(struct btree *t, unsigned long node_num,
  */
 int bt_is_empty(struct btree *t)
 {
-    CK_RV rc;
-
-    if (pthread_mutex_lock(&t->mutex))
-        return 0;
-
-    rc = (t->free_nodes == t->size);
-
-    pthread_mutex_unlock(&t->mutex);
-
-    return rc;
+    return __atomic_load_n(&t->free_nodes, __ATOMIC_ACQUIRE) ==
+           __atomic_load_n(&t->size, __ATOMIC_ACQUIRE);
 }
 
 /* bt_nodes_in_use
@@ -376,18 +401,8 @@ int bt_is_empty(struct btree *t)
  */
 unsigned long bt_nodes_in_use(struct btree *t)
 {
-    CK_RV rc;
-
-    if (pthread_mutex_lock(&t->mutex)) {
-        TRACE_ERROR("BTree Lock failed.\n");
-        return -1;
-    }
-
-    rc = (t->size - t->free_nodes);
-
-    pthread_mutex_unlock(&t->mutex);
-
-    return rc;
+    return __atomic_load_n(&t->size, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&t->free_nodes, __ATOMIC_ACQUIRE);
 }
 
 /* bt_for_each_node
@@ -406,7 +421,7 @@ void bt_for_each_node(STDLL_TokData_t *tokdata, struct btree *t, void (*func)
     unsigned int i;
     void *value;
 
-    for (i = 1; i < t->size + 1; i++) {
+    for (i = 1; i < __atomic_load_n(&t->size, __ATOMIC_ACQUIRE) + 1; i++) {
         /*
          * Get the node value, not the node itself. This ensures that we either
          * get the value from a valid node, or NULL in case of a deleted node.
@@ -475,12 +490,15 @@ void bt_destroy(struct btree *t)
 
     /* the tree is gone now, clear all the other variables */
     t->top = NULL;
-    t->free_list = NULL;
+    for (i = 0; i < BT_LOCK_STRIPES; i++)
+        t->stripes[i].free_list = NULL;
     t->free_nodes = 0;
     t->delete_func = NULL;
 
     pthread_mutex_unlock(&t->mutex);
     pthread_mutex_destroy(&t->mutex);
+    for (i = 0; i < BT_LOCK_STRIPES; i++)
+        pthread_mutex_destroy(&t->stripes[i].mutex);
 }
 
 /* bt_init
@@ -491,11 +509,12 @@ void bt_destroy(struct btree *t)
 CK_RV bt_init(struct btree *t, void (*delete_func)(void *))
 {
     pthread_mutexattr_t attr;
+    unsigned long i;
 
-    t->free_list = NULL;
     t->top = NULL;
     t->size = 0;
     t->free_nodes = 0;
+    t->next_stripe = 0;
     t->delete_func = delete_func;
 
     /*
@@ -515,5 +534,13 @@ CK_RV bt_init(struct btree *t, void (*delete_func)(void *))
         return CKR_CANT_LOCK;
     }
 
+    for (i = 0; i < BT_LOCK_STRIPES; i++) {
+        t->stripes[i].free_list = NULL;
+        if (pthread_mutex_init(&t->stripes[i].mutex, NULL) != 0) {
+            TRACE_ERROR("pthread_mutex_init failed.\n");
+            return CKR_CANT_LOCK;
+        }
+    }
+
     return CKR_OK;
 }
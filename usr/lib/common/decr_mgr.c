@@ -67,7 +67,7 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         }
         // is key allowed to do general decryption?
         //
-        rc = template_attribute_get_bool(key_obj->template, CKA_DECRYPT, &flag);
+        rc = template_key_desc_get_bool(key_obj->template, CKA_DECRYPT, &flag);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_ENCRYPT for the key.\n");
             rc = CKR_KEY_FUNCTION_NOT_PERMITTED;
@@ -90,7 +90,7 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         }
         // is key allowed to unwrap other keys?
         //
-        rc = template_attribute_get_bool(key_obj->template, CKA_UNWRAP, &flag);
+        rc = template_key_desc_get_bool(key_obj->template, CKA_UNWRAP, &flag);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_UNWRAP for the key.\n");
             rc = CKR_KEY_FUNCTION_NOT_PERMITTED;
@@ -139,8 +139,8 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         }
         // is the key type correct?
         //
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -160,7 +160,7 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         //       goto done;
 
         ctx->context_len = sizeof(DES_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(DES_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(DES_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -178,8 +178,8 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         }
         // is the key type correct?
         //
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -199,7 +199,7 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         //       goto done;
 
         ctx->context_len = sizeof(DES_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(DES_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(DES_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -217,8 +217,8 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
             goto done;
         }
 
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -231,7 +231,7 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         }
 
         ctx->context_len = sizeof(DES_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(DES_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(DES_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -247,8 +247,8 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         }
         // is the key type correct?
         //
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -268,7 +268,7 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         //       goto done;
 
         ctx->context_len = sizeof(DES_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(DES_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(DES_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -286,8 +286,8 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         }
         // is the key type correct?
         //
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -307,7 +307,7 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         //       goto done;
 
         ctx->context_len = sizeof(DES_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(DES_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(DES_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -323,8 +323,8 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
             goto done;
         }
 
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -348,8 +348,8 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
             goto done;
         }
 
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -375,8 +375,8 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         }
         // is the key type correct?
         //
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -389,7 +389,7 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         }
 
         ctx->context_len = sizeof(AES_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(AES_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(AES_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -408,8 +408,8 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         }
         // is the key type correct?
         //
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -422,7 +422,7 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         }
 
         ctx->context_len = sizeof(AES_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(AES_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(AES_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -438,8 +438,8 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
             goto done;
         }
         // is the key type correct?
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -452,7 +452,7 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         }
 
         ctx->context_len = sizeof(AES_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(AES_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(AES_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -478,8 +478,8 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
             mech = &temp_mech;
         }
 
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -492,7 +492,7 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         }
 
         ctx->context_len = sizeof(AES_GCM_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(AES_GCM_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(AES_GCM_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -524,8 +524,8 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
             goto done;
         }
 
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -538,7 +538,7 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         }
 
         ctx->context_len = sizeof(AES_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(AES_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(AES_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -554,8 +554,8 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
             goto done;
         }
 
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -568,7 +568,7 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
         }
 
         ctx->context_len = sizeof(AES_XTS_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(AES_XTS_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(AES_XTS_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -620,8 +620,10 @@ CK_RV decr_mgr_init(STDLL_TokData_t *tokdata,
     rc = CKR_OK;
 
 done:
-    if (ctx->count_statistics == TRUE && rc == CKR_OK)
-         INC_COUNTER(tokdata, sess, mech, key_obj, strength);
+    if (ctx->count_statistics == TRUE && rc == CKR_OK) {
+        INC_COUNTER(tokdata, sess, mech, key_obj, strength);
+        STAT_OP_START(tokdata, ctx, mech, key_obj, strength);
+    }
 
     object_put(tokdata, key_obj, TRUE);
     key_obj = NULL;
@@ -670,11 +672,13 @@ CK_RV decr_mgr_cleanup(STDLL_TokData_t *tokdata, SESSION *sess,
             ctx->context_free_func(tokdata, sess, ctx->context,
                                    ctx->context_len);
         else
-            free(ctx->context);
+            session_mgr_op_free(sess, ctx->context, 0);
         ctx->context = NULL;
     }
     ctx->context_free_func = NULL;
 
+    session_mgr_op_reset(sess, ctx);
+
     return CKR_OK;
 }
 
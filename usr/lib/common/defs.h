@@ -167,7 +167,13 @@ struct oc_sha_ctx {
 
 #define DEFAULT_SO_PIN  "87654321"
 
-#define MAX_TOK_OBJS 2048
+/*
+ * Token object entries in shared memory are allocated in segments of
+ * TOK_OBJ_SEG_SIZE entries (must be a power of 2), up to TOK_OBJ_MAX_SEGS
+ * segments per token.
+ */
+#define TOK_OBJ_SEG_SIZE    4096
+#define TOK_OBJ_MAX_SEGS    1024
 
 
 typedef enum {
@@ -199,6 +205,7 @@ typedef struct _DL_NODE {
 #define PK_LITE_NV   "NVTOK.DAT"
 #define PK_LITE_OBJ_DIR "TOK_OBJ"
 #define PK_LITE_OBJ_IDX "OBJ.IDX"
+#define PK_LITE_OBJ_LOG "OBJ.LOG"
 
 #define DEL_CMD "/bin/rm -f"
 
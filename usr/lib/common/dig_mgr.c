@@ -129,8 +129,10 @@ CK_RV digest_mgr_init(STDLL_TokData_t *tokdata,
     ctx->multi = FALSE;
     ctx->active = TRUE;
 
-    if (ctx->count_statistics == TRUE)
+    if (ctx->count_statistics == TRUE) {
         INC_COUNTER(tokdata, sess, mech, NULL, POLICY_STRENGTH_IDX_0);
+        STAT_OP_START(tokdata, ctx, mech, NULL, POLICY_STRENGTH_IDX_0);
+    }
 
     return CKR_OK;
 }
@@ -250,6 +252,9 @@ CK_RV digest_mgr_digest(STDLL_TokData_t *tokdata,
     }
 
 out:
+    if (rc == CKR_OK && length_only == FALSE)
+        STAT_OP_DONE(tokdata, sess, ctx, in_data_len);
+
     if (!((rc == CKR_BUFFER_TOO_SMALL) ||
           (rc == CKR_OK && length_only == TRUE))) {
         // "A call to C_Digest always terminates the active digest operation
@@ -324,6 +329,9 @@ CK_RV digest_mgr_digest_update(STDLL_TokData_t *tokdata,
     }
 
 out:
+    if (rc == CKR_OK)
+        ctx->stat.bytes += data_len;
+
     if (rc != CKR_OK) {
         digest_mgr_cleanup(tokdata, sess, ctx);
         // "A call to C_DigestUpdate which results in an error
@@ -469,6 +477,9 @@ CK_RV digest_mgr_digest_final(STDLL_TokData_t *tokdata,
     }
 
 out:
+    if (rc == CKR_OK && length_only == FALSE)
+        STAT_OP_DONE(tokdata, sess, ctx, 0);
+
     if (!((rc == CKR_BUFFER_TOO_SMALL) ||
           (rc == CKR_OK && length_only == TRUE))) {
         // "A call to C_DigestFinal always terminates the active digest
@@ -69,7 +69,7 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         }
         // is key allowed to do general encryption?
         //
-        rc = template_attribute_get_bool(key_obj->template, CKA_ENCRYPT, &flag);
+        rc = template_key_desc_get_bool(key_obj->template, CKA_ENCRYPT, &flag);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_ENCRYPT for the key.\n");
             rc = CKR_KEY_FUNCTION_NOT_PERMITTED;
@@ -93,7 +93,7 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         }
         // is key allowed to wrap other keys?
         //
-        rc = template_attribute_get_bool(key_obj->template, CKA_WRAP, &flag);
+        rc = template_key_desc_get_bool(key_obj->template, CKA_WRAP, &flag);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_WRAP for the key.\n");
             rc = CKR_KEY_FUNCTION_NOT_PERMITTED;
@@ -141,8 +141,8 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         }
         // is the key type correct?
         //
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -162,7 +162,7 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         //       goto done;
 
         ctx->context_len = sizeof(DES_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(DES_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(DES_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -180,8 +180,8 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         }
         // is the key type correct?
         //
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -201,7 +201,7 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         //       goto done;
 
         ctx->context_len = sizeof(DES_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(DES_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(DES_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -219,8 +219,8 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
             goto done;
         }
 
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -233,7 +233,7 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         }
 
         ctx->context_len = sizeof(DES_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(DES_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(DES_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -249,8 +249,8 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         }
         // is the key type correct?
         //
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -270,7 +270,7 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         //       goto done;
 
         ctx->context_len = sizeof(DES_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(DES_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(DES_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -288,8 +288,8 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         }
         // is the key type correct?
         //
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -309,7 +309,7 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         //       goto done;
 
         ctx->context_len = sizeof(DES_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(DES_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(DES_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -325,8 +325,8 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
             goto done;
         }
 
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -350,8 +350,8 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
             goto done;
         }
 
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -377,8 +377,8 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         }
         // is the key type correct?
         //
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -391,7 +391,7 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         }
 
         ctx->context_len = sizeof(AES_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(AES_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(AES_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -410,8 +410,8 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         }
         // is the key type correct?
         //
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -424,7 +424,7 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         }
 
         ctx->context_len = sizeof(AES_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(AES_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(AES_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -440,8 +440,8 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
             goto done;
         }
         // is the key type correct
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -454,7 +454,7 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         }
 
         ctx->context_len = sizeof(AES_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(AES_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(AES_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -480,8 +480,8 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
             mech = &temp_mech;
         }
 
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -494,7 +494,7 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         }
 
         ctx->context_len = sizeof(AES_GCM_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(AES_GCM_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(AES_GCM_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -526,8 +526,8 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
             goto done;
         }
 
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -540,7 +540,7 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         }
 
         ctx->context_len = sizeof(AES_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(AES_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(AES_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -556,8 +556,8 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
             goto done;
         }
 
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -570,7 +570,7 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
         }
 
         ctx->context_len = sizeof(AES_XTS_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(AES_XTS_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(AES_XTS_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -622,8 +622,10 @@ CK_RV encr_mgr_init(STDLL_TokData_t *tokdata,
     rc = CKR_OK;
 
 done:
-    if (ctx->count_statistics == TRUE && rc == CKR_OK)
+    if (ctx->count_statistics == TRUE && rc == CKR_OK) {
         INC_COUNTER(tokdata, sess, mech, key_obj, strength);
+        STAT_OP_START(tokdata, ctx, mech, key_obj, strength);
+    }
 
     object_put(tokdata, key_obj, TRUE);
     key_obj = NULL;
@@ -672,11 +674,13 @@ CK_RV encr_mgr_cleanup(STDLL_TokData_t *tokdata, SESSION *sess,
             ctx->context_free_func(tokdata, sess, ctx->context,
                                    ctx->context_len);
         else
-            free(ctx->context);
+            session_mgr_op_free(sess, ctx->context, 0);
         ctx->context = NULL;
     }
     ctx->context_free_func = NULL;
 
+    session_mgr_op_reset(sess, ctx);
+
     return CKR_OK;
 }
 
@@ -1163,8 +1167,8 @@ CK_RV encr_mgr_reencrypt_single(STDLL_TokData_t *tokdata, SESSION *sess,
             goto done;
         }
 
-        rc = template_attribute_get_bool(decr_key_obj->template, CKA_DECRYPT,
-                                         &flag);
+        rc = template_key_desc_get_bool(decr_key_obj->template, CKA_DECRYPT,
+                                        &flag);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_DECRYPT for the key.\n");
             rc = CKR_KEY_FUNCTION_NOT_PERMITTED;
@@ -1177,8 +1181,8 @@ CK_RV encr_mgr_reencrypt_single(STDLL_TokData_t *tokdata, SESSION *sess,
             goto done;
         }
 
-        rc = template_attribute_get_bool(encr_key_obj->template, CKA_ENCRYPT,
-                                         &flag);
+        rc = template_key_desc_get_bool(encr_key_obj->template, CKA_ENCRYPT,
+                                        &flag);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_ENCRYPT for the key.\n");
             rc = CKR_KEY_FUNCTION_NOT_PERMITTED;
@@ -412,7 +412,10 @@ CK_RV dp_x9dh_set_default_attributes(TEMPLATE *tmpl, CK_ULONG mode);
 CK_RV dp_x9dh_validate_attribute(TEMPLATE *tmpl,
                                  CK_ATTRIBUTE *attr, CK_ULONG mode);
 
+CK_RV new_token_object_name(STDLL_TokData_t *tokdata, CK_BYTE *name);
 CK_RV save_token_object(STDLL_TokData_t *tokdata, OBJECT *obj);
+CK_RV save_token_objects(STDLL_TokData_t *tokdata, OBJECT **objs,
+                         CK_RV *rcs, CK_ULONG num);
 CK_RV save_private_token_object(STDLL_TokData_t *tokdata, OBJECT *obj);
 CK_RV save_public_token_object(STDLL_TokData_t *tokdata, OBJECT *obj);
 
@@ -1844,6 +1847,7 @@ CK_RV get_keytype(STDLL_TokData_t *tokdata, CK_OBJECT_HANDLE hkey,
 //lock and unlock routines
 CK_RV XProcLock(STDLL_TokData_t *tokdata);
 CK_RV XProcUnLock(STDLL_TokData_t *tokdata);
+CK_BBOOL XProcLockHeld(STDLL_TokData_t *tokdata);
 CK_RV XThreadLock(STDLL_TokData_t *tokdata);
 CK_RV XThreadUnLock(STDLL_TokData_t *tokdata);
 CK_RV CreateXProcLock(char *tokname, STDLL_TokData_t *tokdata);
@@ -2131,6 +2135,9 @@ CK_RV session_mgr_set_op_state(STDLL_TokData_t *tokdata, SESSION *sess,
                                CK_ULONG data_len);
 CK_RV session_mgr_cancel(STDLL_TokData_t *tokdata, SESSION *sess,
                          CK_FLAGS flags);
+CK_BYTE *session_mgr_op_alloc(SESSION *sess, void *op_ctx, CK_ULONG len);
+void session_mgr_op_free(SESSION *sess, CK_BYTE *ptr, CK_ULONG len);
+void session_mgr_op_reset(SESSION *sess, void *op_ctx);
 CK_BBOOL pin_expired(CK_SESSION_INFO *, CK_FLAGS);
 CK_BBOOL pin_locked(CK_SESSION_INFO *, CK_FLAGS);
 void set_login_flags(CK_USER_TYPE, CK_FLAGS_32 *);
@@ -2169,19 +2176,23 @@ CK_RV object_mgr_add_to_map(STDLL_TokData_t *tokdata,
                             unsigned long obj_handle,
                             CK_OBJECT_HANDLE *handle);
 
-void object_mgr_add_to_shm(OBJECT *obj, LW_SHM_TYPE *shm);
-CK_RV object_mgr_del_from_shm(OBJECT *obj, LW_SHM_TYPE *shm);
+CK_RV object_mgr_add_to_shm(STDLL_TokData_t *tokdata, OBJECT *obj);
+CK_RV object_mgr_del_from_shm(STDLL_TokData_t *tokdata, OBJECT *obj);
 CK_RV object_mgr_get_shm_entry_for_obj(STDLL_TokData_t *tokdata, OBJECT *obj,
                                        TOK_OBJ_ENTRY **entry);
 CK_RV object_mgr_check_shm(STDLL_TokData_t *tokdata, OBJECT *obj,
                            OBJ_LOCK_TYPE lock_type);
-CK_RV object_mgr_search_shm_for_obj(TOK_OBJ_ENTRY *list,
-                                    CK_ULONG lo,
-                                    CK_ULONG hi,
-                                    OBJECT *obj, CK_ULONG *index);
+void object_mgr_unmap_tok_obj_segs(STDLL_TokData_t *tokdata,
+                                   CK_BBOOL ignore_ref_count);
 CK_RV object_mgr_update_from_shm(STDLL_TokData_t *tokdata);
 CK_RV object_mgr_update_publ_tok_obj_from_shm(STDLL_TokData_t *tokdata);
 CK_RV object_mgr_update_priv_tok_obj_from_shm(STDLL_TokData_t *tokdata);
+CK_BBOOL object_mgr_shm_changed(STDLL_TokData_t *tokdata);
+
+CK_RV tok_obj_name_index_init(struct tok_obj_name_index *idx);
+void tok_obj_name_index_destroy(struct tok_obj_name_index *idx);
+CK_RV obj_attr_index_init(struct obj_attr_index *idx);
+void obj_attr_index_destroy(struct obj_attr_index *idx);
 
 CK_RV object_mgr_copy(STDLL_TokData_t *tokdata,
                       SESSION *sess,
@@ -2233,6 +2244,14 @@ CK_RV object_mgr_get_attribute_values(STDLL_TokData_t *tokdata,
                                       CK_ATTRIBUTE *pTemplate,
                                       CK_ULONG ulCount);
 
+CK_RV object_mgr_find_get_attribute_values(STDLL_TokData_t *tokdata,
+                                           SESSION *sess,
+                                           CK_ATTRIBUTE_TYPE *pTypes,
+                                           CK_ULONG ulTypeCount,
+                                           CK_BYTE *buffer,
+                                           CK_ULONG *buffer_len,
+                                           CK_ULONG *object_count);
+
 CK_RV object_mgr_get_object_size(STDLL_TokData_t *tokdata,
                                  CK_OBJECT_HANDLE handle, CK_ULONG *size);
 
@@ -2251,8 +2270,14 @@ CK_RV object_mgr_restore_obj_withSize(STDLL_TokData_t *tokdata,
                                       int data_size,
                                       const char *fname);
 
+CK_RV object_mgr_add_restored_obj(STDLL_TokData_t *tokdata, OBJECT *obj,
+                                  OBJECT *oldObj);
+
 CK_RV object_mgr_save_token_object(STDLL_TokData_t *tokdata, OBJECT *obj);
 
+CK_RV object_mgr_group_commit_init(STDLL_TokData_t *tokdata);
+void object_mgr_group_commit_final(STDLL_TokData_t *tokdata);
+
 CK_RV object_mgr_set_attribute_values(STDLL_TokData_t *tokdata,
                                       SESSION *sess,
                                       CK_OBJECT_HANDLE handle,
@@ -2299,17 +2324,6 @@ CK_RV obj_mgr_iterate_key_objects(STDLL_TokData_t *tokdata,
 
 /* structures used to hold arguments to callback functions triggered by either
  * bt_for_each_node or bt_node_free */
-struct find_args {
-    int done;
-    OBJECT *obj;
-    CK_OBJECT_HANDLE map_handle;
-};
-
-struct find_by_name_args {
-    int done;
-    char *name;
-};
-
 struct find_build_list_args {
     CK_ATTRIBUTE *pTemplate;
     SESSION *sess;
@@ -2325,8 +2339,7 @@ struct purge_args {
 };
 
 struct update_tok_obj_args {
-    TOK_OBJ_ENTRY *entries;
-    CK_ULONG_32 *num_entries;
+    struct tok_obj_name_index *shm_names;
     struct btree *t;
 };
 
@@ -2347,6 +2360,8 @@ CK_RV object_copy(STDLL_TokData_t *tokdata, SESSION *sess,
                   CK_ULONG ulCount, OBJECT *old_obj, OBJECT **new_obj);
 
 CK_RV object_flatten(OBJECT *obj, CK_BYTE **data, CK_ULONG *len);
+CK_ULONG object_get_flattened_size(OBJECT *obj);
+CK_RV object_flatten_into(OBJECT *obj, CK_BYTE *buf);
 
 void object_free(OBJECT *obj);
 
@@ -2407,6 +2422,12 @@ CK_RV template_attribute_get_bool(TEMPLATE *tmpl, CK_ATTRIBUTE_TYPE type,
 CK_RV template_attribute_get_non_empty(TEMPLATE *tmpl, CK_ATTRIBUTE_TYPE type,
                                        CK_ATTRIBUTE **attr);
 
+void template_update_key_desc(TEMPLATE *tmpl);
+CK_RV template_key_desc_get_ulong(TEMPLATE *tmpl, CK_ATTRIBUTE_TYPE type,
+                                  CK_ULONG *value);
+CK_RV template_key_desc_get_bool(TEMPLATE *tmpl, CK_ATTRIBUTE_TYPE type,
+                                 CK_BBOOL *value);
+
 void template_attribute_find_multiple(TEMPLATE *tmpl,
                                       ATTRIBUTE_PARSE_LIST *parselist,
                                       CK_ULONG plcount);
@@ -2965,8 +2986,23 @@ typedef CK_RV (*t_rsa_decrypt)(STDLL_TokData_t *, CK_BYTE *in_data,
                                CK_ULONG in_data_len, CK_BYTE *out_data,
                                OBJECT *key_obj);
 
+#define OPENSSL_EX_DATA_CIPHER_CTXS     14
+#define OPENSSL_EX_DATA_HMAC_CTXS       12
+
 struct openssl_ex_data {
     EVP_PKEY *pkey;
+    /*
+     * Cipher contexts with the key schedule already set up, one per
+     * mechanism and direction. A context is used by one thread at a time,
+     * the corresponding busy flag is obtained via atomic test-and-set.
+     */
+    EVP_CIPHER_CTX *cipher_ctx[OPENSSL_EX_DATA_CIPHER_CTXS];
+    int cipher_ctx_busy[OPENSSL_EX_DATA_CIPHER_CTXS];
+    /*
+     * HMAC sign contexts with the inner and outer key state already set up,
+     * one per digest. These are never used directly, but only copied.
+     */
+    EVP_MD_CTX *hmac_ctx[OPENSSL_EX_DATA_HMAC_CTXS];
 };
 
 void openssl_free_ex_data(OBJECT *obj, void *ex_data, size_t ex_data_len);
@@ -2978,6 +3014,16 @@ CK_RV openssl_get_ex_data(OBJECT *obj, void **ex_data, size_t ex_data_len,
                                                void *ex_data,
                                                size_t ex_data_len));
 
+const EVP_MD *openssl_md(const EVP_MD *md);
+const EVP_CIPHER *openssl_cipher(const EVP_CIPHER *cipher);
+#if OPENSSL_VERSION_PREREQ(3, 0)
+EVP_MAC *openssl_mac(const char *name);
+#endif
+void openssl_algs_get(void);
+void openssl_algs_put(void);
+
+CK_RV openssl_specific_rng(STDLL_TokData_t *tokdata, CK_BYTE *output,
+                           CK_ULONG bytes);
 CK_RV openssl_specific_rsa_keygen(TEMPLATE *publ_tmpl, TEMPLATE *priv_tmpl);
 CK_RV openssl_specific_rsa_encrypt(STDLL_TokData_t *, CK_BYTE *in_data,
                                    CK_ULONG in_data_len,
@@ -3166,6 +3212,12 @@ CK_RV openssl_specific_tdes_mac(STDLL_TokData_t *tokdata, CK_BYTE *message,
 CK_RV openssl_specific_tdes_cmac(STDLL_TokData_t *tokdata, CK_BYTE *message,
                                  CK_ULONG message_len, OBJECT *key, CK_BYTE *mac,
                                  CK_BBOOL first, CK_BBOOL last, CK_VOID_PTR *ctx);
+CK_RV openssl_specific_cipher_update(STDLL_TokData_t *tokdata,
+                                     CK_MECHANISM_TYPE mech,
+                                     CK_BYTE *in_data, CK_ULONG in_data_len,
+                                     CK_BYTE *out_data, OBJECT *key,
+                                     CK_BYTE *init_v, CK_BYTE encrypt,
+                                     CK_BBOOL last, CK_VOID_PTR *ctx);
 
 CK_RV openssl_specific_hmac_init(STDLL_TokData_t *tokdata,
                                  SIGN_VERIFY_CONTEXT *ctx,
@@ -43,6 +43,7 @@ typedef struct _ENCR_DECR_CONTEXT {
     CK_BBOOL pkey_active;
     CK_BBOOL state_unsaveable;
     CK_BBOOL count_statistics;
+    struct stat_op stat;        // not reset by cleanup, see STAT_OP_DONE
 } ENCR_DECR_CONTEXT;
 
 typedef struct _DIGEST_CONTEXT {
@@ -56,6 +57,7 @@ typedef struct _DIGEST_CONTEXT {
                                 // on first call *after* init
     CK_BBOOL state_unsaveable;
     CK_BBOOL count_statistics;
+    struct stat_op stat;        // not reset by cleanup, see STAT_OP_DONE
 } DIGEST_CONTEXT;
 
 typedef struct _SIGN_VERIFY_CONTEXT {
@@ -73,8 +75,23 @@ typedef struct _SIGN_VERIFY_CONTEXT {
     CK_BBOOL pkey_active;
     CK_BBOOL state_unsaveable;
     CK_BBOOL count_statistics;
+    struct stat_op stat;        // not reset by cleanup, see STAT_OP_DONE
 } SIGN_VERIFY_CONTEXT;
 
+/*
+ * Scratch arena of a session's crypto operation, see session_mgr_op_alloc().
+ * The buffer is allocated on first use with the size of the operation class
+ * and kept until the session is closed.
+ */
+typedef struct _OP_ARENA {
+    CK_BYTE *base;
+    CK_ULONG size;
+    CK_ULONG used;
+} OP_ARENA;
+
+#define OP_ARENA_ENCR_DECR_SIZE     4096
+#define OP_ARENA_SIGN_VERIFY_SIZE   2048
+
 
 typedef struct _SESSION {
     struct bt_ref_hdr hdr;
@@ -93,6 +110,11 @@ typedef struct _SESSION {
     SIGN_VERIFY_CONTEXT sign_ctx;
     SIGN_VERIFY_CONTEXT verify_ctx;
 
+    OP_ARENA encr_arena;
+    OP_ARENA decr_arena;
+    OP_ARENA sign_arena;
+    OP_ARENA verify_arena;
+
     void *private_data;
 } SESSION;
 
@@ -105,6 +127,7 @@ typedef struct _DES_CONTEXT {
     CK_BYTE data[DES_BLOCK_SIZE];
     CK_ULONG len;
     CK_BBOOL cbc_pad;           // is this a CKM_DES_CBC_PAD operation?
+    CK_VOID_PTR cipher_ctx;     // token's cipher context for multi-part ops
 } DES_CONTEXT;
 
 typedef struct _DES_DATA_CONTEXT {
@@ -117,6 +140,7 @@ typedef struct _AES_CONTEXT {
     CK_BYTE data[AES_BLOCK_SIZE];
     CK_ULONG len;
     CK_BBOOL cbc_pad;
+    CK_VOID_PTR cipher_ctx;
 } AES_CONTEXT;
 
 typedef struct _AES_XTS_CONTEXT {
@@ -192,11 +216,78 @@ typedef pthread_mutex_t MUTEX;
 
 // This is actualy wrong... XPROC will be with spinlocks
 
+typedef struct _TEMPLATE_ATTR {
+    CK_ATTRIBUTE_TYPE type;     // copy of attr->type, keeps lookups local
+    CK_ATTRIBUTE *attr;
+} TEMPLATE_ATTR;
+
+/*
+ * Key properties read by the crypto init paths, derived from the template by
+ * template_update_key_desc(). Any change of the template drops it, and the
+ * template_key_desc_get_*() accessors then fall back to the attributes.
+ */
+#define KEY_DESC_CLASS                  0x00000001
+#define KEY_DESC_KEY_TYPE               0x00000002
+#define KEY_DESC_ENCRYPT                0x00000004
+#define KEY_DESC_DECRYPT                0x00000008
+#define KEY_DESC_SIGN                   0x00000010
+#define KEY_DESC_SIGN_RECOVER           0x00000020
+#define KEY_DESC_VERIFY                 0x00000040
+#define KEY_DESC_VERIFY_RECOVER         0x00000080
+#define KEY_DESC_WRAP                   0x00000100
+#define KEY_DESC_UNWRAP                 0x00000200
+#define KEY_DESC_DERIVE                 0x00000400
+#define KEY_DESC_SENSITIVE              0x00000800
+#define KEY_DESC_EXTRACTABLE            0x00001000
+#define KEY_DESC_WRAP_WITH_TRUSTED      0x00002000
+#define KEY_DESC_ALWAYS_AUTHENTICATE    0x00004000
+
+typedef struct _KEY_DESC {
+    CK_ULONG known;             // KEY_DESC_* bits of the attributes cached
+    CK_ULONG flags;             // KEY_DESC_* bits of the CK_BBOOLs that are TRUE
+    CK_OBJECT_CLASS class;
+    CK_KEY_TYPE key_type;
+} KEY_DESC;
+
 typedef struct _TEMPLATE {
-    DL_NODE *attribute_list;
+    TEMPLATE_ATTR *attrs;       // sorted by attribute type, types are unique
+    CK_ULONG num_attrs;
+    CK_ULONG max_attrs;
+    KEY_DESC key_desc;
+    CK_BYTE *slab;              // attributes restored by template_unflatten
+    CK_ULONG slab_len;
 } TEMPLATE;
 
 
+/*
+ * Per process secondary index of an object btree by the values of the
+ * attributes most commonly used in find templates. Each distinct attribute
+ * value has a list of the objects that have it; the objects link themselves
+ * into these lists, so that they are added and removed in constant time.
+ */
+#define OBJ_ATTR_INDEX_CLASS        0
+#define OBJ_ATTR_INDEX_KEY_TYPE     1
+#define OBJ_ATTR_INDEX_ID           2
+#define OBJ_ATTR_INDEX_LABEL        3
+#define OBJ_ATTR_INDEX_NUM          4
+
+struct obj_attr_index_list;
+
+struct obj_attr_index_link {
+    struct obj_attr_index_link *prev;
+    struct obj_attr_index_link *next;
+    struct obj_attr_index_list *list; /* NULL if not linked */
+    struct _OBJECT *obj;
+};
+
+struct obj_attr_index {
+    struct obj_attr_index_list **buckets;
+    unsigned long num_buckets;
+    unsigned long num_lists;
+    CK_BBOOL failed;            /* an object could not be indexed */
+    pthread_mutex_t mutex;
+};
+
 typedef struct _OBJECT {
     struct bt_ref_hdr hdr;
     CK_OBJECT_CLASS class;
@@ -210,6 +301,11 @@ typedef struct _OBJECT {
     CK_ULONG index;             // SAB  Index into the SHM
     CK_OBJECT_HANDLE map_handle;
 
+    // secondary attribute index of the object's btree, if indexed
+    struct obj_attr_index *attr_index;
+    unsigned long attr_index_handle; // btree node handle of the object
+    struct obj_attr_index_link attr_index_links[OBJ_ATTR_INDEX_NUM];
+
     // policy support (set via store_object_strength_f pointer)
     struct objstrength strength;
 
@@ -368,19 +464,101 @@ CK_RV ock_generic_get_mechanism_info(STDLL_TokData_t * tokdata,
 
 typedef struct _TOK_OBJ_ENTRY {
     CK_BBOOL deleted;
+    CK_BBOOL priv;
     char name[8];
     CK_ULONG_32 count_lo;
     CK_ULONG_32 count_hi;
+    CK_ULONG_32 next;           /* next entry in hash chain or free list */
 } TOK_OBJ_ENTRY;
 
+/*
+ * The token object entries in shared memory form a hash table keyed by the
+ * object name, using linear hashing so that it grows one bucket at a time.
+ * Buckets and entries are stored in segments: the first one is part of
+ * LW_SHM_TYPE, further ones are separate shared memory regions created on
+ * demand. Bucket and entry indexes are global over all segments, entry
+ * index 0 is never used and terminates a chain.
+ */
+typedef struct _TOK_OBJ_SEG {
+    CK_ULONG_32 buckets[TOK_OBJ_SEG_SIZE];
+    TOK_OBJ_ENTRY entries[TOK_OBJ_SEG_SIZE];
+} TOK_OBJ_SEG;
+
+typedef struct _TOK_OBJ_TABLE {
+    CK_ULONG_32 num_ext_segs;   /* segments in addition to the first one */
+    CK_ULONG_32 num_entries;    /* highest entry index ever used */
+    CK_ULONG_32 free_entry;     /* first entry of the free list */
+    CK_ULONG_32 count;          /* entries in use */
+    CK_ULONG_32 level;          /* TOK_OBJ_SEG_SIZE << level buckets ... */
+    CK_ULONG_32 split;          /* ... plus the ones split in this round */
+} TOK_OBJ_TABLE;
+
+/*
+ * Ring of the most recent additions and deletions of one token object list
+ * in the shared memory segment. The generation is bumped (under XProcLock)
+ * for every change, so that a process can tell whether its token object
+ * btree is still in sync with one atomic load, and can catch up by replaying
+ * only the changes it has not yet seen. Must be a power of 2.
+ */
+#define TOK_OBJ_CHANGE_LOG_SIZE 128
+
+typedef struct _TOK_OBJ_CHANGE {
+    CK_ULONG_32 generation;
+    CK_BBOOL deleted;
+    char name[8];
+} TOK_OBJ_CHANGE;
+
+typedef struct _TOK_OBJ_CHANGE_LOG {
+    CK_ULONG_32 generation;
+    TOK_OBJ_CHANGE changes[TOK_OBJ_CHANGE_LOG_SIZE];
+} TOK_OBJ_CHANGE_LOG;
+
 struct _LW_SHM_TYPE {
     TOKEN_DATA nv_token_data;
     CK_ULONG_32 num_priv_tok_obj;
     CK_ULONG_32 num_publ_tok_obj;
     CK_BBOOL priv_loaded;
     CK_BBOOL publ_loaded;
-    TOK_OBJ_ENTRY publ_tok_objs[MAX_TOK_OBJS];
-    TOK_OBJ_ENTRY priv_tok_objs[MAX_TOK_OBJS];
+    TOK_OBJ_CHANGE_LOG publ_tok_log;
+    TOK_OBJ_CHANGE_LOG priv_tok_log;
+    TOK_OBJ_TABLE tok_obj_table;
+    TOK_OBJ_SEG tok_obj_seg;
+};
+
+/*
+ * Per process hash index of a token object btree by object name, mapping the
+ * name of the object to its btree node handle.
+ */
+struct tok_obj_name_index_entry;
+
+struct tok_obj_name_index {
+    struct tok_obj_name_index_entry **buckets;
+    unsigned long num_buckets;
+    unsigned long num_entries;
+    pthread_mutex_t mutex;
+};
+
+/*
+ * Group commit of token object saves (OPENCRYPTOKI_GROUP_COMMIT). Threads
+ * queue the token objects they create or modify, and one of them, the leader,
+ * stores all queued objects under one XProcLock with one sync of the data
+ * store, while the others wait for the result.
+ */
+struct tok_obj_commit;
+
+struct tok_obj_group_commit {
+    CK_BBOOL enabled;
+    long window;                /* usecs the leader waits for more saves */
+    pthread_mutex_t mutex;
+    pthread_cond_t done_cond;   /* a batch has been committed */
+    pthread_cond_t full_cond;   /* the queue is full, wakes the leader */
+    CK_BBOOL leader;            /* a thread is committing a batch */
+    struct tok_obj_commit *head;
+    struct tok_obj_commit *tail;
+    CK_ULONG num_queued;
+    CK_BBOOL in_batch;          /* defer SHM change log publishing */
+    CK_ULONG_32 publ_log_pending; /* unpublished SHM change log entries */
+    CK_ULONG_32 priv_log_pending;
 };
 
 struct _STDLL_TokData_t {
@@ -404,6 +582,8 @@ struct _STDLL_TokData_t {
     TOKEN_DATA *nv_token_data;
     void *private_data;
     uint32_t version; /* major<<16|minor */
+    uint32_t objstore; /* OBJSTORE_FILES or OBJSTORE_LOG */
+    struct logstore *obj_log; /* token object log, opened on first use */
     unsigned char so_wrap_key[32];
     unsigned char user_wrap_key[32];
     pthread_mutex_t login_mutex;
@@ -413,6 +593,18 @@ struct _STDLL_TokData_t {
     struct btree sess_obj_btree;
     struct btree publ_token_obj_btree;
     struct btree priv_token_obj_btree;
+    struct tok_obj_name_index publ_token_obj_index;
+    struct tok_obj_name_index priv_token_obj_index;
+    struct obj_attr_index sess_obj_attr_index;
+    struct obj_attr_index publ_token_obj_attr_index;
+    struct obj_attr_index priv_token_obj_attr_index;
+    CK_ULONG_32 publ_tok_obj_generation; /* last SHM generation synced */
+    CK_ULONG_32 priv_tok_obj_generation;
+    CK_BBOOL publ_tok_obj_synced;
+    CK_BBOOL priv_tok_obj_synced;
+    TOK_OBJ_SEG **tok_obj_segs; /* SHM segments of the token object table */
+    CK_ULONG_32 num_tok_obj_segs; /* segments mapped by this process */
+    struct tok_obj_group_commit group_commit;
     MECH_LIST_ELEMENT *mech_list;
     CK_ULONG mech_list_len;
     struct policy *policy;
@@ -722,7 +722,7 @@ CK_RV key_mgr_wrap_key(STDLL_TokData_t *tokdata,
 
     // is the key-to-be-wrapped EXTRACTABLE?
     //
-    rc = template_attribute_get_bool(key_obj->template, CKA_EXTRACTABLE, &flag);
+    rc = template_key_desc_get_bool(key_obj->template, CKA_EXTRACTABLE, &flag);
     if (rc != CKR_OK) {
         TRACE_ERROR("Failed to find CKA_EXTRACTABLE in key template.\n");
         // could happen if user tries to wrap a public key
@@ -736,8 +736,8 @@ CK_RV key_mgr_wrap_key(STDLL_TokData_t *tokdata,
         goto done;
     }
 
-    rc = template_attribute_get_bool(wrapping_key_obj->template, CKA_WRAP,
-                                     &flag);
+    rc = template_key_desc_get_bool(wrapping_key_obj->template, CKA_WRAP,
+                                    &flag);
     if (rc != CKR_OK) {
         TRACE_ERROR("Could not find CKA_WRAP for the wrapping key.\n");
         rc = CKR_KEY_FUNCTION_NOT_PERMITTED;
@@ -751,8 +751,8 @@ CK_RV key_mgr_wrap_key(STDLL_TokData_t *tokdata,
     }
 
     /* Is a wrapping key with CKA_TRUSTED = CK_TRUE required? */
-    rc = template_attribute_get_bool(key_obj->template, CKA_WRAP_WITH_TRUSTED,
-                                     &flag);
+    rc = template_key_desc_get_bool(key_obj->template, CKA_WRAP_WITH_TRUSTED,
+                                    &flag);
     if (rc == CKR_ATTRIBUTE_VALUE_INVALID) {
         TRACE_ERROR("%s\n", ock_err(ERR_ATTRIBUTE_VALUE_INVALID));
         goto done;
@@ -774,7 +774,7 @@ CK_RV key_mgr_wrap_key(STDLL_TokData_t *tokdata,
     // what kind of key are we trying to wrap?  make sure the mechanism is
     // allowed to wrap this kind of key
     //
-    rc = template_attribute_get_ulong(key_obj->template, CKA_CLASS, &class);
+    rc = template_key_desc_get_ulong(key_obj->template, CKA_CLASS, &class);
     if (rc != CKR_OK) {
         TRACE_ERROR("Could not find CKA_CLASS for the key.\n");
         goto done;
@@ -852,8 +852,8 @@ CK_RV key_mgr_wrap_key(STDLL_TokData_t *tokdata,
 
     // extract the secret data to be wrapped
     //
-    rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                      &keytype);
+    rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                     &keytype);
     if (rc != CKR_OK) {
         TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
         goto done;
@@ -1097,8 +1097,8 @@ CK_RV key_mgr_unwrap_key(STDLL_TokData_t *tokdata,
         goto done;
     }
 
-    rc = template_attribute_get_bool(unwrapping_key_obj->template, CKA_UNWRAP,
-                                     &flag);
+    rc = template_key_desc_get_bool(unwrapping_key_obj->template, CKA_UNWRAP,
+                                    &flag);
     if (rc != CKR_OK) {
         TRACE_ERROR("Could not find CKA_UNWRAP for the key.\n");
         rc = CKR_KEY_FUNCTION_NOT_PERMITTED;
@@ -1500,7 +1500,7 @@ CK_RV key_mgr_derive_key(STDLL_TokData_t *tokdata,
         goto done;
     }
 
-    rc = template_attribute_get_bool(base_key_obj->template, CKA_DERIVE, &flag);
+    rc = template_key_desc_get_bool(base_key_obj->template, CKA_DERIVE, &flag);
     if (rc != CKR_OK) {
         TRACE_ERROR("Could not find CKA_DERIVE for the base key.\n");
         rc = CKR_KEY_FUNCTION_NOT_PERMITTED;
@@ -15,6 +15,7 @@
 //
 #define _GNU_SOURCE
 #include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,6 +30,7 @@
 #include <syslog.h>
 #include <pwd.h>
 #include <grp.h>
+#include <openssl/crypto.h>
 #include <openssl/evp.h>
 #include <endian.h>
 
@@ -42,6 +44,7 @@
 #include "trace.h"
 #include "ock_syslog.h"
 #include "slotmgr.h" // for ock_snprintf
+#include "logstore.h"
 
 extern void set_perm(int);
 
@@ -107,6 +110,29 @@ static FILE *open_token_nvdat(char *buf, size_t buflen,
     return fopen(buf, mode);
 }
 
+/*
+ * Returns the token object log of a token using the log object store. The
+ * log is opened on first use.
+ */
+static logstore_t *token_object_log(STDLL_TokData_t *tokdata)
+{
+    char fname[PATH_MAX];
+
+    if (tokdata->obj_log != NULL)
+        return tokdata->obj_log;
+
+    if (get_token_object_path(fname, sizeof(fname), tokdata,
+                              PK_LITE_OBJ_LOG) < 0)
+        return NULL;
+
+    if (logstore_open(fname, set_perm, &tokdata->obj_log) != CKR_OK) {
+        TRACE_ERROR("Failed to open token object log %s\n", fname);
+        return NULL;
+    }
+
+    return tokdata->obj_log;
+}
+
 char *get_pk_dir(STDLL_TokData_t *tokdata, char *fname, size_t len)
 {
     int snres;
@@ -149,6 +175,40 @@ error:
     TRACE_DEVEL("Unable to set permissions on file.\n");
 }
 
+//
+// Generates a unique name for a new token object.
+//
+// Note: The token lock (XProcLock) must be held when calling this function,
+// and must not be released before the object has been saved.
+//
+CK_RV new_token_object_name(STDLL_TokData_t *tokdata, CK_BYTE *name)
+{
+    logstore_t *ls;
+    char fname[PATH_MAX];
+    int fd;
+
+    if (tokdata->objstore == OBJSTORE_LOG) {
+        ls = token_object_log(tokdata);
+        if (ls == NULL)
+            return CKR_FUNCTION_FAILED;
+        return logstore_new_name(ls, name);
+    }
+
+    /* create unique file name in token directory */
+    if (get_token_object_path(fname, sizeof(fname), tokdata, "OBXXXXXX") < 0)
+        return CKR_FUNCTION_FAILED;
+
+    fd = mkstemp(fname);
+    if (fd < 0) {
+        TRACE_ERROR("mkstemp failed with: %s\n", strerror(errno));
+        return CKR_FUNCTION_FAILED;
+    }
+    close(fd); /* written and permissions set by save_token_object */
+
+    memcpy(name, &fname[strlen(fname) - 8], 8);
+    return CKR_OK;
+}
+
 //
 // Note: The token lock (XProcLock) must be held when calling this function.
 // The object must hold the READ lock when this function is called.
@@ -168,6 +228,10 @@ CK_RV save_token_object(STDLL_TokData_t *tokdata, OBJECT *obj)
     if (rc != CKR_OK)
         return rc;
 
+    // the object log needs no index file
+    if (tokdata->objstore == OBJSTORE_LOG)
+        return CKR_OK;
+
     // update the index file if it exists
     fp = open_token_object_index(fname, sizeof(fname), tokdata, "r");
     if (fp) {
@@ -198,6 +262,122 @@ CK_RV save_token_object(STDLL_TokData_t *tokdata, OBJECT *obj)
     return CKR_OK;
 }
 
+static int compare_token_object_names(const void *a, const void *b)
+{
+    return memcmp(a, b, 8);
+}
+
+//
+// Saves several token objects, with one update of the index file and one
+// sync of the data store for all of them. Used for group commit, see
+// object_mgr_group_commit(). Returns the result for each object in @rcs. If
+// the index file cannot be updated or the data store cannot be synced, this
+// is returned for all objects.
+//
+// Note: The token lock (XProcLock) must be held when calling this function.
+// The objects must hold the READ lock when this function is called.
+//
+CK_RV save_token_objects(STDLL_TokData_t *tokdata, OBJECT **objs,
+                         CK_RV *rcs, CK_ULONG num)
+{
+    FILE *fp = NULL;
+    char line[256];
+    char fname[PATH_MAX];
+    char *names = NULL;
+    CK_ULONG i, num_names = 0, max_names = 0;
+    logstore_t *ls;
+    void *tmp;
+    CK_RV rc = CKR_OK;
+
+    // write token objects
+    for (i = 0; i < num; i++) {
+        if (object_is_private(objs[i]) == TRUE)
+            rcs[i] = save_private_token_object(tokdata, objs[i]);
+        else
+            rcs[i] = save_public_token_object(tokdata, objs[i]);
+    }
+
+    if (tokdata->objstore == OBJSTORE_LOG) {
+        // the object log needs no index file, one sync covers all records
+        ls = token_object_log(tokdata);
+        rc = ls != NULL ? logstore_sync(ls) : CKR_FUNCTION_FAILED;
+        goto done;
+    }
+
+    // read the index file once, instead of once per object
+    fp = open_token_object_index(fname, sizeof(fname), tokdata, "r");
+    if (fp) {
+        while (fgets(line, 50, fp)) {
+            line[strlen(line) - 1] = 0;
+            if (strlen(line) != 8)
+                continue;
+            if (num_names == max_names) {
+                max_names = max_names == 0 ? 256 : max_names * 2;
+                tmp = realloc(names, max_names * 8);
+                if (tmp == NULL) {
+                    TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+                    rc = CKR_HOST_MEMORY;
+                    goto done;
+                }
+                names = tmp;
+            }
+            memcpy(names + num_names * 8, line, 8);
+            num_names++;
+        }
+        fclose(fp);
+        fp = NULL;
+        if (num_names > 0)
+            qsort(names, num_names, 8, compare_token_object_names);
+    }
+
+    // append the objects that are not yet listed with one write
+    fp = fopen(fname, "a");
+    if (!fp) {
+        TRACE_ERROR("fopen(%s): %s\n", fname, strerror(errno));
+        rc = CKR_FUNCTION_FAILED;
+        goto done;
+    }
+
+    set_perm(fileno(fp));
+    for (i = 0; i < num; i++) {
+        if (rcs[i] != CKR_OK)
+            continue;
+        if (num_names > 0 &&
+            bsearch(objs[i]->name, names, num_names, 8,
+                    compare_token_object_names) != NULL)
+            continue;
+        fprintf(fp, "%.8s\n", (char *)objs[i]->name);
+    }
+
+    if (fflush(fp) != 0) {
+        TRACE_ERROR("fflush(%s): %s\n", fname, strerror(errno));
+        rc = CKR_FUNCTION_FAILED;
+        goto done;
+    }
+
+    // one sync of the file system makes the object files and the index
+    // durable, instead of one fsync per object file
+    if (syncfs(fileno(fp)) != 0) {
+        TRACE_ERROR("syncfs(%s): %s\n", fname, strerror(errno));
+        rc = CKR_FUNCTION_FAILED;
+        goto done;
+    }
+
+done:
+    if (fp)
+        fclose(fp);
+    free(names);
+
+    if (rc != CKR_OK) {
+        for (i = 0; i < num; i++) {
+            if (rcs[i] == CKR_OK)
+                rcs[i] = rc;
+        }
+    }
+
+    return rc;
+}
+
 //
 // Note: The token lock (XProcLock) must be held when calling this function.
 //
@@ -205,6 +385,14 @@ CK_RV delete_token_object(STDLL_TokData_t *tokdata, OBJECT *obj)
 {
     FILE *fp1, *fp2;
     char objidx[PATH_MAX], idxtmp[PATH_MAX], fname[PATH_MAX], line[256];
+    logstore_t *ls;
+
+    if (tokdata->objstore == OBJSTORE_LOG) {
+        ls = token_object_log(tokdata);
+        if (ls == NULL)
+            return CKR_FUNCTION_FAILED;
+        return logstore_delete(ls, obj->name);
+    }
 
     // FIXME:  on UNIX, we need to make sure these guys aren't symlinks
     //         before we blindly write to these files...
@@ -214,6 +402,10 @@ CK_RV delete_token_object(STDLL_TokData_t *tokdata, OBJECT *obj)
     //
 
     fp1 = open_token_object_index(objidx, sizeof(objidx), tokdata, "r");
+    if (!fp1 && errno == ENOENT) {
+        // no index yet, only the object file may exist
+        goto remove_file;
+    }
     fp2 = open_token_object_path(idxtmp, sizeof(idxtmp),
                                  tokdata, "IDX.TMP", "w");
     if (!fp1 || !fp2) {
@@ -257,6 +449,7 @@ CK_RV delete_token_object(STDLL_TokData_t *tokdata, OBJECT *obj)
     fclose(fp1);
     fclose(fp2);
 
+remove_file:
     if (get_token_object_path(fname, sizeof(fname), tokdata,
                               (char *) obj->name) < 0)
        TRACE_DEVEL("file name buffer overflow in obj unlink\n");
@@ -286,6 +479,10 @@ CK_RV delete_token_data(STDLL_TokData_t *tokdata)
     if (system(cmd))
         TRACE_ERROR("system() failed.\n");
 
+    /* The object log has been removed as well */
+    logstore_close(tokdata->obj_log);
+    tokdata->obj_log = NULL;
+
 done:
     free(cmd);
 
@@ -297,6 +494,11 @@ CK_RV init_data_store(STDLL_TokData_t *tokdata, char *directory,
 {
     char *pkdir;
     int pklen;
+    CK_RV rc;
+
+    rc = object_mgr_group_commit_init(tokdata);
+    if (rc != CKR_OK)
+        return rc;
 
     if (tokdata->pk_dir != NULL) {
         free(tokdata->pk_dir);
@@ -333,6 +535,11 @@ CK_RV init_data_store(STDLL_TokData_t *tokdata, char *directory,
 
 void final_data_store(STDLL_TokData_t * tokdata)
 {
+    object_mgr_group_commit_final(tokdata);
+
+    logstore_close(tokdata->obj_log);
+    tokdata->obj_log = NULL;
+
     if (tokdata->pk_dir != NULL) {
         free(tokdata->pk_dir);
         tokdata->pk_dir = NULL;
@@ -2316,20 +2523,166 @@ static inline int inc32(unsigned char ctr[4])
 #define PUB_HEADER_LEN     16
 #define HEADER_COMMON_LEN  5
 
+/*
+ * Splits a token object, as stored in the object log, into its body and, for
+ * private objects, its footer. The header starts at @buf.
+ */
+static CK_RV split_token_object(CK_BYTE *buf, CK_ULONG len, CK_BBOOL *priv,
+                                CK_BYTE **body, CK_ULONG_32 *body_len,
+                                CK_BYTE **footer)
+{
+    CK_ULONG header_len, footer_len;
+    uint32_t ver, size;
+
+    if (len < PUB_HEADER_LEN)
+        return CKR_FUNCTION_FAILED;
+
+    memcpy(&ver, buf, 4);
+    memcpy(priv, buf + 4, 1);
+    if (*priv) {
+        header_len = HEADER_LEN;
+        footer_len = FOOTER_LEN;
+        if (len < HEADER_LEN + FOOTER_LEN)
+            return CKR_FUNCTION_FAILED;
+        memcpy(&size, buf + 60, 4);
+    } else {
+        header_len = PUB_HEADER_LEN;
+        footer_len = 0;
+        memcpy(&size, buf + 12, 4);
+    }
+
+    /*
+     * In OCK 3.12 - 3.14 the version and size was not stored in BE. So if
+     * version field is in platform endianness, keep size as is also.
+     */
+    if (ver != TOK_NEW_DATA_STORE)
+        size = be32toh(size);
+
+    if (size != len - header_len - footer_len)
+        return CKR_FUNCTION_FAILED;
+
+    *body = buf + header_len;
+    *body_len = size;
+    *footer = footer_len > 0 ? buf + header_len + size : NULL;
+    return CKR_OK;
+}
+
+/*
+ * Reads the header of the stored version of a private token object into
+ * @header. Sets @found to FALSE if the object has not been stored yet.
+ */
+static CK_RV read_private_token_object_header(STDLL_TokData_t *tokdata,
+                                              OBJECT *obj, CK_BYTE *header,
+                                              CK_BBOOL *found)
+{
+    FILE *fp;
+    CK_BYTE *buf = NULL;
+    CK_ULONG len;
+    char fname[PATH_MAX];
+    struct stat sb;
+    logstore_t *ls;
+    CK_RV rc;
+
+    *found = FALSE;
+
+    if (tokdata->objstore == OBJSTORE_LOG) {
+        ls = token_object_log(tokdata);
+        if (ls == NULL)
+            return CKR_FUNCTION_FAILED;
+
+        rc = logstore_get(ls, obj->name, &buf, &len);
+        if (rc != CKR_OK)
+            return rc;
+
+        if (buf != NULL && len >= HEADER_LEN) {
+            memcpy(header, buf, HEADER_LEN);
+            *found = TRUE;
+        }
+        free(buf);
+        return CKR_OK;
+    }
+
+    sprintf(fname, "%s/%s/", tokdata->data_store, PK_LITE_OBJ_DIR);
+    strncat(fname, (char *)obj->name, 8);
+
+    fp = fopen(fname, "r");
+    if (fp == NULL) {
+        /* create new token object */
+        return CKR_OK;
+    }
+
+    if (fstat(fileno(fp), &sb) != 0) {
+        TRACE_ERROR("fstat(%s): %s\n", fname, strerror(errno));
+        fclose(fp);
+        return CKR_FUNCTION_FAILED;
+    }
+
+    /* New token objects files created by mkstemp have a size of zero */
+    if (sb.st_size == 0) {
+        fclose(fp);
+        return CKR_OK;
+    }
+
+    /* update existing token object */
+    if (fread(header, HEADER_LEN, 1, fp) != 1) {
+        TRACE_ERROR("fread(%s): %s\n", fname, strerror(errno));
+        fclose(fp);
+        return CKR_FUNCTION_FAILED;
+    }
+
+    fclose(fp);
+    *found = TRUE;
+    return CKR_OK;
+}
+
+/*
+ * Stores a token object, replacing its previous version.
+ */
+static CK_RV write_token_object(STDLL_TokData_t *tokdata, OBJECT *obj,
+                                CK_BYTE *data, CK_ULONG len)
+{
+    FILE *fp;
+    char fname[PATH_MAX];
+    logstore_t *ls;
+
+    if (tokdata->objstore == OBJSTORE_LOG) {
+        ls = token_object_log(tokdata);
+        if (ls == NULL)
+            return CKR_FUNCTION_FAILED;
+        return logstore_put(ls, obj->name, data, len);
+    }
+
+    sprintf(fname, "%s/%s/", tokdata->data_store, PK_LITE_OBJ_DIR);
+    strncat(fname, (char *)obj->name, 8);
+
+    fp = fopen(fname, "w");
+    if (!fp) {
+        TRACE_ERROR("fopen(%s): %s\n", fname, strerror(errno));
+        return CKR_FUNCTION_FAILED;
+    }
+
+    set_perm(fileno(fp));
+
+    if (fwrite(data, len, 1, fp) != 1) {
+        TRACE_ERROR("fwrite(%s): %s\n", fname, strerror(errno));
+        fclose(fp);
+        return CKR_FUNCTION_FAILED;
+    }
+
+    fclose(fp);
+    return CKR_OK;
+}
+
 //
 // Note: The token lock (XProcLock) must be held when calling this function.
 //
 CK_RV save_private_token_object(STDLL_TokData_t *tokdata, OBJECT *obj)
 {
-    FILE *fp = NULL;
-    CK_BYTE *obj_data = NULL;
-    char fname[PATH_MAX];
-    struct stat sb;
     CK_ULONG obj_data_len;
     CK_RV rc;
     CK_ULONG_32 obj_data_len_32;
     CK_ULONG_32 total_len;
-    CK_BBOOL flag = CK_TRUE;
+    CK_BBOOL flag = CK_TRUE, found;
     unsigned char obj_key[256 / 8], obj_iv[96 / 8], obj_key_wrapped[40];
     unsigned char *data = NULL;
     uint32_t tmp;
@@ -2338,14 +2691,12 @@ CK_RV save_private_token_object(STDLL_TokData_t *tokdata, OBJECT *obj)
     if (tokdata->version < TOK_NEW_DATA_STORE)
         return save_private_token_object_old(tokdata, obj);
 
-    sprintf(fname, "%s/%s/", tokdata->data_store, PK_LITE_OBJ_DIR);
-    strncat(fname, (char *)obj->name, 8);
-
-    rc = object_flatten(obj, &obj_data, &obj_data_len);
+    /*
+     * The object is flattened right behind the header into the buffer that
+     * is written out, and encrypted in place.
+     */
+    obj_data_len = object_get_flattened_size(obj);
     obj_data_len_32 = obj_data_len;
-    if (rc != CKR_OK) {
-        goto done;
-    }
 
     total_len = HEADER_LEN + obj_data_len_32 + FOOTER_LEN;
 
@@ -2355,35 +2706,14 @@ CK_RV save_private_token_object(STDLL_TokData_t *tokdata, OBJECT *obj)
         goto done;
     }
 
-    fp = fopen(fname, "r");
-    if (fp == NULL) {
+    rc = read_private_token_object_header(tokdata, obj, data, &found);
+    if (rc != CKR_OK)
+        goto done;
+
+    if (!found) {
         /* create new token object */
         new = 1;
     } else {
-        if (fstat(fileno(fp), &sb) != 0) {
-            TRACE_ERROR("fstat(%s): %s\n", fname, strerror(errno));
-            rc = CKR_FUNCTION_FAILED;
-            goto done;
-        }
-
-        /* New token objects files created by mkstemp have a size of zero */
-        if (sb.st_size == 0) {
-            new = 1;
-            fclose(fp);
-            fp = NULL;
-            goto do_work;
-        }
-
-        /* update existing token object */
-        if (fread(data, HEADER_LEN, 1, fp) != 1) {
-            TRACE_ERROR("fread(%s): %s\n", fname, strerror(errno));
-            rc = CKR_FUNCTION_FAILED;
-            goto done;
-        }
-
-        fclose(fp);
-        fp = NULL;
-
         /* iv */
         memcpy(obj_iv, data + 48, 12);
 
@@ -2402,7 +2732,7 @@ CK_RV save_private_token_object(STDLL_TokData_t *tokdata, OBJECT *obj)
                 goto done;
         }
     }
-do_work:
+
     if (new) {
         /* get key */
         rng_generate(tokdata, obj_key, 32);
@@ -2436,6 +2766,10 @@ do_work:
     tmp = htobe32(obj_data_len_32);
     memcpy(data + 60, &tmp, 4);
 
+    rc = object_flatten_into(obj, data + HEADER_LEN);
+    if (rc != CKR_OK)
+        goto done;
+
     rc = aes_256_gcm_seal(tokdata,
                           /* ciphertext */
                           data + HEADER_LEN,
@@ -2445,7 +2779,7 @@ do_work:
                           /* aad */
                           data, HEADER_LEN,
                           /* plaintext */
-                          obj_data, obj_data_len_32,
+                          data + HEADER_LEN, obj_data_len_32,
                           /* key */
                           obj_key,
                           /* iv */
@@ -2453,122 +2787,343 @@ do_work:
     if (rc != CKR_OK)
         goto done;
 
-    fp = fopen(fname, "w");
-    if (!fp) {
-        TRACE_ERROR("fopen(%s): %s\n", fname, strerror(errno));
-        rc = CKR_FUNCTION_FAILED;
-        goto done;
-    }
-
-    set_perm(fileno(fp));
-
-    if (fwrite(data, total_len, 1, fp) != 1) {
-        TRACE_ERROR("fwrite(%s): %s\n", fname, strerror(errno));
-        rc = CKR_FUNCTION_FAILED;
-        goto done;
-    }
-
-    fclose(fp);
-    fp = NULL;
+    rc = write_token_object(tokdata, obj, data, total_len);
 
-    rc = CKR_OK;
 done:
-    if (fp)
-        fclose(fp);
-    if (obj_data)
-        free(obj_data);
-    if (data)
+    if (data) {
+        /* may still hold the object in the clear */
+        if (rc != CKR_OK)
+            OPENSSL_cleanse(data, total_len);
         free(data);
+    }
     return rc;
 }
 
-//
-// Note: The token lock (XProcLock) must be held when calling this function.
-//
-CK_RV load_private_token_objects(STDLL_TokData_t *tokdata)
+/*
+ * Private token objects are read, decrypted and unflattened by a pool of
+ * threads at login. Only adding them to the object tree and to the shared
+ * memory is done by the calling thread, in the order of the object index.
+ */
+#define LOAD_OBJS_PER_THREAD    64
+#define LOAD_MAX_THREADS        16
+
+struct priv_obj_load {
+    char name[50];
+    OBJECT *obj;
+    CK_RV rc;
+};
+
+struct priv_obj_load_ctx {
+    STDLL_TokData_t *tokdata;
+    struct priv_obj_load *objs;
+    unsigned long num_objs;
+    unsigned long next;
+#if OPENSSL_VERSION_PREREQ(3, 0)
+    OSSL_LIB_CTX *libctx;
+#endif
+};
+
+static CK_RV decrypt_private_token_object(STDLL_TokData_t *tokdata,
+                                          CK_BYTE *header,
+                                          CK_BYTE *data, CK_ULONG len,
+                                          CK_BYTE *footer,
+                                          CK_BYTE **clear)
 {
-    FILE *fp1 = NULL, *fp2 = NULL;
-    CK_BYTE *buf = NULL;
-    char tmp[PATH_MAX];
-    char iname[PATH_MAX];
+    unsigned char obj_iv[12], obj_key[32], obj_key_wrapped[40];
+    CK_BYTE *buff = NULL;
+    CK_RV rc;
+
+    /* wrapped key */
+    memcpy(obj_key_wrapped, header + 8, 40);
+    /* iv */
+    memcpy(obj_iv, header + 48, 12);
+
+    rc = aes_256_unwrap(tokdata, obj_key, obj_key_wrapped, tokdata->master_key);
+    if (rc != CKR_OK)
+        return CKR_FUNCTION_FAILED;
+
+    buff = (CK_BYTE *)malloc(len);
+    if (buff == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        return CKR_HOST_MEMORY;
+    }
+
+    rc = aes_256_gcm_unseal(tokdata,
+                            buff, /* plain-text */
+                            header, HEADER_LEN, /* aad */
+                            data, len, /* cipher-text*/
+                            footer, /* tag */
+                            obj_key, obj_iv);
+    if (rc != CKR_OK) {
+        free(buff);
+        return CKR_FUNCTION_FAILED;
+    }
+
+    *clear = buff;
+    return CKR_OK;
+}
+
+static void load_private_token_object_log(STDLL_TokData_t *tokdata,
+                                          struct priv_obj_load *entry)
+{
+    CK_BYTE *buf = NULL, *body, *footer, *clear = NULL;
+    char fname[PATH_MAX];
+    CK_ULONG len;
+    CK_ULONG_32 size;
+    CK_BBOOL priv;
+
+    if (get_token_object_path(fname, sizeof(fname), tokdata, entry->name) < 0)
+        return;
+
+    if (logstore_get(tokdata->obj_log, (CK_BYTE *)entry->name,
+                     &buf, &len) != CKR_OK || buf == NULL)
+        return;
+
+    if (split_token_object(buf, len, &priv, &body, &size, &footer) != CKR_OK) {
+        OCK_SYSLOG(LOG_ERR,
+                   "Token object %s appears corrupted (ignoring it)", fname);
+        goto done;
+    }
+
+    if (priv == FALSE)
+        goto done;
+
+    entry->rc = decrypt_private_token_object(tokdata, buf, body, size,
+                                             footer, &clear);
+    if (entry->rc != CKR_OK)
+        goto done;
+
+    entry->rc = object_restore_withSize(tokdata->policy, clear, &entry->obj,
+                                        FALSE, size, fname);
+    if (entry->rc != CKR_OK)
+        TRACE_DEVEL("object_restore_withSize failed.\n");
+
+done:
+    free(clear);
+    free(buf);
+}
+
+/*
+ * Reads and decrypts one private token object. Leaves entry->obj NULL without
+ * an error, if the object is skipped (public, or not readable).
+ */
+static void load_private_token_object(STDLL_TokData_t *tokdata,
+                                      struct priv_obj_load *entry)
+{
+    FILE *fp = NULL;
+    CK_BYTE *buf = NULL, *clear = NULL;
     char fname[PATH_MAX];
     CK_BBOOL priv;
     CK_ULONG_32 size;
-    CK_RV rc;
     unsigned char header[HEADER_LEN], footer[FOOTER_LEN];
     uint32_t len;
 
+    entry->obj = NULL;
+    entry->rc = CKR_OK;
+
+    if (tokdata->objstore == OBJSTORE_LOG) {
+        load_private_token_object_log(tokdata, entry);
+        return;
+    }
+
+    fp = open_token_object_path(fname, sizeof(fname), tokdata, entry->name,
+                                "r");
+    if (!fp)
+        return;
+
+    if (fread(header, HEADER_LEN, 1, fp) != 1)
+        goto done;
+
+    memcpy(&priv, header + 4, 1);
+    if (priv == FALSE)
+        goto done;
+
+    memcpy(&len, header + 60, 4);
+    size = be32toh(len);
+
+    buf = (CK_BYTE *)malloc(size);
+    if (!buf) {
+        OCK_SYSLOG(LOG_ERR,
+                   "Cannot malloc %u bytes to read in "
+                   "token object %s (ignoring it)", size, fname);
+        goto done;
+    }
+
+    if (fread(buf, size, 1, fp) != 1 ||
+        fread(footer, FOOTER_LEN, 1, fp) != 1) {
+        OCK_SYSLOG(LOG_ERR,
+                   "Cannot read token object %s " "(ignoring it)", fname);
+        goto done;
+    }
+
+    entry->rc = decrypt_private_token_object(tokdata, header, buf, size,
+                                             footer, &clear);
+    if (entry->rc != CKR_OK)
+        goto done;
+
+    entry->rc = object_restore_withSize(tokdata->policy, clear, &entry->obj,
+                                        FALSE, size, fname);
+    if (entry->rc != CKR_OK)
+        TRACE_DEVEL("object_restore_withSize failed.\n");
+
+done:
+    free(clear);
+    free(buf);
+    fclose(fp);
+}
+
+static CK_RV get_token_object_log_names(STDLL_TokData_t *tokdata,
+                                        struct priv_obj_load_ctx *ctx)
+{
+    logstore_t *ls;
+    CK_BYTE *names = NULL;
+    CK_ULONG i, num;
+    CK_RV rc;
+
+    ls = token_object_log(tokdata);
+    if (ls == NULL)
+        return CKR_FUNCTION_FAILED;
+
+    rc = logstore_names(ls, &names, &num);
+    if (rc != CKR_OK || num == 0)
+        return rc;
+
+    ctx->objs = calloc(num, sizeof(*ctx->objs));
+    if (ctx->objs == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        free(names);
+        return CKR_HOST_MEMORY;
+    }
+
+    for (i = 0; i < num; i++)
+        memcpy(ctx->objs[i].name, names + i * LOGSTORE_NAME_LEN,
+               LOGSTORE_NAME_LEN);
+    ctx->num_objs = num;
+
+    free(names);
+    return CKR_OK;
+}
+
+static void *load_private_token_objects_thread(void *arg)
+{
+    struct priv_obj_load_ctx *ctx = arg;
+    unsigned long i;
+
+#if OPENSSL_VERSION_PREREQ(3, 0)
+    /* Use the same OpenSSL library context as the thread calling C_Login */
+    OSSL_LIB_CTX_set0_default(ctx->libctx);
+#endif
+
+    while ((i = __atomic_fetch_add(&ctx->next, 1, __ATOMIC_RELAXED)) <
+                                                            ctx->num_objs)
+        load_private_token_object(ctx->tokdata, &ctx->objs[i]);
+
+    return NULL;
+}
+
+//
+// Note: The token lock (XProcLock) must be held when calling this function.
+//
+CK_RV load_private_token_objects(STDLL_TokData_t *tokdata)
+{
+    FILE *fp1 = NULL;
+    struct priv_obj_load_ctx ctx;
+    struct priv_obj_load *tmp_objs;
+    pthread_t threads[LOAD_MAX_THREADS];
+    sigset_t set, oldset;
+    unsigned long i, alloc = 0, num_threads = 0;
+    char iname[PATH_MAX];
+    char tmp[sizeof(ctx.objs->name)];
+    long cpus;
+    CK_RV rc = CKR_OK;
+
     if (tokdata->version < TOK_NEW_DATA_STORE)
         return load_private_token_objects_old(tokdata);
 
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.tokdata = tokdata;
+
+    if (tokdata->objstore == OBJSTORE_LOG) {
+        rc = get_token_object_log_names(tokdata, &ctx);
+        if (rc != CKR_OK)
+            goto done;
+        goto load;
+    }
+
     fp1 = open_token_object_index(iname, sizeof(iname), tokdata, "r");
     if (!fp1)
         return CKR_OK;          // no token objects
 
-    while (fgets(tmp, 50, fp1)) {
+    while (fgets(tmp, sizeof(tmp), fp1)) {
         tmp[strlen(tmp) - 1] = 0;
 
-        fp2 = open_token_object_path(fname, sizeof(fname), tokdata, tmp,"r");
-        if (!fp2)
-            continue;
-
-        if (fread(header, HEADER_LEN, 1, fp2) != 1) {
-            fclose(fp2);
-            continue;
+        if (ctx.num_objs >= alloc) {
+            alloc = alloc == 0 ? 256 : alloc * 2;
+            tmp_objs = realloc(ctx.objs, alloc * sizeof(*ctx.objs));
+            if (tmp_objs == NULL) {
+                TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+                rc = CKR_HOST_MEMORY;
+                goto done;
+            }
+            ctx.objs = tmp_objs;
         }
 
-        memcpy(&priv, header + 4, 1);
-        if (priv == FALSE) {
-            fclose(fp2);
-            continue;
+        strcpy(ctx.objs[ctx.num_objs].name, tmp);
+        ctx.num_objs++;
+    }
+
+    fclose(fp1);
+    fp1 = NULL;
+
+load:
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > LOAD_MAX_THREADS)
+        cpus = LOAD_MAX_THREADS;
+    if (cpus > 1 && ctx.num_objs >= 2 * LOAD_OBJS_PER_THREAD) {
+#if OPENSSL_VERSION_PREREQ(3, 0)
+        ctx.libctx = OSSL_LIB_CTX_set0_default(NULL);
+#endif
+        /*
+         * The calling thread is one of the loaders. The others must not
+         * receive any of the application's signals.
+         */
+        sigfillset(&set);
+        pthread_sigmask(SIG_SETMASK, &set, &oldset);
+        for (i = 0; i < (unsigned long)cpus - 1 &&
+                    i < ctx.num_objs / LOAD_OBJS_PER_THREAD - 1; i++) {
+            if (pthread_create(&threads[i], NULL,
+                               load_private_token_objects_thread, &ctx) != 0)
+                break;
         }
+        pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+        num_threads = i;
+    }
 
-        memcpy(&len, header + 60, 4);
-        size = be32toh(len);
+    while ((i = __atomic_fetch_add(&ctx.next, 1, __ATOMIC_RELAXED)) <
+                                                            ctx.num_objs)
+        load_private_token_object(tokdata, &ctx.objs[i]);
 
-        buf = (CK_BYTE *)malloc(size);
-        if (!buf) {
-            fclose(fp2);
-            OCK_SYSLOG(LOG_ERR,
-                       "Cannot malloc %u bytes to read in "
-                       "token object %s (ignoring it)", size, fname);
-            continue;
-        }
+    for (i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
 
-        if (fread(buf, size, 1, fp2) != 1) {
-            free(buf);
-            fclose(fp2);
-            OCK_SYSLOG(LOG_ERR,
-                       "Cannot read token object %s " "(ignoring it)", fname);
-            continue;
-        }
-        if (fread(footer, FOOTER_LEN, 1, fp2) != 1) {
-            free(buf);
-            fclose(fp2);
-            OCK_SYSLOG(LOG_ERR,
-                       "Cannot read token object %s " "(ignoring it)", fname);
-            continue;
-        }
+    /* Stop at the first object that fails to load, like a serial load */
+    for (i = 0; i < ctx.num_objs; i++) {
+        if (rc == CKR_OK)
+            rc = ctx.objs[i].rc;
 
-        rc = restore_private_token_object(tokdata, header,
-                                          buf, size,
-                                          footer, NULL, fname);
-        if (rc != CKR_OK)
-            goto error;
+        if (ctx.objs[i].obj == NULL)
+            continue;
 
-        free(buf);
-        fclose(fp2);
+        if (rc == CKR_OK)
+            rc = object_mgr_add_restored_obj(tokdata, ctx.objs[i].obj, NULL);
+        else
+            object_free(ctx.objs[i].obj);
     }
 
-    fclose(fp1);
-    return CKR_OK;
-error:
-    if (buf)
-        free(buf);
+done:
+    free(ctx.objs);
     if (fp1)
         fclose(fp1);
-    if (fp2)
-        fclose(fp2);
     return rc;
 }
 
@@ -2581,7 +3136,6 @@ CK_RV restore_private_token_object(STDLL_TokData_t *tokdata,
                                    OBJECT *pObj,
                                    const char *fname)
 {
-    unsigned char obj_iv[12], obj_key[32], obj_key_wrapped[40];
     CK_BYTE *buff = NULL;
     CK_RV rc;
 
@@ -2589,44 +3143,59 @@ CK_RV restore_private_token_object(STDLL_TokData_t *tokdata,
         return restore_private_token_object_old(tokdata, data, len, pObj,
                                                 fname);
 
-    /* wrapped key */
-    memcpy(obj_key_wrapped, header + 8, 40);
-    /* iv */
-    memcpy(obj_iv, header + 48, 12);
+    rc = decrypt_private_token_object(tokdata, header, data, len, footer,
+                                      &buff);
+    if (rc != CKR_OK)
+        return rc;
 
-    rc = aes_256_unwrap(tokdata, obj_key, obj_key_wrapped, tokdata->master_key);
-    if (rc != CKR_OK) {
-        rc = CKR_FUNCTION_FAILED;
-        goto done;
-    }
+    rc = object_mgr_restore_obj_withSize(tokdata, buff, pObj, len, fname);
 
-    buff = (CK_BYTE *)malloc(len);
-    if (buff == NULL) {
-        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-        rc = CKR_HOST_MEMORY;
-        goto done;
-    }
+    free(buff);
+    return rc;
+}
 
-    rc = aes_256_gcm_unseal(tokdata,
-                            buff, /* plain-text */
-                            header, HEADER_LEN, /* aad */
-                            data, len, /* cipher-text*/
-                            footer, /* tag */
-                            obj_key, obj_iv);
-    if (rc != CKR_OK) {
-        rc = CKR_FUNCTION_FAILED;
-        goto done;
+static CK_RV reload_token_object_log(STDLL_TokData_t *tokdata, OBJECT *obj)
+{
+    CK_BYTE *buf = NULL, *body, *footer;
+    char fname[PATH_MAX], name[9];
+    CK_ULONG len;
+    CK_ULONG_32 size;
+    CK_BBOOL priv;
+    logstore_t *ls;
+    CK_RV rc;
+
+    memcpy(name, obj->name, 8);
+    name[8] = '\0';
+    if (get_token_object_path(fname, sizeof(fname), tokdata, name) < 0)
+        return CKR_FUNCTION_FAILED;
+
+    ls = token_object_log(tokdata);
+    if (ls == NULL)
+        return CKR_FUNCTION_FAILED;
+
+    rc = logstore_get(ls, obj->name, &buf, &len);
+    if (rc != CKR_OK)
+        return rc;
+    if (buf == NULL) {
+        TRACE_ERROR("Token object %s not found\n", fname);
+        return CKR_FUNCTION_FAILED;
     }
 
-    rc = object_mgr_restore_obj(tokdata, buff, pObj, fname);
+    rc = split_token_object(buf, len, &priv, &body, &size, &footer);
     if (rc != CKR_OK) {
+        OCK_SYSLOG(LOG_ERR,
+                   "Token object %s appears corrupted (ignoring it)", fname);
         goto done;
     }
 
-    rc = CKR_OK;
+    if (priv)
+        rc = restore_private_token_object(tokdata, buf, body, size, footer,
+                                          obj, fname);
+    else
+        rc = object_mgr_restore_obj_withSize(tokdata, body, obj, size, fname);
+
 done:
-    if (buff)
-        free(buff);
+    free(buf);
     return rc;
 }
 
@@ -2646,6 +3215,9 @@ CK_RV reload_token_object(STDLL_TokData_t *tokdata, OBJECT *obj)
     if (tokdata->version < TOK_NEW_DATA_STORE)
         return reload_token_object_old(tokdata, obj);
 
+    if (tokdata->objstore == OBJSTORE_LOG)
+        return reload_token_object_log(tokdata, obj);
+
     memset(fname, 0x0, sizeof(fname));
     sprintf(fname, "%s/%s/", tokdata->data_store, PK_LITE_OBJ_DIR);
     strncat(fname, (char *) obj->name, 8);
@@ -2726,7 +3298,7 @@ CK_RV reload_token_object(STDLL_TokData_t *tokdata, OBJECT *obj)
         rc = restore_private_token_object(tokdata, header, buf, size_64,
                                           footer, obj, fname);
     } else {
-        rc = object_mgr_restore_obj(tokdata, buf, obj, fname);
+        rc = object_mgr_restore_obj_withSize(tokdata, buf, obj, size, fname);
     }
 done:
     if (fp)
@@ -2741,60 +3313,82 @@ done:
 //
 CK_RV save_public_token_object(STDLL_TokData_t *tokdata, OBJECT *obj)
 {
-    FILE *fp = NULL;
-    CK_BYTE *clear = NULL;
-    char fname[PATH_MAX];
-    CK_ULONG clear_len;
+    CK_BYTE *data = NULL;
     CK_BBOOL flag = FALSE;
     CK_RV rc;
-    CK_ULONG_32 len, be_len;
-    unsigned char reserved[7] = {0};
+    CK_ULONG_32 len;
     uint32_t tmp;
 
     if (tokdata->version < TOK_NEW_DATA_STORE)
         return save_public_token_object_old(tokdata, obj);
 
-    rc = object_flatten(obj, &clear, &clear_len);
-    if (rc != CKR_OK) {
-        goto done;
-    }
-    len = (CK_ULONG_32)clear_len;
+    len = (CK_ULONG_32)object_get_flattened_size(obj);
 
-    sprintf(fname, "%s/%s/", tokdata->data_store, PK_LITE_OBJ_DIR);
-    strncat(fname, (char *) obj->name, 8);
-
-    fp = fopen(fname, "w");
-    if (!fp) {
-        TRACE_ERROR("fopen(%s): %s\n", fname, strerror(errno));
-        rc = CKR_FUNCTION_FAILED;
+    data = malloc(PUB_HEADER_LEN + len);
+    if (data == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        rc = CKR_HOST_MEMORY;
         goto done;
     }
 
+    /* version */
     tmp = htobe32(tokdata->version);
-    be_len = htobe32(len);
-
-    set_perm(fileno(fp));
-    if (fwrite(&tmp, 4, 1, fp) != 1
-        || fwrite(&flag, 1, 1, fp) != 1
-        || fwrite(reserved, 7, 1, fp) != 1
-        || fwrite(&be_len, 4, 1, fp) != 1
-        || fwrite(clear, len, 1, fp) != 1) {
-        rc = CKR_FUNCTION_FAILED;
+    memcpy(data, &tmp, 4);
+    /* flags */
+    memcpy(data + 4, &flag, 1);
+    memset(data + 5, 0, 7);
+    /* object len */
+    tmp = htobe32(len);
+    memcpy(data + 12, &tmp, 4);
+    /* object */
+    rc = object_flatten_into(obj, data + PUB_HEADER_LEN);
+    if (rc != CKR_OK)
         goto done;
-    }
 
-    fclose(fp);
-    fp = NULL;
+    rc = write_token_object(tokdata, obj, data, PUB_HEADER_LEN + len);
 
-    rc = CKR_OK;
 done:
-    if (fp)
-        fclose(fp);
-    if (clear)
-        free(clear);
+    if (data)
+        free(data);
     return rc;
 }
 
+static CK_RV load_public_token_object_cb(const CK_BYTE *name,
+                                         const CK_BYTE *data, CK_ULONG len,
+                                         void *private)
+{
+    STDLL_TokData_t *tokdata = private;
+    CK_BYTE *body, *footer;
+    char fname[PATH_MAX], tmp[9];
+    CK_ULONG_32 size;
+    CK_BBOOL priv;
+
+    memcpy(tmp, name, 8);
+    tmp[8] = '\0';
+    if (get_token_object_path(fname, sizeof(fname), tokdata, tmp) < 0)
+        return CKR_OK;
+
+    /* The data is only read */
+    if (split_token_object((CK_BYTE *)data, len, &priv, &body, &size,
+                           &footer) != CKR_OK) {
+        OCK_SYSLOG(LOG_ERR,
+                   "Token object %s appears corrupted (ignoring it)", fname);
+        return CKR_OK;
+    }
+
+    if (priv == TRUE)
+        return CKR_OK;
+
+    if (object_mgr_restore_obj_withSize(tokdata, body, NULL, size,
+                                        fname) != CKR_OK) {
+        OCK_SYSLOG(LOG_ERR,
+                   "Cannot restore token object %s "
+                   "(ignoring it)", fname);
+    }
+
+    return CKR_OK;
+}
+
 //
 // Note: The token lock (XProcLock) must be held when calling this function.
 //
@@ -2809,10 +3403,18 @@ CK_RV load_public_token_objects(STDLL_TokData_t *tokdata)
     CK_ULONG_32 size;
     unsigned char header[PUB_HEADER_LEN];
     uint32_t ver;
+    logstore_t *ls;
 
     if (tokdata->version < TOK_NEW_DATA_STORE)
         return load_public_token_objects_old(tokdata);
 
+    if (tokdata->objstore == OBJSTORE_LOG) {
+        ls = token_object_log(tokdata);
+        if (ls == NULL)
+            return CKR_FUNCTION_FAILED;
+        return logstore_iterate(ls, load_public_token_object_cb, tokdata);
+    }
+
     fp1 = open_token_object_index(iname, sizeof(iname), tokdata, "r");
     if (!fp1)
         return CKR_OK;          // no token objects
@@ -0,0 +1,1044 @@
+/*
+ * COPYRIGHT (c) International Business Machines Corp. 2026
+ *
+ * This program is provided under the terms of the Common Public License,
+ * version 1.0 (CPL-1.0). Any use, reproduction or distribution for this
+ * software constitutes recipient's acceptance of CPL-1.0 terms which can be
+ * found in the file LICENSE file or at
+ * https://opensource.org/licenses/cpl1.0.php
+ */
+
+/*
+ * Log-structured token object store.
+ *
+ * segment file layout
+ *
+ * --- file header ---
+ * u8  magic[8]                  "OCKOBJLG"
+ * u32 format_version
+ * u32 reserved
+ * --- record --------        <--+
+ * u32 magic                     | 24-byte record header
+ * u8  type                      |
+ * u8  reserved[3]               |
+ * u8  name[8]                   |
+ * u32 data_len                  |
+ * u32 crc                       |
+ * -------------------        <--+
+ * u8  data[data_len]            | record data, padded to 8 bytes
+ * -------------------        <--+
+ * ... more records
+ *
+ * All integers are big endian. The CRC-32 covers the record header up to the
+ * crc field and the record data. A put record holds the complete token object
+ * file contents of the one-file-per-object store, a delete record has no data.
+ *
+ * A record is only valid if it is complete and its CRC matches. Scanning
+ * stops at the first invalid record, so after a crash the store is always a
+ * consistent prefix of the records written. The invalid tail is overwritten
+ * by the next append. Appends are synced in batches of LOGSTORE_SYNC_RECORDS
+ * records, or when a record is appended more than LOGSTORE_SYNC_INTERVAL
+ * seconds after the last sync, and when the store is closed.
+ *
+ * When more than half of the file is taken by records that have been
+ * overwritten or deleted, the live records are copied to a new file, which
+ * then atomically replaces the old one. Other processes notice the new file
+ * by its inode and re-read it.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "pkcs11types.h"
+#include "local_types.h"
+#include "trace.h"
+#include "logstore.h"
+
+#define LOGSTORE_MAGIC          "OCKOBJLG"
+#define LOGSTORE_FORMAT         1
+#define LOGSTORE_HDR_LEN        16
+
+#define LOGSTORE_REC_MAGIC      0x4f424a52      /* "OBJR" */
+#define LOGSTORE_REC_HDR_LEN    24
+#define LOGSTORE_REC_PUT        1
+#define LOGSTORE_REC_DEL        2
+#define LOGSTORE_REC_SIZE(len)  \
+    (((uint64_t)LOGSTORE_REC_HDR_LEN + (len) + 7) & ~(uint64_t)7)
+
+#define LOGSTORE_SYNC_RECORDS   64
+#define LOGSTORE_SYNC_INTERVAL  1
+#define LOGSTORE_COMPACT_MIN    (256 * 1024)
+#define LOGSTORE_COPY_BUF_SIZE  (1024 * 1024)
+
+#define LOGSTORE_ENTRY_FREE     0
+#define LOGSTORE_ENTRY_USED     1
+#define LOGSTORE_ENTRY_DELETED  2
+
+struct logstore_entry {
+    CK_BYTE name[LOGSTORE_NAME_LEN];
+    uint8_t state;
+    uint32_t len;               /* length of the record data */
+    uint64_t off;               /* file offset of the record */
+};
+
+struct logstore {
+    char *path;
+    void (*set_perm)(int fd);
+    pthread_mutex_t mutex;
+    int fd;
+    dev_t dev;
+    ino_t ino;
+    unsigned char *map;
+    size_t map_len;
+    uint64_t end;               /* end of the last valid record, 0 if none */
+    uint64_t scanned;           /* file size at the last scan */
+    uint64_t live;              /* size of the records in the index */
+    struct logstore_entry *entries;
+    unsigned long num_buckets;
+    unsigned long num_entries;
+    unsigned long num_deleted;
+    unsigned long unsynced;
+    time_t last_sync;
+    uint64_t seed;
+};
+
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+static uint32_t crc_table[256];
+
+static void crc_table_init(void)
+{
+    uint32_t c;
+    int i, k;
+
+    for (i = 0; i < 256; i++) {
+        c = i;
+        for (k = 0; k < 8; k++)
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32_update(uint32_t crc, const unsigned char *p, size_t len)
+{
+    crc = ~crc;
+    while (len--)
+        crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t record_crc(const unsigned char *hdr, const unsigned char *data,
+                           uint32_t len)
+{
+    uint32_t crc;
+
+    crc = crc32_update(0, hdr, LOGSTORE_REC_HDR_LEN - 4);
+    return crc32_update(crc, data, len);
+}
+
+static unsigned long name_hash(const CK_BYTE *name)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int i;
+
+    for (i = 0; i < LOGSTORE_NAME_LEN; i++) {
+        h ^= name[i];
+        h *= 0x100000001b3ULL;
+    }
+    return (unsigned long)h;
+}
+
+static struct logstore_entry *index_find(logstore_t *ls, const CK_BYTE *name)
+{
+    unsigned long i, n;
+    struct logstore_entry *e;
+
+    if (ls->num_buckets == 0)
+        return NULL;
+
+    i = name_hash(name) & (ls->num_buckets - 1);
+    for (n = 0; n < ls->num_buckets; n++) {
+        e = &ls->entries[i];
+        if (e->state == LOGSTORE_ENTRY_FREE)
+            return NULL;
+        if (e->state == LOGSTORE_ENTRY_USED &&
+            memcmp(e->name, name, LOGSTORE_NAME_LEN) == 0)
+            return e;
+        i = (i + 1) & (ls->num_buckets - 1);
+    }
+    return NULL;
+}
+
+static struct logstore_entry *index_slot(struct logstore_entry *entries,
+                                         unsigned long num_buckets,
+                                         const CK_BYTE *name)
+{
+    unsigned long i;
+
+    i = name_hash(name) & (num_buckets - 1);
+    while (entries[i].state == LOGSTORE_ENTRY_USED)
+        i = (i + 1) & (num_buckets - 1);
+    return &entries[i];
+}
+
+static CK_RV index_grow(logstore_t *ls)
+{
+    struct logstore_entry *entries, *e;
+    unsigned long i, num_buckets;
+
+    num_buckets = ls->num_buckets == 0 ? 64 : ls->num_buckets;
+    while ((ls->num_entries + 1) * 2 > num_buckets)
+        num_buckets *= 2;
+
+    entries = calloc(num_buckets, sizeof(*entries));
+    if (entries == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        return CKR_HOST_MEMORY;
+    }
+
+    for (i = 0; i < ls->num_buckets; i++) {
+        if (ls->entries[i].state != LOGSTORE_ENTRY_USED)
+            continue;
+        e = index_slot(entries, num_buckets, ls->entries[i].name);
+        *e = ls->entries[i];
+    }
+
+    free(ls->entries);
+    ls->entries = entries;
+    ls->num_buckets = num_buckets;
+    ls->num_deleted = 0;
+    return CKR_OK;
+}
+
+static CK_RV index_put(logstore_t *ls, const CK_BYTE *name,
+                       uint64_t off, uint32_t len)
+{
+    struct logstore_entry *e;
+    CK_RV rc;
+
+    e = index_find(ls, name);
+    if (e != NULL) {
+        ls->live -= LOGSTORE_REC_SIZE(e->len);
+    } else {
+        if ((ls->num_entries + ls->num_deleted + 1) * 4 >
+                                                    ls->num_buckets * 3) {
+            rc = index_grow(ls);
+            if (rc != CKR_OK)
+                return rc;
+        }
+
+        e = index_slot(ls->entries, ls->num_buckets, name);
+        if (e->state == LOGSTORE_ENTRY_DELETED)
+            ls->num_deleted--;
+        memcpy(e->name, name, LOGSTORE_NAME_LEN);
+        e->state = LOGSTORE_ENTRY_USED;
+        ls->num_entries++;
+    }
+
+    e->off = off;
+    e->len = len;
+    ls->live += LOGSTORE_REC_SIZE(len);
+    return CKR_OK;
+}
+
+static void index_del(logstore_t *ls, const CK_BYTE *name)
+{
+    struct logstore_entry *e;
+
+    e = index_find(ls, name);
+    if (e == NULL)
+        return;
+
+    ls->live -= LOGSTORE_REC_SIZE(e->len);
+    e->state = LOGSTORE_ENTRY_DELETED;
+    ls->num_entries--;
+    ls->num_deleted++;
+}
+
+static int entry_cmp_off(const void *a, const void *b)
+{
+    const struct logstore_entry *e1 = *(struct logstore_entry * const *)a;
+    const struct logstore_entry *e2 = *(struct logstore_entry * const *)b;
+
+    return e1->off < e2->off ? -1 : e1->off > e2->off;
+}
+
+/* Returns the entries of the index in the order of the log */
+static CK_RV index_sorted(logstore_t *ls, struct logstore_entry ***sorted)
+{
+    struct logstore_entry **list;
+    unsigned long i, n = 0;
+
+    *sorted = NULL;
+    if (ls->num_entries == 0)
+        return CKR_OK;
+
+    list = malloc(ls->num_entries * sizeof(*list));
+    if (list == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        return CKR_HOST_MEMORY;
+    }
+
+    for (i = 0; i < ls->num_buckets; i++) {
+        if (ls->entries[i].state == LOGSTORE_ENTRY_USED)
+            list[n++] = &ls->entries[i];
+    }
+    qsort(list, n, sizeof(*list), entry_cmp_off);
+
+    *sorted = list;
+    return CKR_OK;
+}
+
+static void logstore_unmap(logstore_t *ls)
+{
+    if (ls->map != NULL)
+        munmap(ls->map, ls->map_len);
+    ls->map = NULL;
+    ls->map_len = 0;
+}
+
+static void logstore_reset(logstore_t *ls)
+{
+    logstore_unmap(ls);
+    if (ls->fd >= 0)
+        close(ls->fd);
+    ls->fd = -1;
+    ls->dev = 0;
+    ls->ino = 0;
+    ls->end = 0;
+    ls->scanned = 0;
+    ls->live = 0;
+    if (ls->entries != NULL)
+        memset(ls->entries, 0, ls->num_buckets * sizeof(*ls->entries));
+    ls->num_entries = 0;
+    ls->num_deleted = 0;
+    ls->unsynced = 0;
+}
+
+/* Makes sure that the first @size bytes of the file are mapped */
+static CK_RV logstore_map(logstore_t *ls, uint64_t size)
+{
+    void *map;
+
+    if (size <= ls->map_len)
+        return CKR_OK;
+
+    logstore_unmap(ls);
+
+    map = mmap(NULL, size, PROT_READ, MAP_SHARED, ls->fd, 0);
+    if (map == MAP_FAILED) {
+        TRACE_ERROR("mmap(%s): %s\n", ls->path, strerror(errno));
+        return CKR_FUNCTION_FAILED;
+    }
+
+    ls->map = map;
+    ls->map_len = size;
+    return CKR_OK;
+}
+
+/* Adds the records between the last valid record and @size to the index */
+static CK_RV logstore_scan(logstore_t *ls, uint64_t size)
+{
+    const unsigned char *p;
+    uint64_t off;
+    uint32_t magic, len, crc;
+    CK_RV rc;
+
+    ls->scanned = size;
+    if (size < LOGSTORE_HDR_LEN)
+        return CKR_OK;
+
+    rc = logstore_map(ls, size);
+    if (rc != CKR_OK)
+        return rc;
+
+    if (ls->end == 0) {
+        memcpy(&magic, ls->map + 8, 4);
+        if (memcmp(ls->map, LOGSTORE_MAGIC, 8) != 0 ||
+            be32toh(magic) != LOGSTORE_FORMAT) {
+            TRACE_ERROR("%s is not a token object log\n", ls->path);
+            return CKR_FUNCTION_FAILED;
+        }
+        ls->end = LOGSTORE_HDR_LEN;
+    }
+
+    for (off = ls->end; off + LOGSTORE_REC_HDR_LEN <= size;
+         off += LOGSTORE_REC_SIZE(len)) {
+        p = ls->map + off;
+
+        memcpy(&magic, p, 4);
+        memcpy(&len, p + 16, 4);
+        memcpy(&crc, p + 20, 4);
+        len = be32toh(len);
+        if (be32toh(magic) != LOGSTORE_REC_MAGIC ||
+            len > size - off - LOGSTORE_REC_HDR_LEN ||
+            LOGSTORE_REC_SIZE(len) > size - off ||
+            record_crc(p, p + LOGSTORE_REC_HDR_LEN, len) != be32toh(crc))
+            break;
+
+        if (p[4] == LOGSTORE_REC_PUT) {
+            rc = index_put(ls, p + 8, off, len);
+            if (rc != CKR_OK)
+                return rc;
+        } else if (p[4] == LOGSTORE_REC_DEL) {
+            index_del(ls, p + 8);
+        } else {
+            break;
+        }
+    }
+
+    if (off < size)
+        TRACE_WARNING("Ignoring %lu bytes of incomplete records at the end of "
+                   "%s\n", (unsigned long)(size - off), ls->path);
+
+    ls->end = off;
+    return CKR_OK;
+}
+
+/* Picks up records appended, or a compaction done, by other processes */
+static CK_RV logstore_refresh(logstore_t *ls)
+{
+    struct stat sb;
+
+    if (stat(ls->path, &sb) != 0) {
+        if (errno != ENOENT) {
+            TRACE_ERROR("stat(%s): %s\n", ls->path, strerror(errno));
+            return CKR_FUNCTION_FAILED;
+        }
+        /* The store was removed, e.g. by C_InitToken */
+        if (ls->fd >= 0)
+            logstore_reset(ls);
+        return CKR_OK;
+    }
+
+    if (ls->fd >= 0 && sb.st_dev == ls->dev && sb.st_ino == ls->ino &&
+        (uint64_t)sb.st_size >= ls->scanned) {
+        if ((uint64_t)sb.st_size == ls->scanned)
+            return CKR_OK;
+        return logstore_scan(ls, sb.st_size);
+    }
+
+    logstore_reset(ls);
+
+    ls->fd = open(ls->path, O_RDWR | O_CLOEXEC);
+    if (ls->fd < 0 || fstat(ls->fd, &sb) != 0) {
+        TRACE_ERROR("open(%s): %s\n", ls->path, strerror(errno));
+        logstore_reset(ls);
+        return CKR_FUNCTION_FAILED;
+    }
+    ls->dev = sb.st_dev;
+    ls->ino = sb.st_ino;
+
+    return logstore_scan(ls, sb.st_size);
+}
+
+static CK_RV write_full(int fd, const unsigned char *buf, size_t len,
+                        uint64_t off)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = pwrite(fd, buf, len, off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            TRACE_ERROR("pwrite: %s\n", strerror(errno));
+            return CKR_FUNCTION_FAILED;
+        }
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return CKR_OK;
+}
+
+static void sync_dir(const char *path)
+{
+    char dir[PATH_MAX], *p;
+    int fd;
+
+    if (strlen(path) >= sizeof(dir))
+        return;
+    strcpy(dir, path);
+    p = strrchr(dir, '/');
+    if (p == NULL)
+        strcpy(dir, ".");
+    else if (p == dir)
+        p[1] = '\0';
+    else
+        *p = '\0';
+
+    fd = open(dir, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    if (fsync(fd) != 0)
+        TRACE_DEVEL("fsync(%s): %s\n", dir, strerror(errno));
+    close(fd);
+}
+
+static CK_RV write_header(int fd)
+{
+    unsigned char hdr[LOGSTORE_HDR_LEN];
+    uint32_t tmp;
+
+    memcpy(hdr, LOGSTORE_MAGIC, 8);
+    tmp = htobe32(LOGSTORE_FORMAT);
+    memcpy(hdr + 8, &tmp, 4);
+    memset(hdr + 12, 0, 4);
+
+    return write_full(fd, hdr, sizeof(hdr), 0);
+}
+
+static CK_RV logstore_create(logstore_t *ls)
+{
+    struct stat sb;
+    CK_RV rc;
+
+    if (ls->fd < 0) {
+        ls->fd = open(ls->path, O_RDWR | O_CREAT | O_CLOEXEC,
+                      S_IRUSR | S_IWUSR);
+        if (ls->fd < 0 || fstat(ls->fd, &sb) != 0) {
+            TRACE_ERROR("open(%s): %s\n", ls->path, strerror(errno));
+            logstore_reset(ls);
+            return CKR_FUNCTION_FAILED;
+        }
+        ls->dev = sb.st_dev;
+        ls->ino = sb.st_ino;
+        if (ls->set_perm != NULL)
+            ls->set_perm(ls->fd);
+    }
+
+    if (ftruncate(ls->fd, 0) != 0) {
+        TRACE_ERROR("ftruncate(%s): %s\n", ls->path, strerror(errno));
+        return CKR_FUNCTION_FAILED;
+    }
+
+    rc = write_header(ls->fd);
+    if (rc != CKR_OK)
+        return rc;
+
+    if (fdatasync(ls->fd) != 0) {
+        TRACE_ERROR("fdatasync(%s): %s\n", ls->path, strerror(errno));
+        return CKR_FUNCTION_FAILED;
+    }
+    sync_dir(ls->path);
+
+    ls->end = LOGSTORE_HDR_LEN;
+    ls->scanned = LOGSTORE_HDR_LEN;
+    return CKR_OK;
+}
+
+static CK_RV logstore_append(logstore_t *ls, uint8_t type, const CK_BYTE *name,
+                             const CK_BYTE *data, uint32_t len, uint64_t *off)
+{
+    unsigned char *rec;
+    uint64_t size = LOGSTORE_REC_SIZE(len);
+    uint32_t tmp;
+    CK_RV rc;
+
+    if (ls->fd < 0 || ls->end == 0) {
+        rc = logstore_create(ls);
+        if (rc != CKR_OK)
+            return rc;
+    }
+
+    /* Drop an incomplete record left by a crash */
+    if (ls->scanned > ls->end) {
+        if (ftruncate(ls->fd, ls->end) != 0) {
+            TRACE_ERROR("ftruncate(%s): %s\n", ls->path, strerror(errno));
+            return CKR_FUNCTION_FAILED;
+        }
+        ls->scanned = ls->end;
+    }
+
+    rec = calloc(1, size);
+    if (rec == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        return CKR_HOST_MEMORY;
+    }
+
+    tmp = htobe32(LOGSTORE_REC_MAGIC);
+    memcpy(rec, &tmp, 4);
+    rec[4] = type;
+    memcpy(rec + 8, name, LOGSTORE_NAME_LEN);
+    tmp = htobe32(len);
+    memcpy(rec + 16, &tmp, 4);
+    if (len > 0)
+        memcpy(rec + LOGSTORE_REC_HDR_LEN, data, len);
+    tmp = htobe32(record_crc(rec, rec + LOGSTORE_REC_HDR_LEN, len));
+    memcpy(rec + 20, &tmp, 4);
+
+    rc = write_full(ls->fd, rec, size, ls->end);
+    free(rec);
+    if (rc != CKR_OK) {
+        TRACE_ERROR("Failed to append to %s\n", ls->path);
+        if (ftruncate(ls->fd, ls->end) != 0)
+            TRACE_DEVEL("ftruncate(%s): %s\n", ls->path, strerror(errno));
+        return rc;
+    }
+
+    *off = ls->end;
+    ls->end += size;
+    ls->scanned = ls->end;
+    ls->unsynced++;
+    return CKR_OK;
+}
+
+static CK_RV logstore_sync_locked(logstore_t *ls)
+{
+    if (ls->fd < 0 || ls->unsynced == 0)
+        return CKR_OK;
+
+    if (fdatasync(ls->fd) != 0) {
+        TRACE_ERROR("fdatasync(%s): %s\n", ls->path, strerror(errno));
+        return CKR_FUNCTION_FAILED;
+    }
+
+    ls->unsynced = 0;
+    ls->last_sync = time(NULL);
+    return CKR_OK;
+}
+
+static CK_RV logstore_compact_locked(logstore_t *ls)
+{
+    struct logstore_entry **sorted = NULL;
+    unsigned char *buf = NULL;
+    char tmp_path[PATH_MAX];
+    uint64_t *offs = NULL, off, size;
+    unsigned long i, n = ls->num_entries, fill = 0;
+    struct stat sb;
+    int fd = -1;
+    CK_RV rc;
+
+    if (ls->fd < 0 || ls->end <= LOGSTORE_HDR_LEN)
+        return CKR_OK;
+
+    if ((size_t)snprintf(tmp_path, sizeof(tmp_path), "%s.TMP",
+                         ls->path) >= sizeof(tmp_path)) {
+        TRACE_ERROR("buffer overflow for path %s\n", ls->path);
+        return CKR_FUNCTION_FAILED;
+    }
+
+    rc = index_sorted(ls, &sorted);
+    if (rc != CKR_OK)
+        return rc;
+
+    rc = logstore_map(ls, ls->end);
+    if (rc != CKR_OK)
+        goto done;
+
+    buf = malloc(LOGSTORE_COPY_BUF_SIZE);
+    offs = malloc((n + 1) * sizeof(*offs));
+    if (buf == NULL || offs == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        rc = CKR_HOST_MEMORY;
+        goto done;
+    }
+
+    fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+              S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        TRACE_ERROR("open(%s): %s\n", tmp_path, strerror(errno));
+        rc = CKR_FUNCTION_FAILED;
+        goto done;
+    }
+    if (ls->set_perm != NULL)
+        ls->set_perm(fd);
+
+    rc = write_header(fd);
+    if (rc != CKR_OK)
+        goto done;
+
+    /* Copy the live records unchanged, their CRCs do not cover the offset */
+    off = LOGSTORE_HDR_LEN;
+    for (i = 0; i < n; i++) {
+        size = LOGSTORE_REC_SIZE(sorted[i]->len);
+        if (fill + size > LOGSTORE_COPY_BUF_SIZE) {
+            rc = write_full(fd, buf, fill, off - fill);
+            if (rc != CKR_OK)
+                goto done;
+            fill = 0;
+        }
+
+        offs[i] = off;
+        if (size > LOGSTORE_COPY_BUF_SIZE) {
+            rc = write_full(fd, ls->map + sorted[i]->off, size, off);
+            if (rc != CKR_OK)
+                goto done;
+        } else {
+            memcpy(buf + fill, ls->map + sorted[i]->off, size);
+            fill += size;
+        }
+        off += size;
+    }
+    if (fill > 0) {
+        rc = write_full(fd, buf, fill, off - fill);
+        if (rc != CKR_OK)
+            goto done;
+    }
+
+    if (fdatasync(fd) != 0 || fstat(fd, &sb) != 0) {
+        TRACE_ERROR("fdatasync(%s): %s\n", tmp_path, strerror(errno));
+        rc = CKR_FUNCTION_FAILED;
+        goto done;
+    }
+
+    if (rename(tmp_path, ls->path) != 0) {
+        TRACE_ERROR("rename(%s): %s\n", tmp_path, strerror(errno));
+        rc = CKR_FUNCTION_FAILED;
+        goto done;
+    }
+    sync_dir(ls->path);
+
+    TRACE_DEVEL("Compacted %s from %lu to %lu bytes\n", ls->path,
+                (unsigned long)ls->end, (unsigned long)off);
+
+    logstore_unmap(ls);
+    close(ls->fd);
+    ls->fd = fd;
+    fd = -1;
+    ls->dev = sb.st_dev;
+    ls->ino = sb.st_ino;
+    ls->end = off;
+    ls->scanned = off;
+    ls->live = off - LOGSTORE_HDR_LEN;
+    ls->unsynced = 0;
+    ls->last_sync = time(NULL);
+    for (i = 0; i < n; i++)
+        sorted[i]->off = offs[i];
+
+done:
+    if (fd >= 0) {
+        close(fd);
+        unlink(tmp_path);
+    }
+    free(offs);
+    free(buf);
+    free(sorted);
+    return rc;
+}
+
+/* Syncs and compacts the store as needed after an append */
+static CK_RV logstore_commit(logstore_t *ls)
+{
+    CK_RV rc;
+
+    if (ls->unsynced >= LOGSTORE_SYNC_RECORDS ||
+        time(NULL) - ls->last_sync >= LOGSTORE_SYNC_INTERVAL) {
+        rc = logstore_sync_locked(ls);
+        if (rc != CKR_OK)
+            return rc;
+    }
+
+    if (ls->end >= LOGSTORE_COMPACT_MIN &&
+        ls->end - LOGSTORE_HDR_LEN > 2 * ls->live) {
+        /* The store stays usable without compaction */
+        if (logstore_compact_locked(ls) != CKR_OK)
+            TRACE_WARNING("Failed to compact %s\n", ls->path);
+    }
+
+    return CKR_OK;
+}
+
+CK_RV logstore_open(const char *path, void (*set_perm)(int fd),
+                    logstore_t **ls)
+{
+    logstore_t *new;
+    CK_RV rc;
+
+    pthread_once(&crc_table_once, crc_table_init);
+
+    new = calloc(1, sizeof(*new));
+    if (new == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        return CKR_HOST_MEMORY;
+    }
+
+    new->path = strdup(path);
+    if (new->path == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        free(new);
+        return CKR_HOST_MEMORY;
+    }
+
+    pthread_mutex_init(&new->mutex, NULL);
+    new->fd = -1;
+    new->set_perm = set_perm;
+    new->last_sync = time(NULL);
+    new->seed = (uint64_t)new->last_sync ^ ((uint64_t)getpid() << 32) ^
+                (uint64_t)(uintptr_t)new;
+
+    /* The file is created with the first record, if it does not exist */
+    rc = logstore_refresh(new);
+    if (rc != CKR_OK) {
+        logstore_close(new);
+        return rc;
+    }
+
+    *ls = new;
+    return CKR_OK;
+}
+
+void logstore_close(logstore_t *ls)
+{
+    if (ls == NULL)
+        return;
+
+    logstore_sync_locked(ls);
+    logstore_reset(ls);
+    pthread_mutex_destroy(&ls->mutex);
+    free(ls->entries);
+    free(ls->path);
+    free(ls);
+}
+
+CK_RV logstore_put(logstore_t *ls, const CK_BYTE *name,
+                   const CK_BYTE *data, CK_ULONG len)
+{
+    uint64_t off;
+    CK_RV rc;
+
+    if (len > UINT32_MAX - 2 * LOGSTORE_REC_HDR_LEN) {
+        TRACE_ERROR("Record of %lu bytes is too large\n", len);
+        return CKR_FUNCTION_FAILED;
+    }
+
+    pthread_mutex_lock(&ls->mutex);
+
+    rc = logstore_refresh(ls);
+    if (rc != CKR_OK)
+        goto done;
+
+    rc = logstore_append(ls, LOGSTORE_REC_PUT, name, data, len, &off);
+    if (rc != CKR_OK)
+        goto done;
+
+    rc = index_put(ls, name, off, len);
+    if (rc != CKR_OK) {
+        /* Re-read the store to get the index in line with the file again */
+        logstore_reset(ls);
+        goto done;
+    }
+
+    rc = logstore_commit(ls);
+
+done:
+    pthread_mutex_unlock(&ls->mutex);
+    return rc;
+}
+
+CK_RV logstore_delete(logstore_t *ls, const CK_BYTE *name)
+{
+    uint64_t off;
+    CK_RV rc;
+
+    pthread_mutex_lock(&ls->mutex);
+
+    rc = logstore_refresh(ls);
+    if (rc != CKR_OK || index_find(ls, name) == NULL)
+        goto done;
+
+    rc = logstore_append(ls, LOGSTORE_REC_DEL, name, NULL, 0, &off);
+    if (rc != CKR_OK)
+        goto done;
+
+    index_del(ls, name);
+
+    rc = logstore_commit(ls);
+
+done:
+    pthread_mutex_unlock(&ls->mutex);
+    return rc;
+}
+
+/*
+ * Returns a copy of the data of the latest record of object @name, or NULL
+ * if there is no such object.
+ */
+CK_RV logstore_get(logstore_t *ls, const CK_BYTE *name,
+                   CK_BYTE **data, CK_ULONG *len)
+{
+    struct logstore_entry *e;
+    CK_RV rc;
+
+    *data = NULL;
+    *len = 0;
+
+    pthread_mutex_lock(&ls->mutex);
+
+    rc = logstore_refresh(ls);
+    if (rc != CKR_OK)
+        goto done;
+
+    e = index_find(ls, name);
+    if (e == NULL)
+        goto done;
+
+    rc = logstore_map(ls, ls->end);
+    if (rc != CKR_OK)
+        goto done;
+
+    *data = malloc(e->len > 0 ? e->len : 1);
+    if (*data == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        rc = CKR_HOST_MEMORY;
+        goto done;
+    }
+    memcpy(*data, ls->map + e->off + LOGSTORE_REC_HDR_LEN, e->len);
+    *len = e->len;
+
+done:
+    pthread_mutex_unlock(&ls->mutex);
+    return rc;
+}
+
+/*
+ * Returns the names of all objects, LOGSTORE_NAME_LEN bytes each, in the
+ * order of their latest records. The caller must free @names.
+ */
+CK_RV logstore_names(logstore_t *ls, CK_BYTE **names, CK_ULONG *num)
+{
+    struct logstore_entry **sorted = NULL;
+    unsigned long i;
+    CK_RV rc;
+
+    *names = NULL;
+    *num = 0;
+
+    pthread_mutex_lock(&ls->mutex);
+
+    rc = logstore_refresh(ls);
+    if (rc != CKR_OK)
+        goto done;
+
+    rc = index_sorted(ls, &sorted);
+    if (rc != CKR_OK || sorted == NULL)
+        goto done;
+
+    *names = malloc(ls->num_entries * LOGSTORE_NAME_LEN);
+    if (*names == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        rc = CKR_HOST_MEMORY;
+        goto done;
+    }
+
+    for (i = 0; i < ls->num_entries; i++)
+        memcpy(*names + i * LOGSTORE_NAME_LEN, sorted[i]->name,
+               LOGSTORE_NAME_LEN);
+    *num = ls->num_entries;
+
+done:
+    pthread_mutex_unlock(&ls->mutex);
+    free(sorted);
+    return rc;
+}
+
+/*
+ * Calls @cb for all objects in the order of their latest records. The data
+ * passed to @cb points into the mapped file, and is only valid during the
+ * call. The callback must not call any other logstore function on @ls.
+ * Iteration stops at the first callback not returning CKR_OK.
+ */
+CK_RV logstore_iterate(logstore_t *ls, logstore_iterate_cb cb, void *private)
+{
+    struct logstore_entry **sorted = NULL;
+    unsigned long i;
+    CK_RV rc;
+
+    pthread_mutex_lock(&ls->mutex);
+
+    rc = logstore_refresh(ls);
+    if (rc != CKR_OK)
+        goto done;
+
+    rc = index_sorted(ls, &sorted);
+    if (rc != CKR_OK || sorted == NULL)
+        goto done;
+
+    rc = logstore_map(ls, ls->end);
+    if (rc != CKR_OK)
+        goto done;
+
+    for (i = 0; i < ls->num_entries && rc == CKR_OK; i++)
+        rc = cb(sorted[i]->name,
+                ls->map + sorted[i]->off + LOGSTORE_REC_HDR_LEN,
+                sorted[i]->len, private);
+
+done:
+    pthread_mutex_unlock(&ls->mutex);
+    free(sorted);
+    return rc;
+}
+
+/*
+ * Generates an object name of the form OBxxxxxx that is not used in the
+ * store. The token lock must be held until the object has been put.
+ */
+CK_RV logstore_new_name(logstore_t *ls, CK_BYTE *name)
+{
+    static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                "abcdefghijklmnopqrstuvwxyz0123456789";
+    uint64_t x;
+    int i;
+    CK_RV rc;
+
+    pthread_mutex_lock(&ls->mutex);
+
+    rc = logstore_refresh(ls);
+    if (rc != CKR_OK)
+        goto done;
+
+    do {
+        /* xorshift64 */
+        x = ls->seed;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        ls->seed = x;
+
+        name[0] = 'O';
+        name[1] = 'B';
+        for (i = 2; i < LOGSTORE_NAME_LEN; i++, x >>= 6)
+            name[i] = chars[(x & 0x3f) % (sizeof(chars) - 1)];
+    } while (index_find(ls, name) != NULL);
+
+done:
+    pthread_mutex_unlock(&ls->mutex);
+    return rc;
+}
+
+CK_RV logstore_sync(logstore_t *ls)
+{
+    CK_RV rc;
+
+    pthread_mutex_lock(&ls->mutex);
+    rc = logstore_sync_locked(ls);
+    pthread_mutex_unlock(&ls->mutex);
+    return rc;
+}
+
+CK_RV logstore_compact(logstore_t *ls)
+{
+    CK_RV rc;
+
+    pthread_mutex_lock(&ls->mutex);
+
+    rc = logstore_refresh(ls);
+    if (rc == CKR_OK)
+        rc = logstore_compact_locked(ls);
+
+    pthread_mutex_unlock(&ls->mutex);
+    return rc;
+}
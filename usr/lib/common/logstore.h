@@ -0,0 +1,52 @@
+/*
+ * COPYRIGHT (c) International Business Machines Corp. 2026
+ *
+ * This program is provided under the terms of the Common Public License,
+ * version 1.0 (CPL-1.0). Any use, reproduction or distribution for this
+ * software constitutes recipient's acceptance of CPL-1.0 terms which can be
+ * found in the file LICENSE file or at
+ * https://opensource.org/licenses/cpl1.0.php
+ */
+
+#ifndef __LOGSTORE_H
+#define __LOGSTORE_H
+
+#include "pkcs11types.h"
+
+/*
+ * Log-structured token object store: all token objects of a token are kept
+ * in one append-only segment file. Every change of an object appends a
+ * checksummed record, a per process index maps the object names to the
+ * offsets of their latest records, and records are read through a shared
+ * mapping of the file.
+ *
+ * The store does not do any locking between processes. All functions must be
+ * called with the token lock (XProcLock) held, which also makes the store
+ * pick up changes done by other processes.
+ */
+
+#define LOGSTORE_NAME_LEN   8
+
+typedef struct logstore logstore_t;
+
+typedef CK_RV (*logstore_iterate_cb)(const CK_BYTE *name,
+                                     const CK_BYTE *data, CK_ULONG len,
+                                     void *private);
+
+CK_RV logstore_open(const char *path, void (*set_perm)(int fd),
+                    logstore_t **ls);
+void logstore_close(logstore_t *ls);
+
+CK_RV logstore_put(logstore_t *ls, const CK_BYTE *name,
+                   const CK_BYTE *data, CK_ULONG len);
+CK_RV logstore_delete(logstore_t *ls, const CK_BYTE *name);
+CK_RV logstore_get(logstore_t *ls, const CK_BYTE *name,
+                   CK_BYTE **data, CK_ULONG *len);
+CK_RV logstore_names(logstore_t *ls, CK_BYTE **names, CK_ULONG *num);
+CK_RV logstore_iterate(logstore_t *ls, logstore_iterate_cb cb, void *private);
+CK_RV logstore_new_name(logstore_t *ls, CK_BYTE *name);
+
+CK_RV logstore_sync(logstore_t *ls);
+CK_RV logstore_compact(logstore_t *ls);
+
+#endif                          /* __LOGSTORE_H */
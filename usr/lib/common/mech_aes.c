@@ -284,7 +284,7 @@ CK_RV aes_cbc_pad_encrypt(STDLL_TokData_t *tokdata,
         goto done;
     }
 
-    clear = (CK_BYTE *) malloc(padded_len);
+    clear = session_mgr_op_alloc(sess, ctx, padded_len);
     if (!clear) {
         TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
         rc = CKR_HOST_MEMORY;
@@ -299,7 +299,7 @@ CK_RV aes_cbc_pad_encrypt(STDLL_TokData_t *tokdata,
     rc = ckm_aes_cbc_encrypt(tokdata, sess, clear, padded_len, out_data, out_data_len,
                              ctx->mech.pParameter, key);
 
-    free(clear);
+    session_mgr_op_free(sess, clear, padded_len);
 
 done:
     object_put(tokdata, key, TRUE);
@@ -357,7 +357,7 @@ CK_RV aes_cbc_pad_decrypt(STDLL_TokData_t *tokdata,
         goto done;
     }
 
-    clear = (CK_BYTE *) malloc(padded_len);
+    clear = session_mgr_op_alloc(sess, ctx, padded_len);
     if (!clear) {
         TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
         rc = CKR_HOST_MEMORY;
@@ -371,7 +371,7 @@ CK_RV aes_cbc_pad_decrypt(STDLL_TokData_t *tokdata,
         memcpy(out_data, clear, *out_data_len);
     }
 
-    free(clear);
+    session_mgr_op_free(sess, clear, in_data_len);
 
 done:
     object_put(tokdata, key, TRUE);
@@ -567,105 +567,162 @@ CK_RV aes_xts_decrypt(STDLL_TokData_t *tokdata,
                          in_data, in_data_len, out_data, out_data_len);
 }
 
+static void aes_cipher_cleanup(STDLL_TokData_t *tokdata, SESSION *sess,
+                               CK_BYTE *context, CK_ULONG context_len)
+{
+    if (((AES_CONTEXT *)context)->cipher_ctx != NULL) {
+        token_specific.t_cipher_update(tokdata, 0, NULL, 0, NULL, NULL, NULL,
+                                       0, CK_TRUE,
+                                       &((AES_CONTEXT *)context)->cipher_ctx);
+        ((AES_CONTEXT *)context)->cipher_ctx = NULL;
+    }
+
+    session_mgr_op_free(sess, context, context_len);
+}
+
 //
+// Encrypts or decrypts a multiple of the block size for a multi-part
+// operation and updates the IV (or counter block) in the mechanism parameter.
+// If the token provides t_cipher_update, its cipher context is kept in the
+// AES context for the whole operation, so that the key is expanded only once.
 //
-CK_RV aes_ecb_encrypt_update(STDLL_TokData_t *tokdata,
-                             SESSION *sess,
-                             CK_BBOOL length_only,
-                             ENCR_DECR_CONTEXT *ctx,
-                             CK_BYTE *in_data,
-                             CK_ULONG in_data_len,
-                             CK_BYTE *out_data, CK_ULONG *out_data_len)
+static CK_RV aes_crypt_blocks(STDLL_TokData_t *tokdata,
+                              SESSION *sess,
+                              ENCR_DECR_CONTEXT *ctx,
+                              OBJECT *key,
+                              CK_BYTE *in_data,
+                              CK_ULONG in_data_len,
+                              CK_BYTE *out_data, CK_BYTE encrypt)
 {
-    AES_CONTEXT *context = NULL;
-    OBJECT *key = NULL;
-    CK_BYTE *clear = NULL;
-    CK_ULONG total, remain, out_len;
+    AES_CONTEXT *context = (AES_CONTEXT *) ctx->context;
+    CK_AES_CTR_PARAMS *aesctr = NULL;
+    CK_BYTE iv[AES_BLOCK_SIZE];
+    CK_ULONG out_len = in_data_len;
     CK_RV rc;
 
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad arguments\n", __func__);
-        return CKR_FUNCTION_FAILED;
+    switch (ctx->mech.mechanism) {
+    case CKM_AES_CTR:
+        // the counter block handling is left to the single-part function
+        aesctr = (CK_AES_CTR_PARAMS *) ctx->mech.pParameter;
+        if (encrypt)
+            return ckm_aes_ctr_encrypt(tokdata, in_data, in_data_len,
+                                       out_data, &out_len,
+                                       (CK_BYTE *) aesctr->cb,
+                                       (CK_ULONG) aesctr->ulCounterBits, key);
+        return ckm_aes_ctr_decrypt(tokdata, in_data, in_data_len,
+                                   out_data, &out_len,
+                                   (CK_BYTE *) aesctr->cb,
+                                   (CK_ULONG) aesctr->ulCounterBits, key);
+    case CKM_AES_ECB:
+    case CKM_AES_CBC:
+    case CKM_AES_CBC_PAD:
+    case CKM_AES_OFB:
+    case CKM_AES_CFB8:
+    case CKM_AES_CFB64:
+    case CKM_AES_CFB128:
+        break;
+    default:
+        TRACE_ERROR("%s\n", ock_err(ERR_MECHANISM_INVALID));
+        return CKR_MECHANISM_INVALID;
     }
-    context = (AES_CONTEXT *) ctx->context;
-
-    total = (context->len + in_data_len);
 
-    if (total < AES_BLOCK_SIZE) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        // we have at least 1 block
-        //
-        remain = (total % AES_BLOCK_SIZE);
-        out_len = (total - remain);     // should always be at least 1 block
-
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-
-        rc = object_mgr_find_in_map_nocache(tokdata, ctx->key, &key, READ_LOCK);
+    if (token_specific.t_cipher_update != NULL) {
+        rc = token_specific.t_cipher_update(tokdata, ctx->mech.mechanism,
+                                            in_data, in_data_len, out_data,
+                                            key,
+                                            ctx->mech.mechanism == CKM_AES_ECB ?
+                                                NULL : ctx->mech.pParameter,
+                                            encrypt, CK_FALSE,
+                                            &context->cipher_ctx);
         if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
+            TRACE_DEVEL("Token specific cipher update failed.\n");
             return rc;
         }
 
-        clear = (CK_BYTE *) malloc(out_len);
-        if (!clear) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            object_put(tokdata, key, TRUE);
-            key = NULL;
-            return CKR_HOST_MEMORY;
-        }
-        // copy any data left over from the previous encryption operation first
-        //
-        memcpy(clear, context->data, context->len);
-        memcpy(clear + context->len, in_data, out_len - context->len);
+        if (context->cipher_ctx != NULL)
+            ctx->state_unsaveable = CK_TRUE;
 
-        rc = ckm_aes_ecb_encrypt(tokdata, sess, clear, out_len, out_data,
-                                 out_data_len, key);
-        if (rc == CKR_OK) {
-            *out_data_len = out_len;
+        ctx->context_free_func = aes_cipher_cleanup;
 
-            // update the context buffer.  we already used the buffer's current
-            // contents so we completely overwrite it
-            //
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-
-            context->len = remain;
-        }
-
-        free(clear);
-
-        object_put(tokdata, key, TRUE);
-        key = NULL;
+        return CKR_OK;
+    }
 
-        return rc;
+    switch (ctx->mech.mechanism) {
+    case CKM_AES_ECB:
+        if (encrypt)
+            rc = ckm_aes_ecb_encrypt(tokdata, sess, in_data, in_data_len,
+                                     out_data, &out_len, key);
+        else
+            rc = ckm_aes_ecb_decrypt(tokdata, sess, in_data, in_data_len,
+                                     out_data, &out_len, key);
+        break;
+    case CKM_AES_CBC:
+    case CKM_AES_CBC_PAD:
+        if (encrypt) {
+            rc = ckm_aes_cbc_encrypt(tokdata, sess, in_data, in_data_len,
+                                     out_data, &out_len,
+                                     ctx->mech.pParameter, key);
+            // the new init_v is the last encrypted data block
+            if (rc == CKR_OK)
+                memcpy(ctx->mech.pParameter,
+                       out_data + (in_data_len - AES_BLOCK_SIZE),
+                       AES_BLOCK_SIZE);
+        } else {
+            // the new init_v is the last input data block, which might
+            // get overwritten when decrypting in place
+            memcpy(iv, in_data + (in_data_len - AES_BLOCK_SIZE),
+                   AES_BLOCK_SIZE);
+            rc = ckm_aes_cbc_decrypt(tokdata, sess, in_data, in_data_len,
+                                     out_data, &out_len,
+                                     ctx->mech.pParameter, key);
+            if (rc == CKR_OK)
+                memcpy(ctx->mech.pParameter, iv, AES_BLOCK_SIZE);
+        }
+        break;
+    case CKM_AES_OFB:
+        rc = token_specific.t_aes_ofb(tokdata, in_data, in_data_len, out_data,
+                                      key, ctx->mech.pParameter, encrypt);
+        if (rc != CKR_OK)
+            TRACE_DEVEL("Token specific aes ofb failed.\n");
+        break;
+    default:
+        rc = token_specific.t_aes_cfb(tokdata, in_data, in_data_len, out_data,
+                                      key, ctx->mech.pParameter,
+                                      ctx->mech.mechanism == CKM_AES_CFB8 ? 1 :
+                                      ctx->mech.mechanism == CKM_AES_CFB64 ?
+                                                            8 : 16,
+                                      encrypt);
+        if (rc != CKR_OK)
+            TRACE_DEVEL("Token specific aes cfb failed.\n");
+        break;
     }
-}
 
+    return rc;
+}
 
 //
+// Common multi-part update for the block modes. Only a partial block (or,
+// with keep_last, the last block for the padding in the final call) is
+// staged in the context; everything else is processed directly from the
+// caller's input buffer into the caller's output buffer.
 //
-CK_RV aes_ecb_decrypt_update(STDLL_TokData_t *tokdata,
-                             SESSION *sess,
-                             CK_BBOOL length_only,
-                             ENCR_DECR_CONTEXT *ctx,
-                             CK_BYTE *in_data,
-                             CK_ULONG in_data_len,
-                             CK_BYTE *out_data, CK_ULONG *out_data_len)
+static CK_RV aes_crypt_update(STDLL_TokData_t *tokdata,
+                              SESSION *sess,
+                              CK_BBOOL length_only,
+                              ENCR_DECR_CONTEXT *ctx,
+                              CK_BYTE *in_data,
+                              CK_ULONG in_data_len,
+                              CK_BYTE *out_data,
+                              CK_ULONG *out_data_len,
+                              CK_ULONG block_size,
+                              CK_BBOOL keep_last, CK_BYTE encrypt)
 {
     AES_CONTEXT *context = NULL;
     OBJECT *key = NULL;
-    CK_BYTE *cipher = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
+    CK_BYTE block[AES_BLOCK_SIZE], tail[AES_BLOCK_SIZE];
+    CK_BYTE *buf = NULL;
+    CK_ULONG total, remain, out_len, fill;
+    CK_RV rc = CKR_OK;
 
     if (!sess || !ctx || !out_data_len) {
         TRACE_ERROR("%s received bad argument(s)\n", __func__);
@@ -675,7 +732,7 @@ CK_RV aes_ecb_decrypt_update(STDLL_TokData_t *tokdata,
 
     total = (context->len + in_data_len);
 
-    if (total < AES_BLOCK_SIZE) {
+    if (total < block_size || (keep_last && total == block_size)) {
         if (length_only == FALSE && in_data_len) {
             memcpy(context->data + context->len, in_data, in_data_len);
             context->len += in_data_len;
@@ -683,60 +740,95 @@ CK_RV aes_ecb_decrypt_update(STDLL_TokData_t *tokdata,
 
         *out_data_len = 0;
         return CKR_OK;
-    } else {
-        // we have at least 1 block
-        //
-        remain = (total % AES_BLOCK_SIZE);
-        out_len = total - remain;
+    }
 
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
+    // we have at least 1 block
+    //
+    remain = (total % block_size);
+    out_len = total - remain;
 
-        rc = object_mgr_find_in_map_nocache(tokdata, ctx->key, &key, READ_LOCK);
+    if (keep_last && remain == 0) {
+        remain = block_size;
+        out_len -= block_size;
+    }
+
+    if (length_only == TRUE) {
+        *out_data_len = out_len;
+        return CKR_OK;
+    }
+
+    if (*out_data_len < out_len) {
+        *out_data_len = out_len;
+        TRACE_ERROR("%s\n", ock_err(ERR_BUFFER_TOO_SMALL));
+        return CKR_BUFFER_TOO_SMALL;
+    }
+
+    // the key is not needed while the token's cipher context is alive
+    //
+    if (context->cipher_ctx == NULL) {
+        rc = object_mgr_find_in_map_nocache(tokdata, ctx->key, &key,
+                                            READ_LOCK);
         if (rc != CKR_OK) {
             TRACE_ERROR("Failed to find specified object.\n");
             return rc;
         }
+    }
 
-        cipher = (CK_BYTE *) malloc(out_len);
-        if (!cipher) {
+    // save the remaining 'new' input data, the output may overlap it
+    //
+    memcpy(tail, in_data + (in_data_len - remain), remain);
+
+    if (out_data < in_data + in_data_len && in_data < out_data + out_len &&
+        (out_data != in_data || context->len > 0)) {
+        // the output overlaps the input other than exactly in place, so
+        // the input needs to be staged
+        buf = session_mgr_op_alloc(sess, ctx, out_len);
+        if (!buf) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            object_put(tokdata, key, TRUE);
-            key = NULL;
-            return CKR_HOST_MEMORY;
+            rc = CKR_HOST_MEMORY;
+            goto done;
         }
-        // copy any data left over from the previous decryption operation first
-        //
-        memcpy(cipher, context->data, context->len);
-        memcpy(cipher + context->len, in_data, out_len - context->len);
+        memcpy(buf, context->data, context->len);
+        memcpy(buf + context->len, in_data, out_len - context->len);
 
-        rc = ckm_aes_ecb_decrypt(tokdata, sess, cipher, out_len, out_data,
-                                 out_data_len, key);
-        if (rc == CKR_OK) {
-            *out_data_len = out_len;
+        rc = aes_crypt_blocks(tokdata, sess, ctx, key, buf, out_len,
+                              out_data, encrypt);
+        session_mgr_op_free(sess, buf, out_len);
+    } else {
+        fill = 0;
+        if (context->len > 0) {
+            // complete the first block with the data left over from the
+            // previous call
+            fill = block_size - context->len;
+            memcpy(block, context->data, context->len);
+            memcpy(block + context->len, in_data, fill);
 
-            // copy the remaining 'new' input data to the context buffer
-            //
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-            context->len = remain;
+            rc = aes_crypt_blocks(tokdata, sess, ctx, key, block, block_size,
+                                  out_data, encrypt);
         }
+        if (rc == CKR_OK && out_len > context->len + fill)
+            rc = aes_crypt_blocks(tokdata, sess, ctx, key, in_data + fill,
+                                  out_len - context->len - fill,
+                                  out_data + context->len + fill, encrypt);
+    }
+
+    if (rc == CKR_OK) {
+        *out_data_len = out_len;
 
-        free(cipher);
+        memcpy(context->data, tail, remain);
+        context->len = remain;
+    }
 
+done:
+    if (key != NULL)
         object_put(tokdata, key, TRUE);
-        key = NULL;
 
-        return rc;
-    }
+    return rc;
 }
 
-
 //
 //
-CK_RV aes_cbc_encrypt_update(STDLL_TokData_t *tokdata,
+CK_RV aes_ecb_encrypt_update(STDLL_TokData_t *tokdata,
                              SESSION *sess,
                              CK_BBOOL length_only,
                              ENCR_DECR_CONTEXT *ctx,
@@ -744,90 +836,15 @@ CK_RV aes_cbc_encrypt_update(STDLL_TokData_t *tokdata,
                              CK_ULONG in_data_len,
                              CK_BYTE *out_data, CK_ULONG *out_data_len)
 {
-    AES_CONTEXT *context = NULL;
-    OBJECT *key = NULL;
-    CK_BYTE *clear = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
-
-
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-    context = (AES_CONTEXT *) ctx->context;
-
-    total = (context->len + in_data_len);
-
-    if (total < AES_BLOCK_SIZE) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        // we have at least 1 block
-        //
-        remain = (total % AES_BLOCK_SIZE);
-        out_len = total - remain;
-
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-
-        rc = object_mgr_find_in_map_nocache(tokdata, ctx->key, &key, READ_LOCK);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
-            return rc;
-        }
-        // these buffers need to be longword aligned
-        //
-        clear = (CK_BYTE *) malloc(out_len);
-        if (!clear) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            object_put(tokdata, key, TRUE);
-            key = NULL;
-            return CKR_HOST_MEMORY;
-        }
-        // copy any data left over from the previous encryption operation first
-        //
-        memcpy(clear, context->data, context->len);
-        memcpy(clear + context->len, in_data, out_len - context->len);
-
-        rc = ckm_aes_cbc_encrypt(tokdata, sess, clear, out_len, out_data,
-                                 out_data_len, ctx->mech.pParameter, key);
-
-        if (rc == CKR_OK) {
-            *out_data_len = out_len;
-
-            // the new init_v is the last encrypted data block
-            //
-            memcpy(ctx->mech.pParameter,
-                   out_data + (*out_data_len - AES_BLOCK_SIZE), AES_BLOCK_SIZE);
-
-            // copy the remaining 'new' input data to the context buffer
-            //
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-            context->len = remain;
-        }
-
-        free(clear);
-
-        object_put(tokdata, key, TRUE);
-        key = NULL;
-
-        return rc;
-    }
+    return aes_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                            in_data_len, out_data, out_data_len,
+                            AES_BLOCK_SIZE, FALSE, 1);
 }
 
 
 //
 //
-CK_RV aes_cbc_decrypt_update(STDLL_TokData_t *tokdata,
+CK_RV aes_ecb_decrypt_update(STDLL_TokData_t *tokdata,
                              SESSION *sess,
                              CK_BBOOL length_only,
                              ENCR_DECR_CONTEXT *ctx,
@@ -835,193 +852,47 @@ CK_RV aes_cbc_decrypt_update(STDLL_TokData_t *tokdata,
                              CK_ULONG in_data_len,
                              CK_BYTE *out_data, CK_ULONG *out_data_len)
 {
-    AES_CONTEXT *context = NULL;
-    OBJECT *key = NULL;
-    CK_BYTE *cipher = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
-
-
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-
-    context = (AES_CONTEXT *) ctx->context;
-
-    total = context->len + in_data_len;
-
-    if (total < AES_BLOCK_SIZE) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        // we have at least 1 block
-        //
-        remain = total % AES_BLOCK_SIZE;
-        out_len = total - remain;
-
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-
-        rc = object_mgr_find_in_map_nocache(tokdata, ctx->key, &key, READ_LOCK);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
-            return rc;
-        }
-        // these buffers need to be longword aligned
-        //
-        cipher = (CK_BYTE *) malloc(out_len);
-        if (!cipher) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            object_put(tokdata, key, TRUE);
-            key = NULL;
-            return CKR_HOST_MEMORY;
-        }
-        // copy any data left over from the previous decryption operation first
-        //
-        memcpy(cipher, context->data, context->len);
-        memcpy(cipher + context->len, in_data, out_len - context->len);
-
-        rc = ckm_aes_cbc_decrypt(tokdata, sess, cipher, out_len, out_data,
-                                 out_data_len, ctx->mech.pParameter, key);
-
-        if (rc == CKR_OK) {
-            *out_data_len = out_len;
-
-            // the new init_v is the last input data block
-            //
-            memcpy(ctx->mech.pParameter, cipher + (out_len - AES_BLOCK_SIZE),
-                   AES_BLOCK_SIZE);
-
-            // copy the remaining 'new' input data to the context buffer
-            //
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-
-            context->len = remain;
-        }
-
-        free(cipher);
-
-        object_put(tokdata, key, TRUE);
-        key = NULL;
-
-        return rc;
-    }
+    return aes_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                            in_data_len, out_data, out_data_len,
+                            AES_BLOCK_SIZE, FALSE, 0);
 }
 
 
 //
 //
-CK_RV aes_cbc_pad_encrypt_update(STDLL_TokData_t *tokdata,
-                                 SESSION *sess,
-                                 CK_BBOOL length_only,
-                                 ENCR_DECR_CONTEXT *ctx,
-                                 CK_BYTE *in_data,
-                                 CK_ULONG in_data_len,
-                                 CK_BYTE *out_data, CK_ULONG *out_data_len)
+CK_RV aes_cbc_encrypt_update(STDLL_TokData_t *tokdata,
+                             SESSION *sess,
+                             CK_BBOOL length_only,
+                             ENCR_DECR_CONTEXT *ctx,
+                             CK_BYTE *in_data,
+                             CK_ULONG in_data_len,
+                             CK_BYTE *out_data, CK_ULONG *out_data_len)
 {
-    AES_CONTEXT *context = NULL;
-    OBJECT *key = NULL;
-    CK_BYTE *clear = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
-
-
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-
-    context = (AES_CONTEXT *) ctx->context;
-
-    total = (context->len + in_data_len);
-
-    // note, this is subtly different from the other encrypt update routines
-    //
-    if (total <= AES_BLOCK_SIZE) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        remain = (total % AES_BLOCK_SIZE);
-        out_len = total - remain;   // out_len is a multiple of AES_BLOCK_SIZE
-
-        if (remain == 0) {
-            remain = AES_BLOCK_SIZE;
-            out_len -= AES_BLOCK_SIZE;
-        }
-
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-        // at this point, we should have:
-        //    1) remain != 0
-        //    2) out_len != 0
-        //
-        rc = object_mgr_find_in_map_nocache(tokdata, ctx->key, &key, READ_LOCK);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
-            return rc;
-        }
-        // these buffers need to be longword aligned
-        //
-        clear = (CK_BYTE *) malloc(out_len);
-        if (!clear) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            object_put(tokdata, key, TRUE);
-            key = NULL;
-            return CKR_HOST_MEMORY;
-        }
-        // copy any data left over from the previous encryption operation first
-        //
-        memcpy(clear, context->data, context->len);
-        memcpy(clear + context->len, in_data, out_len - context->len);
-
-        //
-        // we don't do padding during the update
-        //
-        rc = ckm_aes_cbc_encrypt(tokdata, sess, clear, out_len, out_data,
-                                 out_data_len, ctx->mech.pParameter, key);
-
-        if (rc == CKR_OK) {
-            // the new init_v is the last encrypted data block
-            //
-            memcpy(ctx->mech.pParameter,
-                   out_data + (*out_data_len - AES_BLOCK_SIZE), AES_BLOCK_SIZE);
-
-            // copy the remaining 'new' input data to the temporary space
-            //
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-            context->len = remain;
-        }
+    return aes_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                            in_data_len, out_data, out_data_len,
+                            AES_BLOCK_SIZE, FALSE, 1);
+}
 
-        free(clear);
 
-        object_put(tokdata, key, TRUE);
-        key = NULL;
-
-        return rc;
-    }
+//
+//
+CK_RV aes_cbc_decrypt_update(STDLL_TokData_t *tokdata,
+                             SESSION *sess,
+                             CK_BBOOL length_only,
+                             ENCR_DECR_CONTEXT *ctx,
+                             CK_BYTE *in_data,
+                             CK_ULONG in_data_len,
+                             CK_BYTE *out_data, CK_ULONG *out_data_len)
+{
+    return aes_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                            in_data_len, out_data, out_data_len,
+                            AES_BLOCK_SIZE, FALSE, 0);
 }
 
 
 //
 //
-CK_RV aes_cbc_pad_decrypt_update(STDLL_TokData_t *tokdata,
+CK_RV aes_cbc_pad_encrypt_update(STDLL_TokData_t *tokdata,
                                  SESSION *sess,
                                  CK_BBOOL length_only,
                                  ENCR_DECR_CONTEXT *ctx,
@@ -1029,93 +900,25 @@ CK_RV aes_cbc_pad_decrypt_update(STDLL_TokData_t *tokdata,
                                  CK_ULONG in_data_len,
                                  CK_BYTE *out_data, CK_ULONG *out_data_len)
 {
-    AES_CONTEXT *context = NULL;
-    OBJECT *key = NULL;
-    CK_BYTE *cipher = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
-
-
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-
-    context = (AES_CONTEXT *) ctx->context;
-
-    total = (context->len + in_data_len);
-
-    // note, this is subtly different from the other decrypt update routines
-    //
-    if (total <= AES_BLOCK_SIZE) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        // we have at least 1 block + 1 byte
-        //
-        remain = total % AES_BLOCK_SIZE;
-        out_len = total - remain;
-
-        if (remain == 0) {
-            remain = AES_BLOCK_SIZE;
-            out_len -= AES_BLOCK_SIZE;
-        }
-
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-        // at this point, we should have:
-        //    1) remain != 0
-        //    2) out_len != 0
-        //
-        rc = object_mgr_find_in_map_nocache(tokdata, ctx->key, &key, READ_LOCK);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
-            return rc;
-        }
-        // these buffers need to be longword aligned
-        //
-        cipher = (CK_BYTE *) malloc(out_len);
-        if (!cipher) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            object_put(tokdata, key, TRUE);
-            key = NULL;
-            return CKR_HOST_MEMORY;
-        }
-        // copy any data left over from the previous decryption operation first
-        //
-        memcpy(cipher, context->data, context->len);
-        memcpy(cipher + context->len, in_data, out_len - context->len);
-
-        rc = ckm_aes_cbc_decrypt(tokdata, sess, cipher, out_len, out_data,
-                                 out_data_len, ctx->mech.pParameter, key);
-
-        if (rc == CKR_OK) {
-            // the new init_v is the last input data block
-            //
-            memcpy(ctx->mech.pParameter, cipher + (out_len - AES_BLOCK_SIZE),
-                   AES_BLOCK_SIZE);
-
-            // copy the remaining 'new' input data to the temporary space
-            //
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-            context->len = remain;
-        }
-
-        free(cipher);
+    return aes_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                            in_data_len, out_data, out_data_len,
+                            AES_BLOCK_SIZE, TRUE, 1);
+}
 
-        object_put(tokdata, key, TRUE);
-        key = NULL;
 
-        return rc;
-    }
+//
+//
+CK_RV aes_cbc_pad_decrypt_update(STDLL_TokData_t *tokdata,
+                                 SESSION *sess,
+                                 CK_BBOOL length_only,
+                                 ENCR_DECR_CONTEXT *ctx,
+                                 CK_BYTE *in_data,
+                                 CK_ULONG in_data_len,
+                                 CK_BYTE *out_data, CK_ULONG *out_data_len)
+{
+    return aes_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                            in_data_len, out_data, out_data_len,
+                            AES_BLOCK_SIZE, TRUE, 0);
 }
 
 //
@@ -1128,70 +931,9 @@ CK_RV aes_ctr_encrypt_update(STDLL_TokData_t *tokdata,
                              CK_ULONG in_data_len,
                              CK_BYTE *out_data, CK_ULONG *out_data_len)
 {
-    AES_CONTEXT *context = NULL;
-    OBJECT *key = NULL;
-    CK_BYTE *clear = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
-    CK_AES_CTR_PARAMS *aesctr = NULL;
-
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-    context = (AES_CONTEXT *) ctx->context;
-    total = (context->len + in_data_len);
-    if (total < AES_BLOCK_SIZE) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        // we atleast have 1 block
-        remain = (total % AES_BLOCK_SIZE);
-        out_len = total - remain;
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-        rc = object_mgr_find_in_map_nocache(tokdata, ctx->key, &key, READ_LOCK);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
-            return rc;
-        }
-        //these buffers need to be longword aligned
-        clear = (CK_BYTE *) malloc(out_len);
-        if (!clear) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            object_put(tokdata, key, TRUE);
-            key = NULL;
-            return CKR_HOST_MEMORY;
-        }
-        //copy all the leftover data  from the previous encryption operation
-        //first
-        memcpy(clear, context->data, context->len);
-        memcpy(clear + context->len, in_data, out_len - context->len);
-        aesctr = (CK_AES_CTR_PARAMS *) ctx->mech.pParameter;
-        rc = ckm_aes_ctr_encrypt(tokdata, clear, out_len, out_data,
-                                 out_data_len, (CK_BYTE *) aesctr->cb,
-                                 (CK_ULONG) aesctr->ulCounterBits, key);
-        if (rc == CKR_OK) {
-            *out_data_len = out_len;
-            // copy the remaining 'new' input data to the context buffer
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-            context->len = remain;
-        }
-
-        free(clear);
-
-        object_put(tokdata, key, TRUE);
-        key = NULL;
-
-        return rc;
-    }
+    return aes_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                            in_data_len, out_data, out_data_len,
+                            AES_BLOCK_SIZE, FALSE, 1);
 }
 
 //
@@ -1204,70 +946,9 @@ CK_RV aes_ctr_decrypt_update(STDLL_TokData_t *tokdata,
                              CK_ULONG in_data_len,
                              CK_BYTE *out_data, CK_ULONG *out_data_len)
 {
-    AES_CONTEXT *context = NULL;
-    OBJECT *key = NULL;
-    CK_BYTE *clear = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
-    CK_AES_CTR_PARAMS *aesctr = NULL;
-
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-    context = (AES_CONTEXT *) ctx->context;
-    total = (context->len + in_data_len);
-    if (total < AES_BLOCK_SIZE) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        // we atleast have 1 block
-        remain = (total % AES_BLOCK_SIZE);
-        out_len = total - remain;
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-        rc = object_mgr_find_in_map_nocache(tokdata, ctx->key, &key, READ_LOCK);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
-            return rc;
-        }
-        //these buffers need to be longword aligned
-        clear = (CK_BYTE *) malloc(out_len);
-        if (!clear) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            object_put(tokdata, key, TRUE);
-            key = NULL;
-            return CKR_HOST_MEMORY;
-        }
-        //copy all the leftover data  from the previous encryption operation
-        //first
-        memcpy(clear, context->data, context->len);
-        memcpy(clear + context->len, in_data, out_len - context->len);
-        aesctr = (CK_AES_CTR_PARAMS *) ctx->mech.pParameter;
-        rc = ckm_aes_ctr_decrypt(tokdata, clear, out_len, out_data,
-                                 out_data_len, (CK_BYTE *) aesctr->cb,
-                                 (CK_ULONG) aesctr->ulCounterBits, key);
-        if (rc == CKR_OK) {
-            *out_data_len = out_len;
-            // copy the remaining 'new' input data to the context buffer
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-            context->len = remain;
-        }
-
-        free(clear);
-
-        object_put(tokdata, key, TRUE);
-        key = NULL;
-
-        return rc;
-    }
+    return aes_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                            in_data_len, out_data, out_data_len,
+                            AES_BLOCK_SIZE, FALSE, 0);
 }
 
 static CK_RV aes_xts_crypt_update(STDLL_TokData_t *tokdata,
@@ -1282,6 +963,7 @@ static CK_RV aes_xts_crypt_update(STDLL_TokData_t *tokdata,
     AES_XTS_CONTEXT *context = NULL;
     OBJECT *key = NULL;
     CK_BYTE *clear = NULL;
+    CK_BYTE tail[2 * AES_BLOCK_SIZE];
     CK_ULONG total, remain, out_len;
     CK_RV rc;
 
@@ -1322,11 +1004,14 @@ static CK_RV aes_xts_crypt_update(STDLL_TokData_t *tokdata,
     }
 
     if (out_len < context->len) {
+        /* Save the input, out_data may overlap in_data */
+        memcpy(tail, in_data, in_data_len);
+
         rc = ckm_aes_xts_crypt(tokdata, sess, context->data, out_len, out_data,
                                out_data_len, ctx->mech.pParameter, key,
                                !context->initialized, FALSE, context->iv,
                                encrypt);
-        if (rc == CKR_OK) {
+        if (rc != CKR_OK) {
             TRACE_ERROR("ckm_aes_xts_crypt failed\n");
             goto out;
         }
@@ -1335,12 +1020,12 @@ static CK_RV aes_xts_crypt_update(STDLL_TokData_t *tokdata,
                 context->len - out_len);
         context->len -= out_len;
 
-        memcpy(context->data + context->len, in_data, in_data_len);
+        memcpy(context->data + context->len, tail, in_data_len);
         context->len += in_data_len;
 
         context->initialized = TRUE;
     } else {
-        clear = (CK_BYTE *) malloc(out_len);
+        clear = session_mgr_op_alloc(sess, ctx, out_len);
         if (!clear) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -1349,15 +1034,15 @@ static CK_RV aes_xts_crypt_update(STDLL_TokData_t *tokdata,
 
         memcpy(clear, context->data, context->len);
         memcpy(clear + context->len, in_data, out_len - context->len);
+        /* Save the remainder, out_data may overlap in_data */
+        memcpy(tail, in_data + (in_data_len - remain), remain);
 
         rc = ckm_aes_xts_crypt(tokdata, sess, clear, out_len, out_data,
                                  out_data_len, ctx->mech.pParameter, key,
                                  !context->initialized, FALSE, context->iv,
                                  encrypt);
         if (rc == CKR_OK) {
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain),
-                       remain);
+            memcpy(context->data, tail, remain);
             context->len = remain;
 
             context->initialized = TRUE;
@@ -1365,7 +1050,7 @@ static CK_RV aes_xts_crypt_update(STDLL_TokData_t *tokdata,
             TRACE_ERROR("ckm_aes_xts_crypt failed\n");
         }
 
-        free(clear);
+        session_mgr_op_free(sess, clear, out_len);
     }
 
 out:
@@ -1790,7 +1475,7 @@ static CK_RV aes_xts_crypt_final(STDLL_TokData_t *tokdata,
     object_put(tokdata, key, TRUE);
     key = NULL;
 
-    return CKR_OK;
+    return rc;
 }
 
 CK_RV aes_xts_encrypt_final(STDLL_TokData_t *tokdata,
@@ -1826,120 +1511,48 @@ CK_RV aes_ofb_encrypt(STDLL_TokData_t *tokdata,
 
     if (!sess || !ctx || !in_data || !out_data_len) {
         TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-
-    if (length_only == TRUE) {
-        *out_data_len = in_data_len;
-        return CKR_OK;
-    }
-
-    if (*out_data_len < in_data_len) {
-        TRACE_ERROR("%s\n", ock_err(ERR_BUFFER_TOO_SMALL));
-        return CKR_BUFFER_TOO_SMALL;
-    }
-
-    rc = object_mgr_find_in_map1(tokdata, ctx->key, &key_obj, READ_LOCK);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("Failed to find specified object.\n");
-        return rc;
-    }
-
-    rc = token_specific.t_aes_ofb(tokdata, in_data, in_data_len, out_data,
-                                  key_obj, ctx->mech.pParameter, 1);
-
-    if (rc != CKR_OK)
-        TRACE_DEVEL("Token specific aes ofb encrypt failed.\n");
-
-    object_put(tokdata, key_obj, TRUE);
-    key_obj = NULL;
-
-    return rc;
-}
-
-CK_RV aes_ofb_encrypt_update(STDLL_TokData_t *tokdata,
-                             SESSION *sess,
-                             CK_BBOOL length_only,
-                             ENCR_DECR_CONTEXT *ctx,
-                             CK_BYTE *in_data,
-                             CK_ULONG in_data_len,
-                             CK_BYTE *out_data, CK_ULONG *out_data_len)
-{
-    AES_CONTEXT *context = NULL;
-    CK_BYTE *cipher = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
-    OBJECT *key_obj = NULL;
-
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-    context = (AES_CONTEXT *) ctx->context;
-
-    total = (context->len + in_data_len);
-
-    if (total < AES_BLOCK_SIZE) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        // we have at least 1 block
-        remain = (total % AES_BLOCK_SIZE);
-        out_len = total - remain;
-
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-
-        if (*out_data_len < out_len) {
-            TRACE_ERROR("%s\n", ock_err(ERR_BUFFER_TOO_SMALL));
-            return CKR_BUFFER_TOO_SMALL;
-        }
-
-        rc = object_mgr_find_in_map1(tokdata, ctx->key, &key_obj, READ_LOCK);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
-            return rc;
-        }
+        return CKR_FUNCTION_FAILED;
+    }
 
-        cipher = (CK_BYTE *) malloc(out_len);
-        if (!cipher) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            rc = CKR_HOST_MEMORY;
-            goto done;
-        }
-        // copy any data left over from the previous encryption operation first
-        memcpy(cipher, context->data, context->len);
-        memcpy(cipher + context->len, in_data, out_len - context->len);
+    if (length_only == TRUE) {
+        *out_data_len = in_data_len;
+        return CKR_OK;
+    }
 
-        rc = token_specific.t_aes_ofb(tokdata, cipher, out_len, out_data,
-                                      key_obj, ctx->mech.pParameter, 1);
+    if (*out_data_len < in_data_len) {
+        TRACE_ERROR("%s\n", ock_err(ERR_BUFFER_TOO_SMALL));
+        return CKR_BUFFER_TOO_SMALL;
+    }
 
-        if (rc == CKR_OK) {
-            *out_data_len = out_len;
+    rc = object_mgr_find_in_map1(tokdata, ctx->key, &key_obj, READ_LOCK);
+    if (rc != CKR_OK) {
+        TRACE_ERROR("Failed to find specified object.\n");
+        return rc;
+    }
 
-            // copy the remaining 'new' input data to the context buffer
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-            context->len = remain;
-        } else {
-            TRACE_DEVEL("Token specific aes ofb encrypt failed.\n");
-        }
+    rc = token_specific.t_aes_ofb(tokdata, in_data, in_data_len, out_data,
+                                  key_obj, ctx->mech.pParameter, 1);
 
-        free(cipher);
+    if (rc != CKR_OK)
+        TRACE_DEVEL("Token specific aes ofb encrypt failed.\n");
 
-done:
-        object_put(tokdata, key_obj, TRUE);
-        key_obj = NULL;
+    object_put(tokdata, key_obj, TRUE);
+    key_obj = NULL;
 
-        return rc;
-    }
+    return rc;
+}
+
+CK_RV aes_ofb_encrypt_update(STDLL_TokData_t *tokdata,
+                             SESSION *sess,
+                             CK_BBOOL length_only,
+                             ENCR_DECR_CONTEXT *ctx,
+                             CK_BYTE *in_data,
+                             CK_ULONG in_data_len,
+                             CK_BYTE *out_data, CK_ULONG *out_data_len)
+{
+    return aes_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                            in_data_len, out_data, out_data_len,
+                            AES_BLOCK_SIZE, FALSE, 1);
 }
 
 CK_RV aes_ofb_encrypt_final(STDLL_TokData_t *tokdata,
@@ -2047,82 +1660,9 @@ CK_RV aes_ofb_decrypt_update(STDLL_TokData_t *tokdata,
                              CK_ULONG in_data_len,
                              CK_BYTE *out_data, CK_ULONG *out_data_len)
 {
-    AES_CONTEXT *context = NULL;
-    CK_BYTE *cipher = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
-    OBJECT *key_obj = NULL;
-
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-
-    context = (AES_CONTEXT *) ctx->context;
-
-    total = (context->len + in_data_len);
-
-    if (total < AES_BLOCK_SIZE) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        // we have at least 1 block
-        remain = (total % AES_BLOCK_SIZE);
-        out_len = total - remain;
-
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-
-        if (*out_data_len < out_len) {
-            TRACE_ERROR("%s\n", ock_err(ERR_BUFFER_TOO_SMALL));
-            return CKR_BUFFER_TOO_SMALL;
-        }
-
-        rc = object_mgr_find_in_map1(tokdata, ctx->key, &key_obj, READ_LOCK);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
-            return rc;
-        }
-
-        cipher = (CK_BYTE *) malloc(out_len);
-        if (!cipher) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            rc = CKR_HOST_MEMORY;
-            goto done;
-        }
-        // copy any data left over from the previous decryption operation first
-        memcpy(cipher, context->data, context->len);
-        memcpy(cipher + context->len, in_data, out_len - context->len);
-
-        rc = token_specific.t_aes_ofb(tokdata, cipher, out_len, out_data,
-                                      key_obj, ctx->mech.pParameter, 0);
-
-        if (rc == CKR_OK) {
-            *out_data_len = out_len;
-
-            // copy the remaining 'new' input data to the context buffer
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-            context->len = remain;
-        } else {
-            TRACE_DEVEL("Token specific aes ofb decrypt failed.\n");
-        }
-
-        free(cipher);
-
-done:
-        object_put(tokdata, key_obj, TRUE);
-        key_obj = NULL;
-
-        return rc;
-    }
+    return aes_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                            in_data_len, out_data, out_data_len,
+                            AES_BLOCK_SIZE, FALSE, 0);
 }
 
 CK_RV aes_ofb_decrypt_final(STDLL_TokData_t *tokdata,
@@ -2232,82 +1772,9 @@ CK_RV aes_cfb_encrypt_update(STDLL_TokData_t *tokdata,
                              CK_BYTE *out_data,
                              CK_ULONG *out_data_len, CK_ULONG cfb_len)
 {
-    AES_CONTEXT *context = NULL;
-    CK_BYTE *cipher = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
-    OBJECT *key_obj = NULL;
-
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-    context = (AES_CONTEXT *) ctx->context;
-
-    total = (context->len + in_data_len);
-
-    if (total < cfb_len) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        // we have at least 1 block
-        remain = (total % cfb_len);
-        out_len = total - remain;
-
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-
-        if (*out_data_len < out_len) {
-            TRACE_ERROR("%s\n", ock_err(ERR_BUFFER_TOO_SMALL));
-            return CKR_BUFFER_TOO_SMALL;
-        }
-
-        rc = object_mgr_find_in_map1(tokdata, ctx->key, &key_obj, READ_LOCK);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
-            return rc;
-        }
-
-        cipher = (CK_BYTE *) malloc(out_len);
-        if (!cipher) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            rc = CKR_HOST_MEMORY;
-            goto done;
-        }
-        // copy any data left over from the previous encryption operation first
-        memcpy(cipher, context->data, context->len);
-        memcpy(cipher + context->len, in_data, out_len - context->len);
-
-        rc = token_specific.t_aes_cfb(tokdata, cipher, out_len, out_data,
-                                      key_obj, ctx->mech.pParameter, cfb_len,
-                                      1);
-
-        if (rc == CKR_OK) {
-            *out_data_len = out_len;
-
-            // copy the remaining 'new' input data to the context buffer
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-            context->len = remain;
-        } else {
-            TRACE_DEVEL("Token specific aes cfb encrypt failed.\n");
-        }
-
-        free(cipher);
-
-done:
-        object_put(tokdata, key_obj, TRUE);
-        key_obj = NULL;
-
-        return rc;
-    }
+    return aes_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                            in_data_len, out_data, out_data_len,
+                            cfb_len, FALSE, 1);
 }
 
 CK_RV aes_cfb_encrypt_final(STDLL_TokData_t *tokdata,
@@ -2418,82 +1885,9 @@ CK_RV aes_cfb_decrypt_update(STDLL_TokData_t *tokdata,
                              CK_BYTE *out_data,
                              CK_ULONG *out_data_len, CK_ULONG cfb_len)
 {
-    AES_CONTEXT *context = NULL;
-    CK_BYTE *cipher = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
-    OBJECT *key_obj = NULL;
-
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-    context = (AES_CONTEXT *) ctx->context;
-
-    total = (context->len + in_data_len);
-
-    if (total < cfb_len) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        // we have at least 1 block
-        remain = (total % cfb_len);
-        out_len = total - remain;
-
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-
-        if (*out_data_len < out_len) {
-            TRACE_ERROR("%s\n", ock_err(ERR_BUFFER_TOO_SMALL));
-            return CKR_BUFFER_TOO_SMALL;
-        }
-
-        rc = object_mgr_find_in_map1(tokdata, ctx->key, &key_obj, READ_LOCK);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
-            return rc;
-        }
-
-        cipher = (CK_BYTE *) malloc(out_len);
-        if (!cipher) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            rc = CKR_HOST_MEMORY;
-            goto done;
-        }
-        // copy any data left over from the previous decryption operation first
-        memcpy(cipher, context->data, context->len);
-        memcpy(cipher + context->len, in_data, out_len - context->len);
-
-        rc = token_specific.t_aes_cfb(tokdata, cipher, out_len, out_data,
-                                      key_obj, ctx->mech.pParameter, cfb_len,
-                                      0);
-
-        if (rc == CKR_OK) {
-            *out_data_len = out_len;
-
-            // copy the remaining 'new' input data to the context buffer
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-            context->len = remain;
-        } else {
-            TRACE_DEVEL("Token specific aes cfb decrypt failed.\n");
-        }
-
-        free(cipher);
-
-done:
-        object_put(tokdata, key_obj, TRUE);
-        key_obj = NULL;
-
-        return rc;
-    }
+    return aes_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                            in_data_len, out_data, out_data_len,
+                            cfb_len, FALSE, 0);
 }
 
 CK_RV aes_cfb_decrypt_final(STDLL_TokData_t *tokdata,
@@ -2655,7 +2049,7 @@ CK_RV aes_mac_sign_update(STDLL_TokData_t *tokdata,
             return rc;
         }
 
-        cipher = (CK_BYTE *) malloc(out_len);
+        cipher = session_mgr_op_alloc(sess, ctx, out_len);
         if (!cipher) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -2677,7 +2071,7 @@ CK_RV aes_mac_sign_update(STDLL_TokData_t *tokdata,
             TRACE_DEVEL("Token specific aes mac failed.\n");
         }
 
-        free(cipher);
+        session_mgr_op_free(sess, cipher, out_len);
 
 done:
         object_put(tokdata, key_obj, TRUE);
@@ -2860,7 +2254,7 @@ CK_RV aes_mac_verify_update(STDLL_TokData_t *tokdata,
             return rc;
         }
 
-        cipher = (CK_BYTE *) malloc(out_len);
+        cipher = session_mgr_op_alloc(sess, ctx, out_len);
         if (!cipher) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -2881,7 +2275,7 @@ CK_RV aes_mac_verify_update(STDLL_TokData_t *tokdata,
             TRACE_DEVEL("Token specific aes mac failed.\n");
         }
 
-        free(cipher);
+        session_mgr_op_free(sess, cipher, out_len);
 
 done:
         object_put(tokdata, key_obj, TRUE);
@@ -2961,8 +2355,6 @@ static void aes_cmac_cleanup(STDLL_TokData_t *tokdata, SESSION *sess,
                              CK_BYTE *context, CK_ULONG context_len)
 {
     UNUSED(tokdata);
-    UNUSED(sess);
-    UNUSED(context_len);
 
     if (((AES_CMAC_CONTEXT *)context)->ctx != NULL) {
         token_specific.t_aes_cmac(tokdata, (CK_BYTE *)"", 0, NULL,
@@ -2972,7 +2364,7 @@ static void aes_cmac_cleanup(STDLL_TokData_t *tokdata, SESSION *sess,
         ((AES_CMAC_CONTEXT *)context)->ctx = NULL;
     }
 
-    free(context);
+    session_mgr_op_free(sess, context, context_len);
 }
 
 CK_RV aes_cmac_sign(STDLL_TokData_t *tokdata,
@@ -3079,7 +2471,7 @@ CK_RV aes_cmac_sign_update(STDLL_TokData_t *tokdata,
             return rc;
         }
 
-        cipher = (CK_BYTE *) malloc(out_len);
+        cipher = session_mgr_op_alloc(sess, ctx, out_len);
         if (!cipher) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -3110,7 +2502,7 @@ CK_RV aes_cmac_sign_update(STDLL_TokData_t *tokdata,
             TRACE_DEVEL("Token specific aes cmac failed.\n");
         }
 
-        free(cipher);
+        session_mgr_op_free(sess, cipher, out_len);
 
 done:
         object_put(tokdata, key_obj, TRUE);
@@ -3287,7 +2679,7 @@ CK_RV aes_cmac_verify_update(STDLL_TokData_t *tokdata,
             return rc;
         }
 
-        cipher = (CK_BYTE *) malloc(out_len);
+        cipher = session_mgr_op_alloc(sess, ctx, out_len);
         if (!cipher) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -3317,7 +2709,7 @@ CK_RV aes_cmac_verify_update(STDLL_TokData_t *tokdata,
             TRACE_DEVEL("Token specific aes cmac failed.\n");
         }
 
-        free(cipher);
+        session_mgr_op_free(sess, cipher, out_len);
 
 done:
         object_put(tokdata, key_obj, TRUE);
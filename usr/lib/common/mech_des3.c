@@ -288,7 +288,7 @@ CK_RV des3_cbc_pad_encrypt(STDLL_TokData_t *tokdata,
         goto done;
     }
 
-    clear = (CK_BYTE *) malloc(padded_len);
+    clear = session_mgr_op_alloc(sess, ctx, padded_len);
     if (!clear) {
         TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
         rc = CKR_HOST_MEMORY;
@@ -303,7 +303,7 @@ CK_RV des3_cbc_pad_encrypt(STDLL_TokData_t *tokdata,
     rc = ckm_des3_cbc_encrypt(tokdata, clear, padded_len, out_data,
                               out_data_len, ctx->mech.pParameter, key);
 
-    free(clear);
+    session_mgr_op_free(sess, clear, padded_len);
 
 done:
     object_put(tokdata, key, TRUE);
@@ -361,7 +361,7 @@ CK_RV des3_cbc_pad_decrypt(STDLL_TokData_t *tokdata,
         goto done;
     }
 
-    clear = (CK_BYTE *) malloc(padded_len);
+    clear = session_mgr_op_alloc(sess, ctx, padded_len);
     if (!clear) {
         TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
         rc = CKR_HOST_MEMORY;
@@ -375,7 +375,7 @@ CK_RV des3_cbc_pad_decrypt(STDLL_TokData_t *tokdata,
         memcpy(out_data, clear, *out_data_len);
     }
 
-    free(clear);
+    session_mgr_op_free(sess, clear, in_data_len);
 
 done:
     object_put(tokdata, key, TRUE);
@@ -385,105 +385,149 @@ done:
 }
 
 
+static void des3_cipher_cleanup(STDLL_TokData_t *tokdata, SESSION *sess,
+                                CK_BYTE *context, CK_ULONG context_len)
+{
+    if (((DES_CONTEXT *)context)->cipher_ctx != NULL) {
+        token_specific.t_cipher_update(tokdata, 0, NULL, 0, NULL, NULL, NULL,
+                                       0, CK_TRUE,
+                                       &((DES_CONTEXT *)context)->cipher_ctx);
+        ((DES_CONTEXT *)context)->cipher_ctx = NULL;
+    }
+
+    session_mgr_op_free(sess, context, context_len);
+}
+
 //
+// Encrypts or decrypts a multiple of the block size for a multi-part
+// operation and updates the IV in the mechanism parameter. If the token
+// provides t_cipher_update, its cipher context is kept in the DES context
+// for the whole operation, so that the key is set up only once.
 //
-CK_RV des3_ecb_encrypt_update(STDLL_TokData_t *tokdata,
-                              SESSION *sess,
-                              CK_BBOOL length_only,
-                              ENCR_DECR_CONTEXT *ctx,
-                              CK_BYTE *in_data,
-                              CK_ULONG in_data_len,
-                              CK_BYTE *out_data, CK_ULONG *out_data_len)
+static CK_RV des3_crypt_blocks(STDLL_TokData_t *tokdata,
+                               ENCR_DECR_CONTEXT *ctx,
+                               OBJECT *key,
+                               CK_BYTE *in_data,
+                               CK_ULONG in_data_len,
+                               CK_BYTE *out_data, CK_BYTE encrypt)
 {
-    DES_CONTEXT *context = NULL;
-    OBJECT *key = NULL;
-    CK_BYTE *clear = NULL;
-    CK_ULONG total, remain, out_len;
+    DES_CONTEXT *context = (DES_CONTEXT *) ctx->context;
+    CK_BYTE iv[DES_BLOCK_SIZE];
+    CK_ULONG out_len = in_data_len;
     CK_RV rc;
 
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
+    switch (ctx->mech.mechanism) {
+    case CKM_DES3_ECB:
+    case CKM_DES3_CBC:
+    case CKM_DES3_CBC_PAD:
+    case CKM_DES_OFB64:
+    case CKM_DES_CFB8:
+    case CKM_DES_CFB64:
+        break;
+    default:
+        TRACE_ERROR("%s\n", ock_err(ERR_MECHANISM_INVALID));
+        return CKR_MECHANISM_INVALID;
     }
-    context = (DES_CONTEXT *) ctx->context;
-
-    total = (context->len + in_data_len);
-
-    if (total < DES_BLOCK_SIZE) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        // we have at least 1 block
-        //
-        remain = (total % DES_BLOCK_SIZE);
-        out_len = (total - remain);     // should always be at least 1 block
 
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-
-        rc = object_mgr_find_in_map_nocache(tokdata, ctx->key, &key, READ_LOCK);
+    if (token_specific.t_cipher_update != NULL) {
+        rc = token_specific.t_cipher_update(tokdata, ctx->mech.mechanism,
+                                            in_data, in_data_len, out_data,
+                                            key,
+                                            ctx->mech.mechanism ==
+                                                CKM_DES3_ECB ?
+                                                NULL : ctx->mech.pParameter,
+                                            encrypt, CK_FALSE,
+                                            &context->cipher_ctx);
         if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
+            TRACE_DEVEL("Token specific cipher update failed.\n");
             return rc;
         }
 
-        clear = (CK_BYTE *) malloc(out_len);
-        if (!clear) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            object_put(tokdata, key, TRUE);
-            key = NULL;
-            return CKR_HOST_MEMORY;
-        }
-        // copy any data left over from the previous encryption operation first
-        //
-        memcpy(clear, context->data, context->len);
-        memcpy(clear + context->len, in_data, out_len - context->len);
-
-        rc = ckm_des3_ecb_encrypt(tokdata, clear, out_len,
-                                  out_data, out_data_len, key);
-        if (rc == CKR_OK) {
-            *out_data_len = out_len;
-
-            // update the context buffer.  we already used the buffer's current
-            // contents so we completely overwrite it
-            //
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-
-            context->len = remain;
-        }
+        if (context->cipher_ctx != NULL)
+            ctx->state_unsaveable = CK_TRUE;
 
-        free(clear);
+        ctx->context_free_func = des3_cipher_cleanup;
 
-        object_put(tokdata, key, TRUE);
-        key = NULL;
+        return CKR_OK;
+    }
 
-        return rc;
+    switch (ctx->mech.mechanism) {
+    case CKM_DES3_ECB:
+        if (encrypt)
+            rc = ckm_des3_ecb_encrypt(tokdata, in_data, in_data_len,
+                                      out_data, &out_len, key);
+        else
+            rc = ckm_des3_ecb_decrypt(tokdata, in_data, in_data_len,
+                                      out_data, &out_len, key);
+        break;
+    case CKM_DES3_CBC:
+    case CKM_DES3_CBC_PAD:
+        if (encrypt) {
+            rc = ckm_des3_cbc_encrypt(tokdata, in_data, in_data_len,
+                                      out_data, &out_len,
+                                      ctx->mech.pParameter, key);
+            // the new init_v is the last encrypted data block
+            if (rc == CKR_OK)
+                memcpy(ctx->mech.pParameter,
+                       out_data + (in_data_len - DES_BLOCK_SIZE),
+                       DES_BLOCK_SIZE);
+        } else {
+            // the new init_v is the last input data block, which might
+            // get overwritten when decrypting in place
+            memcpy(iv, in_data + (in_data_len - DES_BLOCK_SIZE),
+                   DES_BLOCK_SIZE);
+            rc = ckm_des3_cbc_decrypt(tokdata, in_data, in_data_len,
+                                      out_data, &out_len,
+                                      ctx->mech.pParameter, key);
+            if (rc == CKR_OK)
+                memcpy(ctx->mech.pParameter, iv, DES_BLOCK_SIZE);
+        }
+        break;
+    case CKM_DES_OFB64:
+        rc = token_specific.t_tdes_ofb(tokdata, in_data, out_data,
+                                       in_data_len, key,
+                                       ctx->mech.pParameter, encrypt);
+        if (rc != CKR_OK)
+            TRACE_DEVEL("Token specific des3 ofb failed.\n");
+        break;
+    default:
+        rc = token_specific.t_tdes_cfb(tokdata, in_data, out_data,
+                                       in_data_len, key,
+                                       ctx->mech.pParameter,
+                                       ctx->mech.mechanism == CKM_DES_CFB8 ?
+                                                                    1 : 8,
+                                       encrypt);
+        if (rc != CKR_OK)
+            TRACE_DEVEL("Token specific des3 cfb failed.\n");
+        break;
     }
-}
 
+    return rc;
+}
 
 //
+// Common multi-part update for the block modes. Only a partial block (or,
+// with keep_last, the last block for the padding in the final call) is
+// staged in the context; everything else is processed directly from the
+// caller's input buffer into the caller's output buffer.
 //
-CK_RV des3_ecb_decrypt_update(STDLL_TokData_t *tokdata,
-                              SESSION *sess,
-                              CK_BBOOL length_only,
-                              ENCR_DECR_CONTEXT *ctx,
-                              CK_BYTE *in_data,
-                              CK_ULONG in_data_len,
-                              CK_BYTE *out_data, CK_ULONG *out_data_len)
+static CK_RV des3_crypt_update(STDLL_TokData_t *tokdata,
+                               SESSION *sess,
+                               CK_BBOOL length_only,
+                               ENCR_DECR_CONTEXT *ctx,
+                               CK_BYTE *in_data,
+                               CK_ULONG in_data_len,
+                               CK_BYTE *out_data,
+                               CK_ULONG *out_data_len,
+                               CK_ULONG block_size,
+                               CK_BBOOL keep_last, CK_BYTE encrypt)
 {
     DES_CONTEXT *context = NULL;
     OBJECT *key = NULL;
-    CK_BYTE *cipher = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
+    CK_BYTE block[DES_BLOCK_SIZE], tail[DES_BLOCK_SIZE];
+    CK_BYTE *buf = NULL;
+    CK_ULONG total, remain, out_len, fill;
+    CK_RV rc = CKR_OK;
 
     if (!sess || !ctx || !out_data_len) {
         TRACE_ERROR("%s received bad argument(s)\n", __func__);
@@ -493,7 +537,7 @@ CK_RV des3_ecb_decrypt_update(STDLL_TokData_t *tokdata,
 
     total = (context->len + in_data_len);
 
-    if (total < DES_BLOCK_SIZE) {
+    if (total < block_size || (keep_last && total == block_size)) {
         if (length_only == FALSE && in_data_len) {
             memcpy(context->data + context->len, in_data, in_data_len);
             context->len += in_data_len;
@@ -501,61 +545,95 @@ CK_RV des3_ecb_decrypt_update(STDLL_TokData_t *tokdata,
 
         *out_data_len = 0;
         return CKR_OK;
-    } else {
-        // we have at least 1 block
-        //
-        remain = (total % DES_BLOCK_SIZE);
-        out_len = total - remain;
+    }
 
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
+    // we have at least 1 block
+    //
+    remain = (total % block_size);
+    out_len = total - remain;
+
+    if (keep_last && remain == 0) {
+        remain = block_size;
+        out_len -= block_size;
+    }
 
-        rc = object_mgr_find_in_map1(tokdata, ctx->key, &key, READ_LOCK);
+    if (length_only == TRUE) {
+        *out_data_len = out_len;
+        return CKR_OK;
+    }
+
+    if (*out_data_len < out_len) {
+        *out_data_len = out_len;
+        TRACE_ERROR("%s\n", ock_err(ERR_BUFFER_TOO_SMALL));
+        return CKR_BUFFER_TOO_SMALL;
+    }
+
+    // the key is not needed while the token's cipher context is alive
+    //
+    if (context->cipher_ctx == NULL) {
+        rc = object_mgr_find_in_map_nocache(tokdata, ctx->key, &key,
+                                            READ_LOCK);
         if (rc != CKR_OK) {
             TRACE_ERROR("Failed to find specified object.\n");
             return rc;
         }
+    }
 
-        cipher = (CK_BYTE *) malloc(out_len);
-        if (!cipher) {
+    // save the remaining 'new' input data, the output may overlap it
+    //
+    memcpy(tail, in_data + (in_data_len - remain), remain);
+
+    if (out_data < in_data + in_data_len && in_data < out_data + out_len &&
+        (out_data != in_data || context->len > 0)) {
+        // the output overlaps the input other than exactly in place, so
+        // the input needs to be staged
+        buf = session_mgr_op_alloc(sess, ctx, out_len);
+        if (!buf) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
             goto done;
         }
-        // copy any data left over from the previous decryption operation first
-        //
-        memcpy(cipher, context->data, context->len);
-        memcpy(cipher + context->len, in_data, out_len - context->len);
+        memcpy(buf, context->data, context->len);
+        memcpy(buf + context->len, in_data, out_len - context->len);
 
-        rc = ckm_des3_ecb_decrypt(tokdata, cipher, out_len, out_data,
-                                  out_data_len, key);
-        if (rc == CKR_OK) {
-            *out_data_len = out_len;
+        rc = des3_crypt_blocks(tokdata, ctx, key, buf, out_len,
+                               out_data, encrypt);
+        session_mgr_op_free(sess, buf, out_len);
+    } else {
+        fill = 0;
+        if (context->len > 0) {
+            // complete the first block with the data left over from the
+            // previous call
+            fill = block_size - context->len;
+            memcpy(block, context->data, context->len);
+            memcpy(block + context->len, in_data, fill);
 
-            // copy the remaining 'new' input data to the context buffer
-            //
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-            context->len = remain;
+            rc = des3_crypt_blocks(tokdata, ctx, key, block, block_size,
+                                   out_data, encrypt);
         }
+        if (rc == CKR_OK && out_len > context->len + fill)
+            rc = des3_crypt_blocks(tokdata, ctx, key, in_data + fill,
+                                   out_len - context->len - fill,
+                                   out_data + context->len + fill, encrypt);
+    }
+
+    if (rc == CKR_OK) {
+        *out_data_len = out_len;
 
-        free(cipher);
+        memcpy(context->data, tail, remain);
+        context->len = remain;
+    }
 
 done:
+    if (key != NULL)
         object_put(tokdata, key, TRUE);
-        key = NULL;
-
-        return rc;
-    }
 
+    return rc;
 }
 
-
 //
 //
-CK_RV des3_cbc_encrypt_update(STDLL_TokData_t *tokdata,
+CK_RV des3_ecb_encrypt_update(STDLL_TokData_t *tokdata,
                               SESSION *sess,
                               CK_BBOOL length_only,
                               ENCR_DECR_CONTEXT *ctx,
@@ -563,84 +641,41 @@ CK_RV des3_cbc_encrypt_update(STDLL_TokData_t *tokdata,
                               CK_ULONG in_data_len,
                               CK_BYTE *out_data, CK_ULONG *out_data_len)
 {
-    DES_CONTEXT *context = NULL;
-    OBJECT *key = NULL;
-    CK_BYTE *clear = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
-
-
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-    context = (DES_CONTEXT *) ctx->context;
-
-    total = (context->len + in_data_len);
-
-    if (total < DES_BLOCK_SIZE) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        // we have at least 1 block
-        //
-        remain = (total % DES_BLOCK_SIZE);
-        out_len = total - remain;
-
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-
-        rc = object_mgr_find_in_map_nocache(tokdata, ctx->key, &key, READ_LOCK);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
-            return rc;
-        }
-        // these buffers need to be longword aligned
-        //
-        clear = (CK_BYTE *) malloc(out_len);
-        if (!clear) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            object_put(tokdata, key, TRUE);
-            key = NULL;
-            return CKR_HOST_MEMORY;
-        }
-        // copy any data left over from the previous encryption operation first
-        //
-        memcpy(clear, context->data, context->len);
-        memcpy(clear + context->len, in_data, out_len - context->len);
-
-        rc = ckm_des3_cbc_encrypt(tokdata, clear, out_len, out_data,
-                                  out_data_len, ctx->mech.pParameter, key);
-
-        if (rc == CKR_OK) {
-            *out_data_len = out_len;
-
-            // the new init_v is the last encrypted data block
-            //
-            memcpy(ctx->mech.pParameter,
-                   out_data + (*out_data_len - DES_BLOCK_SIZE), DES_BLOCK_SIZE);
+    return des3_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                             in_data_len, out_data, out_data_len,
+                             DES_BLOCK_SIZE, FALSE, 1);
+}
 
-            // copy the remaining 'new' input data to the context buffer
-            //
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-            context->len = remain;
-        }
 
-        free(clear);
+//
+//
+CK_RV des3_ecb_decrypt_update(STDLL_TokData_t *tokdata,
+                              SESSION *sess,
+                              CK_BBOOL length_only,
+                              ENCR_DECR_CONTEXT *ctx,
+                              CK_BYTE *in_data,
+                              CK_ULONG in_data_len,
+                              CK_BYTE *out_data, CK_ULONG *out_data_len)
+{
+    return des3_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                             in_data_len, out_data, out_data_len,
+                             DES_BLOCK_SIZE, FALSE, 0);
+}
 
-        object_put(tokdata, key, TRUE);
-        key = NULL;
 
-        return rc;
-    }
+//
+//
+CK_RV des3_cbc_encrypt_update(STDLL_TokData_t *tokdata,
+                              SESSION *sess,
+                              CK_BBOOL length_only,
+                              ENCR_DECR_CONTEXT *ctx,
+                              CK_BYTE *in_data,
+                              CK_ULONG in_data_len,
+                              CK_BYTE *out_data, CK_ULONG *out_data_len)
+{
+    return des3_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                             in_data_len, out_data, out_data_len,
+                             DES_BLOCK_SIZE, FALSE, 1);
 }
 
 
@@ -654,86 +689,9 @@ CK_RV des3_cbc_decrypt_update(STDLL_TokData_t *tokdata,
                               CK_ULONG in_data_len,
                               CK_BYTE *out_data, CK_ULONG *out_data_len)
 {
-    DES_CONTEXT *context = NULL;
-    OBJECT *key = NULL;
-    CK_BYTE *cipher = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
-
-
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-    context = (DES_CONTEXT *) ctx->context;
-
-    total = context->len + in_data_len;
-
-    if (total < DES_BLOCK_SIZE) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        // we have at least 1 block
-        //
-        remain = total % DES_BLOCK_SIZE;
-        out_len = total - remain;
-
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-
-        rc = object_mgr_find_in_map_nocache(tokdata, ctx->key, &key, READ_LOCK);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
-            return rc;
-        }
-        // these buffers need to be longword aligned
-        //
-        cipher = (CK_BYTE *) malloc(out_len);
-        if (!cipher) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            object_put(tokdata, key, TRUE);
-            key = NULL;
-            return CKR_HOST_MEMORY;
-        }
-        // copy any data left over from the previous decryption operation first
-        //
-        memcpy(cipher, context->data, context->len);
-        memcpy(cipher + context->len, in_data, out_len - context->len);
-
-        rc = ckm_des3_cbc_decrypt(tokdata, cipher, out_len, out_data,
-                                  out_data_len, ctx->mech.pParameter, key);
-
-        if (rc == CKR_OK) {
-            *out_data_len = out_len;
-
-            // the new init_v is the last input data block
-            //
-            memcpy(ctx->mech.pParameter, cipher + (out_len - DES_BLOCK_SIZE),
-                   DES_BLOCK_SIZE);
-
-            // copy the remaining 'new' input data to the context buffer
-            //
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-
-            context->len = remain;
-        }
-
-        free(cipher);
-
-        object_put(tokdata, key, TRUE);
-        key = NULL;
-
-        return rc;
-    }
-
+    return des3_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                             in_data_len, out_data, out_data_len,
+                             DES_BLOCK_SIZE, FALSE, 0);
 }
 
 
@@ -747,93 +705,9 @@ CK_RV des3_cbc_pad_encrypt_update(STDLL_TokData_t *tokdata,
                                   CK_ULONG in_data_len,
                                   CK_BYTE *out_data, CK_ULONG *out_data_len)
 {
-    DES_CONTEXT *context = NULL;
-    OBJECT *key = NULL;
-    CK_BYTE *clear = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
-
-
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-    context = (DES_CONTEXT *) ctx->context;
-
-    total = (context->len + in_data_len);
-
-    // note, this is subtly different from the other encrypt update routines
-    //
-    if (total <= DES_BLOCK_SIZE) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        remain = (total % DES_BLOCK_SIZE);
-        out_len = total - remain;   // out_len is a multiple of DES_BLOCK_SIZE
-
-        if (remain == 0) {
-            remain = DES_BLOCK_SIZE;
-            out_len -= DES_BLOCK_SIZE;
-        }
-
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-        // at this point, we should have:
-        //    1) remain != 0
-        //    2) out_len != 0
-        //
-        rc = object_mgr_find_in_map_nocache(tokdata, ctx->key, &key, READ_LOCK);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
-            return rc;
-        }
-        // these buffers need to be longword aligned
-        //
-        clear = (CK_BYTE *) malloc(out_len);
-        if (!clear) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            object_put(tokdata, key, TRUE);
-            key = NULL;
-            return CKR_HOST_MEMORY;
-        }
-        // copy any data left over from the previous encryption operation first
-        //
-        memcpy(clear, context->data, context->len);
-        memcpy(clear + context->len, in_data, out_len - context->len);
-
-        //
-        // we don't do padding during the update
-        //
-        rc = ckm_des3_cbc_encrypt(tokdata, clear, out_len, out_data,
-                                  out_data_len, ctx->mech.pParameter, key);
-
-        if (rc == CKR_OK) {
-            // the new init_v is the last encrypted data block
-            //
-            memcpy(ctx->mech.pParameter,
-                   out_data + (*out_data_len - DES_BLOCK_SIZE), DES_BLOCK_SIZE);
-
-            // copy the remaining 'new' input data to the temporary space
-            //
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-            context->len = remain;
-        }
-
-        free(clear);
-
-        object_put(tokdata, key, TRUE);
-        key = NULL;
-
-        return rc;
-    }
+    return des3_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                             in_data_len, out_data, out_data_len,
+                             DES_BLOCK_SIZE, TRUE, 1);
 }
 
 
@@ -847,92 +721,9 @@ CK_RV des3_cbc_pad_decrypt_update(STDLL_TokData_t *tokdata,
                                   CK_ULONG in_data_len,
                                   CK_BYTE *out_data, CK_ULONG *out_data_len)
 {
-    DES_CONTEXT *context = NULL;
-    OBJECT *key = NULL;
-    CK_BYTE *cipher = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
-
-
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-    context = (DES_CONTEXT *) ctx->context;
-
-    total = (context->len + in_data_len);
-
-    // note, this is subtly different from the other decrypt update routines
-    //
-    if (total <= DES_BLOCK_SIZE) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        // we have at least 1 block + 1 byte
-        //
-        remain = total % DES_BLOCK_SIZE;
-        out_len = total - remain;
-
-        if (remain == 0) {
-            remain = DES_BLOCK_SIZE;
-            out_len -= DES_BLOCK_SIZE;
-        }
-
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-        // at this point, we should have:
-        //    1) remain != 0
-        //    2) out_len != 0
-        //
-        rc = object_mgr_find_in_map_nocache(tokdata, ctx->key, &key, READ_LOCK);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
-            return rc;
-        }
-        // these buffers need to be longword aligned
-        //
-        cipher = (CK_BYTE *) malloc(out_len);
-        if (!cipher) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            object_put(tokdata, key, TRUE);
-            key = NULL;
-            return CKR_HOST_MEMORY;
-        }
-        // copy any data left over from the previous decryption operation first
-        //
-        memcpy(cipher, context->data, context->len);
-        memcpy(cipher + context->len, in_data, out_len - context->len);
-
-        rc = ckm_des3_cbc_decrypt(tokdata, cipher, out_len, out_data,
-                                  out_data_len, ctx->mech.pParameter, key);
-
-        if (rc == CKR_OK) {
-            // the new init_v is the last input data block
-            //
-            memcpy(ctx->mech.pParameter, cipher + (out_len - DES_BLOCK_SIZE),
-                   DES_BLOCK_SIZE);
-
-            // copy the remaining 'new' input data to the temporary space
-            //
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-            context->len = remain;
-        }
-
-        free(cipher);
-
-        object_put(tokdata, key, TRUE);
-        key = NULL;
-
-        return rc;
-    }
+    return des3_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                             in_data_len, out_data, out_data_len,
+                             DES_BLOCK_SIZE, TRUE, 0);
 }
 
 
@@ -1201,132 +992,60 @@ done:
     return rc;
 }
 
-CK_RV des3_ofb_encrypt(STDLL_TokData_t *tokdata,
-                       SESSION *sess,
-                       CK_BBOOL length_only,
-                       ENCR_DECR_CONTEXT *ctx,
-                       CK_BYTE *in_data,
-                       CK_ULONG in_data_len,
-                       CK_BYTE *out_data, CK_ULONG *out_data_len)
-{
-    CK_ULONG rc;
-    OBJECT *key_obj = NULL;
-
-    if (!sess || !ctx || !in_data || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-
-    if (length_only == TRUE) {
-        *out_data_len = in_data_len;
-        return CKR_OK;
-    }
-
-    if (*out_data_len < in_data_len) {
-        TRACE_ERROR("%s\n", ock_err(ERR_BUFFER_TOO_SMALL));
-        return CKR_BUFFER_TOO_SMALL;
-    }
-
-    rc = object_mgr_find_in_map1(tokdata, ctx->key, &key_obj, READ_LOCK);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("Failed to find specified object.\n");
-        return rc;
-    }
-
-    rc = token_specific.t_tdes_ofb(tokdata, in_data, out_data, in_data_len,
-                                   key_obj, ctx->mech.pParameter, 1);
-    if (rc != CKR_OK)
-        TRACE_DEVEL("Token specific des3 ofb encrypt failed.\n");
-
-    object_put(tokdata, key_obj, TRUE);
-    key_obj = NULL;
-
-    return rc;
-}
-
-CK_RV des3_ofb_encrypt_update(STDLL_TokData_t *tokdata,
-                              SESSION *sess,
-                              CK_BBOOL length_only,
-                              ENCR_DECR_CONTEXT *ctx,
-                              CK_BYTE *in_data,
-                              CK_ULONG in_data_len,
-                              CK_BYTE *out_data, CK_ULONG *out_data_len)
-{
-    DES_DATA_CONTEXT *context = NULL;
-    CK_BYTE *cipher = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
-    OBJECT *key_obj = NULL;
-
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-    context = (DES_DATA_CONTEXT *) ctx->context;
-
-    total = (context->len + in_data_len);
-
-    if (total < DES_BLOCK_SIZE) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        // we have at least 1 block
-        remain = (total % DES_BLOCK_SIZE);
-        out_len = total - remain;
-
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-
-        if (*out_data_len < out_len) {
-            TRACE_ERROR("%s\n", ock_err(ERR_BUFFER_TOO_SMALL));
-            return CKR_BUFFER_TOO_SMALL;
-        }
-
-        rc = object_mgr_find_in_map1(tokdata, ctx->key, &key_obj, READ_LOCK);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
-            return rc;
-        }
-
-        cipher = (CK_BYTE *) malloc(out_len);
-        if (!cipher) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            rc = CKR_HOST_MEMORY;
-            goto done;
-        }
-        // copy any data left over from the previous encryption operation first
-        memcpy(cipher, context->data, context->len);
-        memcpy(cipher + context->len, in_data, out_len - context->len);
-
-        rc = token_specific.t_tdes_ofb(tokdata, cipher, out_data, out_len,
-                                       key_obj, ctx->mech.pParameter, 1);
-
-        if (rc == CKR_OK) {
-            *out_data_len = out_len;
+CK_RV des3_ofb_encrypt(STDLL_TokData_t *tokdata,
+                       SESSION *sess,
+                       CK_BBOOL length_only,
+                       ENCR_DECR_CONTEXT *ctx,
+                       CK_BYTE *in_data,
+                       CK_ULONG in_data_len,
+                       CK_BYTE *out_data, CK_ULONG *out_data_len)
+{
+    CK_ULONG rc;
+    OBJECT *key_obj = NULL;
 
-            // copy the remaining 'new' input data to the context buffer
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-            context->len = remain;
-        } else {
-            TRACE_DEVEL("Token specific des3 ofb encrypt failed.\n");
-        }
+    if (!sess || !ctx || !in_data || !out_data_len) {
+        TRACE_ERROR("%s received bad argument(s)\n", __func__);
+        return CKR_FUNCTION_FAILED;
+    }
 
-        free(cipher);
+    if (length_only == TRUE) {
+        *out_data_len = in_data_len;
+        return CKR_OK;
+    }
 
-done:
-        object_put(tokdata, key_obj, TRUE);
-        key_obj = NULL;
+    if (*out_data_len < in_data_len) {
+        TRACE_ERROR("%s\n", ock_err(ERR_BUFFER_TOO_SMALL));
+        return CKR_BUFFER_TOO_SMALL;
+    }
 
+    rc = object_mgr_find_in_map1(tokdata, ctx->key, &key_obj, READ_LOCK);
+    if (rc != CKR_OK) {
+        TRACE_ERROR("Failed to find specified object.\n");
         return rc;
     }
+
+    rc = token_specific.t_tdes_ofb(tokdata, in_data, out_data, in_data_len,
+                                   key_obj, ctx->mech.pParameter, 1);
+    if (rc != CKR_OK)
+        TRACE_DEVEL("Token specific des3 ofb encrypt failed.\n");
+
+    object_put(tokdata, key_obj, TRUE);
+    key_obj = NULL;
+
+    return rc;
+}
+
+CK_RV des3_ofb_encrypt_update(STDLL_TokData_t *tokdata,
+                              SESSION *sess,
+                              CK_BBOOL length_only,
+                              ENCR_DECR_CONTEXT *ctx,
+                              CK_BYTE *in_data,
+                              CK_ULONG in_data_len,
+                              CK_BYTE *out_data, CK_ULONG *out_data_len)
+{
+    return des3_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                             in_data_len, out_data, out_data_len,
+                             DES_BLOCK_SIZE, FALSE, 1);
 }
 
 CK_RV des3_ofb_encrypt_final(STDLL_TokData_t *tokdata,
@@ -1432,81 +1151,9 @@ CK_RV des3_ofb_decrypt_update(STDLL_TokData_t *tokdata,
                               CK_ULONG in_data_len,
                               CK_BYTE *out_data, CK_ULONG *out_data_len)
 {
-    DES_CONTEXT *context = NULL;
-    CK_BYTE *cipher = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
-    OBJECT *key_obj = NULL;
-
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-    context = (DES_CONTEXT *) ctx->context;
-
-    total = (context->len + in_data_len);
-
-    if (total < DES_BLOCK_SIZE) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        // we have at least 1 block
-        remain = (total % DES_BLOCK_SIZE);
-        out_len = total - remain;
-
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-
-        if (*out_data_len < out_len) {
-            TRACE_ERROR("%s\n", ock_err(ERR_BUFFER_TOO_SMALL));
-            return CKR_BUFFER_TOO_SMALL;
-        }
-
-        rc = object_mgr_find_in_map1(tokdata, ctx->key, &key_obj, READ_LOCK);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
-            return rc;
-        }
-
-        cipher = (CK_BYTE *) malloc(out_len);
-        if (!cipher) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            rc = CKR_HOST_MEMORY;
-            goto done;
-        }
-        // copy any data left over from the previous decryption operation first
-        memcpy(cipher, context->data, context->len);
-        memcpy(cipher + context->len, in_data, out_len - context->len);
-
-        rc = token_specific.t_tdes_ofb(tokdata, cipher, out_data, out_len,
-                                       key_obj, ctx->mech.pParameter, 0);
-
-        if (rc == CKR_OK) {
-            *out_data_len = out_len;
-
-            // copy the remaining 'new' input data to the context buffer
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-            context->len = remain;
-        } else {
-            TRACE_DEVEL("Token specific des3 ofb decrypt failed.\n");
-        }
-
-        free(cipher);
-
-done:
-        object_put(tokdata, key_obj, TRUE);
-        key_obj = NULL;
-
-        return rc;
-    }
+    return des3_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                             in_data_len, out_data, out_data_len,
+                             DES_BLOCK_SIZE, FALSE, 0);
 }
 
 CK_RV des3_ofb_decrypt_final(STDLL_TokData_t *tokdata,
@@ -1616,81 +1263,9 @@ CK_RV des3_cfb_encrypt_update(STDLL_TokData_t *tokdata,
                               CK_BYTE *out_data,
                               CK_ULONG *out_data_len, CK_ULONG cfb_len)
 {
-    DES_CONTEXT *context = NULL;
-    CK_BYTE *cipher = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
-    OBJECT *key_obj = NULL;
-
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-    context = (DES_CONTEXT *) ctx->context;
-
-    total = (context->len + in_data_len);
-
-    if (total < cfb_len) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        // we have at least 1 block
-        remain = (total % cfb_len);
-        out_len = total - remain;
-
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-
-        if (*out_data_len < out_len) {
-            TRACE_ERROR("%s\n", ock_err(ERR_BUFFER_TOO_SMALL));
-            return CKR_BUFFER_TOO_SMALL;
-        }
-
-        rc = object_mgr_find_in_map1(tokdata, ctx->key, &key_obj, READ_LOCK);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
-            return rc;
-        }
-        cipher = (CK_BYTE *) malloc(out_len);
-        if (!cipher) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            rc = CKR_HOST_MEMORY;
-            goto done;
-        }
-        // copy any data left over from the previous encryption operation first
-        memcpy(cipher, context->data, context->len);
-        memcpy(cipher + context->len, in_data, out_len - context->len);
-
-        rc = token_specific.t_tdes_cfb(tokdata, cipher, out_data, out_len,
-                                       key_obj, ctx->mech.pParameter, cfb_len,
-                                       1);
-
-        if (rc == CKR_OK) {
-            *out_data_len = out_len;
-
-            // copy the remaining 'new' input data to the context buffer
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-            context->len = remain;
-        } else {
-            TRACE_DEVEL("Token specific des3 cfb encrypt failed.\n");
-        }
-
-        free(cipher);
-
-done:
-        object_put(tokdata, key_obj, TRUE);
-        key_obj = NULL;
-
-        return rc;
-    }
+    return des3_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                             in_data_len, out_data, out_data_len,
+                             cfb_len, FALSE, 1);
 }
 
 CK_RV des3_cfb_encrypt_final(STDLL_TokData_t *tokdata,
@@ -1801,82 +1376,9 @@ CK_RV des3_cfb_decrypt_update(STDLL_TokData_t *tokdata,
                               CK_BYTE *out_data,
                               CK_ULONG *out_data_len, CK_ULONG cfb_len)
 {
-    DES_CONTEXT *context = NULL;
-    CK_BYTE *cipher = NULL;
-    CK_ULONG total, remain, out_len;
-    CK_RV rc;
-    OBJECT *key_obj = NULL;
-
-    if (!sess || !ctx || !out_data_len) {
-        TRACE_ERROR("%s received bad argument(s)\n", __func__);
-        return CKR_FUNCTION_FAILED;
-    }
-
-    context = (DES_CONTEXT *) ctx->context;
-
-    total = (context->len + in_data_len);
-
-    if (total < cfb_len) {
-        if (length_only == FALSE && in_data_len) {
-            memcpy(context->data + context->len, in_data, in_data_len);
-            context->len += in_data_len;
-        }
-
-        *out_data_len = 0;
-        return CKR_OK;
-    } else {
-        // we have at least 1 block
-        remain = (total % cfb_len);
-        out_len = total - remain;
-
-        if (length_only == TRUE) {
-            *out_data_len = out_len;
-            return CKR_OK;
-        }
-
-        if (*out_data_len < out_len) {
-            TRACE_ERROR("%s\n", ock_err(ERR_BUFFER_TOO_SMALL));
-            return CKR_BUFFER_TOO_SMALL;
-        }
-
-        rc = object_mgr_find_in_map1(tokdata, ctx->key, &key_obj, READ_LOCK);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("Failed to find specified object.\n");
-            return rc;
-        }
-        cipher = (CK_BYTE *) malloc(out_len);
-        if (!cipher) {
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            rc = CKR_HOST_MEMORY;
-            goto done;
-        }
-        // copy any data left over from the previous decryption operation first
-        memcpy(cipher, context->data, context->len);
-        memcpy(cipher + context->len, in_data, out_len - context->len);
-
-        rc = token_specific.t_tdes_cfb(tokdata, cipher, out_data, out_len,
-                                       key_obj, ctx->mech.pParameter, cfb_len,
-                                       0);
-
-        if (rc == CKR_OK) {
-            *out_data_len = out_len;
-
-            // copy the remaining 'new' input data to the context buffer
-            if (remain != 0)
-                memcpy(context->data, in_data + (in_data_len - remain), remain);
-            context->len = remain;
-        } else {
-            TRACE_DEVEL("Token specific des3 cfb decrypt failed.\n");
-        }
-
-        free(cipher);
-
-done:
-        object_put(tokdata, key_obj, TRUE);
-        key_obj = NULL;
-
-        return rc;
-    }
+    return des3_crypt_update(tokdata, sess, length_only, ctx, in_data,
+                             in_data_len, out_data, out_data_len,
+                             cfb_len, FALSE, 0);
 }
 
 CK_RV des3_cfb_decrypt_final(STDLL_TokData_t *tokdata,
@@ -2036,7 +1538,7 @@ CK_RV des3_mac_sign_update(STDLL_TokData_t *tokdata,
             return rc;
         }
 
-        cipher = (CK_BYTE *) malloc(out_len);
+        cipher = session_mgr_op_alloc(sess, ctx, out_len);
         if (!cipher) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -2058,7 +1560,7 @@ CK_RV des3_mac_sign_update(STDLL_TokData_t *tokdata,
             TRACE_DEVEL("Token specific des3 mac failed.\n");
         }
 
-        free(cipher);
+        session_mgr_op_free(sess, cipher, out_len);
 
 done:
         object_put(tokdata, key_obj, TRUE);
@@ -2236,7 +1738,7 @@ CK_RV des3_mac_verify_update(STDLL_TokData_t *tokdata,
             return rc;
         }
 
-        cipher = (CK_BYTE *) malloc(out_len);
+        cipher = session_mgr_op_alloc(sess, ctx, out_len);
         if (!cipher) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -2257,7 +1759,7 @@ CK_RV des3_mac_verify_update(STDLL_TokData_t *tokdata,
             TRACE_DEVEL("Token specific des3 mac failed.\n");
         }
 
-        free(cipher);
+        session_mgr_op_free(sess, cipher, out_len);
 
 done:
         object_put(tokdata, key_obj, TRUE);
@@ -2338,8 +1840,6 @@ static void des3_cmac_cleanup(STDLL_TokData_t *tokdata, SESSION *sess,
                               CK_BYTE *context, CK_ULONG context_len)
 {
     UNUSED(tokdata);
-    UNUSED(sess);
-    UNUSED(context_len);
 
     if (((DES_CMAC_CONTEXT *)context)->ctx != NULL) {
         token_specific.t_tdes_cmac(tokdata, (CK_BYTE *)"", 0, NULL,
@@ -2349,7 +1849,7 @@ static void des3_cmac_cleanup(STDLL_TokData_t *tokdata, SESSION *sess,
         ((DES_CMAC_CONTEXT *)context)->ctx = NULL;
     }
 
-    free(context);
+    session_mgr_op_free(sess, context, context_len);
 }
 
 CK_RV des3_cmac_sign(STDLL_TokData_t *tokdata,
@@ -2453,7 +1953,7 @@ CK_RV des3_cmac_sign_update(STDLL_TokData_t *tokdata,
             return rc;
         }
 
-        cipher = (CK_BYTE *) malloc(out_len);
+        cipher = session_mgr_op_alloc(sess, ctx, out_len);
         if (!cipher) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -2484,7 +1984,7 @@ CK_RV des3_cmac_sign_update(STDLL_TokData_t *tokdata,
             TRACE_DEVEL("Token specific des3 cmac failed.\n");
         }
 
-        free(cipher);
+        session_mgr_op_free(sess, cipher, out_len);
 
 done:
         object_put(tokdata, key_obj, TRUE);
@@ -2656,7 +2156,7 @@ CK_RV des3_cmac_verify_update(STDLL_TokData_t *tokdata,
             return rc;
         }
 
-        cipher = (CK_BYTE *) malloc(out_len);
+        cipher = session_mgr_op_alloc(sess, ctx, out_len);
         if (!cipher) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -2686,7 +2186,7 @@ CK_RV des3_cmac_verify_update(STDLL_TokData_t *tokdata,
             TRACE_DEVEL("Token specific des3 cmac failed.\n");
         }
 
-        free(cipher);
+        session_mgr_op_free(sess, cipher, out_len);
 
 done:
         object_put(tokdata, key_obj, TRUE);
@@ -47,7 +47,8 @@ CK_RV sw_md5_init(DIGEST_CONTEXT *ctx)
         return CKR_HOST_MEMORY;
     }
 
-    if (!EVP_DigestInit_ex((EVP_MD_CTX *)ctx->context, EVP_md5(), NULL)) {
+    if (!EVP_DigestInit_ex((EVP_MD_CTX *)ctx->context,
+                           openssl_md(EVP_md5()), NULL)) {
         TRACE_ERROR("%s\n", ock_err(ERR_FUNCTION_FAILED));
         EVP_MD_CTX_free((EVP_MD_CTX *)ctx->context);
         ctx->context = NULL;
@@ -10,6 +10,7 @@
 
 
 #include <pthread.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -32,6 +33,7 @@
 #include <openssl/sha.h>
 #include <openssl/cmac.h>
 #include <openssl/des.h>
+#include <openssl/rand.h>
 #if OPENSSL_VERSION_PREREQ(3, 0)
 #include <openssl/core_names.h>
 #include <openssl/param_build.h>
@@ -40,6 +42,7 @@
 void openssl_free_ex_data(OBJECT *obj, void *ex_data, size_t ex_data_len)
 {
     struct openssl_ex_data *data = ex_data;
+    int i;
 
     if (ex_data == NULL || ex_data_len < sizeof(struct openssl_ex_data))
         return;
@@ -49,6 +52,20 @@ void openssl_free_ex_data(OBJECT *obj, void *ex_data, size_t ex_data_len)
         data->pkey = NULL;
     }
 
+    for (i = 0; i < OPENSSL_EX_DATA_CIPHER_CTXS; i++) {
+        if (data->cipher_ctx[i] != NULL) {
+            EVP_CIPHER_CTX_free(data->cipher_ctx[i]);
+            data->cipher_ctx[i] = NULL;
+        }
+    }
+
+    for (i = 0; i < OPENSSL_EX_DATA_HMAC_CTXS; i++) {
+        if (data->hmac_ctx[i] != NULL) {
+            EVP_MD_CTX_free(data->hmac_ctx[i]);
+            data->hmac_ctx[i] = NULL;
+        }
+    }
+
     free(data);
     obj->ex_data = NULL;
     obj->ex_data_len = 0;
@@ -132,6 +149,270 @@ static CK_BBOOL openssl_need_wr_lock(OBJECT *obj, void *ex_data,
     return data->pkey == NULL;
 }
 
+#if OPENSSL_VERSION_PREREQ(3, 0)
+/*
+ * Algorithm implementations explicitly fetched from the library context the
+ * token runs in. With OpenSSL 3.0, using the EVP_sha256() style getters
+ * causes an implicit fetch (with a lookup in the method store under a lock)
+ * on every EVP_DigestInit_ex(), EVP_CipherInit_ex(), etc. The digests and
+ * ciphers are indexed by NID and fetched on first use. The MACs are fetched
+ * by name. The table is shared by all slots served by this library and bound
+ * to the library context it was fetched from. All entries are freed when the
+ * last of the slots is finalized, while that context is still valid.
+ */
+#define OPENSSL_ALGS_MAX_NID        1280
+
+static const char *openssl_mac_names[] = { "CMAC", "HMAC" };
+
+#define OPENSSL_ALGS_NUM_MACS   \
+            (sizeof(openssl_mac_names) / sizeof(openssl_mac_names[0]))
+
+static struct {
+    OSSL_LIB_CTX *libctx;       /* the context the entries were fetched from */
+    EVP_MD *md[OPENSSL_ALGS_MAX_NID];
+    EVP_CIPHER *cipher[OPENSSL_ALGS_MAX_NID];
+    EVP_MAC *mac[OPENSSL_ALGS_NUM_MACS];
+} openssl_algs;
+
+static pthread_mutex_t openssl_algs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long openssl_algs_users = 0;
+
+/* Returns the current (thread) default library context */
+static OSSL_LIB_CTX *openssl_current_libctx(void)
+{
+    return OSSL_LIB_CTX_set0_default(NULL);
+}
+
+/*
+ * Returns true if the table may be used from the current library context.
+ * A caller running in another context gets the implicit fetch instead.
+ */
+static int openssl_algs_usable(void)
+{
+    OSSL_LIB_CTX *libctx;
+
+    libctx = __atomic_load_n(&openssl_algs.libctx, __ATOMIC_ACQUIRE);
+
+    return libctx != NULL && libctx == openssl_current_libctx();
+}
+
+/*
+ * Returns the fetched implementation of a digest obtained via a EVP_xxx()
+ * getter. If it can not be fetched, the passed digest is returned, so that
+ * OpenSSL performs the implicit fetch as before.
+ */
+const EVP_MD *openssl_md(const EVP_MD *md)
+{
+    EVP_MD *fetched;
+    int nid;
+
+    if (md == NULL)
+        return NULL;
+
+    nid = EVP_MD_get_type(md);
+    if (nid <= NID_undef || nid >= OPENSSL_ALGS_MAX_NID ||
+        !openssl_algs_usable())
+        return md;
+
+    fetched = __atomic_load_n(&openssl_algs.md[nid], __ATOMIC_ACQUIRE);
+    if (fetched != NULL)
+        return fetched;
+
+    fetched = EVP_MD_fetch(openssl_current_libctx(), EVP_MD_get0_name(md),
+                           NULL);
+    if (fetched == NULL) {
+        TRACE_DEVEL("EVP_MD_fetch(%s) failed\n", EVP_MD_get0_name(md));
+        return md;
+    }
+
+    if (!__sync_bool_compare_and_swap(&openssl_algs.md[nid], NULL, fetched)) {
+        /* Another thread was faster */
+        EVP_MD_free(fetched);
+        fetched = __atomic_load_n(&openssl_algs.md[nid], __ATOMIC_ACQUIRE);
+    }
+
+    return fetched;
+}
+
+/* Same as openssl_md(), but for ciphers */
+const EVP_CIPHER *openssl_cipher(const EVP_CIPHER *cipher)
+{
+    EVP_CIPHER *fetched;
+    int nid;
+
+    if (cipher == NULL)
+        return NULL;
+
+    nid = EVP_CIPHER_get_nid(cipher);
+    if (nid <= NID_undef || nid >= OPENSSL_ALGS_MAX_NID ||
+        !openssl_algs_usable())
+        return cipher;
+
+    fetched = __atomic_load_n(&openssl_algs.cipher[nid], __ATOMIC_ACQUIRE);
+    if (fetched != NULL)
+        return fetched;
+
+    fetched = EVP_CIPHER_fetch(openssl_current_libctx(),
+                               EVP_CIPHER_get0_name(cipher), NULL);
+    if (fetched == NULL) {
+        TRACE_DEVEL("EVP_CIPHER_fetch(%s) failed\n",
+                    EVP_CIPHER_get0_name(cipher));
+        return cipher;
+    }
+
+    if (!__sync_bool_compare_and_swap(&openssl_algs.cipher[nid], NULL,
+                                      fetched)) {
+        EVP_CIPHER_free(fetched);
+        fetched = __atomic_load_n(&openssl_algs.cipher[nid],
+                                  __ATOMIC_ACQUIRE);
+    }
+
+    return fetched;
+}
+
+/*
+ * Returns the fetched MAC with the specified name. The caller gets its own
+ * reference, and must free it with EVP_MAC_free().
+ */
+EVP_MAC *openssl_mac(const char *name)
+{
+    EVP_MAC *fetched;
+    size_t i;
+
+    for (i = 0; i < OPENSSL_ALGS_NUM_MACS; i++) {
+        if (strcmp(openssl_mac_names[i], name) == 0)
+            break;
+    }
+    if (i >= OPENSSL_ALGS_NUM_MACS || !openssl_algs_usable())
+        return EVP_MAC_fetch(NULL, name, NULL);
+
+    fetched = __atomic_load_n(&openssl_algs.mac[i], __ATOMIC_ACQUIRE);
+    if (fetched == NULL) {
+        fetched = EVP_MAC_fetch(openssl_current_libctx(), name, NULL);
+        if (fetched == NULL)
+            return NULL;
+
+        if (!__sync_bool_compare_and_swap(&openssl_algs.mac[i], NULL,
+                                          fetched)) {
+            EVP_MAC_free(fetched);
+            fetched = __atomic_load_n(&openssl_algs.mac[i], __ATOMIC_ACQUIRE);
+        }
+    }
+
+    if (EVP_MAC_up_ref(fetched) != 1)
+        return NULL;
+
+    return fetched;
+}
+
+/*
+ * Clears the table. The entries are only freed if do_free is true, i.e. if
+ * the library context they were fetched from is known to be still valid.
+ */
+static void openssl_algs_clear(CK_BBOOL do_free)
+{
+    size_t i;
+
+    __atomic_store_n(&openssl_algs.libctx, NULL, __ATOMIC_RELEASE);
+
+    for (i = 0; i < OPENSSL_ALGS_MAX_NID; i++) {
+        if (do_free) {
+            EVP_MD_free(openssl_algs.md[i]);
+            EVP_CIPHER_free(openssl_algs.cipher[i]);
+        }
+        openssl_algs.md[i] = NULL;
+        openssl_algs.cipher[i] = NULL;
+    }
+
+    for (i = 0; i < OPENSSL_ALGS_NUM_MACS; i++) {
+        if (do_free)
+            EVP_MAC_free(openssl_algs.mac[i]);
+        openssl_algs.mac[i] = NULL;
+    }
+}
+
+/*
+ * Called by each slot that is initialized, before it uses the table. The
+ * first slot binds the table to its library context. Entries left over from
+ * a different context are dropped without freeing them, that context may
+ * already be gone.
+ */
+void openssl_algs_get(void)
+{
+    OSSL_LIB_CTX *libctx = openssl_current_libctx();
+
+    pthread_mutex_lock(&openssl_algs_mutex);
+
+    if (openssl_algs_users == 0 && openssl_algs.libctx != libctx) {
+        openssl_algs_clear(FALSE);
+        __atomic_store_n(&openssl_algs.libctx, libctx, __ATOMIC_RELEASE);
+    }
+    openssl_algs_users++;
+
+    pthread_mutex_unlock(&openssl_algs_mutex);
+}
+
+/*
+ * Called by each slot that is finalized. The table is freed once no slot of
+ * this library uses it anymore.
+ */
+void openssl_algs_put(void)
+{
+    pthread_mutex_lock(&openssl_algs_mutex);
+
+    if (openssl_algs_users > 0) {
+        openssl_algs_users--;
+        if (openssl_algs_users == 0)
+            openssl_algs_clear(TRUE);
+    }
+
+    pthread_mutex_unlock(&openssl_algs_mutex);
+}
+#else
+const EVP_MD *openssl_md(const EVP_MD *md)
+{
+    return md;
+}
+
+const EVP_CIPHER *openssl_cipher(const EVP_CIPHER *cipher)
+{
+    return cipher;
+}
+
+void openssl_algs_get(void)
+{
+}
+
+void openssl_algs_put(void)
+{
+}
+#endif
+
+/*
+ * Random numbers from OpenSSL's private DRBG. OpenSSL keeps one DRBG instance
+ * per thread, seeds it from getrandom(), and reseeds it after a fork, so
+ * this does not need any system call or locking in the common case.
+ */
+CK_RV openssl_specific_rng(STDLL_TokData_t *tokdata, CK_BYTE *output,
+                           CK_ULONG bytes)
+{
+    int len;
+
+    UNUSED(tokdata);
+
+    while (bytes > 0) {
+        len = bytes > INT_MAX ? INT_MAX : (int)bytes;
+        if (RAND_priv_bytes(output, len) != 1) {
+            TRACE_ERROR("RAND_priv_bytes failed\n");
+            return CKR_FUNCTION_FAILED;
+        }
+        output += len;
+        bytes -= len;
+    }
+
+    return CKR_OK;
+}
+
 CK_RV openssl_specific_rsa_keygen(TEMPLATE *publ_tmpl, TEMPLATE *priv_tmpl)
 {
     CK_ATTRIBUTE *publ_exp = NULL;
@@ -2998,7 +3279,7 @@ static const EVP_MD *md_from_mech(CK_MECHANISM *mech)
         break;
     }
 
-    return md;
+    return openssl_md(md);
 }
 
 #if !OPENSSL_VERSION_PREREQ(3, 0)
@@ -3279,7 +3560,8 @@ out:
     return rc;
 }
 
-static const EVP_CIPHER *openssl_cipher_from_mech(CK_MECHANISM_TYPE mech,
+static const EVP_CIPHER *openssl_legacy_cipher_from_mech(
+                                                  CK_MECHANISM_TYPE mech,
                                                   CK_ULONG keylen,
                                                   CK_KEY_TYPE keytype)
 {
@@ -3446,6 +3728,51 @@ static const EVP_CIPHER *openssl_cipher_from_mech(CK_MECHANISM_TYPE mech,
     return NULL;
 }
 
+static const EVP_CIPHER *openssl_cipher_from_mech(CK_MECHANISM_TYPE mech,
+                                                  CK_ULONG keylen,
+                                                  CK_KEY_TYPE keytype)
+{
+    return openssl_cipher(openssl_legacy_cipher_from_mech(mech, keylen,
+                                                          keytype));
+}
+
+/*
+ * Returns the index of the cached cipher context in the key's ex_data for
+ * the mechanism and direction, or -1 if the mechanism is not cached.
+ */
+static int openssl_cipher_ctx_index(CK_MECHANISM_TYPE mech, CK_BYTE encrypt)
+{
+    int idx;
+
+    switch (mech) {
+    case CKM_AES_ECB:
+        idx = 0;
+        break;
+    case CKM_AES_CBC:
+        idx = 1;
+        break;
+    case CKM_DES_ECB:
+        idx = 2;
+        break;
+    case CKM_DES_CBC:
+        idx = 3;
+        break;
+    case CKM_DES3_ECB:
+        idx = 4;
+        break;
+    case CKM_DES3_CBC:
+        idx = 5;
+        break;
+    case CKM_AES_XTS:
+        idx = 6;
+        break;
+    default:
+        return -1;
+    }
+
+    return idx * 2 + (encrypt ? 1 : 0);
+}
+
 static CK_RV openssl_cipher_perform(OBJECT *key, CK_MECHANISM_TYPE mech,
                                     CK_BYTE *in_data,  CK_ULONG in_data_len,
                                     CK_BYTE *out_data, CK_ULONG *out_data_len,
@@ -3455,8 +3782,10 @@ static CK_RV openssl_cipher_perform(OBJECT *key, CK_MECHANISM_TYPE mech,
     const EVP_CIPHER *cipher = NULL;
     CK_ATTRIBUTE *key_attr = NULL;
     EVP_CIPHER_CTX *ctx = NULL;
+    struct openssl_ex_data *ex_data = NULL;
     CK_KEY_TYPE keytype = 0;
-    int blocksize, outlen;
+    int blocksize, outlen, idx;
+    CK_BBOOL cached = FALSE;
     CK_RV rc;
 
     rc = template_attribute_get_ulong(key->template, CKA_KEY_TYPE, &keytype);
@@ -3489,16 +3818,54 @@ static CK_RV openssl_cipher_perform(OBJECT *key, CK_MECHANISM_TYPE mech,
         return CKR_DATA_LEN_RANGE;
     }
 
-    ctx = EVP_CIPHER_CTX_new();
-    if (ctx == NULL) {
-        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-        return CKR_HOST_MEMORY;
+    /*
+     * For ECB, CBC and XTS, the context with the expanded key is kept in the key
+     * object's ex_data, so that only the IV needs to be set for subsequent
+     * operations. If the cached context is in use by another thread, a
+     * temporary context is used instead. The ex_data (and with it the cached
+     * contexts) is freed when the key object is reloaded.
+     */
+    idx = openssl_cipher_ctx_index(mech, encrypt);
+    if (idx >= 0) {
+        rc = openssl_get_ex_data(key, (void **)&ex_data,
+                                 sizeof(struct openssl_ex_data), NULL, NULL);
+        if (rc != CKR_OK)
+            return rc;
+
+        if (__sync_lock_test_and_set(&ex_data->cipher_ctx_busy[idx], 1) == 0) {
+            cached = TRUE;
+            ctx = ex_data->cipher_ctx[idx];
+        }
+    }
+
+    if (ctx != NULL) {
+        if (EVP_CipherInit_ex(ctx, NULL, NULL, NULL, init_v, -1) != 1 ||
+            EVP_CIPHER_CTX_set_padding(ctx, 0) != 1) {
+            TRACE_ERROR("%s\n", ock_err(ERR_GENERAL_ERROR));
+            rc = CKR_GENERAL_ERROR;
+            goto done;
+        }
+    } else {
+        ctx = EVP_CIPHER_CTX_new();
+        if (ctx == NULL) {
+            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+            rc = CKR_HOST_MEMORY;
+            goto done;
+        }
+
+        if (EVP_CipherInit_ex(ctx, cipher, NULL, key_attr->pValue,
+                              init_v, encrypt ? 1 : 0) != 1
+            || EVP_CIPHER_CTX_set_padding(ctx, 0) != 1) {
+            TRACE_ERROR("%s\n", ock_err(ERR_GENERAL_ERROR));
+            rc = CKR_GENERAL_ERROR;
+            goto done;
+        }
+
+        if (cached)
+            ex_data->cipher_ctx[idx] = ctx;
     }
 
-    if (EVP_CipherInit_ex(ctx, cipher, NULL, key_attr->pValue,
-                          init_v, encrypt ? 1 : 0) != 1
-        || EVP_CIPHER_CTX_set_padding(ctx, 0) != 1
-        || EVP_CipherUpdate(ctx, out_data, &outlen, in_data, in_data_len) != 1
+    if (EVP_CipherUpdate(ctx, out_data, &outlen, in_data, in_data_len) != 1
         || EVP_CipherFinal_ex(ctx, out_data, &outlen) != 1) {
         TRACE_ERROR("%s\n", ock_err(ERR_GENERAL_ERROR));
         rc = CKR_GENERAL_ERROR;
@@ -3522,7 +3889,20 @@ static CK_RV openssl_cipher_perform(OBJECT *key, CK_MECHANISM_TYPE mech,
     rc = CKR_OK;
 
 done:
-    EVP_CIPHER_CTX_free(ctx);
+    if (cached) {
+        /* Do not keep a context in an undefined state */
+        if (rc != CKR_OK && ctx != NULL) {
+            EVP_CIPHER_CTX_free(ctx);
+            ex_data->cipher_ctx[idx] = NULL;
+        }
+        __sync_lock_release(&ex_data->cipher_ctx_busy[idx]);
+    } else {
+        EVP_CIPHER_CTX_free(ctx);
+    }
+
+    if (ex_data != NULL)
+        object_ex_data_unlock(key);
+
     return rc;
 }
 
@@ -3624,7 +4004,7 @@ CK_RV openssl_cmac_perform(CK_MECHANISM_TYPE mech, CK_BYTE *message,
             goto err;
         }
 #else
-        cmac->mac = EVP_MAC_fetch(NULL, "CMAC", NULL);
+        cmac->mac = openssl_mac("CMAC");
         if (cmac->mac == NULL) {
             TRACE_ERROR("%s\n", ock_err(ERR_FUNCTION_FAILED));
             rv = CKR_FUNCTION_FAILED;
@@ -3839,8 +4219,6 @@ static void openssl_specific_aes_gcm_free(STDLL_TokData_t *tokdata,
     AES_GCM_CONTEXT *ctx = (AES_GCM_CONTEXT *)context;
 
     UNUSED(tokdata);
-    UNUSED(sess);
-    UNUSED(context_len);
 
     if (ctx == NULL)
         return;
@@ -3848,7 +4226,7 @@ static void openssl_specific_aes_gcm_free(STDLL_TokData_t *tokdata,
     if ((EVP_CIPHER_CTX *)ctx->ulClen != NULL)
         EVP_CIPHER_CTX_free((EVP_CIPHER_CTX *)ctx->ulClen);
 
-    free(context);
+    session_mgr_op_free(sess, context, context_len);
 }
 
 CK_RV openssl_specific_aes_gcm_init(STDLL_TokData_t *tokdata, SESSION *sess,
@@ -4300,26 +4678,65 @@ static EVP_CIPHER_CTX *aes_xts_init_ecb_cipher_ctx(const CK_BYTE *key,
     return ctx;
 }
 
-static void aes_xts_xor_block(const CK_BYTE *in1, const CK_BYTE *in2,
-                              CK_BYTE *out)
+/*
+ * Number of blocks processed per bulk ECB call. The tweaks of a whole batch
+ * are computed up front, so that a single EVP_Cipher call can cover the batch.
+ */
+#define AES_XTS_BATCH_BLOCKS    256
+
+/* OpenSSL refuses XTS data units larger than 2^20 blocks */
+#define AES_XTS_MAX_UNIT_LEN    ((1UL << 20) * AES_BLOCK_SIZE)
+
+static inline uint64_t aes_xts_load64(const CK_BYTE *p)
+{
+    return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 |
+           (uint64_t)p[3] << 24 | (uint64_t)p[4] << 32 |
+           (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 |
+           (uint64_t)p[7] << 56;
+}
+
+static inline void aes_xts_store64(CK_BYTE *p, uint64_t v)
 {
     CK_ULONG i;
 
-    for (i = 0; i < AES_BLOCK_SIZE; i++)
-        out[i] = in1[i] ^ in2[i];
+    for (i = 0; i < 8; i++, v >>= 8)
+        p[i] = (CK_BYTE)v;
 }
 
-static void aes_xts_mult(CK_BYTE *iv)
+/*
+ * Multiply the tweak (two little endian 64 bit words) by alpha in GF(2^128).
+ */
+static inline void aes_xts_mult64(uint64_t *lo, uint64_t *hi)
 {
-    CK_ULONG c, i;
+    uint64_t carry = *hi >> 63;
 
-    for (c = 0, i = 0; i < AES_BLOCK_SIZE; ++i) {
-        c += ((CK_ULONG)iv[i]) << 1;
-        iv[i] = (CK_BYTE)c;
-        c = c >> 8;
-    }
+    *hi = (*hi << 1) | (*lo >> 63);
+    *lo = (*lo << 1) ^ (0x87 & (0 - carry));
+}
+
+static void aes_xts_mult(CK_BYTE *iv, CK_ULONG count)
+{
+    uint64_t lo = aes_xts_load64(iv), hi = aes_xts_load64(iv + 8);
+
+    while (count-- > 0)
+        aes_xts_mult64(&lo, &hi);
+
+    aes_xts_store64(iv, lo);
+    aes_xts_store64(iv + 8, hi);
+}
+
+static void aes_xts_xor_blocks(const CK_BYTE *in1, const CK_BYTE *in2,
+                               CK_BYTE *out, CK_ULONG len)
+{
+    uint64_t a, b;
+    CK_ULONG i;
 
-    iv[0] ^= (CK_BYTE)(0x87 & (0 - c));
+    for (i = 0; i < len; i += sizeof(a)) {
+        memcpy(&a, in1 + i, sizeof(a));
+        memcpy(&b, in2 + i, sizeof(b));
+        a ^= b;
+        memcpy(out + i, &a, sizeof(a));
+    }
 }
 
 struct aes_xts_cb_data {
@@ -4343,28 +4760,123 @@ static CK_RV aes_xts_cipher_blocks(CK_BYTE *in, CK_BYTE *out, CK_ULONG len,
                                    CK_BYTE *iv, void * cb_data)
 {
     struct aes_xts_cb_data *data = cb_data;
-    CK_BYTE buf[AES_INIT_VECTOR_SIZE];
+    CK_BYTE tweaks[AES_XTS_BATCH_BLOCKS * AES_BLOCK_SIZE];
+    CK_BYTE buf[AES_XTS_BATCH_BLOCKS * AES_BLOCK_SIZE];
+    CK_ULONG i, blocks, batch_len;
+    uint64_t lo, hi;
+
+    lo = aes_xts_load64(iv);
+    hi = aes_xts_load64(iv + 8);
 
     while (len >= AES_BLOCK_SIZE) {
-        aes_xts_xor_block(in, iv, buf);
+        blocks = len / AES_BLOCK_SIZE;
+        if (blocks > AES_XTS_BATCH_BLOCKS)
+            blocks = AES_XTS_BATCH_BLOCKS;
+        batch_len = blocks * AES_BLOCK_SIZE;
+
+        /* Tweaks for the whole batch, then one ECB call over the batch */
+        for (i = 0; i < batch_len; i += AES_BLOCK_SIZE) {
+            aes_xts_store64(tweaks + i, lo);
+            aes_xts_store64(tweaks + i + 8, hi);
+            aes_xts_mult64(&lo, &hi);
+        }
+
+        aes_xts_xor_blocks(in, tweaks, buf, batch_len);
 
-        if (EVP_Cipher(data->cipher_ctx, out, buf, AES_BLOCK_SIZE) <= 0) {
+        if (EVP_Cipher(data->cipher_ctx, out, buf, batch_len) <= 0) {
             TRACE_ERROR("EVP_Cipher failed\n");
+            OPENSSL_cleanse(buf, sizeof(buf));
             return CKR_FUNCTION_FAILED;
         }
 
-        aes_xts_xor_block(out, iv, out);
+        aes_xts_xor_blocks(out, tweaks, out, batch_len);
 
-        in += AES_BLOCK_SIZE;
-        out += AES_BLOCK_SIZE;
-        len -= AES_BLOCK_SIZE;
-
-        aes_xts_mult(iv);
+        in += batch_len;
+        out += batch_len;
+        len -= batch_len;
     }
 
+    aes_xts_store64(iv, lo);
+    aes_xts_store64(iv + 8, hi);
+
+    OPENSSL_cleanse(buf, sizeof(buf));
+
     return CKR_OK;
 }
 
+/*
+ * Process a part of an XTS data unit with OpenSSL's native XTS
+ * implementation. The native cipher derives the tweak of the first block from
+ * the unencrypted tweak value, so for a continuation the current (encrypted)
+ * tweak in iv is decrypted with the tweak key first. For a non-final part, the
+ * tweak for the next part is returned in iv.
+ */
+static CK_RV aes_xts_native_cipher(OBJECT *key_obj, CK_ATTRIBUTE *key_attr,
+                                   CK_BYTE *in_data, CK_ULONG in_data_len,
+                                   CK_BYTE *out_data, CK_ULONG *out_data_len,
+                                   CK_BYTE *tweak, CK_BBOOL encrypt,
+                                   CK_BBOOL initial, CK_BBOOL final,
+                                   CK_BYTE *iv)
+{
+    CK_ULONG half = key_attr->ulValueLen / 2;
+    CK_BYTE unit_iv[AES_INIT_VECTOR_SIZE];
+    EVP_CIPHER_CTX *tweak_ctx = NULL;
+    CK_RV rc;
+
+    if (!final && (in_data_len % AES_BLOCK_SIZE) != 0)
+        return CKR_DATA_LEN_RANGE;
+    if (final && in_data_len < AES_BLOCK_SIZE)
+        return CKR_DATA_LEN_RANGE;
+
+    if (out_data == NULL) {
+        *out_data_len = in_data_len;
+        return CKR_OK;
+    }
+
+    if (*out_data_len < in_data_len)
+        return CKR_BUFFER_TOO_SMALL;
+
+    if (initial && final)
+        return openssl_cipher_perform(key_obj, CKM_AES_XTS,
+                                      in_data, in_data_len,
+                                      out_data, out_data_len,
+                                      tweak, NULL, encrypt);
+
+    tweak_ctx = aes_xts_init_ecb_cipher_ctx((CK_BYTE *)key_attr->pValue + half,
+                                            half, initial);
+    if (tweak_ctx == NULL) {
+        TRACE_ERROR("aes_xts_init_ecb_cipher_ctx failed\n");
+        return CKR_FUNCTION_FAILED;
+    }
+
+    if (initial) {
+        memcpy(unit_iv, tweak, AES_INIT_VECTOR_SIZE);
+    } else if (EVP_Cipher(tweak_ctx, unit_iv, iv, AES_BLOCK_SIZE) <= 0) {
+        TRACE_ERROR("EVP_Cipher failed\n");
+        rc = CKR_FUNCTION_FAILED;
+        goto out;
+    }
+
+    rc = openssl_cipher_perform(key_obj, CKM_AES_XTS, in_data, in_data_len,
+                                out_data, out_data_len, unit_iv, NULL,
+                                encrypt);
+    if (rc != CKR_OK || final)
+        goto out;
+
+    if (initial && EVP_Cipher(tweak_ctx, iv, tweak, AES_BLOCK_SIZE) <= 0) {
+        TRACE_ERROR("EVP_Cipher failed\n");
+        rc = CKR_FUNCTION_FAILED;
+        goto out;
+    }
+    aes_xts_mult(iv, in_data_len / AES_BLOCK_SIZE);
+
+out:
+    EVP_CIPHER_CTX_free(tweak_ctx);
+    OPENSSL_cleanse(unit_iv, sizeof(unit_iv));
+
+    return rc;
+}
+
 CK_RV openssl_specific_aes_xts(STDLL_TokData_t *tokdata,
                                CK_BYTE *in_data, CK_ULONG in_data_len,
                                CK_BYTE *out_data, CK_ULONG *out_data_len,
@@ -4374,16 +4886,11 @@ CK_RV openssl_specific_aes_xts(STDLL_TokData_t *tokdata,
 {
     struct aes_xts_cb_data data = { 0 };
     CK_ATTRIBUTE *key_attr;
+    CK_ULONG half;
     CK_RV rc;
 
     UNUSED(tokdata);
 
-    if (initial && final)
-        return openssl_cipher_perform(key_obj, CKM_AES_XTS,
-                                      in_data, in_data_len,
-                                      out_data, out_data_len,
-                                      tweak, NULL, encrypt);
-
     rc = template_attribute_get_non_empty(key_obj->template, CKA_VALUE,
                                           &key_attr);
     if (rc != CKR_OK) {
@@ -4391,10 +4898,27 @@ CK_RV openssl_specific_aes_xts(STDLL_TokData_t *tokdata,
         return rc;
     }
 
+    half = key_attr->ulValueLen / 2;
+    if (half != AES_KEY_SIZE_128 && half != AES_KEY_SIZE_256) {
+        TRACE_ERROR("Key size wrong: %lu.\n", key_attr->ulValueLen);
+        return CKR_KEY_SIZE_RANGE;
+    }
+
+    /*
+     * OpenSSL's native XTS rejects keys with identical halves, and data units
+     * larger than 2^20 blocks. Everything else goes through the native cipher,
+     * the bulk ECB engine below handles the remaining cases.
+     */
+    if (in_data_len <= AES_XTS_MAX_UNIT_LEN &&
+        CRYPTO_memcmp(key_attr->pValue, (CK_BYTE *)key_attr->pValue + half,
+                      half) != 0)
+        return aes_xts_native_cipher(key_obj, key_attr, in_data, in_data_len,
+                                     out_data, out_data_len, tweak, encrypt,
+                                     initial, final, iv);
+
     if (initial) {
         data.tweak_ctx = aes_xts_init_ecb_cipher_ctx(
-                        (CK_BYTE *)key_attr->pValue + key_attr->ulValueLen / 2,
-                        key_attr->ulValueLen / 2, TRUE);
+                        (CK_BYTE *)key_attr->pValue + half, half, TRUE);
         if (data.tweak_ctx == NULL) {
             TRACE_ERROR("aes_xts_init_ecb_cipher_ctx failed\n");
             rc = CKR_FUNCTION_FAILED;
@@ -4403,8 +4927,7 @@ CK_RV openssl_specific_aes_xts(STDLL_TokData_t *tokdata,
     }
 
     data.cipher_ctx = aes_xts_init_ecb_cipher_ctx((CK_BYTE *)key_attr->pValue,
-                                                  key_attr->ulValueLen / 2,
-                                                  encrypt);
+                                                  half, encrypt);
     if (data.cipher_ctx == NULL) {
         TRACE_ERROR("aes_xts_init_ecb_cipher_ctx failed\n");
         rc = CKR_FUNCTION_FAILED;
@@ -4528,6 +5051,129 @@ CK_RV openssl_specific_tdes_cfb(STDLL_TokData_t *tokdata,
                                   encrypt);
 }
 
+/*
+ * Multi-part encryption or decryption of a multiple of the block size. The
+ * cipher context is created on the first call and returned in *ctx, so that
+ * subsequent calls continue with the expanded key and the chaining state of
+ * the previous call. If init_v is not NULL, it receives the updated IV after
+ * each call. The context is freed when last is TRUE.
+ */
+CK_RV openssl_specific_cipher_update(STDLL_TokData_t *tokdata,
+                                     CK_MECHANISM_TYPE mech,
+                                     CK_BYTE *in_data, CK_ULONG in_data_len,
+                                     CK_BYTE *out_data, OBJECT *key,
+                                     CK_BYTE *init_v, CK_BYTE encrypt,
+                                     CK_BBOOL last, CK_VOID_PTR *ctx)
+{
+    EVP_CIPHER_CTX *evp_ctx = (EVP_CIPHER_CTX *)*ctx;
+    const EVP_CIPHER *cipher = NULL;
+    CK_ATTRIBUTE *key_attr = NULL;
+    CK_KEY_TYPE keytype = 0;
+    int outlen;
+    CK_RV rc;
+
+    UNUSED(tokdata);
+
+    if (evp_ctx == NULL && !last) {
+        if (key == NULL)
+            return CKR_ARGUMENTS_BAD;
+
+        switch (mech) {
+        case CKM_AES_CBC_PAD:
+            mech = CKM_AES_CBC;
+            break;
+        case CKM_DES3_CBC_PAD:
+            mech = CKM_DES3_CBC;
+            break;
+        default:
+            break;
+        }
+
+        rc = template_attribute_get_ulong(key->template, CKA_KEY_TYPE,
+                                          &keytype);
+        if (rc != CKR_OK) {
+            TRACE_ERROR("Could not find CKA_KEY_TYPE for the key\n");
+            return rc;
+        }
+
+        rc = template_attribute_get_non_empty(key->template, CKA_VALUE,
+                                              &key_attr);
+        if (rc != CKR_OK) {
+            TRACE_ERROR("Could not find CKA_VALUE for the key.\n");
+            return rc;
+        }
+
+        cipher = openssl_cipher_from_mech(mech, key_attr->ulValueLen, keytype);
+        if (cipher == NULL) {
+            TRACE_ERROR("Cipher not supported.\n");
+            return CKR_MECHANISM_INVALID;
+        }
+
+        evp_ctx = EVP_CIPHER_CTX_new();
+        if (evp_ctx == NULL) {
+            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+            return CKR_HOST_MEMORY;
+        }
+
+        if (EVP_CipherInit_ex(evp_ctx, cipher, NULL, key_attr->pValue,
+                              init_v, encrypt ? 1 : 0) != 1
+            || EVP_CIPHER_CTX_set_padding(evp_ctx, 0) != 1) {
+            TRACE_ERROR("%s\n", ock_err(ERR_GENERAL_ERROR));
+            rc = CKR_GENERAL_ERROR;
+            goto err;
+        }
+
+        *ctx = evp_ctx;
+    }
+
+    if (in_data_len > 0) {
+        if (evp_ctx == NULL) {
+            TRACE_ERROR("%s\n", ock_err(ERR_FUNCTION_FAILED));
+            return CKR_FUNCTION_FAILED;
+        }
+
+        if (in_data_len > INT_MAX) {
+            TRACE_ERROR("%s\n", ock_err(ERR_DATA_LEN_RANGE));
+            rc = CKR_DATA_LEN_RANGE;
+            goto err;
+        }
+
+        if (EVP_CipherUpdate(evp_ctx, out_data, &outlen,
+                             in_data, in_data_len) != 1 ||
+            (CK_ULONG)outlen != in_data_len) {
+            TRACE_ERROR("%s\n", ock_err(ERR_GENERAL_ERROR));
+            rc = CKR_GENERAL_ERROR;
+            goto err;
+        }
+
+        if (init_v != NULL) {
+#if !OPENSSL_VERSION_PREREQ(3, 0)
+            memcpy(init_v, EVP_CIPHER_CTX_iv(evp_ctx),
+                   EVP_CIPHER_CTX_iv_length(evp_ctx));
+#else
+            if (EVP_CIPHER_CTX_get_updated_iv(evp_ctx, init_v,
+                                EVP_CIPHER_CTX_get_iv_length(evp_ctx)) != 1) {
+                TRACE_ERROR("%s\n", ock_err(ERR_GENERAL_ERROR));
+                rc = CKR_GENERAL_ERROR;
+                goto err;
+            }
+#endif
+        }
+    }
+
+    if (last) {
+        EVP_CIPHER_CTX_free(evp_ctx);
+        *ctx = NULL;
+    }
+
+    return CKR_OK;
+
+err:
+    EVP_CIPHER_CTX_free(evp_ctx);
+    *ctx = NULL;
+    return rc;
+}
+
 CK_RV openssl_specific_tdes_mac(STDLL_TokData_t *tokdata, CK_BYTE *message,
                                 CK_ULONG message_len, OBJECT *key, CK_BYTE *mac)
 {
@@ -4572,125 +5218,188 @@ static void openssl_specific_hmac_free(STDLL_TokData_t *tokdata, SESSION *sess,
     EVP_MD_CTX_destroy((EVP_MD_CTX *)context);
 }
 
-CK_RV openssl_specific_hmac_init(STDLL_TokData_t *tokdata,
-                                 SIGN_VERIFY_CONTEXT *ctx,
-                                 CK_MECHANISM_PTR mech,
-                                 CK_OBJECT_HANDLE Hkey)
+/*
+ * Returns the digest for an HMAC mechanism, and the index of the cached HMAC
+ * context in the key's ex_data.
+ */
+static const EVP_MD *openssl_hmac_md_from_mech(CK_MECHANISM_TYPE mech,
+                                               int *idx)
 {
-    int rc;
-    OBJECT *key = NULL;
-    CK_ATTRIBUTE *attr = NULL;
-    EVP_MD_CTX *mdctx = NULL;
-    EVP_PKEY *pkey = NULL;
-
-    rc = object_mgr_find_in_map1(tokdata, Hkey, &key, READ_LOCK);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("Failed to find specified object.\n");
-        return rc;
-    }
-
-    rc = template_attribute_get_non_empty(key->template, CKA_VALUE, &attr);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("Could not find CKA_VALUE for the key.\n");
-        goto done;
-    }
-
-    pkey = EVP_PKEY_new_mac_key(EVP_PKEY_HMAC, NULL, attr->pValue,
-                                attr->ulValueLen);
-    if (pkey == NULL) {
-        TRACE_ERROR("EVP_PKEY_new_mac_key() failed.\n");
-        rc = CKR_FUNCTION_FAILED;
-        goto done;
-    }
-
-    mdctx = EVP_MD_CTX_create();
-    if (mdctx == NULL) {
-        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-        rc = CKR_HOST_MEMORY;
-        goto done;
-    }
-
-    switch (mech->mechanism) {
+    switch (mech) {
     case CKM_MD5_HMAC_GENERAL:
     case CKM_MD5_HMAC:
-        rc = EVP_DigestSignInit(mdctx, NULL, EVP_md5(), NULL, pkey);
-        break;
+        *idx = 0;
+        return EVP_md5();
     case CKM_SHA_1_HMAC_GENERAL:
     case CKM_SHA_1_HMAC:
-        rc = EVP_DigestSignInit(mdctx, NULL, EVP_sha1(), NULL, pkey);
-        break;
+        *idx = 1;
+        return EVP_sha1();
     case CKM_SHA224_HMAC_GENERAL:
     case CKM_SHA224_HMAC:
-        rc = EVP_DigestSignInit(mdctx, NULL, EVP_sha224(), NULL, pkey);
-        break;
+        *idx = 2;
+        return EVP_sha224();
     case CKM_SHA256_HMAC_GENERAL:
     case CKM_SHA256_HMAC:
-        rc = EVP_DigestSignInit(mdctx, NULL, EVP_sha256(), NULL, pkey);
-        break;
+        *idx = 3;
+        return EVP_sha256();
     case CKM_SHA384_HMAC_GENERAL:
     case CKM_SHA384_HMAC:
-        rc = EVP_DigestSignInit(mdctx, NULL, EVP_sha384(), NULL, pkey);
-        break;
+        *idx = 4;
+        return EVP_sha384();
     case CKM_SHA512_HMAC_GENERAL:
     case CKM_SHA512_HMAC:
-        rc = EVP_DigestSignInit(mdctx, NULL, EVP_sha512(), NULL, pkey);
-        break;
+        *idx = 5;
+        return EVP_sha512();
 #ifdef NID_sha512_224WithRSAEncryption
     case CKM_SHA512_224_HMAC_GENERAL:
     case CKM_SHA512_224_HMAC:
-        rc = EVP_DigestSignInit(mdctx, NULL, EVP_sha512_224(), NULL, pkey);
-        break;
+        *idx = 6;
+        return EVP_sha512_224();
 #endif
 #ifdef NID_sha512_256WithRSAEncryption
     case CKM_SHA512_256_HMAC_GENERAL:
     case CKM_SHA512_256_HMAC:
-        rc = EVP_DigestSignInit(mdctx, NULL, EVP_sha512_256(), NULL, pkey);
-        break;
+        *idx = 7;
+        return EVP_sha512_256();
 #endif
 #ifdef NID_sha3_224
     case CKM_IBM_SHA3_224_HMAC:
-        rc = EVP_DigestSignInit(mdctx, NULL, EVP_sha3_224(), NULL, pkey);
-        break;
+        *idx = 8;
+        return EVP_sha3_224();
 #endif
 #ifdef NID_sha3_256
     case CKM_IBM_SHA3_256_HMAC:
-        rc = EVP_DigestSignInit(mdctx, NULL, EVP_sha3_256(), NULL, pkey);
-        break;
+        *idx = 9;
+        return EVP_sha3_256();
 #endif
 #ifdef NID_sha3_384
     case CKM_IBM_SHA3_384_HMAC:
-        rc = EVP_DigestSignInit(mdctx, NULL, EVP_sha3_384(), NULL, pkey);
-        break;
+        *idx = 10;
+        return EVP_sha3_384();
 #endif
 #ifdef NID_sha3_512
     case CKM_IBM_SHA3_512_HMAC:
-        rc = EVP_DigestSignInit(mdctx, NULL, EVP_sha3_512(), NULL, pkey);
-        break;
+        *idx = 11;
+        return EVP_sha3_512();
 #endif
     default:
+        return NULL;
+    }
+}
+
+static EVP_MD_CTX *openssl_hmac_ctx_new(const EVP_MD *md, CK_ATTRIBUTE *attr)
+{
+    EVP_MD_CTX *mdctx = NULL;
+    EVP_PKEY *pkey = NULL;
+
+    pkey = EVP_PKEY_new_mac_key(EVP_PKEY_HMAC, NULL, attr->pValue,
+                                attr->ulValueLen);
+    if (pkey == NULL) {
+        TRACE_ERROR("EVP_PKEY_new_mac_key() failed.\n");
+        return NULL;
+    }
+
+    mdctx = EVP_MD_CTX_create();
+    if (mdctx == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        goto out;
+    }
+
+    if (EVP_DigestSignInit(mdctx, NULL, md, NULL, pkey) != 1) {
+        TRACE_ERROR("EVP_DigestSignInit failed.\n");
         EVP_MD_CTX_destroy(mdctx);
+        mdctx = NULL;
+    }
+
+out:
+    EVP_PKEY_free(pkey);
+    return mdctx;
+}
+
+CK_RV openssl_specific_hmac_init(STDLL_TokData_t *tokdata,
+                                 SIGN_VERIFY_CONTEXT *ctx,
+                                 CK_MECHANISM_PTR mech,
+                                 CK_OBJECT_HANDLE Hkey)
+{
+    CK_RV rc;
+    OBJECT *key = NULL;
+    CK_ATTRIBUTE *attr = NULL;
+    EVP_MD_CTX *mdctx = NULL, *tmpl = NULL;
+    struct openssl_ex_data *ex_data = NULL;
+    const EVP_MD *md;
+    int idx = 0;
+
+    rc = object_mgr_find_in_map1(tokdata, Hkey, &key, READ_LOCK);
+    if (rc != CKR_OK) {
+        TRACE_ERROR("Failed to find specified object.\n");
+        return rc;
+    }
+
+    rc = template_attribute_get_non_empty(key->template, CKA_VALUE, &attr);
+    if (rc != CKR_OK) {
+        TRACE_ERROR("Could not find CKA_VALUE for the key.\n");
+        goto done;
+    }
+
+    md = openssl_md(openssl_hmac_md_from_mech(mech->mechanism, &idx));
+    if (md == NULL) {
         TRACE_ERROR("%s\n", ock_err(ERR_MECHANISM_INVALID));
         rc = CKR_MECHANISM_INVALID;
         goto done;
     }
 
-    if (rc != 1) {
+    /*
+     * The context with the inner and outer key state of the HMAC is set up
+     * once per key and digest, and kept in the key object's ex_data. Each
+     * operation works on a copy of it. The cached context is installed
+     * atomically, so a READ lock on the ex_data is sufficient. The ex_data
+     * (and with it the cached contexts) is freed when the key object is
+     * reloaded.
+     */
+    rc = openssl_get_ex_data(key, (void **)&ex_data,
+                             sizeof(struct openssl_ex_data), NULL, NULL);
+    if (rc != CKR_OK)
+        goto done;
+
+    tmpl = __atomic_load_n(&ex_data->hmac_ctx[idx], __ATOMIC_ACQUIRE);
+    if (tmpl == NULL) {
+        tmpl = openssl_hmac_ctx_new(md, attr);
+        if (tmpl == NULL) {
+            rc = CKR_FUNCTION_FAILED;
+            goto unlock;
+        }
+
+        if (!__sync_bool_compare_and_swap(&ex_data->hmac_ctx[idx], NULL,
+                                          tmpl)) {
+            /* Another thread was faster */
+            EVP_MD_CTX_free(tmpl);
+            tmpl = __atomic_load_n(&ex_data->hmac_ctx[idx],
+                                   __ATOMIC_ACQUIRE);
+        }
+    }
+
+    mdctx = EVP_MD_CTX_create();
+    if (mdctx == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        rc = CKR_HOST_MEMORY;
+        goto unlock;
+    }
+
+    if (EVP_MD_CTX_copy_ex(mdctx, tmpl) != 1) {
+        TRACE_ERROR("EVP_MD_CTX_copy_ex failed.\n");
         EVP_MD_CTX_destroy(mdctx);
-        ctx->context = NULL;
-        TRACE_ERROR("EVP_DigestSignInit failed.\n");
         rc = CKR_FUNCTION_FAILED;
-        goto done;
-    } else {
-        ctx->context = (CK_BYTE *) mdctx;
-        ctx->context_free_func = openssl_specific_hmac_free;
-        ctx->state_unsaveable = TRUE;
+        goto unlock;
     }
 
+    ctx->context = (CK_BYTE *) mdctx;
+    ctx->context_free_func = openssl_specific_hmac_free;
+    ctx->state_unsaveable = TRUE;
+
     rc = CKR_OK;
+unlock:
+    object_ex_data_unlock(key);
 done:
-    if (pkey != NULL)
-        EVP_PKEY_free(pkey);
-
     object_put(tokdata, key, TRUE);
     key = NULL;
     return rc;
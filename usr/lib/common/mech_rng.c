@@ -15,12 +15,15 @@
 // PKCS #11 doesn't consider random number generator to be a "mechanism"
 //
 
+#define _GNU_SOURCE
 #include <string.h>             // for memcmp() et al
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sys/syscall.h>
 
 #include "pkcs11types.h"
 #include "defs.h"
@@ -39,6 +42,22 @@ CK_RV local_rng(CK_BYTE *output, CK_ULONG bytes)
     int rlen;
     unsigned int totallen = 0;
 
+#ifdef SYS_getrandom
+    /* getrandom() avoids opening the random device on every call */
+    while (totallen < bytes) {
+        rlen = syscall(SYS_getrandom, output + totallen, bytes - totallen, 0);
+        if (rlen < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        totallen += rlen;
+    }
+    if (totallen == bytes)
+        return CKR_OK;
+    totallen = 0;
+#endif
+
     ranfd = open("/dev/prandom", O_RDONLY);
     if (ranfd < 0)
         ranfd = open("/dev/urandom", O_RDONLY);
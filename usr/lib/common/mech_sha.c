@@ -65,7 +65,8 @@ CK_RV sw_sha1_init(DIGEST_CONTEXT *ctx)
         return CKR_HOST_MEMORY;
     }
 
-    if (!EVP_DigestInit_ex((EVP_MD_CTX *)ctx->context, EVP_sha1(), NULL)) {
+    if (!EVP_DigestInit_ex((EVP_MD_CTX *)ctx->context,
+                           openssl_md(EVP_sha1()), NULL)) {
         TRACE_ERROR("%s\n", ock_err(ERR_FUNCTION_FAILED));
         EVP_MD_CTX_free((EVP_MD_CTX *)ctx->context);
         ctx->context = NULL;
@@ -93,6 +93,11 @@ CK_RV ST_Initialize(API_Slot_t *sltp, CK_SLOT_ID SlotNumber,
     rc |= bt_init(&sltp->TokData->sess_obj_btree, call_object_free);
     rc |= bt_init(&sltp->TokData->priv_token_obj_btree, call_object_free);
     rc |= bt_init(&sltp->TokData->publ_token_obj_btree, call_object_free);
+    rc |= tok_obj_name_index_init(&sltp->TokData->priv_token_obj_index);
+    rc |= tok_obj_name_index_init(&sltp->TokData->publ_token_obj_index);
+    rc |= obj_attr_index_init(&sltp->TokData->sess_obj_attr_index);
+    rc |= obj_attr_index_init(&sltp->TokData->publ_token_obj_attr_index);
+    rc |= obj_attr_index_init(&sltp->TokData->priv_token_obj_attr_index);
     if (rc != CKR_OK) {
         TRACE_ERROR("Btree init failed\n");
         rc = CKR_FUNCTION_FAILED;
@@ -124,6 +129,16 @@ CK_RV ST_Initialize(API_Slot_t *sltp, CK_SLOT_ID SlotNumber,
     TRACE_DEVEL("Token version: %u.%u\n",
                 (unsigned int)(sinfp->version >> 16),
                 (unsigned int)(sinfp->version & 0xffff));
+
+    sltp->TokData->objstore = sinfp->objstore;
+    if (sinfp->objstore == OBJSTORE_LOG &&
+        sinfp->version < TOK_NEW_DATA_STORE) {
+        TRACE_ERROR("The log object store requires tokversion 3.12 or "
+                    "later.\n");
+        rc = CKR_FUNCTION_FAILED;
+        goto done;
+    }
+
     /* Check token store encryption against policy */
     newdatastore = sinfp->version >= TOK_NEW_DATA_STORE ? CK_TRUE : CK_FALSE;
     rc = policy->check_token_store(policy, newdatastore,
@@ -172,6 +187,7 @@ CK_RV ST_Initialize(API_Slot_t *sltp, CK_SLOT_ID SlotNumber,
             goto done;
         }
         sltp->TokData->initialized = TRUE;
+        openssl_algs_get();
     }
 
     rc = load_token_data(sltp->TokData, SlotNumber);
@@ -213,6 +229,11 @@ done:
             bt_destroy(&sltp->TokData->sess_obj_btree);
             bt_destroy(&sltp->TokData->priv_token_obj_btree);
             bt_destroy(&sltp->TokData->publ_token_obj_btree);
+            tok_obj_name_index_destroy(&sltp->TokData->priv_token_obj_index);
+            tok_obj_name_index_destroy(&sltp->TokData->publ_token_obj_index);
+            obj_attr_index_destroy(&sltp->TokData->sess_obj_attr_index);
+            obj_attr_index_destroy(&sltp->TokData->publ_token_obj_attr_index);
+            obj_attr_index_destroy(&sltp->TokData->priv_token_obj_attr_index);
         }
     }
 
@@ -250,6 +271,11 @@ CK_RV SC_Finalize(STDLL_TokData_t *tokdata, CK_SLOT_ID sid, SLOT_INFO *sinfp,
     bt_destroy(&tokdata->sess_obj_btree);
     bt_destroy(&tokdata->priv_token_obj_btree);
     bt_destroy(&tokdata->publ_token_obj_btree);
+    tok_obj_name_index_destroy(&tokdata->priv_token_obj_index);
+    tok_obj_name_index_destroy(&tokdata->publ_token_obj_index);
+    obj_attr_index_destroy(&tokdata->sess_obj_attr_index);
+    obj_attr_index_destroy(&tokdata->publ_token_obj_attr_index);
+    obj_attr_index_destroy(&tokdata->priv_token_obj_attr_index);
 
     detach_shm(tokdata, in_fork_initializer);
     /* close spin lock file */
@@ -258,11 +284,12 @@ CK_RV SC_Finalize(STDLL_TokData_t *tokdata, CK_SLOT_ID sid, SLOT_INFO *sinfp,
         rc = token_specific.t_final(tokdata, in_fork_initializer);
         if (rc != CKR_OK) {
             TRACE_ERROR("Token specific final call failed.\n");
-            return rc;
         }
     }
 
+    /* Release the token's resources even if the token specific final failed */
     final_data_store(tokdata);
+    openssl_algs_put();
 
     return rc;
 }
@@ -2002,6 +2029,67 @@ done:
 }
 
 
+CK_RV SC_IBM_FindObjectsGetAttributes(STDLL_TokData_t *tokdata,
+                                      ST_SESSION_HANDLE *sSession,
+                                      CK_ATTRIBUTE_TYPE *pTypes,
+                                      CK_ULONG ulTypeCount,
+                                      CK_BYTE_PTR pBuffer,
+                                      CK_ULONG_PTR pulBufferLen,
+                                      CK_ULONG_PTR pulObjectCount)
+{
+    SESSION *sess = NULL;
+    CK_RV rc = CKR_OK;
+
+    if (tokdata->initialized == FALSE) {
+        TRACE_ERROR("%s\n", ock_err(ERR_CRYPTOKI_NOT_INITIALIZED));
+        rc = CKR_CRYPTOKI_NOT_INITIALIZED;
+        goto done;
+    }
+
+    if ((!pTypes && ulTypeCount > 0) || !pBuffer || !pulBufferLen ||
+        !pulObjectCount) {
+        TRACE_ERROR("%s\n", ock_err(ERR_ARGUMENTS_BAD));
+        rc = CKR_ARGUMENTS_BAD;
+        goto done;
+    }
+
+    sess = session_mgr_find_reset_error(tokdata, sSession->sessionh);
+    if (!sess) {
+        TRACE_ERROR("%s\n", ock_err(ERR_SESSION_HANDLE_INVALID));
+        rc = CKR_SESSION_HANDLE_INVALID;
+        goto done;
+    }
+
+    if (sess->find_active == FALSE) {
+        TRACE_ERROR("%s\n", ock_err(ERR_OPERATION_NOT_INITIALIZED));
+        rc = CKR_OPERATION_NOT_INITIALIZED;
+        goto done;
+    }
+
+    if (!sess->find_list) {
+        TRACE_DEVEL("sess->find_list is NULL.\n");
+        rc = CKR_OPERATION_NOT_INITIALIZED;
+        goto done;
+    }
+
+    rc = object_mgr_find_get_attribute_values(tokdata, sess, pTypes,
+                                              ulTypeCount, pBuffer,
+                                              pulBufferLen, pulObjectCount);
+    if (rc != CKR_OK)
+        TRACE_DEVEL("object_mgr_find_get_attribute_values() failed.\n");
+
+done:
+    TRACE_INFO("C_IBM_FindObjectsGetAttributes: rc = 0x%08lx, "
+               "returned %lu objects\n", rc,
+               (rc == CKR_OK && pulObjectCount) ? *pulObjectCount : 0);
+
+    if (sess != NULL)
+        session_mgr_put(tokdata, sess);
+
+    return rc;
+}
+
+
 CK_RV SC_FindObjectsFinal(STDLL_TokData_t *tokdata,
                           ST_SESSION_HANDLE *sSession)
 {
@@ -2145,6 +2233,8 @@ CK_RV SC_Encrypt(STDLL_TokData_t *tokdata, ST_SESSION_HANDLE *sSession,
                           ulDataLen, pEncryptedData, pulEncryptedDataLen);
     if (rc != CKR_OK)
         TRACE_DEVEL("encr_mgr_encrypt() failed.\n");
+    else if (length_only == FALSE)
+        STAT_OP_DONE(tokdata, sess, &sess->encr_ctx, ulDataLen);
 
 done:
     if (rc != CKR_BUFFER_TOO_SMALL && (rc != CKR_OK || length_only != TRUE)) {
@@ -2204,6 +2294,8 @@ CK_RV SC_EncryptUpdate(STDLL_TokData_t *tokdata, ST_SESSION_HANDLE *sSession,
                                  pEncryptedPart, pulEncryptedPartLen);
     if (rc != CKR_OK)
         TRACE_DEVEL("encr_mgr_encrypt_update() failed.\n");
+    else if (length_only == FALSE)
+        sess->encr_ctx.stat.bytes += ulPartLen;
 
 done:
     if (rc != CKR_OK && rc != CKR_BUFFER_TOO_SMALL) {
@@ -2261,6 +2353,8 @@ CK_RV SC_EncryptFinal(STDLL_TokData_t * tokdata, ST_SESSION_HANDLE * sSession,
                                 pLastEncryptedPart, pulLastEncryptedPartLen);
     if (rc != CKR_OK)
         TRACE_ERROR("encr_mgr_encrypt_final() failed.\n");
+    else if (length_only == FALSE)
+        STAT_OP_DONE(tokdata, sess, &sess->encr_ctx, 0);
 
 done:
     if (rc != CKR_BUFFER_TOO_SMALL && (rc != CKR_OK || length_only != TRUE)) {
@@ -2379,6 +2473,8 @@ CK_RV SC_Decrypt(STDLL_TokData_t *tokdata, ST_SESSION_HANDLE *sSession,
                           pulDataLen);
     if (!is_rsa_mechanism(sess->decr_ctx.mech.mechanism) && rc != CKR_OK)
         TRACE_DEVEL("decr_mgr_decrypt() failed.\n");
+    if (rc == CKR_OK && length_only == FALSE)
+        STAT_OP_DONE(tokdata, sess, &sess->decr_ctx, ulEncryptedDataLen);
 
 done:
     if (rc != CKR_BUFFER_TOO_SMALL && (rc != CKR_OK || length_only != TRUE)) {
@@ -2438,6 +2534,8 @@ CK_RV SC_DecryptUpdate(STDLL_TokData_t *tokdata, ST_SESSION_HANDLE *sSession,
                                  ulEncryptedPartLen, pPart, pulPartLen);
     if (!is_rsa_mechanism(sess->decr_ctx.mech.mechanism) && rc != CKR_OK)
         TRACE_DEVEL("decr_mgr_decrypt_update() failed.\n");
+    if (rc == CKR_OK && length_only == FALSE)
+        sess->decr_ctx.stat.bytes += ulEncryptedPartLen;
 
 done:
     if (rc != CKR_OK && rc != CKR_BUFFER_TOO_SMALL && sess != NULL) {
@@ -2495,6 +2593,8 @@ CK_RV SC_DecryptFinal(STDLL_TokData_t *tokdata, ST_SESSION_HANDLE *sSession,
                                 pLastPart, pulLastPartLen);
     if (!is_rsa_mechanism(sess->decr_ctx.mech.mechanism) && rc != CKR_OK)
         TRACE_DEVEL("decr_mgr_decrypt_final() failed.\n");
+    if (rc == CKR_OK && length_only == FALSE)
+        STAT_OP_DONE(tokdata, sess, &sess->decr_ctx, 0);
 
 done:
     if (rc != CKR_BUFFER_TOO_SMALL && (rc != CKR_OK || length_only != TRUE)) {
@@ -2846,6 +2946,8 @@ CK_RV SC_Sign(STDLL_TokData_t *tokdata, ST_SESSION_HANDLE *sSession,
                        ulDataLen, pSignature, pulSignatureLen);
     if (rc != CKR_OK)
         TRACE_DEVEL("sign_mgr_sign() failed.\n");
+    else if (length_only == FALSE)
+        STAT_OP_DONE(tokdata, sess, &sess->sign_ctx, ulDataLen);
 
 done:
     if (rc != CKR_BUFFER_TOO_SMALL && (rc != CKR_OK || length_only != TRUE)) {
@@ -2897,6 +2999,8 @@ CK_RV SC_SignUpdate(STDLL_TokData_t *tokdata, ST_SESSION_HANDLE *sSession,
     rc = sign_mgr_sign_update(tokdata, sess, &sess->sign_ctx, pPart, ulPartLen);
     if (rc != CKR_OK)
         TRACE_DEVEL("sign_mgr_sign_update() failed.\n");
+    else
+        sess->sign_ctx.stat.bytes += ulPartLen;
 
 done:
     if (rc != CKR_OK && sess != NULL)
@@ -2951,6 +3055,8 @@ CK_RV SC_SignFinal(STDLL_TokData_t *tokdata, ST_SESSION_HANDLE *sSession,
                              pSignature, pulSignatureLen);
     if (rc != CKR_OK)
         TRACE_ERROR("sign_mgr_sign_final() failed.\n");
+    else if (length_only == FALSE)
+        STAT_OP_DONE(tokdata, sess, &sess->sign_ctx, 0);
 
 done:
     if (rc != CKR_BUFFER_TOO_SMALL && (rc != CKR_OK || length_only != TRUE)) {
@@ -3179,6 +3285,8 @@ CK_RV SC_Verify(STDLL_TokData_t *tokdata, ST_SESSION_HANDLE *sSession,
                            ulDataLen, pSignature, ulSignatureLen);
     if (rc != CKR_OK)
         TRACE_DEVEL("verify_mgr_verify() failed.\n");
+    else
+        STAT_OP_DONE(tokdata, sess, &sess->verify_ctx, ulDataLen);
 
 done:
     if (sess != NULL)
@@ -3229,6 +3337,8 @@ CK_RV SC_VerifyUpdate(STDLL_TokData_t *tokdata, ST_SESSION_HANDLE *sSession,
                                   ulPartLen);
     if (rc != CKR_OK)
         TRACE_DEVEL("verify_mgr_verify_update() failed.\n");
+    else
+        sess->verify_ctx.stat.bytes += ulPartLen;
 
 done:
     if (rc != CKR_OK && sess != NULL)
@@ -3279,6 +3389,8 @@ CK_RV SC_VerifyFinal(STDLL_TokData_t *tokdata, ST_SESSION_HANDLE *sSession,
                                  pSignature, ulSignatureLen);
     if (rc != CKR_OK)
         TRACE_DEVEL("verify_mgr_verify_final() failed.\n");
+    else
+        STAT_OP_DONE(tokdata, sess, &sess->verify_ctx, 0);
 
 done:
     if (sess != NULL)
@@ -4154,6 +4266,8 @@ void SC_SetFunctionList(void)
     function_list.ST_SessionCancel = SC_SessionCancel;
 
     function_list.ST_IBM_ReencryptSingle = SC_IBM_ReencryptSingle;
+    function_list.ST_IBM_FindObjectsGetAttributes =
+        SC_IBM_FindObjectsGetAttributes;
 
     function_list.ST_HandleEvent = SC_HandleEvent;
 }
@@ -20,19 +20,908 @@
 #include <strings.h>
 #include <errno.h>
 #include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <openssl/crypto.h>
 
 #include "pkcs11types.h"
 #include "defs.h"
 #include "host_defs.h"
 #include "h_extern.h"
 #include "attributes.h"
+#include "p11util.h"
 #include "tok_spec_struct.h"
 #include "trace.h"
 #include "ock_syslog.h"
+#include "shared_memory.h"
 
 #include "../api/apiproto.h"
 #include "../api/policy.h"
 
+#define TOK_OBJ_NAME_INDEX_MIN_BUCKETS 64
+
+struct tok_obj_name_index_entry {
+    struct tok_obj_name_index_entry *next;
+    char name[8];
+    unsigned long obj_handle;
+};
+
+static unsigned long tok_obj_name_hash(const void *name)
+{
+    const unsigned char *p = name;
+    uint32_t hash = 2166136261u; /* FNV-1a */
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        hash ^= p[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+CK_RV tok_obj_name_index_init(struct tok_obj_name_index *idx)
+{
+    idx->buckets = calloc(TOK_OBJ_NAME_INDEX_MIN_BUCKETS,
+                          sizeof(struct tok_obj_name_index_entry *));
+    if (idx->buckets == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        return CKR_HOST_MEMORY;
+    }
+    idx->num_buckets = TOK_OBJ_NAME_INDEX_MIN_BUCKETS;
+    idx->num_entries = 0;
+
+    if (pthread_mutex_init(&idx->mutex, NULL) != 0) {
+        TRACE_ERROR("Mutex init failed.\n");
+        free(idx->buckets);
+        idx->buckets = NULL;
+        return CKR_CANT_LOCK;
+    }
+
+    return CKR_OK;
+}
+
+void tok_obj_name_index_destroy(struct tok_obj_name_index *idx)
+{
+    struct tok_obj_name_index_entry *entry, *next;
+    unsigned long i;
+
+    if (idx->buckets == NULL)
+        return;
+
+    for (i = 0; i < idx->num_buckets; i++) {
+        for (entry = idx->buckets[i]; entry != NULL; entry = next) {
+            next = entry->next;
+            free(entry);
+        }
+    }
+    free(idx->buckets);
+    idx->buckets = NULL;
+    idx->num_buckets = 0;
+    idx->num_entries = 0;
+
+    pthread_mutex_destroy(&idx->mutex);
+}
+
+/* The caller must hold the index mutex */
+static void tok_obj_name_index_grow(struct tok_obj_name_index *idx)
+{
+    struct tok_obj_name_index_entry **buckets, *entry, *next;
+    unsigned long i, num_buckets = idx->num_buckets * 2, bucket;
+
+    buckets = calloc(num_buckets, sizeof(struct tok_obj_name_index_entry *));
+    if (buckets == NULL)
+        return; /* keep using the current (more crowded) buckets */
+
+    for (i = 0; i < idx->num_buckets; i++) {
+        for (entry = idx->buckets[i]; entry != NULL; entry = next) {
+            next = entry->next;
+            bucket = tok_obj_name_hash(entry->name) & (num_buckets - 1);
+            entry->next = buckets[bucket];
+            buckets[bucket] = entry;
+        }
+    }
+
+    free(idx->buckets);
+    idx->buckets = buckets;
+    idx->num_buckets = num_buckets;
+}
+
+static CK_RV tok_obj_name_index_add(struct tok_obj_name_index *idx,
+                                    const void *name, unsigned long obj_handle)
+{
+    struct tok_obj_name_index_entry *entry;
+    unsigned long bucket;
+
+    pthread_mutex_lock(&idx->mutex);
+
+    bucket = tok_obj_name_hash(name) & (idx->num_buckets - 1);
+    for (entry = idx->buckets[bucket]; entry != NULL; entry = entry->next) {
+        if (memcmp(entry->name, name, 8) == 0) {
+            entry->obj_handle = obj_handle;
+            pthread_mutex_unlock(&idx->mutex);
+            return CKR_OK;
+        }
+    }
+
+    entry = malloc(sizeof(*entry));
+    if (entry == NULL) {
+        pthread_mutex_unlock(&idx->mutex);
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        return CKR_HOST_MEMORY;
+    }
+    memcpy(entry->name, name, 8);
+    entry->obj_handle = obj_handle;
+    entry->next = idx->buckets[bucket];
+    idx->buckets[bucket] = entry;
+    idx->num_entries++;
+
+    if (idx->num_entries > idx->num_buckets)
+        tok_obj_name_index_grow(idx);
+
+    pthread_mutex_unlock(&idx->mutex);
+
+    return CKR_OK;
+}
+
+/* Removes the entry for name, but only if it refers to obj_handle */
+static void tok_obj_name_index_del(struct tok_obj_name_index *idx,
+                                   const void *name, unsigned long obj_handle)
+{
+    struct tok_obj_name_index_entry **pentry, *entry;
+
+    pthread_mutex_lock(&idx->mutex);
+
+    pentry = &idx->buckets[tok_obj_name_hash(name) & (idx->num_buckets - 1)];
+    for (entry = *pentry; entry != NULL; pentry = &entry->next,
+                                         entry = entry->next) {
+        if (memcmp(entry->name, name, 8) == 0) {
+            if (entry->obj_handle == obj_handle) {
+                *pentry = entry->next;
+                free(entry);
+                idx->num_entries--;
+            }
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&idx->mutex);
+}
+
+/* Returns the btree handle of the object with that name, or 0 */
+static unsigned long tok_obj_name_index_find(struct tok_obj_name_index *idx,
+                                             const void *name)
+{
+    struct tok_obj_name_index_entry *entry;
+    unsigned long obj_handle = 0;
+
+    pthread_mutex_lock(&idx->mutex);
+
+    entry = idx->buckets[tok_obj_name_hash(name) & (idx->num_buckets - 1)];
+    for (; entry != NULL; entry = entry->next) {
+        if (memcmp(entry->name, name, 8) == 0) {
+            obj_handle = entry->obj_handle;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&idx->mutex);
+
+    return obj_handle;
+}
+
+#define OBJ_ATTR_INDEX_MIN_BUCKETS 64
+
+struct obj_attr_index_list {
+    struct obj_attr_index_list *next;
+    CK_ATTRIBUTE_TYPE type;
+    unsigned long hash;
+    unsigned long count;        /* number of objects in the list */
+    struct obj_attr_index_link *head;
+    CK_ULONG value_len;
+    CK_BYTE value[];
+};
+
+static const CK_ATTRIBUTE_TYPE obj_attr_index_types[OBJ_ATTR_INDEX_NUM] = {
+    [OBJ_ATTR_INDEX_CLASS] = CKA_CLASS,
+    [OBJ_ATTR_INDEX_KEY_TYPE] = CKA_KEY_TYPE,
+    [OBJ_ATTR_INDEX_ID] = CKA_ID,
+    [OBJ_ATTR_INDEX_LABEL] = CKA_LABEL,
+};
+
+static unsigned long obj_attr_index_hash(CK_ATTRIBUTE_TYPE type,
+                                         const CK_BYTE *value, CK_ULONG len)
+{
+    uint32_t hash = 2166136261u; /* FNV-1a */
+    CK_ULONG i;
+
+    for (i = 0; i < sizeof(type); i++) {
+        hash ^= (type >> (i * 8)) & 0xff;
+        hash *= 16777619u;
+    }
+    for (i = 0; i < len; i++) {
+        hash ^= value[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+CK_RV obj_attr_index_init(struct obj_attr_index *idx)
+{
+    idx->buckets = calloc(OBJ_ATTR_INDEX_MIN_BUCKETS,
+                          sizeof(struct obj_attr_index_list *));
+    if (idx->buckets == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        return CKR_HOST_MEMORY;
+    }
+    idx->num_buckets = OBJ_ATTR_INDEX_MIN_BUCKETS;
+    idx->num_lists = 0;
+    idx->failed = FALSE;
+
+    if (pthread_mutex_init(&idx->mutex, NULL) != 0) {
+        TRACE_ERROR("Mutex init failed.\n");
+        free(idx->buckets);
+        idx->buckets = NULL;
+        return CKR_CANT_LOCK;
+    }
+
+    return CKR_OK;
+}
+
+/*
+ * Frees the index itself. The links embedded in the objects are not touched,
+ * the objects are expected to be freed together with their btree.
+ */
+void obj_attr_index_destroy(struct obj_attr_index *idx)
+{
+    struct obj_attr_index_list *list, *next;
+    unsigned long i;
+
+    if (idx->buckets == NULL)
+        return;
+
+    for (i = 0; i < idx->num_buckets; i++) {
+        for (list = idx->buckets[i]; list != NULL; list = next) {
+            next = list->next;
+            free(list);
+        }
+    }
+    free(idx->buckets);
+    idx->buckets = NULL;
+    idx->num_buckets = 0;
+    idx->num_lists = 0;
+
+    pthread_mutex_destroy(&idx->mutex);
+}
+
+/* The caller must hold the index mutex */
+static void obj_attr_index_grow(struct obj_attr_index *idx)
+{
+    struct obj_attr_index_list **buckets, *list, *next;
+    unsigned long i, num_buckets = idx->num_buckets * 2, bucket;
+
+    buckets = calloc(num_buckets, sizeof(struct obj_attr_index_list *));
+    if (buckets == NULL)
+        return; /* keep using the current (more crowded) buckets */
+
+    for (i = 0; i < idx->num_buckets; i++) {
+        for (list = idx->buckets[i]; list != NULL; list = next) {
+            next = list->next;
+            bucket = list->hash & (num_buckets - 1);
+            list->next = buckets[bucket];
+            buckets[bucket] = list;
+        }
+    }
+
+    free(idx->buckets);
+    idx->buckets = buckets;
+    idx->num_buckets = num_buckets;
+}
+
+/* The caller must hold the index mutex */
+static struct obj_attr_index_list *obj_attr_index_find_list(
+                                                struct obj_attr_index *idx,
+                                                CK_ATTRIBUTE_TYPE type,
+                                                unsigned long hash,
+                                                const CK_BYTE *value,
+                                                CK_ULONG len)
+{
+    struct obj_attr_index_list *list;
+
+    list = idx->buckets[hash & (idx->num_buckets - 1)];
+    for (; list != NULL; list = list->next) {
+        if (list->hash == hash && list->type == type &&
+            list->value_len == len &&
+            (len == 0 || memcmp(list->value, value, len) == 0))
+            return list;
+    }
+
+    return NULL;
+}
+
+/*
+ * Links the object into the lists of its indexed attribute values. The caller
+ * must hold the index mutex, and the object's template must not change
+ * meanwhile.
+ */
+static void obj_attr_index_link_obj(struct obj_attr_index *idx, OBJECT *obj)
+{
+    struct obj_attr_index_link *link;
+    struct obj_attr_index_list *list;
+    CK_ATTRIBUTE *attr;
+    unsigned long hash, bucket;
+    int i;
+
+    for (i = 0; i < OBJ_ATTR_INDEX_NUM; i++) {
+        if (!template_attribute_find(obj->template, obj_attr_index_types[i],
+                                     &attr))
+            continue;
+        if (attr->ulValueLen > 0 && attr->pValue == NULL)
+            continue;
+
+        hash = obj_attr_index_hash(attr->type, attr->pValue,
+                                   attr->ulValueLen);
+        list = obj_attr_index_find_list(idx, attr->type, hash, attr->pValue,
+                                        attr->ulValueLen);
+        if (list == NULL) {
+            list = malloc(sizeof(*list) + attr->ulValueLen);
+            if (list == NULL) {
+                TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+                /* searches can no longer rely on the index */
+                idx->failed = TRUE;
+                continue;
+            }
+            list->type = attr->type;
+            list->hash = hash;
+            list->count = 0;
+            list->head = NULL;
+            list->value_len = attr->ulValueLen;
+            if (attr->ulValueLen > 0)
+                memcpy(list->value, attr->pValue, attr->ulValueLen);
+
+            bucket = hash & (idx->num_buckets - 1);
+            list->next = idx->buckets[bucket];
+            idx->buckets[bucket] = list;
+            idx->num_lists++;
+
+            if (idx->num_lists > idx->num_buckets)
+                obj_attr_index_grow(idx);
+        }
+
+        link = &obj->attr_index_links[i];
+        link->prev = NULL;
+        link->next = list->head;
+        if (list->head != NULL)
+            list->head->prev = link;
+        list->head = link;
+        link->list = list;
+        link->obj = obj;
+        list->count++;
+    }
+}
+
+/* The caller must hold the index mutex */
+static void obj_attr_index_unlink_obj(struct obj_attr_index *idx, OBJECT *obj)
+{
+    struct obj_attr_index_link *link;
+    struct obj_attr_index_list *list, **plist;
+    int i;
+
+    for (i = 0; i < OBJ_ATTR_INDEX_NUM; i++) {
+        link = &obj->attr_index_links[i];
+        list = link->list;
+        if (list == NULL)
+            continue;
+
+        if (link->prev != NULL)
+            link->prev->next = link->next;
+        else
+            list->head = link->next;
+        if (link->next != NULL)
+            link->next->prev = link->prev;
+        link->prev = link->next = NULL;
+        link->list = NULL;
+
+        if (--list->count > 0)
+            continue;
+
+        plist = &idx->buckets[list->hash & (idx->num_buckets - 1)];
+        for (; *plist != NULL; plist = &(*plist)->next) {
+            if (*plist == list) {
+                *plist = list->next;
+                free(list);
+                idx->num_lists--;
+                break;
+            }
+        }
+    }
+}
+
+/* Adds an object that has just been stored under obj_handle to the index */
+static void obj_attr_index_add(struct obj_attr_index *idx, OBJECT *obj,
+                               unsigned long obj_handle)
+{
+    if (idx->buckets == NULL)
+        return;
+
+    pthread_mutex_lock(&idx->mutex);
+
+    obj->attr_index = idx;
+    obj->attr_index_handle = obj_handle;
+    obj_attr_index_link_obj(idx, obj);
+
+    pthread_mutex_unlock(&idx->mutex);
+}
+
+/* Removes an object from the index it has been added to, if any */
+static void obj_attr_index_del(OBJECT *obj)
+{
+    struct obj_attr_index *idx = obj->attr_index;
+
+    if (idx == NULL)
+        return;
+
+    pthread_mutex_lock(&idx->mutex);
+
+    if (obj->attr_index == idx) {
+        obj_attr_index_unlink_obj(idx, obj);
+        obj->attr_index = NULL;
+    }
+
+    pthread_mutex_unlock(&idx->mutex);
+}
+
+/*
+ * Re-indexes an object after its template has been changed or reloaded. The
+ * caller must hold the object's WRITE lock.
+ */
+static void obj_attr_index_update(OBJECT *obj)
+{
+    struct obj_attr_index *idx = obj->attr_index;
+
+    if (idx == NULL)
+        return;
+
+    pthread_mutex_lock(&idx->mutex);
+
+    if (obj->attr_index == idx) {
+        obj_attr_index_unlink_obj(idx, obj);
+        obj_attr_index_link_obj(idx, obj);
+    }
+
+    pthread_mutex_unlock(&idx->mutex);
+}
+
+static int obj_attr_index_cmp_handle(const void *a, const void *b)
+{
+    unsigned long h1 = *(const unsigned long *)a;
+    unsigned long h2 = *(const unsigned long *)b;
+
+    return (h1 > h2) - (h1 < h2);
+}
+
+/*
+ * Returns the btree handles of the candidate objects for a find template,
+ * taken from the list of the most selective indexed attribute value in the
+ * template, in ascending order. Returns FALSE if the index can't narrow down
+ * the search, and all objects must be compared against the template.
+ */
+static CK_BBOOL obj_attr_index_candidates(struct obj_attr_index *idx,
+                                          CK_ATTRIBUTE *pTemplate,
+                                          CK_ULONG ulCount,
+                                          unsigned long **handles,
+                                          CK_ULONG *num_handles)
+{
+    struct obj_attr_index_list *list, *best = NULL;
+    struct obj_attr_index_link *link;
+    CK_BBOOL indexed = FALSE;
+    CK_ULONG i, n = 0;
+    int j;
+
+    *handles = NULL;
+    *num_handles = 0;
+
+    if (idx->buckets == NULL || pTemplate == NULL || ulCount == 0)
+        return FALSE;
+
+    pthread_mutex_lock(&idx->mutex);
+
+    if (idx->failed)
+        goto out;
+
+    for (i = 0; i < ulCount; i++) {
+        for (j = 0; j < OBJ_ATTR_INDEX_NUM; j++) {
+            if (pTemplate[i].type == obj_attr_index_types[j])
+                break;
+        }
+        if (j == OBJ_ATTR_INDEX_NUM)
+            continue;
+        if (pTemplate[i].ulValueLen > 0 && pTemplate[i].pValue == NULL)
+            continue;
+
+        list = obj_attr_index_find_list(idx, pTemplate[i].type,
+                                        obj_attr_index_hash(pTemplate[i].type,
+                                                        pTemplate[i].pValue,
+                                                        pTemplate[i].ulValueLen),
+                                        pTemplate[i].pValue,
+                                        pTemplate[i].ulValueLen);
+        if (list == NULL) {
+            /* no object has this value, so no object can match */
+            indexed = TRUE;
+            best = NULL;
+            goto out;
+        }
+        if (!indexed || list->count < best->count)
+            best = list;
+        indexed = TRUE;
+    }
+
+    if (best == NULL)
+        goto out;
+
+    *handles = malloc(best->count * sizeof(unsigned long));
+    if (*handles == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        indexed = FALSE;
+        goto out;
+    }
+
+    for (link = best->head; link != NULL; link = link->next)
+        (*handles)[n++] = link->obj->attr_index_handle;
+
+out:
+    pthread_mutex_unlock(&idx->mutex);
+
+    if (*handles != NULL) {
+        *num_handles = n;
+        qsort(*handles, n, sizeof(unsigned long), obj_attr_index_cmp_handle);
+    }
+
+    return indexed;
+}
+
+static struct tok_obj_name_index *object_mgr_tok_obj_index(
+                                                    STDLL_TokData_t *tokdata,
+                                                    struct btree *t)
+{
+    if (t == &tokdata->priv_token_obj_btree)
+        return &tokdata->priv_token_obj_index;
+
+    return &tokdata->publ_token_obj_index;
+}
+
+static struct obj_attr_index *object_mgr_obj_attr_index(
+                                                    STDLL_TokData_t *tokdata,
+                                                    struct btree *t)
+{
+    if (t == &tokdata->priv_token_obj_btree)
+        return &tokdata->priv_token_obj_attr_index;
+    if (t == &tokdata->publ_token_obj_btree)
+        return &tokdata->publ_token_obj_attr_index;
+
+    return &tokdata->sess_obj_attr_index;
+}
+
+/*
+ * Adds a token object to the token object btree @t and the name and attribute
+ * indexes of that btree. Returns the btree handle of the object or 0 on
+ * failure.
+ */
+static unsigned long object_mgr_add_tok_obj(STDLL_TokData_t *tokdata,
+                                            struct btree *t, OBJECT *obj)
+{
+    unsigned long obj_handle;
+
+    obj_handle = bt_node_add(t, obj);
+    if (obj_handle == 0)
+        return 0;
+
+    if (tok_obj_name_index_add(object_mgr_tok_obj_index(tokdata, t),
+                               obj->name, obj_handle) != CKR_OK) {
+        bt_node_free(t, obj_handle, FALSE);
+        return 0;
+    }
+    obj_attr_index_add(object_mgr_obj_attr_index(tokdata, t), obj, obj_handle);
+
+    return obj_handle;
+}
+
+/*
+ * Removes a token object from the token object btree @t and its indexes.
+ * If @put_value is TRUE, the object is freed once its last reference is gone,
+ * otherwise the object is left untouched.
+ */
+static void object_mgr_free_tok_obj(STDLL_TokData_t *tokdata, struct btree *t,
+                                    unsigned long obj_handle, OBJECT *obj,
+                                    CK_BBOOL put_value)
+{
+    tok_obj_name_index_del(object_mgr_tok_obj_index(tokdata, t), obj->name,
+                           obj_handle);
+    obj_attr_index_del(obj);
+    bt_node_free(t, obj_handle, put_value);
+}
+
+/*
+ * Adds a session object to the session object btree and its attribute index.
+ * Returns the btree handle of the object or 0 on failure.
+ */
+static unsigned long object_mgr_add_sess_obj(STDLL_TokData_t *tokdata,
+                                             OBJECT *obj)
+{
+    unsigned long obj_handle;
+
+    obj_handle = bt_node_add(&tokdata->sess_obj_btree, obj);
+    if (obj_handle == 0)
+        return 0;
+
+    obj_attr_index_add(&tokdata->sess_obj_attr_index, obj, obj_handle);
+
+    return obj_handle;
+}
+
+/*
+ * Removes a session object from the session object btree and its attribute
+ * index, see object_mgr_free_tok_obj().
+ */
+static void object_mgr_free_sess_obj(STDLL_TokData_t *tokdata,
+                                     unsigned long obj_handle, OBJECT *obj,
+                                     CK_BBOOL put_value)
+{
+    obj_attr_index_del(obj);
+    bt_node_free(&tokdata->sess_obj_btree, obj_handle, put_value);
+}
+
+// publishes the changes recorded in the change log of a token object list by
+// bumping the generation of the log. the calling routine is responsible for
+// locking the global_shm mutex
+//
+static void object_mgr_publish_shm_log(TOK_OBJ_CHANGE_LOG *log,
+                                       CK_ULONG_32 *pending)
+{
+    if (*pending == 0)
+        return;
+
+    __atomic_store_n(&log->generation, log->generation + *pending,
+                     __ATOMIC_RELEASE);
+    *pending = 0;
+}
+
+// records an addition or deletion in the change log of a token object list
+// and publishes it, unless a group commit batch is in progress, which
+// publishes all its changes at once. the calling routine is responsible for
+// locking the global_shm mutex
+//
+static void object_mgr_log_shm_change(STDLL_TokData_t *tokdata, CK_BBOOL priv,
+                                      const void *name, CK_BBOOL deleted)
+{
+    struct tok_obj_group_commit *gc = &tokdata->group_commit;
+    TOK_OBJ_CHANGE_LOG *log;
+    CK_ULONG_32 generation, *pending;
+    TOK_OBJ_CHANGE *change;
+
+    if (priv) {
+        log = &tokdata->global_shm->priv_tok_log;
+        pending = &gc->priv_log_pending;
+    } else {
+        log = &tokdata->global_shm->publ_tok_log;
+        pending = &gc->publ_log_pending;
+    }
+
+    generation = log->generation + ++(*pending);
+
+    change = &log->changes[generation & (TOK_OBJ_CHANGE_LOG_SIZE - 1)];
+    change->generation = generation;
+    change->deleted = deleted;
+    memcpy(change->name, name, 8);
+
+    if (!gc->in_batch)
+        object_mgr_publish_shm_log(log, pending);
+}
+
+// invalidates all changes recorded in the log, forcing a full resync
+//
+static void object_mgr_reset_shm_log(TOK_OBJ_CHANGE_LOG *log)
+{
+    __atomic_store_n(&log->generation,
+                     log->generation + TOK_OBJ_CHANGE_LOG_SIZE + 1,
+                     __ATOMIC_RELEASE);
+}
+
+// maps the SHM segments of the token object table that have been added by
+// other processes since this process looked last. the calling routine is
+// responsible for locking the global_shm mutex
+//
+static CK_RV object_mgr_map_tok_obj_segs(STDLL_TokData_t *tokdata)
+{
+    TOK_OBJ_TABLE *table = &tokdata->global_shm->tok_obj_table;
+    CK_ULONG_32 num_segs = table->num_ext_segs + 1;
+    char name[SM_NAME_LEN + 1], seg_name[SM_NAME_LEN + 1];
+    TOK_OBJ_SEG **segs;
+    void *addr;
+
+    if (tokdata->num_tok_obj_segs >= num_segs)
+        return CKR_OK;
+
+    segs = realloc(tokdata->tok_obj_segs, num_segs * sizeof(TOK_OBJ_SEG *));
+    if (segs == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        return CKR_HOST_MEMORY;
+    }
+    tokdata->tok_obj_segs = segs;
+
+    if (tokdata->num_tok_obj_segs == 0) {
+        segs[0] = &tokdata->global_shm->tok_obj_seg;
+        tokdata->num_tok_obj_segs = 1;
+    }
+
+    if (tokdata->num_tok_obj_segs < num_segs &&
+        sm_copy_name(tokdata->global_shm, name, sizeof(name)) != 0) {
+        TRACE_ERROR("sm_copy_name failed.\n");
+        return CKR_FUNCTION_FAILED;
+    }
+
+    while (tokdata->num_tok_obj_segs < num_segs) {
+        if (ock_snprintf(seg_name, sizeof(seg_name), "%s.%u", name,
+                         (unsigned int)tokdata->num_tok_obj_segs) != 0) {
+            TRACE_ERROR("SHM segment name buffer overflow\n");
+            return CKR_FUNCTION_FAILED;
+        }
+        if (sm_open(seg_name, 0660, &addr, sizeof(TOK_OBJ_SEG), 1) < 0) {
+            TRACE_ERROR("sm_open failed for %s.\n", seg_name);
+            return CKR_FUNCTION_FAILED;
+        }
+        segs[tokdata->num_tok_obj_segs++] = addr;
+    }
+
+    return CKR_OK;
+}
+
+// adds a segment to the token object table
+//
+static CK_RV object_mgr_grow_tok_obj_table(STDLL_TokData_t *tokdata)
+{
+    TOK_OBJ_TABLE *table = &tokdata->global_shm->tok_obj_table;
+    CK_RV rc;
+
+    if (table->num_ext_segs + 1 >= TOK_OBJ_MAX_SEGS) {
+        TRACE_ERROR("Maximum number of token objects reached.\n");
+        return CKR_HOST_MEMORY;
+    }
+
+    table->num_ext_segs++;
+    rc = object_mgr_map_tok_obj_segs(tokdata);
+    if (rc != CKR_OK) {
+        table->num_ext_segs--;
+        return rc;
+    }
+
+    // the segment may be left over from a previous incarnation of the table
+    memset(tokdata->tok_obj_segs[table->num_ext_segs], 0, sizeof(TOK_OBJ_SEG));
+
+    return CKR_OK;
+}
+
+// unmaps the SHM segments of the token object table from this process
+//
+void object_mgr_unmap_tok_obj_segs(STDLL_TokData_t *tokdata,
+                                   CK_BBOOL ignore_ref_count)
+{
+    CK_ULONG_32 i;
+
+    for (i = 1; i < tokdata->num_tok_obj_segs; i++)
+        sm_close(tokdata->tok_obj_segs[i], 0, ignore_ref_count);
+
+    free(tokdata->tok_obj_segs);
+    tokdata->tok_obj_segs = NULL;
+    tokdata->num_tok_obj_segs = 0;
+}
+
+static inline TOK_OBJ_ENTRY *tok_obj_entry(STDLL_TokData_t *tokdata,
+                                           CK_ULONG_32 index)
+{
+    return &tokdata->tok_obj_segs[index / TOK_OBJ_SEG_SIZE]->
+                                        entries[index % TOK_OBJ_SEG_SIZE];
+}
+
+static inline CK_ULONG_32 *tok_obj_bucket(STDLL_TokData_t *tokdata,
+                                          CK_ULONG_32 bucket)
+{
+    return &tokdata->tok_obj_segs[bucket / TOK_OBJ_SEG_SIZE]->
+                                        buckets[bucket % TOK_OBJ_SEG_SIZE];
+}
+
+static CK_ULONG_32 tok_obj_bucket_for_hash(TOK_OBJ_TABLE *table,
+                                           unsigned long hash)
+{
+    CK_ULONG_32 num_buckets = TOK_OBJ_SEG_SIZE << table->level;
+    CK_ULONG_32 bucket = hash & (num_buckets - 1);
+
+    if (bucket < table->split)
+        bucket = hash & (2 * num_buckets - 1);
+
+    return bucket;
+}
+
+// splits the next bucket of the token object table (linear hashing)
+//
+static void object_mgr_split_tok_obj_bucket(STDLL_TokData_t *tokdata)
+{
+    TOK_OBJ_TABLE *table = &tokdata->global_shm->tok_obj_table;
+    CK_ULONG_32 num_buckets = TOK_OBJ_SEG_SIZE << table->level;
+    CK_ULONG_32 *old_bucket, *new_bucket, index, next;
+    TOK_OBJ_ENTRY *entry;
+
+    old_bucket = tok_obj_bucket(tokdata, table->split);
+    new_bucket = tok_obj_bucket(tokdata, table->split + num_buckets);
+
+    index = *old_bucket;
+    *old_bucket = 0;
+    *new_bucket = 0;
+    for (; index != 0; index = next) {
+        entry = tok_obj_entry(tokdata, index);
+        next = entry->next;
+        if (tok_obj_name_hash(entry->name) & num_buckets) {
+            entry->next = *new_bucket;
+            *new_bucket = index;
+        } else {
+            entry->next = *old_bucket;
+            *old_bucket = index;
+        }
+    }
+
+    table->split++;
+    if (table->split == num_buckets) {
+        table->level++;
+        table->split = 0;
+    }
+}
+
+// looks up the entry of the token object with the specified name. returns
+// the entry index, or 0 if not found. if @link is not NULL, it receives the
+// pointer to the chain link referring to the entry
+//
+static CK_ULONG_32 object_mgr_lookup_tok_obj(STDLL_TokData_t *tokdata,
+                                             const void *name,
+                                             CK_ULONG_32 **link)
+{
+    TOK_OBJ_TABLE *table = &tokdata->global_shm->tok_obj_table;
+    CK_ULONG_32 *plink, index;
+    TOK_OBJ_ENTRY *entry;
+
+    plink = tok_obj_bucket(tokdata,
+                           tok_obj_bucket_for_hash(table,
+                                                   tok_obj_name_hash(name)));
+    for (index = *plink; index != 0; index = entry->next) {
+        entry = tok_obj_entry(tokdata, index);
+        if (memcmp(entry->name, name, 8) == 0) {
+            if (link != NULL)
+                *link = plink;
+            return index;
+        }
+        plink = &entry->next;
+    }
+
+    return 0;
+}
+
+// clears the token object table. the SHM segments stay allocated
+//
+static void object_mgr_clear_tok_obj_table(STDLL_TokData_t *tokdata)
+{
+    CK_ULONG_32 i;
+
+    for (i = 0; i < tokdata->num_tok_obj_segs; i++)
+        memset(tokdata->tok_obj_segs[i], 0, sizeof(TOK_OBJ_SEG));
+
+    tokdata->global_shm->tok_obj_table.num_entries = 0;
+    tokdata->global_shm->tok_obj_table.free_entry = 0;
+    tokdata->global_shm->tok_obj_table.count = 0;
+    tokdata->global_shm->tok_obj_table.level = 0;
+    tokdata->global_shm->tok_obj_table.split = 0;
+}
+
+
 static CK_RV object_mgr_check_session(SESSION *sess, CK_BBOOL priv_obj,
                                       CK_BBOOL sess_obj)
 {
@@ -373,60 +1262,337 @@ CK_RV object_mgr_create_skel(STDLL_TokData_t *tokdata,
         TRACE_ERROR("Invalid function arguments.\n");
         return CKR_FUNCTION_FAILED;
     }
-    //
-    // we don't need to lock mutex for this routine
-    //
+    //
+    // we don't need to lock mutex for this routine
+    //
+
+    rc = object_create_skel(tokdata, pTemplate, ulCount,
+                            mode, obj_type, sub_class, &o);
+    if (rc != CKR_OK) {
+        TRACE_DEVEL("object_create_skel failed.\n");
+        return rc;
+    }
+    sess_obj = object_is_session_object(o);
+    priv_obj = object_is_private(o);
+
+    if (sess->session_info.state == CKS_RO_PUBLIC_SESSION) {
+        if (priv_obj) {
+            object_free(o);
+            TRACE_ERROR("%s\n", ock_err(ERR_USER_NOT_LOGGED_IN));
+            return CKR_USER_NOT_LOGGED_IN;
+        }
+
+        if (!sess_obj) {
+            object_free(o);
+            TRACE_ERROR("%s\n", ock_err(ERR_SESSION_READ_ONLY));
+            return CKR_SESSION_READ_ONLY;
+        }
+    }
+
+    if (sess->session_info.state == CKS_RO_USER_FUNCTIONS) {
+        if (!sess_obj) {
+            object_free(o);
+            TRACE_ERROR("%s\n", ock_err(ERR_SESSION_READ_ONLY));
+            return CKR_SESSION_READ_ONLY;
+        }
+    }
+
+    if (sess->session_info.state == CKS_RW_PUBLIC_SESSION) {
+        if (priv_obj) {
+            object_free(o);
+            TRACE_ERROR("%s\n", ock_err(ERR_USER_NOT_LOGGED_IN));
+            return CKR_USER_NOT_LOGGED_IN;
+        }
+    }
+
+    if (sess->session_info.state == CKS_RW_SO_FUNCTIONS) {
+        if (priv_obj) {
+            object_free(o);
+            TRACE_ERROR("%s\n", ock_err(ERR_USER_NOT_LOGGED_IN));
+            return CKR_USER_NOT_LOGGED_IN;
+        }
+    }
+
+    *obj = o;
+
+    return CKR_OK;
+}
+
+#define TOK_OBJ_COMMIT_MAX 256
+
+struct tok_obj_commit {
+    struct tok_obj_commit *next;
+    OBJECT *obj;
+    CK_BBOOL create;            /* new object, else modified object */
+    CK_BBOOL named;             /* a name has been generated for obj */
+    unsigned long obj_handle;   /* new object: handle in token object btree */
+    CK_BBOOL done;
+    CK_RV rc;
+};
+
+// sets up group commit of token object saves if the environment variable
+// OPENCRYPTOKI_GROUP_COMMIT is set. Its value is the number of microseconds
+// the leader of a batch waits for further saves to join the batch
+//
+CK_RV object_mgr_group_commit_init(STDLL_TokData_t *tokdata)
+{
+    struct tok_obj_group_commit *gc = &tokdata->group_commit;
+    const char *opt;
+    char *end;
+    long window;
+
+    memset(gc, 0, sizeof(*gc));
+
+    opt = getenv("OPENCRYPTOKI_GROUP_COMMIT");
+    if (opt == NULL)
+        return CKR_OK;
+
+    errno = 0;
+    window = strtol(opt, &end, 10);
+    if (errno != 0 || end == opt || *end != '\0' || window < 0 ||
+        window > 1000000) {
+        OCK_SYSLOG(LOG_WARNING, "OPENCRYPTOKI_GROUP_COMMIT '%s' is invalid. "
+                   "Group commit is disabled.\n", opt);
+        return CKR_OK;
+    }
+
+    if (pthread_mutex_init(&gc->mutex, NULL) != 0 ||
+        pthread_cond_init(&gc->done_cond, NULL) != 0 ||
+        pthread_cond_init(&gc->full_cond, NULL) != 0) {
+        TRACE_ERROR("Initializing group commit failed.\n");
+        return CKR_FUNCTION_FAILED;
+    }
+
+    gc->window = window;
+    gc->enabled = TRUE;
+    TRACE_DEVEL("Group commit of token objects enabled, window: %ld us\n",
+                window);
+
+    return CKR_OK;
+}
+
+void object_mgr_group_commit_final(STDLL_TokData_t *tokdata)
+{
+    struct tok_obj_group_commit *gc = &tokdata->group_commit;
+
+    if (!gc->enabled)
+        return;
+
+    pthread_cond_destroy(&gc->full_cond);
+    pthread_cond_destroy(&gc->done_cond);
+    pthread_mutex_destroy(&gc->mutex);
+    gc->enabled = FALSE;
+}
+
+// generates a name for a new token object of a batch. the names of the
+// objects of the batch are only reserved once they are saved, so make sure
+// that no other object of the batch got the same name
+//
+static CK_RV object_mgr_commit_batch_name(STDLL_TokData_t *tokdata,
+                                          struct tok_obj_commit *batch,
+                                          struct tok_obj_commit *req)
+{
+    struct tok_obj_commit *r;
+    CK_RV rc;
+
+retry:
+    rc = new_token_object_name(tokdata, req->obj->name);
+    if (rc != CKR_OK)
+        return rc;
+
+    for (r = batch; r != req; r = r->next) {
+        if (r->named && memcmp(r->obj->name, req->obj->name, 8) == 0)
+            goto retry;
+    }
+
+    req->named = TRUE;
+    return CKR_OK;
+}
+
+// stores the token objects of a group commit batch with one XProcLock, one
+// save of all objects, and one update of the SHM change logs
+//
+static void object_mgr_commit_batch(STDLL_TokData_t *tokdata,
+                                    struct tok_obj_commit *batch)
+{
+    struct tok_obj_group_commit *gc = &tokdata->group_commit;
+    struct tok_obj_commit *req, *reqs[TOK_OBJ_COMMIT_MAX];
+    OBJECT *objs[TOK_OBJ_COMMIT_MAX];
+    CK_RV rcs[TOK_OBJ_COMMIT_MAX];
+    TOK_OBJ_ENTRY *entry = NULL;
+    CK_ULONG i, num = 0;
+    CK_BBOOL priv;
+    CK_RV rc;
+
+    rc = XProcLock(tokdata);
+    if (rc != CKR_OK) {
+        TRACE_ERROR("Failed to get Process Lock.\n");
+        for (req = batch; req != NULL; req = req->next)
+            req->rc = rc;
+        return;
+    }
+
+    gc->in_batch = TRUE;
+
+    for (req = batch; req != NULL; req = req->next) {
+        if (req->create) {
+            req->obj->session = NULL;
+            req->rc = object_mgr_commit_batch_name(tokdata, batch, req);
+        } else {
+            req->rc = object_mgr_get_shm_entry_for_obj(tokdata, req->obj,
+                                                       &entry);
+        }
+        if (req->rc != CKR_OK)
+            continue;
+
+        reqs[num] = req;
+        objs[num] = req->obj;
+        num++;
+    }
 
-    rc = object_create_skel(tokdata, pTemplate, ulCount,
-                            mode, obj_type, sub_class, &o);
-    if (rc != CKR_OK) {
-        TRACE_DEVEL("object_create_skel failed.\n");
-        return rc;
+    if (num > 0)
+        save_token_objects(tokdata, objs, rcs, num);
+    for (i = 0; i < num; i++) {
+        reqs[i]->rc = rcs[i];
+        if (rcs[i] != CKR_OK)
+            TRACE_ERROR("Failed to save token object, rc=0x%lx.\n", rcs[i]);
     }
-    sess_obj = object_is_session_object(o);
-    priv_obj = object_is_private(o);
 
-    if (sess->session_info.state == CKS_RO_PUBLIC_SESSION) {
-        if (priv_obj) {
-            object_free(o);
-            TRACE_ERROR("%s\n", ock_err(ERR_USER_NOT_LOGGED_IN));
-            return CKR_USER_NOT_LOGGED_IN;
+    for (req = batch; req != NULL; req = req->next) {
+        if (!req->create) {
+            if (req->rc != CKR_OK)
+                continue;
+
+            req->rc = object_mgr_get_shm_entry_for_obj(tokdata, req->obj,
+                                                       &entry);
+            if (req->rc != CKR_OK)
+                continue;
+
+            entry->count_lo = req->obj->count_lo;
+            entry->count_hi = req->obj->count_hi;
+            continue;
         }
 
-        if (!sess_obj) {
-            object_free(o);
-            TRACE_ERROR("%s\n", ock_err(ERR_SESSION_READ_ONLY));
-            return CKR_SESSION_READ_ONLY;
+        if (req->rc == CKR_OK) {
+            // add the object identifier to the shared memory segment
+            req->rc = object_mgr_add_to_shm(tokdata, req->obj);
+            if (req->rc != CKR_OK)
+                TRACE_DEVEL("object_mgr_add_to_shm failed.\n");
         }
-    }
 
-    if (sess->session_info.state == CKS_RO_USER_FUNCTIONS) {
-        if (!sess_obj) {
-            object_free(o);
-            TRACE_ERROR("%s\n", ock_err(ERR_SESSION_READ_ONLY));
-            return CKR_SESSION_READ_ONLY;
+        if (req->rc == CKR_OK) {
+            // now, store the object in the token object btree
+            priv = object_is_private(req->obj);
+            req->obj_handle = object_mgr_add_tok_obj(tokdata,
+                                     priv ? &tokdata->priv_token_obj_btree :
+                                            &tokdata->publ_token_obj_btree,
+                                     req->obj);
+            if (req->obj_handle == 0) {
+                TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+                object_mgr_del_from_shm(tokdata, req->obj);
+                req->rc = CKR_HOST_MEMORY;
+            }
         }
+
+        // remove what has been stored under the new name
+        if (req->rc != CKR_OK && req->named)
+            delete_token_object(tokdata, req->obj);
     }
 
-    if (sess->session_info.state == CKS_RW_PUBLIC_SESSION) {
-        if (priv_obj) {
-            object_free(o);
-            TRACE_ERROR("%s\n", ock_err(ERR_USER_NOT_LOGGED_IN));
-            return CKR_USER_NOT_LOGGED_IN;
+    gc->in_batch = FALSE;
+    object_mgr_publish_shm_log(&tokdata->global_shm->publ_tok_log,
+                               &gc->publ_log_pending);
+    object_mgr_publish_shm_log(&tokdata->global_shm->priv_tok_log,
+                               &gc->priv_log_pending);
+
+    // the objects are stored, they must not be freed by the callers anymore
+    if (XProcUnLock(tokdata) != CKR_OK)
+        TRACE_ERROR("Failed to release Process Lock.\n");
+}
+
+// stores a new or modified token object together with the objects that other
+// threads store at the same time. the thread that finds no batch in progress
+// becomes the leader: it waits up to the group commit window for more
+// requests, and then commits the queued requests as one batch. all others
+// wait until their request has been committed. returns when the object is
+// durable.
+//
+// The XProcLock must not be held when calling this function. The object must
+// hold the READ or WRITE lock.
+//
+static CK_RV object_mgr_group_commit(STDLL_TokData_t *tokdata,
+                                     struct tok_obj_commit *req)
+{
+    struct tok_obj_group_commit *gc = &tokdata->group_commit;
+    struct tok_obj_commit *batch, *last, *next;
+    struct timespec deadline;
+    CK_ULONG num;
+
+    req->next = NULL;
+    req->named = FALSE;
+    req->obj_handle = 0;
+    req->done = FALSE;
+    req->rc = CKR_OK;
+
+    pthread_mutex_lock(&gc->mutex);
+
+    if (gc->tail != NULL)
+        gc->tail->next = req;
+    else
+        gc->head = req;
+    gc->tail = req;
+    gc->num_queued++;
+    if (gc->leader && gc->num_queued >= TOK_OBJ_COMMIT_MAX)
+        pthread_cond_signal(&gc->full_cond);
+
+    while (!req->done) {
+        if (gc->leader) {
+            pthread_cond_wait(&gc->done_cond, &gc->mutex);
+            continue;
         }
-    }
 
-    if (sess->session_info.state == CKS_RW_SO_FUNCTIONS) {
-        if (priv_obj) {
-            object_free(o);
-            TRACE_ERROR("%s\n", ock_err(ERR_USER_NOT_LOGGED_IN));
-            return CKR_USER_NOT_LOGGED_IN;
+        gc->leader = TRUE;
+
+        if (gc->window > 0) {
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += gc->window * 1000;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+
+            while (gc->num_queued < TOK_OBJ_COMMIT_MAX &&
+                   pthread_cond_timedwait(&gc->full_cond, &gc->mutex,
+                                          &deadline) != ETIMEDOUT)
+                ;
+        }
+
+        // take up to TOK_OBJ_COMMIT_MAX requests off the queue
+        batch = gc->head;
+        for (last = batch, num = 1; num < TOK_OBJ_COMMIT_MAX &&
+                                    last->next != NULL; num++)
+            last = last->next;
+        gc->head = last->next;
+        if (gc->head == NULL)
+            gc->tail = NULL;
+        gc->num_queued -= num;
+        last->next = NULL;
+
+        pthread_mutex_unlock(&gc->mutex);
+        object_mgr_commit_batch(tokdata, batch);
+        pthread_mutex_lock(&gc->mutex);
+
+        // a request may go away as soon as it is done
+        for (; batch != NULL; batch = next) {
+            next = batch->next;
+            batch->done = TRUE;
         }
+
+        gc->leader = FALSE;
+        pthread_cond_broadcast(&gc->done_cond);
     }
 
-    *obj = o;
+    pthread_mutex_unlock(&gc->mutex);
 
-    return CKR_OK;
+    return req->rc;
 }
 
 /*
@@ -446,8 +1612,8 @@ CK_RV object_mgr_create_final(STDLL_TokData_t *tokdata,
     CK_BBOOL locked = FALSE;
     CK_RV rc;
     unsigned long obj_handle;
-    char fname[PATH_MAX] = "";
-    int fd;
+    CK_BBOOL named = FALSE;
+    struct tok_obj_commit req;
 
     if (!sess || !obj || !handle) {
         TRACE_ERROR("Invalid function arguments.\n");
@@ -464,6 +1630,7 @@ CK_RV object_mgr_create_final(STDLL_TokData_t *tokdata,
         TRACE_ERROR("Failed to store acceptable object strength.\n");
         return rc;
     }
+    template_update_key_desc(obj->template);
 
     sess_obj = object_is_session_object(obj);
     priv_obj = object_is_private(obj);
@@ -472,10 +1639,21 @@ CK_RV object_mgr_create_final(STDLL_TokData_t *tokdata,
         obj->session = sess;
         memset(obj->name, 0x0, sizeof(CK_BYTE) * 8);
 
-        if ((obj_handle = bt_node_add(&tokdata->sess_obj_btree, obj)) == 0) {
+        if ((obj_handle = object_mgr_add_sess_obj(tokdata, obj)) == 0) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             return CKR_HOST_MEMORY;
         }
+    } else if (tokdata->group_commit.enabled && !XProcLockHeld(tokdata)) {
+        // name, save, and add the object to SHM and the token object btree
+        // together with the objects created by other threads
+        //
+        req.obj = obj;
+        req.create = TRUE;
+        rc = object_mgr_group_commit(tokdata, &req);
+        if (rc != CKR_OK)
+            return rc;
+
+        obj_handle = req.obj_handle;
     } else {
         // we'll be modifying nv_token_data so we should protect this part
         // with 'XProcLock'
@@ -487,40 +1665,12 @@ CK_RV object_mgr_create_final(STDLL_TokData_t *tokdata,
         }
         locked = TRUE;
 
-        // Determine if we have already reached our Max Token Objects
-        //
-        if (priv_obj) {
-            if (tokdata->global_shm->num_priv_tok_obj >= MAX_TOK_OBJS) {
-                TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-                rc = CKR_HOST_MEMORY;
-                goto done;
-            }
-        } else {
-            if (tokdata->global_shm->num_publ_tok_obj >= MAX_TOK_OBJS) {
-                TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-                rc = CKR_HOST_MEMORY;
-                goto done;
-            }
-        }
-
-        /* create unique file name in token directory */
-        if (ock_snprintf(fname, sizeof(fname), "%s/" PK_LITE_OBJ_DIR "/%s",
-                         tokdata->data_store, "OBXXXXXX") != 0) {
-            TRACE_ERROR("buffer overflow for object path");
-            rc = CKR_FUNCTION_FAILED;
-            goto done;
-        }
-
-        fd = mkstemp(fname);
-        if (fd < 0) {
-            TRACE_ERROR("mkstemp failed with: %s\n", strerror(errno));
-            rc = CKR_FUNCTION_FAILED;
+        rc = new_token_object_name(tokdata, obj->name);
+        if (rc != CKR_OK)
             goto done;
-        }
-        close(fd); /* written and permissions set by save_token_object */
+        named = TRUE;
 
         obj->session = NULL;
-        memcpy(&obj->name, &fname[strlen(fname) - 8], 8);
 
         rc = save_token_object(tokdata, obj);
         if (rc != CKR_OK)
@@ -528,14 +1678,23 @@ CK_RV object_mgr_create_final(STDLL_TokData_t *tokdata,
 
         // add the object identifier to the shared memory segment
         //
-        object_mgr_add_to_shm(obj, tokdata->global_shm);
+        rc = object_mgr_add_to_shm(tokdata, obj);
+        if (rc != CKR_OK) {
+            TRACE_DEVEL("object_mgr_add_to_shm failed.\n");
+            delete_token_object(tokdata, obj);
+            goto done;
+        }
 
         // now, store the object in the token object btree
         //
         if (priv_obj)
-            obj_handle = bt_node_add(&tokdata->priv_token_obj_btree, obj);
+            obj_handle = object_mgr_add_tok_obj(tokdata,
+                                                &tokdata->priv_token_obj_btree,
+                                                obj);
         else
-            obj_handle = bt_node_add(&tokdata->publ_token_obj_btree, obj);
+            obj_handle = object_mgr_add_tok_obj(tokdata,
+                                                &tokdata->publ_token_obj_btree,
+                                                obj);
 
         if (!obj_handle) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
@@ -555,8 +1714,12 @@ CK_RV object_mgr_create_final(STDLL_TokData_t *tokdata,
             // pass NULL here, so that obj (the binary tree node's value
             // pointer) isn't touched.
             // It is free'd by the caller of object_mgr_create_final
-            bt_node_free(&tokdata->sess_obj_btree, obj_handle, FALSE);
+            object_mgr_free_sess_obj(tokdata, obj_handle, obj, FALSE);
         } else {
+            // a group commit has already released the XProcLock
+            if (!locked && XProcLock(tokdata) == CKR_OK)
+                locked = TRUE;
+
             delete_token_object(tokdata, obj);
 
             if (priv_obj) {
@@ -564,16 +1727,18 @@ CK_RV object_mgr_create_final(STDLL_TokData_t *tokdata,
                 // but pass NULL here, so that obj (the binary tree node's value
                 // pointer) isn't touched. It is free'd by the caller of
                 // object_mgr_create_final
-                bt_node_free(&tokdata->priv_token_obj_btree, obj_handle, FALSE);
+                object_mgr_free_tok_obj(tokdata, &tokdata->priv_token_obj_btree,
+                                        obj_handle, obj, FALSE);
             } else {
                 // put the binary tree node which holds obj on the free list,
                 // but pass NULL here, so that obj (the binary tree node's value
                 // pointer) isn't touched. It is free'd by the caller of
                 // object_mgr_create_final
-                bt_node_free(&tokdata->publ_token_obj_btree, obj_handle, FALSE);
+                object_mgr_free_tok_obj(tokdata, &tokdata->publ_token_obj_btree,
+                                        obj_handle, obj, FALSE);
             }
 
-            object_mgr_del_from_shm(obj, tokdata->global_shm);
+            object_mgr_del_from_shm(tokdata, obj);
         }
     }
 
@@ -585,6 +1750,9 @@ done:
                 TRACE_ERROR("Failed to release Process Lock.\n");
             }
         } else {
+            /* remove what has been stored under the new name */
+            if (named)
+                delete_token_object(tokdata, obj);
             /* return error that occurred first */
             XProcUnLock(tokdata);
         }
@@ -592,8 +1760,6 @@ done:
 
     if (rc == CKR_OK)
         TRACE_DEVEL("Object created: handle: %lu\n", *handle);
-    else if (fname[0] != '\0')
-        remove(fname);
 
     return rc;
 }
@@ -640,7 +1806,12 @@ CK_RV object_mgr_destroy_object(STDLL_TokData_t *tokdata,
     }
 
     if (map->is_session_obj) {
-        bt_node_free(&tokdata->sess_obj_btree, map->obj_handle, TRUE);
+        o = bt_get_node_value(&tokdata->sess_obj_btree, map->obj_handle);
+        if (o != NULL) {
+            bt_put_node_value(&tokdata->sess_obj_btree, o);
+            object_mgr_free_sess_obj(tokdata, map->obj_handle, o, TRUE);
+            o = NULL;
+        }
     } else {
         if (XProcLock(tokdata)) {
             TRACE_ERROR("Failed to get Process Lock.\n");
@@ -663,16 +1834,18 @@ CK_RV object_mgr_destroy_object(STDLL_TokData_t *tokdata,
 
         delete_token_object(tokdata, o);
 
-        DUMP_SHM(tokdata->global_shm, "before");
-        object_mgr_del_from_shm(o, tokdata->global_shm);
-        DUMP_SHM(tokdata->global_shm, "after");
+        DUMP_SHM(tokdata, "before");
+        object_mgr_del_from_shm(tokdata, o);
+        DUMP_SHM(tokdata, "after");
 
         if (map->is_private) {
             bt_put_node_value(&tokdata->priv_token_obj_btree, o);
-            bt_node_free(&tokdata->priv_token_obj_btree, map->obj_handle, TRUE);
+            object_mgr_free_tok_obj(tokdata, &tokdata->priv_token_obj_btree,
+                                    map->obj_handle, o, TRUE);
         } else {
             bt_put_node_value(&tokdata->publ_token_obj_btree, o);
-            bt_node_free(&tokdata->publ_token_obj_btree, map->obj_handle, TRUE);
+            object_mgr_free_tok_obj(tokdata, &tokdata->publ_token_obj_btree,
+                                    map->obj_handle, o, TRUE);
         }
         o = NULL;
     }
@@ -731,15 +1904,17 @@ void delete_token_obj_cb(STDLL_TokData_t *tokdata, void *node,
 
         delete_token_object(tokdata, o);
 
-        object_mgr_del_from_shm(o, tokdata->global_shm);
+        object_mgr_del_from_shm(tokdata, o);
 
         if (map->is_private) {
             bt_put_node_value(&tokdata->priv_token_obj_btree, o);
-            bt_node_free(&tokdata->priv_token_obj_btree, map->obj_handle, TRUE);
+            object_mgr_free_tok_obj(tokdata, &tokdata->priv_token_obj_btree,
+                                    map->obj_handle, o, TRUE);
         }
         else {
             bt_put_node_value(&tokdata->publ_token_obj_btree, o);
-            bt_node_free(&tokdata->publ_token_obj_btree, map->obj_handle, TRUE);
+            object_mgr_free_tok_obj(tokdata, &tokdata->publ_token_obj_btree,
+                                    map->obj_handle, o, TRUE);
         }
         o = NULL;
     }
@@ -782,10 +1957,18 @@ CK_RV object_mgr_destroy_token_objects(STDLL_TokData_t *tokdata)
     tokdata->global_shm->num_priv_tok_obj = 0;
     tokdata->global_shm->num_publ_tok_obj = 0;
 
-    memset(&tokdata->global_shm->publ_tok_objs, 0x0,
-           MAX_TOK_OBJS * sizeof(TOK_OBJ_ENTRY));
-    memset(&tokdata->global_shm->priv_tok_objs, 0x0,
-           MAX_TOK_OBJS * sizeof(TOK_OBJ_ENTRY));
+    rc = object_mgr_map_tok_obj_segs(tokdata);
+    if (rc != CKR_OK) {
+        XProcUnLock(tokdata);
+        goto done;
+    }
+    object_mgr_clear_tok_obj_table(tokdata);
+
+    // skip the generations past the change logs, so that all processes
+    // resync their token object btrees completely
+    //
+    object_mgr_reset_shm_log(&tokdata->global_shm->publ_tok_log);
+    object_mgr_reset_shm_log(&tokdata->global_shm->priv_tok_log);
 
     rc = XProcUnLock(tokdata);
     if (rc != CKR_OK) {
@@ -962,42 +2145,56 @@ done:
     return rc;
 }
 
-void find_obj_cb(STDLL_TokData_t *tokdata, void *node,
-                 unsigned long map_handle, void *p3)
+/*
+ * Returns the object map handle recorded in the object, if the object map
+ * node it refers to still maps to this very object. Returns 0 if the object
+ * is not (or no longer) in the object map, e.g. because the map node has been
+ * purged and possibly reused for another object in the meantime.
+ */
+static CK_OBJECT_HANDLE object_mgr_get_map_handle(STDLL_TokData_t *tokdata,
+                                                  OBJECT *obj)
 {
-    OBJECT_MAP *map = (OBJECT_MAP *) node;
-    OBJECT *obj;
-    struct find_args *fa = (struct find_args *) p3;
+    CK_OBJECT_HANDLE map_handle = obj->map_handle;
+    OBJECT_MAP *map;
+    OBJECT *map_obj;
+    struct btree *t;
 
-    UNUSED(tokdata);
+    if (map_handle == 0)
+        return 0;
 
-    if (fa->done)
-        return;
+    map = bt_get_node_value(&tokdata->object_map_btree, map_handle);
+    if (map == NULL)
+        return 0;
 
     if (map->is_session_obj)
-        obj = bt_get_node_value(&tokdata->sess_obj_btree, map->obj_handle);
+        t = &tokdata->sess_obj_btree;
     else if (map->is_private)
-        obj = bt_get_node_value(&tokdata->priv_token_obj_btree, map->obj_handle);
+        t = &tokdata->priv_token_obj_btree;
     else
-        obj = bt_get_node_value(&tokdata->publ_token_obj_btree, map->obj_handle);
+        t = &tokdata->publ_token_obj_btree;
 
-    if (!obj)
-        return;
+    map_obj = bt_get_node_value(t, map->obj_handle);
+    if (map_obj != obj)
+        map_handle = 0;
 
-    /* if this object is the one we're looking for (matches p3->obj), return
-     * its map_handle in p3->map_handle */
-    if (obj == fa->obj) {
-        fa->map_handle = map_handle;
-        fa->done = TRUE;
-    }
+    bt_put_node_value(t, map_obj);
+    bt_put_node_value(&tokdata->object_map_btree, map);
 
-    if (map->is_session_obj)
-        bt_put_node_value(&tokdata->sess_obj_btree, obj);
-    else if (map->is_private)
-        bt_put_node_value(&tokdata->priv_token_obj_btree, obj);
-    else
-        bt_put_node_value(&tokdata->publ_token_obj_btree, obj);
-    obj = NULL;
+    return map_handle;
+}
+
+/*
+ * Removes the object map node of the object (if any) from the object map.
+ */
+static void object_mgr_del_from_map(STDLL_TokData_t *tokdata, OBJECT *obj)
+{
+    CK_OBJECT_HANDLE map_handle;
+
+    map_handle = object_mgr_get_map_handle(tokdata, obj);
+    if (map_handle != 0)
+        bt_node_free(&tokdata->object_map_btree, map_handle, TRUE);
+
+    obj->map_handle = 0;
 }
 
 // object_mgr_find_in_map2()
@@ -1007,7 +2204,7 @@ void find_obj_cb(STDLL_TokData_t *tokdata, void *node,
 CK_RV object_mgr_find_in_map2(STDLL_TokData_t *tokdata,
                               OBJECT *obj, CK_OBJECT_HANDLE *handle)
 {
-    struct find_args fa;
+    CK_OBJECT_HANDLE map_handle;
     CK_RV rc;
 
     if (!obj || !handle) {
@@ -1015,19 +2212,15 @@ CK_RV object_mgr_find_in_map2(STDLL_TokData_t *tokdata,
         return CKR_FUNCTION_FAILED;
     }
 
-    fa.done = FALSE;
-    fa.obj = obj;
-    fa.map_handle = 0;
-
-    // pass the fa structure with the values to operate on in the find_obj_cb
-    // function
-    bt_for_each_node(tokdata, &tokdata->object_map_btree, find_obj_cb, &fa);
-
-    if (fa.done == FALSE || fa.map_handle == 0) {
+    // the object remembers its map handle, so no need to walk the whole
+    // object map, just verify that the map node still refers to the object
+    map_handle = object_mgr_get_map_handle(tokdata, obj);
+    if (map_handle == 0) {
+        obj->map_handle = 0;
         return CKR_OBJECT_HANDLE_INVALID;
     }
 
-    *handle = fa.map_handle;
+    *handle = map_handle;
 
     if (!object_is_session_object(obj)) {
         rc = object_mgr_check_shm(tokdata, obj, READ_LOCK);
@@ -1115,6 +2308,37 @@ done:
     object_unlock(obj);
 }
 
+// Adds the objects of btree @t that match the find template to the session's
+// find list. Only the candidates from the btree's attribute index are compared
+// against the template if the template contains an indexed attribute.
+//
+static void object_mgr_find_in_btree(STDLL_TokData_t *tokdata,
+                                     struct btree *t,
+                                     struct find_build_list_args *fa)
+{
+    unsigned long *handles;
+    CK_ULONG num_handles, i;
+    OBJECT *obj;
+
+    if (!obj_attr_index_candidates(object_mgr_obj_attr_index(tokdata, t),
+                                   fa->pTemplate, fa->ulCount,
+                                   &handles, &num_handles)) {
+        bt_for_each_node(tokdata, t, find_build_list_cb, fa);
+        return;
+    }
+
+    for (i = 0; i < num_handles; i++) {
+        obj = bt_get_node_value(t, handles[i]);
+        if (obj == NULL)
+            continue;
+
+        find_build_list_cb(tokdata, obj, handles[i], fa);
+        bt_put_node_value(t, obj);
+    }
+
+    free(handles);
+}
+
 CK_RV object_mgr_find_init(STDLL_TokData_t *tokdata,
                            SESSION *sess,
                            CK_ATTRIBUTE *pTemplate, CK_ULONG ulCount)
@@ -1154,18 +2378,20 @@ CK_RV object_mgr_find_init(STDLL_TokData_t *tokdata,
     sess->find_count = 0;
     sess->find_idx = 0;
 
-    rc = XProcLock(tokdata);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("Failed to get Process Lock.\n");
-        return rc;
-    }
+    if (object_mgr_shm_changed(tokdata)) {
+        rc = XProcLock(tokdata);
+        if (rc != CKR_OK) {
+            TRACE_ERROR("Failed to get Process Lock.\n");
+            return rc;
+        }
 
-    object_mgr_update_from_shm(tokdata);
+        object_mgr_update_from_shm(tokdata);
 
-    rc = XProcUnLock(tokdata);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("Failed to release Process Lock.\n");
-        return rc;
+        rc = XProcUnLock(tokdata);
+        if (rc != CKR_OK) {
+            TRACE_ERROR("Failed to release Process Lock.\n");
+            return rc;
+        }
     }
 
     fa.hw_feature = FALSE;
@@ -1207,21 +2433,19 @@ CK_RV object_mgr_find_init(STDLL_TokData_t *tokdata,
     case CKS_RW_SO_FUNCTIONS:
         fa.public_only = TRUE;
 
-        bt_for_each_node(tokdata, &tokdata->publ_token_obj_btree,
-                         find_build_list_cb, &fa);
-        bt_for_each_node(tokdata, &tokdata->sess_obj_btree, find_build_list_cb,
-                         &fa);
+        object_mgr_find_in_btree(tokdata, &tokdata->publ_token_obj_btree,
+                                 &fa);
+        object_mgr_find_in_btree(tokdata, &tokdata->sess_obj_btree, &fa);
         break;
     case CKS_RO_USER_FUNCTIONS:
     case CKS_RW_USER_FUNCTIONS:
         fa.public_only = FALSE;
 
-        bt_for_each_node(tokdata, &tokdata->priv_token_obj_btree,
-                         find_build_list_cb, &fa);
-        bt_for_each_node(tokdata, &tokdata->publ_token_obj_btree,
-                         find_build_list_cb, &fa);
-        bt_for_each_node(tokdata, &tokdata->sess_obj_btree, find_build_list_cb,
-                         &fa);
+        object_mgr_find_in_btree(tokdata, &tokdata->priv_token_obj_btree,
+                                 &fa);
+        object_mgr_find_in_btree(tokdata, &tokdata->publ_token_obj_btree,
+                                 &fa);
+        object_mgr_find_in_btree(tokdata, &tokdata->sess_obj_btree, &fa);
         break;
     }
 
@@ -1297,6 +2521,154 @@ done:
 }
 
 
+/* Attribute values in find records are padded to a multiple of CK_ULONG */
+#define FIND_RECORD_VALUE_LEN(len) \
+    (((len) + sizeof(CK_ULONG) - 1) & ~(sizeof(CK_ULONG) - 1))
+
+// object_mgr_find_get_attribute_values()
+//
+// Returns the next objects of the session's active find operation as packed
+// records (see CK_C_IBM_FindObjectsGetAttributes) carrying the values of the
+// requested attribute types. Each object is looked up and locked only once,
+// instead of once per C_GetAttributeValue call. Objects that have been
+// destroyed since C_FindObjectsInit, or that are private while the session
+// is not logged in, are skipped.
+//
+CK_RV object_mgr_find_get_attribute_values(STDLL_TokData_t *tokdata,
+                                           SESSION *sess,
+                                           CK_ATTRIBUTE_TYPE *pTypes,
+                                           CK_ULONG ulTypeCount,
+                                           CK_BYTE *buffer,
+                                           CK_ULONG *buffer_len,
+                                           CK_ULONG *object_count)
+{
+    CK_IBM_OBJECT_RECORD rec;
+    CK_IBM_ATTRIBUTE_VALUE val;
+    CK_ATTRIBUTE *attrs = NULL;
+    OBJECT *obj;
+    CK_ULONG i, used = 0, count = 0, rec_len, pad;
+    CK_BYTE *ptr;
+    CK_RV rc = CKR_OK;
+
+    if (!sess || (!pTypes && ulTypeCount > 0) || !buffer || !buffer_len ||
+        !object_count) {
+        TRACE_ERROR("Invalid function arguments.\n");
+        return CKR_FUNCTION_FAILED;
+    }
+
+    for (i = 0; i < ulTypeCount; i++) {
+        if (is_attribute_attr_array(pTypes[i])) {
+            TRACE_ERROR("%s: %lx\n", ock_err(ERR_ATTRIBUTE_TYPE_INVALID),
+                        pTypes[i]);
+            return CKR_ATTRIBUTE_TYPE_INVALID;
+        }
+    }
+
+    if (ulTypeCount > 0) {
+        attrs = calloc(ulTypeCount, sizeof(CK_ATTRIBUTE));
+        if (attrs == NULL) {
+            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+            return CKR_HOST_MEMORY;
+        }
+    }
+
+    while (sess->find_idx < sess->find_count) {
+        rc = object_mgr_find_in_map1(tokdata,
+                                     sess->find_list[sess->find_idx],
+                                     &obj, READ_LOCK);
+        if (rc == CKR_OBJECT_HANDLE_INVALID) {
+            sess->find_idx++;
+            continue;
+        }
+        if (rc != CKR_OK) {
+            TRACE_DEVEL("object_mgr_find_in_map1 failed.\n");
+            goto done;
+        }
+
+        if (object_is_private(obj) &&
+            (sess->session_info.state == CKS_RO_PUBLIC_SESSION ||
+             sess->session_info.state == CKS_RW_PUBLIC_SESSION)) {
+            object_put(tokdata, obj, TRUE);
+            obj = NULL;
+            sess->find_idx++;
+            continue;
+        }
+
+        /* First pass: determine the value lengths and thus the record size */
+        rec_len = sizeof(rec);
+        for (i = 0; i < ulTypeCount; i++) {
+            attrs[i].type = pTypes[i];
+            attrs[i].pValue = NULL;
+            attrs[i].ulValueLen = 0;
+        }
+        /* Sensitive or missing attributes are flagged in ulValueLen */
+        object_get_attribute_values(obj, attrs, ulTypeCount);
+        for (i = 0; i < ulTypeCount; i++) {
+            rec_len += sizeof(val);
+            if (attrs[i].ulValueLen != (CK_ULONG)CK_UNAVAILABLE_INFORMATION)
+                rec_len += FIND_RECORD_VALUE_LEN(attrs[i].ulValueLen);
+        }
+
+        if (*buffer_len - used < rec_len) {
+            object_put(tokdata, obj, TRUE);
+            obj = NULL;
+            if (count == 0) {
+                TRACE_ERROR("%s\n", ock_err(ERR_BUFFER_TOO_SMALL));
+                *buffer_len = rec_len;
+                rc = CKR_BUFFER_TOO_SMALL;
+                goto out;
+            }
+            break;
+        }
+
+        /* Second pass: copy the values into the record */
+        ptr = buffer + used + sizeof(rec);
+        for (i = 0; i < ulTypeCount; i++) {
+            ptr += sizeof(val);
+            if (attrs[i].ulValueLen == (CK_ULONG)CK_UNAVAILABLE_INFORMATION)
+                continue;
+            attrs[i].pValue = ptr;
+            ptr += FIND_RECORD_VALUE_LEN(attrs[i].ulValueLen);
+        }
+        object_get_attribute_values(obj, attrs, ulTypeCount);
+
+        object_put(tokdata, obj, TRUE);
+        obj = NULL;
+
+        rec.hObject = sess->find_list[sess->find_idx];
+        rec.ulRecordLen = rec_len;
+        memcpy(buffer + used, &rec, sizeof(rec));
+
+        ptr = buffer + used + sizeof(rec);
+        for (i = 0; i < ulTypeCount; i++) {
+            val.type = attrs[i].type;
+            val.ulValueLen = attrs[i].ulValueLen;
+            memcpy(ptr, &val, sizeof(val));
+            ptr += sizeof(val);
+            if (val.ulValueLen == (CK_ULONG)CK_UNAVAILABLE_INFORMATION)
+                continue;
+            pad = FIND_RECORD_VALUE_LEN(val.ulValueLen) - val.ulValueLen;
+            memset(ptr + val.ulValueLen, 0, pad);
+            ptr += val.ulValueLen + pad;
+        }
+
+        used += rec_len;
+        count++;
+        sess->find_idx++;
+    }
+
+done:
+    if (rc == CKR_OK) {
+        *buffer_len = used;
+        *object_count = count;
+    }
+out:
+    free(attrs);
+
+    return rc;
+}
+
+
 //
 //
 CK_RV object_mgr_get_object_size(STDLL_TokData_t *tokdata,
@@ -1345,10 +2717,9 @@ void purge_session_obj_cb(STDLL_TokData_t *tokdata, void *node,
         object_unlock(obj);
 
         if (del == TRUE) {
-            if (obj->map_handle)
-                bt_node_free(&tokdata->object_map_btree, obj->map_handle, TRUE);
+            object_mgr_del_from_map(tokdata, obj);
 
-            bt_node_free(&tokdata->sess_obj_btree, obj_handle, TRUE);
+            object_mgr_free_sess_obj(tokdata, obj_handle, obj, TRUE);
         }
     }
 }
@@ -1387,12 +2758,9 @@ void purge_token_obj_cb(STDLL_TokData_t *tokdata, void *node,
     OBJECT *obj = (OBJECT *) node;
     struct btree *t = (struct btree *) p3;
 
-    UNUSED(tokdata);
-
-    if (obj->map_handle)
-        bt_node_free(&tokdata->object_map_btree, obj->map_handle, TRUE);
+    object_mgr_del_from_map(tokdata, obj);
 
-    bt_node_free(t, obj_handle, TRUE);
+    object_mgr_free_tok_obj(tokdata, t, obj_handle, obj, TRUE);
 }
 
 // this routine cleans up the list of token objects. in general, we don't
@@ -1406,6 +2774,9 @@ CK_BBOOL object_mgr_purge_token_objects(STDLL_TokData_t *tokdata)
     bt_for_each_node(tokdata, &tokdata->publ_token_obj_btree, purge_token_obj_cb,
                      &tokdata->publ_token_obj_btree);
 
+    tokdata->priv_tok_obj_synced = FALSE;
+    tokdata->publ_tok_obj_synced = FALSE;
+
     return TRUE;
 }
 
@@ -1415,6 +2786,8 @@ CK_BBOOL object_mgr_purge_private_token_objects(STDLL_TokData_t *tokdata)
     bt_for_each_node(tokdata, &tokdata->priv_token_obj_btree, purge_token_obj_cb,
                      &tokdata->priv_token_obj_btree);
 
+    tokdata->priv_tok_obj_synced = FALSE;
+
     return TRUE;
 }
 
@@ -1434,9 +2807,7 @@ CK_RV object_mgr_restore_obj_withSize(STDLL_TokData_t *tokdata, CK_BYTE *data,
                                       const char *fname)
 {
     OBJECT *obj = NULL;
-    CK_BBOOL priv;
-    CK_RV rc, tmp;
-    TOK_OBJ_ENTRY *entry = NULL;
+    CK_RV rc;
 
     if (!data) {
         TRACE_ERROR("Invalid function argument.\n");
@@ -1453,6 +2824,21 @@ CK_RV object_mgr_restore_obj_withSize(STDLL_TokData_t *tokdata, CK_BYTE *data,
         return rc;
     }
 
+    return object_mgr_add_restored_obj(tokdata, obj, oldObj);
+}
+
+//
+// Adds an object restored via object_restore_withSize() to the token object
+// tree and shared memory, or updates the shared memory information of
+// oldObj if it has been restored in place. A new object is freed on error.
+//
+CK_RV object_mgr_add_restored_obj(STDLL_TokData_t *tokdata, OBJECT *obj,
+                                  OBJECT *oldObj)
+{
+    CK_BBOOL priv;
+    CK_RV rc, tmp;
+    TOK_OBJ_ENTRY *entry = NULL;
+
     rc = XProcLock(tokdata);
     if (rc != CKR_OK) {
         TRACE_ERROR("Failed to get Process Lock.\n");
@@ -1473,14 +2859,16 @@ CK_RV object_mgr_restore_obj_withSize(STDLL_TokData_t *tokdata, CK_BYTE *data,
         priv = object_is_private(obj);
 
         if (priv) {
-            if (!bt_node_add(&tokdata->priv_token_obj_btree, obj)) {
+            if (!object_mgr_add_tok_obj(tokdata,
+                                        &tokdata->priv_token_obj_btree, obj)) {
                 TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
                 rc = CKR_HOST_MEMORY;
                 object_free(obj);
                 goto unlock;
             }
         } else {
-            if (!bt_node_add(&tokdata->publ_token_obj_btree, obj)) {
+            if (!object_mgr_add_tok_obj(tokdata,
+                                        &tokdata->publ_token_obj_btree, obj)) {
                 TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
                 rc = CKR_HOST_MEMORY;
                 object_free(obj);
@@ -1490,13 +2878,9 @@ CK_RV object_mgr_restore_obj_withSize(STDLL_TokData_t *tokdata, CK_BYTE *data,
 
         if (priv) {
             if (tokdata->global_shm->priv_loaded == FALSE) {
-                if (tokdata->global_shm->num_priv_tok_obj < MAX_TOK_OBJS) {
-                    object_mgr_add_to_shm(obj, tokdata->global_shm);
-                } else {
-                    TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-                    rc = CKR_HOST_MEMORY;
+                rc = object_mgr_add_to_shm(tokdata, obj);
+                if (rc != CKR_OK)
                     goto unlock;
-                }
             } else {
                 rc = object_mgr_get_shm_entry_for_obj(tokdata, obj, &entry);
                 if (rc == CKR_OK) {
@@ -1506,13 +2890,9 @@ CK_RV object_mgr_restore_obj_withSize(STDLL_TokData_t *tokdata, CK_BYTE *data,
             }
         } else {
             if (tokdata->global_shm->publ_loaded == FALSE) {
-                if (tokdata->global_shm->num_publ_tok_obj < MAX_TOK_OBJS) {
-                    object_mgr_add_to_shm(obj, tokdata->global_shm);
-                } else {
-                    TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-                    rc = CKR_HOST_MEMORY;
+                rc = object_mgr_add_to_shm(tokdata, obj);
+                if (rc != CKR_OK)
                     goto unlock;
-                }
             } else {
                 rc = object_mgr_get_shm_entry_for_obj(tokdata, obj, &entry);
                 if (rc == CKR_OK) {
@@ -1539,58 +2919,30 @@ unlock:
 CK_RV object_mgr_save_token_object(STDLL_TokData_t *tokdata, OBJECT *obj)
 {
     TOK_OBJ_ENTRY *entry = NULL;
-    CK_ULONG index;
+    struct tok_obj_commit req;
     CK_RV rc;
 
     obj->count_lo++;
     if (obj->count_lo == 0)
-        obj->count_hi++;
-
-    rc = XProcLock(tokdata);
-    if (rc != CKR_OK) {
-        TRACE_ERROR("Failed to get Process Lock.\n");
-        goto done;
-    }
-
-    if (object_is_private(obj)) {
-        if (tokdata->global_shm->num_priv_tok_obj == 0) {
-            TRACE_DEVEL("%s\n", ock_err(ERR_OBJECT_HANDLE_INVALID));
-            rc = CKR_OBJECT_HANDLE_INVALID;
-            XProcUnLock(tokdata);
-            goto done;
-        }
-        rc = object_mgr_search_shm_for_obj(tokdata->global_shm->
-                                           priv_tok_objs, 0,
-                                           tokdata->global_shm->
-                                           num_priv_tok_obj - 1, obj,
-                                           &index);
-
-        if (rc != CKR_OK) {
-            TRACE_DEVEL("object_mgr_search_shm_for_obj failed.\n");
-            XProcUnLock(tokdata);
-            goto done;
-        }
-
-        entry = &tokdata->global_shm->priv_tok_objs[index];
-    } else {
-        if (tokdata->global_shm->num_publ_tok_obj == 0) {
-            TRACE_DEVEL("%s\n", ock_err(ERR_OBJECT_HANDLE_INVALID));
-            rc = CKR_OBJECT_HANDLE_INVALID;
-            XProcUnLock(tokdata);
-            goto done;
-        }
-        rc = object_mgr_search_shm_for_obj(tokdata->global_shm->
-                                           publ_tok_objs, 0,
-                                           tokdata->global_shm->
-                                           num_publ_tok_obj - 1, obj,
-                                           &index);
-        if (rc != CKR_OK) {
-            TRACE_DEVEL("object_mgr_search_shm_for_obj failed.\n");
-            XProcUnLock(tokdata);
-            goto done;
-        }
+        obj->count_hi++;
+
+    if (tokdata->group_commit.enabled && !XProcLockHeld(tokdata)) {
+        req.obj = obj;
+        req.create = FALSE;
+        return object_mgr_group_commit(tokdata, &req);
+    }
+
+    rc = XProcLock(tokdata);
+    if (rc != CKR_OK) {
+        TRACE_ERROR("Failed to get Process Lock.\n");
+        goto done;
+    }
 
-        entry = &tokdata->global_shm->publ_tok_objs[index];
+    rc = object_mgr_get_shm_entry_for_obj(tokdata, obj, &entry);
+    if (rc != CKR_OK) {
+        TRACE_DEVEL("object_mgr_get_shm_entry_for_obj failed.\n");
+        XProcUnLock(tokdata);
+        goto done;
     }
 
     rc = save_token_object(tokdata, obj);
@@ -1661,6 +3013,9 @@ CK_RV object_mgr_set_attribute_values(STDLL_TokData_t *tokdata,
         TRACE_DEVEL("object_set_attribute_values failed.\n");
         goto done;
     }
+    template_update_key_desc(obj->template);
+    obj_attr_index_update(obj);
+
     // okay.  the object has been updated.  if it's a session object,
     // we're finished.  if it's a token object, we need to update
     // non-volatile storage.
@@ -1684,177 +3039,141 @@ done:
 }
 
 
+// adds the token object to the token object table in SHM. the calling routine
+// is responsible for locking the global_shm mutex
 //
-//
-void object_mgr_add_to_shm(OBJECT *obj, LW_SHM_TYPE *global_shm)
+CK_RV object_mgr_add_to_shm(STDLL_TokData_t *tokdata, OBJECT *obj)
 {
-    // TODO: Can't this function fail?
+    LW_SHM_TYPE *global_shm = tokdata->global_shm;
+    TOK_OBJ_TABLE *table = &global_shm->tok_obj_table;
     TOK_OBJ_ENTRY *entry = NULL;
+    CK_ULONG_32 index, *bucket;
     CK_BBOOL priv;
+    CK_RV rc;
+
+    rc = object_mgr_map_tok_obj_segs(tokdata);
+    if (rc != CKR_OK)
+        return rc;
 
-    // the calling routine is responsible for locking the global_shm mutex
-    //
     priv = object_is_private(obj);
 
-    if (priv)
-        entry = &global_shm->priv_tok_objs[global_shm->num_priv_tok_obj];
-    else
-        entry = &global_shm->publ_tok_objs[global_shm->num_publ_tok_obj];
+    if (table->free_entry != 0) {
+        index = table->free_entry;
+        entry = tok_obj_entry(tokdata, index);
+        table->free_entry = entry->next;
+    } else {
+        if (table->num_entries + 1 >=
+                        (table->num_ext_segs + 1) * TOK_OBJ_SEG_SIZE) {
+            rc = object_mgr_grow_tok_obj_table(tokdata);
+            if (rc != CKR_OK)
+                return rc;
+        }
+        index = ++table->num_entries;
+        entry = tok_obj_entry(tokdata, index);
+    }
 
     entry->deleted = FALSE;
+    entry->priv = priv;
     entry->count_lo = 0;
     entry->count_hi = 0;
     memcpy(entry->name, obj->name, 8);
 
+    bucket = tok_obj_bucket(tokdata,
+                            tok_obj_bucket_for_hash(table,
+                                                    tok_obj_name_hash(obj->name)));
+    entry->next = *bucket;
+    *bucket = index;
+    obj->index = index;
+
+    table->count++;
+    if (table->count > (TOK_OBJ_SEG_SIZE << table->level) + table->split)
+        object_mgr_split_tok_obj_bucket(tokdata);
+
     if (priv)
         global_shm->num_priv_tok_obj++;
     else
         global_shm->num_publ_tok_obj++;
 
-    return;
+    object_mgr_log_shm_change(tokdata, priv, obj->name, FALSE);
+
+    return CKR_OK;
 }
 
 
+// removes the token object from the token object table in SHM. the calling
+// routine is responsible for locking the global_shm mutex
 //
-//
-CK_RV object_mgr_del_from_shm(OBJECT *obj, LW_SHM_TYPE *global_shm)
+CK_RV object_mgr_del_from_shm(STDLL_TokData_t *tokdata, OBJECT *obj)
 {
-    CK_ULONG index, count;
+    LW_SHM_TYPE *global_shm = tokdata->global_shm;
+    TOK_OBJ_TABLE *table = &global_shm->tok_obj_table;
+    TOK_OBJ_ENTRY *entry;
+    CK_ULONG_32 index, *link;
     CK_BBOOL priv;
     CK_RV rc;
 
+    rc = object_mgr_map_tok_obj_segs(tokdata);
+    if (rc != CKR_OK)
+        return rc;
 
-    // the calling routine is responsible for locking the global_shm mutex
-    //
+    index = object_mgr_lookup_tok_obj(tokdata, obj->name, &link);
+    if (index == 0) {
+        TRACE_DEVEL("%s\n", ock_err(ERR_OBJECT_HANDLE_INVALID));
+        return CKR_OBJECT_HANDLE_INVALID;
+    }
+    entry = tok_obj_entry(tokdata, index);
+    priv = entry->priv;
 
-    priv = object_is_private(obj);
+    *link = entry->next;
+    memset(entry, 0, sizeof(TOK_OBJ_ENTRY));
+    entry->deleted = TRUE;
+    entry->next = table->free_entry;
+    table->free_entry = index;
+    table->count--;
+    obj->index = 0;
 
-    if (priv) {
-        if (global_shm->num_priv_tok_obj == 0) {
-            TRACE_DEVEL("%s\n", ock_err(ERR_OBJECT_HANDLE_INVALID));
-            return CKR_OBJECT_HANDLE_INVALID;
-        }
-        rc = object_mgr_search_shm_for_obj(global_shm->priv_tok_objs,
-                                           0, global_shm->num_priv_tok_obj - 1,
-                                           obj, &index);
-        if (rc != CKR_OK) {
-            TRACE_DEVEL("object_mgr_search_shm_for_obj failed.\n");
-            return rc;
-        }
-        // Since the number of objects starts at 1 and index starts at zero, we
-        // decrement before we get count.  This eliminates the need to perform
-        // this operation later as well as decrementing the number of objects.
-        // (i.e. If we have 10 objects, num will be 10 but the last index is 9.
-        // If we want to delete the last object we need to subtract 9 from 9 not
-        // 10 from 9.)
-        //
+    if (priv)
         global_shm->num_priv_tok_obj--;
-        if (index > global_shm->num_priv_tok_obj) {
-            count = index - global_shm->num_priv_tok_obj;
-        } else {
-            count = global_shm->num_priv_tok_obj - index;
-        }
-
-        if (count > 0) {
-            // If we aren't deleting the last element in the list
-            // Move up count number of elements effectively deleting the index
-            // NB: memmove is required since the copied regions may overlap
-            memmove((char *) &global_shm->priv_tok_objs[index],
-                    (char *) &global_shm->priv_tok_objs[index + 1],
-                    sizeof(TOK_OBJ_ENTRY) * count);
-            // We need to zero out the last entry... Since the memcopy
-            // does not zero it out...
-            memset((char *) &global_shm->
-                   priv_tok_objs[global_shm->num_priv_tok_obj + 1], 0,
-                   sizeof(TOK_OBJ_ENTRY));
-        } else {
-            // We are deleting the last element which is in num_priv_tok_obj
-            memset((char *) &global_shm->
-                   priv_tok_objs[global_shm->num_priv_tok_obj], 0,
-                   sizeof(TOK_OBJ_ENTRY));
-        }
-    } else {
-        if (global_shm->num_publ_tok_obj == 0) {
-            TRACE_DEVEL("%s\n", ock_err(ERR_OBJECT_HANDLE_INVALID));
-            return CKR_OBJECT_HANDLE_INVALID;
-        }
-        rc = object_mgr_search_shm_for_obj(global_shm->publ_tok_objs,
-                                           0, global_shm->num_publ_tok_obj - 1,
-                                           obj, &index);
-        if (rc != CKR_OK) {
-            TRACE_DEVEL("object_mgr_search_shm_for_obj failed.\n");
-            return rc;
-        }
+    else
         global_shm->num_publ_tok_obj--;
 
-
-        if (index > global_shm->num_publ_tok_obj) {
-            count = index - global_shm->num_publ_tok_obj;
-        } else {
-            count = global_shm->num_publ_tok_obj - index;
-        }
-
-        if (count > 0) {
-            // NB: memmove is required since the copied regions may overlap
-            memmove((char *) &global_shm->publ_tok_objs[index],
-                    (char *) &global_shm->publ_tok_objs[index + 1],
-                    sizeof(TOK_OBJ_ENTRY) * count);
-            // We need to zero out the last entry... Since the memcopy
-            // does not zero it out...
-            memset((char *) &global_shm->
-                   publ_tok_objs[global_shm->num_publ_tok_obj + 1], 0,
-                   sizeof(TOK_OBJ_ENTRY));
-        } else {
-            memset((char *) &global_shm->
-                   publ_tok_objs[global_shm->num_publ_tok_obj], 0,
-                   sizeof(TOK_OBJ_ENTRY));
-        }
-    }
+    object_mgr_log_shm_change(tokdata, priv, obj->name, TRUE);
 
     return CKR_OK;
 }
 
+// the calling routine is responsible for locking the global_shm mutex
+//
 CK_RV object_mgr_get_shm_entry_for_obj(STDLL_TokData_t *tokdata, OBJECT *obj,
                                        TOK_OBJ_ENTRY **entry)
 {
-    CK_ULONG index;
+    TOK_OBJ_TABLE *table = &tokdata->global_shm->tok_obj_table;
+    CK_ULONG_32 index;
     CK_RV rc;
 
     *entry = NULL;
 
-    if (object_is_private(obj)) {
-        /* first check the object count. If it is 0, then just return. */
-        if (tokdata->global_shm->num_priv_tok_obj == 0) {
-            TRACE_ERROR("%s\n", ock_err(ERR_OBJECT_HANDLE_INVALID));
-            return CKR_OBJECT_HANDLE_INVALID;
-        }
-        rc = object_mgr_search_shm_for_obj(tokdata->global_shm->priv_tok_objs,
-                                           0,
-                                           tokdata->global_shm->
-                                           num_priv_tok_obj - 1, obj, &index);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("object_mgr_search_shm_for_obj failed.\n");
-            return rc;
-        }
-        *entry = &tokdata->global_shm->priv_tok_objs[index];
-    } else {
-        /* first check the object count. If it is 0, then just return. */
-        if (tokdata->global_shm->num_publ_tok_obj == 0) {
-            TRACE_ERROR("%s\n", ock_err(ERR_OBJECT_HANDLE_INVALID));
-            return CKR_OBJECT_HANDLE_INVALID;
-        }
-        rc = object_mgr_search_shm_for_obj(tokdata->global_shm->publ_tok_objs,
-                                           0,
-                                           tokdata->global_shm->num_publ_tok_obj
-                                           - 1,
-                                           obj, &index);
-        if (rc != CKR_OK) {
-            TRACE_ERROR("object_mgr_search_shm_for_obj failed.\n");
-            return rc;
-        }
-        *entry = &tokdata->global_shm->publ_tok_objs[index];
+    rc = object_mgr_map_tok_obj_segs(tokdata);
+    if (rc != CKR_OK)
+        return rc;
+
+    /* obj->index caches the entry index, but the entry may have been reused */
+    if (obj->index != 0 && obj->index <= table->num_entries) {
+        *entry = tok_obj_entry(tokdata, obj->index);
+        if (!(*entry)->deleted && memcmp((*entry)->name, obj->name, 8) == 0)
+            return CKR_OK;
+    }
+
+    index = object_mgr_lookup_tok_obj(tokdata, obj->name, NULL);
+    if (index == 0) {
+        *entry = NULL;
+        TRACE_ERROR("%s\n", ock_err(ERR_OBJECT_HANDLE_INVALID));
+        return CKR_OBJECT_HANDLE_INVALID;
     }
 
+    obj->index = index;
+    *entry = tok_obj_entry(tokdata, index);
+
     return CKR_OK;
 }
 
@@ -1945,6 +3264,7 @@ retry:
     rc = reload_token_object(tokdata, obj);
     if (rc != CKR_OK)
         goto done;
+    obj_attr_index_update(obj);
 
     rc = object_ex_data_lock(obj, WRITE_LOCK);
     if (rc != CKR_OK)
@@ -1995,49 +3315,6 @@ done_no_xproc_unlock:
 }
 
 
-// I'd use the standard bsearch() routine but I want an index, not a pointer.
-// Converting the pointer to an index might cause problems when switching
-// to a 64-bit environment...
-//
-CK_RV object_mgr_search_shm_for_obj(TOK_OBJ_ENTRY *obj_list,
-                                    CK_ULONG lo,
-                                    CK_ULONG hi, OBJECT *obj, CK_ULONG *index)
-{
-// SAB  XXX reduce the search time since this is what seems to be burning cycles
-    CK_ULONG idx;
-
-    UNUSED(lo);
-
-    if (obj->index == 0) {
-        for (idx = 0; idx <= hi; idx++) {
-            if (memcmp(obj->name, obj_list[idx].name, 8) == 0) {
-                *index = idx;
-                obj->index = idx;
-                return CKR_OK;
-            }
-        }
-    } else {
-        // SAB better double check
-        if (memcmp(obj->name, obj_list[obj->index].name, 8) == 0) {
-            *index = obj->index;
-            return CKR_OK;
-        } else {
-            // something is hosed.. go back to the brute force method
-            for (idx = 0; idx <= hi; idx++) {
-                if (memcmp(obj->name, obj_list[idx].name, 8) == 0) {
-                    *index = idx;
-                    obj->index = idx;
-                    return CKR_OK;
-                }
-            }
-        }
-    }
-
-    TRACE_ERROR("%s\n", ock_err(ERR_OBJECT_HANDLE_INVALID));
-
-    return CKR_OBJECT_HANDLE_INVALID;
-}
-
 // this routine scans the local token object lists and updates any objects that
 // have changed. it also adds any new token objects that have been added by
 // other processes and deletes any objects that have been deleted by other
@@ -2051,172 +3328,246 @@ CK_RV object_mgr_update_from_shm(STDLL_TokData_t *tokdata)
     return CKR_OK;
 }
 
-void delete_objs_from_btree_cb(STDLL_TokData_t *tokdata, void *node,
-                               unsigned long obj_handle, void *p3)
+// returns TRUE if the token object lists in the shared memory segment have
+// changed since the last object_mgr_update_from_shm() of this process. can be
+// called without holding the XProcLock
+//
+CK_BBOOL object_mgr_shm_changed(STDLL_TokData_t *tokdata)
 {
-    struct update_tok_obj_args *ua = (struct update_tok_obj_args *) p3;
-    TOK_OBJ_ENTRY *shm_te = NULL;
-    OBJECT *obj = (OBJECT *) node;
-    CK_ULONG index;
-
-    UNUSED(tokdata);
+    LW_SHM_TYPE *shm = tokdata->global_shm;
 
-    /* for each TOK_OBJ_ENTRY in the SHM list */
-    for (index = 0; index < *(ua->num_entries); index++) {
-        shm_te = &(ua->entries[index]);
+    if (!tokdata->publ_tok_obj_synced ||
+        __atomic_load_n(&shm->publ_tok_log.generation, __ATOMIC_ACQUIRE) !=
+                                        tokdata->publ_tok_obj_generation)
+        return TRUE;
 
-        /* found it, return */
-        if (!memcmp(obj->name, shm_te->name, 8)) {
-            return;
-        }
-    }
+    if (!tokdata->priv_tok_obj_synced ||
+        __atomic_load_n(&shm->priv_tok_log.generation, __ATOMIC_ACQUIRE) !=
+                                        tokdata->priv_tok_obj_generation)
+        return session_mgr_user_session_exists(tokdata);
 
-    /* didn't find it in SHM, delete it from its btree and the object map */
-    bt_node_free(&tokdata->object_map_btree, obj->map_handle, TRUE);
-    bt_node_free(ua->t, obj_handle, TRUE);
+    return FALSE;
 }
 
-void find_by_name_cb(STDLL_TokData_t *tokdata, void *node,
-                     unsigned long obj_handle, void *p3)
+void delete_objs_from_btree_cb(STDLL_TokData_t *tokdata, void *node,
+                               unsigned long obj_handle, void *p3)
 {
+    struct update_tok_obj_args *ua = (struct update_tok_obj_args *) p3;
     OBJECT *obj = (OBJECT *) node;
-    struct find_by_name_args *fa = (struct find_by_name_args *) p3;
-
-    UNUSED(tokdata);
-    UNUSED(obj_handle);
 
-    if (fa->done)
+    /* found it in SHM, keep it */
+    if (tok_obj_name_index_find(ua->shm_names, obj->name) != 0)
         return;
 
-    if (!memcmp(obj->name, fa->name, 8)) {
-        fa->done = TRUE;
-    }
+    /* didn't find it in SHM, delete it from its btree and the object map */
+    object_mgr_del_from_map(tokdata, obj);
+    object_mgr_free_tok_obj(tokdata, ua->t, obj_handle, obj, TRUE);
 }
 
-CK_RV object_mgr_update_publ_tok_obj_from_shm(STDLL_TokData_t *tokdata)
+// loads the token object with the specified name that has been added by
+// another process into token object btree @t
+//
+static CK_RV object_mgr_load_tok_obj_from_shm(STDLL_TokData_t *tokdata,
+                                              struct btree *t,
+                                              const char *name)
 {
-    struct update_tok_obj_args ua;
-    struct find_by_name_args fa;
-    TOK_OBJ_ENTRY *shm_te = NULL;
-    CK_ULONG index;
     OBJECT *new_obj;
     CK_RV rc;
 
-    ua.entries = tokdata->global_shm->publ_tok_objs;
-    ua.num_entries = &(tokdata->global_shm->num_publ_tok_obj);
-    ua.t = &tokdata->publ_token_obj_btree;
+    new_obj = (OBJECT *) malloc(sizeof(OBJECT));
+    if (new_obj == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        return CKR_HOST_MEMORY;
+    }
+    memset(new_obj, 0x0, sizeof(OBJECT));
 
-    /* delete any objects not in SHM from the btree */
-    bt_for_each_node(tokdata, &tokdata->publ_token_obj_btree,
-                     delete_objs_from_btree_cb, &ua);
+    rc = object_init_lock(new_obj);
+    if (rc != CKR_OK) {
+        free(new_obj);
+        return rc;
+    }
 
-    /* for each item in SHM, add it to the btree if its not there */
-    for (index = 0; index < tokdata->global_shm->num_publ_tok_obj; index++) {
-        shm_te = &tokdata->global_shm->publ_tok_objs[index];
+    rc = object_init_ex_data_lock(new_obj);
+    if (rc != CKR_OK) {
+        object_destroy_lock(new_obj);
+        free(new_obj);
+        return rc;
+    }
 
-        fa.done = FALSE;
-        fa.name = shm_te->name;
+    memcpy(new_obj->name, name, 8);
+    rc = reload_token_object(tokdata, new_obj);
+    if (rc != CKR_OK) {
+        object_free(new_obj);
+        return rc;
+    }
 
-        /* find an object from SHM in the btree */
-        bt_for_each_node(tokdata, &tokdata->publ_token_obj_btree,
-                         find_by_name_cb, &fa);
+    if (object_mgr_add_tok_obj(tokdata, t, new_obj) == 0) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        object_free(new_obj);
+        return CKR_HOST_MEMORY;
+    }
 
-        /* we didn't find it in the btree, so add it */
-        if (fa.done == FALSE) {
-            new_obj = (OBJECT *) malloc(sizeof(OBJECT));
-            if (new_obj == NULL)
-                return CKR_HOST_MEMORY;
-            memset(new_obj, 0x0, sizeof(OBJECT));
+    return CKR_OK;
+}
 
-            rc = object_init_lock(new_obj);
-            if (rc != CKR_OK) {
-                free(new_obj);
-                continue;
-            }
+// removes the token object with the specified name that has been deleted by
+// another process from token object btree @t
+//
+static void object_mgr_unload_tok_obj(STDLL_TokData_t *tokdata,
+                                      struct btree *t, const char *name)
+{
+    unsigned long obj_handle;
+    OBJECT *obj;
 
-            rc = object_init_ex_data_lock(new_obj);
-            if (rc != CKR_OK) {
-                object_destroy_lock(new_obj);
-                free(new_obj);
-                continue;
-            }
+    obj_handle = tok_obj_name_index_find(object_mgr_tok_obj_index(tokdata, t),
+                                         name);
+    if (obj_handle == 0)
+        return;
 
-            memcpy(new_obj->name, shm_te->name, 8);
-            rc = reload_token_object(tokdata, new_obj);
-            if (rc == CKR_OK)
-                bt_node_add(&tokdata->publ_token_obj_btree, new_obj);
-            else
-                object_free(new_obj);
-        }
-    }
+    obj = bt_get_node_value(t, obj_handle);
+    if (obj == NULL)
+        return;
 
-    return CKR_OK;
+    object_mgr_del_from_map(tokdata, obj);
+    bt_put_node_value(t, obj);
+    object_mgr_free_tok_obj(tokdata, t, obj_handle, obj, TRUE);
 }
 
-CK_RV object_mgr_update_priv_tok_obj_from_shm(STDLL_TokData_t *tokdata)
+// full resync of a token object btree against the SHM table: O(n) in the
+// number of objects, used when the change log does not cover all changes
+// since the last sync
+//
+static CK_RV object_mgr_resync_tok_objs_from_shm(STDLL_TokData_t *tokdata,
+                                                 CK_BBOOL priv,
+                                                 struct btree *t)
 {
+    struct tok_obj_name_index shm_names;
     struct update_tok_obj_args ua;
-    struct find_by_name_args fa;
-    TOK_OBJ_ENTRY *shm_te = NULL;
-    CK_ULONG index;
-    OBJECT *new_obj;
+    struct tok_obj_name_index *idx = object_mgr_tok_obj_index(tokdata, t);
+    TOK_OBJ_ENTRY *entry;
+    CK_ULONG_32 index;
     CK_RV rc;
 
-    // SAB XXX don't bother doing this call if we are not in the correct
-    // login state
-    if (!session_mgr_user_session_exists(tokdata))
-        return CKR_OK;
+    rc = object_mgr_map_tok_obj_segs(tokdata);
+    if (rc != CKR_OK)
+        return rc;
 
-    ua.entries = tokdata->global_shm->priv_tok_objs;
-    ua.num_entries = &(tokdata->global_shm->num_priv_tok_obj);
-    ua.t = &tokdata->priv_token_obj_btree;
+    rc = tok_obj_name_index_init(&shm_names);
+    if (rc != CKR_OK)
+        return rc;
+
+    /* for each item in SHM, add it to the btree if its not there */
+    for (index = 1; index <= tokdata->global_shm->tok_obj_table.num_entries;
+         index++) {
+        entry = tok_obj_entry(tokdata, index);
+        if (entry->deleted || entry->priv != priv)
+            continue;
+
+        rc = tok_obj_name_index_add(&shm_names, entry->name, index);
+        if (rc != CKR_OK)
+            goto done;
+
+        if (tok_obj_name_index_find(idx, entry->name) != 0)
+            continue;
+
+        rc = object_mgr_load_tok_obj_from_shm(tokdata, t, entry->name);
+        if (rc == CKR_HOST_MEMORY)
+            goto done;
+    }
 
     /* delete any objects not in SHM from the btree */
-    bt_for_each_node(tokdata, &tokdata->priv_token_obj_btree, delete_objs_from_btree_cb,
-                     &ua);
+    ua.shm_names = &shm_names;
+    ua.t = t;
+    bt_for_each_node(tokdata, t, delete_objs_from_btree_cb, &ua);
+    rc = CKR_OK;
 
-    /* for each item in SHM, add it to the btree if its not there */
-    for (index = 0; index < tokdata->global_shm->num_priv_tok_obj; index++) {
-        shm_te = &tokdata->global_shm->priv_tok_objs[index];
+done:
+    tok_obj_name_index_destroy(&shm_names);
 
-        fa.done = FALSE;
-        fa.name = shm_te->name;
+    return rc;
+}
 
-        /* find an object from SHM in the btree */
-        bt_for_each_node(tokdata, &tokdata->priv_token_obj_btree, find_by_name_cb, &fa);
+// brings a token object btree in sync with the SHM list by replaying the
+// changes recorded since the last sync, or with a full resync if the change
+// log has wrapped in between. the caller must hold the XProcLock
+//
+static CK_RV object_mgr_sync_tok_objs_from_shm(STDLL_TokData_t *tokdata,
+                                               CK_BBOOL priv)
+{
+    LW_SHM_TYPE *shm = tokdata->global_shm;
+    TOK_OBJ_CHANGE_LOG *log;
+    TOK_OBJ_CHANGE *change;
+    CK_ULONG_32 *synced_gen, generation, gen;
+    CK_BBOOL *synced;
+    struct btree *t;
+    CK_RV rc = CKR_OK;
 
-        /* we didn't find it in the btree, so add it */
-        if (fa.done == FALSE) {
-            new_obj = (OBJECT *) malloc(sizeof(OBJECT));
-            if (new_obj == NULL)
-                return CKR_HOST_MEMORY;
-            memset(new_obj, 0x0, sizeof(OBJECT));
+    if (priv) {
+        log = &shm->priv_tok_log;
+        synced_gen = &tokdata->priv_tok_obj_generation;
+        synced = &tokdata->priv_tok_obj_synced;
+        t = &tokdata->priv_token_obj_btree;
+    } else {
+        log = &shm->publ_tok_log;
+        synced_gen = &tokdata->publ_tok_obj_generation;
+        synced = &tokdata->publ_tok_obj_synced;
+        t = &tokdata->publ_token_obj_btree;
+    }
 
-            rc = object_init_lock(new_obj);
-            if (rc != CKR_OK) {
-                free(new_obj);
-                continue;
-            }
+    generation = __atomic_load_n(&log->generation, __ATOMIC_ACQUIRE);
+    if (*synced && generation == *synced_gen)
+        return CKR_OK;
 
-            rc = object_init_ex_data_lock(new_obj);
-            if (rc != CKR_OK) {
-                object_destroy_lock(new_obj);
-                free(new_obj);
-                continue;
+    if (*synced && generation - *synced_gen <= TOK_OBJ_CHANGE_LOG_SIZE) {
+        for (gen = *synced_gen + 1; gen != generation + 1; gen++) {
+            change = &log->changes[gen & (TOK_OBJ_CHANGE_LOG_SIZE - 1)];
+            if (change->generation != gen)
+                goto resync;
+
+            if (change->deleted) {
+                object_mgr_unload_tok_obj(tokdata, t, change->name);
+            } else if (tok_obj_name_index_find(object_mgr_tok_obj_index(
+                                                   tokdata, t),
+                                               change->name) == 0) {
+                /* a later deletion may have removed the file again */
+                rc = object_mgr_load_tok_obj_from_shm(tokdata, t,
+                                                      change->name);
+                if (rc == CKR_HOST_MEMORY)
+                    goto resync;
             }
-
-            memcpy(new_obj->name, shm_te->name, 8);
-            rc = reload_token_object(tokdata, new_obj);
-            if (rc == CKR_OK)
-                bt_node_add(&tokdata->priv_token_obj_btree, new_obj);
-            else
-                object_free(new_obj);
         }
+        goto done;
+    }
+
+resync:
+    rc = object_mgr_resync_tok_objs_from_shm(tokdata, priv, t);
+    if (rc != CKR_OK) {
+        *synced = FALSE;
+        return rc;
     }
 
+done:
+    *synced_gen = generation;
+    *synced = TRUE;
+
     return CKR_OK;
 }
 
+CK_RV object_mgr_update_publ_tok_obj_from_shm(STDLL_TokData_t *tokdata)
+{
+    return object_mgr_sync_tok_objs_from_shm(tokdata, FALSE);
+}
+
+CK_RV object_mgr_update_priv_tok_obj_from_shm(STDLL_TokData_t *tokdata)
+{
+    // SAB XXX don't bother doing this call if we are not in the correct
+    // login state
+    if (!session_mgr_user_session_exists(tokdata))
+        return CKR_OK;
+
+    return object_mgr_sync_tok_objs_from_shm(tokdata, TRUE);
+}
+
 // SAB FIXME FIXME
 
 void purge_map_by_type_cb(STDLL_TokData_t *tokdata, void *node,
@@ -2280,17 +3631,20 @@ CK_RV object_put(STDLL_TokData_t *tokdata, OBJECT *obj, CK_BBOOL unlock)
 }
 
 #ifdef DEBUG
-void dump_shm(LW_SHM_TYPE *global_shm, const char *s)
+void dump_shm(STDLL_TokData_t *tokdata, const char *s)
 {
-    CK_ULONG i;
-    TRACE_DEBUG("%s: dump_shm priv:\n", s);
+    TOK_OBJ_ENTRY *entry;
+    CK_ULONG_32 i;
 
-    for (i = 0; i < global_shm->num_priv_tok_obj; i++) {
-        TRACE_DEBUG("[%lu]: %.8s\n", i, global_shm->priv_tok_objs[i].name);
-    }
-    TRACE_DEBUG("%s: dump_shm publ:\n", s);
-    for (i = 0; i < global_shm->num_publ_tok_obj; i++) {
-        TRACE_DEBUG("[%lu]: %.8s\n", i, global_shm->publ_tok_objs[i].name);
+    if (object_mgr_map_tok_obj_segs(tokdata) != CKR_OK)
+        return;
+
+    TRACE_DEBUG("%s: dump_shm:\n", s);
+    for (i = 1; i <= tokdata->global_shm->tok_obj_table.num_entries; i++) {
+        entry = tok_obj_entry(tokdata, i);
+        if (!entry->deleted)
+            TRACE_DEBUG("[%u]: %.8s %s\n", (unsigned int)i, entry->name,
+                        entry->priv ? "priv" : "publ");
     }
 }
 #endif
@@ -2551,8 +3905,22 @@ struct iterate_obj_data {
     const char *msg;
     CK_BBOOL syslog;
     CK_RV error;
+    unsigned long num_workers;
+    unsigned long processed;
 };
 
+struct iterate_obj_worker {
+    STDLL_TokData_t *tokdata;
+    struct btree *t;
+    struct iterate_obj_data *iod;
+    unsigned long next_node;
+#if OPENSSL_VERSION_PREREQ(3, 0)
+    OSSL_LIB_CTX *libctx;
+#endif
+};
+
+#define OBJ_MGR_ITERATE_MAX_WORKERS     64
+
 static void obj_mgr_iterate_key_objects_cb(STDLL_TokData_t *tokdata, void *p1,
                                            unsigned long p2, void *p3)
 {
@@ -2563,7 +3931,8 @@ static void obj_mgr_iterate_key_objects_cb(STDLL_TokData_t *tokdata, void *p1,
 
     UNUSED(p2);
 
-    if (iod->error != CKR_OK) /* Skip if previous reported an error */
+    /* Skip if previous reported an error */
+    if (__atomic_load_n(&iod->error, __ATOMIC_RELAXED) != CKR_OK)
         return;
 
     rc = object_lock(obj, WRITE_LOCK);
@@ -2580,7 +3949,7 @@ static void obj_mgr_iterate_key_objects_cb(STDLL_TokData_t *tokdata, void *p1,
         if (iod->syslog)
             OCK_SYSLOG(LOG_ERR, "Slot %lu: Failed to get object class: 0x%lx\n",
                        tokdata->slot_id, rc);
-        iod->error = rc;
+        __sync_bool_compare_and_swap(&iod->error, CKR_OK, rc);
         goto out;
     }
 
@@ -2629,14 +3998,126 @@ static void obj_mgr_iterate_key_objects_cb(STDLL_TokData_t *tokdata, void *p1,
                            "Slot %lu: Failed to %s token object '%s': 0x%lx\n",
                            tokdata->slot_id, iod->msg, obj->name, rc);
         }
-        iod->error = rc;
+        __sync_bool_compare_and_swap(&iod->error, CKR_OK, rc);
         goto out;
     }
 
+    __sync_add_and_fetch(&iod->processed, 1);
+
 out:
     object_unlock(obj);
 }
 
+static void *obj_mgr_iterate_key_objects_worker(void *arg)
+{
+    struct iterate_obj_worker *w = arg;
+    unsigned long node;
+    void *value;
+#if OPENSSL_VERSION_PREREQ(3, 0)
+    OSSL_LIB_CTX *prev_libctx;
+
+    /* Use the same OpenSSL library context as the thread changing the MK */
+    prev_libctx = OSSL_LIB_CTX_set0_default(w->libctx);
+#endif
+
+    while (__atomic_load_n(&w->iod->error, __ATOMIC_RELAXED) == CKR_OK) {
+        node = __sync_add_and_fetch(&w->next_node, 1);
+        if (node > __atomic_load_n(&w->t->size, __ATOMIC_ACQUIRE))
+            break;
+
+        /* See bt_for_each_node() why the node value is obtained */
+        value = bt_get_node_value(w->t, node);
+        if (value == NULL)
+            continue;
+
+        obj_mgr_iterate_key_objects_cb(w->tokdata, value, node, w->iod);
+
+        bt_put_node_value(w->t, value);
+    }
+
+#if OPENSSL_VERSION_PREREQ(3, 0)
+    OSSL_LIB_CTX_set0_default(prev_libctx);
+#endif
+
+    return NULL;
+}
+
+/*
+ * Calls obj_mgr_iterate_key_objects_cb for all objects of a btree. Token
+ * objects are distributed over iod->num_workers threads, each processing the
+ * next unprocessed node, so that the round trips to the adapters and the
+ * saves of the objects of different threads overlap. The calling thread is
+ * one of the workers.
+ */
+static void obj_mgr_iterate_key_objects_btree(STDLL_TokData_t *tokdata,
+                                              struct btree *t,
+                                              struct iterate_obj_data *iod)
+{
+    struct iterate_obj_worker w;
+    pthread_t threads[OBJ_MGR_ITERATE_MAX_WORKERS - 1];
+    unsigned long i, num_threads = 0;
+    sigset_t set, oldset;
+
+    if (iod->num_workers <= 1) {
+        bt_for_each_node(tokdata, t, obj_mgr_iterate_key_objects_cb, iod);
+        return;
+    }
+
+    w.tokdata = tokdata;
+    w.t = t;
+    w.iod = iod;
+    w.next_node = 0;
+#if OPENSSL_VERSION_PREREQ(3, 0)
+    w.libctx = OSSL_LIB_CTX_set0_default(NULL);
+#endif
+
+    /* The workers must not receive any of the process's signals */
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &oldset);
+    for (i = 1; i < iod->num_workers && i < t->size; i++) {
+        if (pthread_create(&threads[num_threads], NULL,
+                           obj_mgr_iterate_key_objects_worker, &w) != 0) {
+            TRACE_WARNING("Failed to start worker thread, continue with %lu\n",
+                          num_threads + 1);
+            break;
+        }
+        num_threads++;
+    }
+    pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+    obj_mgr_iterate_key_objects_worker(&w);
+
+    for (i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+}
+
+// Number of threads that process token objects during a HSM master key
+// change, taken from the environment variable OPENCRYPTOKI_MK_CHANGE_WORKERS.
+// The callbacks of obj_mgr_iterate_key_objects() must be thread safe.
+//
+static unsigned long obj_mgr_mk_change_workers(void)
+{
+    const char *opt;
+    char *end;
+    long workers;
+
+    opt = getenv("OPENCRYPTOKI_MK_CHANGE_WORKERS");
+    if (opt == NULL)
+        return 1;
+
+    errno = 0;
+    workers = strtol(opt, &end, 10);
+    if (errno != 0 || end == opt || *end != '\0' || workers < 1 ||
+        workers > OBJ_MGR_ITERATE_MAX_WORKERS) {
+        OCK_SYSLOG(LOG_WARNING, "OPENCRYPTOKI_MK_CHANGE_WORKERS '%s' is "
+                   "invalid. Token objects are processed by one thread.\n",
+                   opt);
+        return 1;
+    }
+
+    return workers;
+}
+
 CK_RV obj_mgr_iterate_key_objects(STDLL_TokData_t *tokdata,
                                   CK_BBOOL session_objects,
                                   CK_BBOOL token_objects,
@@ -2650,6 +4131,8 @@ CK_RV obj_mgr_iterate_key_objects(STDLL_TokData_t *tokdata,
                                   const char *msg)
 {
     struct iterate_obj_data iod;
+    struct timespec start, end;
+    unsigned long msecs;
     CK_RV rc;
 
     iod.filter = filter;
@@ -2659,6 +4142,8 @@ CK_RV obj_mgr_iterate_key_objects(STDLL_TokData_t *tokdata,
     iod.syslog = syslog;
     iod.msg = msg;
     iod.error = CKR_OK;
+    iod.num_workers = 1;
+    iod.processed = 0;
 
     if (session_objects) {
         /* Session objects */
@@ -2698,9 +4183,13 @@ CK_RV obj_mgr_iterate_key_objects(STDLL_TokData_t *tokdata,
             return rc;
         }
 
+        iod.num_workers = obj_mgr_mk_change_workers();
+        iod.processed = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
         /* Public token objects */
-        bt_for_each_node(tokdata, &tokdata->publ_token_obj_btree,
-                         obj_mgr_iterate_key_objects_cb, &iod);
+        obj_mgr_iterate_key_objects_btree(tokdata,
+                                          &tokdata->publ_token_obj_btree, &iod);
         if (iod.error != CKR_OK) {
             TRACE_ERROR("%s failed to %s public token objects: 0x%lx\n",
                         __func__, msg, iod.error);
@@ -2712,8 +4201,8 @@ CK_RV obj_mgr_iterate_key_objects(STDLL_TokData_t *tokdata,
         }
 
         /* Private token objects */
-        bt_for_each_node(tokdata, &tokdata->priv_token_obj_btree,
-                         obj_mgr_iterate_key_objects_cb, &iod);
+        obj_mgr_iterate_key_objects_btree(tokdata,
+                                          &tokdata->priv_token_obj_btree, &iod);
         if (iod.error != CKR_OK) {
             TRACE_ERROR("%s failed to %s private token objects: 0x%lx\n",
                         __func__, msg, iod.error);
@@ -2723,6 +4212,19 @@ CK_RV obj_mgr_iterate_key_objects(STDLL_TokData_t *tokdata,
                            iod.error);
             return iod.error;
         }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        msecs = (end.tv_sec - start.tv_sec) * 1000 +
+                (end.tv_nsec - start.tv_nsec) / 1000000;
+        TRACE_INFO("%s %s %lu token key objects in %lu ms with %lu threads\n",
+                   __func__, msg, iod.processed, msecs, iod.num_workers);
+        if (syslog)
+            OCK_SYSLOG(LOG_INFO, "Slot %lu: %s %lu token key objects in "
+                       "%lu.%03lu seconds (%lu objects per second)\n",
+                       tokdata->slot_id, msg, iod.processed, msecs / 1000,
+                       msecs % 1000,
+                       msecs > 0 ? iod.processed * 1000 / msecs :
+                                   iod.processed);
     }
 
     return CKR_OK;
@@ -273,33 +273,30 @@ error:
 }
 
 
-// object_flatten() - this is still used when saving token objects
+// object_get_flattened_size() - size of the flattened form of an object
 //
-CK_RV object_flatten(OBJECT * obj, CK_BYTE ** data, CK_ULONG * len)
+CK_ULONG object_get_flattened_size(OBJECT *obj)
+{
+    return template_get_compressed_size(obj->template) +
+           sizeof(CK_OBJECT_CLASS_32) + sizeof(CK_ULONG_32) + 8;
+}
+
+
+// object_flatten_into() - flattens an object into a caller supplied buffer
+// of object_get_flattened_size() bytes, e.g. right behind the header of the
+// token object it is stored in
+//
+CK_RV object_flatten_into(OBJECT *obj, CK_BYTE *buf)
 {
-    CK_BYTE *buf = NULL;
-    CK_ULONG tmpl_len, total_len;
     CK_ULONG offset;
     CK_ULONG_32 count;
     CK_OBJECT_CLASS_32 class32;
-    long rc;
 
-    if (!obj) {
+    if (!obj || !buf) {
         TRACE_ERROR("Invalid function arguments.\n");
         return CKR_FUNCTION_FAILED;
     }
     count = template_get_count(obj->template);
-    tmpl_len = template_get_compressed_size(obj->template);
-
-    total_len = tmpl_len + sizeof(CK_OBJECT_CLASS_32) + sizeof(CK_ULONG_32) + 8;
-
-    buf = (CK_BYTE *) malloc(total_len);
-    if (!buf) {                 // SAB  XXX FIXME  This was DATA
-        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-        return CKR_HOST_MEMORY;
-    }
-
-    memset((CK_BYTE *) buf, 0x0, total_len);
 
     offset = 0;
 
@@ -312,7 +309,34 @@ CK_RV object_flatten(OBJECT * obj, CK_BYTE ** data, CK_ULONG * len)
 
     memcpy(buf + offset, &obj->name, sizeof(CK_BYTE) * 8);
     offset += 8;
-    rc = template_flatten(obj->template, buf + offset);
+
+    return template_flatten(obj->template, buf + offset);
+}
+
+
+// object_flatten() - this is still used when saving token objects
+//
+CK_RV object_flatten(OBJECT * obj, CK_BYTE ** data, CK_ULONG * len)
+{
+    CK_BYTE *buf = NULL;
+    CK_ULONG total_len;
+    long rc;
+
+    if (!obj) {
+        TRACE_ERROR("Invalid function arguments.\n");
+        return CKR_FUNCTION_FAILED;
+    }
+    total_len = object_get_flattened_size(obj);
+
+    buf = (CK_BYTE *) malloc(total_len);
+    if (!buf) {                 // SAB  XXX FIXME  This was DATA
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        return CKR_HOST_MEMORY;
+    }
+
+    memset((CK_BYTE *) buf, 0x0, total_len);
+
+    rc = object_flatten_into(obj, buf);
     if (rc != CKR_OK) {
         free(buf);
         return rc;
@@ -739,6 +763,14 @@ CK_RV object_restore_withSize(struct policy *policy,
 
     memset(obj, 0x0, sizeof(OBJECT));
 
+    if (data_size >= 0 &&
+        (CK_ULONG)data_size < sizeof(CK_OBJECT_CLASS_32) +
+                                sizeof(CK_ULONG_32) + 8) {
+        TRACE_ERROR("Flattened object is too short.\n");
+        rc = CKR_FUNCTION_FAILED;
+        goto error;
+    }
+
     memcpy(&class32, data + offset, sizeof(CK_OBJECT_CLASS_32));
     obj->class = class32;
     offset += sizeof(CK_OBJECT_CLASS_32);
@@ -773,7 +805,9 @@ CK_RV object_restore_withSize(struct policy *policy,
         }
     }
 
-    rc = template_unflatten_withSize(&tmpl, data + offset, count, data_size);
+    rc = template_unflatten_withSize(&tmpl, data + offset, count,
+                                     data_size >= 0 ?
+                                            data_size - (int)offset : -1);
     if (rc != CKR_OK) {
         TRACE_DEVEL("template_unflatten_withSize failed.\n");
         goto error;
@@ -789,6 +823,7 @@ CK_RV object_restore_withSize(struct policy *policy,
                                       tmpl, NULL, NULL);
     }
 
+    template_update_key_desc(tmpl);
     obj->template = tmpl;
     tmpl = NULL;
 
@@ -256,6 +256,161 @@ CK_BBOOL session_mgr_readonly_session_exists(STDLL_TokData_t *tokdata)
 }
 
 
+/*
+ * The contexts and temporary buffers of the encrypt, decrypt, sign and verify
+ * operations of a session are carved from an arena per operation, so that a
+ * typical operation does not call malloc at all. Everything carved from an
+ * arena is cleansed and handed back at once when the operation is cleaned
+ * up. Requests that do not fit, or that are made for a context that does not
+ * belong to the session (like the local contexts used for key wrapping), are
+ * served from the heap.
+ */
+#define OP_ARENA_ALIGN(len)     (((len) + 15) & ~((CK_ULONG)15))
+
+static OP_ARENA *session_mgr_op_arena(SESSION *sess, void *op_ctx,
+                                      CK_ULONG *size)
+{
+    if (sess == NULL || op_ctx == NULL)
+        return NULL;
+
+    if (op_ctx == &sess->encr_ctx) {
+        *size = OP_ARENA_ENCR_DECR_SIZE;
+        return &sess->encr_arena;
+    }
+    if (op_ctx == &sess->decr_ctx) {
+        *size = OP_ARENA_ENCR_DECR_SIZE;
+        return &sess->decr_arena;
+    }
+    if (op_ctx == &sess->sign_ctx) {
+        *size = OP_ARENA_SIGN_VERIFY_SIZE;
+        return &sess->sign_arena;
+    }
+    if (op_ctx == &sess->verify_ctx) {
+        *size = OP_ARENA_SIGN_VERIFY_SIZE;
+        return &sess->verify_arena;
+    }
+
+    return NULL;
+}
+
+static OP_ARENA *session_mgr_op_arena_of(SESSION *sess, CK_BYTE *ptr)
+{
+    OP_ARENA *arenas[4];
+    unsigned int i;
+
+    if (sess == NULL)
+        return NULL;
+
+    arenas[0] = &sess->encr_arena;
+    arenas[1] = &sess->decr_arena;
+    arenas[2] = &sess->sign_arena;
+    arenas[3] = &sess->verify_arena;
+
+    for (i = 0; i < 4; i++) {
+        if (arenas[i]->base != NULL && ptr >= arenas[i]->base &&
+            ptr < arenas[i]->base + arenas[i]->size)
+            return arenas[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * Allocates len bytes for the operation of op_ctx. The memory must be
+ * released with session_mgr_op_free(), not with free().
+ */
+CK_BYTE *session_mgr_op_alloc(SESSION *sess, void *op_ctx, CK_ULONG len)
+{
+    OP_ARENA *arena;
+    CK_ULONG size = 0, alen = OP_ARENA_ALIGN(len);
+    CK_BYTE *ptr;
+
+    arena = session_mgr_op_arena(sess, op_ctx, &size);
+    if (arena != NULL && len > 0 && alen <= size) {
+        if (arena->base == NULL) {
+            arena->base = (CK_BYTE *) malloc(size);
+            if (arena->base != NULL) {
+                arena->size = size;
+                arena->used = 0;
+            }
+        }
+
+        if (arena->base != NULL && alen <= arena->size - arena->used) {
+            ptr = arena->base + arena->used;
+            arena->used += alen;
+            return ptr;
+        }
+    }
+
+    return (CK_BYTE *) malloc(len);
+}
+
+/*
+ * Releases memory obtained from session_mgr_op_alloc(). len is the length
+ * that was requested, or 0 if it is not known. Arena memory is cleansed and
+ * reused right away if it is the most recent allocation, otherwise when the
+ * operation is reset. Heap memory is cleansed (if len is known) and freed.
+ */
+void session_mgr_op_free(SESSION *sess, CK_BYTE *ptr, CK_ULONG len)
+{
+    OP_ARENA *arena;
+    CK_ULONG alen = OP_ARENA_ALIGN(len);
+
+    if (ptr == NULL)
+        return;
+
+    arena = session_mgr_op_arena_of(sess, ptr);
+    if (arena == NULL) {
+        if (len > 0)
+            OPENSSL_cleanse(ptr, len);
+        free(ptr);
+        return;
+    }
+
+    if (len > 0 && alen <= arena->used &&
+        ptr == arena->base + arena->used - alen) {
+        OPENSSL_cleanse(ptr, alen);
+        arena->used -= alen;
+    }
+}
+
+/*
+ * Cleanses and rewinds the arena of the operation of op_ctx. Called when
+ * the operation is cleaned up, after its context has been released.
+ */
+void session_mgr_op_reset(SESSION *sess, void *op_ctx)
+{
+    OP_ARENA *arena;
+    CK_ULONG size;
+
+    arena = session_mgr_op_arena(sess, op_ctx, &size);
+    if (arena == NULL || arena->used == 0)
+        return;
+
+    OPENSSL_cleanse(arena->base, arena->used);
+    arena->used = 0;
+}
+
+static void session_mgr_op_arena_free(OP_ARENA *arena)
+{
+    if (arena->base == NULL)
+        return;
+
+    OPENSSL_cleanse(arena->base, arena->used);
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+static void session_mgr_op_arenas_free(SESSION *sess)
+{
+    session_mgr_op_arena_free(&sess->encr_arena);
+    session_mgr_op_arena_free(&sess->decr_arena);
+    session_mgr_op_arena_free(&sess->sign_arena);
+    session_mgr_op_arena_free(&sess->verify_arena);
+}
+
 // session_mgr_close_session()
 //
 // removes the specified session from the process' session list
@@ -303,7 +458,7 @@ CK_RV session_mgr_close_session(STDLL_TokData_t *tokdata,
                                              sess->encr_ctx.context,
                                              sess->encr_ctx.context_len);
         else
-            free(sess->encr_ctx.context);
+            session_mgr_op_free(sess, sess->encr_ctx.context, 0);
     }
 
     if (sess->encr_ctx.mech.pParameter)
@@ -315,7 +470,7 @@ CK_RV session_mgr_close_session(STDLL_TokData_t *tokdata,
                                              sess->decr_ctx.context,
                                              sess->decr_ctx.context_len);
         else
-            free(sess->decr_ctx.context);
+            session_mgr_op_free(sess, sess->decr_ctx.context, 0);
     }
 
     if (sess->decr_ctx.mech.pParameter)
@@ -339,7 +494,7 @@ CK_RV session_mgr_close_session(STDLL_TokData_t *tokdata,
                                              sess->sign_ctx.context,
                                              sess->sign_ctx.context_len);
         else
-            free(sess->sign_ctx.context);
+            session_mgr_op_free(sess, sess->sign_ctx.context, 0);
     }
 
     if (sess->sign_ctx.mech.pParameter)
@@ -351,12 +506,14 @@ CK_RV session_mgr_close_session(STDLL_TokData_t *tokdata,
                                                sess->verify_ctx.context,
                                                sess->verify_ctx.context_len);
         else
-            free(sess->verify_ctx.context);
+            session_mgr_op_free(sess, sess->verify_ctx.context, 0);
     }
 
     if (sess->verify_ctx.mech.pParameter)
         free(sess->verify_ctx.mech.pParameter);
 
+    session_mgr_op_arenas_free(sess);
+
     bt_put_node_value(&tokdata->sess_btree, sess);
     sess = NULL;
     bt_node_free(&tokdata->sess_btree, handle, TRUE);
@@ -411,7 +568,7 @@ void session_free(STDLL_TokData_t *tokdata, void *node_value,
                                              sess->encr_ctx.context,
                                              sess->encr_ctx.context_len);
         else
-            free(sess->encr_ctx.context);
+            session_mgr_op_free(sess, sess->encr_ctx.context, 0);
     }
 
     if (sess->encr_ctx.mech.pParameter)
@@ -423,7 +580,7 @@ void session_free(STDLL_TokData_t *tokdata, void *node_value,
                                              sess->decr_ctx.context,
                                              sess->decr_ctx.context_len);
         else
-            free(sess->decr_ctx.context);
+            session_mgr_op_free(sess, sess->decr_ctx.context, 0);
     }
 
     if (sess->decr_ctx.mech.pParameter)
@@ -447,7 +604,7 @@ void session_free(STDLL_TokData_t *tokdata, void *node_value,
                                              sess->sign_ctx.context,
                                              sess->sign_ctx.context_len);
         else
-            free(sess->sign_ctx.context);
+            session_mgr_op_free(sess, sess->sign_ctx.context, 0);
     }
 
     if (sess->sign_ctx.mech.pParameter)
@@ -459,12 +616,14 @@ void session_free(STDLL_TokData_t *tokdata, void *node_value,
                                                sess->verify_ctx.context,
                                                sess->verify_ctx.context_len);
         else
-            free(sess->verify_ctx.context);
+            session_mgr_op_free(sess, sess->verify_ctx.context, 0);
     }
 
     if (sess->verify_ctx.mech.pParameter)
         free(sess->verify_ctx.mech.pParameter);
 
+    session_mgr_op_arenas_free(sess);
+
     /* NB: any access to sess or @node_value after this returns will segfault */
     bt_node_free(&tokdata->sess_btree, node_idx, TRUE);
 }
@@ -31,6 +31,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <openssl/crypto.h>
 #include <openssl/rand.h>
 
 #include "pkcs11types.h"
@@ -244,30 +245,109 @@ CK_RV template_add_default_attributes(TEMPLATE *tmpl, TEMPLATE *basetmpl,
 }
 
 
+#define TEMPLATE_MIN_ATTRS    16
+
+/*
+ * Binary search for an attribute type in the sorted attribute array, starting
+ * at index 'start'. Returns TRUE if found. In any case, *pos is set to the
+ * index where the attribute is, or where it would have to be inserted.
+ */
+static CK_BBOOL template_attr_search(TEMPLATE *tmpl, CK_ATTRIBUTE_TYPE type,
+                                     CK_ULONG start, CK_ULONG *pos)
+{
+    CK_ULONG lo = start, hi = tmpl->num_attrs, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (tmpl->attrs[mid].type < type)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    *pos = lo;
+    return (lo < tmpl->num_attrs && tmpl->attrs[lo].type == type);
+}
+
+/* insert an attribute at the specified index of the sorted array */
+static CK_RV template_attr_insert(TEMPLATE *tmpl, CK_ULONG pos,
+                                  CK_ATTRIBUTE *attr)
+{
+    TEMPLATE_ATTR *attrs;
+    CK_ULONG max;
+
+    if (tmpl->num_attrs >= tmpl->max_attrs) {
+        max = tmpl->max_attrs > 0 ? tmpl->max_attrs * 2 : TEMPLATE_MIN_ATTRS;
+        attrs = realloc(tmpl->attrs, max * sizeof(TEMPLATE_ATTR));
+        if (attrs == NULL) {
+            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+            return CKR_HOST_MEMORY;
+        }
+        tmpl->attrs = attrs;
+        tmpl->max_attrs = max;
+    }
+
+    if (pos < tmpl->num_attrs)
+        memmove(&tmpl->attrs[pos + 1], &tmpl->attrs[pos],
+                (tmpl->num_attrs - pos) * sizeof(TEMPLATE_ATTR));
+
+    tmpl->attrs[pos].type = attr->type;
+    tmpl->attrs[pos].attr = attr;
+    tmpl->num_attrs++;
+    tmpl->key_desc.known = 0;
+
+    return CKR_OK;
+}
+
+/* attributes restored by template_unflatten() are not allocated one by one */
+static CK_BBOOL template_attr_in_slab(TEMPLATE *tmpl, CK_ATTRIBUTE *attr)
+{
+    return tmpl->slab != NULL && (CK_BYTE *)attr >= tmpl->slab &&
+           (CK_BYTE *)attr < tmpl->slab + tmpl->slab_len;
+}
+
+static void template_attr_free(TEMPLATE *tmpl, CK_ATTRIBUTE *attr)
+{
+    if (is_attribute_attr_array(attr->type)) {
+        cleanse_and_free_attribute_array2((CK_ATTRIBUTE_PTR)attr->pValue,
+                                          attr->ulValueLen /
+                                                    sizeof(CK_ATTRIBUTE),
+                                          FALSE);
+    }
+    if (!template_attr_in_slab(tmpl, attr))
+        free(attr);
+}
+
+/* free the attribute at the specified index and remove it from the array */
+static void template_attr_remove(TEMPLATE *tmpl, CK_ULONG pos)
+{
+    CK_ATTRIBUTE *attr = tmpl->attrs[pos].attr;
+
+    if (attr != NULL)
+        template_attr_free(tmpl, attr);
+
+    tmpl->num_attrs--;
+    if (pos < tmpl->num_attrs)
+        memmove(&tmpl->attrs[pos], &tmpl->attrs[pos + 1],
+                (tmpl->num_attrs - pos) * sizeof(TEMPLATE_ATTR));
+    tmpl->key_desc.known = 0;
+}
+
 /* template_attribute_find()
  *
- * find the attribute in the list and return its value
+ * find the attribute in the template and return its value
  */
 CK_BBOOL template_attribute_find(TEMPLATE *tmpl, CK_ATTRIBUTE_TYPE type,
                                  CK_ATTRIBUTE **attr)
 {
-    DL_NODE *node = NULL;
-    CK_ATTRIBUTE *a = NULL;
+    CK_ULONG pos;
 
     if (!tmpl || !attr)
         return FALSE;
 
-    node = tmpl->attribute_list;
-
-    while (node != NULL) {
-        a = (CK_ATTRIBUTE *) node->data;
-
-        if (type == a->type) {
-            *attr = a;
-            return TRUE;
-        }
-
-        node = node->next;
+    if (template_attr_search(tmpl, type, 0, &pos)) {
+        *attr = tmpl->attrs[pos].attr;
+        return TRUE;
     }
 
     *attr = NULL;
@@ -327,6 +407,126 @@ CK_RV template_attribute_get_bool(TEMPLATE *tmpl, CK_ATTRIBUTE_TYPE type,
     return CKR_OK;
 }
 
+static CK_ULONG key_desc_bit(CK_ATTRIBUTE_TYPE type)
+{
+    switch (type) {
+    case CKA_CLASS:
+        return KEY_DESC_CLASS;
+    case CKA_KEY_TYPE:
+        return KEY_DESC_KEY_TYPE;
+    case CKA_ENCRYPT:
+        return KEY_DESC_ENCRYPT;
+    case CKA_DECRYPT:
+        return KEY_DESC_DECRYPT;
+    case CKA_SIGN:
+        return KEY_DESC_SIGN;
+    case CKA_SIGN_RECOVER:
+        return KEY_DESC_SIGN_RECOVER;
+    case CKA_VERIFY:
+        return KEY_DESC_VERIFY;
+    case CKA_VERIFY_RECOVER:
+        return KEY_DESC_VERIFY_RECOVER;
+    case CKA_WRAP:
+        return KEY_DESC_WRAP;
+    case CKA_UNWRAP:
+        return KEY_DESC_UNWRAP;
+    case CKA_DERIVE:
+        return KEY_DESC_DERIVE;
+    case CKA_SENSITIVE:
+        return KEY_DESC_SENSITIVE;
+    case CKA_EXTRACTABLE:
+        return KEY_DESC_EXTRACTABLE;
+    case CKA_WRAP_WITH_TRUSTED:
+        return KEY_DESC_WRAP_WITH_TRUSTED;
+    case CKA_ALWAYS_AUTHENTICATE:
+        return KEY_DESC_ALWAYS_AUTHENTICATE;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Derive the key descriptor from the template. Called when an object is
+ * created, loaded or its attributes are set, with the object locked for
+ * writing. Attributes that are missing or invalid are not cached, so that
+ * the accessors return the same errors as the template_attribute_get_*()
+ * functions.
+ */
+void template_update_key_desc(TEMPLATE *tmpl)
+{
+    static const CK_ATTRIBUTE_TYPE bools[] = {
+        CKA_ENCRYPT, CKA_DECRYPT, CKA_SIGN, CKA_SIGN_RECOVER, CKA_VERIFY,
+        CKA_VERIFY_RECOVER, CKA_WRAP, CKA_UNWRAP, CKA_DERIVE, CKA_SENSITIVE,
+        CKA_EXTRACTABLE, CKA_WRAP_WITH_TRUSTED, CKA_ALWAYS_AUTHENTICATE,
+    };
+    KEY_DESC desc;
+    CK_BBOOL flag;
+    CK_ULONG i;
+
+    if (tmpl == NULL)
+        return;
+
+    memset(&desc, 0, sizeof(desc));
+
+    if (template_attribute_get_ulong(tmpl, CKA_CLASS, &desc.class) == CKR_OK)
+        desc.known |= KEY_DESC_CLASS;
+    if (template_attribute_get_ulong(tmpl, CKA_KEY_TYPE,
+                                     &desc.key_type) == CKR_OK)
+        desc.known |= KEY_DESC_KEY_TYPE;
+
+    for (i = 0; i < sizeof(bools) / sizeof(bools[0]); i++) {
+        if (template_attribute_get_bool(tmpl, bools[i], &flag) != CKR_OK ||
+            (flag != TRUE && flag != FALSE))
+            continue;
+        desc.known |= key_desc_bit(bools[i]);
+        if (flag == TRUE)
+            desc.flags |= key_desc_bit(bools[i]);
+    }
+
+    tmpl->key_desc = desc;
+}
+
+/*
+ * Same as template_attribute_get_ulong(), but served from the key
+ * descriptor for CKA_CLASS and CKA_KEY_TYPE.
+ */
+CK_RV template_key_desc_get_ulong(TEMPLATE *tmpl, CK_ATTRIBUTE_TYPE type,
+                                  CK_ULONG *value)
+{
+    CK_ULONG bit = key_desc_bit(type);
+
+    if (tmpl != NULL && (tmpl->key_desc.known & bit) != 0) {
+        if (bit == KEY_DESC_CLASS) {
+            *value = tmpl->key_desc.class;
+            return CKR_OK;
+        }
+        if (bit == KEY_DESC_KEY_TYPE) {
+            *value = tmpl->key_desc.key_type;
+            return CKR_OK;
+        }
+    }
+
+    return template_attribute_get_ulong(tmpl, type, value);
+}
+
+/*
+ * Same as template_attribute_get_bool(), but served from the key descriptor
+ * for the key usage and protection attributes.
+ */
+CK_RV template_key_desc_get_bool(TEMPLATE *tmpl, CK_ATTRIBUTE_TYPE type,
+                                 CK_BBOOL *value)
+{
+    CK_ULONG bit = key_desc_bit(type);
+
+    if (tmpl != NULL && bit != KEY_DESC_CLASS && bit != KEY_DESC_KEY_TYPE &&
+        (tmpl->key_desc.known & bit) != 0) {
+        *value = (tmpl->key_desc.flags & bit) ? TRUE : FALSE;
+        return CKR_OK;
+    }
+
+    return template_attribute_get_bool(tmpl, type, value);
+}
+
 /*
  * Find the attribute in the list and check that the value length is > 0  and
  * that it is non-empty.
@@ -514,28 +714,29 @@ CK_RV template_check_required_base_attributes(TEMPLATE *tmpl, CK_ULONG mode)
     return CKR_OK;
 }
 
-/* template_compare() */
+/* template_compare()
+ *
+ * Search templates are usually sorted by attribute type (or consist of a
+ * single attribute), so as long as the types in t1 are ascending, the search
+ * in t2 continues from where the previous attribute was found, which walks
+ * both arrays like a merge.
+ */
 CK_BBOOL template_compare(CK_ATTRIBUTE *t1, CK_ULONG ulCount, TEMPLATE *t2)
 {
-    CK_ATTRIBUTE *attr1 = NULL;
-    CK_ATTRIBUTE *attr2 = NULL;
-    CK_ULONG i;
-    CK_RV rc;
+    CK_ULONG i, pos = 0;
 
     if (!t1 || !t2)
         return FALSE;
 
-    attr1 = t1;
-
     for (i = 0; i < ulCount; i++) {
-        rc = template_attribute_find(t2, attr1->type, &attr2);
-        if (rc == FALSE)
-            return FALSE;
+        if (i > 0 && t1[i].type < t1[i - 1].type)
+            pos = 0;
 
-        if (!compare_attribute(attr1, attr2))
+        if (!template_attr_search(t2, t1[i].type, pos, &pos))
             return FALSE;
 
-        attr1++;
+        if (!compare_attribute(&t1[i], t2->attrs[pos].attr))
+            return FALSE;
     }
 
     return TRUE;
@@ -543,28 +744,23 @@ CK_BBOOL template_compare(CK_ATTRIBUTE *t1, CK_ULONG ulCount, TEMPLATE *t2)
 
 
 /* template_copy()
- *
- * This doesn't copy the template items verbatim.  The new template is in
- * the reverse order of the old one.  This should not have any effect.
  *
  * This is very similar to template_merge().  template_merge() can also
- * be used to copy a list (of unique attributes) but is slower because for
- * each attribute, it must search through the list.
+ * be used to copy a template, but destroys the source template.
  */
 CK_RV template_copy(TEMPLATE *dest, TEMPLATE *src)
 {
     char unique_id_str[2 * UNIQUE_ID_LEN + 1];
-    DL_NODE *node, *list;
+    CK_ULONG i;
     CK_RV rc;
 
     if (!dest || !src) {
         TRACE_ERROR("Invalid function arguments.\n");
         return CKR_FUNCTION_FAILED;
     }
-    node = src->attribute_list;
 
-    while (node) {
-        CK_ATTRIBUTE *attr = (CK_ATTRIBUTE *) node->data;
+    for (i = 0; i < src->num_attrs; i++) {
+        CK_ATTRIBUTE *attr = src->attrs[i].attr;
         CK_ATTRIBUTE *new_attr = NULL;
         CK_ULONG len;
 
@@ -609,19 +805,17 @@ CK_RV template_copy(TEMPLATE *dest, TEMPLATE *src)
             new_attr->ulValueLen = 2 * UNIQUE_ID_LEN;
         }
 
-        list = dlist_add_as_first(dest->attribute_list, new_attr);
-        if (list == NULL) {
+        rc = template_update_attribute(dest, new_attr);
+        if (rc != CKR_OK) {
             if (is_attribute_attr_array(new_attr->type))
                 cleanse_and_free_attribute_array2(
                                 (CK_ATTRIBUTE_PTR)new_attr->pValue,
                                 new_attr->ulValueLen / sizeof(CK_ATTRIBUTE),
                                 FALSE);
             free(new_attr);
-            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-            return CKR_HOST_MEMORY;
+            TRACE_DEVEL("template_update_attribute failed.\n");
+            return rc;
         }
-        dest->attribute_list = list;
-        node = node->next;
     }
 
     return CKR_OK;
@@ -744,7 +938,7 @@ static CK_RV attribute_array_flatten(CK_ATTRIBUTE_PTR array_attr,
  */
 CK_RV template_flatten(TEMPLATE *tmpl, CK_BYTE *dest)
 {
-    DL_NODE *node = NULL;
+    CK_ULONG i;
     CK_BYTE *ptr = NULL;
     CK_ULONG_32 long_len = sizeof(CK_ULONG);
     CK_ATTRIBUTE_32 attr_32;
@@ -756,9 +950,8 @@ CK_RV template_flatten(TEMPLATE *tmpl, CK_BYTE *dest)
         return CKR_FUNCTION_FAILED;
     }
     ptr = dest;
-    node = tmpl->attribute_list;
-    while (node) {
-        CK_ATTRIBUTE *attr = (CK_ATTRIBUTE *) node->data;
+    for (i = 0; i < tmpl->num_attrs; i++) {
+        CK_ATTRIBUTE *attr = tmpl->attrs[i].attr;
 
         if (is_attribute_attr_array(attr->type)) {
             rc = attribute_array_flatten(attr, &ptr);
@@ -767,7 +960,6 @@ CK_RV template_flatten(TEMPLATE *tmpl, CK_BYTE *dest)
                 return rc;
             }
 
-            node = node->next;
             continue;
         }
 
@@ -798,8 +990,6 @@ CK_RV template_flatten(TEMPLATE *tmpl, CK_BYTE *dest)
                 }
             }
         }
-
-        node = node->next;
     }
 
     return CKR_OK;
@@ -935,23 +1125,81 @@ CK_RV template_unflatten(TEMPLATE **new_tmpl, CK_BYTE *buf, CK_ULONG count)
     return template_unflatten_withSize(new_tmpl, buf, count, -1);
 }
 
+#define TEMPLATE_SLAB_ALIGN(len) \
+    (((len) + sizeof(CK_ULONG) - 1) & ~(sizeof(CK_ULONG) - 1))
+
+/*
+ * Reads the header of the flattened attribute at ptr. end is the end of the
+ * flattened template, or NULL if its size is unknown.
+ */
+static CK_RV template_flat_attr_header(CK_BYTE *ptr, CK_BYTE *end,
+                                       CK_ATTRIBUTE_TYPE *type,
+                                       CK_ULONG *value_len, CK_ULONG *hdr_len)
+{
+    CK_ULONG_32 long_len = sizeof(CK_ULONG);
+    CK_ATTRIBUTE a1;
+    CK_ATTRIBUTE_32 a1_32;
+
+    if (long_len == 4) {
+        *hdr_len = sizeof(CK_ATTRIBUTE);
+        if (end != NULL && ptr + *hdr_len > end)
+            return CKR_FUNCTION_FAILED;
+
+        memcpy(&a1, ptr, sizeof(a1));
+        *type = a1.type;
+        *value_len = a1.ulValueLen;
+    } else {
+        *hdr_len = sizeof(CK_ATTRIBUTE_32);
+        if (end != NULL && ptr + *hdr_len > end)
+            return CKR_FUNCTION_FAILED;
+
+        memcpy(&a1_32, ptr, sizeof(a1_32));
+        *type = a1_32.type;
+        *value_len = a1_32.ulValueLen;
+
+        if (flatten_ulong_attribute_as_ulong32(*type) && *value_len != 0 &&
+            *value_len != sizeof(CK_ULONG_32))
+            return CKR_FUNCTION_FAILED;
+    }
+
+    if (end != NULL && *value_len > (CK_ULONG)(end - ptr) - *hdr_len)
+        return CKR_FUNCTION_FAILED;
+
+    return CKR_OK;
+}
+
+/* space an attribute restored from its flattened form takes in the slab */
+static CK_ULONG template_slab_attr_size(CK_ATTRIBUTE_TYPE type,
+                                        CK_ULONG value_len)
+{
+    CK_ULONG_32 long_len = sizeof(CK_ULONG);
+
+    if (long_len != 4 && value_len != 0 &&
+        flatten_ulong_attribute_as_ulong32(type))
+        value_len = sizeof(CK_ULONG);
+
+    return sizeof(CK_ATTRIBUTE) + TEMPLATE_SLAB_ALIGN(value_len);
+}
+
 /* Modified version of template_unflatten that checks
  * that buf isn't overread.  buf_size=-1 turns off checking
  * (for backwards compatability)
+ *
+ * All attributes but attribute arrays are restored into one allocation, the
+ * template's slab, instead of being allocated one by one.
  */
 CK_RV template_unflatten_withSize(TEMPLATE **new_tmpl, CK_BYTE *buf,
                                   CK_ULONG count, int buf_size)
 {
     TEMPLATE *tmpl = NULL;
     CK_ATTRIBUTE *a2 = NULL;
-    CK_BYTE *ptr = NULL;
-    CK_ULONG i, len;
+    CK_ATTRIBUTE_TYPE type;
+    CK_BYTE *ptr = NULL, *end;
+    CK_ULONG i, len, hdr_len, slab_ofs;
     CK_RV rc;
     CK_ULONG_32 long_len = sizeof(CK_ULONG);
     CK_ULONG_32 attr_ulong_32;
     CK_ULONG attr_ulong;
-    CK_ATTRIBUTE *a1 = NULL;
-    CK_ATTRIBUTE_32 a1_32;
     CK_ATTRIBUTE_PTR attrs = NULL;
     CK_ULONG num_attrs = 0;
 
@@ -966,183 +1214,105 @@ CK_RV template_unflatten_withSize(TEMPLATE **new_tmpl, CK_BYTE *buf,
     }
     memset(tmpl, 0x0, sizeof(TEMPLATE));
 
+    end = buf_size >= 0 ? buf + buf_size : NULL;
+
+    /* check the attribute headers and size the slab */
     ptr = buf;
     for (i = 0; i < count; i++) {
-        if (long_len == 4) {
-            if (buf_size >= 0 &&
-                ((ptr + sizeof(CK_ATTRIBUTE)) > (buf + buf_size))) {
-                template_free(tmpl);
-                return CKR_FUNCTION_FAILED;
-            }
-
-            a1 = (CK_ATTRIBUTE *) ptr;
+        rc = template_flat_attr_header(ptr, end, &type, &len, &hdr_len);
+        if (rc != CKR_OK) {
+            template_free(tmpl);
+            return rc;
+        }
 
-            if (is_attribute_attr_array(a1->type)) {
-                if (buf_size >= 0 &&
-                    (ptr + sizeof(CK_ATTRIBUTE) + a1->ulValueLen ) >
-                                                     (buf + buf_size)) {
-                    template_free(tmpl);
-                    return CKR_FUNCTION_FAILED;
-                }
-                rc = attribute_array_unflatten(&ptr, &attrs, &num_attrs);
-                if (rc != CKR_OK) {
-                    TRACE_ERROR("attribute_array_unflatten failed\n");
-                    template_free(tmpl);
-                    return rc;
-                }
+        if (!is_attribute_attr_array(type))
+            tmpl->slab_len += template_slab_attr_size(type, len);
+        ptr += hdr_len + len;
+    }
 
-                len = sizeof(CK_ATTRIBUTE) + num_attrs * sizeof(CK_ATTRIBUTE);
-                a2 = (CK_ATTRIBUTE *) malloc(len);
-                if (!a2) {
-                    template_free(tmpl);
-                    cleanse_and_free_attribute_array(attrs, num_attrs);
-                    TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-                    return CKR_HOST_MEMORY;
-                }
+    if (count > 0) {
+        tmpl->attrs = (TEMPLATE_ATTR *) malloc(count * sizeof(TEMPLATE_ATTR));
+        if (!tmpl->attrs) {
+            template_free(tmpl);
+            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+            return CKR_HOST_MEMORY;
+        }
+        tmpl->max_attrs = count;
+    }
 
-                a2->type = a1->type;
-                a2->ulValueLen = num_attrs * sizeof(CK_ATTRIBUTE);
+    if (tmpl->slab_len > 0) {
+        tmpl->slab = (CK_BYTE *) malloc(tmpl->slab_len);
+        if (!tmpl->slab) {
+            tmpl->slab_len = 0;
+            template_free(tmpl);
+            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+            return CKR_HOST_MEMORY;
+        }
+    }
 
-                if (a2->ulValueLen > 0) {
-                    a2->pValue = ((CK_BYTE *)a2) + sizeof(CK_ATTRIBUTE);
-                    memcpy(a2->pValue, attrs, a2->ulValueLen);
-                } else {
-                    a2->pValue = NULL;
-                }
+    ptr = buf;
+    slab_ofs = 0;
+    for (i = 0; i < count; i++) {
+        template_flat_attr_header(ptr, NULL, &type, &len, &hdr_len);
 
-                free(attrs); /* Array elements were copied, don't free them! */
-                goto add_it;
+        if (is_attribute_attr_array(type)) {
+            rc = attribute_array_unflatten(&ptr, &attrs, &num_attrs);
+            if (rc != CKR_OK) {
+                TRACE_ERROR("attribute_array_unflatten failed\n");
+                template_free(tmpl);
+                return rc;
             }
 
-            len = sizeof(CK_ATTRIBUTE) + a1->ulValueLen;
+            len = sizeof(CK_ATTRIBUTE) + num_attrs * sizeof(CK_ATTRIBUTE);
             a2 = (CK_ATTRIBUTE *) malloc(len);
             if (!a2) {
                 template_free(tmpl);
+                cleanse_and_free_attribute_array(attrs, num_attrs);
                 TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
                 return CKR_HOST_MEMORY;
             }
 
-            /* if a buffer size is given, make sure it
-             * doesn't get overrun
-             */
-            if (buf_size >= 0 &&
-                (((unsigned char *) a1 + len)
-                 > ((unsigned char *) buf + buf_size))) {
-                free(a2);
-                template_free(tmpl);
-                return CKR_FUNCTION_FAILED;
-            }
-            memcpy(a2, a1, len);
-
-            if (a2->ulValueLen > 0)
+            a2->type = type;
+            a2->ulValueLen = num_attrs * sizeof(CK_ATTRIBUTE);
+            if (a2->ulValueLen > 0) {
                 a2->pValue = ((CK_BYTE *)a2) + sizeof(CK_ATTRIBUTE);
-            else
+                memcpy(a2->pValue, attrs, a2->ulValueLen);
+            } else {
                 a2->pValue = NULL;
-
-            ptr += len;
-        } else {
-            if (buf_size >= 0 &&
-                ((ptr + sizeof(CK_ATTRIBUTE_32)) > (buf + buf_size))) {
-                template_free(tmpl);
-                return CKR_FUNCTION_FAILED;
             }
 
-            memcpy(&a1_32, ptr, sizeof(a1_32));
-
-            if (is_attribute_attr_array(a1_32.type)) {
-                if (buf_size >= 0 &&
-                    (ptr + sizeof(CK_ATTRIBUTE_32) + a1_32.ulValueLen ) >
-                                                     (buf + buf_size)) {
-                    template_free(tmpl);
-                    return CKR_FUNCTION_FAILED;
-                }
-                rc = attribute_array_unflatten(&ptr, &attrs, &num_attrs);
-                if (rc != CKR_OK) {
-                    TRACE_ERROR("attribute_array_unflatten failed\n");
-                    template_free(tmpl);
-                    return rc;
-                }
-
-                len = sizeof(CK_ATTRIBUTE) + num_attrs * sizeof(CK_ATTRIBUTE);
-                a2 = (CK_ATTRIBUTE *) malloc(len);
-                if (!a2) {
-                    template_free(tmpl);
-                    cleanse_and_free_attribute_array(attrs, num_attrs);
-                    TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-                    return CKR_HOST_MEMORY;
-                }
-
-                a2->type = a1_32.type;
-                a2->ulValueLen = num_attrs * sizeof(CK_ATTRIBUTE);
-                if (a2->ulValueLen > 0) {
-                    a2->pValue = ((CK_BYTE *)a2) + sizeof(CK_ATTRIBUTE);
-                    memcpy(a2->pValue, attrs, a2->ulValueLen);
-                } else {
-                    a2->pValue = NULL;
-                }
-
-                free(attrs); /* Array elements were copied, don't free them! */
-                goto add_it;
-            }
-
-            if (flatten_ulong_attribute_as_ulong32(a1_32.type)
-                && a1_32.ulValueLen != 0) {
-                len = sizeof(CK_ATTRIBUTE) + sizeof(CK_ULONG);
-            } else {
-                len = sizeof(CK_ATTRIBUTE) + a1_32.ulValueLen;
-            }
+            free(attrs); /* Array elements were copied, don't free them! */
+        } else {
+            a2 = (CK_ATTRIBUTE *)(tmpl->slab + slab_ofs);
+            slab_ofs += template_slab_attr_size(type, len);
 
-            a2 = (CK_ATTRIBUTE *) malloc(len);
-            if (!a2) {
-                template_free(tmpl);
-                TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-                return CKR_HOST_MEMORY;
-            }
-            a2->type = a1_32.type;
+            a2->type = type;
             a2->ulValueLen = 0;
 
-            if (a1_32.ulValueLen != 0)
+            if (len != 0)
                 a2->pValue = (CK_BYTE *)a2 + sizeof(CK_ATTRIBUTE);
             else
                 a2->pValue = NULL;
 
-            if (flatten_ulong_attribute_as_ulong32(a1_32.type)
-                && a1_32.ulValueLen != 0) {
-
+            if (long_len != 4 && len != 0 &&
+                flatten_ulong_attribute_as_ulong32(type)) {
                 a2->ulValueLen = sizeof(CK_ULONG);
 
-                memcpy(&attr_ulong_32, ptr + sizeof(CK_ATTRIBUTE_32),
-                       sizeof(attr_ulong_32));
+                memcpy(&attr_ulong_32, ptr + hdr_len, sizeof(attr_ulong_32));
                 attr_ulong = attr_ulong_32;
 
                 memcpy(a2->pValue, (CK_BYTE *)&attr_ulong, sizeof(CK_ULONG));
-            } else if (a1_32.ulValueLen != 0) {
-                a2->ulValueLen = a1_32.ulValueLen;
-                /* if a buffer size is given, make sure it
-                 * doesn't get overrun
-                 */
-                if (buf_size >= 0 &&
-                    (ptr + sizeof(CK_ATTRIBUTE_32) + a1_32.ulValueLen) >
-                                                            (buf + buf_size)) {
-                    free(a2);
-                    template_free(tmpl);
-                    return CKR_FUNCTION_FAILED;
-                }
-                memcpy(a2->pValue, ptr + sizeof(CK_ATTRIBUTE_32),
-                       a1_32.ulValueLen);
+            } else if (len != 0) {
+                a2->ulValueLen = len;
+                memcpy(a2->pValue, ptr + hdr_len, len);
             }
 
-            ptr += sizeof(CK_ATTRIBUTE_32) + a1_32.ulValueLen;
+            ptr += hdr_len + len;
         }
 
-add_it:
         rc = template_update_attribute(tmpl, a2);
         if (rc != CKR_OK) {
-            if (is_attribute_attr_array(a2->type))
-                cleanse_and_free_attribute_array2((CK_ATTRIBUTE_PTR)a2->pValue,
-                                    a2->ulValueLen / sizeof(CK_ATTRIBUTE),
-                                    FALSE);
-            free(a2);
+            template_attr_free(tmpl, a2);
             template_free(tmpl);
             return rc;
         }
@@ -1153,30 +1323,20 @@ add_it:
     return CKR_OK;
 }
 
-
 /* template_free() */
 CK_RV template_free(TEMPLATE *tmpl)
 {
     if (!tmpl)
         return CKR_OK;
 
-    while (tmpl->attribute_list) {
-        CK_ATTRIBUTE *attr = (CK_ATTRIBUTE *) tmpl->attribute_list->data;
-
-        if (attr) {
-            if (is_attribute_attr_array(attr->type)) {
-                cleanse_and_free_attribute_array2(
-                                    (CK_ATTRIBUTE_PTR)attr->pValue,
-                                    attr->ulValueLen / sizeof(CK_ATTRIBUTE),
-                                    FALSE);
-            }
-            free(attr);
-        }
+    while (tmpl->num_attrs > 0)
+        template_attr_remove(tmpl, tmpl->num_attrs - 1);
 
-        tmpl->attribute_list = dlist_remove_node(tmpl->attribute_list,
-                                                 tmpl->attribute_list);
+    if (tmpl->slab != NULL) {
+        OPENSSL_cleanse(tmpl->slab, tmpl->slab_len);
+        free(tmpl->slab);
     }
-
+    free(tmpl->attrs);
     free(tmpl);
 
     return CKR_OK;
@@ -1186,17 +1346,15 @@ CK_RV template_free(TEMPLATE *tmpl)
 CK_BBOOL template_get_class(TEMPLATE *tmpl, CK_ULONG *class,
                             CK_ULONG *subclass)
 {
-    DL_NODE *node;
+    CK_ULONG i;
     CK_BBOOL found = FALSE;
 
     if (!tmpl || !class || !subclass)
         return FALSE;
 
-    node = tmpl->attribute_list;
-
     /* have to iterate through all attributes. no early exits */
-    while (node) {
-        CK_ATTRIBUTE *attr = (CK_ATTRIBUTE *) node->data;
+    for (i = 0; i < tmpl->num_attrs; i++) {
+        CK_ATTRIBUTE *attr = tmpl->attrs[i].attr;
 
         if (attr->type == CKA_CLASS &&
             attr->ulValueLen == sizeof(CK_OBJECT_CLASS) &&
@@ -1222,8 +1380,6 @@ CK_BBOOL template_get_class(TEMPLATE *tmpl, CK_ULONG *class,
             attr->ulValueLen == sizeof(CK_HW_FEATURE_TYPE) &&
             attr->pValue != NULL)
             *subclass = *(CK_HW_FEATURE_TYPE *) attr->pValue;
-
-        node = node->next;
     }
 
     return found;
@@ -1234,21 +1390,19 @@ CK_ULONG template_get_count(TEMPLATE *tmpl)
     if (tmpl == NULL)
         return 0;
 
-    return dlist_length(tmpl->attribute_list);
+    return tmpl->num_attrs;
 }
 
 CK_ULONG template_get_size(TEMPLATE *tmpl)
 {
-    DL_NODE *node;
-    CK_ULONG size = 0, i, num_attrs;
+    CK_ULONG size = 0, i, j, num_attrs;
     CK_ATTRIBUTE_PTR attrs;
 
     if (tmpl == NULL)
         return 0;
 
-    node = tmpl->attribute_list;
-    while (node) {
-        CK_ATTRIBUTE *attr = (CK_ATTRIBUTE *) node->data;
+    for (j = 0; j < tmpl->num_attrs; j++) {
+        CK_ATTRIBUTE *attr = tmpl->attrs[j].attr;
 
         size += sizeof(CK_ATTRIBUTE) + attr->ulValueLen;
 
@@ -1258,8 +1412,6 @@ CK_ULONG template_get_size(TEMPLATE *tmpl)
             for (i = 0; i< num_attrs; i++)
                 size += sizeof(CK_ATTRIBUTE) + attrs[i].ulValueLen;
         }
-
-        node = node->next;
     }
 
     return size;
@@ -1288,19 +1440,13 @@ static CK_ULONG attribute_get_compressed_size(CK_ATTRIBUTE_PTR attr)
 
 CK_ULONG template_get_compressed_size(TEMPLATE *tmpl)
 {
-    DL_NODE *node;
-    CK_ULONG size = 0;
+    CK_ULONG size = 0, i;
 
     if (tmpl == NULL)
         return 0;
-    node = tmpl->attribute_list;
-    while (node) {
-        CK_ATTRIBUTE *attr = (CK_ATTRIBUTE *) node->data;
-
-        size += attribute_get_compressed_size(attr);
 
-        node = node->next;
-    }
+    for (i = 0; i < tmpl->num_attrs; i++)
+        size += attribute_get_compressed_size(tmpl->attrs[i].attr);
 
     return size;
 }
@@ -1398,26 +1544,39 @@ CK_BBOOL template_check_exportability(TEMPLATE *tmpl, CK_ATTRIBUTE_TYPE type)
  */
 CK_RV template_merge(TEMPLATE *dest, TEMPLATE **src)
 {
-    DL_NODE *node;
+    CK_ATTRIBUTE *attr;
+    CK_ULONG i, len;
     CK_RV rc;
 
     if (!dest || !src) {
         TRACE_ERROR("Invalid function arguments.\n");
         return CKR_FUNCTION_FAILED;
     }
-    node = (*src)->attribute_list;
 
-    while (node) {
-        CK_ATTRIBUTE *attr = (CK_ATTRIBUTE *) node->data;
+    for (i = 0; i < (*src)->num_attrs; i++) {
+        attr = (*src)->attrs[i].attr;
+        if (template_attr_in_slab(*src, attr)) {
+            /* the slab goes away with 'src', so 'dest' gets its own copy */
+            len = sizeof(CK_ATTRIBUTE) + attr->ulValueLen;
+            attr = (CK_ATTRIBUTE *) malloc(len);
+            if (attr == NULL) {
+                TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+                return CKR_HOST_MEMORY;
+            }
+            memcpy(attr, (*src)->attrs[i].attr, len);
+            attr->pValue = attr->ulValueLen > 0 ?
+                                (CK_BYTE *)attr + sizeof(CK_ATTRIBUTE) : NULL;
+        }
 
         rc = template_update_attribute(dest, attr);
         if (rc != CKR_OK) {
+            if (attr != (*src)->attrs[i].attr)
+                free(attr);
             TRACE_DEVEL("template_update_attribute failed.\n");
             return rc;
         }
-        /* we've assigned the node's data to a node in 'dest' */
-        node->data = NULL;
-        node = node->next;
+        /* we've assigned the attribute to 'dest' */
+        (*src)->attrs[i].attr = NULL;
     }
 
     template_free(*src);
@@ -1580,37 +1739,19 @@ error:
  */
 CK_RV template_remove_attribute(TEMPLATE *tmpl, CK_ATTRIBUTE_TYPE type)
 {
-    DL_NODE *node = NULL;
-    CK_ATTRIBUTE *attr = NULL;
-    CK_BBOOL found = FALSE;
+    CK_ULONG pos;
 
     if (!tmpl) {
         TRACE_ERROR("Invalid function arguments.\n");
         return CKR_ARGUMENTS_BAD;
     }
-    node = tmpl->attribute_list;
 
-    while (node != NULL) {
-        attr = (CK_ATTRIBUTE *) node->data;
-
-        if (type == attr->type) {
-            found = TRUE;
-            if (is_attribute_attr_array(attr->type)) {
-                 cleanse_and_free_attribute_array2(
-                                     (CK_ATTRIBUTE_PTR)attr->pValue,
-                                     attr->ulValueLen / sizeof(CK_ATTRIBUTE),
-                                     FALSE);
-            }
-            free(attr);
-            tmpl->attribute_list =
-                dlist_remove_node(tmpl->attribute_list, node);
-            break;
-        }
+    if (!template_attr_search(tmpl, type, 0, &pos))
+        return CKR_ATTRIBUTE_TYPE_INVALID;
 
-        node = node->next;
-    }
+    template_attr_remove(tmpl, pos);
 
-    return found ? CKR_OK : CKR_ATTRIBUTE_TYPE_INVALID;
+    return CKR_OK;
 }
 
 /* template_update_attribute()
@@ -1621,30 +1762,27 @@ CK_RV template_remove_attribute(TEMPLATE *tmpl, CK_ATTRIBUTE_TYPE type)
  */
 CK_RV template_update_attribute(TEMPLATE *tmpl, CK_ATTRIBUTE *new_attr)
 {
-    DL_NODE *list;
-    CK_RV rc;
+    CK_ULONG pos;
+    CK_ATTRIBUTE *old_attr;
 
     if (!tmpl || !new_attr) {
         TRACE_ERROR("Invalid function arguments.\n");
         return CKR_ARGUMENTS_BAD;
     }
 
-    /* if the attribute already exists in the list, remove it.
-     * this algorithm will limit an attribute to appearing at most
-     * once in the list
+    /* if the attribute already exists in the template, replace it in place.
+     * this limits an attribute to appearing at most once in the template
      */
-    rc = template_remove_attribute(tmpl, new_attr->type);
-    if (rc != CKR_OK && rc != CKR_ATTRIBUTE_TYPE_INVALID)
-        return rc;
+    if (!template_attr_search(tmpl, new_attr->type, 0, &pos))
+        return template_attr_insert(tmpl, pos, new_attr);
 
-    /* add the new attribute */
-    list = dlist_add_as_first(tmpl->attribute_list, new_attr);
-    if (list == NULL) {
-        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
-        return CKR_HOST_MEMORY;
-    }
+    old_attr = tmpl->attrs[pos].attr;
+    tmpl->attrs[pos].attr = new_attr;
+    tmpl->key_desc.known = 0;
+
+    if (old_attr != NULL && old_attr != new_attr)
+        template_attr_free(tmpl, old_attr);
 
-    tmpl->attribute_list = list;
     return CKR_OK;
 }
 
@@ -1759,30 +1897,49 @@ CK_RV template_validate_attribute(STDLL_TokData_t *tokdata, TEMPLATE *tmpl,
 
 /* template_validate_attributes()
  *
- * walk through the list of attributes in the template validating each one
+ * walk through the attributes in the template validating each one.
+ *
+ * Validation of an attribute may add attributes to the template (e.g.
+ * CKA_EXTRACTABLE=FALSE adds CKA_NEVER_EXTRACTABLE). Those are set by the
+ * token itself and must not be validated, so only the attribute types present
+ * at the beginning are walked.
  */
 CK_RV template_validate_attributes(STDLL_TokData_t *tokdata, TEMPLATE *tmpl,
                                    CK_ULONG class, CK_ULONG subclass,
                                    CK_ULONG mode)
 {
-    DL_NODE *node;
+    CK_ATTRIBUTE_TYPE *types;
+    CK_ULONG i, num_types, pos;
     CK_RV rc = CKR_OK;
 
-    node = tmpl->attribute_list;
+    num_types = tmpl->num_attrs;
+    if (num_types == 0)
+        return CKR_OK;
+
+    types = malloc(num_types * sizeof(CK_ATTRIBUTE_TYPE));
+    if (types == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        return CKR_HOST_MEMORY;
+    }
+
+    for (i = 0; i < num_types; i++)
+        types[i] = tmpl->attrs[i].type;
 
-    while (node) {
-        CK_ATTRIBUTE *attr = (CK_ATTRIBUTE *) node->data;
+    for (i = 0; i < num_types; i++) {
+        if (!template_attr_search(tmpl, types[i], 0, &pos))
+            continue;
 
-        rc = template_validate_attribute(tokdata, tmpl, attr, class,
-                                         subclass, mode);
+        rc = template_validate_attribute(tokdata, tmpl, tmpl->attrs[pos].attr,
+                                         class, subclass, mode);
         if (rc != CKR_OK) {
             TRACE_DEVEL("template_validate_attribute failed.\n");
-            return rc;
+            break;
         }
-        node = node->next;
     }
 
-    return CKR_OK;
+    free(types);
+
+    return rc;
 }
 
 
@@ -1892,14 +2049,9 @@ CK_RV template_validate_base_attribute(TEMPLATE *tmpl, CK_ATTRIBUTE *attr,
 /* Debug function: dump list of attribues from a template */
 void dump_template(TEMPLATE *tmpl)
 {
-    DL_NODE *node = NULL;
-    CK_ATTRIBUTE *a = NULL;
-
-    node = tmpl->attribute_list;
-    while (node) {
-        a = (CK_ATTRIBUTE *) node->data;
-	TRACE_DEBUG_DUMPATTR(a);
-        node = node->next;
-    }
+    CK_ULONG i;
+
+    for (i = 0; i < tmpl->num_attrs; i++)
+        TRACE_DEBUG_DUMPATTR(tmpl->attrs[i].attr);
 }
 #endif
@@ -290,6 +290,10 @@ struct token_specific_struct {
     CK_RV(*t_handle_event) (STDLL_TokData_t *tokdata, unsigned int event_type,
                             unsigned int event_flags, const char *payload,
                             unsigned int payload_len);
+
+    CK_RV(*t_cipher_update) (STDLL_TokData_t *, CK_MECHANISM_TYPE,
+                             CK_BYTE *, CK_ULONG, CK_BYTE *, OBJECT *,
+                             CK_BYTE *, CK_BYTE, CK_BBOOL, CK_VOID_PTR *);
 };
 
 typedef struct token_specific_struct token_spec_t;
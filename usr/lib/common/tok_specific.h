@@ -338,4 +338,8 @@ CK_RV token_specific_handle_event(STDLL_TokData_t *tokdata,
                                   const char *payload,
                                   unsigned int payload_len);
 
+CK_RV token_specific_cipher_update(STDLL_TokData_t *, CK_MECHANISM_TYPE,
+                                   CK_BYTE *, CK_ULONG, CK_BYTE *, OBJECT *,
+                                   CK_BYTE *, CK_BYTE, CK_BBOOL, CK_VOID_PTR *);
+
 #endif
@@ -13,6 +13,8 @@
 #include <errno.h>
 #include <grp.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -40,6 +42,64 @@
 pthread_mutex_t tlmtx = PTHREAD_MUTEX_INITIALIZER;
 struct trace_handle_t trace;
 
+/*
+ * Asynchronous tracing (OPENCRYPTOKI_TRACE_ASYNC=drop|wait):
+ * Each thread appends its trace records to its own single-producer/
+ * single-consumer ring buffer. A record contains the time stamp and thread id
+ * in binary form, and the already formatted message. A background thread
+ * drains all rings, formats the time stamps and writes the lines to the trace
+ * file in large chunks. When a ring is full, the record is either dropped and
+ * counted ('drop'), or the thread waits for the drain thread ('wait').
+ *
+ * The rings and the drain thread are owned by the API library. The tokens
+ * get the function queuing a record via the trace handle, so that there is
+ * only one drain thread per process, and records stay valid when a token
+ * library is unloaded.
+ */
+#define TRACE_RING_RECORDS          128     /* must be a power of 2 */
+#define TRACE_RECORD_TEXT_SIZE      1000
+#define TRACE_DRAIN_INTERVAL_MS     10
+#define TRACE_WRITE_BUF_SIZE        (64 * 1024)
+
+struct trace_record {
+    struct timespec time;
+    pid_t tid;
+    char text[TRACE_RECORD_TEXT_SIZE];
+};
+
+struct trace_ring {
+    /* written by the owning thread only */
+    unsigned long head __attribute__((aligned(64)));
+    unsigned long dropped;
+    /* written by the drain thread only */
+    unsigned long tail __attribute__((aligned(64)));
+    unsigned long dropped_reported;
+    CK_BBOOL orphaned;              /* owning thread has terminated */
+    pid_t tid;
+    struct trace_ring *next;        /* protected by trace_async.mutex */
+    struct trace_record records[TRACE_RING_RECORDS];
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    pthread_key_t key;
+    pid_t pid;
+    CK_BBOOL wait_on_overflow;
+    CK_BBOOL started;
+    CK_BBOOL stop;
+    unsigned long generation;
+    unsigned long dropped;
+    struct trace_ring *rings;
+} trace_async = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static __thread struct trace_ring *trace_thread_ring;
+static __thread unsigned long trace_thread_generation;
+
 static const char *ock_err_msg[] = {
     "Malloc Failed",            /*ERR_HOST_MEMORY */
     "Slot Invalid",             /*ERR_SLOT_ID_INVALID */
@@ -123,14 +183,336 @@ static const char *ock_err_msg[] = {
     "Unknown error",            /*ERR_MAX */
 };
 
+static const char *trace_level_prefix(trace_level_t level)
+{
+    switch (level) {
+    case TRACE_LEVEL_ERROR:
+        return "[%s:%d %s] ERROR: ";
+    case TRACE_LEVEL_WARNING:
+        return "[%s:%d %s] WARN: ";
+    case TRACE_LEVEL_INFO:
+        return "[%s:%d %s] INFO: ";
+    case TRACE_LEVEL_DEVEL:
+        return "[%s:%d %s] DEVEL: ";
+    case TRACE_LEVEL_DEBUG:
+        return "[%s:%d %s] DEBUG: ";
+    default:	/* cannot happen */
+        return "[%s:%d %s] ERROR: ";
+    }
+}
+
+static void trace_write(const char *buf, size_t len)
+{
+    if (len > 0 && write(trace.fd, buf, len) == -1)
+        fprintf(stderr, "cannot write to trace file\n");
+}
+
+/*
+ * Appends the lines of all records available in the ring to the write buffer,
+ * writing out the buffer whenever it runs full.
+ */
+static void trace_drain_ring(struct trace_ring *ring, char *buf,
+                             size_t *buflen, time_t *last_sec,
+                             char *time_str, size_t time_str_size)
+{
+    unsigned long head, tail;
+    struct trace_record *rec;
+    struct tm tm;
+    int len;
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    for (tail = ring->tail; tail != head; tail++) {
+        rec = &ring->records[tail & (TRACE_RING_RECORDS - 1)];
+
+        if (rec->time.tv_sec != *last_sec) {
+            localtime_r(&rec->time.tv_sec, &tm);
+            strftime(time_str, time_str_size, "%m/%d/%Y %H:%M:%S ", &tm);
+            *last_sec = rec->time.tv_sec;
+        }
+
+        if (*buflen + 64 + TRACE_RECORD_TEXT_SIZE > TRACE_WRITE_BUF_SIZE) {
+            trace_write(buf, *buflen);
+            *buflen = 0;
+        }
+
+#ifdef __gettid
+        len = snprintf(buf + *buflen, TRACE_WRITE_BUF_SIZE - *buflen,
+                       "%s%u %s", time_str, (unsigned int)rec->tid,
+                       rec->text);
+#else
+        len = snprintf(buf + *buflen, TRACE_WRITE_BUF_SIZE - *buflen,
+                       "%s%s", time_str, rec->text);
+#endif
+        if (len > 0)
+            *buflen += len;
+
+        /* Release the record only after it has been copied */
+        __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void trace_drain_all(void)
+{
+    static char buf[TRACE_WRITE_BUF_SIZE];
+    char time_str[32] = "";
+    time_t last_sec = (time_t)-1;
+    struct trace_ring *ring, **prev;
+    unsigned long dropped = 0, d;
+    struct tm tm;
+    time_t t;
+    size_t buflen = 0;
+    int len;
+
+    pthread_mutex_lock(&trace_async.mutex);
+    for (prev = &trace_async.rings, ring = *prev; ring != NULL;
+         ring = *prev) {
+        trace_drain_ring(ring, buf, &buflen, &last_sec,
+                         time_str, sizeof(time_str));
+
+        d = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+        dropped += d - ring->dropped_reported;
+        ring->dropped_reported = d;
+
+        /* Free the ring of a terminated thread, once it is drained */
+        if (__atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail) {
+            *prev = ring->next;
+            free(ring);
+            continue;
+        }
+        prev = &ring->next;
+    }
+    pthread_mutex_unlock(&trace_async.mutex);
+
+    if (dropped > 0) {
+        trace_async.dropped += dropped;
+        t = time(NULL);
+        localtime_r(&t, &tm);
+        strftime(time_str, sizeof(time_str), "%m/%d/%Y %H:%M:%S ", &tm);
+        len = snprintf(buf + buflen, TRACE_WRITE_BUF_SIZE - buflen,
+                       "%s**** %lu trace records dropped (%lu in total) "
+                       "****\n", time_str, dropped, trace_async.dropped);
+        if (len > 0 && buflen + len < TRACE_WRITE_BUF_SIZE)
+            buflen += len;
+    }
+
+    trace_write(buf, buflen);
+}
+
+static void *trace_drain_thread(void *arg)
+{
+    struct timespec ts;
+
+    UNUSED(arg);
+
+    pthread_mutex_lock(&trace_async.mutex);
+    while (!trace_async.stop) {
+        pthread_mutex_unlock(&trace_async.mutex);
+        trace_drain_all();
+        pthread_mutex_lock(&trace_async.mutex);
+
+        if (trace_async.stop)
+            break;
+
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += TRACE_DRAIN_INTERVAL_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&trace_async.cond, &trace_async.mutex, &ts);
+    }
+    pthread_mutex_unlock(&trace_async.mutex);
+
+    trace_drain_all();
+
+    return NULL;
+}
+
+static void trace_ring_release(void *arg)
+{
+    struct trace_ring *ring = arg;
+
+    __atomic_store_n(&ring->orphaned, TRUE, __ATOMIC_RELEASE);
+}
+
+/*
+ * Returns the ring of the calling thread, allocating and registering it on
+ * the first call. The drain thread is started lazily with the first ring.
+ */
+static struct trace_ring *trace_get_ring(void)
+{
+    struct trace_ring *ring;
+    sigset_t set, oldset;
+    int rc;
+
+    if (trace_thread_ring != NULL &&
+        trace_thread_generation == trace_async.generation)
+        return trace_thread_ring;
+
+    if (posix_memalign((void **)&ring, 64, sizeof(*ring)) != 0)
+        return NULL;
+    ring->head = 0;
+    ring->dropped = 0;
+    ring->tail = 0;
+    ring->dropped_reported = 0;
+    ring->orphaned = FALSE;
+#ifdef __gettid
+    ring->tid = __gettid();
+#else
+    ring->tid = 0;
+#endif
+
+    pthread_mutex_lock(&trace_async.mutex);
+    if (!trace_async.started) {
+        /* The drain thread must not receive any of the process's signals */
+        sigfillset(&set);
+        pthread_sigmask(SIG_SETMASK, &set, &oldset);
+        rc = pthread_create(&trace_async.thread, NULL, trace_drain_thread,
+                            NULL);
+        pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+        if (rc != 0) {
+            pthread_mutex_unlock(&trace_async.mutex);
+            free(ring);
+            return NULL;
+        }
+        trace_async.started = TRUE;
+    }
+    ring->next = trace_async.rings;
+    trace_async.rings = ring;
+    pthread_mutex_unlock(&trace_async.mutex);
+
+    pthread_setspecific(trace_async.key, ring);
+    trace_thread_ring = ring;
+    trace_thread_generation = trace_async.generation;
+
+    return ring;
+}
+
+static void trace_async_put(trace_level_t level, const char *file, int line,
+                            const char *stdll_name, const char *fmt,
+                            va_list ap)
+{
+    struct trace_ring *ring;
+    struct trace_record *rec;
+    unsigned long head, used;
+    int len;
+
+    ring = trace_get_ring();
+    if (ring == NULL)
+        return;
+
+    head = ring->head;
+    for (;;) {
+        used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (used < TRACE_RING_RECORDS)
+            break;
+
+        if (!trace_async.wait_on_overflow ||
+            __atomic_load_n(&trace_async.stop, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&ring->dropped, ring->dropped + 1,
+                             __ATOMIC_RELAXED);
+            return;
+        }
+        pthread_cond_signal(&trace_async.cond);
+        sched_yield();
+    }
+
+    rec = &ring->records[head & (TRACE_RING_RECORDS - 1)];
+    clock_gettime(CLOCK_REALTIME, &rec->time);
+    rec->tid = ring->tid;
+    len = snprintf(rec->text, sizeof(rec->text), trace_level_prefix(level),
+                   file, line, stdll_name);
+    if (len < 0 || len >= (int)sizeof(rec->text))
+        len = 0;
+    vsnprintf(rec->text + len, sizeof(rec->text) - len, fmt, ap);
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    /* Wake up the drain thread early when the ring fills up */
+    if (used + 1 == TRACE_RING_RECORDS / 2)
+        pthread_cond_signal(&trace_async.cond);
+}
+
+static CK_RV trace_async_start(const char *policy)
+{
+    if (strcmp(policy, "drop") == 0) {
+        trace_async.wait_on_overflow = FALSE;
+    } else if (strcmp(policy, "wait") == 0) {
+        trace_async.wait_on_overflow = TRUE;
+    } else {
+        OCK_SYSLOG(LOG_WARNING, "OPENCRYPTOKI_TRACE_ASYNC '%s' is invalid. "
+                   "Tracing is synchronous.", policy);
+        return CKR_FUNCTION_FAILED;
+    }
+
+    if (pthread_key_create(&trace_async.key, trace_ring_release) != 0)
+        return CKR_FUNCTION_FAILED;
+
+    trace_async.pid = getpid();
+    trace_async.started = FALSE;
+    trace_async.stop = FALSE;
+    trace_async.dropped = 0;
+
+    return CKR_OK;
+}
+
+static void trace_async_stop(void)
+{
+    struct trace_ring *ring;
+    char buf[128];
+    int len;
+
+    if (trace_async.pid == getpid()) {
+        pthread_mutex_lock(&trace_async.mutex);
+        trace_async.stop = TRUE;
+        pthread_cond_signal(&trace_async.cond);
+        pthread_mutex_unlock(&trace_async.mutex);
+
+        if (trace_async.started)
+            pthread_join(trace_async.thread, NULL);
+
+        if (trace_async.dropped > 0) {
+            len = snprintf(buf, sizeof(buf), "**** %lu trace records "
+                           "dropped in total ****\n", trace_async.dropped);
+            if (len > 0)
+                trace_write(buf, len);
+        }
+    } else {
+        /*
+         * In a forked child the drain thread does not exist, and the mutex
+         * may have been held by a thread of the parent during fork.
+         */
+        pthread_mutex_init(&trace_async.mutex, NULL);
+        pthread_cond_init(&trace_async.cond, NULL);
+    }
+
+    pthread_key_delete(trace_async.key);
+
+    while (trace_async.rings != NULL) {
+        ring = trace_async.rings;
+        trace_async.rings = ring->next;
+        free(ring);
+    }
+
+    /* Let the threads allocate a new ring when tracing is re-initialized */
+    trace_async.generation++;
+    trace_async.started = FALSE;
+}
+
 void set_trace(struct trace_handle_t t_handle)
 {
     trace.fd = t_handle.fd;
     trace.level = t_handle.level;
+    trace.async_func = t_handle.async_func;
 }
 
 void trace_finalize(void)
 {
+    if (trace.async_func != NULL)
+        trace_async_stop();
+    trace.async_func = NULL;
+
     if (trace.fd >= 0)
         close(trace.fd);
     trace.fd = -1;
@@ -148,6 +530,7 @@ CK_RV trace_initialize(void)
     /* initialize the trace values */
     trace.level = TRACE_LEVEL_NONE;
     trace.fd = -1;
+    trace.async_func = NULL;
 
     opt = getenv("OPENCRYPTOKI_TRACE_LEVEL");
     if (!opt)
@@ -207,6 +590,10 @@ CK_RV trace_initialize(void)
         goto error;
     }
 
+    opt = getenv("OPENCRYPTOKI_TRACE_ASYNC");
+    if (opt != NULL && trace_async_start(opt) == CKR_OK)
+        trace.async_func = trace_async_put;
+
 #ifdef PACKAGE_VERSION
     TRACE_INFO("**** OCK Trace level %d activated for OCK version %s ****\n",
             trace.level, PACKAGE_VERSION);
@@ -241,6 +628,13 @@ void ock_traceit(trace_level_t level, const char *file, int line,
     if (level > trace.level)
         return;
 
+    if (trace.async_func != NULL) {
+        va_start(ap, fmt);
+        trace.async_func(level, file, line, stdll_name, fmt, ap);
+        va_end(ap);
+        return;
+    }
+
     pbuf = buf;
     buflen = sizeof(buf);
 
@@ -260,26 +654,7 @@ void ock_traceit(trace_level_t level, const char *file, int line,
 #endif
 
     /* add file line and stdll name */
-    switch (level) {
-    case TRACE_LEVEL_ERROR:
-        fmt_pre = "[%s:%d %s] ERROR: ";
-        break;
-    case TRACE_LEVEL_WARNING:
-        fmt_pre = "[%s:%d %s] WARN: ";
-        break;
-    case TRACE_LEVEL_INFO:
-        fmt_pre = "[%s:%d %s] INFO: ";
-        break;
-    case TRACE_LEVEL_DEVEL:
-        fmt_pre = "[%s:%d %s] DEVEL: ";
-        break;
-    case TRACE_LEVEL_DEBUG:
-        fmt_pre = "[%s:%d %s] DEBUG: ";
-        break;
-    default:	/* cannot happen */
-        fmt_pre = "[%s:%d %s] ERROR: ";
-        break;
-    }
+    fmt_pre = trace_level_prefix(level);
     snprintf(pbuf, buflen, fmt_pre, file, line, stdll_name);
 
     /* add the format */
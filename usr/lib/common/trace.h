@@ -11,6 +11,8 @@
 #ifndef _TRACE_H
 #define _TRACE_H
 
+#include <stdarg.h>
+
 #include "defs.h"
 #include "host_defs.h"
 
@@ -110,10 +112,16 @@ typedef enum {
 } trace_level_t;
 
 
+typedef void (*trace_async_f)(trace_level_t level, const char *file,
+                              int line, const char *stdll_name,
+                              const char *fmt, va_list ap);
+
 /* Encapsulate all trace variables */
 struct trace_handle_t {
     int fd;                     /* file descriptor for filename */
     trace_level_t level;        /* trace level */
+    trace_async_f async_func;   /* queues a trace record, NULL if tracing
+                                   is synchronous */
 };
 
 extern struct trace_handle_t trace;
@@ -144,7 +152,7 @@ const char *ock_err(int num);
 #define TRACE_DEBUG(...)						\
     ock_traceit(TRACE_LEVEL_DEBUG, __FILE__, __LINE__, STDLL_NAME, __VA_ARGS__)
 
-void dump_shm(LW_SHM_TYPE *, const char *);
+void dump_shm(STDLL_TokData_t *, const char *);
 #define DUMP_SHM(x,y) dump_shm(x,y)
 #else
 #define TRACE_DEBUG(...)
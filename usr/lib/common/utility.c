@@ -227,6 +227,24 @@ CK_RV XProcUnLock(STDLL_TokData_t *tokdata)
     return CKR_OK;
 }
 
+/*
+ * Returns TRUE if the calling thread holds the XProcLock. spinxplfd_mutex is
+ * recursive, so the trylock only succeeds for the owner, or if it is unlocked,
+ * in which case no XProcLock is held.
+ */
+CK_BBOOL XProcLockHeld(STDLL_TokData_t *tokdata)
+{
+    CK_BBOOL held;
+
+    if (pthread_mutex_trylock(&tokdata->spinxplfd_mutex) != 0)
+        return FALSE;
+
+    held = tokdata->spinxplfd_count > 0;
+    pthread_mutex_unlock(&tokdata->spinxplfd_mutex);
+
+    return held;
+}
+
 CK_RV XProcLock_Init(STDLL_TokData_t *tokdata)
 {
     pthread_mutexattr_t attr;
@@ -620,6 +638,8 @@ CK_RV detach_shm(STDLL_TokData_t *tokdata, CK_BBOOL ignore_ref_count)
     if (rc != CKR_OK)
         return rc;
 
+    object_mgr_unmap_tok_obj_segs(tokdata, ignore_ref_count);
+
     if (sm_close((void *) tokdata->global_shm, 0, ignore_ref_count)) {
         TRACE_DEVEL("sm_close failed.\n");
         rc = CKR_FUNCTION_FAILED;
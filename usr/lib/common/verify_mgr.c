@@ -77,8 +77,8 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
     if (recover_mode) {
         // is key allowed to verify signatures where the data can be
         // recovered from the signature?
-        rc = template_attribute_get_bool(key_obj->template, CKA_VERIFY_RECOVER,
-                                         &flag);
+        rc = template_key_desc_get_bool(key_obj->template, CKA_VERIFY_RECOVER,
+                                        &flag);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_VERIFY_RECOVER for the key.\n");
             rc = CKR_KEY_FUNCTION_NOT_PERMITTED;
@@ -87,7 +87,7 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
     } else {
         // is key allowed to verify signatures where the signature is an
         // appendix to the data?
-        rc = template_attribute_get_bool(key_obj->template, CKA_VERIFY, &flag);
+        rc = template_key_desc_get_bool(key_obj->template, CKA_VERIFY, &flag);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_VERIFY for the key.\n");
             rc = CKR_KEY_FUNCTION_NOT_PERMITTED;
@@ -135,8 +135,8 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
             }
         }
 
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -150,8 +150,8 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
 
         // must be a PUBLIC key operation
         //
-        rc = template_attribute_get_ulong(key_obj->template, CKA_CLASS,
-                                          &class);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_CLASS,
+                                         &class);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_CLASS for the key.\n");
             goto done;
@@ -178,8 +178,8 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
             rc = CKR_MECHANISM_PARAM_INVALID;
             goto done;
         }
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -193,8 +193,8 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
 
         // must be a PUBLIC key operation
         //
-        rc = template_attribute_get_ulong(key_obj->template, CKA_CLASS,
-                                          &class);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_CLASS,
+                                         &class);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_CLASS for the key.\n");
             goto done;
@@ -211,7 +211,7 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
             ctx->context = NULL;
         } else {
             ctx->context_len = sizeof(RSA_DIGEST_CONTEXT);
-            ctx->context = (CK_BYTE *) malloc(sizeof(RSA_DIGEST_CONTEXT));
+            ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(RSA_DIGEST_CONTEXT));
             if (!ctx->context) {
                 TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
                 rc = CKR_HOST_MEMORY;
@@ -234,8 +234,8 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
             rc = CKR_MECHANISM_PARAM_INVALID;
             goto done;
         }
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -249,8 +249,8 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
 
         // must be a PUBLIC key operation
         //
-        rc = template_attribute_get_ulong(key_obj->template, CKA_CLASS,
-                                          &class);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_CLASS,
+                                         &class);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_CLASS for the key.\n");
             goto done;
@@ -262,7 +262,7 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
             goto done;
         }
         ctx->context_len = sizeof(RSA_DIGEST_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(sizeof(RSA_DIGEST_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(RSA_DIGEST_CONTEXT));
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -288,8 +288,8 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
             goto done;
         }
 
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -303,8 +303,8 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
 
         // must be a PUBLIC key operation
         //
-        rc = template_attribute_get_ulong(key_obj->template, CKA_CLASS,
-                                          &class);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_CLASS,
+                                         &class);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_CLASS for the key.\n");
             goto done;
@@ -316,7 +316,7 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
             goto done;
         }
         ctx->context_len = sizeof(DIGEST_CONTEXT);
-        ctx->context = (CK_BYTE *) malloc(ctx->context_len);
+        ctx->context = session_mgr_op_alloc(sess, ctx, ctx->context_len);
         if (!ctx->context) {
             TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
             rc = CKR_HOST_MEMORY;
@@ -332,8 +332,8 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
             goto done;
         }
 
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -347,8 +347,8 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
 
         // must be a PUBLIC key operation
         //
-        rc = template_attribute_get_ulong(key_obj->template, CKA_CLASS,
-                                          &class);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_CLASS,
+                                         &class);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_CLASS for the key.\n");
             goto done;
@@ -375,8 +375,8 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
             goto done;
         }
 
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -410,8 +410,8 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
             goto done;
         }
 
-        rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                          &keytype);
+        rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                         &keytype);
         if (rc != CKR_OK) {
             TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
             goto done;
@@ -464,8 +464,8 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
                 goto done;
             }
 
-            rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                              &keytype);
+            rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                             &keytype);
             if (rc != CKR_OK) {
                 TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
                 goto done;
@@ -550,8 +550,8 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
                 goto done;
             }
 
-            rc = template_attribute_get_ulong(key_obj->template, CKA_KEY_TYPE,
-                                              &keytype);
+            rc = template_key_desc_get_ulong(key_obj->template, CKA_KEY_TYPE,
+                                             &keytype);
             if (rc != CKR_OK) {
                 TRACE_ERROR("Could not find CKA_KEY_TYPE for the key.\n");
                 goto done;
@@ -608,8 +608,8 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
                 }
             }
 
-            rc = template_attribute_get_ulong(key_obj->template, CKA_CLASS,
-                                              &class);
+            rc = template_key_desc_get_ulong(key_obj->template, CKA_CLASS,
+                                             &class);
             if (rc != CKR_OK) {
                 TRACE_ERROR("Could not find CKA_CLASS for the key.\n");
                 goto done;
@@ -622,7 +622,7 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
             }
 
             ctx->context_len = sizeof(SSL3_MAC_CONTEXT);
-            ctx->context = (CK_BYTE *) malloc(sizeof(SSL3_MAC_CONTEXT));
+            ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(SSL3_MAC_CONTEXT));
             if (!ctx->context) {
                 TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
                 rc = CKR_HOST_MEMORY;
@@ -658,7 +658,7 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
                 }
             }
 
-            ctx->context = (CK_BYTE *) malloc(sizeof(DES_DATA_CONTEXT));
+            ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(DES_DATA_CONTEXT));
             ctx->context_len = sizeof(DES_DATA_CONTEXT);
 
             if (!ctx->context) {
@@ -695,7 +695,7 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
             }
         }
 
-        ctx->context = (CK_BYTE *) malloc(sizeof(DES_CMAC_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(DES_CMAC_CONTEXT));
         ctx->context_len = sizeof(DES_CMAC_CONTEXT);
 
         if (!ctx->context) {
@@ -733,7 +733,7 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
                 }
             }
 
-            ctx->context = (CK_BYTE *) malloc(sizeof(AES_DATA_CONTEXT));
+            ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(AES_DATA_CONTEXT));
             ctx->context_len = sizeof(AES_DATA_CONTEXT);
 
             if (!ctx->context) {
@@ -771,7 +771,7 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
             }
         }
 
-        ctx->context = (CK_BYTE *) malloc(sizeof(AES_CMAC_CONTEXT));
+        ctx->context = session_mgr_op_alloc(sess, ctx, sizeof(AES_CMAC_CONTEXT));
         ctx->context_len = sizeof(AES_CMAC_CONTEXT);
 
         if (!ctx->context) {
@@ -811,8 +811,10 @@ CK_RV verify_mgr_init(STDLL_TokData_t *tokdata,
     rc = CKR_OK;
 
 done:
-    if (ctx->count_statistics == TRUE && rc == CKR_OK)
+    if (ctx->count_statistics == TRUE && rc == CKR_OK) {
         INC_COUNTER(tokdata, sess, mech, key_obj, POLICY_STRENGTH_IDX_0);
+        STAT_OP_START(tokdata, ctx, mech, key_obj, POLICY_STRENGTH_IDX_0);
+    }
 
     object_put(tokdata, key_obj, TRUE);
     key_obj = NULL;
@@ -853,11 +855,13 @@ CK_RV verify_mgr_cleanup(STDLL_TokData_t *tokdata, SESSION *sess,
             ctx->context_free_func(tokdata, sess, ctx->context,
                                    ctx->context_len);
         else
-            free(ctx->context);
+            session_mgr_op_free(sess, ctx->context, 0);
         ctx->context = NULL;
     }
     ctx->context_free_func = NULL;
 
+    session_mgr_op_reset(sess, ctx);
+
     return CKR_OK;
 }
 
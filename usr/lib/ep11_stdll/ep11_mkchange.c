@@ -486,6 +486,10 @@ struct reencipher_data {
     STDLL_TokData_t *tokdata;
     SESSION *session;
     ep11_target_info_t *target_info;
+    /* Single APQN targets the token objects are spread over, if any */
+    ep11_target_info_t **apqn_targets;
+    unsigned int num_apqn_targets;
+    volatile unsigned long next_apqn_target;
 };
 
 static CK_RV ep11tok_reencipher_objects_reenc(CK_BYTE *sec_key,
@@ -499,21 +503,42 @@ static CK_RV ep11tok_reencipher_objects_reenc(CK_BYTE *sec_key,
                                    sec_key, sec_key_len, reenc_sec_key);
 }
 
+/*
+ * Token objects may be re-enciphered by multiple threads concurrently, see
+ * obj_mgr_iterate_key_objects(). Each call therefore uses its own copy of the
+ * re-encipher data with its own reference to the (single APQN) target.
+ * If per-APQN targets have been set up, the objects are distributed over
+ * those round robin, so that the workers keep all APQNs of the token busy.
+ */
 static CK_RV ep11tok_reencipher_objects_cb(STDLL_TokData_t *tokdata,
                                            OBJECT *obj, void *cb_data)
 {
     struct reencipher_data *rd = cb_data;
-    SESSION *session_save;
+    struct reencipher_data obj_rd;
+    unsigned long idx;
     CK_RV rc;
 
-    session_save = rd->session;
+    obj_rd.tokdata = rd->tokdata;
+    obj_rd.session = rd->session;
     if (obj->session != NULL) /* session is NULL for token objects */
-        rd->session = obj->session;
+        obj_rd.session = obj->session;
+    if (rd->num_apqn_targets > 0) {
+        idx = __sync_fetch_and_add(&rd->next_apqn_target, 1);
+        obj_rd.target_info = rd->apqn_targets[idx % rd->num_apqn_targets];
+        __sync_add_and_fetch(&obj_rd.target_info->ref_count, 1);
+    } else {
+        obj_rd.target_info = get_target_info(tokdata);
+    }
+    if (obj_rd.target_info == NULL)
+        return CKR_FUNCTION_FAILED;
+
     rc = obj_mgr_reencipher_secure_key(tokdata, obj,
-                                       ep11tok_reencipher_objects_reenc, rd);
+                                       ep11tok_reencipher_objects_reenc,
+                                       &obj_rd);
     if (rc == CKR_OBJECT_HANDLE_INVALID) /* Obj was deleted by other proc */
         rc = CKR_OK;
-    rd->session = session_save;
+
+    put_target_info(tokdata, obj_rd.target_info);
 
     return rc;
 }
@@ -529,6 +554,17 @@ static CK_BBOOL ep11tok_reencipher_filter_cb(STDLL_TokData_t *tokdata,
     return template_attribute_find(obj->template, CKA_IBM_OPAQUE_REENC, &attr);
 }
 
+/*
+ * When resuming an interrupted re-encipher run, skip those objects that
+ * already have been re-enciphered.
+ */
+static CK_BBOOL ep11tok_reencipher_resume_filter_cb(STDLL_TokData_t *tokdata,
+                                                    OBJECT *obj,
+                                                    void *filter_data)
+{
+    return !ep11tok_reencipher_filter_cb(tokdata, obj, filter_data);
+}
+
 static CK_RV ep11tok_reencipher_cancel_objects_cb(STDLL_TokData_t *tokdata,
                                                   OBJECT *obj, void *cb_data)
 {
@@ -815,6 +851,118 @@ static CK_RV ep11tok_mk_change_find_rw_session(STDLL_TokData_t *tokdata,
     return CKR_OK;
 }
 
+struct apqn_targets_data {
+    ep11_private_data_t *ep11_data;
+    struct hsm_mk_change_info *info;
+    ep11_target_info_t **targets;
+    unsigned int num_targets;
+};
+
+/*
+ * Collects a single APQN target for each online APQN of the MK change
+ * operation that has the expected current WK and the new WK committed, and
+ * thus is able to re-encipher the blobs.
+ */
+static CK_RV mk_change_apqn_targets_handler(uint_32 adapter, uint_32 domain,
+                                            void *handler_data)
+{
+    struct apqn_targets_data *atd = handler_data;
+    CK_IBM_DOMAIN_INFO domain_info;
+    CK_ULONG domain_info_len = sizeof(domain_info);
+    ep11_target_info_t *target_info, **tmp;
+    target_t target;
+    CK_RV rc;
+
+    if (hsm_mk_change_apqns_find(atd->info->apqns, atd->info->num_apqns,
+                                 adapter, domain) == FALSE)
+        return CKR_OK;
+
+    rc = get_ep11_target_for_apqn(adapter, domain, &target, 0);
+    if (rc != CKR_OK)
+        return CKR_OK;
+
+    rc = dll_m_get_xcp_info(&domain_info, &domain_info_len, CK_IBM_XCPQ_DOMAIN,
+                            0, target);
+    if (rc != CKR_OK ||
+        (domain_info.flags & CK_IBM_DOM_CURR_WK) == 0 ||
+        (domain_info.flags & CK_IBM_DOM_COMMITTED_NWK) == 0 ||
+        memcmp(domain_info.wk, atd->ep11_data->expected_wkvp,
+               XCP_WKID_BYTES) != 0 ||
+        memcmp(domain_info.nextwk, atd->ep11_data->new_wkvp,
+               XCP_WKID_BYTES) != 0) {
+        TRACE_DEVEL("%s APQN %02X.%04X can not re-encipher, skipped\n",
+                    __func__, adapter, domain);
+        free_ep11_target_for_apqn(target);
+        return CKR_OK;
+    }
+
+    target_info = calloc(1, sizeof(ep11_target_info_t));
+    tmp = realloc(atd->targets,
+                  (atd->num_targets + 1) * sizeof(ep11_target_info_t *));
+    if (target_info == NULL || tmp == NULL) {
+        TRACE_ERROR("%s Memory allocation failed\n", __func__);
+        free(target_info);
+        if (tmp != NULL)
+            atd->targets = tmp;
+        free_ep11_target_for_apqn(target);
+        return CKR_HOST_MEMORY;
+    }
+
+    target_info->ref_count = 1;
+    target_info->target = target;
+    target_info->single_apqn = 1;
+    target_info->adapter = adapter;
+    target_info->domain = domain;
+
+    atd->targets = tmp;
+    atd->targets[atd->num_targets++] = target_info;
+
+    TRACE_DEVEL("%s APQN %02X.%04X used for re-enciphering\n", __func__,
+                adapter, domain);
+
+    return CKR_OK;
+}
+
+static void ep11tok_free_apqn_targets(ep11_target_info_t **targets,
+                                      unsigned int num_targets)
+{
+    unsigned int i;
+
+    /* All references of the re-encipher workers have been put already */
+    for (i = 0; i < num_targets; i++) {
+        free_ep11_target_for_apqn(targets[i]->target);
+        free(targets[i]);
+    }
+    free(targets);
+}
+
+static CK_RV ep11tok_get_apqn_targets(STDLL_TokData_t *tokdata,
+                                      struct hsm_mk_change_info *info,
+                                      ep11_target_info_t ***targets,
+                                      unsigned int *num_targets)
+{
+    ep11_private_data_t *ep11_data = tokdata->private_data;
+    struct apqn_targets_data atd;
+    CK_RV rc;
+
+    memset(&atd, 0, sizeof(atd));
+    atd.ep11_data = ep11_data;
+    atd.info = info;
+
+    rc = handle_all_ep11_cards(&ep11_data->target_list,
+                               mk_change_apqn_targets_handler, &atd);
+    if (rc != CKR_OK) {
+        TRACE_ERROR("%s handle_all_ep11_cards failed: 0x%lx\n", __func__, rc);
+        ep11tok_free_apqn_targets(atd.targets, atd.num_targets);
+        return rc;
+    }
+
+    *targets = atd.targets;
+    *num_targets = atd.num_targets;
+
+    return CKR_OK;
+}
+
 /*
  * ATTENTION: This function is called in a separate thread. All actions
  * performed by this function must be thread save and use locks to lock
@@ -918,9 +1066,37 @@ static CK_RV ep11tok_mk_change_reencipher(STDLL_TokData_t *tokdata,
         goto out;
     }
 
-    /* Re-encipher key objects */
+    if (token_objs) {
+        /*
+         * Spread the token objects over all APQNs that are able to
+         * re-encipher. If none is found, use the single APQN target.
+         */
+        rc = ep11tok_get_apqn_targets(tokdata, info, &rd.apqn_targets,
+                                      &rd.num_apqn_targets);
+        if (rc != CKR_OK) {
+            OCK_SYSLOG(LOG_ERR, "Slot %lu: Failed to get the APQN targets: "
+                       "0x%lx\n", tokdata->slot_id, rc);
+            goto out;
+        }
+
+        TRACE_DEVEL("%s re-encipher token objects using %u APQNs\n",
+                    __func__, rd.num_apqn_targets);
+    }
+
+    /*
+     * Re-encipher key objects.
+     * If flag EVENT_MK_CHANGE_FLAGS_TOK_OBJS_RESUME is on, the tool resumes an
+     * interrupted run. Token objects that already have the
+     * CKA_IBM_OPAQUE_REENC attribute have been re-enciphered by that run, or
+     * have been created by a process after the MK change operation has been
+     * activated, and are skipped.
+     */
     rc = obj_mgr_iterate_key_objects(tokdata, !token_objs, token_objs,
-                                     NULL, NULL,
+                                     token_objs && (op->flags &
+                                         EVENT_MK_CHANGE_FLAGS_TOK_OBJS_RESUME) ?
+                                         ep11tok_reencipher_resume_filter_cb :
+                                         NULL,
+                                     NULL,
                                      ep11tok_reencipher_objects_cb, &rd,
                                      TRUE, "re-encipher");
     if (rc != CKR_OK)
@@ -963,6 +1139,8 @@ out:
     }
 
     put_target_info(tokdata, rd.target_info);
+    if (rd.apqn_targets != NULL)
+        ep11tok_free_apqn_targets(rd.apqn_targets, rd.num_apqn_targets);
 
     if (rd.session != NULL)
         session_mgr_put(tokdata, rd.session);
@@ -1965,14 +1965,12 @@ static CK_RV build_ep11_attrs(STDLL_TokData_t * tokdata, TEMPLATE *template,
                               CK_KEY_TYPE ktype, CK_OBJECT_CLASS class,
                               int curve_type, CK_MECHANISM_PTR mech)
 {
-    DL_NODE *node;
     CK_ATTRIBUTE_PTR attr;
     CK_RV rc;
-    CK_ULONG value_len = 0;
+    CK_ULONG i, value_len = 0;
 
-    node = template->attribute_list;
-    while (node != NULL) {
-        attr = node->data;
+    for (i = 0; i < template->num_attrs; i++) {
+        attr = template->attrs[i].attr;
 
         /* EP11 handles this as 'read only' and reports an error if specified */
         switch (attr->type) {
@@ -2012,8 +2010,6 @@ static CK_RV build_ep11_attrs(STDLL_TokData_t * tokdata, TEMPLATE *template,
                 }
             }
         }
-
-        node = node->next;
     }
 
     return CKR_OK;
@@ -2673,7 +2669,7 @@ static CK_RV make_maced_spki(STDLL_TokData_t *tokdata, SESSION * sess,
     CK_ULONG attrs_len = 0;
     CK_ATTRIBUTE_PTR attr;
     CK_BBOOL bool_value;
-    DL_NODE *node;
+    CK_ULONG i;
     CK_BYTE csum[MAX_BLOBSIZE];
     CK_ULONG cslen = sizeof(csum);
     CK_KEY_TYPE keytype;
@@ -2690,9 +2686,8 @@ static CK_RV make_maced_spki(STDLL_TokData_t *tokdata, SESSION * sess,
      * m_UnwrapKey with CKM_IBM_TRANSPORTKEY allows boolean attributes only to
      * be added to MACed-SPKIs
      */
-    node = pub_key_obj->template->attribute_list;
-    while (node != NULL) {
-        attr = node->data;
+    for (i = 0; i < pub_key_obj->template->num_attrs; i++) {
+        attr = pub_key_obj->template->attrs[i].attr;
 
         if (!attr_applicable_for_ep11(tokdata, attr, keytype,
                                       CKO_PUBLIC_KEY, curve_type, &mech))
@@ -2754,7 +2749,7 @@ static CK_RV make_maced_spki(STDLL_TokData_t *tokdata, SESSION * sess,
             break;
         }
 make_maced_spki_next:
-        node = node->next;
+        ;
     }
 
     trace_attributes(__func__, "MACed SPKI import:", p_attrs, attrs_len);
@@ -13923,7 +13918,7 @@ CK_RV token_specific_set_attribute_values(STDLL_TokData_t *tokdata,
     CK_KEY_TYPE ktype;
     size_t keyblobsize = 0, reencblobsize = 0;
     CK_BYTE *keyblob, *reencblob = NULL;
-    DL_NODE *node;
+    CK_ULONG i;
     CK_ATTRIBUTE *ibm_opaque_attr = NULL, *ibm_opaque_reenc_attr = NULL;
     CK_ATTRIBUTE_PTR attributes = NULL;
     CK_ULONG num_attributes = 0;
@@ -13973,9 +13968,8 @@ CK_RV token_specific_set_attribute_values(STDLL_TokData_t *tokdata,
         }
     }
 
-    node = new_tmpl->attribute_list;
-    while (node) {
-        attr = (CK_ATTRIBUTE *)node->data;
+    for (i = 0; i < new_tmpl->num_attrs; i++) {
+        attr = new_tmpl->attrs[i].attr;
 
         /* EP11 can set certain boolean attributes only */
         switch (attr->type) {
@@ -14023,8 +14017,6 @@ CK_RV token_specific_set_attribute_values(STDLL_TokData_t *tokdata,
             /* Either non-boolean, or read-only */
             break;
         }
-
-        node = node->next;
     }
 
     if (attributes != NULL && num_attributes > 0) {
@@ -85,6 +85,11 @@ CK_RV ST_Initialize(API_Slot_t *sltp, CK_SLOT_ID SlotNumber,
     rc |= bt_init(&sltp->TokData->sess_obj_btree, call_object_free);
     rc |= bt_init(&sltp->TokData->priv_token_obj_btree, call_object_free);
     rc |= bt_init(&sltp->TokData->publ_token_obj_btree, call_object_free);
+    rc |= tok_obj_name_index_init(&sltp->TokData->priv_token_obj_index);
+    rc |= tok_obj_name_index_init(&sltp->TokData->publ_token_obj_index);
+    rc |= obj_attr_index_init(&sltp->TokData->sess_obj_attr_index);
+    rc |= obj_attr_index_init(&sltp->TokData->publ_token_obj_attr_index);
+    rc |= obj_attr_index_init(&sltp->TokData->priv_token_obj_attr_index);
     if (rc != CKR_OK) {
         TRACE_ERROR("Btree init failed\n");
         rc = CKR_FUNCTION_FAILED;
@@ -117,6 +122,15 @@ CK_RV ST_Initialize(API_Slot_t *sltp, CK_SLOT_ID SlotNumber,
                 (unsigned int)(sinfp->version >> 16),
                 (unsigned int)(sinfp->version & 0xffff));
 
+    sltp->TokData->objstore = sinfp->objstore;
+    if (sinfp->objstore == OBJSTORE_LOG &&
+        sinfp->version < TOK_NEW_DATA_STORE) {
+        TRACE_ERROR("The log object store requires tokversion 3.12 or "
+                    "later.\n");
+        rc = CKR_FUNCTION_FAILED;
+        goto done;
+    }
+
     /* Check token store encryption against policy */
     newdatastore = sinfp->version >= TOK_NEW_DATA_STORE ? CK_TRUE : CK_FALSE;
     rc = policy->check_token_store(policy, newdatastore,
@@ -164,6 +178,7 @@ CK_RV ST_Initialize(API_Slot_t *sltp, CK_SLOT_ID SlotNumber,
             goto done;
         }
         sltp->TokData->initialized = TRUE;
+        openssl_algs_get();
     }
 
     rc = load_token_data(sltp->TokData, SlotNumber);
@@ -205,6 +220,11 @@ done:
             bt_destroy(&sltp->TokData->sess_obj_btree);
             bt_destroy(&sltp->TokData->priv_token_obj_btree);
             bt_destroy(&sltp->TokData->publ_token_obj_btree);
+            tok_obj_name_index_destroy(&sltp->TokData->priv_token_obj_index);
+            tok_obj_name_index_destroy(&sltp->TokData->publ_token_obj_index);
+            obj_attr_index_destroy(&sltp->TokData->sess_obj_attr_index);
+            obj_attr_index_destroy(&sltp->TokData->publ_token_obj_attr_index);
+            obj_attr_index_destroy(&sltp->TokData->priv_token_obj_attr_index);
         }
     }
 
@@ -248,6 +268,11 @@ CK_RV SC_Finalize(STDLL_TokData_t *tokdata, CK_SLOT_ID sid, SLOT_INFO *sinfp,
     bt_destroy(&tokdata->sess_obj_btree);
     bt_destroy(&tokdata->priv_token_obj_btree);
     bt_destroy(&tokdata->publ_token_obj_btree);
+    tok_obj_name_index_destroy(&tokdata->priv_token_obj_index);
+    tok_obj_name_index_destroy(&tokdata->publ_token_obj_index);
+    obj_attr_index_destroy(&tokdata->sess_obj_attr_index);
+    obj_attr_index_destroy(&tokdata->publ_token_obj_attr_index);
+    obj_attr_index_destroy(&tokdata->priv_token_obj_attr_index);
 
     detach_shm(tokdata, in_fork_initializer);
     /* close spin lock file */
@@ -255,10 +280,11 @@ CK_RV SC_Finalize(STDLL_TokData_t *tokdata, CK_SLOT_ID sid, SLOT_INFO *sinfp,
     rc = ep11tok_final(tokdata, in_fork_initializer);
     if (rc != CKR_OK) {
         TRACE_ERROR("Token specific final call failed.\n");
-        return rc;
     }
 
+    /* Release the token's resources even if the token specific final failed */
     final_data_store(tokdata);
+    openssl_algs_put();
 
     return rc;
 }
@@ -1989,6 +2015,67 @@ done:
 }
 
 
+CK_RV SC_IBM_FindObjectsGetAttributes(STDLL_TokData_t *tokdata,
+                                      ST_SESSION_HANDLE *sSession,
+                                      CK_ATTRIBUTE_TYPE *pTypes,
+                                      CK_ULONG ulTypeCount,
+                                      CK_BYTE_PTR pBuffer,
+                                      CK_ULONG_PTR pulBufferLen,
+                                      CK_ULONG_PTR pulObjectCount)
+{
+    SESSION *sess = NULL;
+    CK_RV rc = CKR_OK;
+
+    if (tokdata->initialized == FALSE) {
+        TRACE_ERROR("%s\n", ock_err(ERR_CRYPTOKI_NOT_INITIALIZED));
+        rc = CKR_CRYPTOKI_NOT_INITIALIZED;
+        goto done;
+    }
+
+    if ((!pTypes && ulTypeCount > 0) || !pBuffer || !pulBufferLen ||
+        !pulObjectCount) {
+        TRACE_ERROR("%s\n", ock_err(ERR_ARGUMENTS_BAD));
+        rc = CKR_ARGUMENTS_BAD;
+        goto done;
+    }
+
+    sess = session_mgr_find_reset_error(tokdata, sSession->sessionh);
+    if (!sess) {
+        TRACE_ERROR("%s\n", ock_err(ERR_SESSION_HANDLE_INVALID));
+        rc = CKR_SESSION_HANDLE_INVALID;
+        goto done;
+    }
+
+    if (sess->find_active == FALSE) {
+        TRACE_ERROR("%s\n", ock_err(ERR_OPERATION_NOT_INITIALIZED));
+        rc = CKR_OPERATION_NOT_INITIALIZED;
+        goto done;
+    }
+
+    if (!sess->find_list) {
+        TRACE_DEVEL("sess->find_list is NULL.\n");
+        rc = CKR_OPERATION_NOT_INITIALIZED;
+        goto done;
+    }
+
+    rc = object_mgr_find_get_attribute_values(tokdata, sess, pTypes,
+                                              ulTypeCount, pBuffer,
+                                              pulBufferLen, pulObjectCount);
+    if (rc != CKR_OK)
+        TRACE_DEVEL("object_mgr_find_get_attribute_values() failed.\n");
+
+done:
+    TRACE_INFO("C_IBM_FindObjectsGetAttributes: rc = 0x%08lx, "
+               "returned %lu objects\n", rc,
+               (rc == CKR_OK && pulObjectCount) ? *pulObjectCount : 0);
+
+    if (sess != NULL)
+        session_mgr_put(tokdata, sess);
+
+    return rc;
+}
+
+
 CK_RV SC_FindObjectsFinal(STDLL_TokData_t *tokdata,
                           ST_SESSION_HANDLE *sSession)
 {
@@ -4436,6 +4523,8 @@ void SC_SetFunctionList(void)
     function_list.ST_SessionCancel = SC_SessionCancel;
 
     function_list.ST_IBM_ReencryptSingle = SC_IBM_ReencryptSingle;
+    function_list.ST_IBM_FindObjectsGetAttributes =
+        SC_IBM_FindObjectsGetAttributes;
 
     function_list.ST_HandleEvent = SC_HandleEvent;
 }
@@ -563,6 +563,8 @@ void hsm_mk_change_op_clean(struct hsm_mk_change_op *op)
     hsm_mk_change_info_clean(&op->info);
     if (op->slots != NULL)
         free(op->slots);
+    if (op->slots_done != NULL)
+        free(op->slots_done);
     memset(op, 0, sizeof(*op));
 }
 
@@ -623,7 +625,7 @@ static FILE* hsm_mk_change_op_open(const char *id, CK_SLOT_ID slot_id,
 CK_RV hsm_mk_change_op_save(const struct hsm_mk_change_op *op)
 {
     struct hsm_mk_change_op_hdr *op_hdr;
-    size_t info_len = 0, slots_len, len;
+    size_t info_len = 0, slots_len, done_len = 0, len;
     unsigned char *buff = NULL;
     FILE *fp = NULL;
     CK_RV rc = CKR_OK;
@@ -637,7 +639,20 @@ CK_RV hsm_mk_change_op_save(const struct hsm_mk_change_op *op)
     if (rc != CKR_OK)
         return rc;
 
-    len = sizeof(struct hsm_mk_change_op_hdr) + info_len + slots_len;
+    /*
+     * The list of completed slots is optional and only written once the
+     * first slot is done, so that files of operations that have not made any
+     * progress yet keep the previous layout.
+     */
+    if (op->num_slots_done > 0) {
+        rc = hsm_mk_change_slots_flatten(op->slots_done, op->num_slots_done,
+                                         NULL, &done_len);
+        if (rc != CKR_OK)
+            return rc;
+    }
+
+    len = sizeof(struct hsm_mk_change_op_hdr) + info_len + slots_len +
+          done_len;
 
     buff = calloc(1, len);
     if (buff == NULL) {
@@ -662,6 +677,15 @@ CK_RV hsm_mk_change_op_save(const struct hsm_mk_change_op *op)
     if (rc != CKR_OK)
         goto out;
 
+    if (op->num_slots_done > 0) {
+        rc = hsm_mk_change_slots_flatten(op->slots_done, op->num_slots_done,
+                                         buff + sizeof(*op_hdr) + info_len +
+                                                                slots_len,
+                                         &done_len);
+        if (rc != CKR_OK)
+            goto out;
+    }
+
     fp = hsm_mk_change_op_open(op->id, -1, "w");
     if (fp == NULL) {
         rc = CKR_FUNCTION_FAILED;
@@ -687,7 +711,7 @@ CK_RV hsm_mk_change_op_load(const char *id, struct hsm_mk_change_op *op)
 {
     struct hsm_mk_change_op_hdr *op_hdr;
     struct stat sb;
-    size_t len, info_read = 0, slots_read;
+    size_t len, info_read = 0, slots_read, done_read = 0;
     FILE *fp;
     unsigned char *buff = NULL;
     CK_RV rc = CKR_OK;
@@ -737,9 +761,19 @@ CK_RV hsm_mk_change_op_load(const char *id, struct hsm_mk_change_op *op)
     if (rc != CKR_OK)
         goto out;
 
-    if (info_read + slots_read != len) {
+    if (info_read + slots_read < len) {
+        rc = hsm_mk_change_slots_unflatten(buff + sizeof(*op_hdr) + info_read +
+                                                                slots_read,
+                                           len - info_read - slots_read,
+                                           &done_read, &op->slots_done,
+                                           &op->num_slots_done);
+        if (rc != CKR_OK)
+            goto out;
+    }
+
+    if (info_read + slots_read + done_read != len) {
         TRACE_ERROR("Not all data read for file %s: len: %lu read: %lu\n",
-                    op->id, len, info_read + slots_read);
+                    op->id, len, info_read + slots_read + done_read);
         rc = CKR_FUNCTION_FAILED;
         goto out;
     }
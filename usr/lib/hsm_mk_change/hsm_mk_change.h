@@ -53,6 +53,9 @@ struct hsm_mk_change_op {
     struct hsm_mk_change_info info;
     CK_SLOT_ID *slots;
     unsigned int num_slots;
+    /* Slots whose token objects are completely re-enciphered */
+    CK_SLOT_ID *slots_done;
+    unsigned int num_slots_done;
 };
 
 CK_RV hsm_mk_change_apqns_flatten(const struct apqn *apqns,
@@ -135,6 +135,7 @@ token_spec_t token_specific = {
     NULL,                       // set_attribute_values
     NULL,                       // set_attrs_for_new_object
     NULL,                       // handle_event
+    NULL,                       // cipher_update
 };
 
 #endif
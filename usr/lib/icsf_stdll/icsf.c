@@ -23,6 +23,7 @@
 #include <ctype.h>
 #include <lber.h>
 #include <limits.h>
+#include <pthread.h>
 #include "icsf.h"
 
 /* For logging functions: */
@@ -30,6 +31,7 @@
 #include "host_defs.h"
 #include "h_extern.h"
 #include "trace.h"
+#include "attributes.h"
 
 /*
  * Note about ICSF callable services:
@@ -406,6 +408,109 @@ int icsf_sasl_login(LDAP ** ld, const char *uri, const char *cert,
     return 0;
 }
 
+/*
+ * LDAP handles that lost their connection to the server. A handle may be
+ * shared by several sessions, so it is only marked here by the request that
+ * noticed the failure and unbound by its owner once nobody uses it anymore.
+ */
+static pthread_mutex_t broken_ld_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LDAP **broken_ld = NULL;
+static size_t broken_ld_len = 0;
+static size_t broken_ld_size = 0;
+
+static void icsf_mark_broken(LDAP * ld)
+{
+    LDAP **tmp;
+    size_t i;
+
+    if (pthread_mutex_lock(&broken_ld_mutex)) {
+        TRACE_ERROR("Failed to lock mutex.\n");
+        return;
+    }
+
+    for (i = 0; i < broken_ld_len; i++) {
+        if (broken_ld[i] == ld)
+            goto done;
+    }
+
+    if (broken_ld_len == broken_ld_size) {
+        tmp = realloc(broken_ld, (broken_ld_size + 4) * sizeof(LDAP *));
+        if (tmp == NULL) {
+            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+            goto done;
+        }
+        broken_ld = tmp;
+        broken_ld_size += 4;
+    }
+    broken_ld[broken_ld_len++] = ld;
+    TRACE_DEVEL("LDAP connection %p lost.\n", (void *)ld);
+
+done:
+    if (pthread_mutex_unlock(&broken_ld_mutex))
+        TRACE_ERROR("Mutex Unlock failed.\n");
+}
+
+static void icsf_forget_broken(LDAP * ld)
+{
+    size_t i;
+
+    if (pthread_mutex_lock(&broken_ld_mutex)) {
+        TRACE_ERROR("Failed to lock mutex.\n");
+        return;
+    }
+
+    for (i = 0; i < broken_ld_len; i++) {
+        if (broken_ld[i] == ld) {
+            broken_ld[i] = broken_ld[--broken_ld_len];
+            break;
+        }
+    }
+    if (broken_ld_len == 0) {
+        free(broken_ld);
+        broken_ld = NULL;
+        broken_ld_size = 0;
+    }
+
+    if (pthread_mutex_unlock(&broken_ld_mutex))
+        TRACE_ERROR("Mutex Unlock failed.\n");
+}
+
+/*
+ * Check if the connection of an LDAP handle to the server was lost. Such a
+ * handle must not be used for further requests.
+ */
+int icsf_ldap_is_broken(LDAP * ld)
+{
+    int broken = 0;
+    size_t i;
+
+    if (pthread_mutex_lock(&broken_ld_mutex)) {
+        TRACE_ERROR("Failed to lock mutex.\n");
+        return 0;
+    }
+
+    for (i = 0; i < broken_ld_len; i++) {
+        if (broken_ld[i] == ld) {
+            broken = 1;
+            break;
+        }
+    }
+
+    if (pthread_mutex_unlock(&broken_ld_mutex))
+        TRACE_ERROR("Mutex Unlock failed.\n");
+
+    return broken;
+}
+
+/*
+ * Check if an LDAP result code means that the connection is unusable.
+ */
+static int icsf_ldap_conn_lost(int rc)
+{
+    return rc == LDAP_SERVER_DOWN || rc == LDAP_CONNECT_ERROR ||
+           rc == LDAP_TIMEOUT;
+}
+
 /*
  * Disconnect from the server.
  */
@@ -415,6 +520,8 @@ int icsf_logout(LDAP * ld)
 
     CHECK_ARG_NON_NULL(ld);
 
+    icsf_forget_broken(ld);
+
     rc = ldap_unbind_ext_s(ld, NULL, NULL);
     if (rc != LDAP_SUCCESS) {
         TRACE_ERROR("Failed to unbind: %s (%d)\n", ldap_err2string(rc), rc);
@@ -424,6 +531,241 @@ int icsf_logout(LDAP * ld)
     return 0;
 }
 
+/*
+ * Initialize a pool of at most `size` LDAP connections. New connections are
+ * bound by calling `connect` with `private` as argument.
+ */
+int icsf_ldap_pool_init(struct icsf_ldap_pool *pool, unsigned int size,
+                        LDAP *(*connect)(void *private), void *private)
+{
+    CHECK_ARG_NON_NULL(pool);
+    CHECK_ARG_NON_NULL(connect);
+
+    if (size < 1 || size > ICSF_LDAP_POOL_MAX_SIZE) {
+        TRACE_ERROR("Invalid LDAP connection pool size: %u\n", size);
+        return -1;
+    }
+
+    memset(pool, 0, sizeof(*pool));
+    pool->size = size;
+    pool->connect = connect;
+    pool->private = private;
+
+    if (pthread_mutex_init(&pool->mutex, NULL) != 0) {
+        TRACE_ERROR("Initializing LDAP connection pool lock failed.\n");
+        return -1;
+    }
+
+    if (pthread_cond_init(&pool->cond, NULL) != 0) {
+        TRACE_ERROR("Initializing LDAP connection pool condition failed.\n");
+        pthread_mutex_destroy(&pool->mutex);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Release the resources of a pool. All connections must have been closed
+ * with icsf_ldap_pool_close() before.
+ */
+void icsf_ldap_pool_destroy(struct icsf_ldap_pool *pool)
+{
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->mutex);
+}
+
+/*
+ * Unbind a broken connection and remove it from the pool. The pool lock must
+ * be held by the caller.
+ */
+static void icsf_ldap_pool_drop(struct icsf_ldap_pool *pool, unsigned int i)
+{
+    LDAP *ld = pool->conns[i].ld;
+
+    TRACE_DEVEL("Dropping broken LDAP connection %p from the pool.\n",
+                (void *)ld);
+
+    icsf_forget_broken(ld);
+    ldap_unbind_ext(ld, NULL, NULL);
+
+    pool->conns[i] = pool->conns[--pool->len];
+    pool->conns[pool->len].ld = NULL;
+    pool->conns[pool->len].users = 0;
+}
+
+/*
+ * Find the least used healthy connection of the pool, and drop the broken
+ * connections nobody uses anymore. Returns the number of healthy
+ * connections. The pool lock must be held by the caller.
+ */
+static unsigned int icsf_ldap_pool_scan(struct icsf_ldap_pool *pool,
+                                        struct icsf_ldap_conn **least_used)
+{
+    unsigned int i = 0, healthy = 0;
+
+    *least_used = NULL;
+    while (i < pool->len) {
+        if (!icsf_ldap_is_broken(pool->conns[i].ld)) {
+            healthy++;
+            if (*least_used == NULL ||
+                pool->conns[i].users < (*least_used)->users)
+                *least_used = &pool->conns[i];
+        } else if (pool->conns[i].users == 0) {
+            icsf_ldap_pool_drop(pool, i);
+            continue;
+        }
+        i++;
+    }
+
+    return healthy;
+}
+
+/*
+ * Borrow an authenticated LDAP connection from the pool. A new connection is
+ * bound while the pool is not full and all pooled connections are in use,
+ * otherwise the least used connection is shared. Broken connections are never
+ * handed out, and do not count against the pool size.
+ *
+ * The bind is done without holding the pool lock, so that other sessions can
+ * share the pooled connections meanwhile. Only if there is no connection to
+ * share, they wait for the bind to complete.
+ */
+LDAP *icsf_ldap_pool_get(struct icsf_ldap_pool *pool)
+{
+    struct icsf_ldap_conn *conn;
+    unsigned int healthy;
+    LDAP *ld = NULL, *new_ld;
+
+    if (pthread_mutex_lock(&pool->mutex)) {
+        TRACE_ERROR("Failed to lock mutex.\n");
+        return NULL;
+    }
+
+    for (;;) {
+        healthy = icsf_ldap_pool_scan(pool, &conn);
+        if ((conn == NULL || conn->users > 0) &&
+            healthy + pool->connecting < pool->size &&
+            pool->len + pool->connecting < ICSF_LDAP_POOL_MAX_SIZE)
+            break;
+
+        if (conn != NULL) {
+            conn->users++;
+            ld = conn->ld;
+            goto done;
+        }
+
+        if (pool->connecting == 0)
+            goto done;
+
+        pthread_cond_wait(&pool->cond, &pool->mutex);
+    }
+
+    /* Reserve a slot for the new connection and bind it unlocked */
+    pool->connecting++;
+
+    if (pthread_mutex_unlock(&pool->mutex)) {
+        TRACE_ERROR("Mutex Unlock failed.\n");
+        return NULL;
+    }
+
+    new_ld = pool->connect(pool->private);
+
+    if (pthread_mutex_lock(&pool->mutex)) {
+        TRACE_ERROR("Failed to lock mutex.\n");
+        if (new_ld != NULL)
+            ldap_unbind_ext(new_ld, NULL, NULL);
+        return NULL;
+    }
+
+    pool->connecting--;
+    if (new_ld != NULL) {
+        conn = &pool->conns[pool->len++];
+        conn->ld = new_ld;
+        conn->users = 1;
+        ld = new_ld;
+        TRACE_DEVEL("Added LDAP connection %u to the pool.\n", pool->len);
+    } else {
+        /* Share a pooled connection instead, if there is any */
+        icsf_ldap_pool_scan(pool, &conn);
+        if (conn != NULL) {
+            conn->users++;
+            ld = conn->ld;
+        }
+    }
+    pthread_cond_broadcast(&pool->cond);
+
+done:
+    if (pthread_mutex_unlock(&pool->mutex)) {
+        TRACE_ERROR("Mutex Unlock failed.\n");
+        return NULL;
+    }
+
+    return ld;
+}
+
+/*
+ * Give a borrowed LDAP connection back to the pool. The connection stays
+ * bound for later sessions, unless it is broken and this was its last user.
+ */
+void icsf_ldap_pool_put(struct icsf_ldap_pool *pool, LDAP * ld)
+{
+    unsigned int i;
+
+    if (pthread_mutex_lock(&pool->mutex)) {
+        TRACE_ERROR("Failed to lock mutex.\n");
+        return;
+    }
+
+    for (i = 0; i < pool->len; i++) {
+        if (pool->conns[i].ld == ld) {
+            if (pool->conns[i].users > 0)
+                pool->conns[i].users--;
+            if (pool->conns[i].users == 0 && icsf_ldap_is_broken(ld))
+                icsf_ldap_pool_drop(pool, i);
+            break;
+        }
+    }
+
+    if (pthread_mutex_unlock(&pool->mutex))
+        TRACE_ERROR("Mutex Unlock failed.\n");
+}
+
+/*
+ * Unbind all pooled LDAP connections. If `forget` is set, the connections
+ * belong to another process (e.g. the parent of a fork) and are only
+ * forgotten.
+ */
+int icsf_ldap_pool_close(struct icsf_ldap_pool *pool, int forget)
+{
+    unsigned int i;
+    int rc = 0;
+
+    if (pthread_mutex_lock(&pool->mutex)) {
+        TRACE_ERROR("Failed to lock mutex.\n");
+        return -1;
+    }
+
+    for (i = 0; i < pool->len; i++) {
+        if (forget) {
+            icsf_forget_broken(pool->conns[i].ld);
+        } else if (icsf_logout(pool->conns[i].ld)) {
+            TRACE_DEVEL("Failed to disconnect from LDAP server.\n");
+            rc = -1;
+        }
+        pool->conns[i].ld = NULL;
+        pool->conns[i].users = 0;
+    }
+    pool->len = 0;
+
+    if (pthread_mutex_unlock(&pool->mutex)) {
+        TRACE_ERROR("Mutex Unlock failed.\n");
+        return -1;
+    }
+
+    return rc;
+}
+
 /*
  * Check if the ICSF LDAP extension is supported by the server.
  */
@@ -538,6 +880,9 @@ static int icsf_call(LDAP * ld, int *reason, char *handle, size_t handle_len,
     struct berval *raw_res = NULL;
     struct berval *raw_specific = NULL;
     char *response_oid = NULL;
+    LDAPMessage *ldap_res = NULL;
+    char *ext_msg = NULL;
+    int msgid, err = LDAP_SUCCESS;
 
     /* Variables used as input */
     int version = 1;
@@ -636,18 +981,55 @@ static int icsf_call(LDAP * ld, int *reason, char *handle, size_t handle_len,
         goto cleanup;
     }
 
-    /* Call ICSF service */
-    rc = ldap_extended_operation_s(ld, ICSF_REQ_OID, raw_req, NULL, NULL,
-                                   &response_oid, &raw_res);
+    /*
+     * Call ICSF service. The connection may be shared by several sessions,
+     * so the request is sent asynchronously and only the response with its
+     * message ID is collected. Requests of other sessions stay in flight on
+     * the same connection meanwhile.
+     */
+    rc = ldap_extended_operation(ld, ICSF_REQ_OID, raw_req, NULL, NULL,
+                                 &msgid);
+    if (rc != LDAP_SUCCESS) {
+        TRACE_ERROR("Failed to send ICSF request: %s (%d)\n",
+                    ldap_err2string(rc), rc);
+        if (icsf_ldap_conn_lost(rc))
+            icsf_mark_broken(ld);
+        rc = -1;
+        goto cleanup;
+    }
+
+    /*
+     * Without a timeout, ldap_result() blocks until the response arrives or
+     * fails. A lost connection may still have responses of other requests
+     * pending, so it is only marked as broken and dropped when given back to
+     * the pool by its last user.
+     */
+    if (ldap_result(ld, msgid, LDAP_MSG_ALL, NULL, &ldap_res) == -1) {
+        rc = LDAP_OTHER;
+        ldap_get_option(ld, LDAP_OPT_RESULT_CODE, &rc);
+    } else {
+        rc = LDAP_SUCCESS;
+    }
+    if (rc != LDAP_SUCCESS) {
+        TRACE_ERROR("Failed to receive ICSF response: %s (%d)\n",
+                    ldap_err2string(rc), rc);
+        if (icsf_ldap_conn_lost(rc))
+            icsf_mark_broken(ld);
+        rc = -1;
+        goto cleanup;
+    }
+
+    rc = ldap_parse_extended_result(ld, ldap_res, &response_oid, &raw_res, 0);
+    if (rc == LDAP_SUCCESS)
+        rc = ldap_parse_result(ld, ldap_res, &err, NULL, &ext_msg, NULL,
+                               NULL, 0);
+    if (rc == LDAP_SUCCESS)
+        rc = err;
     if (rc != LDAP_SUCCESS) {
-        char *ext_msg = NULL;
-        ldap_get_option(ld, LDAP_OPT_DIAGNOSTIC_MESSAGE, &ext_msg);
         TRACE_ERROR("ICSF call failed: %s (%d)%s%s\n",
                     ldap_err2string(rc), rc,
                     ext_msg ? "\nDetailed message: " : "",
                     ext_msg ? ext_msg : "");
-        if (ext_msg)
-            ldap_memfree(ext_msg);
         rc = -1;
         goto cleanup;
     }
@@ -702,6 +1084,10 @@ cleanup:
         ber_bvfree(raw_res);
     if (response_oid)
         ldap_memfree(response_oid);
+    if (ext_msg)
+        ldap_memfree(ext_msg);
+    if (ldap_res)
+        ldap_msgfree(ldap_res);
     if (out_handle)
         ber_bvfree(out_handle);
     if (raw_specific)
@@ -2145,23 +2531,36 @@ done:
     return rc;
 }
 
+/*
+ * Decode the attribute list of a CSFPGAV response:
+ *
+ * asn.1 {{{ito|i} {ito|i} ...}i}
+ *
+ * `cb` is called with the type and value of each attribute in the list. The
+ * value of an integer attribute is passed as CK_ULONG. Decoding stops at the
+ * end of the list, when `cb` sets `*done`, or when it returns non-zero, which
+ * is then returned.
+ */
 static int icsf_ber_decode_get_attribute_list(BerElement * berbuf,
-                                              CK_ATTRIBUTE * attrs,
-                                              CK_ULONG attrs_len,
-                                              int *reason)
+                                              int (*cb)(CK_ATTRIBUTE_TYPE type,
+                                                        const void *value,
+                                                        CK_ULONG value_len,
+                                                        void *private,
+                                                        int *done),
+                                              void *private)
 {
     int attrtype;
     struct berval attrbval = { 0, NULL };
     ber_int_t intval;
-    unsigned int i;
-    CK_ULONG found = 0;
+    CK_ULONG ulval;
     ber_tag_t tag;
+    int done = 0;
     int rc = 0;
 
     if (ber_scanf(berbuf, "{{") == LBER_ERROR)
         goto decode_error;
 
-    while (1) {
+    while (!done) {
 
         /* get tag preceding sequence */
         if (ber_scanf(berbuf, "t", &tag) == LBER_ERROR)
@@ -2177,64 +2576,25 @@ static int icsf_ber_decode_get_attribute_list(BerElement * berbuf,
         if ((tag & LBER_BIG_TAG_MASK) == 0) {
             if (ber_scanf(berbuf, "o}", &attrbval) == LBER_ERROR)
                 goto decode_error;
+            rc = cb((CK_ATTRIBUTE_TYPE)attrtype, attrbval.bv_val,
+                    attrbval.bv_len, private, &done);
         } else {
             if (ber_scanf(berbuf, "i}", &intval) == LBER_ERROR)
                 goto decode_error;
-            attrbval.bv_len = sizeof(CK_ULONG);
-        }
-
-        /* see if this type matches any that we need to
-         * get value for. if so, then get the value, otherwise
-         * continue until we have found all of them or there
-         * are no  more attributes to search
-         */
-        for (i = 0; i < attrs_len; i++) {
-            if (attrs[i].type != (CK_ATTRIBUTE_TYPE)attrtype)
-                continue;
-
-            /* we have decoded attribute, now add the values */
-            if (attrs[i].pValue == NULL) {
-                attrs[i].ulValueLen = attrbval.bv_len;
-            } else if (attrs[i].ulValueLen >= attrbval.bv_len) {
-                if ((tag & LBER_BIG_TAG_MASK) == 0) {
-                    memcpy(attrs[i].pValue, attrbval.bv_val, attrbval.bv_len);
-                } else {
-                    *((CK_ULONG *) attrs[i].pValue) = intval;
-                }
-                attrs[i].ulValueLen = attrbval.bv_len;
-            } else {
-                rc = 8;
-                *reason = 3003; /* CKR_BUFFER_TOO_SMALL */
-                attrs[i].ulValueLen = -1;
-                goto decode_error;
-            }
-
-            /* keep count of how many are found. */
-            found++;
+            ulval = intval;
+            rc = cb((CK_ATTRIBUTE_TYPE)attrtype, &ulval, sizeof(ulval),
+                    private, &done);
         }
 
         if (attrbval.bv_val != NULL)
             ber_memfree(attrbval.bv_val);
         attrbval.bv_val = NULL;
 
-        /* if we have found all the values for our list, then
-         * we are done.
-         */
-        if (found == attrs_len)
-            break;
-    }
-
-    /* if we have gone through the entire loop and could not find
-     * all of the attributes in our list, mark this as an error.
-     */
-    if (found < attrs_len) {
-        TRACE_ERROR("%s\n", ock_err(ERR_ATTRIBUTE_TYPE_INVALID));
-        rc = 8;
-        *reason = 3029; /* CKR_ATTRIBUTE_TYPE_INVALID */
-        goto decode_error;
+        if (rc != 0)
+            return rc;
     }
 
-    return rc;
+    return 0;
 
 decode_error:
     TRACE_ERROR("Failed to decode message.\n");
@@ -2242,7 +2602,96 @@ decode_error:
     if (attrbval.bv_val != NULL)
         ber_memfree(attrbval.bv_val);
 
-    return rc;
+    return -1;
+}
+
+struct get_attribute_data {
+    CK_ATTRIBUTE *attrs;
+    CK_ULONG attrs_len;
+    CK_ULONG found;
+    int *reason;
+};
+
+/*
+ * Copy a decoded attribute value into the caller's template, see
+ * icsf_get_attribute().
+ */
+static int icsf_get_attribute_cb(CK_ATTRIBUTE_TYPE type, const void *value,
+                                 CK_ULONG value_len, void *private, int *done)
+{
+    struct get_attribute_data *data = private;
+    CK_ATTRIBUTE *attrs = data->attrs;
+    unsigned int i;
+
+    /* see if this type matches any that we need to
+     * get value for. if so, then get the value, otherwise
+     * continue until we have found all of them or there
+     * are no  more attributes to search
+     */
+    for (i = 0; i < data->attrs_len; i++) {
+        if (attrs[i].type != type)
+            continue;
+
+        /* we have decoded attribute, now add the values */
+        if (attrs[i].pValue == NULL) {
+            attrs[i].ulValueLen = value_len;
+        } else if (attrs[i].ulValueLen >= value_len) {
+            memcpy(attrs[i].pValue, value, value_len);
+            attrs[i].ulValueLen = value_len;
+        } else {
+            TRACE_ERROR("Failed to decode message.\n");
+            *data->reason = 3003; /* CKR_BUFFER_TOO_SMALL */
+            attrs[i].ulValueLen = -1;
+            return 8;
+        }
+
+        /* keep count of how many are found. */
+        data->found++;
+    }
+
+    /* if we have found all the values for our list, then
+     * we are done.
+     */
+    if (data->found == data->attrs_len)
+        *done = 1;
+
+    return 0;
+}
+
+struct get_attribute_list_data {
+    const CK_ATTRIBUTE_TYPE *types;
+    CK_ULONG types_len;
+    CK_ATTRIBUTE *list;
+    CK_ULONG list_len;
+};
+
+/*
+ * Add a decoded attribute to a newly built attribute array, see
+ * icsf_get_attribute_list().
+ */
+static int icsf_get_attribute_list_cb(CK_ATTRIBUTE_TYPE type,
+                                      const void *value, CK_ULONG value_len,
+                                      void *private, int *done)
+{
+    struct get_attribute_list_data *data = private;
+    unsigned int i;
+    CK_RV rv;
+
+    for (i = 0; i < data->types_len; i++) {
+        if (data->types[i] != type)
+            continue;
+
+        rv = add_to_attribute_array(&data->list, &data->list_len, type,
+                                    (CK_BYTE *)value, value_len);
+        if (rv != CKR_OK)
+            return rv;
+        break;
+    }
+
+    if (data->list_len == data->types_len)
+        *done = 1;
+
+    return 0;
 }
 
 int icsf_get_attribute(LDAP * ld, int *reason,
@@ -2253,6 +2702,7 @@ int icsf_get_attribute(LDAP * ld, int *reason,
     char handle[ICSF_HANDLE_LEN];
     BerElement *msg = NULL;
     BerElement *result = NULL;
+    struct get_attribute_data data;
     unsigned int i;
     int rc = 0;
 
@@ -2302,12 +2752,26 @@ int icsf_get_attribute(LDAP * ld, int *reason,
      *
      * asn.1 {{{ito|i} {ito|i} ...}i}
      */
-    rc = icsf_ber_decode_get_attribute_list(result, attrs, attrs_len, reason);
+    data.attrs = attrs;
+    data.attrs_len = attrs_len;
+    data.found = 0;
+    data.reason = reason;
+    rc = icsf_ber_decode_get_attribute_list(result, icsf_get_attribute_cb,
+                                            &data);
     if (rc < 0) {
         TRACE_ERROR("Failed to decode message.\n");
         goto cleanup;
     }
 
+    /* if we have gone through the entire list and could not find
+     * all of the attributes in our list, mark this as an error.
+     */
+    if (rc == 0 && data.found < attrs_len) {
+        TRACE_ERROR("%s\n", ock_err(ERR_ATTRIBUTE_TYPE_INVALID));
+        rc = 8;
+        *reason = 3029; /* CKR_ATTRIBUTE_TYPE_INVALID */
+    }
+
 cleanup:
     if (msg)
         ber_free(msg, 1);
@@ -2318,6 +2782,68 @@ cleanup:
     return rc;
 }
 
+/*
+ * Get the values of several attributes of an object with a single call. The
+ * values of the attribute types in `types` that the object has are returned
+ * in a newly allocated attribute array, that must be freed with
+ * free_attribute_array(). Unlike icsf_get_attribute(), attributes the
+ * object does not have are silently left out.
+ */
+int icsf_get_attribute_list(LDAP * ld, int *reason,
+                            struct icsf_object_record *object,
+                            const CK_ATTRIBUTE_TYPE * types, CK_ULONG types_len,
+                            CK_ATTRIBUTE ** attrs, CK_ULONG * attrs_len)
+{
+    char handle[ICSF_HANDLE_LEN];
+    BerElement *msg = NULL;
+    BerElement *result = NULL;
+    struct get_attribute_list_data data = { types, types_len, NULL, 0 };
+    int rc = 0;
+
+    CHECK_ARG_NON_NULL(ld);
+    CHECK_ARG_NON_NULL(object);
+    CHECK_ARG_NON_NULL(types);
+    CHECK_ARG_NON_NULL(attrs);
+    CHECK_ARG_NON_NULL(attrs_len);
+
+    object_record_to_handle(handle, object);
+
+    if (!(msg = ber_alloc_t(LBER_USE_DER))) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        return CKR_HOST_MEMORY;
+    }
+
+    rc = ber_printf(msg, "i", types_len);
+    if (rc < 0)
+        goto cleanup;
+
+    rc = icsf_call(ld, reason, handle, sizeof(handle), "", 0,
+                   ICSF_TAG_CSFPGAV, msg, &result);
+    if (rc != 0) {
+        TRACE_DEVEL("icsf_call failed.\n");
+        goto cleanup;
+    }
+
+    rc = icsf_ber_decode_get_attribute_list(result, icsf_get_attribute_list_cb,
+                                            &data);
+    if (rc != 0)
+        goto cleanup;
+
+    *attrs = data.list;
+    *attrs_len = data.list_len;
+    data.list = NULL;
+
+cleanup:
+    if (data.list)
+        free_attribute_array(data.list, data.list_len);
+    if (msg)
+        ber_free(msg, 1);
+    if (result)
+        ber_free(result, 1);
+
+    return rc;
+}
+
 int icsf_set_attribute(LDAP * ld, int *reason,
                        struct icsf_object_record *object, CK_ATTRIBUTE * attrs,
                        CK_ULONG attrs_len)
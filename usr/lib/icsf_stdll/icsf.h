@@ -20,6 +20,7 @@
 
 #include <ldap.h>
 #include <lber.h>
+#include <pthread.h>
 #include "pkcs11types.h"
 
 /* OIDs used for PKCS extension */
@@ -134,6 +135,48 @@ int icsf_sasl_login(LDAP ** ld, const char *uri, const char *cert,
 
 int icsf_logout(LDAP * ld);
 
+int icsf_ldap_is_broken(LDAP * ld);
+
+/* Default and upper limit of pooled LDAP connections per slot */
+#define ICSF_LDAP_POOL_DEFAULT_SIZE     4
+#define ICSF_LDAP_POOL_MAX_SIZE         64
+
+/*
+ * An authenticated LDAP connection of the pool. Requests of all sessions
+ * borrowing the connection are multiplexed on it by LDAP message ID.
+ */
+struct icsf_ldap_conn {
+    LDAP *ld;
+    unsigned int users;
+};
+
+/*
+ * Pool of authenticated LDAP connections. New connections are bound via the
+ * connect callback, without holding the pool lock. Connections being bound
+ * are counted in `connecting`, and `cond` is signaled when they are done.
+ */
+struct icsf_ldap_pool {
+    struct icsf_ldap_conn conns[ICSF_LDAP_POOL_MAX_SIZE];
+    unsigned int len;
+    unsigned int connecting;
+    unsigned int size;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    LDAP *(*connect)(void *private);
+    void *private;
+};
+
+int icsf_ldap_pool_init(struct icsf_ldap_pool *pool, unsigned int size,
+                        LDAP *(*connect)(void *private), void *private);
+
+void icsf_ldap_pool_destroy(struct icsf_ldap_pool *pool);
+
+LDAP *icsf_ldap_pool_get(struct icsf_ldap_pool *pool);
+
+void icsf_ldap_pool_put(struct icsf_ldap_pool *pool, LDAP * ld);
+
+int icsf_ldap_pool_close(struct icsf_ldap_pool *pool, int forget);
+
 int icsf_check_pkcs_extension(LDAP * ld);
 
 int icsf_create_token(LDAP * ld, int *reason, const char *token_name,
@@ -184,6 +227,11 @@ int icsf_get_attribute(LDAP * ld, int *reason,
                        struct icsf_object_record *object, CK_ATTRIBUTE * attrs,
                        CK_ULONG attrs_len);
 
+int icsf_get_attribute_list(LDAP * ld, int *reason,
+                            struct icsf_object_record *object,
+                            const CK_ATTRIBUTE_TYPE * types, CK_ULONG types_len,
+                            CK_ATTRIBUTE ** attrs, CK_ULONG * attrs_len);
+
 int icsf_set_attribute(LDAP * ld, int *reason,
                        struct icsf_object_record *object, CK_ATTRIBUTE * attrs,
                        CK_ULONG attrs_len);
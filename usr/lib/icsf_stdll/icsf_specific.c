@@ -42,6 +42,7 @@
 #include "attributes.h"
 #include "../api/apiproto.h"
 #include "trace.h"
+#include "ock_syslog.h"
 #include "shared_memory.h"
 #include "slotmgr.h"
 #include "../api/policy.h"
@@ -150,6 +151,20 @@ struct icsf_object_mapping {
     CK_SESSION_HANDLE session_id;
     struct icsf_object_record icsf_object;
     struct objstrength strength;
+
+    /* Cached immutable attributes, see icsf_cached_attr_types */
+    CK_BBOOL attr_cache_valid;
+    CK_ATTRIBUTE *attr_cache;
+    CK_ULONG attr_cache_len;
+};
+
+/*
+ * Attributes that cannot change during the lifetime of an object. They are
+ * fetched with a single ICSF call on first use and kept in the mapping.
+ */
+static const CK_ATTRIBUTE_TYPE icsf_cached_attr_types[] = {
+    CKA_CLASS, CKA_KEY_TYPE, CKA_MODULUS_BITS, CKA_MODULUS, CKA_PRIME,
+    CKA_SUBPRIME, CKA_EC_PARAMS, CKA_VALUE_LEN,
 };
 
 /*
@@ -164,12 +179,157 @@ struct icsf_multi_part_context {
 };
 
 struct icsf_policy_attr {
+    STDLL_TokData_t *tokdata;
     LDAP *ld;
-    struct icsf_object_record *icsf_object;
+    struct icsf_object_mapping *mapping;
 };
 
 int icsf_to_ock_err(int icsf_return_code, int icsf_reason_code);
 
+static void icsf_object_mapping_free(void *value)
+{
+    struct icsf_object_mapping *mapping = value;
+
+    if (mapping->attr_cache != NULL)
+        free_attribute_array(mapping->attr_cache, mapping->attr_cache_len);
+    free(mapping);
+}
+
+static CK_BBOOL icsf_attr_is_cached(CK_ATTRIBUTE_TYPE type)
+{
+    CK_ULONG i;
+
+    for (i = 0; i < sizeof(icsf_cached_attr_types) /
+                    sizeof(icsf_cached_attr_types[0]); i++) {
+        if (icsf_cached_attr_types[i] == type)
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Drop the cached attributes of an object, e.g. after they were modified.
+ */
+static void icsf_attr_cache_invalidate(STDLL_TokData_t * tokdata,
+                                       struct icsf_object_mapping *mapping)
+{
+    icsf_private_data_t *icsf_data = tokdata->private_data;
+    CK_ATTRIBUTE *attrs;
+    CK_ULONG attrs_len;
+
+    if (pthread_mutex_lock(&icsf_data->attr_cache_mutex)) {
+        TRACE_ERROR("Failed to lock mutex.\n");
+        return;
+    }
+
+    attrs = mapping->attr_cache;
+    attrs_len = mapping->attr_cache_len;
+    mapping->attr_cache = NULL;
+    mapping->attr_cache_len = 0;
+    mapping->attr_cache_valid = FALSE;
+
+    if (pthread_mutex_unlock(&icsf_data->attr_cache_mutex))
+        TRACE_ERROR("Mutex Unlock failed.\n");
+
+    if (attrs != NULL)
+        free_attribute_array(attrs, attrs_len);
+}
+
+/*
+ * Get attribute values from the attribute cache of an object, filling the
+ * cache with a single ICSF call first if needed. The values are returned
+ * like C_GetAttributeValue does. *found is set to FALSE if not all
+ * attributes of the template are available from the cache, the caller must
+ * then ask ICSF.
+ */
+static CK_RV icsf_attr_cache_lookup(STDLL_TokData_t * tokdata, LDAP * ld,
+                                    struct icsf_object_mapping *mapping,
+                                    CK_ATTRIBUTE * pTemplate, CK_ULONG ulCount,
+                                    CK_BBOOL * found)
+{
+    icsf_private_data_t *icsf_data = tokdata->private_data;
+    CK_ATTRIBUTE *attrs = NULL, *attr;
+    CK_ULONG attrs_len = 0, i;
+    CK_RV rc = CKR_OK;
+    int reason = 0;
+
+    *found = FALSE;
+
+    for (i = 0; i < ulCount; i++) {
+        if (!icsf_attr_is_cached(pTemplate[i].type))
+            return CKR_OK;
+    }
+
+    if (pthread_mutex_lock(&icsf_data->attr_cache_mutex)) {
+        TRACE_ERROR("Failed to lock mutex.\n");
+        return CKR_CANT_LOCK;
+    }
+
+    if (!mapping->attr_cache_valid) {
+        icsf_data->attr_cache_misses++;
+        if (pthread_mutex_unlock(&icsf_data->attr_cache_mutex)) {
+            TRACE_ERROR("Mutex Unlock failed.\n");
+            return CKR_CANT_LOCK;
+        }
+
+        if (icsf_get_attribute_list(ld, &reason, &mapping->icsf_object,
+                                    icsf_cached_attr_types,
+                                    sizeof(icsf_cached_attr_types) /
+                                    sizeof(icsf_cached_attr_types[0]),
+                                    &attrs, &attrs_len) != 0) {
+            TRACE_DEVEL("icsf_get_attribute_list failed\n");
+            return CKR_OK;
+        }
+
+        if (pthread_mutex_lock(&icsf_data->attr_cache_mutex)) {
+            TRACE_ERROR("Failed to lock mutex.\n");
+            free_attribute_array(attrs, attrs_len);
+            return CKR_CANT_LOCK;
+        }
+
+        if (!mapping->attr_cache_valid) {
+            mapping->attr_cache = attrs;
+            mapping->attr_cache_len = attrs_len;
+            mapping->attr_cache_valid = TRUE;
+            attrs = NULL;
+        }
+    } else {
+        icsf_data->attr_cache_hits++;
+    }
+
+    for (i = 0; i < ulCount; i++) {
+        if (get_attribute_by_type(mapping->attr_cache, mapping->attr_cache_len,
+                                  pTemplate[i].type) == NULL)
+            goto done;
+    }
+
+    for (i = 0; i < ulCount; i++) {
+        attr = get_attribute_by_type(mapping->attr_cache,
+                                     mapping->attr_cache_len,
+                                     pTemplate[i].type);
+        if (pTemplate[i].pValue == NULL) {
+            pTemplate[i].ulValueLen = attr->ulValueLen;
+        } else if (pTemplate[i].ulValueLen >= attr->ulValueLen) {
+            memcpy(pTemplate[i].pValue, attr->pValue, attr->ulValueLen);
+            pTemplate[i].ulValueLen = attr->ulValueLen;
+        } else {
+            pTemplate[i].ulValueLen = CK_UNAVAILABLE_INFORMATION;
+            rc = CKR_BUFFER_TOO_SMALL;
+        }
+    }
+    *found = TRUE;
+
+done:
+    if (pthread_mutex_unlock(&icsf_data->attr_cache_mutex))
+        TRACE_ERROR("Mutex Unlock failed.\n");
+
+    if (attrs != NULL)
+        free_attribute_array(attrs, attrs_len);
+
+    return rc;
+}
+
 static CK_RV icsf_policy_get_attr(void *data,
                                   CK_ATTRIBUTE_TYPE type,
                                   CK_ATTRIBUTE **attr)
@@ -179,8 +339,31 @@ static CK_RV icsf_policy_get_attr(void *data,
     struct icsf_policy_attr *d = data;
     CK_ATTRIBUTE *a;
     CK_ATTRIBUTE s = { .type = type, .ulValueLen = 0, .pValue = NULL };
-    
-    rc = icsf_get_attribute(d->ld, &reason, d->icsf_object, &s, 1);
+    CK_BBOOL found;
+
+    rc = icsf_attr_cache_lookup(d->tokdata, d->ld, d->mapping, &s, 1, &found);
+    if (rc != CKR_OK)
+        return rc;
+    if (found) {
+        a = (CK_ATTRIBUTE *) malloc(sizeof(CK_ATTRIBUTE) + s.ulValueLen);
+        if (!a) {
+            TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+            return CKR_HOST_MEMORY;
+        }
+        a->type = type;
+        a->ulValueLen = s.ulValueLen;
+        a->pValue = (CK_BYTE *) a + sizeof(CK_ATTRIBUTE);
+        rc = icsf_attr_cache_lookup(d->tokdata, d->ld, d->mapping, a, 1,
+                                    &found);
+        if (rc != CKR_OK || !found) {
+            free(a);
+            return rc != CKR_OK ? rc : CKR_FUNCTION_FAILED;
+        }
+        *attr = a;
+        return CKR_OK;
+    }
+
+    rc = icsf_get_attribute(d->ld, &reason, &d->mapping->icsf_object, &s, 1);
     if (rc != CKR_OK) {
         TRACE_DEVEL("icsf_get_attribute failed\n");
         return icsf_to_ock_err(rc, reason);
@@ -198,7 +381,7 @@ static CK_RV icsf_policy_get_attr(void *data,
     a->type = type;
     a->ulValueLen = s.ulValueLen;
     a->pValue = (CK_BYTE *) a + sizeof(CK_ATTRIBUTE);
-    rc = icsf_get_attribute(d->ld, &reason, d->icsf_object, a, 1);
+    rc = icsf_get_attribute(d->ld, &reason, &d->mapping->icsf_object, a, 1);
     if (rc != CKR_OK) {
         TRACE_DEVEL("icsf_get_attribute failed\n");
         free(a);
@@ -213,6 +396,22 @@ static void icsf_policy_free_attr(CK_ATTRIBUTE *attr)
     free(attr);
 }
 
+/*
+ * Look up the session specific structure.
+ *
+ * Must be called with sess_list_mutex locked.
+ */
+static struct session_state *find_session_state(icsf_private_data_t *icsf_data,
+                                                CK_SESSION_HANDLE session_id)
+{
+    union hashmap_value val;
+
+    if (!hashmap_find(icsf_data->sessions_map, session_id, &val))
+        return NULL;
+
+    return val.pVal;
+}
+
 /*
  * Get the session specific structure.
  */
@@ -220,8 +419,7 @@ static struct session_state *get_session_state(STDLL_TokData_t * tokdata,
                                                CK_SESSION_HANDLE session_id)
 {
     icsf_private_data_t *icsf_data = tokdata->private_data;
-    struct session_state *found = NULL;
-    struct session_state *s;
+    struct session_state *found;
 
     /* Lock sessions list */
     if (pthread_mutex_lock(&icsf_data->sess_list_mutex)) {
@@ -229,14 +427,14 @@ static struct session_state *get_session_state(STDLL_TokData_t * tokdata,
         return NULL;
     }
 
-    for_each_list_entry(&icsf_data->sessions, struct session_state, s, sessions) {
-        if (s->session_id == session_id) {
-            found = s;
-            goto done;
-        }
+    found = find_session_state(icsf_data, session_id);
+
+    /* Replace a connection that was lost by a fresh one from the pool */
+    if (found && found->ld && icsf_ldap_is_broken(found->ld)) {
+        icsf_ldap_pool_put(&icsf_data->ldap_pool, found->ld);
+        found->ld = icsf_ldap_pool_get(&icsf_data->ldap_pool);
     }
 
-done:
     /* Unlock */
     if (pthread_mutex_unlock(&icsf_data->sess_list_mutex)) {
         TRACE_ERROR("Mutex Unlock failed.\n");
@@ -246,6 +444,43 @@ done:
     return found;
 }
 
+/*
+ * Number of LDAP connections pooled per slot, taken from the environment
+ * variable OPENCRYPTOKI_ICSF_LDAP_CONNECTIONS.
+ */
+static unsigned int icsf_ldap_pool_size(void)
+{
+    const char *opt;
+    char *end;
+    long size;
+
+    opt = getenv("OPENCRYPTOKI_ICSF_LDAP_CONNECTIONS");
+    if (opt == NULL)
+        return ICSF_LDAP_POOL_DEFAULT_SIZE;
+
+    errno = 0;
+    size = strtol(opt, &end, 10);
+    if (errno != 0 || end == opt || *end != '\0' || size < 1 ||
+        size > ICSF_LDAP_POOL_MAX_SIZE) {
+        OCK_SYSLOG(LOG_WARNING, "OPENCRYPTOKI_ICSF_LDAP_CONNECTIONS '%s' is "
+                   "invalid. Using %d connections.\n", opt,
+                   ICSF_LDAP_POOL_DEFAULT_SIZE);
+        return ICSF_LDAP_POOL_DEFAULT_SIZE;
+    }
+
+    return size;
+}
+
+/*
+ * Bind a new LDAP connection for the pool of the slot.
+ */
+static LDAP *icsf_ldap_pool_connect(void *private)
+{
+    STDLL_TokData_t *tokdata = private;
+
+    return getLDAPhandle(tokdata, tokdata->slot_id);
+}
+
 static void purge_object_mapping_cb(STDLL_TokData_t * tokdata, void *value,
                                     unsigned long node_num, void *p3)
 {
@@ -375,14 +610,39 @@ CK_RV icsftok_init(STDLL_TokData_t * tokdata, CK_SLOT_ID slot_id,
     if (icsf_data == NULL)
         return CKR_HOST_MEMORY;
     list_init(&icsf_data->sessions);
+    icsf_data->sessions_map = hashmap_new();
+    if (icsf_data->sessions_map == NULL) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        free(icsf_data);
+        return CKR_HOST_MEMORY;
+    }
     if (pthread_mutex_init(&icsf_data->sess_list_mutex, NULL) != 0) {
         TRACE_ERROR("Initializing session list lock failed.\n");
+        hashmap_free(icsf_data->sessions_map, NULL);
         free(icsf_data);
         return CKR_CANT_LOCK;
     }
-    if (bt_init(&icsf_data->objects, free) != CKR_OK) {
+    if (icsf_ldap_pool_init(&icsf_data->ldap_pool, icsf_ldap_pool_size(),
+                            icsf_ldap_pool_connect, tokdata) != 0) {
+        pthread_mutex_destroy(&icsf_data->sess_list_mutex);
+        hashmap_free(icsf_data->sessions_map, NULL);
+        free(icsf_data);
+        return CKR_CANT_LOCK;
+    }
+    if (pthread_mutex_init(&icsf_data->attr_cache_mutex, NULL) != 0) {
+        TRACE_ERROR("Initializing attribute cache lock failed.\n");
+        icsf_ldap_pool_destroy(&icsf_data->ldap_pool);
+        pthread_mutex_destroy(&icsf_data->sess_list_mutex);
+        hashmap_free(icsf_data->sessions_map, NULL);
+        free(icsf_data);
+        return CKR_CANT_LOCK;
+    }
+    if (bt_init(&icsf_data->objects, icsf_object_mapping_free) != CKR_OK) {
         TRACE_ERROR("BTree init failed.\n");
+        pthread_mutex_destroy(&icsf_data->attr_cache_mutex);
+        icsf_ldap_pool_destroy(&icsf_data->ldap_pool);
         pthread_mutex_destroy(&icsf_data->sess_list_mutex);
+        hashmap_free(icsf_data->sessions_map, NULL);
         free(icsf_data);
         return CKR_FUNCTION_FAILED;
     }
@@ -1315,7 +1575,7 @@ LDAP *getLDAPhandle(STDLL_TokData_t * tokdata, CK_SLOT_ID slot_id)
     return new_ld;
 }
 
-CK_RV icsf_get_handles(STDLL_TokData_t * tokdata, CK_SLOT_ID slot_id)
+CK_RV icsf_get_handles(STDLL_TokData_t * tokdata)
 {
     icsf_private_data_t *icsf_data = tokdata->private_data;
     struct session_state *s;
@@ -1330,7 +1590,7 @@ CK_RV icsf_get_handles(STDLL_TokData_t * tokdata, CK_SLOT_ID slot_id)
     for_each_list_entry(&icsf_data->sessions, struct session_state, s,
                         sessions) {
         if (s->ld == NULL)
-            s->ld = getLDAPhandle(tokdata, slot_id);
+            s->ld = icsf_ldap_pool_get(&icsf_data->ldap_pool);
     }
 
     if (pthread_mutex_unlock(&icsf_data->sess_list_mutex)) {
@@ -1347,6 +1607,7 @@ CK_RV icsftok_open_session(STDLL_TokData_t * tokdata, SESSION * sess)
     CK_RV rc = CKR_OK;
     LDAP *ld;
     struct session_state *session_state;
+    union hashmap_value val;
 
     /* Sanity */
     if (sess == NULL) {
@@ -1373,7 +1634,7 @@ CK_RV icsftok_open_session(STDLL_TokData_t * tokdata, SESSION * sess)
      * same login state.
      */
     if (session_mgr_user_session_exists(tokdata)) {
-        ld = getLDAPhandle(tokdata, sess->session_info.slotID);
+        ld = icsf_ldap_pool_get(&icsf_data->ldap_pool);
         if (ld == NULL) {
             TRACE_DEVEL("Failed to get LDAP handle for session.\n");
             rc = CKR_FUNCTION_FAILED;
@@ -1384,6 +1645,15 @@ CK_RV icsftok_open_session(STDLL_TokData_t * tokdata, SESSION * sess)
     }
 
     /* put new session_state into the list */
+    val.pVal = session_state;
+    if (hashmap_add(icsf_data->sessions_map, session_state->session_id,
+                    val, NULL)) {
+        TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
+        if (session_state->ld)
+            icsf_ldap_pool_put(&icsf_data->ldap_pool, session_state->ld);
+        rc = CKR_HOST_MEMORY;
+        goto done;
+    }
     list_insert_head(&icsf_data->sessions, &session_state->sessions);
 
 done:
@@ -1405,8 +1675,7 @@ done:
  * Must be called with sess_list_mutex locked.
  */
 static CK_RV close_session(STDLL_TokData_t * tokdata,
-                           struct session_state *session_state,
-                           CK_BBOOL in_fork_initializer)
+                           struct session_state *session_state)
 {
     icsf_private_data_t *icsf_data = tokdata->private_data;
     CK_RV rc = CKR_OK;
@@ -1456,16 +1725,14 @@ static CK_RV close_session(STDLL_TokData_t * tokdata,
     if (rc)
         return rc;
 
-    /* Log off from LDAP server */
+    /* Give the LDAP connection back to the pool */
     if (session_state->ld) {
-        if (!in_fork_initializer && icsf_logout(session_state->ld)) {
-            TRACE_DEVEL("Failed to disconnect from LDAP server.\n");
-            return CKR_FUNCTION_FAILED;
-        }
+        icsf_ldap_pool_put(&icsf_data->ldap_pool, session_state->ld);
         session_state->ld = NULL;
     }
 
     /* Remove session */
+    hashmap_delete(icsf_data->sessions_map, session_state->session_id, NULL);
     list_remove(&session_state->sessions);
     if (list_is_empty(&icsf_data->sessions)) {
         if (purge_object_mapping(tokdata)) {
@@ -1484,19 +1751,38 @@ static CK_RV close_session(STDLL_TokData_t * tokdata,
 CK_RV icsftok_close_session(STDLL_TokData_t * tokdata, SESSION * session,
                             CK_BBOOL in_fork_initializer)
 {
+    icsf_private_data_t *icsf_data = tokdata->private_data;
     CK_RV rc;
     struct session_state *session_state;
 
-    /* Get the related session_state */
-    if (session == NULL
-        || !(session_state = get_session_state(tokdata, session->handle))) {
+    UNUSED(in_fork_initializer);
+
+    if (session == NULL) {
         TRACE_ERROR("%s\n", ock_err(ERR_SESSION_HANDLE_INVALID));
         return CKR_SESSION_HANDLE_INVALID;
     }
 
-    if ((rc = close_session(tokdata, session_state, in_fork_initializer)))
+    if (pthread_mutex_lock(&icsf_data->sess_list_mutex)) {
+        TRACE_ERROR("Failed to lock mutex.\n");
+        return CKR_FUNCTION_FAILED;
+    }
+
+    /* Get the related session_state */
+    if (!(session_state = find_session_state(icsf_data, session->handle))) {
+        TRACE_ERROR("%s\n", ock_err(ERR_SESSION_HANDLE_INVALID));
+        rc = CKR_SESSION_HANDLE_INVALID;
+        goto done;
+    }
+
+    if ((rc = close_session(tokdata, session_state)))
         TRACE_ERROR("close_session failed\n");
 
+done:
+    if (pthread_mutex_unlock(&icsf_data->sess_list_mutex)) {
+        TRACE_ERROR("Mutex Unlock Failed.\n");
+        return CKR_FUNCTION_FAILED;
+    }
+
     return rc;
 }
 
@@ -1519,7 +1805,7 @@ CK_RV icsftok_final(STDLL_TokData_t * tokdata, CK_BBOOL finalize,
 
     for_each_list_entry_safe(&icsf_data->sessions, struct session_state,
                              session_state, sessions, e) {
-        if ((rc = close_session(tokdata, session_state, in_fork_initializer)))
+        if ((rc = close_session(tokdata, session_state)))
             break;
     }
 
@@ -1529,8 +1815,19 @@ CK_RV icsftok_final(STDLL_TokData_t * tokdata, CK_BBOOL finalize,
         return CKR_FUNCTION_FAILED;
     }
 
+    if (finalize || in_fork_initializer) {
+        if (icsf_ldap_pool_close(&icsf_data->ldap_pool, in_fork_initializer)
+            && rc == CKR_OK)
+            rc = CKR_FUNCTION_FAILED;
+    }
+
     if (finalize) {
+        TRACE_INFO("Attribute cache: %lu hits, %lu misses\n",
+                   icsf_data->attr_cache_hits, icsf_data->attr_cache_misses);
         bt_destroy(&icsf_data->objects);
+        hashmap_free(icsf_data->sessions_map, NULL);
+        pthread_mutex_destroy(&icsf_data->attr_cache_mutex);
+        icsf_ldap_pool_destroy(&icsf_data->ldap_pool);
         pthread_mutex_destroy(&icsf_data->sess_list_mutex);
         free(icsf_data);
         tokdata->private_data = NULL;
@@ -1762,7 +2059,7 @@ CK_RV icsftok_copy_object(STDLL_TokData_t * tokdata,
     }
 
     /* Allocate structure for new object */
-    if (!(mapping_dst = malloc(sizeof(*mapping_dst)))) {
+    if (!(mapping_dst = calloc(1, sizeof(*mapping_dst)))) {
         TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
         rc = CKR_HOST_MEMORY;
         goto done;
@@ -1906,8 +2203,9 @@ CK_RV icsftok_create_object(STDLL_TokData_t * tokdata, SESSION * session,
         goto done;
     }
     /* Policy check */
+    pattr.tokdata = tokdata;
     pattr.ld = session_state->ld;
-    pattr.icsf_object = &mapping->icsf_object;
+    pattr.mapping = mapping;
     rc = tokdata->policy->store_object_strength(tokdata->policy,
                                                 &mapping->strength,
                                                 icsf_policy_get_attr, &pattr,
@@ -2115,8 +2413,8 @@ CK_RV icsftok_generate_key_pair(STDLL_TokData_t * tokdata, SESSION * session,
     }
 
     /* Allocate structure to keep ICSF objects information */
-    if (!(pub_key_mapping = malloc(sizeof(*pub_key_mapping))) ||
-        !(priv_key_mapping = malloc(sizeof(*priv_key_mapping)))) {
+    if (!(pub_key_mapping = calloc(1, sizeof(*pub_key_mapping))) ||
+        !(priv_key_mapping = calloc(1, sizeof(*priv_key_mapping)))) {
         TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
         rc = CKR_HOST_MEMORY;
         goto done;
@@ -2132,8 +2430,9 @@ CK_RV icsftok_generate_key_pair(STDLL_TokData_t * tokdata, SESSION * session,
         rc = icsf_to_ock_err(rc, reason);
         goto done;
     }
+    pattr.tokdata = tokdata;
     pattr.ld = session_state->ld;
-    pattr.icsf_object = &pub_key_mapping->icsf_object;
+    pattr.mapping = pub_key_mapping;
     rc = tokdata->policy->store_object_strength(tokdata->policy,
                                                 &pub_key_mapping->strength,
                                                 icsf_policy_get_attr, &pattr,
@@ -2142,7 +2441,7 @@ CK_RV icsftok_generate_key_pair(STDLL_TokData_t * tokdata, SESSION * session,
         TRACE_ERROR("POLICY VIOLATION: Public key too weak\n");
         goto done;
     }
-    pattr.icsf_object = &priv_key_mapping->icsf_object;
+    pattr.mapping = priv_key_mapping;
     rc = tokdata->policy->store_object_strength(tokdata->policy,
                                                 &priv_key_mapping->strength,
                                                 icsf_policy_get_attr, &pattr,
@@ -2266,8 +2565,9 @@ CK_RV icsftok_generate_key(STDLL_TokData_t * tokdata, SESSION * session,
         rc = icsf_to_ock_err(rc, reason);
         goto done;
     }
+    pattr.tokdata = tokdata;
     pattr.ld = session_state->ld;
-    pattr.icsf_object = &mapping->icsf_object;
+    pattr.mapping = mapping;
     rc = tokdata->policy->store_object_strength(tokdata->policy,
                                                 &mapping->strength,
                                                 icsf_policy_get_attr, &pattr,
@@ -3472,7 +3772,7 @@ CK_RV icsftok_get_attribute_value(STDLL_TokData_t * tokdata,
 {
     icsf_private_data_t *icsf_data = tokdata->private_data;
     CK_RV rc = CKR_OK;
-    CK_BBOOL priv_obj;
+    CK_BBOOL priv_obj, cached;
     struct session_state *session_state;
     struct icsf_object_mapping *mapping = NULL;
     int reason = 0;
@@ -3522,6 +3822,12 @@ CK_RV icsftok_get_attribute_value(STDLL_TokData_t * tokdata,
     }
     // get requested attributes and values if the obj_size ptr is not set
     if (!obj_size) {
+        /* Immutable attributes may be served from the attribute cache */
+        rc = icsf_attr_cache_lookup(tokdata, session_state->ld, mapping,
+                                    pTemplate, ulCount, &cached);
+        if (rc != CKR_OK || cached)
+            goto done;
+
         /* Now call icsf to get the attribute values */
         rc = icsf_get_attribute(session_state->ld, &reason,
                                 &mapping->icsf_object, pTemplate, ulCount);
@@ -3613,6 +3919,7 @@ CK_RV icsftok_set_attribute_value(STDLL_TokData_t * tokdata,
     }
 
     /* Now call into icsf to set the attribute values */
+    icsf_attr_cache_invalidate(tokdata, mapping);
     rc = icsf_set_attribute(session_state->ld, &reason,
                             &mapping->icsf_object, pTemplate, ulCount);
     if (rc != CKR_OK) {
@@ -3761,7 +4068,7 @@ CK_RV icsftok_find_objects_init(STDLL_TokData_t * tokdata, SESSION * sess,
             if (!node_number) {
                 struct icsf_object_mapping *new_mapping;
 
-                if (!(new_mapping = malloc(sizeof(*new_mapping)))) {
+                if (!(new_mapping = calloc(1, sizeof(*new_mapping)))) {
                     TRACE_ERROR("%s\n", ock_err(ERR_HOST_MEMORY));
                     rv = CKR_HOST_MEMORY;
                     goto done;
@@ -3769,8 +4076,9 @@ CK_RV icsftok_find_objects_init(STDLL_TokData_t * tokdata, SESSION * sess,
                 new_mapping->session_id = sess->handle;
                 new_mapping->icsf_object = records[i];
                 /* Policy check */
+                pattr.tokdata = tokdata;
                 pattr.ld = session_state->ld;
-                pattr.icsf_object = &new_mapping->icsf_object;
+                pattr.mapping = new_mapping;
                 rc = tokdata->policy->store_object_strength(
                      tokdata->policy, &new_mapping->strength,
                      icsf_policy_get_attr, &pattr, icsf_policy_free_attr, sess);
@@ -3860,6 +4168,8 @@ CK_RV icsftok_destroy_object(STDLL_TokData_t * tokdata, SESSION * sess,
         goto done;
     }
 
+    /* Other threads may still hold the mapping until it is freed */
+    icsf_attr_cache_invalidate(tokdata, mapping);
     bt_put_node_value(&icsf_data->objects, mapping);
     mapping = NULL;
 
@@ -5340,8 +5650,9 @@ CK_RV icsftok_unwrap_key(STDLL_TokData_t * tokdata,
         rc = icsf_to_ock_err(rc, reason);
         goto done;
     }
+    pattr.tokdata = tokdata;
     pattr.ld = session_state->ld;
-    pattr.icsf_object = &key_mapping->icsf_object;
+    pattr.mapping = key_mapping;
     rc = tokdata->policy->store_object_strength(tokdata->policy,
                                                 &key_mapping->strength,
                                                 icsf_policy_get_attr, &pattr,
@@ -5491,8 +5802,9 @@ CK_RV icsftok_derive_key(STDLL_TokData_t * tokdata, SESSION * session,
             rc = icsf_to_ock_err(rc, reason);
             goto done;
         }
+        pattr.tokdata = tokdata;
         pattr.ld = session_state->ld;
-        pattr.icsf_object = &mappings[0]->icsf_object;
+        pattr.mapping = mappings[0];
         rc = tokdata->policy->store_object_strength(tokdata->policy,
                                                     &mappings[0]->strength,
                                                     icsf_policy_get_attr,
@@ -5517,9 +5829,10 @@ CK_RV icsftok_derive_key(STDLL_TokData_t * tokdata, SESSION * session,
             rc = icsf_to_ock_err(rc, reason);
             goto done;
         }
+        pattr.tokdata = tokdata;
         pattr.ld = session_state->ld;
         for (i = 0; i < 4; ++i) {
-            pattr.icsf_object = &mappings[i]->icsf_object;
+            pattr.mapping = mappings[i];
             rc = tokdata->policy->store_object_strength(tokdata->policy,
                                                         &mappings[i]->strength,
                                                         icsf_policy_get_attr,
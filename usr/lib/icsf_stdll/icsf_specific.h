@@ -16,8 +16,11 @@
 #ifndef ICSF_SPECIFIC_H
 #define ICSF_SPECIFIC_H
 
+#include <ldap.h>
 #include "pkcs11types.h"
 #include "list.h"
+#include "../api/hashmap.h"
+#include "icsf.h"
 
 typedef struct {
     /*
@@ -33,6 +36,29 @@ typedef struct {
     list_t sessions;
     pthread_mutex_t sess_list_mutex;
 
+    /*
+     * Maps a session handle to its element in the sessions list. It is
+     * protected by sess_list_mutex as well.
+     */
+    struct hashmap *sessions_map;
+
+    /*
+     * Pool of authenticated LDAP connections. Sessions borrow a connection
+     * from the pool instead of binding their own one, and give it back when
+     * they are closed. Connections stay bound until the token is finalized,
+     * or until their connection to the server is lost.
+     */
+    struct icsf_ldap_pool ldap_pool;
+
+    /*
+     * Protects the attribute caches of the object mappings. The counters
+     * tell how often a cache could serve a lookup (hit) and how often the
+     * attributes had to be fetched from ICSF first (miss).
+     */
+    pthread_mutex_t attr_cache_mutex;
+    unsigned long attr_cache_hits;
+    unsigned long attr_cache_misses;
+
     /*
      * This binary tree keeps the mapping between ICSF object handles and PKCS#11
      * object handles. The tree index is used as the PKCS#11 handle.
@@ -188,6 +214,8 @@ CK_RV icsftok_generate_key(STDLL_TokData_t * tokdata, SESSION * session,
                            CK_ATTRIBUTE_PTR attrs, CK_ULONG attrs_len,
                            CK_OBJECT_HANDLE_PTR handle);
 
-CK_RV icsf_get_handles(STDLL_TokData_t * tokdata, CK_SLOT_ID slot_id);
+CK_RV icsf_get_handles(STDLL_TokData_t * tokdata);
+
+LDAP *getLDAPhandle(STDLL_TokData_t * tokdata, CK_SLOT_ID slot_id);
 
 #endif
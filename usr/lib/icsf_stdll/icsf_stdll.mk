@@ -16,8 +16,8 @@ opencryptoki_stdll_libpkcs11_icsf_la_CFLAGS =				\
 	-I${top_builddir}/usr/lib/config -I${srcdir}/usr/lib/config
 
 opencryptoki_stdll_libpkcs11_icsf_la_LDFLAGS =				\
-	-shared	-Wl,-z,defs,-Bsymbolic -lcrypto	-lldap -lpthread	\
-	-lrt -llber							\
+	-shared	-Wl,-z,defs,-Bsymbolic -lcrypto	$(OPENLDAP_LIBS)	\
+	-lpthread -lrt							\
 	-Wl,--version-script=${srcdir}/opencryptoki_tok.map
 
 opencryptoki_stdll_libpkcs11_icsf_la_SOURCES = usr/lib/common/asn1.c	\
@@ -46,6 +46,7 @@ opencryptoki_stdll_libpkcs11_icsf_la_SOURCES = usr/lib/common/asn1.c	\
 	usr/lib/config/configuration.c usr/lib/common/pqc_supported.c	\
 	usr/lib/config/cfgparse.y usr/lib/config/cfglex.l		\
 	usr/lib/common/mech_openssl.c					\
-	usr/lib/common/btree.c usr/lib/common/sess_mgr.c
+	usr/lib/common/btree.c usr/lib/common/sess_mgr.c		\
+	usr/lib/common/logstore.c usr/lib/api/hashmap.c
 
 usr/lib/icsf_stdll/icsf_specific.$(OBJEXT): usr/lib/config/cfgparse.h
@@ -82,6 +82,8 @@ CK_RV ST_Initialize(API_Slot_t *sltp, CK_SLOT_ID SlotNumber,
     rc |= bt_init(&sltp->TokData->sess_obj_btree, call_object_free);
     rc |= bt_init(&sltp->TokData->priv_token_obj_btree, call_object_free);
     rc |= bt_init(&sltp->TokData->publ_token_obj_btree, call_object_free);
+    rc |= tok_obj_name_index_init(&sltp->TokData->priv_token_obj_index);
+    rc |= tok_obj_name_index_init(&sltp->TokData->publ_token_obj_index);
     if (rc != CKR_OK) {
         TRACE_ERROR("Btree init failed\n");
         rc = CKR_FUNCTION_FAILED;
@@ -114,6 +116,15 @@ CK_RV ST_Initialize(API_Slot_t *sltp, CK_SLOT_ID SlotNumber,
                 (unsigned int)(sinfp->version >> 16),
                 (unsigned int)(sinfp->version & 0xffff));
 
+    sltp->TokData->objstore = sinfp->objstore;
+    if (sinfp->objstore == OBJSTORE_LOG &&
+        sinfp->version < TOK_NEW_DATA_STORE) {
+        TRACE_ERROR("The log object store requires tokversion 3.12 or "
+                    "later.\n");
+        rc = CKR_FUNCTION_FAILED;
+        goto done;
+    }
+
     /* Check token store encryption against policy */
     newdatastore = sinfp->version >= TOK_NEW_DATA_STORE ? CK_TRUE : CK_FALSE;
     rc = policy->check_token_store(policy, newdatastore,
@@ -161,6 +172,7 @@ CK_RV ST_Initialize(API_Slot_t *sltp, CK_SLOT_ID SlotNumber,
             goto done;
         }
         sltp->TokData->initialized = TRUE;
+        openssl_algs_get();
     }
 
     rc = load_token_data(sltp->TokData, SlotNumber);
@@ -202,6 +214,8 @@ done:
             bt_destroy(&sltp->TokData->sess_obj_btree);
             bt_destroy(&sltp->TokData->priv_token_obj_btree);
             bt_destroy(&sltp->TokData->publ_token_obj_btree);
+            tok_obj_name_index_destroy(&sltp->TokData->priv_token_obj_index);
+            tok_obj_name_index_destroy(&sltp->TokData->publ_token_obj_index);
         }
     }
 
@@ -239,6 +253,8 @@ CK_RV SC_Finalize(STDLL_TokData_t *tokdata, CK_SLOT_ID sid, SLOT_INFO *sinfp,
     bt_destroy(&tokdata->sess_obj_btree);
     bt_destroy(&tokdata->priv_token_obj_btree);
     bt_destroy(&tokdata->publ_token_obj_btree);
+    tok_obj_name_index_destroy(&tokdata->priv_token_obj_index);
+    tok_obj_name_index_destroy(&tokdata->publ_token_obj_index);
 
     detach_shm(tokdata, in_fork_initializer);
     /* close spin lock file */
@@ -247,10 +263,11 @@ CK_RV SC_Finalize(STDLL_TokData_t *tokdata, CK_SLOT_ID sid, SLOT_INFO *sinfp,
     rc = icsftok_final(tokdata, TRUE, in_fork_initializer);
     if (rc != CKR_OK) {
         TRACE_ERROR("Token specific final call failed.\n");
-        return rc;
     }
 
+    /* Release the token's resources even if the token specific final failed */
     final_data_store(tokdata);
+    openssl_algs_put();
 
     return rc;
 }
@@ -917,7 +934,7 @@ done:
             TRACE_DEVEL("session_mgr_login_all failed.\n");
         } else {
             if (sess)
-                rc = icsf_get_handles(tokdata, sess->session_info.slotID);
+                rc = icsf_get_handles(tokdata);
         }
     }
 
@@ -252,6 +252,12 @@ CK_RV token_specific_final(STDLL_TokData_t *tokdata,
     return CKR_OK;
 }
 
+CK_RV token_specific_rng(STDLL_TokData_t *tokdata, CK_BYTE *output,
+                         CK_ULONG bytes)
+{
+    return openssl_specific_rng(tokdata, output, bytes);
+}
+
 CK_RV token_specific_des_key_gen(STDLL_TokData_t *tokdata, TEMPLATE *tmpl,
                                  CK_BYTE **des_key, CK_ULONG *len,
                                  CK_ULONG keysize, CK_BBOOL *is_opaque)
@@ -674,6 +680,18 @@ CK_RV token_specific_aes_cmac(STDLL_TokData_t *tokdata, CK_BYTE *message,
                                      first, last, ctx);
 }
 
+CK_RV token_specific_cipher_update(STDLL_TokData_t *tokdata,
+                                   CK_MECHANISM_TYPE mech,
+                                   CK_BYTE *in_data, CK_ULONG in_data_len,
+                                   CK_BYTE *out_data, OBJECT *key,
+                                   CK_BYTE *init_v, CK_BYTE encrypt,
+                                   CK_BBOOL last, CK_VOID_PTR *ctx)
+{
+    return openssl_specific_cipher_update(tokdata, mech, in_data, in_data_len,
+                                          out_data, key, init_v, encrypt,
+                                          last, ctx);
+}
+
 CK_RV token_specific_aes_xts(STDLL_TokData_t *tokdata, SESSION *sess,
                              CK_BYTE *in_data, CK_ULONG in_data_len,
                              CK_BYTE *out_data, CK_ULONG *out_data_len,
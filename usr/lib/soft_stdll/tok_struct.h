@@ -66,7 +66,7 @@ token_spec_t token_specific = {
     NULL,                       // init_token_data
     NULL,                       // load_token_data
     NULL,                       // save_token_data
-    NULL,                       // random number generator
+    &token_specific_rng,
     &token_specific_final,
     NULL,                       // init_token
     NULL,                       // login
@@ -164,6 +164,7 @@ token_spec_t token_specific = {
     NULL,                       // set_attribute_values
     NULL,                       // set_attrs_for_new_object
     NULL,                       // handle_event
+    &token_specific_cipher_update,
 };
 
 #endif
@@ -81,6 +81,7 @@ static void print_extract_cert_pubkey_help(void);
 static void *pkcs11_lib = NULL;
 static bool pkcs11_initialized = false;
 static CK_FUNCTION_LIST *pkcs11_funcs = NULL;
+static CK_IBM_FUNCTION_LIST_1_1 *pkcs11_ibm_funcs = NULL;
 static CK_SESSION_HANDLE pkcs11_session = CK_INVALID_HANDLE;
 static CK_INFO pkcs11_info;
 static CK_TOKEN_INFO pkcs11_tokeninfo;
@@ -4498,19 +4499,9 @@ static int iterate_compare(const void *a, const void *b, void *private)
     return result;
 }
 
-static CK_BBOOL objclass_expected(CK_OBJECT_HANDLE obj, enum p11sak_objclass objclass)
+static CK_BBOOL objclass_matches(CK_OBJECT_CLASS class_val,
+                                 enum p11sak_objclass objclass)
 {
-    CK_OBJECT_CLASS class_val = 0;
-    CK_ATTRIBUTE attr = { CKA_CLASS, &class_val, sizeof(class_val) };
-    CK_RV rv;
-
-    rv = get_attribute(obj, &attr);
-    if (rv != CKR_OK) {
-        warnx("Failed to get CKA_CLASS attribute: get_attribute: 0x%lX: %s",
-              rv, p11_get_ckr(rv));
-        return rv;
-    }
-
     switch (objclass) {
     case OBJCLASS_KEY:
         if (class_val == CKO_SECRET_KEY || class_val == CKO_PUBLIC_KEY ||
@@ -4528,6 +4519,159 @@ static CK_BBOOL objclass_expected(CK_OBJECT_HANDLE obj, enum p11sak_objclass obj
     return CK_FALSE;
 }
 
+static CK_BBOOL objclass_expected(CK_OBJECT_HANDLE obj, enum p11sak_objclass objclass)
+{
+    CK_OBJECT_CLASS class_val = 0;
+    CK_ATTRIBUTE attr = { CKA_CLASS, &class_val, sizeof(class_val) };
+    CK_RV rv;
+
+    rv = get_attribute(obj, &attr);
+    if (rv != CKR_OK) {
+        warnx("Failed to get CKA_CLASS attribute: get_attribute: 0x%lX: %s",
+              rv, p11_get_ckr(rv));
+        return rv;
+    }
+
+    return objclass_matches(class_val, objclass);
+}
+
+static CK_RV add_matched_obj(CK_OBJECT_HANDLE obj,
+                             CK_OBJECT_HANDLE **matched_objs,
+                             CK_ULONG *num_matched_objs,
+                             CK_ULONG *alloc_matched_objs)
+{
+    CK_OBJECT_HANDLE *tmp;
+
+    if (*num_matched_objs >= *alloc_matched_objs) {
+        tmp = realloc(*matched_objs,
+                      (*alloc_matched_objs + FIND_OBJECTS_COUNT) *
+                                              sizeof(CK_OBJECT_HANDLE));
+        if (tmp == NULL) {
+            warnx("Failed to allocate a list of matched objects.");
+            return CKR_HOST_MEMORY;
+        }
+
+        *matched_objs = tmp;
+        *alloc_matched_objs += FIND_OBJECTS_COUNT;
+    }
+
+    (*matched_objs)[(*num_matched_objs)++] = obj;
+
+    return CKR_OK;
+}
+
+/*
+ * Fetches the matching objects of an active find operation together with
+ * their CKA_CLASS and CKA_LABEL attributes, using the bulk find function
+ * of the IBM vendor interface. This avoids one C_GetAttributeValue round
+ * trip per object and attribute for class and label filtering. Returns
+ * CKR_FUNCTION_NOT_SUPPORTED without consuming any objects if the library
+ * or token does not support it.
+ */
+static CK_RV find_objects_bulk(const char *label_filter,
+                               bool manual_filtering,
+                               enum p11sak_objclass objclass,
+                               CK_OBJECT_HANDLE **matched_objs,
+                               CK_ULONG *num_matched_objs,
+                               CK_ULONG *alloc_matched_objs)
+{
+    CK_ATTRIBUTE_TYPE types[] = { CKA_CLASS, CKA_LABEL };
+    CK_IBM_OBJECT_RECORD rec;
+    CK_IBM_ATTRIBUTE_VALUE class_hdr, label_hdr;
+    CK_OBJECT_CLASS class_val;
+    CK_BYTE *buf = NULL, *tmp, *ptr;
+    CK_ULONG buf_size = FIND_OBJECTS_BUFFER_SIZE, buf_len, num_objs, i;
+    char *label = NULL;
+    CK_RV rc;
+
+    if (pkcs11_ibm_funcs == NULL)
+        return CKR_FUNCTION_NOT_SUPPORTED;
+
+    buf = malloc(buf_size);
+    if (buf == NULL) {
+        warnx("Failed to allocate a find buffer.");
+        return CKR_HOST_MEMORY;
+    }
+
+    while (1) {
+        buf_len = buf_size;
+        num_objs = 0;
+
+        rc = pkcs11_ibm_funcs->C_IBM_FindObjectsGetAttributes(pkcs11_session,
+                                                    types,
+                                                    sizeof(types) /
+                                                        sizeof(types[0]),
+                                                    buf, &buf_len, &num_objs);
+        if (rc == CKR_BUFFER_TOO_SMALL && buf_len > buf_size) {
+            tmp = realloc(buf, buf_len);
+            if (tmp == NULL) {
+                warnx("Failed to allocate a find buffer.");
+                rc = CKR_HOST_MEMORY;
+                goto done;
+            }
+            buf = tmp;
+            buf_size = buf_len;
+            continue;
+        }
+        if (rc == CKR_FUNCTION_NOT_SUPPORTED)
+            goto done;
+        if (rc != CKR_OK) {
+            warnx("Failed to find objects: C_IBM_FindObjectsGetAttributes: "
+                  "0x%lX: %s", rc, p11_get_ckr(rc));
+            goto done;
+        }
+
+        if (num_objs == 0)
+            break;
+
+        for (i = 0, ptr = buf; i < num_objs; i++, ptr += rec.ulRecordLen) {
+            memcpy(&rec, ptr, sizeof(rec));
+            memcpy(&class_hdr, ptr + sizeof(rec), sizeof(class_hdr));
+            if (class_hdr.ulValueLen != sizeof(class_val))
+                continue;
+            memcpy(&class_val, ptr + sizeof(rec) + sizeof(class_hdr),
+                   sizeof(class_val));
+            if (!objclass_matches(class_val, objclass))
+                continue;
+
+            if (manual_filtering) {
+                memcpy(&label_hdr, ptr + sizeof(rec) + sizeof(class_hdr) +
+                       sizeof(class_val), sizeof(label_hdr));
+                if (label_hdr.ulValueLen == CK_UNAVAILABLE_INFORMATION)
+                    label_hdr.ulValueLen = 0;
+
+                label = calloc(label_hdr.ulValueLen + 1, 1);
+                if (label == NULL) {
+                    warnx("Failed to allocate memory for label attribute");
+                    rc = CKR_HOST_MEMORY;
+                    goto done;
+                }
+                memcpy(label, ptr + sizeof(rec) + sizeof(class_hdr) +
+                       sizeof(class_val) + sizeof(label_hdr),
+                       label_hdr.ulValueLen);
+
+                if (fnmatch(label_filter, label, 0) != 0) {
+                    free(label);
+                    label = NULL;
+                    continue;
+                }
+                free(label);
+                label = NULL;
+            }
+
+            rc = add_matched_obj(rec.hObject, matched_objs, num_matched_objs,
+                                 alloc_matched_objs);
+            if (rc != CKR_OK)
+                goto done;
+        }
+    }
+
+done:
+    free(buf);
+
+    return rc;
+}
+
 static CK_RV iterate_objects(const struct p11sak_objtype *objtype,
                              const char *label_filter,
                              const char *id_filter,
@@ -4561,7 +4705,7 @@ static CK_RV iterate_objects(const struct p11sak_objtype *objtype,
     char *typestr = NULL;
     char *common_name = NULL;
     const struct p11sak_objtype *type;
-    CK_OBJECT_HANDLE *matched_objs = NULL, *tmp;
+    CK_OBJECT_HANDLE *matched_objs = NULL;
     CK_ULONG num_matched_objs = 0;
     CK_ULONG alloc_matched_objs = 0;
     struct p11sak_iterate_compare_data data;
@@ -4608,6 +4752,12 @@ static CK_RV iterate_objects(const struct p11sak_objtype *objtype,
         goto done;
     }
 
+    rc = find_objects_bulk(label_filter, manual_filtering, objclass,
+                           &matched_objs, &num_matched_objs,
+                           &alloc_matched_objs);
+    if (rc != CKR_FUNCTION_NOT_SUPPORTED)
+        goto done_find;
+
     while (1) {
         memset(objs, 0, sizeof(objs));
         num_objs = 0;
@@ -4636,21 +4786,10 @@ static CK_RV iterate_objects(const struct p11sak_objtype *objtype,
                     goto next;
             }
 
-            if (num_matched_objs >= alloc_matched_objs) {
-                tmp = realloc(matched_objs,
-                              (alloc_matched_objs + FIND_OBJECTS_COUNT) *
-                                                  sizeof(CK_OBJECT_HANDLE));
-                if (tmp == NULL) {
-                    warnx("Failed to allocate a list of matched objects.");
-                    rc = CKR_HOST_MEMORY;
-                    goto done_find;
-                }
-
-                matched_objs = tmp;
-                alloc_matched_objs += FIND_OBJECTS_COUNT;
-            }
-
-            matched_objs[num_matched_objs++] = objs[i];
+            rc = add_matched_obj(objs[i], &matched_objs, &num_matched_objs,
+                                 &alloc_matched_objs);
+            if (rc != CKR_OK)
+                goto done_find;
 
 next:
             if (label != NULL)
@@ -10046,6 +10185,11 @@ static CK_RV load_pkcs11_lib(void)
 {
     CK_RV rc;
     CK_RV (*getfunclist)(CK_FUNCTION_LIST_PTR_PTR ppFunctionList);
+    CK_RV (*getinterface)(CK_UTF8CHAR_PTR pInterfaceName,
+                          CK_VERSION_PTR pVersion,
+                          CK_INTERFACE_PTR_PTR ppInterface, CK_FLAGS flags);
+    CK_VERSION ibm_version = { 1, 1 };
+    CK_INTERFACE *ibm_interface = NULL;
     const char *libname;
 
     libname = secure_getenv(P11SAK_PKCSLIB_ENV_NAME);
@@ -10072,6 +10216,15 @@ static CK_RV load_pkcs11_lib(void)
         return CKR_FUNCTION_FAILED;
     }
 
+    /* The IBM vendor interface is optional, other libraries may lack it */
+    *(void**) (&getinterface) = dlsym(pkcs11_lib, "C_GetInterface");
+    if (getinterface != NULL) {
+        rc = getinterface((CK_UTF8CHAR *)"Vendor IBM", &ibm_version,
+                          &ibm_interface, 0);
+        if (rc == CKR_OK && ibm_interface != NULL)
+            pkcs11_ibm_funcs = ibm_interface->pFunctionList;
+    }
+
     return CKR_OK;
 }
 
@@ -10212,6 +10365,7 @@ static void term_pkcs11(void)
 
     pkcs11_lib = NULL;
     pkcs11_funcs = NULL;
+    pkcs11_ibm_funcs = NULL;
 }
 
 static void parse_config_file_error_hook(int line, int col, const char *msg)
@@ -44,6 +44,7 @@
 #define PRINT_INDENT_POS        35
 
 #define FIND_OBJECTS_COUNT      64
+#define FIND_OBJECTS_BUFFER_SIZE 16384
 #define LIST_KEYTYPE_CELL_SIZE  22
 #define LIST_CERTTYPE_CELL_SIZE  9
 #define LIST_CERT_CN_CELL_SIZE  22
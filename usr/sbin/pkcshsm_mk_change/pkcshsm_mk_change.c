@@ -24,6 +24,7 @@
 #include <dlfcn.h>
 #include <signal.h>
 #include <unistd.h>
+#include <time.h>
 
 #include <pkcs11types.h>
 #include "p11util.h"
@@ -40,6 +41,8 @@
 #define CCA_MKVP_LENGTH             8
 #define EP11_WKVP_LENGTH            16
 
+#define MK_CHANGE_MAX_WORKERS       64
+
 #define UNUSED(var)            ((void)(var))
 
 pkcs_trace_level_t trace_level = TRACE_LEVEL_NONE;
@@ -115,8 +118,15 @@ static void usage(char *progname)
            "                          of the new, to be set CCA APKA master key as a\n"
            "                          8 bytes hex string.\n"
            "                          Only valid with the 'reencipher' command.\n");
+    printf(" -w, --workers NUM        specifies the number of threads that re-encipher\n"
+           "                          the token key objects of a token concurrently\n"
+           "                          (1 to %d, default 1).\n"
+           "                          Only valid with the 'reencipher' command.\n",
+           MK_CHANGE_MAX_WORKERS);
     printf(" -i, --id OPERATION-ID    specifies the ID of the master key change operation\n"
-           "                          to finalize, cancel, or list.\n");
+           "                          to finalize, cancel, or list. With the 'reencipher'\n"
+           "                          command, resumes the interrupted re-enciphering of\n"
+           "                          that operation.\n");
     printf(" -v, --verbose LEVEL      set verbose level (optional):\n");
     printf("                          none (default), error, warn, info, devel, debug\n");
     printf(" -h, --help               display help information.\n");
@@ -207,6 +217,33 @@ static int parse_mkvp(char *mkvp_str, size_t min_size, unsigned char *mkvp,
     return 0;
 }
 
+static int parse_workers(char *workers_str)
+{
+    char *endptr;
+    long num;
+
+    TRACE_DEVEL("Workers: '%s'\n", workers_str);
+
+    num = strtol(workers_str, &endptr, 10);
+    if (*workers_str == '\0' || *endptr != '\0' ||
+        num < 1 || num > MK_CHANGE_MAX_WORKERS) {
+        warnx("option -w/--workers must specify a number between 1 and %d",
+              MK_CHANGE_MAX_WORKERS);
+        return EINVAL;
+    }
+
+    /*
+     * The token objects are re-enciphered within this process, so pass the
+     * number of worker threads to the tokens via the environment.
+     */
+    if (setenv("OPENCRYPTOKI_MK_CHANGE_WORKERS", workers_str, 1) != 0) {
+        warnx("Failed to set the number of workers: %s", strerror(errno));
+        return errno;
+    }
+
+    return 0;
+}
+
 static const char *get_mk_type_string(enum hsm_mk_type mk_type)
 {
     switch (mk_type) {
@@ -643,13 +680,105 @@ static void logout_tokens(void)
     }
 }
 
-static int reencipher_tokens(void)
+static bool slot_done(CK_SLOT_ID slot)
+{
+    unsigned int i;
+
+    for (i = 0; i < op.num_slots_done; i++) {
+        if (op.slots_done[i] == slot)
+            return true;
+    }
+
+    return false;
+}
+
+/*
+ * Records that all token objects of the slot have been re-enciphered, so that
+ * an interrupted run can be resumed with the remaining slots.
+ */
+static int checkpoint_slot_done(CK_SLOT_ID slot)
+{
+    CK_SLOT_ID *tmp;
+
+    tmp = realloc(op.slots_done, (op.num_slots_done + 1) * sizeof(CK_SLOT_ID));
+    if (tmp == NULL) {
+        warnx("Failed to allocate list of completed slots");
+        return ENOMEM;
+    }
+
+    op.slots_done = tmp;
+    op.slots_done[op.num_slots_done++] = slot;
+
+    return save_mk_change_op();
+}
+
+static int count_token_key_objects(CK_SESSION_HANDLE session,
+                                   CK_ULONG *count)
+{
+    CK_OBJECT_CLASS classes[] = { CKO_SECRET_KEY, CKO_PRIVATE_KEY,
+                                  CKO_PUBLIC_KEY };
+    CK_OBJECT_CLASS class;
+    CK_BBOOL true_val = CK_TRUE;
+    CK_ATTRIBUTE tmpl[] = {
+        { CKA_CLASS, &class, sizeof(class) },
+        { CKA_TOKEN, &true_val, sizeof(true_val) },
+    };
+    CK_OBJECT_HANDLE handles[256];
+    CK_ULONG i, found;
+    CK_RV rv;
+
+    *count = 0;
+
+    for (i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        class = classes[i];
+
+        rv = func_list->C_FindObjectsInit(session, tmpl,
+                                          sizeof(tmpl) / sizeof(tmpl[0]));
+        if (rv != CKR_OK)
+            return EIO;
+
+        do {
+            rv = func_list->C_FindObjects(session, handles,
+                                          sizeof(handles) / sizeof(handles[0]),
+                                          &found);
+            if (rv != CKR_OK) {
+                func_list->C_FindObjectsFinal(session);
+                return EIO;
+            }
+            *count += found;
+        } while (found > 0);
+
+        func_list->C_FindObjectsFinal(session);
+    }
+
+    return 0;
+}
+
+static void print_throughput(CK_SLOT_ID slot, CK_ULONG num_objs,
+                             const struct timespec *start,
+                             const struct timespec *end)
+{
+    long elapsed_ms;
+
+    elapsed_ms = (end->tv_sec - start->tv_sec) * 1000 +
+                 (end->tv_nsec - start->tv_nsec) / 1000000;
+
+    printf("  Slot %lu: %lu token key objects processed in %ld.%03ld seconds",
+           slot, num_objs, elapsed_ms / 1000, elapsed_ms % 1000);
+    if (elapsed_ms > 0)
+        printf(" (%lu objects/s)", num_objs * 1000 / elapsed_ms);
+    printf("\n");
+}
+
+static int reencipher_tokens(bool resume)
 {
     size_t payload_len;
     unsigned char *payload = NULL;
     event_mk_change_data_t *hdr;
     struct event_destination dest;
     struct event_reply reply;
+    struct timespec start, end;
+    CK_ULONG i, num_objs;
     int rc = 0;
 
     rc = build_event_payload(&payload, &payload_len);
@@ -689,32 +818,56 @@ static int reencipher_tokens(void)
         goto cancel;
 
     /*
-     * Let the tool process re-encipher the token objects.
-     * After that, all objects are re-enciphered.
+     * Let the tool process re-encipher the token objects, one token at a time.
+     * After each token, the MK change operation records the token as done, so
+     * that an interrupted run can be resumed with the remaining tokens. After
+     * that, all objects are re-enciphered.
      */
     hdr->flags = EVENT_MK_CHANGE_FLAGS_TOK_OBJS;
+    if (resume)
+        hdr->flags |= EVENT_MK_CHANGE_FLAGS_TOK_OBJS_RESUME;
 
-    dest.process_id = getpid(); /* Send to current process only */
-    dest.token_type = EVENT_TOK_TYPE_CCA | EVENT_TOK_TYPE_EP11;
-    memset(dest.token_label, ' ', sizeof(dest.token_label));
+    for (i = 0; i < num_tokens; i++) {
+        if (tokens[i].affected == false)
+            continue;
 
-    memset(&reply, 0, sizeof(reply));
+        TRACE_DEVEL("Slot %lu\n", tokens[i].id);
 
-    rc = send_event(event_fd, EVENT_TYPE_MK_CHANGE_REENCIPHER,
-                    EVENT_FLAGS_REPLY_REQ, payload_len, (char *)payload,
-                    &dest, &reply);
-    if (rc != 0) {
-        warnx("Failed to send event: %d", rc);
-        rc = EIO;
-        goto out;
-    }
+        if (count_token_key_objects(tokens[i].session, &num_objs) != 0)
+            num_objs = 0;
 
-    TRACE_DEVEL("Positive: %lu\n", reply.positive_replies);
-    TRACE_DEVEL("Negative: %lu\n", reply.negative_replies);
-    TRACE_DEVEL("Not handled: %lu\n", reply.nothandled_replies);
+        clock_gettime(CLOCK_MONOTONIC, &start);
 
-    if (reply.negative_replies != 0 || reply.positive_replies == 0)
-        goto cancel;
+        dest.process_id = getpid(); /* Send to current process only */
+        dest.token_type = EVENT_TOK_TYPE_CCA | EVENT_TOK_TYPE_EP11;
+        memcpy(dest.token_label, tokens[i].info.label,
+               sizeof(dest.token_label)); /* selected token only */
+
+        memset(&reply, 0, sizeof(reply));
+
+        rc = send_event(event_fd, EVENT_TYPE_MK_CHANGE_REENCIPHER,
+                        EVENT_FLAGS_REPLY_REQ, payload_len, (char *)payload,
+                        &dest, &reply);
+        if (rc != 0) {
+            warnx("Failed to send event: %d", rc);
+            rc = EIO;
+            goto out;
+        }
+
+        TRACE_DEVEL("Positive: %lu\n", reply.positive_replies);
+        TRACE_DEVEL("Negative: %lu\n", reply.negative_replies);
+        TRACE_DEVEL("Not handled: %lu\n", reply.nothandled_replies);
+
+        if (reply.negative_replies != 0 || reply.positive_replies != 1)
+            goto cancel;
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        print_throughput(tokens[i].id, num_objs, &start, &end);
+
+        rc = checkpoint_slot_done(tokens[i].id);
+        if (rc != 0)
+            goto out;
+    }
 
 out:
     free(payload);
@@ -789,6 +942,8 @@ cancel:
 
 static int perform_reencipher(void)
 {
+    struct timespec start, end;
+    long elapsed_ms;
     unsigned int i;
     int rc;
 
@@ -887,12 +1042,19 @@ static int perform_reencipher(void)
 
     printf("Re-enciphering, please wait...\n");
 
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
     /* Let each affected token reencipher its keys */
-    rc =  reencipher_tokens();
+    rc =  reencipher_tokens(false);
     if (rc != 0)
         goto error;
 
-    printf("Completed.\n");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 +
+                 (end.tv_nsec - start.tv_nsec) / 1000000;
+
+    printf("Completed in %ld.%03ld seconds.\n", elapsed_ms / 1000,
+           elapsed_ms % 1000);
 
     /* Update MK operation state */
     op.state = HSM_MK_CH_STATE_REENCIPHERED;
@@ -921,6 +1083,111 @@ error:
     return rc;
 }
 
+/*
+ * Resumes a re-encipher run that has been interrupted, e.g. because the tool
+ * was killed or the system crashed. Only those tokens are processed whose
+ * token objects have not yet been completely re-enciphered.
+ */
+static int perform_reencipher_resume(void)
+{
+    struct timespec start, end;
+    long elapsed_ms;
+    unsigned int i, k;
+    CK_RV rv;
+    int rc;
+
+    TRACE_DEVEL("ID: '%s'\n", id);
+
+    rv = load_mk_change_op(id);
+    if (rv != CKR_OK) {
+        warnx("HSM master key change operation '%s' not found.", id);
+        return ENOENT;
+    }
+
+    if (op.state != HSM_MK_CH_STATE_REENCIPHERING) {
+        warnx("The HSM master key change operation '%s' is in a state where\n"
+              "it can not be resumed.", id);
+        return EINVAL;
+    }
+
+    num_affected_slots = 0;
+    for (i = 0; i < op.num_slots; i++) {
+        if (slot_done(op.slots[i]))
+            continue;
+
+        for (k = 0; k < num_tokens; k++) {
+            if (tokens[k].id == op.slots[i])
+                break;
+        }
+        if (k >= num_tokens || tokens[k].present == false) {
+            warnx("The token in slot %lu is not present.", op.slots[i]);
+            return ENODEV;
+        }
+
+        tokens[k].affected = true;
+        num_affected_slots++;
+    }
+
+    /* The token object events are addressed by the token label */
+    for (i = 0; i < num_tokens; i++) {
+        if (tokens[i].affected == false)
+            continue;
+        for (k = 0; k < num_tokens; k++) {
+            if (k != i && tokens[k].present &&
+                memcmp(tokens[k].info.label, tokens[i].info.label,
+                       sizeof(tokens[i].info.label)) == 0) {
+                warnx("The token in slot %lu uses the same label as the token "
+                      "in slot %lu.", tokens[k].id, tokens[i].id);
+                return EINVAL;
+            }
+        }
+    }
+
+    printf("The following tokens still need to be re-enciphered:\n");
+    for (i = 0; i < num_tokens; i++) {
+        if (tokens[i].affected == true)
+            printf("  Slot %lu: Label: %.32s\n", tokens[i].id,
+                   tokens[i].info.label);
+    }
+
+    /* Prompt for pin, login and open R/W session for each affected token */
+    rc = login_tokens();
+    if (rc != 0)
+        return rc;
+
+    printf("Resuming re-enciphering, please wait...\n");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* Let each remaining token reencipher its keys */
+    rc = reencipher_tokens(true);
+    if (rc != 0)
+        return rc;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 +
+                 (end.tv_nsec - start.tv_nsec) / 1000000;
+
+    printf("Completed in %ld.%03ld seconds.\n", elapsed_ms / 1000,
+           elapsed_ms % 1000);
+
+    /* Update MK operation state */
+    op.state = HSM_MK_CH_STATE_REENCIPHERED;
+
+    rc = save_mk_change_op();
+    if (rc != 0)
+        return rc;
+
+    printf("\nMaster key change operation '%s' resumed.\n\n", op.id);
+    printf("Once the new master keys have been set/activated:\n");
+    printf(" - If you specified EXPECTED_MKVPS in your token configuration file(s),\n"
+           "   you must now replace the old MKVPs with the new MKVPs.");
+    printf(" - Run 'pkcshsm_mk_change finalize --id %s' when the new master\n"
+           "   keys have been set/activated.\n", op.id);
+
+    return 0;
+}
+
 static int finalize_cancel_tokens(unsigned int event,
                                   enum hsm_mk_change_state state,
                                   const char *msg_cmd)
@@ -1223,6 +1490,14 @@ static CK_RV perform_list_cb(struct hsm_mk_change_op *op, void *private)
                 break;
             }
         }
+        if (op->state == HSM_MK_CH_STATE_REENCIPHERING) {
+            for (k = 0; k < op->num_slots_done; k++) {
+                if (op->slots_done[k] == op->slots[i]) {
+                    printf(" (token objects re-enciphered)");
+                    break;
+                }
+            }
+        }
         printf("\n");
 
         rc = hsm_mk_change_token_mkvps_load(op->id, op->slots[i],
@@ -1534,6 +1809,7 @@ int main(int argc, char **argv)
         {"cca-asym-mkvp", required_argument, NULL, 'S'},
         {"cca-aes-mkvp", required_argument, NULL, 'A'},
         {"cca-apka-mkvp", required_argument, NULL, 'p'},
+        {"workers", required_argument, NULL, 'w'},
         {"id", required_argument, NULL, 'i'},
         {"verbose", required_argument, NULL, 'v'},
         {"help", no_argument, NULL, 'h'},
@@ -1558,7 +1834,7 @@ int main(int argc, char **argv)
         argc--;
     }
 
-    while ((opt = getopt_long(argc, argv, "a:e:s:S:A:p:i:v:h", long_opts, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "a:e:s:S:A:p:w:i:v:h", long_opts, NULL)) != -1) {
         switch (opt) {
         case 'a':
             if (cmd != CMD_REENCIPHER) {
@@ -1625,9 +1901,20 @@ int main(int argc, char **argv)
                 goto out;
             break;
 
+        case 'w':
+            if (cmd != CMD_REENCIPHER) {
+                warnx("option -w/--workers is only valid for the 'reencipher' command");
+                exit(EXIT_FAILURE);
+            }
+            rc = parse_workers(optarg);
+            if (rc != 0)
+                goto out;
+            break;
+
         case 'i':
-            if (cmd != CMD_FINALIZE && cmd != CMD_CANCEL && cmd != CMD_LIST) {
-                warnx("option -i/--id is only valid for the 'finalize', 'cancel or 'list' command");
+            if (cmd != CMD_REENCIPHER && cmd != CMD_FINALIZE &&
+                cmd != CMD_CANCEL && cmd != CMD_LIST) {
+                warnx("option -i/--id is only valid for the 'reencipher', 'finalize', 'cancel or 'list' command");
                 exit(EXIT_FAILURE);
             }
             id = optarg;
@@ -1663,6 +1950,17 @@ int main(int argc, char **argv)
     case CMD_REENCIPHER:
         TRACE_DEVEL("Command: reencipher\n");
 
+        if (id != NULL) {
+            if (apqns != NULL || ep11_wkvp_set || cca_sym_mkvp_set ||
+                cca_asym_mkvp_set || cca_aes_mkvp_set || cca_apka_mkvp_set) {
+                warnx("option -i/--id can not be combined with options that specify the APQNs or MKVPs");
+                exit(EXIT_FAILURE);
+            }
+
+            rc = perform_reencipher_resume();
+            break;
+        }
+
         if (apqns == NULL || num_apqns == 0) {
             warnx("option -a/--apqns is required for the 'reencipher' command");
             exit(EXIT_FAILURE);
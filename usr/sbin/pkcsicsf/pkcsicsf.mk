@@ -1,6 +1,6 @@
 sbin_PROGRAMS += usr/sbin/pkcsicsf/pkcsicsf
 
-usr_sbin_pkcsicsf_pkcsicsf_LDFLAGS = -lldap -lssl -llber -lcrypto
+usr_sbin_pkcsicsf_pkcsicsf_LDFLAGS = $(OPENLDAP_LIBS) -lssl -lcrypto
 
 usr_sbin_pkcsicsf_pkcsicsf_CFLAGS =					\
 	-D_THREAD_SAFE -DDEV -DAPI -DSTDLL_NAME=\"icsf\"		\
@@ -105,6 +105,7 @@ void PopulateSlotInfo(Slot_Info_t_64 *slot_info, unsigned int *processed)
                    sizeof(sinfo[id].pk_slot.firmwareVersion));
 
             slot_info[id].version = sinfo[id].version;
+            slot_info[id].objstore = sinfo[id].objstore;
 
             slot_count++;
         }
@@ -559,6 +559,21 @@ static int config_parse_slot(const char *config_file,
             confignode_getversion(c, &sinfo[slot_no].version) == 0)
             continue;
 
+        if (strcmp(c->key, "objstore") == 0 &&
+            (str = confignode_getstr(c)) != NULL) {
+            if (strcmp(str, "files") == 0) {
+                sinfo[slot_no].objstore = OBJSTORE_FILES;
+            } else if (strcmp(str, "log") == 0) {
+                sinfo[slot_no].objstore = OBJSTORE_LOG;
+            } else {
+                ErrLog("Error parsing config file '%s': invalid object store "
+                       "'%s' at line %d, must be 'files' or 'log'\n",
+                       config_file, str, c->line);
+                return 1;
+            }
+            continue;
+        }
+
         ErrLog("Error parsing config file '%s': unexpected token '%s' "
                "at line %d: \n", config_file, c->key, c->line);
         return 1;
@@ -596,7 +611,8 @@ static int config_parse_statistics(const char *config_file,
         if (c->type == CT_BARE && strcmp(c->key, "off") == 0) {
             socketData.flags &= ~(FLAG_STATISTICS_ENABLED |
                                   FLAG_STATISTICS_IMPLICIT |
-                                  FLAG_STATISTICS_INTERNAL);
+                                  FLAG_STATISTICS_INTERNAL |
+                                  FLAG_STATISTICS_LATENCY);
             continue;
         }
         if (c->type == CT_BARE && strcmp(c->key, "on") == 0) {
@@ -611,6 +627,10 @@ static int config_parse_statistics(const char *config_file,
             socketData.flags |= FLAG_STATISTICS_INTERNAL;
             continue;
         }
+        if (c->type == CT_BARE && strcmp(c->key, "latency") == 0) {
+            socketData.flags |= FLAG_STATISTICS_LATENCY;
+            continue;
+        }
 
         ErrLog("Error parsing config file '%s': unexpected token '%s' "
                "at line %d: \n", config_file, c->key, c->line);
@@ -54,6 +54,8 @@ static void usage(char *progname)
     printf(" -d, --delete       delete your own statistics.\n");
     printf(" -D, --delete-all   delete the statistics from all users. (root user only)\n");
     printf(" -j, --json         output the statistics in JSON format.\n");
+    printf(" -f, --format FORMAT  show 'counts' (default), 'bytes' processed, or\n"
+           "                    'latency' percentiles of the crypto operations.\n");
     printf(" -h, --help         display help information.\n");
 
     return;
@@ -118,7 +120,7 @@ static int open_shm(uid_t user_id, const char *user_name,
         return 1;
     }
 
-    *shm_size = num_slots * STAT_SLOT_SIZE;
+    *shm_size = STAT_NUM_SHARDS * num_slots * STAT_SLOT_SIZE;
 
     if ((CK_ULONG)stat_buf.st_size != *shm_size) {
         warnx("Failed to open statistics for user '%s': SHM '%s' has wrong size",
@@ -148,6 +150,31 @@ static void close_shm(CK_BYTE *shm_data, CK_ULONG shm_size)
      munmap(shm_data, shm_size);
 }
 
+/*
+ * Sums up the counter shards of a statistics shared memory segment into a
+ * newly allocated buffer that has the layout of a single shard.
+ */
+static CK_BYTE *fold_shards(const CK_BYTE *shm_data, CK_ULONG shm_size)
+{
+    CK_ULONG shard_size = shm_size / STAT_NUM_SHARDS, i, k;
+    const counter_t *shard;
+    counter_t *sum;
+
+    sum = calloc(1, shard_size);
+    if (sum == NULL) {
+        warnx("Failed to allocate the statistics buffer");
+        return NULL;
+    }
+
+    for (i = 0; i < STAT_NUM_SHARDS; i++) {
+        shard = (const counter_t *)(shm_data + i * shard_size);
+        for (k = 0; k < shard_size / sizeof(counter_t); k++)
+            sum[k] += shard[k];
+    }
+
+    return (CK_BYTE *)sum;
+}
+
 typedef int (*user_f)(int user_id, const char *user_name, void *private);
 
 static int for_all_users(user_f user_cb, void *cb_private)
@@ -226,10 +253,9 @@ static int for_all_slots(slot_f slot_cb, void *cb_private,
 static bool all_conters_zero(CK_BYTE *mech_data, CK_ULONG mech_size)
 {
     counter_t *counter = (counter_t *)mech_data;
-    int i;
+    CK_ULONG i;
 
-    for (i = 0; i < NUM_SUPPORTED_STRENGTHS + 1 &&
-                i * sizeof(counter_t) < mech_size; i++) {
+    for (i = 0; i < mech_size / sizeof(counter_t); i++) {
         if (counter[i] != 0)
             return false;
     }
@@ -309,14 +335,17 @@ static int reset_shm(uid_t user_id, const char *user_name,
 {
     int rc = 0;
     CK_BYTE *shm_data = NULL;
-    CK_ULONG shm_size = 0;
+    CK_ULONG shm_size = 0, shard_size, i;
 
     rc = open_shm(user_id, user_name, num_slots, &shm_data, &shm_size);
     if (rc != 0)
         return rc;
 
-    rc = for_all_slots(reset_slot_cb, NULL, shm_data, shm_size,
-                       num_slots, slots, slot_id_specified, slot_id);
+    shard_size = shm_size / STAT_NUM_SHARDS;
+    for (i = 0; i < STAT_NUM_SHARDS && rc == 0; i++)
+        rc = for_all_slots(reset_slot_cb, NULL, &shm_data[i * shard_size],
+                           shard_size, num_slots, slots,
+                           slot_id_specified, slot_id);
 
     if (rc == 0) {
         if (slot_id_specified)
@@ -409,22 +438,104 @@ int get_token_infos(CK_FUNCTION_LIST_PTR func_list, CK_SLOT_ID slot,
     return 0;
 }
 
+enum stat_format {
+    FORMAT_COUNTS,
+    FORMAT_BYTES,
+    FORMAT_LATENCY,
+};
+
 struct display_mech {
     bool json;
     bool first_mech;
+    enum stat_format format;
 };
 
+/*
+ * Returns the index of the latency bucket that contains the specified
+ * percentile (in per mille) of the samples.
+ */
+static int latency_percentile(const counter_t *latency, counter_t samples,
+                              unsigned int per_mille)
+{
+    counter_t sum = 0;
+    int i;
+
+    for (i = 0; i < STAT_LATENCY_BUCKETS - 1; i++) {
+        sum += latency[i];
+        if (sum * 1000 >= samples * per_mille)
+            break;
+    }
+
+    return i;
+}
+
+static void print_latency_bucket(int bucket)
+{
+    char buf[32];
+
+    if (bucket == STAT_LATENCY_BUCKETS - 1)
+        snprintf(buf, sizeof(buf), ">%lu us", 1UL << (bucket - 1));
+    else
+        snprintf(buf, sizeof(buf), "<%lu us", 1UL << bucket);
+    printf(" %15s", buf);
+}
+
+static void display_mech_latency(const struct stat_counter *counter,
+                                 CK_ULONG num_counters,
+                                 struct display_mech *dm)
+{
+    static const unsigned int percentiles[] = { 500, 900, 990, 999 };
+    counter_t latency[STAT_LATENCY_BUCKETS] = { 0 };
+    counter_t samples = 0;
+    CK_ULONG i;
+    int k;
+
+    if (dm->json) {
+        for (i = 0; i < num_counters; i++) {
+            printf("\t\t\t\t\t\t\t\"strength-%lu\": [",
+                   i == 0 ? 0 : supportedstrengths[NUM_SUPPORTED_STRENGTHS - i]);
+            for (k = 0; k < STAT_LATENCY_BUCKETS; k++)
+                printf("%lu%s", counter[i].latency[k],
+                       k == STAT_LATENCY_BUCKETS - 1 ? "" : ", ");
+            printf("]%s\n", i == NUM_SUPPORTED_STRENGTHS ? "" : ",");
+        }
+        return;
+    }
+
+    /* The table shows the percentiles over all strengths */
+    for (i = 0; i < num_counters; i++) {
+        for (k = 0; k < STAT_LATENCY_BUCKETS; k++) {
+            latency[k] += counter[i].latency[k];
+            samples += counter[i].latency[k];
+        }
+    }
+
+    printf(" %15lu", samples);
+    for (k = 0; k < (int)(sizeof(percentiles) / sizeof(percentiles[0])); k++) {
+        if (samples == 0)
+            printf(" %15s", "-");
+        else
+            print_latency_bucket(latency_percentile(latency, samples,
+                                                    percentiles[k]));
+    }
+}
+
 static int display_mech_cb(CK_MECHANISM_TYPE mech, const char *mech_name,
                            CK_BYTE *mech_data, CK_ULONG mech_size,
                            CK_ULONG ofs, void *private)
 {
-    counter_t *counter = (counter_t *)mech_data;
+    struct stat_counter *counter = (struct stat_counter *)mech_data;
     struct display_mech *dm = private;
-    int i;
+    CK_ULONG i, num_counters;
+    counter_t value;
 
     UNUSED(mech);
     UNUSED(ofs);
 
+    num_counters = mech_size / sizeof(struct stat_counter);
+    if (num_counters > NUM_SUPPORTED_STRENGTHS + 1)
+        num_counters = NUM_SUPPORTED_STRENGTHS + 1;
+
     if (dm->json && dm->first_mech == false)
         printf(",");
 
@@ -433,14 +544,20 @@ static int display_mech_cb(CK_MECHANISM_TYPE mech, const char *mech_name,
     else
         printf("%-30s |", mech_name);
 
-    for (i = 0; i < NUM_SUPPORTED_STRENGTHS + 1 &&
-                 i * sizeof(counter_t) < mech_size; i++) {
-        if (dm->json)
-            printf("\t\t\t\t\t\t\t\"strength-%lu\": %lu%s\n",
-                   i == 0 ? 0 : supportedstrengths[NUM_SUPPORTED_STRENGTHS - i],
-                   counter[i], i == NUM_SUPPORTED_STRENGTHS ? "" : ",");
-        else
-            printf(" %15lu", counter[i]);
+    if (dm->format == FORMAT_LATENCY) {
+        display_mech_latency(counter, num_counters, dm);
+    } else {
+        for (i = 0; i < num_counters; i++) {
+            value = dm->format == FORMAT_BYTES ? counter[i].bytes :
+                                                 counter[i].count;
+            if (dm->json)
+                printf("\t\t\t\t\t\t\t\"strength-%lu\": %lu%s\n",
+                       i == 0 ? 0 :
+                           supportedstrengths[NUM_SUPPORTED_STRENGTHS - i],
+                       value, i == NUM_SUPPORTED_STRENGTHS ? "" : ",");
+            else
+                printf(" %15lu", value);
+        }
     }
 
     if (dm->json)
@@ -460,6 +577,7 @@ struct display_data {
     CK_SLOT_ID slot_id;
     bool all_mechs;
     bool json;
+    enum stat_format format;
     bool first_user;
     bool first_slot;
 };
@@ -474,17 +592,31 @@ static void print_horizontal_line(void)
     printf("-\n");
 }
 
-static void print_header(void)
+static void print_header(enum stat_format format)
 {
     int i;
 
     print_horizontal_line();
-    printf("mechanism                      | strength 0      ");
-    for (i = 0; i < NUM_SUPPORTED_STRENGTHS; i++)
-        printf("strength %-5lu  ",
-               supportedstrengths[NUM_SUPPORTED_STRENGTHS - 1 - i]);
-    printf("\n");
-    printf("                               | or no key\n");
+    switch (format) {
+    case FORMAT_LATENCY:
+        printf("mechanism                      | operations      "
+               "50th perc.      90th perc.      99th perc.      "
+               "99.9th perc.\n");
+        printf("                               | (all strengths)\n");
+        break;
+    case FORMAT_BYTES:
+    case FORMAT_COUNTS:
+        printf("mechanism                      | strength 0      ");
+        for (i = 0; i < NUM_SUPPORTED_STRENGTHS; i++)
+            printf("strength %-5lu  ",
+                   supportedstrengths[NUM_SUPPORTED_STRENGTHS - 1 - i]);
+        printf("\n");
+        if (format == FORMAT_BYTES)
+            printf("(bytes processed)              | or no key\n");
+        else
+            printf("                               | or no key\n");
+        break;
+    }
     print_horizontal_line();
 }
 
@@ -497,7 +629,8 @@ static void print_footer(void)
 
 static int display_slot_stats(CK_FUNCTION_LIST *func_list, CK_SLOT_ID slot,
                               CK_BYTE *slot_data, CK_ULONG slot_size,
-                              bool all_mechs, bool json, bool *first)
+                              bool all_mechs, bool json,
+                              enum stat_format format, bool *first)
 {
     char label[33], model[33];
     struct display_mech dm;
@@ -532,9 +665,10 @@ static int display_slot_stats(CK_FUNCTION_LIST *func_list, CK_SLOT_ID slot,
     if (json)
         printf("\t\t\t\t\t\"mechanisms\": [");
     else
-        print_header();
+        print_header(format);
 
     dm.json = json;
+    dm.format = format;
     dm.first_mech = true;
     rc = for_each_mech(display_mech_cb, &dm, slot_data, slot_size, all_mechs);
     if (rc < 0) {
@@ -560,20 +694,26 @@ static int display_slot_cb(CK_SLOT_ID slot_id, CK_BYTE *slot_data,
     struct display_data *dd = private;
 
     return display_slot_stats(dd->func_list, slot_id, slot_data, slot_size,
-                              dd->all_mechs, dd->json, &dd->first_slot);
+                              dd->all_mechs, dd->json, dd->format,
+                              &dd->first_slot);
 }
 
 static int display_stats(int user_id, const char *user_name,
                          struct display_data* dd)
 {
     int rc = 0;
-    CK_BYTE *shm_data = NULL;
+    CK_BYTE *shm_data = NULL, *stat_data;
     CK_ULONG shm_size = 0;
 
     rc = open_shm(user_id, user_name, dd->num_slots, &shm_data, &shm_size);
     if (rc != 0)
         return rc;
 
+    stat_data = fold_shards(shm_data, shm_size);
+    close_shm(shm_data, shm_size);
+    if (stat_data == NULL)
+        return 1;
+
     if (dd->json) {
         if (!dd->first_user)
             printf(",\n");
@@ -583,15 +723,15 @@ static int display_stats(int user_id, const char *user_name,
     }
 
     dd->first_slot = true;
-    rc = for_all_slots(display_slot_cb, dd, shm_data, shm_size,
-                       dd->num_slots, dd->slots,
+    rc = for_all_slots(display_slot_cb, dd, stat_data,
+                       shm_size / STAT_NUM_SHARDS, dd->num_slots, dd->slots,
                        dd->slot_id_specified, dd->slot_id);
 
     if (dd->json)
         printf("\n\t\t\t]\n\t\t}");
     dd->first_user = false;
 
-    close_shm(shm_data, shm_size);
+    free(stat_data);
     return rc;
 }
 
@@ -615,22 +755,20 @@ static int summary_mech_cb(CK_MECHANISM_TYPE mech, const char *mech_name,
     struct summary_data *sd = private;
     counter_t *slot_counter = (counter_t *)mech_data;
     counter_t *sum_counter;
-    int i;
+    CK_ULONG i;
 
     UNUSED(mech);
     UNUSED(mech_name);
 
     ofs += sd->slot_id * STAT_SLOT_SIZE;
-    if (ofs + (NUM_SUPPORTED_STRENGTHS + 1) * sizeof(counter_t) >
-                                                        sd->summary_size) {
+    if (ofs + mech_size > sd->summary_size) {
         warnx("Internal error: mechanism offset larger than summary size");
         return 1;
     }
 
     sum_counter = (counter_t *)(&sd->summary_data[ofs]);
 
-    for (i = 0; i < NUM_SUPPORTED_STRENGTHS + 1 &&
-                i * sizeof(counter_t) < mech_size; i++)
+    for (i = 0; i < mech_size / sizeof(counter_t); i++)
         sum_counter[i] += slot_counter[i];
 
     return 0;
@@ -653,17 +791,23 @@ static int display_summary_cb(int user_id, const char *user_name, void *private)
 {
     struct summary_data *sd = private;
     int rc = 0;
-    CK_BYTE *shm_data = NULL;
+    CK_BYTE *shm_data = NULL, *stat_data;
     CK_ULONG shm_size = 0;
 
     rc = open_shm(user_id, user_name, sd->num_slots, &shm_data, &shm_size);
     if (rc != 0)
         return rc;
 
-    rc = for_all_slots(summary_slot_cb, sd, shm_data, shm_size,
-                       sd->num_slots, sd->slots, false, 0);
-
+    stat_data = fold_shards(shm_data, shm_size);
     close_shm(shm_data, shm_size);
+    if (stat_data == NULL)
+        return 1;
+
+    rc = for_all_slots(summary_slot_cb, sd, stat_data,
+                       shm_size / STAT_NUM_SHARDS, sd->num_slots, sd->slots,
+                       false, 0);
+
+    free(stat_data);
     return rc;
 
 }
@@ -789,6 +933,7 @@ int main(int argc, char **argv)
     bool delete = false, delete_all = false;
     bool slot_id_specified = false;
     bool json = false, json_started = false;
+    enum stat_format format = FORMAT_COUNTS;
     CK_SLOT_ID slot_id = 0;
     void *dll = NULL;
     CK_FUNCTION_LIST *func_list = NULL;
@@ -810,11 +955,12 @@ int main(int argc, char **argv)
         {"delete", no_argument, NULL, 'd'},
         {"delete-all", no_argument, NULL, 'D'},
         {"json", no_argument, NULL, 'j'},
+        {"format", required_argument, NULL, 'f'},
         {"help", no_argument, NULL, 'h'},
         {0, 0, 0, 0}
     };
 
-    while ((opt = getopt_long(argc, argv, "U:SAas:rRdDjh", long_opts, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "U:SAas:rRdDjf:h", long_opts, NULL)) != -1) {
         switch (opt) {
         case 'U':
             if ((pswd = getpwnam(optarg)) == NULL) {
@@ -877,6 +1023,18 @@ int main(int argc, char **argv)
         case 'j':
             json = true;
             break;
+        case 'f':
+            if (strcmp(optarg, "counts") == 0) {
+                format = FORMAT_COUNTS;
+            } else if (strcmp(optarg, "bytes") == 0) {
+                format = FORMAT_BYTES;
+            } else if (strcmp(optarg, "latency") == 0) {
+                format = FORMAT_LATENCY;
+            } else {
+                warnx("Format parameter invalid: '%s'", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
         case 'h':
             usage(basename(argv[0]));
             exit(EXIT_SUCCESS);
@@ -969,6 +1127,7 @@ int main(int argc, char **argv)
     dd.slot_id = slot_id;
     dd.all_mechs = all_mechs;
     dd.json = json;
+    dd.format = format;
     dd.first_user = true;
     if (all_users) {
         rc = for_all_users(display_all_cb, &dd);
@@ -41,6 +41,7 @@
 #include "local_types.h"
 #include "h_extern.h"
 #include "slotmgr.h" // for ock_snprintf
+#include "logstore.h"
 
 #define OCK_TOOL
 #include "pkcs_utils.h"
@@ -2000,6 +2001,125 @@ done:
     return ret;
 }
 
+/**
+ * Moves the token objects listed in OBJ.IDX into the log-structured object
+ * store OBJ.LOG of the given data store. The log store holds the same object
+ * format as the object files, so the objects are copied unchanged. The object
+ * files and OBJ.IDX are removed once all objects are safely in the log.
+ */
+static CK_RV convert_to_logstore(const char *data_store)
+{
+    char iname[PATH_MAX], fname[PATH_MAX], tmp[PATH_MAX];
+    unsigned char *obj = NULL;
+    logstore_t *ls = NULL;
+    struct stat sb;
+    FILE *fp = NULL, *fp_obj = NULL;
+    int count = 0;
+    CK_RV ret;
+
+    TRACE_INFO("Converting token objects to the log object store ...\n");
+
+    if (ock_snprintf(iname, sizeof(iname), "%s/TOK_OBJ/OBJ.IDX",
+                     data_store) != 0 ||
+        ock_snprintf(fname, sizeof(fname), "%s/TOK_OBJ/%s", data_store,
+                     PK_LITE_OBJ_LOG) != 0) {
+        TRACE_ERROR("Path overflow for data store %s\n", data_store);
+        return CKR_FUNCTION_FAILED;
+    }
+
+    ret = logstore_open(fname, set_perm, &ls);
+    if (ret != CKR_OK) {
+        TRACE_ERROR("Cannot open %s, ret=%08lX\n", fname, ret);
+        return ret;
+    }
+
+    fp = fopen(iname, "r");
+    if (!fp) {
+        TRACE_INFO("Cannot open %s, datastore probably empty.\n", iname);
+        ret = CKR_OK;
+        goto done;
+    }
+
+    /* Copy the objects into the log */
+    while (fgets(tmp, PATH_MAX, fp)) {
+        tmp[strlen(tmp) - 1] = 0;
+        if (strlen(tmp) != LOGSTORE_NAME_LEN) {
+            TRACE_ERROR("Invalid object name '%s' in %s\n", tmp, iname);
+            ret = CKR_FUNCTION_FAILED;
+            goto done;
+        }
+
+        fp_obj = open_tokenobject(fname, sizeof(fname), data_store, "TOK_OBJ",
+                                  tmp, "r");
+        if (!fp_obj) {
+            ret = CKR_FUNCTION_FAILED;
+            goto done;
+        }
+        if (fstat(fileno(fp_obj), &sb) != 0) {
+            TRACE_ERROR("fstat(%s) failed, errno=%s\n", fname, strerror(errno));
+            ret = CKR_FUNCTION_FAILED;
+            goto done;
+        }
+
+        obj = malloc(sb.st_size > 0 ? sb.st_size : 1);
+        if (!obj) {
+            TRACE_ERROR("Cannot malloc %ld bytes\n", (long)sb.st_size);
+            ret = CKR_HOST_MEMORY;
+            goto done;
+        }
+        if (fread(obj, sb.st_size, 1, fp_obj) != 1 && sb.st_size > 0) {
+            TRACE_ERROR("Cannot read %s\n", fname);
+            ret = CKR_FUNCTION_FAILED;
+            goto done;
+        }
+        fclose(fp_obj);
+        fp_obj = NULL;
+
+        ret = logstore_put(ls, (CK_BYTE *)tmp, obj, sb.st_size);
+        if (ret != CKR_OK) {
+            TRACE_ERROR("Cannot add object %s to the log, ret=%08lX\n",
+                        tmp, ret);
+            goto done;
+        }
+        free(obj);
+        obj = NULL;
+        count++;
+    }
+
+    ret = logstore_sync(ls);
+    if (ret != CKR_OK) {
+        TRACE_ERROR("Cannot sync the log, ret=%08lX\n", ret);
+        goto done;
+    }
+
+    /* All objects are in the log now, remove the object files */
+    rewind(fp);
+    while (fgets(tmp, PATH_MAX, fp)) {
+        tmp[strlen(tmp) - 1] = 0;
+        if (ock_snprintf(fname, sizeof(fname), "%s/TOK_OBJ/%s",
+                         data_store, tmp) != 0 || remove(fname) != 0)
+            TRACE_WARN("Cannot remove %s, errno=%s\n", fname, strerror(errno));
+    }
+    if (remove(iname) != 0) {
+        TRACE_ERROR("Cannot remove %s, errno=%s\n", iname, strerror(errno));
+        ret = CKR_FUNCTION_FAILED;
+        goto done;
+    }
+
+    TRACE_NONE("Converted %d object(s) to the log object store.\n", count);
+    ret = CKR_OK;
+
+done:
+    if (fp_obj)
+        fclose(fp_obj);
+    if (fp)
+        fclose(fp);
+    free(obj);
+    logstore_close(ls);
+
+    return ret;
+}
+
 /**
  * Switch to new repository by deleting the old repository and renaming
  * the backup folder to the original data store name.
@@ -2038,19 +2158,23 @@ done:
 }
 
 /**
- * Inserts the new tokversion parm in the token's slot configuration, e.g.
+ * Inserts the new tokversion parm in the token's slot configuration, and the
+ * objstore parm if the token was converted to the log object store, e.g.
  *
  *   slot 2
  *   {
  *     stdll = libpkcs11_cca.so
  *     tokversion = 3.12
+ *     objstore = log
  *   }
  */
-static CK_RV update_opencryptoki_conf(CK_SLOT_ID slot_id, char *location)
+static CK_RV update_opencryptoki_conf(CK_SLOT_ID slot_id, char *location,
+                                      CK_BBOOL logstore)
 {
     char dst_file[PATH_MAX], src_file[PATH_MAX], fname[PATH_MAX+20];
     struct ConfigBaseNode *config = NULL, *c;
     struct ConfigVersionValNode *v;
+    struct ConfigBareValNode *b;
     struct ConfigIdxStructNode *slot;
     FILE *fp_w = NULL;
     CK_RV ret;
@@ -2110,6 +2234,47 @@ static CK_RV update_opencryptoki_conf(CK_SLOT_ID slot_id, char *location)
         confignode_append(slot->value, &v->base);
     }
 
+    if (logstore) {
+        c = confignode_find(slot->value, "objstore");
+        if (c != NULL) {
+            /* modify existing objstore */
+            if (confignode_hastype(c, CT_BAREVAL)) {
+                free(confignode_to_bareval(c)->value);
+                confignode_to_bareval(c)->value = strdup("log");
+                if (confignode_to_bareval(c)->value == NULL) {
+                    TRACE_ERROR("strdup failed\n");
+                    ret = CKR_HOST_MEMORY;
+                    goto done;
+                }
+            } else if (confignode_hastype(c, CT_STRINGVAL)) {
+                free(confignode_to_stringval(c)->value);
+                confignode_to_stringval(c)->value = strdup("log");
+                if (confignode_to_stringval(c)->value == NULL) {
+                    TRACE_ERROR("strdup failed\n");
+                    ret = CKR_HOST_MEMORY;
+                    goto done;
+                }
+            } else {
+                TRACE_ERROR("objstore is invalid in slot %lu in config file %s\n",
+                            slot_id, src_file);
+                ret = CKR_FUNCTION_FAILED;
+                goto done;
+            }
+        } else {
+            /* add new objstore */
+            b = confignode_allocbarevaldumpable("objstore", "log", 0,
+                                                " added by pkcstok_migrate");
+            if (b == NULL) {
+                TRACE_ERROR("failed to allocate config node for config file %s\n",
+                            src_file);
+                ret = CKR_HOST_MEMORY;
+                goto done;
+            }
+
+            confignode_append(slot->value, &b->base);
+        }
+    }
+
     /* Open new conf file for write */
     snprintf(dst_file, PATH_MAX, "%s/%s", location, "opencryptoki.conf_new");
     fp_w = fopen(dst_file, "w");
@@ -2549,6 +2714,8 @@ static void usage(char *progname)
     printf(" -c, --confdir CONFDIR\t\tlocation of opencryptoki.conf (required)\n");
     printf(" -u, --userpin USERPIN\t\ttoken user pin (prompted if not specified)\n");
     printf(" -p, --sopin SOPIN\t\ttoken SO pin (prompted if not specified)\n");
+    printf(" -l, --logstore\t\t\tconvert the token objects to the log object\n");
+    printf("\t\t\t\tstore (optional)\n");
     printf(" -v, --verbose LEVEL\t\tset verbose level (optional):\n");
     printf("\t\t\t\tnone (default), error, warn, info, devel, debug\n");
     return;
@@ -2560,6 +2727,7 @@ int main(int argc, char **argv)
     int opt = 0, vlevel = -1;
     CK_SLOT_ID slot_id = 0;
     CK_BBOOL slot_id_specified = CK_FALSE;
+    CK_BBOOL logstore = CK_FALSE;
     size_t buflen = 0;
     ssize_t num_chars;
     char *data_store = NULL, *data_store_old = NULL, *conf_dir = NULL;
@@ -2569,6 +2737,8 @@ int main(int argc, char **argv)
     char *buff = NULL;
     char dll_name[PATH_MAX];
     char data_store_new[PATH_MAX];
+    char fname[PATH_MAX];
+    struct stat sb;
     CK_TOKEN_INFO_32 tokinfo;
     CK_BBOOL new;
 
@@ -2578,12 +2748,13 @@ int main(int argc, char **argv)
         {"slotid", required_argument, NULL, 's'},
         {"userpin", required_argument, NULL, 'u'},
         {"sopin", required_argument, NULL, 'p'},
+        {"logstore", no_argument, NULL, 'l'},
         {"verbose", required_argument, NULL, 'v'},
         {"help", no_argument, NULL, 'h'},
         {0, 0, 0, 0}
     };
 
-    while ((opt = getopt_long(argc, argv, "d:c:s:u:p:v:h", long_opts, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "d:c:s:u:p:lv:h", long_opts, NULL)) != -1) {
         switch (opt) {
         case 'd':
             data_store = strdup(optarg);
@@ -2609,6 +2780,9 @@ int main(int argc, char **argv)
         case 'p':
             sopin = optarg;
             break;
+        case 'l':
+            logstore = CK_TRUE;
+            break;
         case 'v':
             verbose = strdup(optarg);
             if (verbose == NULL) {
@@ -2658,6 +2832,8 @@ int main(int argc, char **argv)
         printf("  user PIN specified\n");
     if (sopin)
         printf("  SO PIN specified\n");
+    if (logstore)
+        printf("  convert to log object store\n");
     if (vlevel >= 0) {
         trace_level = vlevel;
         printf("  verbose level = %s\n", verbose);
@@ -2787,11 +2963,22 @@ int main(int argc, char **argv)
         goto done;
     }
 
+    /* A data store using the log object store is always in new format */
+    snprintf(fname, PATH_MAX, "%s/TOK_OBJ/%s", data_store, PK_LITE_OBJ_LOG);
+    if (stat(fname, &sb) == 0) {
+        printf("Data store %s is already in new format and uses the log "
+               "object store.\n", data_store);
+        logstore = CK_TRUE;
+        goto finalize;
+    }
+
     /* Check if data store is already new */
     ret = datastore_is_312(data_store, sopin, userpin, &new);
-    if (ret == 0 && new) {
+    new = (ret == 0 && new);
+    if (new) {
         printf("Data store %s is already in new format.\n", data_store);
-        goto finalize;
+        if (!logstore)
+            goto finalize;
     }
 
     /* Backup repository if not already done */
@@ -2805,6 +2992,10 @@ int main(int argc, char **argv)
     data_store_old = data_store;
     snprintf(data_store_new, PATH_MAX, "%s_PKCSTOK_MIGRATE_TMP", data_store_old);
 
+    /* Only the conversion to the log object store is left to do */
+    if (new)
+        goto convert;
+
     /* Create new temp token keys, which exist in parallel to the old ones
      * until the migration is fully completed. */
     ret = create_token_keys_312(data_store_new, sopin, userpin);
@@ -2820,6 +3011,16 @@ int main(int argc, char **argv)
         goto done;
     }
 
+convert:
+    /* Move the token objects into the log object store */
+    if (logstore) {
+        ret = convert_to_logstore(data_store_new);
+        if (ret != CKR_OK) {
+            warnx("Failed to convert to the log object store.");
+            goto done;
+        }
+    }
+
     /* Switch to new repository */
     ret = switch_to_new_repository(data_store_old, data_store_new);
     if (ret != CKR_OK) {
@@ -2836,7 +3037,7 @@ finalize:
     }
 
     /* Now insert new 'tokversion=3.12' parm in opencryptoki.conf */
-    ret = update_opencryptoki_conf(slot_id, conf_dir);
+    ret = update_opencryptoki_conf(slot_id, conf_dir, logstore);
     if (ret != CKR_OK) {
         warnx("Failed to update opencryptoki.conf, you must do this manually.");
         goto done;
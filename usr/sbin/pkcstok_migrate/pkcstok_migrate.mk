@@ -18,6 +18,7 @@ usr_sbin_pkcstok_migrate_pkcstok_migrate_SOURCES =		\
 	usr/lib/common/trace.c 					\
 	usr/lib/common/pkcs_utils.c				\
 	usr/lib/common/pin_prompt.c				\
+	usr/lib/common/logstore.c				\
 	usr/sbin/pkcstok_migrate/pkcstok_migrate.c		\
 	usr/lib/config/configuration.c				\
 	usr/lib/config/cfgparse.y 				\